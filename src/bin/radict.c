@@ -58,7 +58,9 @@ static void usage(void)
 {
 	fprintf(stderr, "usage: radict [OPTS] <attribute> [attribute...]\n");
 	fprintf(stderr, "  -A               Export aliases.\n");
+	fprintf(stderr, "  -B               Compare load times with and without dictionary images.\n");
 	fprintf(stderr, "  -c               Print out in CSV format.\n");
+	fprintf(stderr, "  -C               Generate dictionary images for faster loading.\n");
 	fprintf(stderr, "  -D <dictdir>     Set main dictionary directory (defaults to " DICTDIR ").\n");
 	fprintf(stderr, "  -f               Export dictionary definitions in the normal dictionary format\n");
 	fprintf(stderr, "  -E               Export dictionary definitions.\n");
@@ -150,6 +152,71 @@ static int load_dicts(char const *dict_dir, char const *protocol)
 	return 0;
 }
 
+#define RADICT_BENCH_ROUNDS	5
+
+/** Load the internal and protocol dictionaries, and then free them again
+ *
+ * A new global context is used for each load, so nothing is cached
+ * from the previous one.
+ */
+static int bench_dicts(fr_time_delta_t *out, bool read, bool write, char const *dict_dir, char const *protocol)
+{
+	fr_dict_gctx_t	*gctx;
+	fr_time_t	start;
+	int		ret = -1;
+
+	gctx = fr_dict_global_ctx_init(NULL, false, dict_dir);
+	if (!gctx) return -1;
+
+	fr_dict_global_ctx_set(gctx);
+	fr_dict_global_ctx_images(gctx, read, write);
+
+	start = fr_time();
+	if (fr_dict_internal_afrom_file(dict_end, FR_DICTIONARY_INTERNAL_DIR, __FILE__) < 0) goto finish;
+	dict_end++;
+
+	if (load_dicts(dict_dir, protocol) < 0) goto finish;
+	*out = fr_time_sub(fr_time(), start);
+	ret = 0;
+
+finish:
+	while (dict_end > dicts) {
+		dict_end--;
+		fr_dict_free(dict_end, __FILE__);
+		*dict_end = NULL;
+	}
+	if (fr_dict_global_ctx_free(gctx) < 0) ret = -1;
+
+	return ret;
+}
+
+/** Compare loading the dictionaries from text files and from images
+ *
+ * Images are (re)generated first, and the best time from several
+ * rounds is reported for each, so that both benefit from a warm
+ * page cache.
+ */
+static int bench(char const *dict_dir, char const *protocol)
+{
+	fr_time_delta_t	text = fr_time_delta_wrap(INT64_MAX), image = fr_time_delta_wrap(INT64_MAX), delta;
+	int		i;
+
+	if (bench_dicts(&delta, false, true, dict_dir, protocol) < 0) return -1;
+
+	for (i = 0; i < RADICT_BENCH_ROUNDS; i++) {
+		if (bench_dicts(&delta, false, false, dict_dir, protocol) < 0) return -1;
+		if (fr_time_delta_lt(delta, text)) text = delta;
+
+		if (bench_dicts(&delta, true, false, dict_dir, protocol) < 0) return -1;
+		if (fr_time_delta_lt(delta, image)) image = delta;
+	}
+
+	printf("text\t%" PRIu64 " us\n", (uint64_t) fr_time_delta_to_usec(text));
+	printf("image\t%" PRIu64 " us\n", (uint64_t) fr_time_delta_to_usec(image));
+
+	return 0;
+}
+
 static void da_print_info_td(fr_dict_t const *dict, fr_dict_attr_t const *da)
 {
 	char 			oid_str[512];
@@ -297,7 +364,10 @@ int main(int argc, char *argv[])
 	bool			export = false;
 	bool			file_export = false;
 	bool			alias = false;
+	bool			compile = false;
+	bool			benchmark = false;
 	char const		*protocol = NULL;
+	fr_dict_gctx_t		*gctx;
 
 	TALLOC_CTX		*autofree;
 
@@ -320,15 +390,23 @@ int main(int argc, char *argv[])
 	fr_debug_lvl = 1;
 	fr_log_fp = stdout;
 
-	while ((c = getopt(argc, argv, "AcfED:p:VxhH")) != -1) switch (c) {
+	while ((c = getopt(argc, argv, "ABcCfED:p:VxhH")) != -1) switch (c) {
 		case 'A':
 			alias = true;
 			break;
 
+		case 'B':
+			benchmark = true;
+			break;
+
 		case 'c':
 			output_format = RADICT_OUT_CSV;
 			break;
 
+		case 'C':
+			compile = true;
+			break;
+
 		case 'H':
 			print_headers = true;
 			break;
@@ -375,12 +453,36 @@ int main(int argc, char *argv[])
 		goto finish;
 	}
 
-	if (!fr_dict_global_ctx_init(NULL, true, dict_dir)) {
+	/*
+	 *	The benchmark loads the dictionaries several
+	 *	times, each with its own global context.
+	 */
+	if (benchmark) {
+		fr_time_start();
+
+		INFO("Benchmarking dictionaries in %s", dict_dir);
+
+		if (bench(dict_dir, protocol) < 0) {
+			fr_perror("radict - Benchmark failed");
+			ret = 1;
+		}
+		found = true;
+		goto finish;
+	}
+
+	gctx = fr_dict_global_ctx_init(NULL, true, dict_dir);
+	if (!gctx) {
 		fr_perror("radict - Global context init failed");
 		ret = 1;
 		goto finish;
 	}
 
+	/*
+	 *	Images are written next to each top level
+	 *	dictionary file as it's loaded.
+	 */
+	if (compile) fr_dict_global_ctx_images(gctx, false, true);
+
 	INFO("Loading dictionary: %s/%s", dict_dir, FR_DICTIONARY_FILE);
 
 	if (fr_dict_internal_afrom_file(dict_end++, FR_DICTIONARY_INTERNAL_DIR, __FILE__) < 0) {
@@ -392,12 +494,18 @@ int main(int argc, char *argv[])
 	 *	Don't emit spurious errors...
 	 */
 	fr_strerror_clear();
+
 	if (load_dicts(dict_dir, protocol) < 0) {
 		fr_perror("radict - Loading dictionaries failed");
 		ret = 1;
 		goto finish;
 	}
 
+	if (compile) {
+		found = true;
+		goto finish;
+	}
+
 	if (dict_end == dicts) {
 		fr_perror("radict - No dictionaries loaded");
 		ret = 1;
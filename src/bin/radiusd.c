@@ -845,6 +845,8 @@ int main(int argc, char *argv[])
 		schedule->max_workers = config->max_workers;
 		schedule->max_networks = config->max_networks;
 		schedule->stats_interval = config->stats_interval;
+		schedule->network_cpus = config->network_cpus;
+		schedule->worker_cpus = config->worker_cpus;
 
 		schedule->network.max_outstanding = config->worker.max_requests;
 		schedule->worker = config->worker;
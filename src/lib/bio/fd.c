@@ -296,6 +296,117 @@ retry:
 }
 
 
+/** Allocate the batch buffers on first use
+ *
+ *  We don't know the maximum packet size until the caller reads or writes data, so the batch is
+ *  allocated lazily.
+ */
+static int fr_bio_fd_batch_init(fr_bio_fd_t *my, size_t size)
+{
+	if (size < 4096) size = 4096;
+
+	my->batch = fr_udp_batch_alloc(my, my->info.socket.fd, my->info.cfg->batch_size, size);
+	if (!my->batch) return -1;
+
+	return 0;
+}
+
+/** Read from a UDP socket, draining multiple packets per system call
+ *
+ *  Packets are read in batches via recvmmsg(), and then returned to the caller one at a time.  We get the
+ *  destination IP from IP_PKTINFO / IPV6_PKTINFO if it has been enabled on the socket.
+ */
+static ssize_t fr_bio_fd_recv_batch(fr_bio_t *bio, void *packet_ctx, void *buffer, size_t size)
+{
+	int tries = 0;
+	ssize_t rcode;
+	fr_bio_fd_t *my = talloc_get_type_abort(bio, fr_bio_fd_t);
+	fr_bio_fd_packet_ctx_t *addr = fr_bio_fd_packet_ctx(my, packet_ctx);
+	fr_socket_t socket;
+	fr_time_t when;
+
+	if (!my->batch && (fr_bio_fd_batch_init(my, size) < 0)) return fr_bio_error(GENERIC);
+
+retry:
+	rcode = fr_udp_batch_recv(my->batch, UDP_FLAGS_NONE, &socket, buffer, size, &when);
+	if (rcode > 0) {
+		ADDR_INIT;
+
+		addr->when = when;
+		addr->socket.inet.src_ipaddr = socket.inet.src_ipaddr;
+		addr->socket.inet.src_port = socket.inet.src_port;
+		addr->socket.inet.dst_ipaddr = socket.inet.dst_ipaddr;
+		addr->socket.inet.dst_port = socket.inet.dst_port;
+		if (socket.inet.ifindex) addr->socket.inet.ifindex = socket.inet.ifindex;
+	}
+
+	/*
+	 *	The batch API returns 0 for "no data", which for us means that the socket would block.
+	 */
+	if (rcode == 0) {
+		errno = EWOULDBLOCK;
+		rcode = -1;
+	}
+
+#include "fd_read.h"
+
+	return fr_bio_error(IO);
+}
+
+/** Write to a UDP socket, queueing packets for sendmmsg()
+ *
+ *  Packets are copied to the batch, and are written when the batch is full, or when the caller flushes
+ *  the bio by writing a NULL buffer.
+ */
+static ssize_t fr_bio_fd_send_batch(fr_bio_t *bio, void *packet_ctx, const void *buffer, size_t size)
+{
+	int tries = 0;
+	ssize_t rcode;
+	fr_bio_fd_t *my = talloc_get_type_abort(bio, fr_bio_fd_t);
+	fr_bio_fd_packet_ctx_t *addr = fr_bio_fd_packet_ctx(my, packet_ctx);
+	fr_socket_t socket;
+
+	if (!my->batch && (fr_bio_fd_batch_init(my, size) < 0)) return fr_bio_error(GENERIC);
+
+retry:
+	/*
+	 *	Flush any queued packets.
+	 */
+	if (!buffer) {
+		rcode = fr_udp_batch_flush(my->batch);
+		if (rcode == 0) {
+			if (my->info.write_blocked) {
+				my->info.write_blocked = false;
+
+				if (my->cb.write_resume) {
+					int error;
+
+					error = my->cb.write_resume((fr_bio_t *) my);
+					if (error < 0) return error;
+				}
+			}
+			return 0;
+		}
+
+		goto error;
+	}
+
+	fr_socket_addr_swap(&socket, &addr->socket);
+
+	rcode = fr_udp_batch_send(my->batch, &socket, UDP_FLAGS_NONE, buffer, size);
+	if (rcode < 0) goto error;
+
+	return rcode;
+
+error:
+#undef flag_blocked
+#define flag_blocked write_blocked
+#define FR_FD_BIO_EMSGSIZE (1)
+#include "fd_errno.h"
+
+	return fr_bio_error(IO);
+}
+
 #if defined(IP_PKTINFO) || defined(IP_RECVDSTADDR) || defined(IPV6_PKTINFO)
 static ssize_t fd_fd_recvfromto_common(fr_bio_fd_t *my, void *packet_ctx, void *buffer, size_t size)
 {
@@ -875,6 +986,21 @@ int fr_bio_fd_init_common(fr_bio_fd_t *my)
 		my->bio.read = fr_bio_fd_read_connected_datagram;
 		my->bio.write = fr_bio_fd_write;
 
+	} else if (my->info.cfg && (my->info.cfg->batch_size > 1)) {		//!< batched unconnected datagram
+#if defined(IP_PKTINFO) || defined(IP_RECVDSTADDR)
+		if ((my->info.socket.inet.src_ipaddr.af == AF_INET) &&
+		    fr_ipaddr_is_inaddr_any(&my->info.socket.inet.src_ipaddr) &&
+		    (fr_bio_fd_udpfromto_init4(my->info.socket.fd) < 0)) return -1;
+#endif
+#if defined(IPV6_PKTINFO)
+		if ((my->info.socket.inet.src_ipaddr.af == AF_INET6) &&
+		    fr_ipaddr_is_inaddr_any(&my->info.socket.inet.src_ipaddr) &&
+		    (fr_bio_fd_udpfromto_init6(my->info.socket.fd) < 0)) return -1;
+#endif
+
+		my->bio.read = fr_bio_fd_recv_batch;
+		my->bio.write = fr_bio_fd_send_batch;
+
 	} else if (!fr_ipaddr_is_inaddr_any(&my->info.socket.inet.src_ipaddr)) { //!< we know our IP address
 		my->bio.read = fr_bio_fd_recvfrom;
 		my->bio.write = fr_bio_fd_sendto;
@@ -1050,6 +1176,11 @@ retry:
 		}
 	}
 
+	/*
+	 *	Any queued packets are for the old socket.
+	 */
+	TALLOC_FREE(my->batch);
+
 	my->info.state = FR_BIO_FD_STATE_CLOSED;
 	my->info.read_blocked = true;
 	my->info.write_blocked = true;
@@ -100,6 +100,9 @@ typedef struct {
 	uint32_t	recv_buff;	//!< How big the kernel's receive buffer should be.
 	uint32_t	send_buff;	//!< How big the kernel's send buffer should be.
 
+	uint32_t	batch_size;	//!< for unconnected datagram sockets, read / write this many packets
+					///< per system call via recvmmsg() / sendmmsg().
+
 	char const	*path;		//!< for Unix domain sockets
 	mode_t		perm;		//!< permissions for domain sockets
 	uid_t		uid;		//!< who owns the socket
@@ -152,6 +152,8 @@ static const conf_parser_t client_udp_unconnected_sub_config[] = {
 	{ FR_CONF_OFFSET_IS_SET("recv_buff", FR_TYPE_UINT32, 0, fr_bio_fd_config_t, recv_buff) },
 	{ FR_CONF_OFFSET_IS_SET("send_buff", FR_TYPE_UINT32, 0, fr_bio_fd_config_t, send_buff) },
 
+	{ FR_CONF_OFFSET("batch_size", fr_bio_fd_config_t, batch_size) },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -297,6 +299,8 @@ static const conf_parser_t server_udp_sub_config[] = {
 	{ FR_CONF_OFFSET_IS_SET("recv_buff", FR_TYPE_UINT32, 0, fr_bio_fd_config_t, recv_buff) },
 	{ FR_CONF_OFFSET_IS_SET("send_buff", FR_TYPE_UINT32, 0, fr_bio_fd_config_t, send_buff) },
 
+	{ FR_CONF_OFFSET("batch_size", fr_bio_fd_config_t, batch_size) },
+
 #if (defined(IP_MTU_DISCOVER) && defined(IP_PMTUDISC_DONT)) || defined(IP_DONTFRAG)
 	{ FR_CONF_OFFSET("exceed_mtu", fr_bio_fd_config_t, exceed_mtu), .dflt = "yes" },
 #endif
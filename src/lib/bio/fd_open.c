@@ -976,6 +976,12 @@ int fr_bio_fd_check_config(fr_bio_fd_config_t const *cfg)
 			fr_strerror_const("No source IP address was specified");
 			return -1;
 		}
+
+		if (cfg->batch_size > FR_UDP_BATCH_MAX) {
+			fr_strerror_printf("Batch size %u is too large, it must be no more than %u",
+					   cfg->batch_size, FR_UDP_BATCH_MAX);
+			return -1;
+		}
 		break;
 
 	case FR_BIO_FD_ACCEPTED:
@@ -25,6 +25,7 @@
 RCSIDH(lib_bio_fd_privh, "$Id$")
 
 #include <freeradius-devel/util/syserror.h>
+#include <freeradius-devel/util/udp_batch.h>
 
 #include <freeradius-devel/bio/bio_priv.h>
 #include <freeradius-devel/bio/fd.h>
@@ -52,6 +53,8 @@ typedef struct fr_bio_fd_s {
 	int		max_tries;		//!< how many times we retry on EINTR
 	size_t		offset;			//!< where #fr_bio_fd_packet_ctx_t is stored
 
+	fr_udp_batch_t	*batch;			//!< for recvmmsg() / sendmmsg()
+
 #if defined(IP_PKTINFO) || defined(IP_RECVDSTADDR) || defined(IPV6_PKTINFO)
 	struct iovec	iov;			//!< for recvfromto
 	struct msghdr	msgh;			//!< for recvfromto
@@ -56,6 +56,20 @@ typedef int (*fr_app_open_t)(void *instance, fr_schedule_t *sc, CONF_SECTION *cs
  */
 typedef int (*fr_app_priority_get_t)(void const *instance, uint8_t const *buffer, size_t buflen);
 
+/** Identify the flow a packet belongs to
+ *
+ * Used by the network thread to send related packets (e.g. all rounds of
+ * an EAP conversation) to the same worker.
+ *
+ * @param[in] instance	of the #fr_app_t.
+ * @param[in] buffer	raw packet
+ * @param[in] buflen	length of the packet
+ * @return
+ *	- 0 - the packet has no flow information.
+ *	- *  - a hash identifying the flow.
+ */
+typedef uint32_t (*fr_app_affinity_get_t)(void const *instance, uint8_t const *buffer, size_t buflen);
+
 /** Called by the network thread to pass an event list for the module to use for timer events
  */
 typedef void (*fr_app_event_list_set_t)(fr_listen_t *li, fr_event_list_t *el, void *nr);
@@ -88,6 +102,9 @@ typedef struct {
 							///< to all #fr_app_io_t can be performed by the #fr_app_t.
 
 	fr_app_priority_get_t		priority;	//!< Assign a priority to the packet.
+
+	fr_app_affinity_get_t		affinity;	//!< Identify the flow the packet belongs to.
+							///< May be NULL.
 } fr_app_t;
 
 /** Public structure describing an application (protocol) specialisation
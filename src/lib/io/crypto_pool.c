@@ -0,0 +1,695 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/*
+ * $Id$
+ *
+ * @file io/crypto_pool.c
+ * @brief Run CPU intensive crypto operations outside of the worker threads.
+ *
+ * Password hashes such as PBKDF2 with a high iteration count, or bcrypt,
+ * take milliseconds of CPU time.  Running them in a worker thread stalls
+ * every other request that worker is processing.
+ *
+ * Modules instead submit a job to a shared pool of threads, and yield.
+ * When the job completes, the pool thread hands it back to the worker
+ * via a pipe registered with the worker's event list, and the request
+ * is marked runnable again.
+ *
+ * The number of jobs queued or running is capped.  Jobs submitted when
+ * the pool is full are held in a backlog by the worker which submitted
+ * them, and are passed to the pool as jobs complete.  Only if the pool
+ * is disabled are jobs run immediately in the worker.
+ *
+ * @copyright 2025 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/io/crypto_pool.h>
+#include <freeradius-devel/io/schedule.h>
+#include <freeradius-devel/server/command.h>
+#include <freeradius-devel/server/tmpl.h>
+#include <freeradius-devel/unlang/interpret.h>
+
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/syserror.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+#include <fcntl.h>
+#include <pthread.h>
+
+/** A job, owned by the worker, unless it's pending
+ *
+ */
+struct crypto_job_s {
+	fr_dlist_t		entry;			//!< In the pool's queue, or one of the worker's lists.
+
+	crypto_pool_thread_t	*cpt;			//!< Worker to return the job to.
+	request_t		*request;		//!< To mark runnable when the job completes.
+
+	crypto_job_func_t	func;			//!< Run by a pool thread.
+	void			*uctx;			//!< Passed to func.
+
+	fr_time_t		queued;			//!< When the job was submitted.
+
+	bool			pending;		//!< Backlogged, queued, running, or not yet seen by the worker.
+	bool			backlogged;		//!< In the worker's backlog, waiting for the pool to have room.
+	bool			cancelled;		//!< Free the job when it's returned.
+};
+
+/** Per-worker state
+ *
+ */
+struct crypto_pool_thread_s {
+	fr_event_list_t		*el;			//!< Worker's event list.
+
+	fr_dlist_head_t		backlog;		//!< Jobs submitted while the pool was full.
+							///< Only accessed by the worker.
+
+	fr_dlist_t		waiting_entry;		//!< In the pool's list of workers waiting for room.
+	bool			waiting;		//!< In the waiting list.  Protected by the pool mutex.
+
+	pthread_mutex_t		mutex;			//!< Protects everything below.
+	pthread_cond_t		cond;			//!< Signalled when outstanding reaches zero.
+	fr_dlist_head_t		completed;		//!< Jobs returned by pool threads.
+	uint32_t		outstanding;		//!< Jobs which haven't been returned yet.
+	bool			signalled;		//!< Pipe has been written to, and not yet read.
+
+	int			pipe[2];		//!< Wakes the worker's event loop.
+};
+
+typedef struct {
+	uint32_t		threads;		//!< Number of pool threads.  0 disables the pool.
+	uint32_t		max_jobs;		//!< Maximum number of jobs queued or running.
+} crypto_pool_config_t;
+
+typedef struct {
+	pthread_mutex_t		mutex;			//!< Protects the fields up to the statistics.
+	pthread_cond_t		cond;			//!< Wakes pool threads.
+	fr_dlist_head_t		queue;			//!< Jobs waiting for a pool thread.
+	uint32_t		jobs;			//!< Jobs queued or running.
+	fr_dlist_head_t		waiting;		//!< Workers with backlogged jobs.
+
+	pthread_t		*pthread_ids;
+	uint32_t		num_threads;		//!< Number of threads spawned.
+	bool			started;		//!< Threads have been spawned.
+	bool			stop;			//!< Tells pool threads to exit.
+
+	atomic_uint_fast64_t	submitted;
+	atomic_uint_fast64_t	completed;
+	atomic_uint_fast64_t	inline_jobs;
+	atomic_uint_fast64_t	backlogged;
+	atomic_uint_fast64_t	cancelled;
+	atomic_uint_fast64_t	queued;
+	atomic_uint_fast64_t	queued_max;
+	atomic_uint_fast64_t	wait_time_ns;
+	atomic_uint_fast64_t	wait_time_max_ns;
+	atomic_uint_fast64_t	run_time_ns;
+	atomic_uint_fast64_t	run_time_max_ns;
+} crypto_pool_t;
+
+static crypto_pool_config_t	crypto_pool_config;
+static crypto_pool_t		crypto_pool;
+
+static conf_parser_t const crypto_pool_global_config[] = {
+	{ FR_CONF_OFFSET("threads", crypto_pool_config_t, threads), .dflt = "2" },
+	{ FR_CONF_OFFSET("max_jobs", crypto_pool_config_t, max_jobs), .dflt = "1024" },
+	CONF_PARSER_TERMINATOR
+};
+
+static int crypto_pool_init(void);
+static void crypto_pool_free(void);
+
+global_lib_autoinst_t crypto_pool_autoinst = {
+	.name = "crypto_pool",
+	.config = crypto_pool_global_config,
+	.inst = &crypto_pool_config,
+	.init = crypto_pool_init,
+	.free = crypto_pool_free
+};
+
+static inline void stat_max(atomic_uint_fast64_t *max, uint64_t value)
+{
+	uint_fast64_t old = atomic_load_explicit(max, memory_order_relaxed);
+
+	while ((value > old) && !atomic_compare_exchange_weak_explicit(max, &old, value,
+								       memory_order_relaxed, memory_order_relaxed));
+}
+
+/** Wake a worker's event loop
+ *
+ * Must be called with the worker's mutex held.
+ */
+static inline void crypto_pool_thread_signal(crypto_pool_thread_t *cpt)
+{
+	if (cpt->signalled) return;
+
+	cpt->signalled = true;
+	while ((write(cpt->pipe[1], ".", 1) < 0) && (errno == EINTR));
+}
+
+/** Return a completed job to the worker which submitted it
+ *
+ * The pipe is written to with the mutex held, as the worker may free
+ * its state as soon as outstanding reaches zero.
+ */
+static void crypto_job_return(crypto_job_t *job)
+{
+	crypto_pool_thread_t *cpt = job->cpt;
+
+	pthread_mutex_lock(&cpt->mutex);
+	fr_dlist_insert_tail(&cpt->completed, job);
+	crypto_pool_thread_signal(cpt);
+	if (--cpt->outstanding == 0) pthread_cond_signal(&cpt->cond);
+	pthread_mutex_unlock(&cpt->mutex);
+}
+
+/** Tell a worker with backlogged jobs that the pool has room
+ *
+ * Must be called with the pool mutex held, which stops the worker
+ * freeing its state while we're signalling it.
+ */
+static void crypto_pool_waiting_signal(void)
+{
+	crypto_pool_thread_t *cpt;
+
+	cpt = fr_dlist_pop_head(&crypto_pool.waiting);
+	if (!cpt) return;
+
+	cpt->waiting = false;
+
+	pthread_mutex_lock(&cpt->mutex);
+	crypto_pool_thread_signal(cpt);
+	pthread_mutex_unlock(&cpt->mutex);
+}
+
+static void *crypto_pool_thread(UNUSED void *uctx)
+{
+	crypto_job_t	*job;
+
+	pthread_mutex_lock(&crypto_pool.mutex);
+	for (;;) {
+		fr_time_t	start;
+		uint64_t	wait, run;
+
+		job = fr_dlist_head(&crypto_pool.queue);
+		if (!job) {
+			if (crypto_pool.stop) break;
+
+			pthread_cond_wait(&crypto_pool.cond, &crypto_pool.mutex);
+			continue;
+		}
+		fr_dlist_remove(&crypto_pool.queue, job);
+		pthread_mutex_unlock(&crypto_pool.mutex);
+
+		atomic_fetch_sub_explicit(&crypto_pool.queued, 1, memory_order_relaxed);
+
+		start = fr_time();
+		wait = fr_time_delta_unwrap(fr_time_sub(start, job->queued));
+
+		job->func(job->uctx);
+
+		run = fr_time_delta_unwrap(fr_time_sub(fr_time(), start));
+
+		atomic_fetch_add_explicit(&crypto_pool.completed, 1, memory_order_relaxed);
+		atomic_fetch_add_explicit(&crypto_pool.wait_time_ns, wait, memory_order_relaxed);
+		atomic_fetch_add_explicit(&crypto_pool.run_time_ns, run, memory_order_relaxed);
+		stat_max(&crypto_pool.wait_time_max_ns, wait);
+		stat_max(&crypto_pool.run_time_max_ns, run);
+
+		/*
+		 *	The job may be freed by the worker as soon as
+		 *	it's returned.
+		 */
+		crypto_job_return(job);
+
+		pthread_mutex_lock(&crypto_pool.mutex);
+		crypto_pool.jobs--;
+		crypto_pool_waiting_signal();
+	}
+	pthread_mutex_unlock(&crypto_pool.mutex);
+
+	return NULL;
+}
+
+static int cmd_stats_crypto_pool(FILE *fp, UNUSED FILE *fp_err, UNUSED void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	crypto_pool_stats_t stats;
+
+	crypto_pool_stats(&stats);
+
+	fprintf(fp, "threads\t\t\t%u\n", crypto_pool.num_threads);
+	fprintf(fp, "submitted\t\t%" PRIu64 "\n", stats.submitted);
+	fprintf(fp, "completed\t\t%" PRIu64 "\n", stats.completed);
+	fprintf(fp, "inline\t\t\t%" PRIu64 "\n", stats.inline_jobs);
+	fprintf(fp, "backlogged\t\t%" PRIu64 "\n", stats.backlogged);
+	fprintf(fp, "cancelled\t\t%" PRIu64 "\n", stats.cancelled);
+	fprintf(fp, "queued\t\t\t%" PRIu64 "\n", stats.queued);
+	fprintf(fp, "queued.max\t\t%" PRIu64 "\n", stats.queued_max);
+	fprintf(fp, "wait.average_usec\t%.1f\n",
+		stats.completed ? (double) stats.wait_time_ns / stats.completed / 1000 : 0.0);
+	fprintf(fp, "wait.max_usec\t\t%.1f\n", (double) stats.wait_time_max_ns / 1000);
+	fprintf(fp, "run.average_usec\t%.1f\n",
+		stats.completed ? (double) stats.run_time_ns / stats.completed / 1000 : 0.0);
+	fprintf(fp, "run.max_usec\t\t%.1f\n", (double) stats.run_time_max_ns / 1000);
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_crypto_table[] = {
+	{
+		.parent = "stats",
+		.name = "crypto",
+		.help = "Statistics for crypto operations.",
+		.read_only = true
+	},
+
+	{
+		.parent = "stats crypto",
+		.name = "pool",
+		.func = cmd_stats_crypto_pool,
+		.help = "Show statistics for the crypto offload pool.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
+static int crypto_pool_init(void)
+{
+	static bool	cmd_registered = false;
+
+	if (crypto_pool_config.threads > 1024) {
+		ERROR("crypto_pool - threads must be no more than 1024");
+		return -1;
+	}
+
+	if (crypto_pool_config.threads && !crypto_pool_config.max_jobs) {
+		ERROR("crypto_pool - max_jobs must be at least 1");
+		return -1;
+	}
+
+	pthread_mutex_init(&crypto_pool.mutex, NULL);
+	pthread_cond_init(&crypto_pool.cond, NULL);
+	fr_dlist_init(&crypto_pool.queue, crypto_job_t, entry);
+	fr_dlist_init(&crypto_pool.waiting, crypto_pool_thread_t, waiting_entry);
+
+	/*
+	 *	Commands can't be removed, so they're only
+	 *	registered the first time the library is used.
+	 */
+	if (!cmd_registered) {
+		if (fr_command_register_hook(NULL, NULL, &crypto_pool, cmd_crypto_table) < 0) {
+			PERROR("crypto_pool - Failed registering radmin commands");
+			return -1;
+		}
+		cmd_registered = true;
+	}
+
+	return 0;
+}
+
+static void crypto_pool_free(void)
+{
+	uint32_t i;
+
+	pthread_mutex_lock(&crypto_pool.mutex);
+	crypto_pool.stop = true;
+	pthread_cond_broadcast(&crypto_pool.cond);
+	pthread_mutex_unlock(&crypto_pool.mutex);
+
+	for (i = 0; i < crypto_pool.num_threads; i++) pthread_join(crypto_pool.pthread_ids[i], NULL);
+	TALLOC_FREE(crypto_pool.pthread_ids);
+
+	pthread_cond_destroy(&crypto_pool.cond);
+	pthread_mutex_destroy(&crypto_pool.mutex);
+
+	crypto_pool.num_threads = 0;
+	crypto_pool.started = false;
+	crypto_pool.stop = false;
+}
+
+/** Spawn the pool threads, if they haven't been already
+ *
+ * Must be called with the pool mutex held.
+ */
+static int crypto_pool_start(void)
+{
+	if (crypto_pool.started) return 0;
+
+	if (!crypto_pool.pthread_ids) {
+		MEM(crypto_pool.pthread_ids = talloc_array(NULL, pthread_t, crypto_pool_config.threads));
+	}
+
+	while (crypto_pool.num_threads < crypto_pool_config.threads) {
+		if (fr_schedule_pthread_create(&crypto_pool.pthread_ids[crypto_pool.num_threads],
+					       crypto_pool_thread, NULL) < 0) {
+			fr_strerror_const_push("Failed creating crypto pool thread");
+			return -1;
+		}
+		crypto_pool.num_threads++;
+	}
+
+	crypto_pool.started = true;
+
+	DEBUG2("crypto_pool - Started %u threads", crypto_pool.num_threads);
+
+	return 0;
+}
+
+/** Pass a job to the pool threads
+ *
+ * Must be called with the pool mutex held, and with room in the pool.
+ */
+static void crypto_job_enqueue(crypto_job_t *job)
+{
+	crypto_pool_thread_t	*cpt = job->cpt;
+	uint64_t		queued;
+
+	/*
+	 *	Must be counted before a pool thread can return it.
+	 */
+	pthread_mutex_lock(&cpt->mutex);
+	cpt->outstanding++;
+	pthread_mutex_unlock(&cpt->mutex);
+
+	crypto_pool.jobs++;
+	fr_dlist_insert_tail(&crypto_pool.queue, job);
+	pthread_cond_signal(&crypto_pool.cond);
+
+	queued = atomic_fetch_add_explicit(&crypto_pool.queued, 1, memory_order_relaxed) + 1;
+	stat_max(&crypto_pool.queued_max, queued);
+	atomic_fetch_add_explicit(&crypto_pool.submitted, 1, memory_order_relaxed);
+}
+
+/** Move as many backlogged jobs to the pool as it has room for
+ *
+ * If any are left, the worker is added to the waiting list, so that it's
+ * signalled when a pool thread finishes a job.  If there's room left over,
+ * because the worker's jobs were cancelled after it was signalled, the
+ * next waiting worker is signalled instead.
+ */
+static void crypto_pool_backlog_submit(crypto_pool_thread_t *cpt)
+{
+	crypto_job_t *job;
+
+	pthread_mutex_lock(&crypto_pool.mutex);
+	while ((crypto_pool.jobs < crypto_pool_config.max_jobs) && (job = fr_dlist_pop_head(&cpt->backlog))) {
+		job->backlogged = false;
+		crypto_job_enqueue(job);
+	}
+
+	if (fr_dlist_empty(&cpt->backlog)) {
+		if (crypto_pool.jobs < crypto_pool_config.max_jobs) crypto_pool_waiting_signal();
+	} else if (!cpt->waiting) {
+		cpt->waiting = true;
+		fr_dlist_insert_tail(&crypto_pool.waiting, cpt);
+	}
+	pthread_mutex_unlock(&crypto_pool.mutex);
+}
+
+static void _crypto_pool_thread_read(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	crypto_pool_thread_t	*cpt = talloc_get_type_abort(uctx, crypto_pool_thread_t);
+	fr_dlist_head_t		completed;
+	crypto_job_t		*job;
+	char			buff[64];
+
+	/*
+	 *	Drain the pipe before taking the jobs, so that any
+	 *	job returned after the jobs are taken generates
+	 *	another wakeup.
+	 */
+	while (read(cpt->pipe[0], buff, sizeof(buff)) > 0);
+
+	fr_dlist_init(&completed, crypto_job_t, entry);
+
+	pthread_mutex_lock(&cpt->mutex);
+	fr_dlist_move(&completed, &cpt->completed);
+	cpt->signalled = false;
+	pthread_mutex_unlock(&cpt->mutex);
+
+	while ((job = fr_dlist_pop_head(&completed))) {
+		job->pending = false;
+
+		if (job->cancelled) {
+			talloc_free(job);
+			continue;
+		}
+
+		unlang_interpret_mark_runnable(job->request);
+	}
+
+	crypto_pool_backlog_submit(cpt);
+}
+
+static int _crypto_pool_thread_free(crypto_pool_thread_t *cpt)
+{
+	crypto_job_t *job;
+
+	/*
+	 *	Stop pool threads telling us there's room.
+	 */
+	if (cpt->pipe[0] >= 0) {
+		pthread_mutex_lock(&crypto_pool.mutex);
+		if (cpt->waiting) fr_dlist_remove(&crypto_pool.waiting, cpt);
+		pthread_mutex_unlock(&crypto_pool.mutex);
+	}
+
+	while ((job = fr_dlist_pop_head(&cpt->backlog))) talloc_free(job);
+
+	/*
+	 *	Pool threads still hold pointers to us.  The jobs
+	 *	are bounded in length, so just wait for them.
+	 */
+	pthread_mutex_lock(&cpt->mutex);
+	while (cpt->outstanding > 0) pthread_cond_wait(&cpt->cond, &cpt->mutex);
+	pthread_mutex_unlock(&cpt->mutex);
+
+	while ((job = fr_dlist_pop_head(&cpt->completed))) talloc_free(job);
+
+	if (cpt->pipe[0] >= 0) {
+		(void) fr_event_fd_delete(cpt->el, cpt->pipe[0], FR_EVENT_FILTER_IO);
+		close(cpt->pipe[0]);
+	}
+	if (cpt->pipe[1] >= 0) close(cpt->pipe[1]);
+
+	pthread_cond_destroy(&cpt->cond);
+	pthread_mutex_destroy(&cpt->mutex);
+
+	return 0;
+}
+
+/** Allocate the per-worker state for the crypto pool
+ *
+ * Should be called from a module's thread_instantiate callback.
+ * The pool threads aren't spawned until this is first called, so that
+ * they're created after the server has daemonized.
+ *
+ * @param[in] ctx	to allocate the state in, usually the module thread instance.
+ * @param[in] el	of the worker.  Completed jobs are returned via this.
+ * @return
+ *	- Per-worker state.
+ *	- NULL on error.
+ */
+crypto_pool_thread_t *crypto_pool_thread_alloc(TALLOC_CTX *ctx, fr_event_list_t *el)
+{
+	crypto_pool_thread_t *cpt;
+
+	MEM(cpt = talloc_zero(ctx, crypto_pool_thread_t));
+	cpt->el = el;
+	cpt->pipe[0] = cpt->pipe[1] = -1;
+	pthread_mutex_init(&cpt->mutex, NULL);
+	pthread_cond_init(&cpt->cond, NULL);
+	fr_dlist_init(&cpt->completed, crypto_job_t, entry);
+	fr_dlist_init(&cpt->backlog, crypto_job_t, entry);
+	talloc_set_destructor(cpt, _crypto_pool_thread_free);
+
+	if (!crypto_pool_config.threads) return cpt;
+
+	pthread_mutex_lock(&crypto_pool.mutex);
+	if (crypto_pool_start() < 0) {
+		pthread_mutex_unlock(&crypto_pool.mutex);
+	error:
+		talloc_free(cpt);
+		return NULL;
+	}
+	pthread_mutex_unlock(&crypto_pool.mutex);
+
+	if (pipe(cpt->pipe) < 0) {
+		fr_strerror_printf("Failed opening crypto pool pipe: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	if ((fr_nonblock(cpt->pipe[0]) < 0) || (fr_nonblock(cpt->pipe[1]) < 0) ||
+	    (fcntl(cpt->pipe[0], F_SETFD, FD_CLOEXEC) < 0) || (fcntl(cpt->pipe[1], F_SETFD, FD_CLOEXEC) < 0)) {
+		fr_strerror_printf("Failed setting crypto pool pipe flags: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	if (fr_event_fd_insert(cpt, NULL, el, cpt->pipe[0], _crypto_pool_thread_read, NULL, NULL, cpt) < 0) {
+		fr_strerror_const_push("Failed inserting crypto pool pipe");
+		goto error;
+	}
+
+	return cpt;
+}
+
+/** Allocate a job
+ *
+ * The job is not parented by the request, as it may outlive it.  Any
+ * data the job function needs should be copied into memory parented
+ * by the job.
+ *
+ * @param[in] cpt	Per-worker state.
+ * @return A new job.
+ */
+crypto_job_t *crypto_job_alloc(crypto_pool_thread_t *cpt)
+{
+	crypto_job_t *job;
+
+	MEM(job = talloc_zero(NULL, crypto_job_t));
+	job->cpt = cpt;
+
+	return job;
+}
+
+/** Submit a job to the pool
+ *
+ * If the job is queued, the caller should yield, with a signal callback
+ * which calls #crypto_job_cancel.  The request will be marked runnable
+ * when the job has completed.
+ *
+ * If the pool is full, the job is held by the worker until a pool thread
+ * has finished another job.  Only if the pool is disabled is the job run
+ * immediately.
+ *
+ * @param[in] job	to submit.
+ * @param[in] request	to mark runnable when the job completes.
+ * @param[in] func	to run in a pool thread.
+ * @param[in] uctx	to pass to func.
+ * @return
+ *	- 0 if the job was queued.
+ *	- 1 if the job has already been run.
+ */
+int crypto_job_submit(crypto_job_t *job, request_t *request, crypto_job_func_t func, void *uctx)
+{
+	crypto_pool_thread_t	*cpt = job->cpt;
+
+	job->request = request;
+	job->func = func;
+	job->uctx = uctx;
+
+	if (cpt->pipe[0] < 0) {
+		atomic_fetch_add_explicit(&crypto_pool.inline_jobs, 1, memory_order_relaxed);
+		func(uctx);
+		return 1;
+	}
+
+	job->pending = true;
+	job->queued = fr_time();
+
+	/*
+	 *	Jobs already in the backlog go first, so that
+	 *	they're passed to the pool in the order they
+	 *	were submitted.
+	 */
+	if (fr_dlist_empty(&cpt->backlog)) {
+		pthread_mutex_lock(&crypto_pool.mutex);
+		if (crypto_pool.jobs < crypto_pool_config.max_jobs) {
+			crypto_job_enqueue(job);
+			pthread_mutex_unlock(&crypto_pool.mutex);
+			return 0;
+		}
+		pthread_mutex_unlock(&crypto_pool.mutex);
+	}
+
+	job->backlogged = true;
+	fr_dlist_insert_tail(&cpt->backlog, job);
+	atomic_fetch_add_explicit(&crypto_pool.backlogged, 1, memory_order_relaxed);
+
+	crypto_pool_backlog_submit(cpt);
+
+	return 0;
+}
+
+/** Cancel a job, because the request which submitted it is going away
+ *
+ * Jobs can't be stopped once they've been passed to the pool.  If the
+ * job hasn't been returned by the pool, it's freed when it is.  Otherwise,
+ * including when it's still in the worker's backlog, it's freed
+ * immediately.
+ *
+ * @param[in] job	to cancel.
+ */
+void crypto_job_cancel(crypto_job_t *job)
+{
+	if (job->backlogged) {
+		fr_dlist_remove(&job->cpt->backlog, job);
+		atomic_fetch_add_explicit(&crypto_pool.cancelled, 1, memory_order_relaxed);
+		talloc_free(job);
+		return;
+	}
+
+	if (!job->pending) {
+		talloc_free(job);
+		return;
+	}
+
+	job->request = NULL;
+	job->cancelled = true;
+
+	atomic_fetch_add_explicit(&crypto_pool.cancelled, 1, memory_order_relaxed);
+}
+
+/** Free a job which has completed
+ *
+ * @param[in] job	to free.
+ */
+void crypto_job_free(crypto_job_t *job)
+{
+	fr_assert(!job->pending);
+
+	talloc_free(job);
+}
+
+/** Return a snapshot of the pool's statistics
+ *
+ * @param[out] out	Where to write the statistics.
+ */
+void crypto_pool_stats(crypto_pool_stats_t *out)
+{
+	*out = (crypto_pool_stats_t) {
+		.submitted = atomic_load_explicit(&crypto_pool.submitted, memory_order_relaxed),
+		.completed = atomic_load_explicit(&crypto_pool.completed, memory_order_relaxed),
+		.inline_jobs = atomic_load_explicit(&crypto_pool.inline_jobs, memory_order_relaxed),
+		.backlogged = atomic_load_explicit(&crypto_pool.backlogged, memory_order_relaxed),
+		.cancelled = atomic_load_explicit(&crypto_pool.cancelled, memory_order_relaxed),
+		.queued = atomic_load_explicit(&crypto_pool.queued, memory_order_relaxed),
+		.queued_max = atomic_load_explicit(&crypto_pool.queued_max, memory_order_relaxed),
+		.wait_time_ns = atomic_load_explicit(&crypto_pool.wait_time_ns, memory_order_relaxed),
+		.wait_time_max_ns = atomic_load_explicit(&crypto_pool.wait_time_max_ns, memory_order_relaxed),
+		.run_time_ns = atomic_load_explicit(&crypto_pool.run_time_ns, memory_order_relaxed),
+		.run_time_max_ns = atomic_load_explicit(&crypto_pool.run_time_max_ns, memory_order_relaxed),
+	};
+}
@@ -0,0 +1,82 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/io/crypto_pool.h
+ * @brief Run CPU intensive crypto operations outside of the worker threads.
+ *
+ * @copyright 2025 The FreeRADIUS server project
+ */
+RCSIDH(crypto_pool_h, "$Id$")
+
+#include <freeradius-devel/server/request.h>
+#include <freeradius-devel/server/global_lib.h>
+#include <freeradius-devel/util/event.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct crypto_pool_thread_s crypto_pool_thread_t;
+typedef struct crypto_job_s crypto_job_t;
+
+/** Function run by a pool thread
+ *
+ * Must not access the request, or anything else owned by the worker.
+ *
+ * @param[in] uctx	passed to #crypto_job_submit.
+ */
+typedef void (*crypto_job_func_t)(void *uctx);
+
+/** Snapshot of the pool's statistics
+ *
+ */
+typedef struct {
+	uint64_t		submitted;		//!< Jobs passed to pool threads.
+	uint64_t		completed;		//!< Jobs run by pool threads.
+	uint64_t		inline_jobs;		//!< Jobs run in the worker, because the pool was disabled.
+	uint64_t		backlogged;		//!< Jobs held by the worker, because the pool was full.
+	uint64_t		cancelled;		//!< Jobs whose request went away before they completed.
+
+	uint64_t		queued;			//!< Jobs waiting for a pool thread.
+	uint64_t		queued_max;		//!< Highest value of queued.
+
+	uint64_t		wait_time_ns;		//!< Total time jobs spent waiting for a pool thread.
+	uint64_t		wait_time_max_ns;
+	uint64_t		run_time_ns;		//!< Total time pool threads spent running jobs.
+	uint64_t		run_time_max_ns;
+} crypto_pool_stats_t;
+
+extern global_lib_autoinst_t crypto_pool_autoinst;
+
+crypto_pool_thread_t	*crypto_pool_thread_alloc(TALLOC_CTX *ctx, fr_event_list_t *el);
+
+crypto_job_t		*crypto_job_alloc(crypto_pool_thread_t *cpt);
+
+int			crypto_job_submit(crypto_job_t *job, request_t *request, crypto_job_func_t func, void *uctx);
+
+void			crypto_job_cancel(crypto_job_t *job);
+
+void			crypto_job_free(crypto_job_t *job);
+
+void			crypto_pool_stats(crypto_pool_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,312 @@
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include "crypto_pool.c"
+
+/*
+ *	The main thread plays the part of a worker.  Jobs are returned via
+ *	its event list, and as there's no interpreter, the runnable hook
+ *	records which requests would have been resumed.
+ */
+
+#define TEST_TIMEOUT	fr_time_delta_from_sec(10)
+
+typedef struct {
+	request_t		*request;		//!< Only used to identify the job when it's returned.
+	crypto_job_t		*job;
+
+	pthread_t		ran_in;			//!< Thread which ran the job.
+	atomic_bool		ran;			//!< Set by the job function.
+	unsigned int		order;			//!< Order in which the job ran.
+
+	bool			hold;			//!< Wait for test_release before completing.
+	unsigned int		runnable;		//!< Times the request was marked runnable.
+} test_crypto_job_t;
+
+static atomic_bool	test_released;
+static atomic_uint	test_order;
+
+#define DEBUG_LVL_SET if (acutest_verbose_level_ >= 3) fr_debug_lvl = L_DBG_LVL_4 + 1
+
+static void test_job_func(void *uctx)
+{
+	test_crypto_job_t *tj = uctx;
+
+	if (tj->hold) {
+		while (!atomic_load(&test_released)) usleep(1000);
+	}
+
+	tj->ran_in = pthread_self();
+	tj->order = atomic_fetch_add(&test_order, 1);
+	atomic_store(&tj->ran, true);
+}
+
+/** Record which requests would have been resumed
+ *
+ */
+static void test_mark_runnable(request_t *request, UNUSED void *uctx)
+{
+	test_crypto_job_t *tj = talloc_get_type_abort(talloc_parent(request), test_crypto_job_t);
+
+	tj->runnable++;
+}
+
+typedef struct {
+	TALLOC_CTX		*ctx;
+	fr_event_list_t		*el;
+	crypto_pool_thread_t	*cpt;
+} test_crypto_pool_t;
+
+static void test_setup(test_crypto_pool_t *test, uint32_t threads, uint32_t max_jobs)
+{
+	DEBUG_LVL_SET;
+
+	*test = (test_crypto_pool_t){ .ctx = talloc_init_const("test") };
+	atomic_store(&test_released, false);
+	atomic_store(&test_order, 0);
+
+	crypto_pool_config = (crypto_pool_config_t){ .threads = threads, .max_jobs = max_jobs };
+	memset(&crypto_pool, 0, sizeof(crypto_pool));
+	TEST_ASSERT(crypto_pool_init() == 0);
+
+	test->el = fr_event_list_alloc(test->ctx, NULL, NULL);
+	TEST_ASSERT(test->el != NULL);
+
+	test->cpt = crypto_pool_thread_alloc(test->ctx, test->el);
+	TEST_ASSERT(test->cpt != NULL);
+
+	unlang_interpret_set_thread_runnable_hook(test_mark_runnable, NULL);
+}
+
+static void test_teardown(test_crypto_pool_t *test)
+{
+	unlang_interpret_set_thread_runnable_hook(NULL, NULL);
+
+	atomic_store(&test_released, true);
+	talloc_free(test->ctx);
+	crypto_pool_free();
+}
+
+static test_crypto_job_t *test_job_alloc(test_crypto_pool_t *test, crypto_pool_thread_t *cpt, bool hold)
+{
+	test_crypto_job_t *tj;
+
+	MEM(tj = talloc_zero(test->ctx, test_crypto_job_t));
+	MEM(tj->request = talloc_zero(tj, request_t));
+	tj->hold = hold;
+	tj->job = crypto_job_alloc(cpt);
+
+	return tj;
+}
+
+/** Run the worker's event loop until every job has been returned
+ *
+ */
+static bool test_run(test_crypto_pool_t *test, test_crypto_job_t **tj, size_t num)
+{
+	fr_time_t	timeout = fr_time_add(fr_time(), TEST_TIMEOUT);
+	size_t		i;
+
+	for (;;) {
+		for (i = 0; i < num; i++) if (!tj[i]->runnable) break;
+		if (i == num) return true;
+
+		if (fr_time_gt(fr_time(), timeout)) return false;
+
+		if (fr_event_corral(test->el, fr_time(), true) < 0) return false;
+		fr_event_service(test->el);
+	}
+}
+
+/*
+ *	With the pool disabled, jobs run immediately in the worker.
+ */
+static void test_inline(void)
+{
+	test_crypto_pool_t	test;
+	test_crypto_job_t	*tj;
+	crypto_pool_stats_t	stats;
+
+	test_setup(&test, 0, 1);
+
+	tj = test_job_alloc(&test, test.cpt, false);
+	TEST_CHECK(crypto_job_submit(tj->job, tj->request, test_job_func, tj) == 1);
+	TEST_CHECK(atomic_load(&tj->ran));
+	TEST_CHECK(pthread_equal(tj->ran_in, pthread_self()));
+	crypto_job_free(tj->job);
+
+	crypto_pool_stats(&stats);
+	TEST_CHECK(stats.inline_jobs == 1);
+	TEST_CHECK(stats.submitted == 0);
+
+	test_teardown(&test);
+}
+
+/*
+ *	Jobs run in a pool thread, and the request is marked runnable
+ *	in the worker.
+ */
+static void test_pool(void)
+{
+	test_crypto_pool_t	test;
+	test_crypto_job_t	*tj;
+	crypto_pool_stats_t	stats;
+
+	test_setup(&test, 2, 4);
+
+	tj = test_job_alloc(&test, test.cpt, false);
+	TEST_CHECK(crypto_job_submit(tj->job, tj->request, test_job_func, tj) == 0);
+	TEST_CHECK(test_run(&test, &tj, 1));
+	TEST_CHECK(tj->runnable == 1);
+	TEST_CHECK(atomic_load(&tj->ran));
+	TEST_CHECK(!pthread_equal(tj->ran_in, pthread_self()));
+	crypto_job_free(tj->job);
+
+	crypto_pool_stats(&stats);
+	TEST_CHECK(stats.submitted == 1);
+	TEST_CHECK(stats.completed == 1);
+	TEST_CHECK(stats.inline_jobs == 0);
+	TEST_CHECK(stats.backlogged == 0);
+
+	test_teardown(&test);
+}
+
+/*
+ *	Jobs submitted while the pool is full are held by the worker,
+ *	and passed to the pool in order as it has room.
+ */
+static void test_full(void)
+{
+	test_crypto_pool_t	test;
+	test_crypto_job_t	*tj[3];
+	crypto_pool_stats_t	stats;
+	size_t			i;
+
+	test_setup(&test, 1, 1);
+
+	for (i = 0; i < NUM_ELEMENTS(tj); i++) {
+		tj[i] = test_job_alloc(&test, test.cpt, (i == 0));
+		TEST_CHECK(crypto_job_submit(tj[i]->job, tj[i]->request, test_job_func, tj[i]) == 0);
+	}
+
+	TEST_CASE("Jobs are held, not run in the worker");
+	TEST_CHECK(fr_dlist_num_elements(&test.cpt->backlog) == 2);
+	TEST_CHECK(!atomic_load(&tj[1]->ran));
+	TEST_CHECK(!atomic_load(&tj[2]->ran));
+
+	atomic_store(&test_released, true);
+	TEST_CHECK(test_run(&test, tj, NUM_ELEMENTS(tj)));
+
+	TEST_CASE("Backlogged jobs are run by the pool, in order");
+	for (i = 0; i < NUM_ELEMENTS(tj); i++) {
+		TEST_CHECK(tj[i]->runnable == 1);
+		TEST_CHECK(!pthread_equal(tj[i]->ran_in, pthread_self()));
+		TEST_CHECK(tj[i]->order == i);
+		crypto_job_free(tj[i]->job);
+	}
+
+	crypto_pool_stats(&stats);
+	TEST_CHECK(stats.submitted == 3);
+	TEST_CHECK(stats.completed == 3);
+	TEST_CHECK(stats.backlogged == 2);
+	TEST_CHECK(stats.inline_jobs == 0);
+
+	test_teardown(&test);
+}
+
+/*
+ *	A worker with backlogged jobs is told when another worker's job
+ *	frees up room in the pool.
+ */
+static void test_waiting(void)
+{
+	test_crypto_pool_t	test;
+	crypto_pool_thread_t	*other;
+	test_crypto_job_t	*tj[2];
+
+	test_setup(&test, 1, 1);
+
+	other = crypto_pool_thread_alloc(test.ctx, test.el);
+	TEST_ASSERT(other != NULL);
+
+	tj[0] = test_job_alloc(&test, other, true);
+	TEST_CHECK(crypto_job_submit(tj[0]->job, tj[0]->request, test_job_func, tj[0]) == 0);
+
+	tj[1] = test_job_alloc(&test, test.cpt, false);
+	TEST_CHECK(crypto_job_submit(tj[1]->job, tj[1]->request, test_job_func, tj[1]) == 0);
+	TEST_CHECK(test.cpt->waiting);
+
+	atomic_store(&test_released, true);
+	TEST_CHECK(test_run(&test, tj, NUM_ELEMENTS(tj)));
+	TEST_CHECK(!test.cpt->waiting);
+	TEST_CHECK(fr_dlist_empty(&test.cpt->backlog));
+
+	crypto_job_free(tj[0]->job);
+	crypto_job_free(tj[1]->job);
+
+	test_teardown(&test);
+}
+
+/*
+ *	Cancelled jobs are freed, either immediately if they're still
+ *	held by the worker, or when they're returned by the pool.
+ */
+static void test_cancel(void)
+{
+	test_crypto_pool_t	test;
+	test_crypto_job_t	*tj[2];
+	crypto_pool_stats_t	stats;
+	fr_time_t		timeout;
+
+	test_setup(&test, 1, 1);
+
+	tj[0] = test_job_alloc(&test, test.cpt, true);
+	TEST_CHECK(crypto_job_submit(tj[0]->job, tj[0]->request, test_job_func, tj[0]) == 0);
+
+	tj[1] = test_job_alloc(&test, test.cpt, false);
+	TEST_CHECK(crypto_job_submit(tj[1]->job, tj[1]->request, test_job_func, tj[1]) == 0);
+
+	TEST_CASE("Cancel a backlogged job");
+	crypto_job_cancel(tj[1]->job);
+	TEST_CHECK(fr_dlist_empty(&test.cpt->backlog));
+
+	TEST_CASE("Cancel a job held by the pool");
+	crypto_job_cancel(tj[0]->job);
+	atomic_store(&test_released, true);
+
+	timeout = fr_time_add(fr_time(), TEST_TIMEOUT);
+	for (;;) {
+		uint32_t outstanding;
+
+		pthread_mutex_lock(&test.cpt->mutex);
+		outstanding = test.cpt->outstanding;
+		pthread_mutex_unlock(&test.cpt->mutex);
+
+		if (!outstanding && fr_dlist_empty(&test.cpt->completed)) break;
+
+		TEST_ASSERT(fr_time_lt(fr_time(), timeout));
+		TEST_CHECK(fr_event_corral(test.el, fr_time(), true) >= 0);
+		fr_event_service(test.el);
+	}
+
+	TEST_CHECK(atomic_load(&tj[0]->ran));
+	TEST_CHECK(!atomic_load(&tj[1]->ran));
+	TEST_CHECK(tj[0]->runnable == 0);
+	TEST_CHECK(tj[1]->runnable == 0);
+
+	crypto_pool_stats(&stats);
+	TEST_CHECK(stats.cancelled == 2);
+	TEST_CHECK(stats.completed == 1);
+
+	test_teardown(&test);
+}
+
+TEST_LIST = {
+	{ "Inline - Pool disabled",			test_inline },
+	{ "Pool - Run in pool thread",			test_pool },
+	{ "Full - Jobs backlogged",			test_full },
+	{ "Full - Other worker signalled",		test_waiting },
+	{ "Cancel - Backlogged and pending",		test_cancel },
+
+	{ NULL }
+};
@@ -0,0 +1,13 @@
+TARGET		:= crypto_pool_tests$(E)
+SOURCES		:= crypto_pool_tests.c
+
+TGT_LDLIBS	:= $(LIBS) $(GPERFTOOLS_LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS) $(GPERFTOOLS_LDFLAGS)
+
+ifneq ($(OPENSSL_LIBS),)
+TGT_PREREQS	:= libfreeradius-tls$(L)
+endif
+
+TGT_PREREQS	+= libfreeradius-util$(L) libfreeradius-server$(L) libfreeradius-unlang$(L) libfreeradius-io$(L)
+
+TGT_INSTALLDIR	:=
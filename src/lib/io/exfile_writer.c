@@ -0,0 +1,711 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/*
+ * $Id$
+ *
+ * @file lib/io/exfile_writer.c
+ * @brief Buffered writes to exfile managed files.
+ *
+ * Each worker appends records to its own buffer, with only an uncontended
+ * mutex between it and the writer thread.  The writer thread periodically
+ * takes the buffers from all workers, and writes each file with one lock,
+ * a few writev() calls and, optionally, one fsync().
+ *
+ * Records from one worker are written to a file in the order they were
+ * appended.  There is no ordering between workers, as there was none
+ * before, either.
+ *
+ * @copyright 2025 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/io/exfile_writer.h>
+#include <freeradius-devel/io/schedule.h>
+
+#include <freeradius-devel/server/command.h>
+#include <freeradius-devel/server/tmpl.h>
+
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/syserror.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+
+#ifdef IOV_MAX
+#  define EXFILE_WRITER_IOV_MAX	IOV_MAX
+#else
+#  define EXFILE_WRITER_IOV_MAX	1024
+#endif
+
+/** Records for one file, from one worker
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;			//!< In the worker's, or the writer's list.
+
+	char			*filename;		//!< File to append to.
+	uint32_t		hash;			//!< Of the filename, for cheap comparisons.
+	mode_t			permissions;		//!< For creating the file.
+	gid_t			group;			//!< To set on new files, or -1.
+
+	uint8_t			*header;		//!< Written if the file is empty.
+	size_t			header_len;
+
+	uint8_t			*data;			//!< Buffered records.
+	size_t			used;
+	size_t			size;
+
+	uint64_t		records;		//!< Number of records in data.
+} exfile_segment_t;
+
+struct exfile_writer_s {
+	exfile_t		*ef;			//!< Files we write to.
+	char const		*name;			//!< For logging and radmin.
+	exfile_writer_config_t	config;
+
+	pthread_mutex_t		mutex;			//!< Protects everything below.
+	pthread_cond_t		cond;			//!< Wakes the writer thread.
+	pthread_t		pthread_id;
+	bool			running;		//!< pthread_id refers to a thread which needs joining.
+	bool			stop;			//!< Tell the writer thread to exit.
+	bool			wake;			//!< A worker's buffer is past the high water mark.
+
+	fr_dlist_head_t		workers;		//!< exfile_writer_thread_t.
+	fr_dlist_head_t		orphans;		//!< Segments left behind by workers which have exited.
+
+	atomic_uint_fast64_t	queued_bytes;		//!< Appended, but not yet written.  Limited by max_size.
+	atomic_uint_fast64_t	queued_records;
+	atomic_uint_fast64_t	records;
+	atomic_uint_fast64_t	bytes;
+	atomic_uint_fast64_t	dropped;
+	atomic_uint_fast64_t	errors;
+	atomic_uint_fast64_t	flushes;
+	atomic_uint_fast64_t	fsyncs;
+	atomic_uint_fast64_t	flush_time_ns;
+	atomic_uint_fast64_t	flush_time_max_ns;
+};
+
+struct exfile_writer_thread_s {
+	exfile_writer_t		*writer;
+	fr_dlist_t		entry;			//!< In the writer's list of workers.
+
+	pthread_mutex_t		mutex;			//!< Only ever contended by the writer thread.
+	fr_dlist_head_t		segments;		//!< exfile_segment_t, oldest first.
+	size_t			pending;		//!< Bytes in segments, not yet taken by the writer thread.
+};
+
+conf_parser_t const exfile_writer_config[] = {
+	{ FR_CONF_OFFSET_TYPE_FLAGS("size", FR_TYPE_SIZE, 0, exfile_writer_config_t, size), .dflt = "64k" },
+	{ FR_CONF_OFFSET_TYPE_FLAGS("max_size", FR_TYPE_SIZE, 0, exfile_writer_config_t, max_size), .dflt = "4M" },
+	{ FR_CONF_OFFSET("flush_interval", exfile_writer_config_t, flush_interval), .dflt = "0.1" },
+	{ FR_CONF_OFFSET("fsync", exfile_writer_config_t, fsync), .dflt = "no" },
+	CONF_PARSER_TERMINATOR
+};
+
+static inline CC_HINT(always_inline) bool segment_matches(exfile_segment_t const *seg, uint32_t hash, char const *filename)
+{
+	return (seg->hash == hash) && (strcmp(seg->filename, filename) == 0);
+}
+
+/** Write all of the iovecs, dealing with short writes
+ *
+ */
+static ssize_t writer_writev(int fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t total = 0;
+
+	while (iovcnt > 0) {
+		ssize_t slen;
+
+		slen = writev(fd, iov, iovcnt);
+		if (slen < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		total += slen;
+
+		while ((iovcnt > 0) && ((size_t) slen >= iov->iov_len)) {
+			slen -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+
+		if (iovcnt > 0) {
+			iov->iov_base = ((uint8_t *) iov->iov_base) + slen;
+			iov->iov_len -= slen;
+		}
+	}
+
+	return total;
+}
+
+/** Write every segment for the same file as "first", and remove them from the list
+ *
+ */
+static void writer_flush_file(exfile_writer_t *writer, fr_dlist_head_t *segments, exfile_segment_t *first)
+{
+	struct iovec		iov[EXFILE_WRITER_IOV_MAX];
+	int			iovcnt = 0, fd;
+	off_t			offset;
+	uint32_t		hash = first->hash;
+	char const		*filename = first->filename;
+	fr_dlist_head_t		done;
+	exfile_segment_t	*seg, *next;
+	uint64_t		records = 0, bytes = 0;
+	bool			failed = false;
+
+	fr_dlist_init(&done, exfile_segment_t, entry);
+
+	/*
+	 *	Pull out everything for this file, preserving order.
+	 */
+	for (seg = first; seg; seg = next) {
+		next = fr_dlist_next(segments, seg);
+		if (!segment_matches(seg, hash, filename)) continue;
+
+		fr_dlist_remove(segments, seg);
+		fr_dlist_insert_tail(&done, seg);
+		records += seg->records;
+		bytes += seg->used;
+	}
+
+	fd = exfile_open(writer->ef, filename, first->permissions, &offset);
+	if (fd < 0) {
+		PERROR("%s - Failed opening %s", writer->name, filename);
+		failed = true;
+		goto finish;
+	}
+
+	if (offset == 0) {
+		if ((first->group != (gid_t) -1) && (fchown(fd, -1, first->group) < 0)) {
+			WARN("%s - Unable to change system group of %s: %s", writer->name, filename, fr_syserror(errno));
+		}
+
+		fr_dlist_foreach(&done, exfile_segment_t, hdr) {
+			if (!hdr->header_len) continue;
+
+			iov[iovcnt].iov_base = hdr->header;
+			iov[iovcnt].iov_len = hdr->header_len;
+			iovcnt++;
+			break;
+		}
+	}
+
+	fr_dlist_foreach(&done, exfile_segment_t, to_write) {
+		if (iovcnt == EXFILE_WRITER_IOV_MAX) {
+			if (writer_writev(fd, iov, iovcnt) < 0) goto write_fail;
+			iovcnt = 0;
+		}
+
+		iov[iovcnt].iov_base = to_write->data;
+		iov[iovcnt].iov_len = to_write->used;
+		iovcnt++;
+	}
+
+	if (iovcnt && (writer_writev(fd, iov, iovcnt) < 0)) {
+	write_fail:
+		ERROR("%s - Failed writing to %s: %s", writer->name, filename, fr_syserror(errno));
+		failed = true;
+	}
+
+	/*
+	 *	One fsync for everything we just wrote.
+	 */
+	if (!failed && writer->config.fsync) {
+		if (fsync(fd) < 0) {
+			ERROR("%s - Failed syncing %s to persistent storage: %s", writer->name, filename, fr_syserror(errno));
+			failed = true;
+		} else {
+			atomic_fetch_add_explicit(&writer->fsyncs, 1, memory_order_relaxed);
+		}
+	}
+
+	exfile_close(writer->ef, fd);
+
+finish:
+	if (failed) {
+		atomic_fetch_add_explicit(&writer->errors, records, memory_order_relaxed);
+	} else {
+		atomic_fetch_add_explicit(&writer->records, records, memory_order_relaxed);
+		atomic_fetch_add_explicit(&writer->bytes, bytes, memory_order_relaxed);
+	}
+	atomic_fetch_sub_explicit(&writer->queued_records, records, memory_order_relaxed);
+	atomic_fetch_sub_explicit(&writer->queued_bytes, bytes, memory_order_relaxed);
+
+	while ((seg = fr_dlist_pop_head(&done))) talloc_free(seg);
+}
+
+/** Write out everything we've taken from the workers
+ *
+ */
+static void writer_flush(exfile_writer_t *writer, fr_dlist_head_t *segments)
+{
+	exfile_segment_t	*seg;
+	fr_time_t		start;
+	uint64_t		elapsed;
+
+	if (fr_dlist_empty(segments)) return;
+
+	start = fr_time();
+
+	while ((seg = fr_dlist_head(segments))) writer_flush_file(writer, segments, seg);
+
+	elapsed = fr_time_delta_unwrap(fr_time_sub(fr_time(), start));
+
+	/*
+	 *	Only the writer thread updates these, so there's no
+	 *	need for a CAS loop on the maximum.
+	 */
+	atomic_fetch_add_explicit(&writer->flushes, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&writer->flush_time_ns, elapsed, memory_order_relaxed);
+	if (elapsed > atomic_load_explicit(&writer->flush_time_max_ns, memory_order_relaxed)) {
+		atomic_store_explicit(&writer->flush_time_max_ns, elapsed, memory_order_relaxed);
+	}
+}
+
+/** Take all buffered segments from the workers
+ *
+ * @note Must be called with the writer mutex held.
+ */
+static void writer_collect(exfile_writer_t *writer, fr_dlist_head_t *out)
+{
+	fr_dlist_move(out, &writer->orphans);
+
+	fr_dlist_foreach(&writer->workers, exfile_writer_thread_t, wt) {
+		pthread_mutex_lock(&wt->mutex);
+		fr_dlist_move(out, &wt->segments);
+		wt->pending = 0;
+		pthread_mutex_unlock(&wt->mutex);
+	}
+}
+
+/*
+ *	This thread must not log unless it has something to write.
+ *	Logging allocates a thread local pool, which the main thread
+ *	frees when it triggers the thread local destructors at exit,
+ *	so we need to have exited by then.
+ */
+static void *writer_thread(void *uctx)
+{
+	exfile_writer_t	*writer = uctx;
+	fr_dlist_head_t	segments;
+	sigset_t	sigset;
+
+	/*
+	 *	Leave signal handling to the main thread
+	 */
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+	fr_dlist_init(&segments, exfile_segment_t, entry);
+
+	pthread_mutex_lock(&writer->mutex);
+	while (!writer->stop) {
+		if (!writer->wake) {
+			struct timespec	ts;
+			int64_t		nsec;
+
+			clock_gettime(CLOCK_REALTIME, &ts);
+			nsec = ts.tv_nsec + fr_time_delta_unwrap(writer->config.flush_interval);
+			ts.tv_sec += nsec / NSEC;
+			ts.tv_nsec = nsec % NSEC;
+
+			(void) pthread_cond_timedwait(&writer->cond, &writer->mutex, &ts);
+			if (writer->stop) break;
+		}
+		writer->wake = false;
+
+		writer_collect(writer, &segments);
+		pthread_mutex_unlock(&writer->mutex);
+
+		writer_flush(writer, &segments);
+
+		pthread_mutex_lock(&writer->mutex);
+	}
+
+	/*
+	 *	Don't lose anything on exit.
+	 */
+	writer_collect(writer, &segments);
+	pthread_mutex_unlock(&writer->mutex);
+
+	writer_flush(writer, &segments);
+
+	return NULL;
+}
+
+/** Spawn the writer thread
+ *
+ * @note Must be called with the writer mutex held.
+ */
+static int writer_spawn(exfile_writer_t *writer)
+{
+	if (fr_schedule_pthread_create(&writer->pthread_id, writer_thread, writer) < 0) {
+		fr_strerror_printf_push("Failed creating writer thread for %s", writer->name);
+		return -1;
+	}
+	writer->running = true;
+	writer->stop = false;
+
+	DEBUG2("%s - Writer thread started", writer->name);
+
+	return 0;
+}
+
+/** Stop the writer thread, once it has written everything it's been given
+ *
+ */
+static void writer_stop(exfile_writer_t *writer)
+{
+	pthread_mutex_lock(&writer->mutex);
+	if (!writer->running) {
+		pthread_mutex_unlock(&writer->mutex);
+		return;
+	}
+	writer->stop = true;
+	pthread_cond_signal(&writer->cond);
+	pthread_mutex_unlock(&writer->mutex);
+
+	pthread_join(writer->pthread_id, NULL);
+
+	pthread_mutex_lock(&writer->mutex);
+	writer->running = false;
+	pthread_mutex_unlock(&writer->mutex);
+
+	DEBUG2("%s - Writer thread stopped", writer->name);
+}
+
+static inline void writer_wake(exfile_writer_t *writer)
+{
+	pthread_mutex_lock(&writer->mutex);
+	writer->wake = true;
+	pthread_cond_signal(&writer->cond);
+	pthread_mutex_unlock(&writer->mutex);
+}
+
+static int cmd_stats_buffer(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	exfile_writer_t const	*writer = ctx;
+	exfile_writer_stats_t	stats;
+
+	exfile_writer_stats(&stats, writer);
+
+	fprintf(fp, "queued.bytes\t\t%" PRIu64 "\n", stats.queued_bytes);
+	fprintf(fp, "queued.records\t\t%" PRIu64 "\n", stats.queued_records);
+	fprintf(fp, "records\t\t\t%" PRIu64 "\n", stats.records);
+	fprintf(fp, "bytes\t\t\t%" PRIu64 "\n", stats.bytes);
+	fprintf(fp, "dropped\t\t\t%" PRIu64 "\n", stats.dropped);
+	fprintf(fp, "errors\t\t\t%" PRIu64 "\n", stats.errors);
+	fprintf(fp, "flushes\t\t\t%" PRIu64 "\n", stats.flushes);
+	fprintf(fp, "fsyncs\t\t\t%" PRIu64 "\n", stats.fsyncs);
+	fprintf(fp, "flush.average_usec\t%.1f\n",
+		stats.flushes ? (double) stats.flush_time_ns / stats.flushes / 1000 : 0.0);
+	fprintf(fp, "flush.max_usec\t\t%.1f\n", (double) stats.flush_time_max_ns / 1000);
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_buffer_table[] = {
+	{
+		.parent = "stats",
+		.name = "file",
+		.help = "Statistics for buffered file writers.",
+		.read_only = true
+	},
+
+	{
+		.parent = "stats file",
+		.add_name = true,
+		.name = "buffer",
+		.func = cmd_stats_buffer,
+		.help = "Show buffered write statistics for a specific module.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
+static int _exfile_writer_free(exfile_writer_t *writer)
+{
+	writer_stop(writer);
+
+	pthread_cond_destroy(&writer->cond);
+	pthread_mutex_destroy(&writer->mutex);
+
+	return 0;
+}
+
+/** Allocate a buffered writer, and spawn its writer thread
+ *
+ * Should be called from a module's instantiate callback.  The writer is
+ * modified by the workers, so it must not be allocated in the module's
+ * instance data, which is read only once the server is running.
+ *
+ * The writer thread is stopped when the last worker detaches, so that
+ * everything has been written before the server starts tearing down
+ * thread local state.
+ *
+ * @param[in] ctx	to allocate the writer in.  Must be freed before ef.
+ * @param[in] ef	to write files with.
+ * @param[in] name	for logging, and the "stats file <name> buffer" command.
+ * @param[in] config	buffer sizes and flush interval.
+ * @return
+ *	- A new writer.
+ *	- NULL on error.
+ */
+exfile_writer_t *exfile_writer_alloc(TALLOC_CTX *ctx, exfile_t *ef, char const *name,
+				     exfile_writer_config_t const *config)
+{
+	exfile_writer_t *writer;
+	int		ret;
+
+	if (config->size < 1024) {
+		fr_strerror_const("Buffer size must be at least 1k");
+		return NULL;
+	}
+
+	if (config->max_size < config->size) {
+		fr_strerror_const("Buffer max_size must be at least as large as size");
+		return NULL;
+	}
+
+	if (fr_time_delta_lt(config->flush_interval, fr_time_delta_from_msec(1)) ||
+	    fr_time_delta_gt(config->flush_interval, fr_time_delta_from_sec(10))) {
+		fr_strerror_const("Buffer flush_interval must be between 0.001 and 10 seconds");
+		return NULL;
+	}
+
+	MEM(writer = talloc_zero(ctx, exfile_writer_t));
+	writer->ef = ef;
+	writer->name = talloc_typed_strdup(writer, name);
+	writer->config = *config;
+
+	pthread_mutex_init(&writer->mutex, NULL);
+	pthread_cond_init(&writer->cond, NULL);
+	fr_dlist_init(&writer->workers, exfile_writer_thread_t, entry);
+	fr_dlist_init(&writer->orphans, exfile_segment_t, entry);
+
+	pthread_mutex_lock(&writer->mutex);
+	ret = writer_spawn(writer);
+	pthread_mutex_unlock(&writer->mutex);
+	if (ret < 0) {
+		pthread_cond_destroy(&writer->cond);
+		pthread_mutex_destroy(&writer->mutex);
+		talloc_free(writer);
+		return NULL;
+	}
+	talloc_set_destructor(writer, _exfile_writer_free);
+
+	if (fr_command_register_hook(NULL, writer->name, writer, cmd_buffer_table) < 0) {
+		PERROR("Failed registering radmin commands for %s", writer->name);
+		talloc_free(writer);
+		return NULL;
+	}
+
+	return writer;
+}
+
+static int _exfile_writer_thread_free(exfile_writer_thread_t *wt)
+{
+	exfile_writer_t *writer = wt->writer;
+	bool		last;
+
+	/*
+	 *	Hand anything we haven't written to the writer thread.
+	 */
+	pthread_mutex_lock(&writer->mutex);
+	pthread_mutex_lock(&wt->mutex);
+	fr_dlist_move(&writer->orphans, &wt->segments);
+	fr_dlist_remove(&writer->workers, wt);
+	pthread_mutex_unlock(&wt->mutex);
+	last = fr_dlist_empty(&writer->workers);
+	writer->wake = true;
+	pthread_cond_signal(&writer->cond);
+	pthread_mutex_unlock(&writer->mutex);
+
+	pthread_mutex_destroy(&wt->mutex);
+
+	/*
+	 *	The writer thread has nothing left to do, and
+	 *	it must exit before the thread local destructors
+	 *	are run.
+	 */
+	if (last) writer_stop(writer);
+
+	return 0;
+}
+
+/** Allocate the per-worker buffer for a writer
+ *
+ * Should be called from a module's thread_instantiate callback.  If the
+ * writer thread was stopped because every worker detached, it's spawned
+ * again.
+ *
+ * @param[in] ctx	to allocate the buffer in, usually the module thread instance.
+ * @param[in] writer	to attach to.
+ * @return
+ *	- A new per-worker buffer.
+ *	- NULL on error.
+ */
+exfile_writer_thread_t *exfile_writer_thread_alloc(TALLOC_CTX *ctx, exfile_writer_t *writer)
+{
+	exfile_writer_thread_t *wt;
+
+	MEM(wt = talloc_zero(ctx, exfile_writer_thread_t));
+	wt->writer = writer;
+	pthread_mutex_init(&wt->mutex, NULL);
+	fr_dlist_init(&wt->segments, exfile_segment_t, entry);
+
+	pthread_mutex_lock(&writer->mutex);
+	if (!writer->running && (writer_spawn(writer) < 0)) {
+		pthread_mutex_unlock(&writer->mutex);
+		pthread_mutex_destroy(&wt->mutex);
+		talloc_free(wt);
+		return NULL;
+	}
+	fr_dlist_insert_tail(&writer->workers, wt);
+	pthread_mutex_unlock(&writer->mutex);
+
+	talloc_set_destructor(wt, _exfile_writer_thread_free);
+
+	return wt;
+}
+
+/** Append a record to a worker's buffer
+ *
+ * The record is copied, and will be written by the writer thread within
+ * flush_interval, or sooner if the buffer fills up.  Errors writing
+ * the file are logged, and counted in the statistics.
+ *
+ * @param[in] wt		Per-worker buffer.
+ * @param[in] filename		to append to.
+ * @param[in] permissions	to create the file with.
+ * @param[in] group		to set on new files, or -1 to leave it alone.
+ * @param[in] header		written before the first record if the file is empty.
+ *				May be NULL.
+ * @param[in] header_len	Number of iovecs in header.
+ * @param[in] vector		the record.
+ * @param[in] vector_len	Number of iovecs in vector.
+ * @return
+ *	- 0 on success.
+ *	- -1 if max_size bytes are already waiting to be written.
+ */
+int exfile_writer_append(exfile_writer_thread_t *wt, char const *filename,
+			 mode_t permissions, gid_t group,
+			 struct iovec const *header, size_t header_len,
+			 struct iovec const *vector, size_t vector_len)
+{
+	exfile_writer_t		*writer = wt->writer;
+	exfile_segment_t	*seg;
+	uint32_t		hash;
+	size_t			len = 0, i;
+	bool			wake;
+
+	for (i = 0; i < vector_len; i++) len += vector[i].iov_len;
+
+	hash = fr_hash_string(filename);
+
+	/*
+	 *	Bytes stay queued until the writer thread has written
+	 *	them, so this limits everything which is waiting, not
+	 *	just what's still in the worker buffers.
+	 */
+	if ((atomic_fetch_add_explicit(&writer->queued_bytes, len, memory_order_relaxed) + len) > writer->config.max_size) {
+		atomic_fetch_sub_explicit(&writer->queued_bytes, len, memory_order_relaxed);
+		atomic_fetch_add_explicit(&writer->dropped, 1, memory_order_relaxed);
+		fr_strerror_printf("Write buffer for %s is full", filename);
+		return -1;
+	}
+
+	pthread_mutex_lock(&wt->mutex);
+
+	seg = fr_dlist_tail(&wt->segments);
+	if (!seg || !segment_matches(seg, hash, filename) || ((seg->used + len) > seg->size)) {
+		/*
+		 *	Segments are freed by the writer thread, so they
+		 *	can't be parented by anything the worker owns.
+		 */
+		MEM(seg = talloc_zero(NULL, exfile_segment_t));
+		seg->filename = talloc_typed_strdup(seg, filename);
+		seg->hash = hash;
+		seg->permissions = permissions;
+		seg->group = group;
+		seg->size = len > writer->config.size ? len : writer->config.size;
+		MEM(seg->data = talloc_array(seg, uint8_t, seg->size));
+		fr_dlist_insert_tail(&wt->segments, seg);
+	}
+
+	if (header_len && !seg->header_len) {
+		uint8_t *p;
+
+		for (i = 0; i < header_len; i++) seg->header_len += header[i].iov_len;
+		MEM(p = seg->header = talloc_array(seg, uint8_t, seg->header_len));
+		for (i = 0; i < header_len; i++) {
+			memcpy(p, header[i].iov_base, header[i].iov_len);
+			p += header[i].iov_len;
+		}
+	}
+
+	for (i = 0; i < vector_len; i++) {
+		memcpy(seg->data + seg->used, vector[i].iov_base, vector[i].iov_len);
+		seg->used += vector[i].iov_len;
+	}
+	seg->records++;
+
+	wt->pending += len;
+	wake = (wt->pending >= writer->config.size);
+
+	pthread_mutex_unlock(&wt->mutex);
+
+	atomic_fetch_add_explicit(&writer->queued_records, 1, memory_order_relaxed);
+
+	if (wake) writer_wake(writer);
+
+	return 0;
+}
+
+/** Return a snapshot of a writer's statistics
+ *
+ * @param[out] out	Where to write the statistics.
+ * @param[in] writer	to get statistics for.
+ */
+void exfile_writer_stats(exfile_writer_stats_t *out, exfile_writer_t const *writer)
+{
+	exfile_writer_t *w = UNCONST(exfile_writer_t *, writer);
+
+	*out = (exfile_writer_stats_t) {
+		.queued_bytes = atomic_load_explicit(&w->queued_bytes, memory_order_relaxed),
+		.queued_records = atomic_load_explicit(&w->queued_records, memory_order_relaxed),
+		.records = atomic_load_explicit(&w->records, memory_order_relaxed),
+		.bytes = atomic_load_explicit(&w->bytes, memory_order_relaxed),
+		.dropped = atomic_load_explicit(&w->dropped, memory_order_relaxed),
+		.errors = atomic_load_explicit(&w->errors, memory_order_relaxed),
+		.flushes = atomic_load_explicit(&w->flushes, memory_order_relaxed),
+		.fsyncs = atomic_load_explicit(&w->fsyncs, memory_order_relaxed),
+		.flush_time_ns = atomic_load_explicit(&w->flush_time_ns, memory_order_relaxed),
+		.flush_time_max_ns = atomic_load_explicit(&w->flush_time_max_ns, memory_order_relaxed),
+	};
+}
@@ -0,0 +1,83 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/io/exfile_writer.h
+ * @brief Buffered writes to exfile managed files, flushed by a dedicated writer thread.
+ *
+ * @copyright 2025 The FreeRADIUS server project
+ */
+RCSIDH(exfile_writer_h, "$Id$")
+
+#include <freeradius-devel/server/cf_parse.h>
+#include <freeradius-devel/server/exfile.h>
+
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct exfile_writer_s exfile_writer_t;
+typedef struct exfile_writer_thread_s exfile_writer_thread_t;
+
+/** Configuration for a buffered writer
+ *
+ */
+typedef struct {
+	size_t			size;			//!< Bytes buffered by a worker before the writer is woken.
+	size_t			max_size;		//!< Bytes waiting to be written, from all workers,
+							///< before appends fail.
+	fr_time_delta_t		flush_interval;		//!< Maximum time data waits in a buffer.
+	bool			fsync;			//!< fsync each file once per flush.
+} exfile_writer_config_t;
+
+/** Statistics for a buffered writer
+ *
+ */
+typedef struct {
+	uint64_t		queued_bytes;		//!< Bytes currently waiting to be written.
+	uint64_t		queued_records;		//!< Records currently waiting to be written.
+	uint64_t		records;		//!< Records written.
+	uint64_t		bytes;			//!< Bytes written.
+	uint64_t		dropped;		//!< Records rejected because a buffer was full.
+	uint64_t		errors;			//!< Records which could not be written.
+	uint64_t		flushes;		//!< Flushes of one or more files.
+	uint64_t		fsyncs;			//!< fsync() calls.
+	uint64_t		flush_time_ns;		//!< Total time spent flushing.
+	uint64_t		flush_time_max_ns;	//!< Longest flush.
+} exfile_writer_stats_t;
+
+extern conf_parser_t const exfile_writer_config[];
+
+exfile_writer_t		*exfile_writer_alloc(TALLOC_CTX *ctx, exfile_t *ef, char const *name,
+					     exfile_writer_config_t const *config);
+
+exfile_writer_thread_t	*exfile_writer_thread_alloc(TALLOC_CTX *ctx, exfile_writer_t *writer);
+
+int			exfile_writer_append(exfile_writer_thread_t *wt, char const *filename,
+					     mode_t permissions, gid_t group,
+					     struct iovec const *header, size_t header_len,
+					     struct iovec const *vector, size_t vector_len);
+
+void			exfile_writer_stats(exfile_writer_stats_t *out, exfile_writer_t const *writer);
+
+#ifdef __cplusplus
+}
+#endif
@@ -17,6 +17,16 @@
 #include <freeradius-devel/io/base.h>
 #include <freeradius-devel/io/application.h>
 #include <freeradius-devel/server/time_tracking.h>
+#include <freeradius-devel/util/udp_batch.h>
+
+/** How the network thread picks a worker for packets read from a listener
+ *
+ */
+typedef enum {
+	FR_LISTEN_DISPATCH_LOAD = 0,			//!< Least loaded of two randomly chosen workers.
+	FR_LISTEN_DISPATCH_AFFINITY			//!< Same worker for all packets in a flow, unless
+							///< that worker is overloaded.
+} fr_listen_dispatch_t;
 
 /** Describes a path data takes to/from the wire to/from fr_pair_ts
  *
@@ -51,6 +61,16 @@ struct fr_listen {
 
 	size_t			default_message_size;	//!< copied from app_io, but may be changed
 	size_t			num_messages;		//!< for the message ring buffer
+	uint32_t		read_batch;		//!< maximum packets to read per wakeup, for listeners
+							///< which buffer packets internally.  0 means "default".
+	bool			read_pending;		//!< the listener has packets buffered internally
+							///< which it has not yet returned from read().
+	fr_udp_batch_stats_t const *batch_stats;	//!< for listeners which read and write in batches.
+
+	fr_listen_dispatch_t	dispatch;		//!< how packets are assigned to workers.
+	uint32_t		dispatch_spill;		//!< with affinity dispatch, send the packet to another
+							///< worker when the flow's worker has this many
+							///< outstanding packets.  0 means "never".
 };
 
 /**
@@ -71,6 +91,10 @@ struct fr_async_s {
 	uint32_t		priority;	//!< higher == higher priority
 
 	uint32_t		sequence;	//!< higher == higher priority, too
+
+	struct fr_worker_s	*origin;	//!< Worker which received the request, if another
+						//!< worker stole it.  The reply is sent back via
+						//!< the origin, as it owns the channel.
 };
 
 int fr_io_listen_free(fr_listen_t *li);
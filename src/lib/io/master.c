@@ -1313,8 +1313,8 @@ static int8_t alive_client_cmp(void const *one, void const *two)
  *
  *  The app_io->read does the transport-specific data read.
  */
-static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time_p,
-			uint8_t *buffer, size_t buffer_len, size_t *leftover)
+static ssize_t mod_read_packet(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time_p,
+			       uint8_t *buffer, size_t buffer_len, size_t *leftover)
 {
 	fr_io_instance_t const	*inst;
 	fr_io_thread_t		*thread;
@@ -1917,6 +1917,33 @@ have_client:
 	return 0;
 }
 
+/** Read a packet, skipping any which are discarded.
+ *
+ *  A return of 0 normally means "no more data".  But if the child
+ *  reads packets in batches, it may still have packets buffered
+ *  after we discard one (duplicate, unknown client, etc.)  In that
+ *  case the socket may never become readable again, so we keep
+ *  going until we either have a packet, or the child is empty.
+ */
+static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time_p,
+			uint8_t *buffer, size_t buffer_len, size_t *leftover)
+{
+	fr_io_instance_t const	*inst;
+	fr_io_connection_t	*connection;
+	fr_listen_t		*child;
+	ssize_t			packet_len;
+
+	get_inst(li, &inst, NULL, &connection, &child);
+
+	do {
+		packet_len = mod_read_packet(li, packet_ctx, recv_time_p, buffer, buffer_len, leftover);
+	} while ((packet_len == 0) && !*leftover && child->read_pending);
+
+	li->read_pending = child->read_pending;
+
+	return packet_len;
+}
+
 /** Inject a packet to a connection.
  *
  *  Always called in the context of the network.
@@ -1986,6 +2013,8 @@ static int mod_open(fr_listen_t *li)
 	if (inst->app_io->open(thread->child) < 0) return -1;
 
 	li->fd = thread->child->fd;	/* copy this back up */
+	li->read_batch = thread->child->read_batch;
+	li->batch_stats = thread->child->batch_stats;
 
 	/*
 	 *	Set the name of the socket.
@@ -2758,6 +2787,22 @@ reread:
 	return buffer_len;
 }
 
+/** Flush any replies which the child has batched up.
+ *
+ */
+static int mod_flush(fr_listen_t *li)
+{
+	fr_io_instance_t const *inst;
+	fr_io_connection_t *connection;
+	fr_listen_t *child;
+
+	get_inst(li, &inst, NULL, &connection, &child);
+
+	if (!inst->app_io->flush) return 0;
+
+	return inst->app_io->flush(child);
+}
+
 /** Close the socket.
  *
  */
@@ -3068,25 +3113,16 @@ int fr_io_listen_free(fr_listen_t *li)
 	return 0;
 }
 
-int fr_master_io_listen(fr_io_instance_t *inst, fr_schedule_t *sc,
-			size_t default_message_size, size_t num_messages)
+/** Open one socket for a listener, and add it to the scheduler
+ *
+ */
+static int master_io_listen_shard(fr_io_instance_t *inst, fr_schedule_t *sc,
+				  size_t default_message_size, size_t num_messages,
+				  unsigned int shard, unsigned int num_shards)
 {
 	fr_listen_t	*li, *child;
 	fr_io_thread_t	*thread;
 
-	/*
-	 *	No IO paths, so we don't initialize them.
-	 */
-	if (!inst->app_io) {
-		fr_assert(!inst->dynamic_clients);
-		return 0;
-	}
-
-	if (!inst->app_io->common.thread_inst_size) {
-		fr_strerror_const("IO modules MUST set 'thread_inst_size' when using the master IO handler.");
-		return -1;
-	}
-
 	/*
 	 *	Build the #fr_listen_t.  This describes the complete
 	 *	path data takes from the socket to the decoder and
@@ -3117,6 +3153,12 @@ int fr_master_io_listen(fr_io_instance_t *inst, fr_schedule_t *sc,
 	li->default_message_size = default_message_size;
 	li->num_messages = num_messages;
 
+	/*
+	 *	Connected sockets copy these from us.
+	 */
+	li->dispatch = inst->dispatch;
+	li->dispatch_spill = inst->dispatch_spill;
+
 	/*
 	 *	Per-socket data lives here.
 	 */
@@ -3202,9 +3244,10 @@ int fr_master_io_listen(fr_io_instance_t *inst, fr_schedule_t *sc,
 	li->name = child->name;
 
 	/*
-	 *	Record which socket we opened.
+	 *	Record which socket we opened.  The other shards
+	 *	share the same address, and are expected to.
 	 */
-	if (child->app_io_addr) {
+	if (child->app_io_addr && (shard == 0)) {
 		fr_listen_t *other;
 
 		other = listen_find_any(thread->child);
@@ -3221,10 +3264,32 @@ int fr_master_io_listen(fr_io_instance_t *inst, fr_schedule_t *sc,
 		(void) listen_record(child);
 	}
 
+	/*
+	 *	All of the shards are bound.  Tell the kernel to pick
+	 *	the shard by client IP, so that all of the state for
+	 *	a client (dynamic clients, duplicate detection, etc.)
+	 *	lives in one thread.
+	 */
+	if ((num_shards > 1) && (shard == (num_shards - 1)) && child->app_io_addr &&
+	    (fr_socket_reuseport_by_src(child->fd, child->app_io_addr->inet.src_ipaddr.af, num_shards) < 0)) {
+		cf_log_perr(inst->app_io_conf, "Failed sharding %s", child->name);
+		talloc_free(li);
+		return -1;
+	}
+
 	/*
 	 *	Add the socket to the scheduler, where it might end up
 	 *	in a different thread.
 	 */
+	if (num_shards > 1) {
+		if (!fr_schedule_listen_add_shard(sc, li, shard)) {
+			talloc_free(li);
+			return -1;
+		}
+
+		return 0;
+	}
+
 	if (!fr_schedule_listen_add(sc, li)) {
 		talloc_free(li);
 		return -1;
@@ -3233,6 +3298,56 @@ int fr_master_io_listen(fr_io_instance_t *inst, fr_schedule_t *sc,
 	return 0;
 }
 
+int fr_master_io_listen(fr_io_instance_t *inst, fr_schedule_t *sc,
+			size_t default_message_size, size_t num_messages)
+{
+	unsigned int	i, num_shards;
+
+	/*
+	 *	No IO paths, so we don't initialize them.
+	 */
+	if (!inst->app_io) {
+		fr_assert(!inst->dynamic_clients);
+		return 0;
+	}
+
+	if (!inst->app_io->common.thread_inst_size) {
+		fr_strerror_const("IO modules MUST set 'thread_inst_size' when using the master IO handler.");
+		return -1;
+	}
+
+	/*
+	 *	Sharding opens one SO_REUSEPORT socket per network
+	 *	thread.  It only makes sense for UDP, where there are
+	 *	no connections to track across shards.
+	 */
+	num_shards = 1;
+	if (inst->shards > 1) {
+		if (inst->ipproto != IPPROTO_UDP) {
+			cf_log_warn(inst->app_io_conf, "Ignoring 'shards' - it is only supported for UDP");
+		} else {
+			num_shards = fr_schedule_num_networks(sc);
+			if (num_shards > inst->shards) num_shards = inst->shards;
+		}
+	}
+
+	/*
+	 *	Each shard enforces its own limits, so split the
+	 *	configured limits among them.  Zero means "no limit".
+	 */
+	if (num_shards > 1) {
+		if (inst->max_connections) inst->max_connections = ROUND_UP_DIV(inst->max_connections, num_shards);
+		if (inst->max_clients) inst->max_clients = ROUND_UP_DIV(inst->max_clients, num_shards);
+		if (inst->max_pending_packets) inst->max_pending_packets = ROUND_UP_DIV(inst->max_pending_packets, num_shards);
+	}
+
+	for (i = 0; i < num_shards; i++) {
+		if (master_io_listen_shard(inst, sc, default_message_size, num_messages, i, num_shards) < 0) return -1;
+	}
+
+	return 0;
+}
+
 /*
  *	Used to create a tracking structure for fr_network_sendto_worker()
  */
@@ -3289,6 +3404,7 @@ fr_app_io_t fr_master_app_io = {
 
 	.read			= mod_read,
 	.write			= mod_write,
+	.flush			= mod_flush,
 	.inject			= mod_inject,
 
 	.open			= mod_open,
@@ -28,6 +28,7 @@ RCSIDH(master_h, "$Id$")
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/io/schedule.h>
 #include <freeradius-devel/io/application.h>
+#include <freeradius-devel/io/listen.h>
 #include <freeradius-devel/util/trie.h>
 #include <freeradius-devel/util/talloc.h>
 
@@ -78,6 +79,11 @@ typedef struct {
 	uint32_t			max_connections;		//!< maximum number of connections to allow
 	uint32_t			max_clients;			//!< maximum number of dynamic clients to allow
 	uint32_t			max_pending_packets;		//!< maximum number of pending packets
+	uint32_t			shards;				//!< number of SO_REUSEPORT sockets to open, one
+									///< per network thread.
+	fr_listen_dispatch_t		dispatch;			//!< how packets are assigned to workers.
+	uint32_t			dispatch_spill;			//!< outstanding packets before a flow spills
+									///< to another worker.
 
 	fr_time_delta_t			cleanup_delay;			//!< for Access-Request packets
 	fr_time_delta_t			idle_timeout;			//!< for connected clients
@@ -29,6 +29,7 @@ RCSID("$Id$")
 #define LOG_DST nr->log
 
 #include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/rand.h>
 #include <freeradius-devel/util/rb.h>
@@ -65,6 +66,8 @@ typedef struct {
 
 	bool			blocked;		//!< is this worker blocked?
 
+	int			numa_node;		//!< NUMA node the worker is pinned to, or -1.
+
 	fr_channel_t		*channel;		//!< channel to the worker
 	fr_worker_t		*worker;		//!< worker pointer
 	fr_io_stats_t		stats;
@@ -93,6 +96,7 @@ typedef struct {
 
 	fr_channel_data_t	*pending;		//!< the currently pending partial packet
 	fr_heap_t		*waiting;		//!< packets waiting to be written
+	fr_dlist_t		write_entry;		//!< in the list of sockets with replies to write
 	fr_io_stats_t		stats;
 } fr_network_socket_t;
 
@@ -128,8 +132,12 @@ struct fr_network_s {
 	fr_event_list_t		*el;			//!< our event list
 
 	fr_heap_t		*replies;		//!< replies from the worker, ordered by priority / origin time
+	fr_dlist_head_t		write_pending;		//!< sockets which have replies waiting to be written
 
 	fr_io_stats_t		stats;
+	uint64_t		affinity_hits;		//!< packets sent to the worker which owns their flow.
+	uint64_t		affinity_spills;	//!< packets sent elsewhere because that worker was
+							///< blocked or overloaded.
 
 	fr_rb_tree_t		*sockets;		//!< list of sockets we're managing, ordered by the listener
 	fr_rb_tree_t		*sockets_by_num;       	//!< ordered by number;
@@ -147,12 +155,19 @@ struct fr_network_s {
 
 	fr_network_config_t	config;			//!< configuration
 	fr_network_worker_t	*workers[MAX_WORKERS]; 	//!< each worker
+
+	int			numa_node;		//!< NUMA node we're pinned to, or -1.
+	int			num_local_workers;	//!< number of workers on our NUMA node.
+	int			local_workers[MAX_WORKERS]; //!< indexes into workers[] of the workers
+							///< on our NUMA node.
+	uint64_t		numa_local;		//!< packets sent to a worker on our NUMA node.
 };
 
 static void fr_network_post_event(fr_event_list_t *el, fr_time_t now, void *uctx);
 static int fr_network_pre_event(fr_time_t now, fr_time_delta_t wake, void *uctx);
 static void fr_network_socket_dead(fr_network_t *nr, fr_network_socket_t *s);
 static void fr_network_read(UNUSED fr_event_list_t *el, int sockfd, UNUSED int flags, void *ctx);
+static void fr_network_local_workers_update(fr_network_t *nr);
 
 static int8_t reply_cmp(void const *one, void const *two)
 {
@@ -605,6 +620,7 @@ static void fr_network_channel_callback(void *ctx, void const *data, size_t data
 			}
 		}
 		nr->num_workers--;
+		fr_network_local_workers_update(nr);
 	}
 		break;
 	}
@@ -612,6 +628,88 @@ static void fr_network_channel_callback(void *ctx, void const *data, size_t data
 
 #define OUTSTANDING(_x) ((_x)->stats.in - (_x)->stats.out)
 
+/** Rebuild the list of workers which are on the same NUMA node as us
+ *
+ * @param[in] nr	the network.
+ */
+static void fr_network_local_workers_update(fr_network_t *nr)
+{
+	int i;
+
+	nr->num_local_workers = 0;
+
+	if (nr->numa_node < 0) return;
+
+	for (i = 0; i < nr->num_workers; i++) {
+		if (!nr->workers[i]) continue;
+
+		if (nr->workers[i]->numa_node != nr->numa_node) continue;
+
+		nr->local_workers[nr->num_local_workers++] = i;
+	}
+}
+
+fr_table_num_sorted_t const fr_network_dispatch_table[] = {
+	{ L("affinity"),	FR_LISTEN_DISPATCH_AFFINITY	},
+	{ L("load"),		FR_LISTEN_DISPATCH_LOAD		}
+};
+size_t fr_network_dispatch_table_len = NUM_ELEMENTS(fr_network_dispatch_table);
+
+/** Map a flow to a worker
+ *
+ * Uses the "jump" consistent hash from Lamping and Veach, so that
+ * when the number of workers changes, only 1/N of the flows move.
+ */
+static int fr_network_flow_to_worker(uint32_t flow, int num_workers)
+{
+	uint64_t	key = flow;
+	int64_t		b = -1, j = 0;
+
+	while (j < num_workers) {
+		b = j;
+		key = key * 2862933555777941757ULL + 1;
+		j = (b + 1) * ((double)(1LL << 31) / (double)((key >> 33) + 1));
+	}
+
+	return b;
+}
+
+/** Find the worker which owns the flow a packet belongs to
+ *
+ * @param nr the network
+ * @param cd the message we've received
+ * @return
+ *	- The worker to send the packet to.
+ *	- NULL if the packet isn't part of a flow, or the worker which
+ *	  owns the flow can't take it.  The caller should then pick a
+ *	  worker based on load.
+ */
+static fr_network_worker_t *fr_network_worker_by_flow(fr_network_t *nr, fr_channel_data_t const *cd)
+{
+	fr_listen_t const	*li = cd->listen;
+	fr_network_worker_t	*worker;
+	uint32_t		flow = 0;
+
+	if (li->app->affinity) flow = li->app->affinity(li->app_instance, cd->m.data, cd->m.data_size);
+
+	/*
+	 *	All packets on a connection are one flow.
+	 */
+	if (li->connected) flow = fr_hash_update(&li, sizeof(li), flow);
+
+	if (!flow) return NULL;
+
+	worker = nr->workers[fr_network_flow_to_worker(flow, nr->num_workers)];
+	if (worker->blocked ||
+	    (li->dispatch_spill && (OUTSTANDING(worker) >= li->dispatch_spill))) {
+		nr->affinity_spills++;
+		return NULL;
+	}
+
+	nr->affinity_hits++;
+	return worker;
+}
+
 /** Send a message on the "best" channel.
  *
  * @param nr the network
@@ -634,14 +732,42 @@ retry:
 			return -1;
 		}
 
+	} else if ((cd->listen->dispatch == FR_LISTEN_DISPATCH_AFFINITY) &&
+		   (worker = fr_network_worker_by_flow(nr, cd))) {
+		/*
+		 *	Keep the flow on its worker, so that the
+		 *	worker's copy of the session data stays hot.
+		 */
+
 	} else if (nr->num_blocked == 0) {
 		int64_t cmp;
 		uint32_t one, two;
 
-		one = fr_rand() % nr->num_workers;
-		do {
-			two = fr_rand() % nr->num_workers;
-		} while (two == one);
+		/*
+		 *	Prefer workers on our own NUMA node, so that
+		 *	the channel and message buffers stay local.
+		 */
+		if (nr->num_local_workers >= 2) {
+			uint32_t i;
+
+			i = fr_rand() % nr->num_local_workers;
+			one = nr->local_workers[i];
+			do {
+				two = nr->local_workers[fr_rand() % nr->num_local_workers];
+			} while (two == one);
+
+		} else if (nr->num_local_workers == 1) {
+			one = nr->local_workers[0];
+			do {
+				two = fr_rand() % nr->num_workers;
+			} while (two == one);
+
+		} else {
+			one = fr_rand() % nr->num_workers;
+			do {
+				two = fr_rand() % nr->num_workers;
+			} while (two == one);
+		}
 
 		/*
 		 *	Choose a worker based on minimizing the amount
@@ -664,6 +790,8 @@ retry:
 		} else {
 			worker = nr->workers[two];
 		}
+
+		if ((nr->numa_node >= 0) && (worker->numa_node == nr->numa_node)) nr->numa_local++;
 	} else {
 		int i;
 		uint64_t min_outstanding = UINT64_MAX;
@@ -907,9 +1035,11 @@ static void fr_network_read(UNUSED fr_event_list_t *el, int sockfd, UNUSED int f
 next_message:
 	/*
 	 *	Poll this socket, but not too often.  We have to go
-	 *	service other sockets, too.
+	 *	service other sockets, too.  Batching listeners
+	 *	stop once they've returned everything from one
+	 *	read of the socket, below.
 	 */
-	if (num_messages > 16) {
+	if ((num_messages > 16) && (s->listen->read_batch <= 1)) {
 		s->cd = cd;
 		return;
 	}
@@ -1043,6 +1173,25 @@ next_message:
 		num_messages++;
 		goto next_message;
 	}
+
+	/*
+	 *	Listeners which read packets in batches may have
+	 *	packets buffered internally, even though the socket
+	 *	is no longer readable.  Drain those, but don't read
+	 *	the socket again.  If it has more packets, it's still
+	 *	readable, and we'll get called again after the other
+	 *	sockets have been serviced.
+	 */
+	if (s->listen->read_pending) {
+		cd = (fr_channel_data_t *) fr_message_reserve(s->ms, s->listen->default_message_size);
+		if (!cd) {
+			ERROR("Failed allocating message size %zd! - Closing socket",
+			      s->listen->default_message_size);
+			fr_network_socket_dead(nr, s);
+			return;
+		}
+		goto next_message;
+	}
 }
 
 int fr_network_sendto_worker(fr_network_t *nr, fr_listen_t *li, void *packet_ctx, uint8_t const *data, size_t data_len, fr_time_t recv_time)
@@ -1266,6 +1415,31 @@ static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 		cd = fr_heap_pop(&s->waiting);
 	}
 
+	/*
+	 *	Push out any packets which the listener has batched
+	 *	up.  If the socket isn't writable, then wait for it
+	 *	to become writable, and flush again.
+	 */
+	if (li->app_io->flush && (li->app_io->flush(li) < 0)) {
+		if (errno != EWOULDBLOCK) {
+			PERROR("Failed flushing socket %s", s->listen->name);
+			if (li->app_io->error) li->app_io->error(li);
+			fr_network_socket_dead(nr, s);
+			return;
+		}
+
+		if (!s->blocked) {
+			if (fr_event_filter_update(nr->el, s->listen->fd, FR_EVENT_FILTER_IO, resume_write) < 0) {
+				PERROR("Failed adding write callback to event loop");
+				fr_network_socket_dead(nr, s);
+				return;
+			}
+
+			s->blocked = true;
+		}
+		return;
+	}
+
 	/*
 	 *	We've successfully written all of the packets.  Remove
 	 *	the write callback.
@@ -1288,6 +1462,8 @@ static int _network_socket_free(fr_network_socket_t *s)
 	fr_rb_delete(nr->sockets, s);
 	fr_rb_delete(nr->sockets_by_num, s);
 
+	if (fr_dlist_entry_in_list(&s->write_entry)) fr_dlist_remove(&nr->write_pending, s);
+
 	fr_event_fd_delete(nr->el, s->listen->fd, s->filter);
 
 	if (s->listen->app_io->close) {
@@ -1532,6 +1708,7 @@ static void fr_network_worker_started_callback(void *ctx, void const *data, size
 	MEM(w = talloc_zero(nr, fr_network_worker_t));
 
 	w->worker = worker;
+	w->numa_node = fr_worker_numa_node(worker);
 	w->channel = fr_worker_channel_create(worker, w, nr->control);
 	w->predicted = fr_time_delta_from_msec(10);
 	fr_fatal_assert_msg(w->channel, "Failed creating new channel");
@@ -1554,6 +1731,7 @@ static void fr_network_worker_started_callback(void *ctx, void const *data, size
 		if (nr->workers[i]) continue;
 
 		nr->workers[i] = w;
+		fr_network_local_workers_update(nr);
 		return;
 	}
 
@@ -1685,8 +1863,23 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED fr_time_t n
 		 *	waiting for IO write to become ready.
 		 */
 		if (!s->pending) {
-			fr_assert(!s->blocked);
+			fr_assert(!s->blocked || s->listen->app_io->flush);
 			(void) fr_heap_insert(&s->waiting, cd);
+
+			/*
+			 *	Write all of the replies for a socket
+			 *	in one go, so that listeners which
+			 *	batch their writes can send them in as
+			 *	few system calls as possible.
+			 */
+			if (!fr_dlist_entry_in_list(&s->write_entry)) fr_dlist_insert_tail(&nr->write_pending, s);
+		}
+	}
+
+	{
+		fr_network_socket_t *s;
+
+		while ((s = fr_dlist_pop_head(&nr->write_pending)) != NULL) {
 			fr_network_write(nr->el, s->listen->fd, 0, s);
 		}
 	}
@@ -1922,6 +2115,7 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const
 
 	nr->max_workers = MAX_WORKERS;
 	nr->num_workers = 0;
+	nr->numa_node = -1;
 	nr->signal_pipe[0] = -1;
 	nr->signal_pipe[1] = -1;
 	if (config) nr->config = *config;
@@ -2000,6 +2194,8 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const
 		goto fail2;
 	}
 
+	fr_dlist_init(&nr->write_pending, fr_network_socket_t, write_entry);
+
 	if (fr_event_pre_insert(nr->el, fr_network_pre_event, nr) < 0) {
 		fr_strerror_const("Failed adding pre-check to event list");
 		goto fail2;
@@ -2055,6 +2251,20 @@ void fr_network_stats_log(fr_network_t const *nr, fr_log_t const *log)
 	}
 }
 
+/** Record the NUMA node a network's thread has been pinned to
+ *
+ * Must be called before any workers are added.  Packets are then
+ * preferentially sent to workers on the same node.
+ *
+ * @param[in] nr	the network.
+ * @param[in] node	the NUMA node, or -1 if the thread isn't pinned.
+ */
+void fr_network_numa_node_set(fr_network_t *nr, int node)
+{
+	nr->numa_node = node;
+	fr_network_local_workers_update(nr);
+}
+
 static int cmd_stats_self(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
 {
 	fr_network_t const *nr = ctx;
@@ -2064,6 +2274,9 @@ static int cmd_stats_self(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cm
 	fprintf(fp, "count.dup\t%" PRIu64 "\n", nr->stats.dup);
 	fprintf(fp, "count.dropped\t%" PRIu64 "\n", nr->stats.dropped);
 	fprintf(fp, "count.sockets\t%u\n", fr_rb_num_elements(nr->sockets));
+	fprintf(fp, "count.affinity_hits\t%" PRIu64 "\n", nr->affinity_hits);
+	fprintf(fp, "count.affinity_spills\t%" PRIu64 "\n", nr->affinity_spills);
+	fprintf(fp, "count.numa_local\t%" PRIu64 "\n", nr->numa_local);
 
 	return 0;
 }
@@ -2104,6 +2317,18 @@ static int cmd_stats_socket(FILE *fp, FILE *fp_err, void *ctx, fr_cmd_info_t con
 	fprintf(fp, "count.dup\t%" PRIu64 "\n", s->stats.dup);
 	fprintf(fp, "count.dropped\t%" PRIu64 "\n", s->stats.dropped);
 
+	if (s->listen->batch_stats) {
+		fr_udp_batch_stats_t const *bs = s->listen->batch_stats;
+
+		fprintf(fp, "batch.recv_calls\t%" PRIu64 "\n", bs->recv_calls);
+		fprintf(fp, "batch.recv_packets\t%" PRIu64 "\n", bs->recv_packets);
+		fprintf(fp, "batch.recv_depth_max\t%" PRIu32 "\n", bs->recv_depth_max);
+		fprintf(fp, "batch.send_calls\t%" PRIu64 "\n", bs->send_calls);
+		fprintf(fp, "batch.send_packets\t%" PRIu64 "\n", bs->send_packets);
+		fprintf(fp, "batch.send_depth_max\t%" PRIu32 "\n", bs->send_depth_max);
+		fprintf(fp, "batch.send_errors\t%" PRIu64 "\n", bs->send_errors);
+	}
+
 	return 0;
 }
 
@@ -46,6 +46,9 @@ typedef struct {
 	uint32_t	max_outstanding;
 } fr_network_config_t;
 
+extern fr_table_num_sorted_t const fr_network_dispatch_table[];
+extern size_t fr_network_dispatch_table_len;
+
 int		fr_network_listen_add(fr_network_t *nr, fr_listen_t *li) CC_HINT(nonnull) CC_HINT(warn_unused_result);
 
 int		fr_network_listen_delete(fr_network_t *nr, fr_listen_t *li) CC_HINT(nonnull) CC_HINT(warn_unused_result);
@@ -74,6 +77,8 @@ fr_network_t	*fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 				   char const *nr, fr_log_t const *logger, fr_log_lvl_t lvl,
 				   fr_network_config_t const *config) CC_HINT(nonnull(2,4)) CC_HINT(warn_unused_result);
 
+void		fr_network_numa_node_set(fr_network_t *nr, int node) CC_HINT(nonnull);
+
 int		fr_network_exit(fr_network_t *nr) CC_HINT(nonnull) CC_HINT(warn_unused_result);
 
 int		fr_network_destroy(fr_network_t *nr) CC_HINT(nonnull) CC_HINT(warn_unused_result);
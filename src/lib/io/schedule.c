@@ -30,6 +30,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/io/schedule.h>
 #include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hw.h>
 #include <freeradius-devel/util/rb.h>
 #include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/server/trigger.h>
@@ -95,6 +96,8 @@ typedef struct {
 
 	fr_schedule_child_status_t status;	//!< status of the worker
 	fr_worker_t	*worker;		//!< the worker data structure
+
+	int		cpu;			//!< CPU to pin the thread to, or -1.
 } fr_schedule_worker_t;
 
 /** Scheduler specific information for network threads
@@ -115,6 +118,8 @@ typedef struct {
 	fr_schedule_child_status_t status;	//!< status of the worker
 	fr_network_t	*nr;			//!< the receive data structure
 
+	int		cpu;			//!< CPU to pin the thread to, or -1.
+
 	fr_timer_t 	*ev;		//!< timer for stats_interval
 } fr_schedule_network_t;
 
@@ -146,6 +151,13 @@ struct fr_schedule_s {
 
 	fr_network_t	*single_network;	//!< for single-threaded mode
 	fr_worker_t	*single_worker;		//!< for single-threaded mode
+
+	fr_worker_steal_t *steal;		//!< shared by workers for work stealing
+
+	unsigned int	*network_cpus;		//!< CPUs network threads are pinned to.
+	unsigned int	num_network_cpus;	//!< number of entries in network_cpus.
+	unsigned int	*worker_cpus;		//!< CPUs worker threads are pinned to.
+	unsigned int	num_worker_cpus;	//!< number of entries in worker_cpus.
 };
 
 static _Thread_local int worker_id;		//!< Internal ID of the current worker thread.
@@ -159,6 +171,104 @@ int fr_schedule_worker_id(void)
 	return worker_id;
 }
 
+/** Parse a list of CPUs, in the same format as the kernel's "cpulist", e.g. "0-3,8,10-11"
+ *
+ * @param[in] ctx	to allocate the array in.
+ * @param[out] out	array of CPU numbers.
+ * @param[in] name	of the configuration item, for error messages.
+ * @param[in] list	to parse.
+ * @return
+ *	- >0 the number of CPUs in the list.
+ *	- -1 on error.
+ */
+static int fr_schedule_cpu_list_parse(TALLOC_CTX *ctx, unsigned int **out, char const *name, char const *list)
+{
+	char const	*p = list;
+	unsigned int	*cpus = NULL;
+	int		num = 0;
+
+	while (*p) {
+		unsigned long	first, last;
+		char		*q;
+
+		first = last = strtoul(p, &q, 10);
+		if (q == p) goto error;
+
+		if (*q == '-') {
+			p = q + 1;
+			last = strtoul(p, &q, 10);
+			if ((q == p) || (last < first)) goto error;
+		}
+
+#ifdef CPU_SETSIZE
+		if (last >= CPU_SETSIZE) {
+			fr_strerror_printf("Invalid %s - CPU %lu is larger than the maximum of %u",
+					   name, last, CPU_SETSIZE - 1);
+			talloc_free(cpus);
+			return -1;
+		}
+#endif
+
+		MEM(cpus = talloc_realloc(ctx, cpus, unsigned int, num + (last - first) + 1));
+		while (first <= last) cpus[num++] = first++;
+
+		if (*q == '\0') break;
+		if (*q != ',') goto error;
+		p = q + 1;
+	}
+
+	if (!num) {
+	error:
+		fr_strerror_printf("Invalid %s \"%s\" - expected list of CPUs, e.g. \"0-3,8\"", name, list);
+		talloc_free(cpus);
+		return -1;
+	}
+
+	*out = cpus;
+	return num;
+}
+
+/** Pin the current thread to a CPU
+ *
+ * This should be done before the thread allocates any memory.  Memory
+ * is then placed on the CPU's NUMA node when the thread first touches it.
+ *
+ * @param[in] sc	the scheduler.
+ * @param[in] name	of the thread, for logging.
+ * @param[in] cpu	to pin the thread to.
+ * @return
+ *	- >= 0 the NUMA node of the CPU.
+ *	- -1 if the NUMA node is unknown, or the thread couldn't be pinned.
+ */
+static int fr_schedule_thread_pin(fr_schedule_t *sc, char const *name, unsigned int cpu)
+{
+#ifdef __linux__
+	cpu_set_t	set;
+	int		ret, node;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (ret != 0) {
+		ERROR("%s - Failed pinning thread to CPU %u: %s", name, cpu, fr_syserror(ret));
+		return -1;
+	}
+
+	node = fr_hw_numa_node_of_cpu(cpu);
+	if (node < 0) {
+		INFO("%s - Pinned to CPU %u", name, cpu);
+	} else {
+		INFO("%s - Pinned to CPU %u on NUMA node %d", name, cpu, node);
+	}
+
+	return node;
+#else
+	WARN("%s - Pinning threads to CPUs is not supported on this platform", name);
+	return -1;
+#endif
+}
+
 /** Entry point for worker threads
  *
  * @param[in] arg	the fr_schedule_worker_t
@@ -172,6 +282,7 @@ static void *fr_schedule_worker_thread(void *arg)
 	fr_schedule_child_status_t	status = FR_CHILD_FAIL;
 	fr_schedule_network_t		*sn;
 	char				worker_name[32];
+	int				numa_node = -1;
 
 #ifndef __APPLE__
 	/*
@@ -204,6 +315,12 @@ static void *fr_schedule_worker_thread(void *arg)
 
 	snprintf(worker_name, sizeof(worker_name), "Worker %d", sw->id);
 
+	/*
+	 *	Pin first, so that everything we allocate
+	 *	lands on our NUMA node.
+	 */
+	if (sw->cpu >= 0) numa_node = fr_schedule_thread_pin(sc, worker_name, sw->cpu);
+
 	sw->ctx = ctx = talloc_init("%s", worker_name);
 	if (!ctx) {
 		ERROR("%s - Failed allocating memory", worker_name);
@@ -224,6 +341,12 @@ static void *fr_schedule_worker_thread(void *arg)
 		PERROR("%s - Failed creating worker", worker_name);
 		goto fail;
 	}
+	fr_worker_numa_node_set(sw->worker, numa_node);
+
+	if (sc->steal && (fr_worker_steal_add(sw->worker, sc->steal, sw->id) < 0)) {
+		PERROR("%s - Failed enabling work stealing", worker_name);
+		goto fail;
+	}
 
 	/*
 	 *	@todo make this a registry
@@ -323,6 +446,7 @@ static void *fr_schedule_network_thread(void *arg)
 	fr_schedule_child_status_t	status = FR_CHILD_FAIL;
 	fr_event_list_t			*el;
 	char				network_name[32];
+	int				numa_node = -1;
 
 #ifndef __APPLE__
 	/*
@@ -355,6 +479,8 @@ static void *fr_schedule_network_thread(void *arg)
 
 	INFO("%s - Starting", network_name);
 
+	if (sn->cpu >= 0) numa_node = fr_schedule_thread_pin(sc, network_name, sn->cpu);
+
 	sn->ctx = ctx = talloc_init("%s", network_name);
 	if (!ctx) {
 		ERROR("%s - Failed allocating memory", network_name);
@@ -372,6 +498,7 @@ static void *fr_schedule_network_thread(void *arg)
 		PERROR("%s - Failed creating network", network_name);
 		goto fail;
 	}
+	fr_network_numa_node_set(sn->nr, numa_node);
 
 	sn->status = FR_CHILD_RUNNING;
 
@@ -587,6 +714,31 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 	fr_dlist_init(&sc->workers, fr_schedule_worker_t, entry);
 	fr_dlist_init(&sc->networks, fr_schedule_network_t, entry);
 
+	/*
+	 *	Threads are pinned to CPUs round-robin from the
+	 *	configured lists.
+	 */
+	if (sc->config->network_cpus) {
+		int num;
+
+		num = fr_schedule_cpu_list_parse(sc, &sc->network_cpus, "network_cpus", sc->config->network_cpus);
+		if (num < 0) {
+		cpu_fail:
+			PERROR("Failed parsing thread configuration");
+			talloc_free(sc);
+			return NULL;
+		}
+		sc->num_network_cpus = num;
+	}
+
+	if (sc->config->worker_cpus) {
+		int num;
+
+		num = fr_schedule_cpu_list_parse(sc, &sc->worker_cpus, "worker_cpus", sc->config->worker_cpus);
+		if (num < 0) goto cpu_fail;
+		sc->num_worker_cpus = num;
+	}
+
 	memset(&sc->network_sem, 0, sizeof(sc->network_sem));
 	if (sem_init(&sc->network_sem, 0, SEMAPHORE_LOCKED) != 0) {
 		ERROR("Failed creating semaphore: %s", fr_syserror(errno));
@@ -619,6 +771,7 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		sn->id = i;
 		sn->sc = sc;
 		sn->status = FR_CHILD_INITIALIZING;
+		sn->cpu = sc->num_network_cpus ? (int) sc->network_cpus[i % sc->num_network_cpus] : -1;
 		fr_dlist_insert_head(&sc->networks, sn);
 
 		if (fr_schedule_pthread_create(&sn->pthread_id, fr_schedule_network_thread, sn) < 0) {
@@ -660,6 +813,19 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		return NULL;
 	}
 
+	/*
+	 *	Idle workers can only steal from their peers if
+	 *	there's more than one worker.
+	 */
+	if (sc->config->worker.steal_threshold && (sc->config->max_workers > 1)) {
+		sc->steal = fr_worker_steal_alloc(sc, sc->config->max_workers);
+		if (!sc->steal) {
+			PERROR("Failed creating work stealing state");
+			fr_schedule_destroy(&sc);
+			return NULL;
+		}
+	}
+
 	/*
 	 *	Create all of the workers.
 	 */
@@ -678,6 +844,7 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		sw->id = i;
 		sw->sc = sc;
 		sw->status = FR_CHILD_INITIALIZING;
+		sw->cpu = sc->num_worker_cpus ? (int) sc->worker_cpus[i % sc->num_worker_cpus] : -1;
 		fr_dlist_insert_head(&sc->workers, sw);
 
 		if (fr_schedule_pthread_create(&sw->pthread_id, fr_schedule_worker_thread, sw) < 0) {
@@ -913,6 +1080,56 @@ fr_network_t *fr_schedule_listen_add(fr_schedule_t *sc, fr_listen_t *li)
 	return nr;
 }
 
+/** Return the number of network threads which can accept listeners
+ *
+ * @param[in] sc the scheduler
+ * @return the number of network threads.
+ */
+unsigned int fr_schedule_num_networks(fr_schedule_t const *sc)
+{
+	if (sc->el) return 1;
+
+	return fr_dlist_num_elements(&sc->networks);
+}
+
+/** Add one shard of a sharded fr_listen_t to a scheduler.
+ *
+ * Each shard of a listener is placed in a different network
+ * thread, so that the kernel can spread the load for one port
+ * across multiple CPUs.
+ *
+ * @param[in] sc the scheduler
+ * @param[in] li the ctx and callbacks for the transport.
+ * @param[in] shard the shard number, from 0.
+ * @return
+ *	- NULL on error
+ *	- the fr_network_t that the socket was added to.
+ */
+fr_network_t *fr_schedule_listen_add_shard(fr_schedule_t *sc, fr_listen_t *li, unsigned int shard)
+{
+	fr_network_t *nr;
+
+	(void) talloc_get_type_abort(sc, fr_schedule_t);
+
+	if (sc->el) {
+		nr = sc->single_network;
+	} else {
+		fr_schedule_network_t *sn;
+
+		shard %= fr_dlist_num_elements(&sc->networks);
+
+		for (sn = fr_dlist_head(&sc->networks);
+		     shard > 0;
+		     sn = fr_dlist_next(&sc->networks, sn), shard--);
+
+		nr = sn->nr;
+	}
+
+	if (fr_network_listen_add(nr, li) < 0) return NULL;
+
+	return nr;
+}
+
 /** Add a directory NOTE_EXTEND to a scheduler.
  *
  * @param[in] sc the scheduler
@@ -0,0 +1,1249 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @brief Connection trunks shared between worker threads.
+ * @file io/trunk_shared.c
+ *
+ * Normally every worker thread has its own trunk, and so its own set of connections
+ * to each backend.  With many workers that multiplies the number of connections the
+ * backend has to service, most of which sit idle.
+ *
+ * In shared mode a small number of I/O threads each own a real trunk.  Workers are
+ * given a proxy trunk (see #trunk_proxy_alloc) which passes their requests to the
+ * least loaded I/O thread via a lock-free mailbox.
+ *
+ * All communication between workers and I/O threads is by message, and messages are
+ * only ever processed from the event loop of the receiving thread.  Neither side ever
+ * waits for the other.
+ *
+ * - Requests are enqueued on the I/O thread's trunk without a request_t, so the
+ *   connection and I/O callbacks never log to, or otherwise use, a request owned by
+ *   a worker.  Calls to #unlang_interpret_mark_runnable made by the I/O callbacks are
+ *   forwarded back to the worker which owns the request.
+ * - If the I/O thread's trunk finishes with a request first, the outcome is sent to the
+ *   worker as a "result" message.  The worker calls the API client's complete or fail
+ *   callback, and replies with a "release" message.
+ * - If the API client finishes with a request first, the worker sends a complete, fail
+ *   or cancel message.
+ * - Once the I/O thread has seen the worker's final message, and its trunk has released
+ *   the request, it sends a "done" message.  Only then does the worker free its state.
+ *
+ * The API client must not free a preq whilst it may still be in use by the I/O thread.
+ * Complete and fail must only be signalled once the request has been marked runnable
+ * with its result, and on cancellation the preq must be parented by the treq (as is
+ * already required for API clients which provide a cancel_mux callback).
+ *
+ * @copyright 2025 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#define LOG_PREFIX shared->name
+
+#include <freeradius-devel/io/atomic_queue.h>
+#include <freeradius-devel/io/schedule.h>
+#include <freeradius-devel/io/trunk_shared.h>
+#include <freeradius-devel/server/command.h>
+#include <freeradius-devel/server/log.h>
+#include <freeradius-devel/unlang/interpret.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/rb.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+/** How many messages each mailbox can hold
+ */
+#define TRUNK_SHARED_MAILBOX_SIZE	4096
+
+/** How long a worker waits for outstanding requests to be released when it exits
+ */
+#define TRUNK_SHARED_DETACH_TIMEOUT	fr_time_delta_from_sec(10)
+
+typedef struct trunk_shared_io_s trunk_shared_io_t;
+typedef struct trunk_shared_worker_s trunk_shared_worker_t;
+typedef struct trunk_shared_request_s trunk_shared_request_t;
+
+typedef enum {
+	TRUNK_SHARED_MSG_ENQUEUE = 1,			//!< Worker -> I/O.  Enqueue a new request.
+	TRUNK_SHARED_MSG_REQUEUE,			//!< Worker -> I/O.  Requeue on the same connection.
+	TRUNK_SHARED_MSG_COMPLETE,			//!< Worker -> I/O.  API client is done with the request.
+	TRUNK_SHARED_MSG_FAIL,				//!< Worker -> I/O.  API client failed the request.
+	TRUNK_SHARED_MSG_CANCEL,			//!< Worker -> I/O.  Request was cancelled.
+	TRUNK_SHARED_MSG_RELEASE,			//!< Worker -> I/O.  Result processed.
+	TRUNK_SHARED_MSG_RUNNABLE,			//!< I/O -> Worker.  Mark the request runnable.
+	TRUNK_SHARED_MSG_RESULT,			//!< I/O -> Worker.  I/O trunk released the request
+							///< before the worker was done with it.
+	TRUNK_SHARED_MSG_DONE				//!< I/O -> Worker.  Neither thread needs the request.
+} trunk_shared_msg_type_t;
+
+/** A message passed between threads
+ *
+ * Messages are embedded in the structures they refer to, so passing them never allocates.
+ */
+typedef struct {
+	trunk_shared_msg_type_t	type;
+	trunk_shared_request_t	*sreq;			//!< Request this message refers to.
+	fr_dlist_t		entry;			//!< Entry in an overflow list.
+} trunk_shared_msg_t;
+
+/** Where messages for a thread are delivered
+ */
+typedef struct {
+	fr_atomic_queue_t	*queue;			//!< Messages for the thread.
+	int			pipe[2];		//!< Wakes the thread's event loop.
+	atomic_bool		signalled;		//!< A wakeup is pending, so senders needn't write
+							///< to the pipe again.
+} trunk_shared_mailbox_t;
+
+/** A request forwarded from a worker's proxy trunk to an I/O thread
+ *
+ * Allocated and freed by the worker.  The I/O thread only accesses it between
+ * receiving the enqueue message and sending the done message.
+ */
+struct trunk_shared_request_s {
+	trunk_request_t		*treq;			//!< Proxy treq.  NULL if the API client has already
+							///< been told the outcome.
+	trunk_shared_worker_t	*worker;		//!< Worker which owns the request.
+	trunk_shared_io_t	*io;			//!< I/O thread servicing the request.
+
+	request_t		*request;		//!< Owned by the worker.
+	void			*preq;			//!< Owned by the API client.
+	void			*rctx;			//!< Owned by the API client.
+
+	fr_time_t		enqueued;		//!< When the worker sent the enqueue message.
+
+	trunk_shared_msg_t	msg_enqueue;		//!< Worker -> I/O.
+	trunk_shared_msg_t	msg_requeue;		//!< Worker -> I/O.
+	trunk_shared_msg_t	msg_final;		//!< Worker -> I/O.  Complete, fail, cancel or release.
+	trunk_shared_msg_t	msg_runnable;		//!< I/O -> Worker.
+	trunk_shared_msg_t	msg_result;		//!< I/O -> Worker.
+	trunk_shared_msg_t	msg_done;		//!< I/O -> Worker.
+
+	atomic_bool		runnable_queued;	//!< msg_runnable is in flight.
+	atomic_bool		requeue_queued;		//!< msg_requeue is in flight.
+
+	/** @name Owned by the I/O thread
+	 * @{
+ 	 */
+	trunk_request_t		*io_treq;		//!< Treq in the I/O thread's trunk.
+	fr_rb_node_t		node;			//!< Entry in the I/O thread's request index.
+	fr_dlist_head_t		siblings;		//!< Other sreqs for the same request.
+	fr_dlist_t		sibling_entry;		//!< Entry in another sreq's siblings list.
+	trunk_request_state_t	outcome;		//!< Complete or failed, if known.  Read by the
+							///< worker once it receives msg_result.
+	bool			released;		//!< I/O trunk no longer holds the request.
+	bool			final;			//!< Worker's final message received.
+	/** @} */
+
+	/** @name Owned by the worker
+	 * @{
+ 	 */
+	fr_dlist_t		entry;			//!< Entry in the worker's outstanding list.
+	bool			sent_final;		//!< msg_final has been sent.
+	bool			cancelled;		//!< API client cancelled the request.
+	/** @} */
+};
+
+/** An I/O thread, which owns a real trunk
+ */
+struct trunk_shared_io_s {
+	trunk_shared_t		*shared;		//!< What we belong to.
+	unsigned int		id;			//!< Index of this I/O thread.
+	pthread_t		pthread_id;
+	bool			started;		//!< pthread_id refers to a thread which needs joining.
+
+	trunk_shared_mailbox_t	mailbox;		//!< Messages from workers.
+	atomic_bool		stop;			//!< Set by the main thread to stop us.
+
+	atomic_uint_fast64_t	assigned;		//!< Requests assigned by workers.  Used for load
+							///< balancing.
+
+	/** @name Owned by the I/O thread
+	 * @{
+ 	 */
+	TALLOC_CTX		*ctx;			//!< Thread local ctx.
+	fr_event_list_t		*el;			//!< Thread local event list.
+	trunk_t			*trunk;			//!< Real trunk.
+	fr_rb_tree_t		*requests;		//!< Requests indexed by request_t, for forwarding
+							///< runnable notifications.
+	fr_dlist_head_t		overflow;		//!< Messages which didn't fit in a worker's mailbox.
+	fr_timer_t		*overflow_ev;		//!< Retries delivery of overflowed messages.
+	fr_timer_t		*stats_ev;		//!< Publishes statistics.
+	trunk_shared_request_t	*current;		//!< Request a message is being processed for.
+	/** @} */
+
+	/** @name Statistics, published by the I/O thread
+	 * @{
+ 	 */
+	atomic_uint_fast32_t	conn_open;		//!< Connections which can process requests.
+	atomic_uint_fast32_t	conn_active;		//!< Connections which can accept more requests.
+	atomic_uint_fast64_t	req_total;		//!< Requests allocated by the trunk.
+	atomic_uint_fast64_t	req_inflight;		//!< Requests currently held by the trunk.
+	atomic_uint_fast64_t	handoff_ns;		//!< Total worker -> I/O delivery latency.
+	atomic_uint_fast64_t	handoff_count;		//!< Number of deliveries measured.
+	/** @} */
+};
+
+/** A worker's attachment to a shared trunk
+ */
+struct trunk_shared_worker_s {
+	trunk_shared_t		*shared;		//!< What we're attached to.
+	fr_event_list_t		*el;			//!< Worker's event list.
+	trunk_t			*trunk;			//!< Proxy trunk given to the API client.
+
+	trunk_shared_mailbox_t	mailbox;		//!< Messages from I/O threads.
+	fr_dlist_head_t		overflow;		//!< Messages which didn't fit in an I/O thread's mailbox.
+	fr_timer_t		*overflow_ev;		//!< Retries delivery of overflowed messages.
+	fr_dlist_head_t		outstanding;		//!< Requests not yet released by the I/O threads.
+};
+
+/** A trunk configuration, shared between all workers
+ */
+struct trunk_shared_s {
+	char const		*name;			//!< Used for log messages and radmin commands.
+	trunk_io_funcs_t	funcs;			//!< I/O functions for the real trunks.
+	trunk_conf_t		conf;			//!< Configuration for the real trunks.
+
+	trunk_shared_uctx_alloc_t uctx_alloc;		//!< Allocates the uctx for each I/O thread.
+	void			*uctx;			//!< Passed to uctx_alloc.
+
+	trunk_shared_io_t	**io;			//!< I/O threads, if shared.
+	unsigned int		num_io;			//!< How many I/O threads there are.
+
+	pthread_mutex_t		mutex;			//!< Protects thread startup.
+	pthread_cond_t		cond;			//!< Signalled when an I/O thread has started.
+	unsigned int		num_started;		//!< I/O threads which have started, or failed.
+	bool			spawned;		//!< I/O threads have been spawned.
+	bool			failed;			//!< An I/O thread failed to start.
+
+	atomic_uint_fast32_t	num_workers;		//!< Workers attached.
+};
+
+static trunk_remote_funcs_t const io_remote_funcs;
+
+/** Initialise a mailbox
+ *
+ */
+static int mailbox_init(TALLOC_CTX *ctx, trunk_shared_mailbox_t *mb)
+{
+	mb->pipe[0] = mb->pipe[1] = -1;
+
+	mb->queue = fr_atomic_queue_alloc(ctx, TRUNK_SHARED_MAILBOX_SIZE);
+	if (!mb->queue) {
+		fr_strerror_const("Failed allocating mailbox");
+		return -1;
+	}
+
+	if (pipe(mb->pipe) < 0) {
+		fr_strerror_printf("Failed opening mailbox pipe: %s", fr_syserror(errno));
+		return -1;
+	}
+	if ((fcntl(mb->pipe[0], F_SETFL, O_NONBLOCK) < 0) ||
+	    (fcntl(mb->pipe[0], F_SETFD, FD_CLOEXEC) < 0) ||
+	    (fcntl(mb->pipe[1], F_SETFL, O_NONBLOCK) < 0) ||
+	    (fcntl(mb->pipe[1], F_SETFD, FD_CLOEXEC) < 0)) {
+		fr_strerror_printf("Failed setting mailbox pipe flags: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	atomic_init(&mb->signalled, false);
+
+	return 0;
+}
+
+static void mailbox_close(trunk_shared_mailbox_t *mb)
+{
+	if (mb->pipe[0] >= 0) close(mb->pipe[0]);
+	if (mb->pipe[1] >= 0) close(mb->pipe[1]);
+	mb->pipe[0] = mb->pipe[1] = -1;
+}
+
+/** Wake the thread which owns a mailbox, unless a wakeup is already pending
+ *
+ */
+static inline void mailbox_signal(trunk_shared_mailbox_t *mb)
+{
+	if (atomic_exchange(&mb->signalled, true)) return;
+
+	while ((write(mb->pipe[1], ".", 1) < 0) && (errno == EINTR));
+}
+
+/** Deliver a message
+ *
+ * @return
+ *	- true if the message was delivered.
+ *	- false if the mailbox is full.
+ */
+static inline bool mailbox_push(trunk_shared_mailbox_t *mb, trunk_shared_msg_t *msg)
+{
+	if (!fr_atomic_queue_push(mb->queue, msg)) return false;
+
+	mailbox_signal(mb);
+	return true;
+}
+
+/** Clear any pending wakeup before draining the mailbox
+ *
+ * Anything pushed after this will generate another wakeup.
+ */
+static inline void mailbox_clear(trunk_shared_mailbox_t *mb)
+{
+	char buff[64];
+
+	atomic_store(&mb->signalled, false);
+	while (read(mb->pipe[0], buff, sizeof(buff)) > 0);
+}
+
+static inline trunk_shared_msg_t *mailbox_pop(trunk_shared_mailbox_t *mb)
+{
+	void *msg;
+
+	if (!fr_atomic_queue_pop(mb->queue, &msg)) return NULL;
+
+	return msg;
+}
+
+/*
+ *	I/O thread
+ */
+
+static int8_t _sreq_cmp(void const *one, void const *two)
+{
+	trunk_shared_request_t const *a = one, *b = two;
+
+	return CMP(a->request, b->request);
+}
+
+/** Record a request so runnable notifications can be forwarded to its worker
+ *
+ */
+static void io_request_index(trunk_shared_io_t *io, trunk_shared_request_t *sreq)
+{
+	trunk_shared_request_t *found;
+
+	if (!sreq->request) return;
+
+	found = fr_rb_find(io->requests, sreq);
+	if (found) {
+		fr_dlist_insert_tail(&found->siblings, sreq);
+		return;
+	}
+
+	fr_dlist_init(&sreq->siblings, trunk_shared_request_t, sibling_entry);
+	fr_rb_insert(io->requests, sreq);
+}
+
+static void io_request_unindex(trunk_shared_io_t *io, trunk_shared_request_t *sreq)
+{
+	trunk_shared_request_t *found, *next;
+
+	if (fr_dlist_entry_in_list(&sreq->sibling_entry)) {
+		found = fr_rb_find(io->requests, sreq);
+		if (fr_cond_assert(found)) fr_dlist_remove(&found->siblings, sreq);
+		return;
+	}
+
+	if (!fr_rb_node_inline_in_tree(&sreq->node)) return;
+
+	fr_rb_remove_by_inline_node(io->requests, &sreq->node);
+
+	/*
+	 *	Promote the next sibling
+	 */
+	next = fr_dlist_pop_head(&sreq->siblings);
+	if (!next) return;
+
+	fr_dlist_init(&next->siblings, trunk_shared_request_t, sibling_entry);
+	fr_dlist_move(&next->siblings, &sreq->siblings);
+	fr_rb_insert(io->requests, next);
+}
+
+static void _io_overflow_flush(fr_timer_list_t *tl, fr_time_t now, void *uctx);
+
+/** Send a message to a worker
+ *
+ * Messages which don't fit are held in order and retried.
+ */
+static void io_post(trunk_shared_io_t *io, trunk_shared_msg_t *msg, trunk_shared_msg_type_t type)
+{
+	msg->type = type;
+
+	if ((fr_dlist_num_elements(&io->overflow) == 0) && mailbox_push(&msg->sreq->worker->mailbox, msg)) return;
+
+	fr_dlist_insert_tail(&io->overflow, msg);
+	if (!io->overflow_ev &&
+	    (fr_timer_in(io->ctx, io->el->tl, &io->overflow_ev, fr_time_delta_from_msec(1),
+			 true, _io_overflow_flush, io) < 0)) {
+		fr_assert_msg(0, "Failed inserting overflow timer");
+	}
+}
+
+static void _io_overflow_flush(UNUSED fr_timer_list_t *tl, UNUSED fr_time_t now, void *uctx)
+{
+	trunk_shared_io_t	*io = talloc_get_type_abort(uctx, trunk_shared_io_t);
+	trunk_shared_msg_t	*msg;
+
+	while ((msg = fr_dlist_head(&io->overflow))) {
+		if (!mailbox_push(&msg->sreq->worker->mailbox, msg)) break;
+		fr_dlist_remove(&io->overflow, msg);
+	}
+
+	if (fr_dlist_num_elements(&io->overflow) == 0) return;
+
+	(void) fr_timer_in(io->ctx, io->el->tl, &io->overflow_ev, fr_time_delta_from_msec(1),
+			   true, _io_overflow_flush, io);
+}
+
+/** Forward runnable notifications to the worker which owns the request
+ *
+ */
+static void _io_mark_runnable(request_t *request, void *uctx)
+{
+	trunk_shared_io_t	*io = uctx;
+	trunk_shared_request_t	*sreq;
+
+	sreq = fr_rb_find(io->requests, &(trunk_shared_request_t){ .request = request });
+	if (!sreq) return;
+
+	if (atomic_exchange(&sreq->runnable_queued, true)) return;
+
+	io_post(io, &sreq->msg_runnable, TRUNK_SHARED_MSG_RUNNABLE);
+}
+
+static void _io_request_done(void *remote_ctx, trunk_request_state_t state, UNUSED void *uctx)
+{
+	trunk_shared_request_t *sreq = remote_ctx;
+
+	sreq->outcome = state;
+}
+
+/** Tell the worker it can free the request, once neither thread needs it
+ *
+ * The worker may free the request as soon as the message is sent, so this must be the
+ * last thing done with it.
+ */
+static inline void io_request_finish(trunk_shared_io_t *io, trunk_shared_request_t *sreq)
+{
+	if (!sreq->released || !sreq->final) return;
+
+	io_post(io, &sreq->msg_done, TRUNK_SHARED_MSG_DONE);
+}
+
+static void _io_request_release(void *remote_ctx, void *uctx)
+{
+	trunk_shared_io_t	*io = uctx;
+	trunk_shared_request_t	*sreq = remote_ctx;
+
+	sreq->io_treq = NULL;
+	sreq->released = true;
+	io_request_unindex(io, sreq);
+
+	/*
+	 *	The worker is still waiting on the request, so
+	 *	needs to be told the outcome.
+	 */
+	if (!sreq->final) {
+		io_post(io, &sreq->msg_result, TRUNK_SHARED_MSG_RESULT);
+		return;
+	}
+
+	/*
+	 *	Released whilst processing a message from the
+	 *	worker, which finishes the request itself.
+	 */
+	if (io->current == sreq) return;
+
+	io_request_finish(io, sreq);
+}
+
+static trunk_remote_funcs_t const io_remote_funcs = {
+	.request_done = _io_request_done,
+	.request_release = _io_request_release
+};
+
+/** Process messages from workers
+ *
+ */
+static void _io_mailbox_read(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	trunk_shared_io_t	*io = talloc_get_type_abort(uctx, trunk_shared_io_t);
+	trunk_shared_msg_t	*msg;
+	trunk_shared_request_t	*sreq;
+
+	mailbox_clear(&io->mailbox);
+
+	while ((msg = mailbox_pop(&io->mailbox))) {
+		sreq = msg->sreq;
+		io->current = sreq;
+
+		switch (msg->type) {
+		case TRUNK_SHARED_MSG_ENQUEUE:
+			atomic_fetch_add_explicit(&io->handoff_ns,
+						  fr_time_delta_unwrap(fr_time_sub(fr_time(), sreq->enqueued)),
+						  memory_order_relaxed);
+			atomic_fetch_add_explicit(&io->handoff_count, 1, memory_order_relaxed);
+
+			io_request_index(io, sreq);
+
+			/*
+			 *	The request_t belongs to the worker, so
+			 *	isn't passed to the trunk.  Failures are
+			 *	reported via the remote functions.
+			 */
+			(void) trunk_request_enqueue_remote(&sreq->io_treq, io->trunk, NULL,
+							    sreq->preq, sreq->rctx, sreq);
+			break;
+
+		/*
+		 *	If the request can't be requeued, the worker
+		 *	is told it failed.
+		 */
+		case TRUNK_SHARED_MSG_REQUEUE:
+			atomic_store(&sreq->requeue_queued, false);
+			if (!sreq->io_treq) break;
+
+			if (trunk_request_requeue(sreq->io_treq) != TRUNK_ENQUEUE_OK) {
+				trunk_request_signal_fail(sreq->io_treq);
+			}
+			break;
+
+		case TRUNK_SHARED_MSG_COMPLETE:
+			sreq->final = true;
+			if (sreq->io_treq) trunk_request_signal_complete(sreq->io_treq);
+
+			/*
+			 *	Couldn't be completed in its current
+			 *	state, but the worker is done with it.
+			 */
+			if (sreq->io_treq) {
+				io_request_unindex(io, sreq);
+				trunk_request_signal_cancel(sreq->io_treq);
+			}
+			io_request_finish(io, sreq);
+			break;
+
+		case TRUNK_SHARED_MSG_FAIL:
+			sreq->final = true;
+			if (sreq->io_treq) trunk_request_signal_fail(sreq->io_treq);
+			io_request_finish(io, sreq);
+			break;
+
+		/*
+		 *	If the cancellation has to be sent to the
+		 *	server, the request is released later.
+		 */
+		case TRUNK_SHARED_MSG_CANCEL:
+			sreq->final = true;
+			io_request_unindex(io, sreq);
+			if (sreq->io_treq) trunk_request_signal_cancel(sreq->io_treq);
+			io_request_finish(io, sreq);
+			break;
+
+		case TRUNK_SHARED_MSG_RELEASE:
+			sreq->final = true;
+			io_request_finish(io, sreq);
+			break;
+
+		default:
+			fr_assert(0);
+			break;
+		}
+	}
+	io->current = NULL;
+
+	if (atomic_load(&io->stop)) fr_event_loop_exit(io->el, 1);
+}
+
+/** Publish statistics for radmin
+ *
+ */
+static void _io_stats(UNUSED fr_timer_list_t *tl, UNUSED fr_time_t now, void *uctx)
+{
+	trunk_shared_io_t	*io = talloc_get_type_abort(uctx, trunk_shared_io_t);
+	trunk_t			*trunk = io->trunk;
+
+	atomic_store_explicit(&io->conn_open, trunk_connection_count_by_state(trunk, TRUNK_CONN_PROCESSING),
+			      memory_order_relaxed);
+	atomic_store_explicit(&io->conn_active, trunk_connection_count_by_state(trunk, TRUNK_CONN_ACTIVE),
+			      memory_order_relaxed);
+	atomic_store_explicit(&io->req_total, trunk->req_alloc_new + trunk->req_alloc_reused,
+			      memory_order_relaxed);
+	atomic_store_explicit(&io->req_inflight, trunk->req_alloc, memory_order_relaxed);
+
+	(void) fr_timer_in(io->ctx, io->el->tl, &io->stats_ev, fr_time_delta_from_sec(1),
+			   true, _io_stats, io);
+}
+
+/** Let the thread which spawned us know we've started, or failed
+ *
+ */
+static void io_thread_started(trunk_shared_t *shared, bool failed)
+{
+	pthread_mutex_lock(&shared->mutex);
+	shared->num_started++;
+	if (failed) shared->failed = true;
+	pthread_cond_signal(&shared->cond);
+	pthread_mutex_unlock(&shared->mutex);
+}
+
+static void *trunk_shared_io_thread(void *arg)
+{
+	trunk_shared_io_t	*io = talloc_get_type_abort(arg, trunk_shared_io_t);
+	trunk_shared_t		*shared = io->shared;
+	void			*uctx;
+	char			name[64];
+	sigset_t		sigset;
+
+	/*
+	 *	Leave signal handling to the main thread
+	 */
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+	snprintf(name, sizeof(name), "%s - I/O %u", shared->name, io->id);
+
+	io->ctx = talloc_init("%s", name);
+	if (!io->ctx) {
+		ERROR("%s - Failed allocating memory", name);
+		io_thread_started(shared, true);
+		return NULL;
+	}
+
+	io->el = fr_event_list_alloc(io->ctx, NULL, NULL);
+	if (!io->el) {
+		PERROR("%s - Failed creating event list", name);
+	fail:
+		talloc_free(io->ctx);
+		io->ctx = NULL;
+		io_thread_started(shared, true);
+		return NULL;
+	}
+
+	MEM(io->requests = fr_rb_inline_alloc(io->ctx, trunk_shared_request_t, node, _sreq_cmp, NULL));
+	fr_dlist_init(&io->overflow, trunk_shared_msg_t, entry);
+
+	uctx = shared->uctx_alloc(io->ctx, io->el, shared->uctx);
+	if (!uctx) {
+		ERROR("%s - Failed allocating trunk uctx", name);
+		goto fail;
+	}
+
+	io->trunk = trunk_alloc(io->ctx, io->el, &shared->funcs, &shared->conf, name, uctx, false);
+	if (!io->trunk) {
+		PERROR("%s - Failed creating trunk", name);
+		goto fail;
+	}
+	trunk_remote_funcs_set(io->trunk, &io_remote_funcs, io);
+
+	if (fr_event_fd_insert(io->ctx, NULL, io->el, io->mailbox.pipe[0], _io_mailbox_read, NULL, NULL, io) < 0) {
+		PERROR("%s - Failed inserting mailbox", name);
+		goto fail;
+	}
+
+	if (fr_timer_in(io->ctx, io->el->tl, &io->stats_ev, fr_time_delta_from_sec(1), true, _io_stats, io) < 0) {
+		PERROR("%s - Failed inserting stats timer", name);
+		goto fail;
+	}
+
+	unlang_interpret_set_thread_runnable_hook(_io_mark_runnable, io);
+
+	DEBUG("%s - Started", name);
+	io_thread_started(shared, false);
+
+	(void) fr_event_loop(io->el);
+
+	DEBUG("%s - Exiting", name);
+
+	unlang_interpret_set_thread_runnable_hook(NULL, NULL);
+
+	/*
+	 *	Frees the trunk, and closes its connections
+	 */
+	talloc_free(io->ctx);
+	io->ctx = NULL;
+
+	return NULL;
+}
+
+/** Spawn the I/O threads, and wait for them to start
+ *
+ * Called by the first worker to attach, so that threads are only created after
+ * the server has daemonized.
+ */
+static int trunk_shared_spawn(trunk_shared_t *shared)
+{
+	unsigned int i, spawned = 0;
+
+	for (i = 0; i < shared->num_io; i++) {
+		if (fr_schedule_pthread_create(&shared->io[i]->pthread_id, trunk_shared_io_thread, shared->io[i]) < 0) {
+			PERROR("Failed creating I/O thread %u", i);
+			shared->failed = true;
+			break;
+		}
+		shared->io[i]->started = true;
+		spawned++;
+	}
+
+	while (shared->num_started < spawned) pthread_cond_wait(&shared->cond, &shared->mutex);
+
+	shared->spawned = true;
+
+	return shared->failed ? -1 : 0;
+}
+
+/*
+ *	Worker
+ */
+
+static void _worker_overflow_flush(fr_timer_list_t *tl, fr_time_t now, void *uctx);
+
+/** Send a message to the I/O thread servicing a request
+ *
+ * Messages which don't fit are held in order and retried.
+ */
+static void worker_post(trunk_shared_worker_t *worker, trunk_shared_msg_t *msg, trunk_shared_msg_type_t type)
+{
+	msg->type = type;
+
+	if ((fr_dlist_num_elements(&worker->overflow) == 0) && mailbox_push(&msg->sreq->io->mailbox, msg)) return;
+
+	fr_dlist_insert_tail(&worker->overflow, msg);
+	if (!worker->overflow_ev &&
+	    (fr_timer_in(worker, worker->el->tl, &worker->overflow_ev, fr_time_delta_from_msec(1),
+			 true, _worker_overflow_flush, worker) < 0)) {
+		fr_assert_msg(0, "Failed inserting overflow timer");
+	}
+}
+
+static void _worker_overflow_flush(UNUSED fr_timer_list_t *tl, UNUSED fr_time_t now, void *uctx)
+{
+	trunk_shared_worker_t	*worker = talloc_get_type_abort(uctx, trunk_shared_worker_t);
+	trunk_shared_msg_t	*msg;
+
+	while ((msg = fr_dlist_head(&worker->overflow))) {
+		if (!mailbox_push(&msg->sreq->io->mailbox, msg)) break;
+		fr_dlist_remove(&worker->overflow, msg);
+	}
+
+	if (fr_dlist_num_elements(&worker->overflow) == 0) return;
+
+	(void) fr_timer_in(worker, worker->el->tl, &worker->overflow_ev, fr_time_delta_from_msec(1),
+			   true, _worker_overflow_flush, worker);
+}
+
+/** Send the last message the I/O thread will receive about a request
+ *
+ */
+static inline void worker_post_final(trunk_shared_worker_t *worker, trunk_shared_request_t *sreq,
+				     trunk_shared_msg_type_t type)
+{
+	fr_assert(!sreq->sent_final);
+
+	sreq->sent_final = true;
+	worker_post(worker, &sreq->msg_final, type);
+}
+
+/** Neither thread needs the request any more
+ *
+ */
+static void worker_request_done(trunk_shared_worker_t *worker, trunk_shared_request_t *sreq)
+{
+	fr_dlist_remove(&worker->outstanding, sreq);
+	atomic_fetch_sub_explicit(&sreq->io->assigned, 1, memory_order_relaxed);
+
+	/*
+	 *	Cancelled requests keep their treq, and so
+	 *	the preq, until the I/O thread is done.
+	 */
+	if (sreq->treq) trunk_request_proxy_done(sreq->treq, TRUNK_REQUEST_STATE_CANCEL_COMPLETE);
+
+	talloc_free(sreq);
+}
+
+/** The I/O thread's trunk released a request before the API client was done with it
+ *
+ */
+static void worker_request_result(trunk_shared_worker_t *worker, trunk_shared_request_t *sreq)
+{
+	trunk_request_t *treq = sreq->treq;
+
+	/*
+	 *	Already sent our final message, which the
+	 *	I/O thread will answer.
+	 */
+	if (!treq || sreq->cancelled) return;
+
+	sreq->treq = NULL;
+	worker_post_final(worker, sreq, TRUNK_SHARED_MSG_RELEASE);
+
+	trunk_request_proxy_done(treq, sreq->outcome ? sreq->outcome : TRUNK_REQUEST_STATE_FAILED);
+}
+
+/** Process messages from I/O threads
+ *
+ */
+static void worker_mailbox_drain(trunk_shared_worker_t *worker)
+{
+	trunk_shared_msg_t	*msg;
+	trunk_shared_request_t	*sreq;
+
+	mailbox_clear(&worker->mailbox);
+
+	while ((msg = mailbox_pop(&worker->mailbox))) {
+		sreq = msg->sreq;
+
+		switch (msg->type) {
+		case TRUNK_SHARED_MSG_RUNNABLE:
+			atomic_store(&sreq->runnable_queued, false);
+			if (!sreq->cancelled && sreq->treq && sreq->request) unlang_interpret_mark_runnable(sreq->request);
+			break;
+
+		case TRUNK_SHARED_MSG_RESULT:
+			worker_request_result(worker, sreq);
+			break;
+
+		case TRUNK_SHARED_MSG_DONE:
+			worker_request_done(worker, sreq);
+			break;
+
+		default:
+			fr_assert(0);
+			break;
+		}
+	}
+}
+
+static void _worker_mailbox_read(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	worker_mailbox_drain(talloc_get_type_abort(uctx, trunk_shared_worker_t));
+}
+
+/** Pick the I/O thread with the fewest outstanding requests
+ *
+ */
+static trunk_shared_io_t *worker_io_select(trunk_shared_t *shared)
+{
+	trunk_shared_io_t	*best = shared->io[0];
+	uint_fast64_t		best_assigned = atomic_load_explicit(&best->assigned, memory_order_relaxed);
+	unsigned int		i;
+
+	for (i = 1; i < shared->num_io; i++) {
+		uint_fast64_t assigned = atomic_load_explicit(&shared->io[i]->assigned, memory_order_relaxed);
+
+		if (assigned < best_assigned) {
+			best = shared->io[i];
+			best_assigned = assigned;
+		}
+	}
+
+	return best;
+}
+
+static trunk_enqueue_t _proxy_enqueue(void **proxy_ctx, trunk_request_t *treq, void *uctx)
+{
+	trunk_shared_worker_t	*worker = talloc_get_type_abort(uctx, trunk_shared_worker_t);
+	trunk_shared_request_t	*sreq;
+
+	MEM(sreq = talloc_zero(worker, trunk_shared_request_t));
+	sreq->treq = treq;
+	sreq->worker = worker;
+	sreq->io = worker_io_select(worker->shared);
+	sreq->request = treq->request;
+	sreq->preq = treq->preq;
+	sreq->rctx = treq->rctx;
+	atomic_init(&sreq->runnable_queued, false);
+	atomic_init(&sreq->requeue_queued, false);
+
+	sreq->msg_enqueue = (trunk_shared_msg_t){ .type = TRUNK_SHARED_MSG_ENQUEUE, .sreq = sreq };
+	sreq->msg_requeue = (trunk_shared_msg_t){ .sreq = sreq };
+	sreq->msg_final = (trunk_shared_msg_t){ .sreq = sreq };
+	sreq->msg_runnable = (trunk_shared_msg_t){ .sreq = sreq };
+	sreq->msg_result = (trunk_shared_msg_t){ .sreq = sreq };
+	sreq->msg_done = (trunk_shared_msg_t){ .sreq = sreq };
+	fr_dlist_entry_init(&sreq->sibling_entry);
+
+	/*
+	 *	Queued messages for other requests must be
+	 *	delivered first, and a full mailbox means the
+	 *	I/O thread is overloaded anyway.
+	 */
+	sreq->enqueued = fr_time();
+	if ((fr_dlist_num_elements(&worker->overflow) > 0) || !mailbox_push(&sreq->io->mailbox, &sreq->msg_enqueue)) {
+		talloc_free(sreq);
+		return TRUNK_ENQUEUE_NO_CAPACITY;
+	}
+
+	atomic_fetch_add_explicit(&sreq->io->assigned, 1, memory_order_relaxed);
+	fr_dlist_insert_tail(&worker->outstanding, sreq);
+	*proxy_ctx = sreq;
+
+	return TRUNK_ENQUEUE_OK;
+}
+
+/** Requeue a request on the connection it was sent on
+ *
+ * The request is failed by the I/O thread if that's not possible.
+ */
+static trunk_enqueue_t _proxy_requeue(void *proxy_ctx, UNUSED trunk_request_t *treq, void *uctx)
+{
+	trunk_shared_worker_t	*worker = talloc_get_type_abort(uctx, trunk_shared_worker_t);
+	trunk_shared_request_t	*sreq = proxy_ctx;
+
+	/*
+	 *	Requeues are only valid once the results of
+	 *	the previous query have been returned, which
+	 *	happens after the I/O thread processed the
+	 *	previous requeue.
+	 */
+	if (!fr_cond_assert(!atomic_exchange(&sreq->requeue_queued, true))) return TRUNK_ENQUEUE_FAIL;
+
+	worker_post(worker, &sreq->msg_requeue, TRUNK_SHARED_MSG_REQUEUE);
+
+	return TRUNK_ENQUEUE_OK;
+}
+
+static void _proxy_signal(void *proxy_ctx, trunk_request_t *treq, trunk_request_state_t state, void *uctx)
+{
+	trunk_shared_worker_t	*worker = talloc_get_type_abort(uctx, trunk_shared_worker_t);
+	trunk_shared_request_t	*sreq = proxy_ctx;
+
+	switch (state) {
+	case TRUNK_REQUEST_STATE_COMPLETE:
+		worker_post_final(worker, sreq, TRUNK_SHARED_MSG_COMPLETE);
+		break;
+
+	case TRUNK_REQUEST_STATE_FAILED:
+		worker_post_final(worker, sreq, TRUNK_SHARED_MSG_FAIL);
+		break;
+
+	/*
+	 *	The treq must stay around until the I/O
+	 *	thread has finished with the preq.
+	 */
+	case TRUNK_REQUEST_STATE_CANCEL:
+		sreq->cancelled = true;
+		worker_post_final(worker, sreq, TRUNK_SHARED_MSG_CANCEL);
+		return;
+
+	default:
+		fr_assert(0);
+		return;
+	}
+
+	/*
+	 *	The API client expects the callbacks to have
+	 *	run by the time the signal returns.  The sreq
+	 *	is freed when the I/O thread is done.
+	 */
+	sreq->treq = NULL;
+	trunk_request_proxy_done(treq, state);
+}
+
+static trunk_proxy_funcs_t const proxy_funcs = {
+	.enqueue = _proxy_enqueue,
+	.requeue = _proxy_requeue,
+	.signal = _proxy_signal
+};
+
+/** Cancel outstanding requests and wait for the I/O threads to release them
+ *
+ * Called when the worker's thread exits, after its event loop has stopped, so this is
+ * the one place a worker blocks waiting on an I/O thread.
+ */
+static int _trunk_shared_worker_free(trunk_shared_worker_t *worker)
+{
+	trunk_shared_t		*shared = worker->shared;
+	trunk_shared_request_t	*sreq, *next;
+	trunk_shared_msg_t	*msg;
+	fr_time_t		timeout;
+
+	worker_mailbox_drain(worker);
+
+	for (sreq = fr_dlist_head(&worker->outstanding); sreq; sreq = next) {
+		next = fr_dlist_next(&worker->outstanding, sreq);
+
+		if (sreq->sent_final) continue;
+		trunk_request_signal_cancel(sreq->treq);
+	}
+
+	timeout = fr_time_add(fr_time(), TRUNK_SHARED_DETACH_TIMEOUT);
+	while (fr_dlist_num_elements(&worker->outstanding) > 0) {
+		struct pollfd	pfd = { .fd = worker->mailbox.pipe[0], .events = POLLIN };
+		fr_time_t	now = fr_time();
+
+		/*
+		 *	No event loop to run the overflow timer.
+		 */
+		while ((msg = fr_dlist_head(&worker->overflow))) {
+			if (!mailbox_push(&msg->sreq->io->mailbox, msg)) break;
+			fr_dlist_remove(&worker->overflow, msg);
+		}
+
+		if (fr_time_gteq(now, timeout)) {
+			/*
+			 *	The I/O threads may still deliver
+			 *	messages to us, so we can't be freed.
+			 */
+			WARN("Timed out waiting for %u requests to be released, leaking worker state",
+			     fr_dlist_num_elements(&worker->outstanding));
+			return -1;
+		}
+
+		(void) poll(&pfd, 1, (fr_dlist_num_elements(&worker->overflow) > 0) ?
+			    1 : fr_time_delta_to_msec(fr_time_sub(timeout, now)));
+		worker_mailbox_drain(worker);
+	}
+
+	(void) fr_event_fd_delete(worker->el, worker->mailbox.pipe[0], FR_EVENT_FILTER_IO);
+	mailbox_close(&worker->mailbox);
+
+	atomic_fetch_sub_explicit(&shared->num_workers, 1, memory_order_relaxed);
+
+	return 0;
+}
+
+/** Get a trunk for the calling worker thread
+ *
+ * In per-thread mode this is a normal trunk with its own connections.  In shared
+ * mode this is a proxy trunk which forwards requests to the I/O threads, which are
+ * spawned on the first call.
+ *
+ * @param[in] ctx	to allocate the trunk in.  Must be thread local.
+ * @param[in] el	of the calling thread.
+ * @param[in] shared	trunk configuration from #trunk_shared_alloc.
+ * @param[in] uctx	passed to the trunk callbacks in this thread.  In shared mode
+ *			the connection and I/O callbacks instead receive the uctx
+ *			allocated for each I/O thread.
+ * @return
+ *	- A trunk to enqueue requests on.
+ *	- NULL on error.
+ */
+trunk_t *trunk_shared_attach(TALLOC_CTX *ctx, fr_event_list_t *el, trunk_shared_t *shared, void const *uctx)
+{
+	trunk_shared_worker_t	*worker;
+	int			ret;
+
+	if (!shared->num_io) {
+		trunk_t *trunk;
+
+		trunk = trunk_alloc(ctx, el, &shared->funcs, &shared->conf, shared->name, uctx, false);
+		if (trunk) atomic_fetch_add_explicit(&shared->num_workers, 1, memory_order_relaxed);
+		return trunk;
+	}
+
+	pthread_mutex_lock(&shared->mutex);
+	ret = shared->spawned ? (shared->failed ? -1 : 0) : trunk_shared_spawn(shared);
+	pthread_mutex_unlock(&shared->mutex);
+	if (ret < 0) {
+		ERROR("Shared I/O threads failed to start");
+		return NULL;
+	}
+
+	MEM(worker = talloc_zero(ctx, trunk_shared_worker_t));
+	worker->shared = shared;
+	worker->el = el;
+	fr_dlist_init(&worker->overflow, trunk_shared_msg_t, entry);
+	fr_dlist_init(&worker->outstanding, trunk_shared_request_t, entry);
+
+	if (mailbox_init(worker, &worker->mailbox) < 0) {
+	error:
+		PERROR("Failed attaching to shared trunk");
+		mailbox_close(&worker->mailbox);
+		talloc_free(worker);
+		return NULL;
+	}
+
+	if (fr_event_fd_insert(worker, NULL, el, worker->mailbox.pipe[0], _worker_mailbox_read, NULL, NULL, worker) < 0) {
+		goto error;
+	}
+
+	worker->trunk = trunk_proxy_alloc(worker, el, &shared->funcs, &shared->conf, shared->name, uctx,
+					  &proxy_funcs, worker);
+	if (!worker->trunk) goto error;
+
+	atomic_fetch_add_explicit(&shared->num_workers, 1, memory_order_relaxed);
+	talloc_set_destructor(worker, _trunk_shared_worker_free);
+
+	return worker->trunk;
+}
+
+static int cmd_stats_trunk(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	trunk_shared_t const	*shared = ctx;
+	uint64_t		open = 0, active = 0, total = 0, inflight = 0, handoff_ns = 0, handoff_count = 0;
+	uint32_t		workers = atomic_load_explicit(&shared->num_workers, memory_order_relaxed);
+	unsigned int		i;
+
+	if (!shared->num_io) {
+		fprintf(fp, "mode\t\t\t\tper-thread\n");
+		fprintf(fp, "workers\t\t\t\t%u\n", workers);
+		fprintf(fp, "connections.minimum\t\t%" PRIu64 "\n", (uint64_t)shared->conf.start * workers);
+		return 0;
+	}
+
+	for (i = 0; i < shared->num_io; i++) {
+		trunk_shared_io_t const *io = shared->io[i];
+
+		open += atomic_load_explicit(&io->conn_open, memory_order_relaxed);
+		active += atomic_load_explicit(&io->conn_active, memory_order_relaxed);
+		total += atomic_load_explicit(&io->req_total, memory_order_relaxed);
+		inflight += atomic_load_explicit(&io->req_inflight, memory_order_relaxed);
+		handoff_ns += atomic_load_explicit(&io->handoff_ns, memory_order_relaxed);
+		handoff_count += atomic_load_explicit(&io->handoff_count, memory_order_relaxed);
+	}
+
+	fprintf(fp, "mode\t\t\t\tshared\n");
+	fprintf(fp, "workers\t\t\t\t%u\n", workers);
+	fprintf(fp, "threads\t\t\t\t%u\n", shared->num_io);
+	fprintf(fp, "connections.open\t\t%" PRIu64 "\n", open);
+	fprintf(fp, "connections.active\t\t%" PRIu64 "\n", active);
+	fprintf(fp, "connections.per_thread_minimum\t%" PRIu64 "\n", (uint64_t)shared->conf.start * workers);
+	fprintf(fp, "requests.total\t\t\t%" PRIu64 "\n", total);
+	fprintf(fp, "requests.inflight\t\t%" PRIu64 "\n", inflight);
+	fprintf(fp, "requests.per_connection\t\t%.3f\n", open ? (double)inflight / open : 0.0);
+	fprintf(fp, "utilisation\t\t\t%.3f\n",
+		(open && shared->conf.max_req_per_conn) ?
+		(double)inflight / (open * shared->conf.max_req_per_conn) : 0.0);
+	fprintf(fp, "handoff.average\t\t\t%.9f\n",
+		handoff_count ? ((double)handoff_ns / handoff_count) / (double)NSEC : 0.0);
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_trunk_table[] = {
+	{
+		.parent = "stats",
+		.name = "trunk",
+		.help = "Statistics for connection trunks.",
+		.read_only = true
+	},
+
+	{
+		.parent = "stats trunk",
+		.add_name = true,
+		.name = "self",
+		.func = cmd_stats_trunk,
+		.help = "Show connection and request statistics for a specific trunk.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
+/** Stop the I/O threads
+ *
+ */
+static int _trunk_shared_free(trunk_shared_t *shared)
+{
+	unsigned int i;
+
+	for (i = 0; i < shared->num_io; i++) {
+		trunk_shared_io_t *io = shared->io[i];
+
+		if (!io->started) continue;
+
+		atomic_store(&io->stop, true);
+		mailbox_signal(&io->mailbox);
+	}
+
+	for (i = 0; i < shared->num_io; i++) {
+		trunk_shared_io_t *io = shared->io[i];
+
+		if (!io->started) continue;
+
+		(void) pthread_join(io->pthread_id, NULL);
+		io->started = false;
+	}
+
+	for (i = 0; i < shared->num_io; i++) mailbox_close(&shared->io[i]->mailbox);
+
+	pthread_mutex_destroy(&shared->mutex);
+	pthread_cond_destroy(&shared->cond);
+
+	return 0;
+}
+
+/** Allocate a trunk configuration which can be shared between workers
+ *
+ * Called during module instantiation.  If conf->shared is set, this allocates the
+ * state for conf->shared_threads I/O threads, but the threads themselves are only
+ * spawned when the first worker calls #trunk_shared_attach.
+ *
+ * @param[in] ctx		to allocate in.
+ * @param[in] funcs		I/O functions for the trunks.
+ * @param[in] conf		Trunk configuration.
+ * @param[in] name		Used for log messages and the radmin "stats trunk" command.
+ * @param[in] uctx_alloc	Allocates the uctx for each I/O thread's trunk.
+ * @param[in] uctx		passed to uctx_alloc.
+ * @return
+ *	- A new shared trunk.
+ *	- NULL on error.
+ */
+trunk_shared_t *trunk_shared_alloc(TALLOC_CTX *ctx, trunk_io_funcs_t const *funcs, trunk_conf_t const *conf,
+				   char const *name, trunk_shared_uctx_alloc_t uctx_alloc, void *uctx)
+{
+	trunk_shared_t	*shared;
+	unsigned int	i;
+
+	MEM(shared = talloc_zero(ctx, trunk_shared_t));
+	shared->name = talloc_strdup(shared, name);
+	shared->funcs = *funcs;
+	shared->conf = *conf;
+	shared->uctx_alloc = uctx_alloc;
+	shared->uctx = uctx;
+	atomic_init(&shared->num_workers, 0);
+
+	pthread_mutex_init(&shared->mutex, NULL);
+	pthread_cond_init(&shared->cond, NULL);
+	talloc_set_destructor(shared, _trunk_shared_free);
+
+	if (conf->shared) {
+		shared->num_io = conf->shared_threads ? conf->shared_threads : 1;
+
+		MEM(shared->io = talloc_zero_array(shared, trunk_shared_io_t *, shared->num_io));
+		for (i = 0; i < shared->num_io; i++) {
+			trunk_shared_io_t *io;
+
+			MEM(io = talloc_zero(shared->io, trunk_shared_io_t));
+			io->shared = shared;
+			io->id = i;
+			atomic_init(&io->stop, false);
+			io->mailbox.pipe[0] = io->mailbox.pipe[1] = -1;
+			shared->io[i] = io;
+
+			if (mailbox_init(io, &io->mailbox) < 0) {
+				PERROR("Failed allocating I/O thread %u", i);
+				talloc_free(shared);
+				return NULL;
+			}
+		}
+	}
+
+	if (fr_command_register_hook(NULL, shared->name, shared, cmd_trunk_table) < 0) {
+		PERROR("Failed registering radmin commands for trunk");
+		talloc_free(shared);
+		return NULL;
+	}
+
+	return shared;
+}
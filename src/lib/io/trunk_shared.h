@@ -0,0 +1,58 @@
+#pragma once
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file io/trunk_shared.h
+ * @brief Connection trunks shared between worker threads.
+ *
+ * @copyright 2025 The FreeRADIUS server project
+ */
+RCSIDH(trunk_shared_h, "$Id$")
+
+#include <freeradius-devel/server/trunk.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct trunk_shared_s trunk_shared_t;
+
+/** Allocate the uctx for a trunk owned by a shared I/O thread
+ *
+ * Called in the I/O thread, before its trunk is allocated.
+ *
+ * @param[in] ctx	to allocate the uctx in.  Owned by the I/O thread.
+ * @param[in] el	of the I/O thread.
+ * @param[in] uctx	passed to #trunk_shared_alloc.
+ * @return
+ *	- The uctx to pass to the trunk callbacks.
+ *	- NULL on error.
+ */
+typedef void *(*trunk_shared_uctx_alloc_t)(TALLOC_CTX *ctx, fr_event_list_t *el, void *uctx);
+
+trunk_shared_t	*trunk_shared_alloc(TALLOC_CTX *ctx, trunk_io_funcs_t const *funcs, trunk_conf_t const *conf,
+				    char const *name, trunk_shared_uctx_alloc_t uctx_alloc, void *uctx)
+				    CC_HINT(nonnull(2, 3, 4, 5));
+
+trunk_t		*trunk_shared_attach(TALLOC_CTX *ctx, fr_event_list_t *el, trunk_shared_t *shared, void const *uctx)
+				     CC_HINT(nonnull(2, 3));
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,616 @@
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/syserror.h>
+#include <sys/socket.h>
+
+#include "trunk_shared.c"
+
+/*
+ *	The main thread plays the part of a worker, and the I/O threads
+ *	are spawned by trunk_shared_attach() as they would be in the
+ *	server.  Connections are socket pairs which loop the treq pointer
+ *	written by the muxer back round to the demuxer.
+ */
+
+#define TEST_TIMEOUT	fr_time_delta_from_sec(10)
+
+typedef enum {
+	TEST_REPLY_COMPLETE = 0,		//!< Demuxer completes the request.
+	TEST_REPLY_RUNNABLE,			//!< Demuxer marks the request runnable, and the
+						///< API client completes it.
+	TEST_REPLY_HOLD				//!< Nothing is written, so the request stays sent.
+} test_reply_t;
+
+typedef struct {
+	trunk_request_t		*treq;			//!< Proxy trunk request.
+	request_t		*request;		//!< Passed to the trunk, only for runnable notifications.
+	test_reply_t		reply;			//!< What the I/O thread should do.
+
+	/** @name Written by the I/O thread
+	 * @{
+ 	 */
+	atomic_uint		sent;			//!< How many times the muxer sent the request.
+	/** @} */
+
+	/** @name Written by the worker
+	 * @{
+ 	 */
+	bool			completed;		//!< Seen by the complete callback.
+	bool			failed;			//!< Seen by the failed callback.
+	bool			freed;			//!< Seen by the free callback.
+	unsigned int		runnable;		//!< How many times the request was marked runnable.
+	/** @} */
+} test_shared_request_t;
+
+typedef struct {
+	uint64_t		completed;		//!< Complete callbacks.
+	uint64_t		failed;			//!< Fail callbacks.
+	uint64_t		freed;			//!< Free callbacks.
+	uint64_t		runnable;		//!< Runnable notifications.
+	pthread_t		worker;			//!< Thread the request callbacks must run in.
+} test_shared_stats_t;
+
+/** Cancel callbacks, which run in the I/O threads
+ */
+static atomic_uint test_cancelled;
+
+#define DEBUG_LVL_SET if (acutest_verbose_level_ >= 3) fr_debug_lvl = L_DBG_LVL_4 + 1
+
+static void test_mux(UNUSED fr_event_list_t *el, trunk_connection_t *tconn, connection_t *conn, UNUSED void *uctx)
+{
+	trunk_request_t		*treq;
+	int			fd = *(talloc_get_type_abort(conn->h, int));
+	ssize_t			slen;
+
+	while ((trunk_connection_pop_request(&treq, tconn) == 0) && treq) {
+		test_shared_request_t *preq = talloc_get_type_abort(treq->preq, test_shared_request_t);
+
+		/*
+		 *	The request_t belongs to the worker
+		 */
+		TEST_CHECK(treq->request == NULL);
+
+		atomic_fetch_add(&preq->sent, 1);
+
+		if (preq->reply != TEST_REPLY_HOLD) {
+			slen = write(fd, &treq, sizeof(treq));
+			if (slen <= 0) return;
+			if (slen < (ssize_t)sizeof(treq)) abort();
+		}
+
+		trunk_request_signal_sent(treq);
+	}
+}
+
+static void test_demux(UNUSED fr_event_list_t *el, UNUSED trunk_connection_t *tconn, connection_t *conn, UNUSED void *uctx)
+{
+	int			fd = *(talloc_get_type_abort(conn->h, int));
+	trunk_request_t		*treq;
+	test_shared_request_t	*preq;
+	ssize_t			slen;
+
+	for (;;) {
+		slen = read(fd, &treq, sizeof(treq));
+		if (slen <= 0) break;
+		TEST_CHECK(slen == sizeof(treq));
+
+		if (treq->state != TRUNK_REQUEST_STATE_SENT) continue;
+
+		preq = talloc_get_type_abort(treq->preq, test_shared_request_t);
+
+		if (preq->reply == TEST_REPLY_COMPLETE) {
+			trunk_request_signal_complete(treq);
+			continue;
+		}
+
+		/*
+		 *	Forwarded to the worker by the runnable hook
+		 */
+		unlang_interpret_mark_runnable(preq->request);
+	}
+}
+
+static void _conn_io_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags,
+			   UNUSED int fd_errno, void *uctx)
+{
+	trunk_connection_t	*tconn = talloc_get_type_abort(uctx, trunk_connection_t);
+
+	trunk_connection_signal_reconnect(tconn, CONNECTION_FAILED);
+}
+
+static void _conn_io_read(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	trunk_connection_t *tconn = talloc_get_type_abort(uctx, trunk_connection_t);
+	trunk_connection_signal_readable(tconn);
+}
+
+static void _conn_io_write(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	trunk_connection_t *tconn = talloc_get_type_abort(uctx, trunk_connection_t);
+	trunk_connection_signal_writable(tconn);
+}
+
+static void _conn_notify(trunk_connection_t *tconn, connection_t *conn,
+			 fr_event_list_t *el,
+			 trunk_connection_event_t notify_on, UNUSED void *uctx)
+{
+	int fd = *(talloc_get_type_abort(conn->h, int));
+
+	switch (notify_on) {
+	case TRUNK_CONN_EVENT_NONE:
+		fr_event_fd_delete(el, fd, FR_EVENT_FILTER_IO);
+		break;
+
+	case TRUNK_CONN_EVENT_READ:
+		TEST_CHECK(fr_event_fd_insert(conn, NULL, el, fd, _conn_io_read, NULL, _conn_io_error, tconn) == 0);
+		break;
+
+	case TRUNK_CONN_EVENT_WRITE:
+		TEST_CHECK(fr_event_fd_insert(conn, NULL, el, fd, NULL, _conn_io_write, _conn_io_error, tconn) == 0);
+		break;
+
+	case TRUNK_CONN_EVENT_BOTH:
+		TEST_CHECK(fr_event_fd_insert(conn, NULL, el, fd, _conn_io_read, _conn_io_write, _conn_io_error, tconn) == 0);
+		break;
+
+	default:
+		fr_assert(0);
+	}
+}
+
+/** Runs in the I/O thread
+ *
+ */
+static void test_request_cancel(UNUSED connection_t *conn, void *preq,
+				UNUSED trunk_cancel_reason_t reason, UNUSED void *uctx)
+{
+	(void) talloc_get_type_abort(preq, test_shared_request_t);
+
+	atomic_fetch_add(&test_cancelled, 1);
+}
+
+/** Runs in the worker
+ *
+ */
+static void test_request_complete(UNUSED request_t *request, void *preq, UNUSED void *rctx, void *uctx)
+{
+	test_shared_stats_t	*stats = uctx;
+	test_shared_request_t	*our_preq = talloc_get_type_abort(preq, test_shared_request_t);
+
+	TEST_CHECK(pthread_equal(pthread_self(), stats->worker));
+
+	our_preq->completed = true;
+	stats->completed++;
+}
+
+static void test_request_fail(UNUSED request_t *request, void *preq, UNUSED void *rctx,
+			      UNUSED trunk_request_state_t state, void *uctx)
+{
+	test_shared_stats_t	*stats = uctx;
+	test_shared_request_t	*our_preq = talloc_get_type_abort(preq, test_shared_request_t);
+
+	TEST_CHECK(pthread_equal(pthread_self(), stats->worker));
+
+	our_preq->failed = true;
+	stats->failed++;
+}
+
+static void test_request_free(UNUSED request_t *request, void *preq, void *uctx)
+{
+	test_shared_stats_t	*stats = uctx;
+	test_shared_request_t	*our_preq = talloc_get_type_abort(preq, test_shared_request_t);
+
+	TEST_CHECK(pthread_equal(pthread_self(), stats->worker));
+
+	our_preq->freed = true;
+	stats->freed++;
+}
+
+/** Record runnable notifications delivered to the worker
+ *
+ * There's no interpreter, so the worker thread gets a hook too.
+ */
+static void test_mark_runnable(request_t *request, void *uctx)
+{
+	test_shared_stats_t	*stats = uctx;
+	test_shared_request_t	*preq = talloc_get_type_abort(talloc_parent(request), test_shared_request_t);
+
+	TEST_CHECK(pthread_equal(pthread_self(), stats->worker));
+
+	preq->runnable++;
+	stats->runnable++;
+}
+
+static void _conn_io_loopback(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	int		*our_h = talloc_get_type_abort(uctx, int);
+	uint8_t		buff[1024];
+	ssize_t		slen;
+
+	fr_assert(fd == our_h[1]);
+
+	for (;;) {
+		slen = read(fd, buff, sizeof(buff));
+		if (slen <= 0) return;
+
+		if (write(our_h[1], buff, (size_t)slen) < slen) abort();
+	}
+}
+
+static void _conn_close(UNUSED fr_event_list_t *el, void *h, UNUSED void *uctx)
+{
+	int *our_h = talloc_get_type_abort(h, int);
+
+	talloc_free_children(our_h);	/* Clear the IO handlers */
+
+	close(our_h[0]);
+	close(our_h[1]);
+
+	talloc_free(our_h);
+}
+
+static connection_state_t _conn_open(fr_event_list_t *el, void *h, UNUSED void *uctx)
+{
+	int *our_h = talloc_get_type_abort(h, int);
+
+	TEST_CHECK(fr_event_fd_insert(our_h, NULL, el, our_h[1], _conn_io_loopback, NULL, NULL, our_h) == 0);
+
+	return CONNECTION_STATE_CONNECTED;
+}
+
+CC_NO_UBSAN(function) /* UBSAN: false positive - public vs private connection_t trips --fsanitize=function*/
+static connection_state_t _conn_init(void **h_out, connection_t *conn, UNUSED void *uctx)
+{
+	int *h;
+
+	h = talloc_array(conn, int, 2);
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, h) < 0) return CONNECTION_STATE_FAILED;
+
+	fr_nonblock(h[0]);
+	fr_nonblock(h[1]);
+	connection_signal_on_fd(conn, h[0]);
+	*h_out = h;
+
+	return CONNECTION_STATE_CONNECTING;
+}
+
+static connection_t *test_connection_alloc(trunk_connection_t *tconn, fr_event_list_t *el,
+					   connection_conf_t const *conn_conf,
+					   char const *log_prefix, UNUSED void *uctx)
+{
+	connection_conf_t cstat;
+
+	if (!conn_conf) {
+		memset(&cstat, 0, sizeof(cstat));
+		conn_conf = &cstat;
+	}
+	return connection_alloc(tconn, el,
+				&(connection_funcs_t){
+					.init = _conn_init,
+					.open = _conn_open,
+					.close = _conn_close
+				},
+				conn_conf,
+				log_prefix, tconn);
+}
+
+static void *test_uctx_alloc(TALLOC_CTX *ctx, UNUSED fr_event_list_t *el, UNUSED void *uctx)
+{
+	return talloc_zero(ctx, uint8_t);
+}
+
+typedef struct {
+	TALLOC_CTX		*ctx;
+	fr_event_list_t		*el;
+	trunk_shared_t		*shared;
+	trunk_t			*trunk;			//!< Proxy trunk.
+	trunk_shared_worker_t	*worker;
+	test_shared_stats_t	stats;
+} test_shared_t;
+
+static void test_setup(test_shared_t *test, char const *name, uint16_t threads)
+{
+	trunk_io_funcs_t	io_funcs = {
+					.connection_alloc = test_connection_alloc,
+					.connection_notify = _conn_notify,
+					.request_prioritise = fr_pointer_cmp,
+					.request_mux = test_mux,
+					.request_demux = test_demux,
+					.request_cancel = test_request_cancel,
+					.request_complete = test_request_complete,
+					.request_fail = test_request_fail,
+					.request_free = test_request_free
+				};
+	trunk_conf_t		conf = {
+					.start = 1,
+					.min = 1,
+					.max = 2,
+					.shared = true,
+					.shared_threads = threads
+				};
+
+	DEBUG_LVL_SET;
+
+	*test = (test_shared_t){ .ctx = talloc_init_const("test") };
+	test->stats.worker = pthread_self();
+	atomic_store(&test_cancelled, 0);
+
+	test->el = fr_event_list_alloc(test->ctx, NULL, NULL);
+	TEST_ASSERT(test->el != NULL);
+
+	test->shared = trunk_shared_alloc(test->ctx, &io_funcs, &conf, name, test_uctx_alloc, NULL);
+	TEST_ASSERT(test->shared != NULL);
+	TEST_CHECK(test->shared->num_io == threads);
+
+	test->trunk = trunk_shared_attach(test->ctx, test->el, test->shared, &test->stats);
+	TEST_ASSERT(test->trunk != NULL);
+	test->worker = talloc_get_type_abort(talloc_parent(test->trunk), trunk_shared_worker_t);
+
+	unlang_interpret_set_thread_runnable_hook(test_mark_runnable, &test->stats);
+}
+
+static void test_teardown(test_shared_t *test)
+{
+	unsigned int i;
+
+	unlang_interpret_set_thread_runnable_hook(NULL, NULL);
+
+	/*
+	 *	Detach the worker, then stop and join the I/O threads
+	 */
+	TEST_CHECK(talloc_free(test->worker) == 0);
+
+	for (i = 0; i < test->shared->num_io; i++) TEST_CHECK(test->shared->io[i]->started);
+	TEST_CHECK(talloc_free(test->shared) == 0);
+
+	talloc_free(test->ctx);
+}
+
+/** Run the worker's event loop until there's nothing outstanding
+ *
+ */
+static bool test_run(test_shared_t *test, bool (*done)(test_shared_t *test))
+{
+	fr_time_t timeout = fr_time_add(fr_time(), TEST_TIMEOUT);
+
+	while (!done(test)) {
+		if (fr_time_gt(fr_time(), timeout)) return false;
+
+		if (fr_event_corral(test->el, fr_time(), true) < 0) return false;
+		fr_event_service(test->el);
+	}
+
+	return true;
+}
+
+static bool test_no_outstanding(test_shared_t *test)
+{
+	return fr_dlist_num_elements(&test->worker->outstanding) == 0;
+}
+
+static test_shared_request_t *test_request_alloc(test_shared_t *test, test_reply_t reply)
+{
+	test_shared_request_t *preq;
+
+	MEM(preq = talloc_zero(test->ctx, test_shared_request_t));
+	preq->reply = reply;
+
+	/*
+	 *	Only the pointer is passed between threads.
+	 *	Parenting it by the preq lets the runnable hook
+	 *	find the preq.
+	 */
+	MEM(preq->request = talloc_zero(preq, request_t));
+
+	return preq;
+}
+
+/*
+ *	The I/O thread's demuxer completes the request, and the
+ *	API client's callbacks are run in the worker.
+ */
+static void test_enqueue_complete(void)
+{
+	test_shared_t		test;
+	test_shared_request_t	*preq;
+
+	test_setup(&test, "shared_enqueue_complete", 1);
+
+	preq = test_request_alloc(&test, TEST_REPLY_COMPLETE);
+	TEST_CHECK(trunk_request_enqueue(&preq->treq, test.trunk, preq->request, preq, NULL) == TRUNK_ENQUEUE_OK);
+	TEST_CHECK(preq->treq->state == TRUNK_REQUEST_STATE_SENT);
+	TEST_CHECK(fr_dlist_num_elements(&test.worker->outstanding) == 1);
+
+	TEST_CHECK(test_run(&test, test_no_outstanding));
+
+	TEST_CHECK(atomic_load(&preq->sent) == 1);
+	TEST_CHECK(preq->completed);
+	TEST_CHECK(!preq->failed);
+	TEST_CHECK(preq->freed);
+	TEST_CHECK(test.stats.completed == 1);
+	TEST_CHECK(test.trunk->req_alloc == 0);
+
+	test_teardown(&test);
+}
+
+static bool test_runnable(test_shared_t *test)
+{
+	return test->stats.runnable > 0;
+}
+
+/*
+ *	The I/O thread marks the request runnable, and the API client
+ *	completes it from the worker.
+ */
+static void test_enqueue_runnable_complete(void)
+{
+	test_shared_t		test;
+	test_shared_request_t	*preq;
+
+	test_setup(&test, "shared_runnable_complete", 1);
+
+	preq = test_request_alloc(&test, TEST_REPLY_RUNNABLE);
+	TEST_CHECK(trunk_request_enqueue(&preq->treq, test.trunk, preq->request, preq, NULL) == TRUNK_ENQUEUE_OK);
+
+	TEST_CHECK(test_run(&test, test_runnable));
+	TEST_CHECK(preq->runnable == 1);
+	TEST_CHECK(!preq->completed);
+
+	/*
+	 *	Callbacks run before the signal returns, but
+	 *	the worker's state is kept until the I/O thread
+	 *	is done.
+	 */
+	trunk_request_signal_complete(preq->treq);
+	TEST_CHECK(preq->completed);
+	TEST_CHECK(preq->freed);
+
+	TEST_CHECK(test_run(&test, test_no_outstanding));
+	TEST_CHECK(test.stats.completed == 1);
+	TEST_CHECK(test.stats.failed == 0);
+
+	test_teardown(&test);
+}
+
+/*
+ *	Requeue on the same connection, as is done for transactions.
+ */
+static void test_requeue(void)
+{
+	test_shared_t		test;
+	test_shared_request_t	*preq;
+
+	test_setup(&test, "shared_requeue", 1);
+
+	preq = test_request_alloc(&test, TEST_REPLY_RUNNABLE);
+	TEST_CHECK(trunk_request_enqueue(&preq->treq, test.trunk, preq->request, preq, NULL) == TRUNK_ENQUEUE_OK);
+	TEST_CHECK(test_run(&test, test_runnable));
+
+	/*
+	 *	The I/O thread completes the request the
+	 *	second time round.
+	 */
+	preq->reply = TEST_REPLY_COMPLETE;
+	TEST_CHECK(trunk_request_requeue(preq->treq) == TRUNK_ENQUEUE_OK);
+
+	TEST_CHECK(test_run(&test, test_no_outstanding));
+	TEST_CHECK(atomic_load(&preq->sent) == 2);
+	TEST_CHECK(preq->runnable == 1);
+	TEST_CHECK(preq->completed);
+	TEST_CHECK(preq->freed);
+
+	test_teardown(&test);
+}
+
+/*
+ *	Cancel a request the I/O thread is holding.  The cancel
+ *	callback runs in the I/O thread, so the preq must stay
+ *	around until the I/O thread is done with it.
+ */
+static void test_cancel(void)
+{
+	test_shared_t		test;
+	test_shared_request_t	*preq;
+	fr_time_t		timeout = fr_time_add(fr_time(), TEST_TIMEOUT);
+
+	test_setup(&test, "shared_cancel", 1);
+
+	preq = test_request_alloc(&test, TEST_REPLY_HOLD);
+	TEST_CHECK(trunk_request_enqueue(&preq->treq, test.trunk, preq->request, preq, NULL) == TRUNK_ENQUEUE_OK);
+
+	/*
+	 *	Wait for the request to be written out
+	 */
+	while ((atomic_load(&preq->sent) == 0) && fr_time_lt(fr_time(), timeout)) {
+		TEST_CHECK(fr_event_corral(test.el, fr_time(), false) >= 0);
+		fr_event_service(test.el);
+	}
+	TEST_CHECK(atomic_load(&preq->sent) == 1);
+
+	/*
+	 *	Parent the preq by the treq, as API clients
+	 *	are required to when cancelling.
+	 */
+	talloc_steal(preq->treq, preq);
+	trunk_request_signal_cancel(preq->treq);
+	TEST_CHECK(preq->treq->state == TRUNK_REQUEST_STATE_CANCEL);
+	TEST_CHECK(fr_dlist_num_elements(&test.worker->outstanding) == 1);
+
+	TEST_CHECK(test_run(&test, test_no_outstanding));
+	TEST_CHECK(atomic_load(&test_cancelled) == 1);
+	TEST_CHECK(test.stats.completed == 0);
+	TEST_CHECK(test.stats.failed == 0);
+	TEST_CHECK(test.stats.freed == 1);
+	TEST_CHECK(test.trunk->req_alloc == 0);
+
+	test_teardown(&test);
+}
+
+static bool test_all_runnable(test_shared_t *test)
+{
+	return test->stats.runnable == 200;
+}
+
+/*
+ *	Many requests over several I/O threads, with a mixture of outcomes.
+ */
+static void test_many(void)
+{
+	test_shared_t		test;
+	test_shared_request_t	*preq[400];
+	unsigned int		i, completed = 0, cancelled = 0;
+
+	test_setup(&test, "shared_many", 2);
+
+	for (i = 0; i < NUM_ELEMENTS(preq); i++) {
+		preq[i] = test_request_alloc(&test, (i % 2) ? TEST_REPLY_RUNNABLE : TEST_REPLY_COMPLETE);
+		TEST_CHECK(trunk_request_enqueue(&preq[i]->treq, test.trunk, preq[i]->request,
+						 preq[i], NULL) == TRUNK_ENQUEUE_OK);
+	}
+
+	/*
+	 *	Both I/O threads were used
+	 */
+	TEST_CHECK(atomic_load(&test.shared->io[0]->assigned) > 0);
+	TEST_CHECK(atomic_load(&test.shared->io[1]->assigned) > 0);
+
+	TEST_CHECK(test_run(&test, test_all_runnable));
+
+	/*
+	 *	Complete half of the runnable requests, and
+	 *	cancel the rest.
+	 */
+	for (i = 1; i < NUM_ELEMENTS(preq); i += 2) {
+		TEST_CHECK(preq[i]->runnable == 1);
+
+		if (i % 4 == 1) {
+			trunk_request_signal_complete(preq[i]->treq);
+			completed++;
+			continue;
+		}
+
+		talloc_steal(preq[i]->treq, preq[i]);
+		trunk_request_signal_cancel(preq[i]->treq);
+		cancelled++;
+	}
+
+	TEST_CHECK(test_run(&test, test_no_outstanding));
+	TEST_CHECK(test.stats.completed == (NUM_ELEMENTS(preq) / 2) + completed);
+	TEST_MSG("Expected %zu completed, got %" PRIu64, (NUM_ELEMENTS(preq) / 2) + completed, test.stats.completed);
+	TEST_CHECK(test.stats.failed == 0);
+	TEST_CHECK(test.stats.freed == (test.stats.completed + cancelled));
+	TEST_CHECK(test.trunk->req_alloc == 0);
+	TEST_CHECK(atomic_load(&test_cancelled) == cancelled);
+
+	test_teardown(&test);
+}
+
+TEST_LIST = {
+	{ "Enqueue - Complete in I/O thread",		test_enqueue_complete },
+	{ "Enqueue - Complete in worker",		test_enqueue_runnable_complete },
+	{ "Requeue - Same connection",			test_requeue },
+	{ "Cancel - Held by I/O thread",		test_cancel },
+	{ "Many - Multiple I/O threads",		test_many },
+
+	{ NULL }
+};
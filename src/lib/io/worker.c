@@ -51,6 +51,7 @@ RCSID("$Id$")
 #define LOG_PREFIX worker->name
 #define LOG_DST worker->log
 
+#include <freeradius-devel/io/atomic_queue.h>
 #include <freeradius-devel/io/channel.h>
 #include <freeradius-devel/io/listen.h>
 #include <freeradius-devel/io/message.h>
@@ -58,6 +59,7 @@ RCSID("$Id$")
 #include <freeradius-devel/unlang/base.h>
 #include <freeradius-devel/unlang/call.h>
 #include <freeradius-devel/unlang/interpret.h>
+#include <freeradius-devel/unlang/profile.h>
 #include <freeradius-devel/server/request.h>
 #include <freeradius-devel/server/time_tracking.h>
 #include <freeradius-devel/util/dlist.h>
@@ -93,6 +95,62 @@ typedef struct {
 	fr_dlist_head_t		dlist;
 } fr_worker_channel_t;
 
+/*
+ *	How many unstarted requests a worker may offer to its peers.
+ */
+#define WORKER_STEAL_BACKLOG	(1024)
+
+/** A worker's view of the work stealing state
+ *
+ *  Only the owning worker pushes to the backlog.  Any worker may pop
+ *  from it.
+ */
+typedef struct {
+	fr_worker_t		*worker;	//!< the worker which owns this entry.
+	atomic_bool		running;	//!< whether peers may steal from, or reply to, this worker.
+	atomic_bool		idle;		//!< the worker is waiting for events with nothing to run.
+	fr_atomic_queue_t	*backlog;	//!< unstarted requests which any worker may take.
+} fr_worker_steal_peer_t;
+
+/** Work stealing state shared between all workers in a scheduler
+ *
+ */
+struct fr_worker_steal_s {
+	unsigned int		num_workers;	//!< number of entries in the peer array.
+	fr_worker_steal_peer_t	*peer;		//!< one per worker, indexed by worker ID.
+};
+
+/** A reply encoded by a worker which stole the request
+ *
+ *  Sent back to the origin worker via its control plane, as only the
+ *  origin may write to the channel the request arrived on.
+ */
+typedef struct {
+	fr_channel_t		*ch;		//!< the channel the request arrived on.
+	fr_listen_t		*listen;	//!< the listener the request arrived on.
+	void			*packet_ctx;	//!< for the listener.
+
+	fr_time_t		request_time;	//!< when the network thread received the request.
+	fr_time_delta_t		processing_time; //!< how long the thief spent running the request.
+
+	bool			track_duplicates; //!< the origin tracks the request in its stolen tree.
+	bool			null_reply;	//!< tell the channel the request was eaten.
+	uint8_t			*data;		//!< the encoded reply.
+	size_t			data_size;	//!< length of the encoded reply.
+} fr_worker_stolen_reply_t;
+
+/** A request we offered to our peers, from a listener which tracks duplicates
+ *
+ *  Our peers have their own dedup trees, so the origin checks new packets
+ *  against the requests it has offered, as well as against its own.
+ */
+typedef struct {
+	fr_rb_node_t		node;		//!< entry in the stolen tree.
+	fr_listen_t const	*listen;	//!< the listener the request arrived on.
+	void const		*packet_ctx;	//!< for the listener.
+	fr_time_t		recv_time;	//!< when the network thread received the request.
+} fr_worker_stolen_t;
+
 /**
  *  A worker which takes packets from a master, and processes them.
  */
@@ -142,6 +200,16 @@ struct fr_worker_s {
 	fr_worker_channel_t	*channel;	//!< list of channels
 
 	request_slab_list_t	*slab;		//!< slab allocator for request_t
+
+	fr_worker_steal_t	*steal;		//!< work stealing state shared with our peers, or NULL.
+	unsigned int		steal_id;	//!< our entry in the work stealing peer array.
+	uint64_t		num_stolen;	//!< requests we took from other workers.
+	uint64_t		num_stolen_from; //!< our requests which other workers ran.
+	fr_rb_tree_t		*stolen;	//!< requests we offered to our peers, by dedup key.
+
+	int			numa_node;	//!< NUMA node we're pinned to, or -1.
+
+	unlang_profile_t	*profile;	//!< unlang instruction profiler, disabled until enabled via radmin.
 };
 
 typedef struct {
@@ -201,7 +269,9 @@ static inline bool is_worker_thread(fr_worker_t const *worker)
 	return (pthread_equal(pthread_self(), worker->thread_id) != 0);
 }
 
-static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now);
+static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now, fr_worker_t *origin);
+static bool worker_steal_defer(fr_worker_t *worker, fr_channel_data_t *cd);
+static void worker_steal_channel_close(fr_worker_t *worker, fr_channel_t *ch, fr_time_t now);
 static void worker_send_reply(fr_worker_t *worker, request_t *request, bool do_not_respond, fr_time_t now);
 
 /** Callback which handles a message being received on the worker side.
@@ -217,7 +287,13 @@ static void worker_recv_request(void *ctx, fr_channel_t *ch, fr_channel_data_t *
 	worker->stats.in++;
 	DEBUG3("Received request %" PRIu64 "", worker->stats.in);
 	cd->channel.ch = ch;
-	worker_request_bootstrap(worker, cd, fr_time());
+
+	/*
+	 *	We're overloaded, let an idle peer take it.
+	 */
+	if (worker->steal && worker_steal_defer(worker, cd)) return;
+
+	worker_request_bootstrap(worker, cd, fr_time(), NULL);
 }
 
 static void worker_requests_cancel(fr_worker_channel_t *ch)
@@ -335,6 +411,8 @@ static void worker_channel_callback(void *ctx, void const *data, size_t data_siz
 
 			if (worker->channel[i].ch != ch) continue;
 
+			if (worker->steal) worker_steal_channel_close(worker, ch, now);
+
 			worker_requests_cancel(&worker->channel[i]);
 
 			ms = fr_channel_responder_uctx_get(ch);
@@ -495,6 +573,530 @@ static void worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now
 	worker->stats.out++;
 }
 
+/** Allocate a reply for a request we stole from another worker
+ *
+ * @param[in] ch		the channel the request arrived on.
+ * @param[in] listen		the listener the request arrived on.
+ * @param[in] packet_ctx	for the listener.
+ * @param[in] size		of the buffer to allocate for the encoded reply.
+ * @return the reply.
+ */
+static fr_worker_stolen_reply_t *worker_steal_reply_alloc(fr_channel_t *ch, fr_listen_t *listen, void *packet_ctx, size_t size)
+{
+	fr_worker_stolen_reply_t *sr;
+
+	/*
+	 *	Not parented, as it's freed by the origin worker.
+	 */
+	MEM(sr = talloc_zero(NULL, fr_worker_stolen_reply_t));
+	if (size) MEM(sr->data = talloc_zero_array(sr, uint8_t, size));
+
+	sr->ch = ch;
+	sr->listen = listen;
+	sr->packet_ctx = packet_ctx;
+	sr->track_duplicates = listen->track_duplicates;
+
+	return sr;
+}
+
+static int8_t worker_stolen_cmp(void const *one, void const *two)
+{
+	int ret;
+	fr_worker_stolen_t const *a = one, *b = two;
+
+	ret = CMP(a->listen, b->listen);
+	if (ret) return ret;
+
+	return CMP(a->packet_ctx, b->packet_ctx);
+}
+
+/** Stop tracking a request we offered to our peers
+ *
+ * @param[in] worker		the worker which received the request.
+ * @param[in] listen		the listener the request arrived on.
+ * @param[in] packet_ctx	for the listener.
+ * @param[in] recv_time		when the network thread received the request.
+ * @return
+ *	- true if the request is still current.
+ *	- false if a newer packet has replaced it, and its reply should be discarded.
+ */
+static bool worker_steal_untrack(fr_worker_t *worker, fr_listen_t const *listen, void const *packet_ctx, fr_time_t recv_time)
+{
+	fr_worker_stolen_t	*st;
+
+	st = fr_rb_find(worker->stolen, &(fr_worker_stolen_t){ .listen = listen, .packet_ctx = packet_ctx });
+	if (!st || !fr_time_eq(st->recv_time, recv_time)) return false;
+
+	fr_rb_delete(worker->stolen, st);
+	return true;
+}
+
+/** Hand a reply for a stolen request back to the worker which received it
+ *
+ * @param[in] worker	the worker which ran the request.
+ * @param[in] origin	the worker which owns the channel.
+ * @param[in] sr	the reply.  The origin is responsible for freeing it.
+ */
+static void worker_steal_reply_send(fr_worker_t *worker, fr_worker_t *origin, fr_worker_stolen_reply_t *sr)
+{
+	fr_ring_buffer_t *rb;
+
+	/*
+	 *	The origin is exiting, and there's no one left to
+	 *	talk to the network thread.
+	 */
+	if (!atomic_load_explicit(&worker->steal->peer[origin->steal_id].running, memory_order_acquire)) {
+	fail:
+		talloc_free(sr);
+		return;
+	}
+
+	rb = fr_worker_rb_init();
+	if (!rb) goto fail;
+
+	if (fr_control_message_send(origin->control, rb, FR_CONTROL_ID_STEAL_REPLY, &sr, sizeof(sr)) < 0) {
+		RATE_LIMIT_GLOBAL(PERROR, "Failed returning stolen request to %s", origin->name);
+		goto fail;
+	}
+}
+
+/** NAK a stolen request
+ *
+ * @param[in] worker	the worker which stole the request.
+ * @param[in] origin	the worker which received the request.
+ * @param[in] cd	the message to NAK.
+ * @param[in] now	when we started processing the message.
+ */
+static void worker_steal_nak(fr_worker_t *worker, fr_worker_t *origin, fr_channel_data_t *cd, fr_time_t now)
+{
+	fr_worker_stolen_reply_t	*sr;
+	fr_listen_t			*listen = cd->listen;
+	size_t				size;
+
+	worker->num_naks++;
+
+	size = listen->app_io->default_reply_size;
+	if (!size) size = listen->app_io->default_message_size;
+
+	sr = worker_steal_reply_alloc(cd->channel.ch, listen, cd->packet_ctx, size);
+
+	if (listen->app_io->nak) {
+		size = listen->app_io->nak(listen, cd->packet_ctx, cd->m.data,
+					   cd->m.data_size, sr->data, size);
+	} else {
+		size = 1;	/* rely on them to figure it the heck out */
+	}
+
+	sr->data_size = size;
+	sr->processing_time = fr_time_sub(fr_time(), now);
+	sr->request_time = cd->request.recv_time;
+
+	fr_message_done(&cd->m);
+
+	worker_steal_reply_send(worker, origin, sr);
+}
+
+/** Tell the origin worker that a stolen request was a duplicate
+ *
+ * @param[in] worker	the worker which stole the request.
+ * @param[in] request	the duplicate.
+ */
+static void worker_steal_null_reply(fr_worker_t *worker, request_t *request)
+{
+	fr_worker_stolen_reply_t *sr;
+
+	sr = worker_steal_reply_alloc(request->async->channel, request->async->listen, request->async->packet_ctx, 0);
+	sr->null_reply = true;
+
+	worker_steal_reply_send(worker, request->async->origin, sr);
+}
+
+/** Encode the reply for a stolen request, and return it to the origin worker
+ *
+ * @param[in] worker		the worker which ran the request.
+ * @param[in] request		we're sending a reply for.
+ * @param[in] send_reply	whether the network side sends a reply
+ * @param[in] now		The current time
+ */
+static void worker_steal_send_reply(fr_worker_t *worker, request_t *request, bool send_reply, fr_time_t now)
+{
+	fr_worker_stolen_reply_t	*sr;
+	fr_listen_t			*listen = request->async->listen;
+	size_t				size = 0;
+
+	REQUEST_VERIFY(request);
+
+	fr_assert(!fr_heap_entry_inserted(request->runnable));
+
+	if (send_reply) {
+		size = listen->app_io->default_reply_size;
+		if (!size) size = listen->app_io->default_message_size;
+	}
+
+	sr = worker_steal_reply_alloc(request->async->channel, listen, request->async->packet_ctx, size);
+
+	/*
+	 *	An empty reply tells the origin the network side
+	 *	doesn't send anything.
+	 */
+	if (send_reply) {
+		ssize_t slen = 0;
+
+		if (listen->app_io->encode) {
+			slen = listen->app_io->encode(listen->app_io_instance, request, sr->data, size);
+		} else if (listen->app->encode) {
+			slen = listen->app->encode(listen->app_instance, request, sr->data, size);
+		}
+		if (slen < 0) {
+			RPERROR("Failed encoding request");
+			*sr->data = 0;
+			slen = 1;
+		}
+
+		fr_assert((size_t) slen <= size);
+		sr->data_size = slen;
+	}
+
+	sr->processing_time = request->async->tracking.running_total;
+	sr->request_time = request->async->recv_time;
+
+	fr_time_elapsed_update(&worker->cpu_time, now, fr_time_add(now, sr->processing_time));
+	fr_time_elapsed_update(&worker->wall_clock, sr->request_time, now);
+
+	RDEBUG("Finished request, returning it to %s", request->async->origin->name);
+
+	worker_steal_reply_send(worker, request->async->origin, sr);
+
+	fr_dlist_entry_unlink(&request->listen_entry);
+}
+
+/** A peer has sent us the reply for a request it stole from us
+ *
+ * @param[in] ctx	the worker
+ * @param[in] data	the message
+ * @param[in] data_size	size of the data
+ * @param[in] now	the current time
+ */
+static void worker_steal_reply_callback(void *ctx, void const *data, NDEBUG_UNUSED size_t data_size, fr_time_t now)
+{
+	fr_worker_t			*worker = talloc_get_type_abort(ctx, fr_worker_t);
+	fr_worker_stolen_reply_t	*sr;
+	fr_channel_data_t		*reply;
+	fr_message_set_t		*ms;
+	int				i;
+
+	fr_assert(data_size == sizeof(sr));
+
+	memcpy(&sr, data, sizeof(sr));
+
+	/*
+	 *	A newer packet arrived while the peer was running this
+	 *	one.  Tell the channel we've eaten the request, but
+	 *	don't send the stale reply.
+	 *
+	 *	The request must be untracked even if the channel has
+	 *	closed, and its pointer is only compared, never used.
+	 */
+	if (sr->track_duplicates && !sr->null_reply &&
+	    !worker_steal_untrack(worker, sr->listen, sr->packet_ctx, sr->request_time)) {
+		DEBUG2("Discarding reply to stolen request, a newer packet replaced it");
+		sr->null_reply = true;
+	}
+
+	/*
+	 *	The channel may have been closed while the peer was
+	 *	running the request.  Only use channels we still own.
+	 */
+	for (i = 0; i < worker->config.max_channels; i++) {
+		if (worker->channel[i].ch == sr->ch) break;
+	}
+	if ((i == worker->config.max_channels) || !fr_channel_active(sr->ch)) goto done;
+
+	worker->num_stolen_from++;
+
+	if (sr->null_reply) {
+		fr_channel_null_reply(sr->ch);
+		goto done;
+	}
+
+	ms = fr_channel_responder_uctx_get(sr->ch);
+	fr_assert(ms != NULL);
+
+	reply = (fr_channel_data_t *) fr_message_reserve(ms, sr->data_size ? sr->data_size : 1);
+	fr_assert(reply != NULL);
+
+	if (sr->data_size) {
+		fr_assert(sr->data_size <= reply->m.rb_size);
+		memcpy(reply->m.data, sr->data, sr->data_size);
+		(void) fr_message_alloc(ms, &reply->m, sr->data_size);
+	}
+
+	reply->m.when = now;
+	reply->reply.cpu_time = worker->tracking.running_total;
+	reply->reply.processing_time = sr->processing_time;
+	reply->reply.request_time = sr->request_time;
+
+	reply->listen = sr->listen;
+	reply->packet_ctx = sr->packet_ctx;
+
+	if (fr_channel_send_reply(sr->ch, reply) < 0) {
+		DEBUG2("Failed sending reply to channel");
+	}
+
+	worker->stats.out++;
+
+done:
+	talloc_free(sr);
+}
+
+/** Take unstarted requests from our peers' backlogs
+ *
+ *  We stop once we have as much work as a peer would have before
+ *  offering requests for stealing.
+ *
+ * @param[in] worker	the idle worker.
+ * @param[in] now	the current time.
+ */
+static void worker_steal(fr_worker_t *worker, fr_time_t now)
+{
+	fr_worker_steal_t	*steal = worker->steal;
+	unsigned int		i;
+	void			*data;
+
+	if (worker->exiting) return;
+
+	for (i = 1; i < steal->num_workers; i++) {
+		fr_worker_steal_peer_t *peer = &steal->peer[(worker->steal_id + i) % steal->num_workers];
+
+		if (!atomic_load_explicit(&peer->running, memory_order_acquire)) continue;
+
+		while (fr_heap_num_elements(worker->runnable) < worker->config.steal_threshold) {
+			if (!fr_atomic_queue_pop(peer->backlog, &data)) break;
+
+			worker->num_stolen++;
+			worker_request_bootstrap(worker, data, now, peer->worker);
+		}
+	}
+}
+
+/** A peer has queued requests for stealing, and thinks we're idle
+ *
+ * @param[in] ctx	the worker
+ * @param[in] data	the ID of the peer
+ * @param[in] data_size	size of the data
+ * @param[in] now	the current time
+ */
+static void worker_steal_callback(void *ctx, UNUSED void const *data, UNUSED size_t data_size, fr_time_t now)
+{
+	fr_worker_t *worker = talloc_get_type_abort(ctx, fr_worker_t);
+
+	worker_steal(worker, now);
+}
+
+/** Offer a new request to our peers if we're overloaded
+ *
+ *  Only requests which haven't been started are offered.  Once a
+ *  request has been bootstrapped, its memory, timers and module thread
+ *  instance data all belong to the worker which is running it.
+ *
+ * @param[in] worker	the worker which received the request.
+ * @param[in] cd	the request.
+ * @return
+ *	- true if the request was queued for stealing.
+ *	- false if we should run the request ourselves.
+ */
+static bool worker_steal_defer(fr_worker_t *worker, fr_channel_data_t *cd)
+{
+	fr_worker_steal_t	*steal = worker->steal;
+	fr_listen_t		*listen = cd->listen;
+	fr_worker_stolen_t	*st = NULL;
+	fr_ring_buffer_t	*rb;
+	unsigned int		i;
+
+	/*
+	 *	Our peers can't see each other's dedup trees, so
+	 *	check new packets against the requests we've offered
+	 *	them, whether or not we're overloaded.
+	 */
+	if (listen->track_duplicates && (fr_rb_num_elements(worker->stolen) > 0)) {
+		st = fr_rb_find(worker->stolen, &(fr_worker_stolen_t){ .listen = listen, .packet_ctx = cd->packet_ctx });
+		if (st && fr_time_eq(st->recv_time, cd->request.recv_time)) {
+			DEBUG("Discarding duplicate of request offered to our peers");
+
+			fr_message_done(&cd->m);
+			fr_channel_null_reply(cd->channel.ch);
+			worker->stats.dup++;
+			return true;
+		}
+
+		/*
+		 *	The reply to the old request is discarded when
+		 *	it's returned, or the request is dropped if we
+		 *	reclaim it.
+		 */
+		if (st) {
+			DEBUG("Got conflicting packet for request offered to our peers, discarding the old request");
+
+			fr_rb_delete(worker->stolen, st);
+			worker->stats.dropped++;
+		}
+	}
+
+	if (fr_heap_num_elements(worker->runnable) < worker->config.steal_threshold) return false;
+
+	/*
+	 *	A packet for a request we're running has to go through
+	 *	our own dedup tree.
+	 */
+	if (listen->track_duplicates) {
+		fr_async_t	async = { .listen = listen, .packet_ctx = cd->packet_ctx };
+		request_t	key = { .async = &async };
+
+		if (fr_rb_find(worker->dedup, &key)) return false;
+	}
+
+	if (!fr_atomic_queue_push(steal->peer[worker->steal_id].backlog, cd)) return false;
+
+	if (listen->track_duplicates) {
+		MEM(st = talloc(worker->stolen, fr_worker_stolen_t));
+		*st = (fr_worker_stolen_t){
+			.listen = listen,
+			.packet_ctx = cd->packet_ctx,
+			.recv_time = cd->request.recv_time
+		};
+		(void) fr_rb_insert(worker->stolen, st);
+	}
+
+	/*
+	 *	Wake one idle peer.  Busy peers check the backlogs
+	 *	when they run out of work, and we reclaim whatever
+	 *	is left when we have capacity again.
+	 */
+	for (i = 1; i < steal->num_workers; i++) {
+		fr_worker_steal_peer_t *peer = &steal->peer[(worker->steal_id + i) % steal->num_workers];
+
+		if (!atomic_load_explicit(&peer->running, memory_order_acquire)) continue;
+
+		if (!atomic_exchange_explicit(&peer->idle, false, memory_order_seq_cst)) continue;
+
+		rb = fr_worker_rb_init();
+		if (rb) (void) fr_control_message_send(peer->worker->control, rb, FR_CONTROL_ID_STEAL,
+						       &worker->steal_id, sizeof(worker->steal_id));
+		break;
+	}
+
+	return true;
+}
+
+/** Run a request from our own backlog
+ *
+ * @param[in] worker	the worker.
+ * @param[in] cd	the request, which no peer has taken.
+ * @param[in] now	the current time.
+ */
+static void worker_steal_run(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now)
+{
+	if (cd->listen->track_duplicates &&
+	    !worker_steal_untrack(worker, cd->listen, cd->packet_ctx, cd->request.recv_time)) {
+		DEBUG2("Discarding request which was replaced before it was run");
+
+		fr_message_done(&cd->m);
+		fr_channel_null_reply(cd->channel.ch);
+		return;
+	}
+
+	worker_request_bootstrap(worker, cd, now, NULL);
+}
+
+/** Run requests from our own backlog which no peer has taken
+ *
+ * @param[in] worker	the worker.
+ * @param[in] now	the current time.
+ */
+static void worker_steal_reclaim(fr_worker_t *worker, fr_time_t now)
+{
+	fr_atomic_queue_t	*backlog = worker->steal->peer[worker->steal_id].backlog;
+	void			*data;
+
+	while (fr_heap_num_elements(worker->runnable) < worker->config.steal_threshold) {
+		if (!fr_atomic_queue_pop(backlog, &data)) break;
+
+		worker_steal_run(worker, data, now);
+	}
+}
+
+/** Find work before waiting for events
+ *
+ * @param[in] worker	the worker.
+ * @param[in] now	the current time.
+ */
+static void worker_steal_poll(fr_worker_t *worker, fr_time_t now)
+{
+	fr_worker_steal_peer_t	*me = &worker->steal->peer[worker->steal_id];
+
+	worker_steal_reclaim(worker, now);
+
+	if (worker->exiting || (fr_heap_num_elements(worker->runnable) > 0)) {
+		atomic_store_explicit(&me->idle, false, memory_order_seq_cst);
+		return;
+	}
+
+	/*
+	 *	Say we're idle before looking at the backlogs, so that a
+	 *	peer which queues a request after we've looked will
+	 *	wake us.
+	 */
+	atomic_store_explicit(&me->idle, true, memory_order_seq_cst);
+
+	worker_steal(worker, now);
+
+	if (fr_heap_num_elements(worker->runnable) > 0) atomic_store_explicit(&me->idle, false, memory_order_seq_cst);
+}
+
+/** A channel is closing, so clean up any requests from it in our backlog
+ *
+ * @param[in] worker	the worker.
+ * @param[in] ch	the channel which is closing.
+ * @param[in] now	the current time.
+ */
+static void worker_steal_channel_close(fr_worker_t *worker, fr_channel_t *ch, fr_time_t now)
+{
+	fr_atomic_queue_t	*backlog = worker->steal->peer[worker->steal_id].backlog;
+	fr_channel_data_t	**keep;
+	size_t			i, num = 0;
+	void			*data;
+
+	MEM(keep = talloc_array(NULL, fr_channel_data_t *, WORKER_STEAL_BACKLOG));
+
+	while ((num < WORKER_STEAL_BACKLOG) && fr_atomic_queue_pop(backlog, &data)) {
+		fr_channel_data_t *cd = data;
+
+		if (cd->channel.ch == ch) {
+			if (cd->listen->track_duplicates) {
+				(void) worker_steal_untrack(worker, cd->listen, cd->packet_ctx, cd->request.recv_time);
+			}
+			fr_message_done(&cd->m);
+			continue;
+		}
+
+		keep[num++] = cd;
+	}
+
+	/*
+	 *	Put the other channels' requests back, in order, so
+	 *	they're still available to our peers.  Only we push
+	 *	to our backlog, so there's always room for them.
+	 */
+	for (i = 0; i < num; i++) {
+		if (fr_atomic_queue_push(backlog, keep[i])) continue;
+
+		worker_steal_run(worker, keep[i], now);
+	}
+	talloc_free(keep);
+
+	worker_steal_reclaim(worker, now);
+}
+
 /** Signal the unlang interpreter that it needs to stop running the request
  *
  * Signalling is a synchronous operation.  Whatever I/O requests the request
@@ -804,7 +1406,29 @@ static int _worker_request_deinit(request_t *request, UNUSED void *uctx)
 	return request_slab_deinit(request);
 }
 
-static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now)
+/** NAK a request which hasn't been started
+ *
+ */
+static inline CC_HINT(always_inline)
+void worker_request_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now, fr_worker_t *origin)
+{
+	if (origin) {
+		worker_steal_nak(worker, origin, cd, now);
+		return;
+	}
+
+	worker_nak(worker, cd, now);
+}
+
+/** Decode a message into a new request, and mark it as runnable
+ *
+ * @param[in] worker	the worker which will run the request.
+ * @param[in] cd	the message from the network side.
+ * @param[in] now	the current time.
+ * @param[in] origin	the worker which received the message, if we stole it.
+ *			NULL if the message arrived on one of our channels.
+ */
+static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now, fr_worker_t *origin)
 {
 	int			ret = -1;
 	request_t		*request;
@@ -861,6 +1485,7 @@ static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd,
 	 *	Update the transport-specific fields.
 	 */
 	request->async->channel = cd->channel.ch;
+	request->async->origin = origin;
 
 	request->async->recv_time = cd->request.recv_time;
 
@@ -882,7 +1507,7 @@ static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd,
 	if (ret < 0) {
 		talloc_free(ctx);
 nak:
-		worker_nak(worker, cd, now);
+		worker_request_nak(worker, cd, now, origin);
 		return;
 	}
 
@@ -891,7 +1516,7 @@ nak:
 	 */
 	if (unlang_call_push(NULL, request, cd->listen->server_cs, UNLANG_TOP_FRAME) < 0) {
 		RERROR("Protocol failed to set 'process' function");
-		worker_nak(worker, cd, now);
+		worker_request_nak(worker, cd, now, origin);
 		return;
 	}
 
@@ -913,7 +1538,8 @@ nak:
 		}
 
 		fr_assert(old->async->listen == request->async->listen);
-		fr_assert(old->async->channel == request->async->channel);
+		fr_assert(old->async->origin || request->async->origin ||
+			  (old->async->channel == request->async->channel));
 
 		/*
 		 *	There's a new packet.  Do we keep the old one,
@@ -935,7 +1561,11 @@ nak:
 		if (fr_time_eq(old->async->recv_time, request->async->recv_time)) {
 			RWARN("Discarding duplicate of request (%"PRIu64")", old->number);
 
-			fr_channel_null_reply(request->async->channel);
+			if (request->async->origin) {
+				worker_steal_null_reply(worker, request);
+			} else {
+				fr_channel_null_reply(request->async->channel);
+			}
 			request_slab_release(request);
 
 			/*
@@ -1040,6 +1670,20 @@ void fr_worker_destroy(fr_worker_t *worker)
 	 */
 	unlang_interpret_set_thread_default(NULL);
 
+	/*
+	 *	Stop our peers from stealing from us, or sending us
+	 *	replies.  Anything left in our backlog is discarded.
+	 */
+	if (worker->steal) {
+		fr_worker_steal_peer_t	*peer = &worker->steal->peer[worker->steal_id];
+		void			*data;
+
+		atomic_store_explicit(&peer->running, false, memory_order_seq_cst);
+		atomic_store_explicit(&peer->idle, false, memory_order_seq_cst);
+
+		while (fr_atomic_queue_pop(peer->backlog, &data)) fr_message_done(&((fr_channel_data_t *) data)->m);
+	}
+
 	/*
 	 *	Destroy all of the active requests.  These are ones
 	 *	which are still waiting for timers or file descriptor
@@ -1163,6 +1807,17 @@ static void _worker_request_done_external(request_t *request, UNUSED rlm_rcode_t
 		fr_dlist_entry_unlink(&request->async->entry);
 	}
 
+	/*
+	 *	We stole the request, so the reply goes back via
+	 *	the worker which owns the channel.  We can't look at
+	 *	the channel, as it's not ours.
+	 */
+	if (request->async->origin) {
+		worker_steal_send_reply(worker, request, !unlang_request_is_cancelled(request), now);
+		request_slab_release(request);
+		return;
+	}
+
 	/*
 	 *	These conditions are true when the server is
 	 *	exiting and we're stopping all the requests.
@@ -1348,7 +2003,7 @@ static inline CC_HINT(always_inline) void worker_run_request(fr_worker_t *worker
 		 *	For real requests, if the channel is gone,
 		 *	just stop the request and free it.
 		 */
-		if (request->async->channel && !fr_channel_active(request->async->channel)) {
+		if (request->async->channel && !request->async->origin && !fr_channel_active(request->async->channel)) {
 			worker_stop_request(request);
 			return;
 		}
@@ -1387,6 +2042,9 @@ nomem:
 
 	unlang_thread_instantiate(worker);
 
+	worker->profile = unlang_profile_thread_alloc(worker, 4096);
+	if (!worker->profile) goto nomem;
+
 	if (config) worker->config = *config;
 
 #define CHECK_CONFIG(_x, _min, _max) do { \
@@ -1414,6 +2072,7 @@ nomem:
 	}
 
 	worker->thread_id = pthread_self();
+	worker->numa_node = -1;
 	worker->el = el;
 	worker->log = logger;
 	worker->lvl = lvl;
@@ -1536,6 +2195,12 @@ void fr_worker(fr_worker_t *worker)
 
 		WORKER_VERIFY;
 
+		/*
+		 *	Pick up requests from our backlog, or from
+		 *	our peers if we have nothing to do.
+		 */
+		if (worker->steal) worker_steal_poll(worker, fr_time());
+
 		/*
 		 *	There are runnable requests.  We still service
 		 *	the event loop, but we don't wait for events.
@@ -1686,6 +2351,112 @@ int fr_worker_listen_cancel(fr_worker_t *worker, fr_listen_t const *li)
 	return fr_control_message_send(worker->control, rb, FR_CONTROL_ID_LISTEN, &li, sizeof(li));
 }
 
+/** Record the NUMA node a worker's thread has been pinned to
+ *
+ * Network threads prefer workers on their own node.
+ *
+ * @param[in] worker	the worker.
+ * @param[in] node	the NUMA node, or -1 if the thread isn't pinned.
+ */
+void fr_worker_numa_node_set(fr_worker_t *worker, int node)
+{
+	worker->numa_node = node;
+}
+
+/** Return the NUMA node a worker's thread has been pinned to
+ *
+ * @param[in] worker	the worker.
+ * @return the NUMA node, or -1 if the thread isn't pinned.
+ */
+int fr_worker_numa_node(fr_worker_t const *worker)
+{
+	return worker->numa_node;
+}
+
+/** Allocate the state shared by workers which steal requests from each other
+ *
+ * @param[in] ctx		to allocate the state in.  Must outlive all of the workers.
+ * @param[in] num_workers	the maximum number of workers.
+ * @return
+ *	- NULL on error.
+ *	- the shared state on success.
+ */
+fr_worker_steal_t *fr_worker_steal_alloc(TALLOC_CTX *ctx, unsigned int num_workers)
+{
+	fr_worker_steal_t	*steal;
+	unsigned int		i;
+
+	MEM(steal = talloc_zero(ctx, fr_worker_steal_t));
+	MEM(steal->peer = talloc_zero_array(steal, fr_worker_steal_peer_t, num_workers));
+	steal->num_workers = num_workers;
+
+	for (i = 0; i < num_workers; i++) {
+		atomic_init(&steal->peer[i].running, false);
+		atomic_init(&steal->peer[i].idle, false);
+
+		steal->peer[i].backlog = fr_atomic_queue_alloc(steal, WORKER_STEAL_BACKLOG);
+		if (!steal->peer[i].backlog) {
+			fr_strerror_const("Failed creating work stealing backlog");
+			talloc_free(steal);
+			return NULL;
+		}
+	}
+
+	return steal;
+}
+
+/** Allow a worker to steal requests from its peers, and its peers to steal from it
+ *
+ *  Must be called from the worker's thread, before it starts processing requests.
+ *
+ * @param[in] worker	to add.
+ * @param[in] steal	state shared with the other workers.
+ * @param[in] id	unique ID of the worker, less than the number of workers
+ *			passed to #fr_worker_steal_alloc.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_worker_steal_add(fr_worker_t *worker, fr_worker_steal_t *steal, unsigned int id)
+{
+	fr_worker_steal_peer_t *peer;
+
+	if (id >= steal->num_workers) {
+		fr_strerror_printf("Worker ID %u is out of range", id);
+		return -1;
+	}
+
+	/*
+	 *	Stealing is disabled, don't advertise ourselves.
+	 */
+	if (!worker->config.steal_threshold) return 0;
+
+	worker->stolen = fr_rb_inline_talloc_alloc(worker, fr_worker_stolen_t, node, worker_stolen_cmp, talloc_free_data);
+	if (!worker->stolen) {
+		fr_strerror_const("Failed creating stolen request tree");
+		return -1;
+	}
+
+	if (fr_control_callback_add(worker->control, FR_CONTROL_ID_STEAL, worker, worker_steal_callback) < 0) {
+		fr_strerror_const_push("Failed adding callback for work stealing");
+		return -1;
+	}
+
+	if (fr_control_callback_add(worker->control, FR_CONTROL_ID_STEAL_REPLY, worker, worker_steal_reply_callback) < 0) {
+		fr_strerror_const_push("Failed adding callback for stolen replies");
+		return -1;
+	}
+
+	worker->steal = steal;
+	worker->steal_id = id;
+
+	peer = &steal->peer[id];
+	peer->worker = worker;
+	atomic_store_explicit(&peer->running, true, memory_order_seq_cst);
+
+	return 0;
+}
+
 #ifdef WITH_VERIFY_PTR
 /** Verify the worker data structures.
  *
@@ -1748,6 +2519,8 @@ static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_inf
 		fprintf(fp, "count.naks\t\t\t%" PRIu64 "\n", worker->num_naks);
 		fprintf(fp, "count.active\t\t\t%" PRIu64 "\n", worker->num_active);
 		fprintf(fp, "count.runnable\t\t\t%u\n", fr_heap_num_elements(worker->runnable));
+		fprintf(fp, "count.stolen\t\t\t%" PRIu64 "\n", worker->num_stolen);
+		fprintf(fp, "count.stolen_from\t\t%" PRIu64 "\n", worker->num_stolen_from);
 	}
 
 	if ((info->argc == 0) || (strcmp(info->argv[0], "cpu") == 0)) {
@@ -1771,6 +2544,50 @@ static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_inf
 	return 0;
 }
 
+static int cmd_set_worker_profile(FILE *fp, FILE *fp_err, void *ctx, fr_cmd_info_t const *info)
+{
+	fr_worker_t *worker = ctx;
+
+	if (strcmp(info->argv[0], "reset") == 0) {
+		unlang_profile_reset(worker->profile);
+		return 0;
+	}
+
+	if (strcmp(info->argv[0], "on") == 0) {
+		unlang_profile_enable(worker->profile, true);
+		return 0;
+	}
+
+	if (strcmp(info->argv[0], "off") == 0) {
+		unlang_profile_enable(worker->profile, false);
+		return 0;
+	}
+
+	fprintf(fp_err, "Unknown profile command '%s'\n", info->argv[0]);
+	fprintf(fp, "Use one of 'on', 'off', or 'reset'\n");
+	return -1;
+}
+
+static int cmd_show_worker_profile(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_info_t const *info)
+{
+	fr_worker_t const *worker = ctx;
+
+	if (!unlang_profile_is_enabled(worker->profile)) fprintf(fp, "# profiling is disabled\n");
+
+	if ((info->argc == 0) || (strcmp(info->argv[0], "cpu") == 0)) {
+		unlang_profile_folded_fprint(fp, worker->profile, false);
+		return 0;
+	}
+
+	if (strcmp(info->argv[0], "yielded") == 0) {
+		unlang_profile_folded_fprint(fp, worker->profile, true);
+		return 0;
+	}
+
+	unlang_profile_modules_fprint(fp, worker->profile);
+	return 0;
+}
+
 fr_cmd_table_t cmd_worker_table[] = {
 	{
 		.parent = "stats",
@@ -1789,5 +2606,39 @@ fr_cmd_table_t cmd_worker_table[] = {
 		.read_only = true
 	},
 
+	{
+		.parent = "set",
+		.name = "worker",
+		.help = "Change settings for worker threads.",
+		.read_only = false
+	},
+
+	{
+		.parent = "set worker",
+		.add_name = true,
+		.name = "profile",
+		.syntax = "(on|off|reset)",
+		.func = cmd_set_worker_profile,
+		.help = "Enable, disable, or reset the unlang instruction profiler for a specific worker thread.",
+		.read_only = false
+	},
+
+	{
+		.parent = "show",
+		.name = "worker",
+		.help = "Show information about worker threads.",
+		.read_only = true
+	},
+
+	{
+		.parent = "show worker",
+		.add_name = true,
+		.name = "profile",
+		.syntax = "[(cpu|yielded|modules)]",
+		.func = cmd_show_worker_profile,
+		.help = "Show the unlang instruction profile for a specific worker thread.  'cpu' and 'yielded' print folded stacks in nanoseconds, suitable for flamegraph.pl.",
+		.read_only = true
+	},
+
 	CMD_TABLE_END
 };
@@ -67,8 +67,13 @@ typedef struct {
 	fr_time_delta_t		max_request_time;	//!< maximum time a request can be processed
 
 	fr_slab_config_t	reuse;			//!< slab allocator configuration
+
+	uint32_t		steal_threshold;	//!< runnable requests before idle workers may take
+							///< new ones from us.  0 disables work stealing.
 } fr_worker_config_t;
 
+typedef struct fr_worker_steal_s fr_worker_steal_t;
+
 int		fr_worker_request_timeout_set(fr_worker_t *worker, request_t *request, fr_time_delta_t timeout) CC_HINT(nonnull);
 
 fr_worker_t	*fr_worker_alloc(TALLOC_CTX *ctx, fr_event_list_t *el, char const *name,
@@ -90,6 +95,14 @@ int		fr_worker_stats(fr_worker_t const *worker, int num, uint64_t *stats) CC_HIN
 
 int		fr_worker_listen_cancel(fr_worker_t *worker, fr_listen_t const *li);
 
+void		fr_worker_numa_node_set(fr_worker_t *worker, int node) CC_HINT(nonnull);
+
+int		fr_worker_numa_node(fr_worker_t const *worker) CC_HINT(nonnull);
+
+fr_worker_steal_t *fr_worker_steal_alloc(TALLOC_CTX *ctx, unsigned int num_workers) CC_HINT(nonnull);
+
+int		fr_worker_steal_add(fr_worker_t *worker, fr_worker_steal_t *steal, unsigned int id) CC_HINT(nonnull);
+
 #include <freeradius-devel/server/module.h>
 
 int		fr_worker_subrequest_add(request_t *request) CC_HINT(nonnull);
@@ -257,6 +257,12 @@ fr_slen_t	fr_json_str_from_value(fr_sbuff_t *out, fr_value_box_t *vb, bool inclu
 
 void		fr_json_version_print(void);
 
+json_object	*fr_json_object_afrom_pair_list(TALLOC_CTX *ctx, fr_pair_list_t *vps,
+						fr_json_format_t const *format);
+
+fr_slen_t	fr_json_str_from_pair_list(fr_sbuff_t *out, fr_pair_list_t *vps,
+					   fr_json_format_t const *format);
+
 char		*fr_json_afrom_pair_list(TALLOC_CTX *ctx, fr_pair_list_t *vps,
 					 fr_json_format_t const *format);
 
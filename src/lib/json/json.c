@@ -28,6 +28,7 @@
  */
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/util/base16.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/sbuff.h>
 #include <freeradius-devel/util/types.h>
 #include <freeradius-devel/util/value.h>
@@ -611,7 +612,7 @@ do { \
  *
  * The result is a struct json_object, which should be free'd with
  * json_object_put() by the caller. Intended to only be called by
- * fr_json_afrom_pair_list().
+ * fr_json_object_afrom_pair_list().
  *
  * This function generates the "object" format, JSON_MODE_OBJECT.
  * @see fr_json_format_s
@@ -786,7 +787,7 @@ static json_object *json_object_afrom_pair_list(TALLOC_CTX *ctx, fr_pair_list_t
  *
  * The result is a struct json_object, which should be free'd with
  * json_object_put() by the caller. Intended to only be called by
- * fr_json_afrom_pair_list().
+ * fr_json_object_afrom_pair_list().
  *
  * This function generates the "simple object" format, JSON_MODE_OBJECT_SIMPLE.
  * @see fr_json_format_s
@@ -935,7 +936,7 @@ static json_object *json_smplobj_afrom_pair_list(TALLOC_CTX *ctx, fr_pair_list_t
  *
  * The result is a struct json_object, which should be free'd with
  * json_object_put() by the caller. Intended to only be called by
- * fr_json_afrom_pair_list().
+ * fr_json_object_afrom_pair_list().
  *
  * This function generates the "array" format, JSON_MODE_ARRAY.
  * @see fr_json_format_s
@@ -1079,7 +1080,7 @@ static struct json_object *json_array_afrom_pair_list(TALLOC_CTX *ctx, fr_pair_l
  *
  * The result is a struct json_object, which should be free'd with
  * json_object_put() by the caller. Intended to only be called by
- * fr_json_afrom_pair_list().
+ * fr_json_object_afrom_pair_list().
  *
  * This function generates the "array_of_values" format,
  * JSON_MODE_ARRAY_OF_VALUES, listing just the attribute values.
@@ -1141,7 +1142,7 @@ static struct json_object *json_value_array_afrom_pair_list(TALLOC_CTX *ctx, fr_
  *
  * The result is a struct json_object, which should be free'd with
  * json_object_put() by the caller. Intended to only be called by
- * fr_json_afrom_pair_list().
+ * fr_json_object_afrom_pair_list().
  *
  * This function generates the "array_of_names" format,
  * JSON_MODE_ARRAY_OF_NAMES, listing just the attribute names.
@@ -1202,11 +1203,666 @@ static struct json_object *json_attr_array_afrom_pair_list(TALLOC_CTX *ctx, fr_p
 }
 
 
+/** Returns a json_object tree representing a list of value pairs
+ *
+ * The result should be free'd with json_object_put() by the caller.
+ *
+ * fr_json_afrom_pair_list() and fr_json_str_from_pair_list() produce
+ * the serialised form of this tree without building it, so this is
+ * only needed where the caller wants to manipulate the json_objects.
+ *
+ * @param[in] ctx	Talloc context.
+ * @param[in] vps	a list of value pairs.
+ * @param[in] format	Formatting control, can be NULL to use default format.
+ * @return
+ *	- JSON object with the generated representation.
+ *	- NULL on error.
+ */
+json_object *fr_json_object_afrom_pair_list(TALLOC_CTX *ctx, fr_pair_list_t *vps,
+					    fr_json_format_t const *format)
+{
+	if (!format) format = &default_json_format;
+
+	switch (format->output_mode) {
+	case JSON_MODE_OBJECT:
+		return json_object_afrom_pair_list(ctx, vps, format);
+
+	case JSON_MODE_OBJECT_SIMPLE:
+		return json_smplobj_afrom_pair_list(ctx, vps, format);
+
+	case JSON_MODE_ARRAY:
+		return json_array_afrom_pair_list(ctx, vps, format);
+
+	case JSON_MODE_ARRAY_OF_VALUES:
+		return json_value_array_afrom_pair_list(ctx, vps, format);
+
+	case JSON_MODE_ARRAY_OF_NAMES:
+		return json_attr_array_afrom_pair_list(ctx, vps, format);
+
+	default:
+		/* This should never happen */
+		fr_assert(0);
+		fr_strerror_const("Invalid JSON output mode");
+		return NULL;
+	}
+}
+
+/** Write a string, escaped exactly as json-c's json_escape_str() would
+ *
+ * @param[out] out	Where to write the escaped string.
+ * @param[in] in	String to escape.  May contain embedded NULs.
+ * @param[in] inlen	Length of in.
+ * @return
+ *	- >= 0 the number of bytes written.
+ *	- < 0 the number of additional bytes required.
+ */
+static fr_slen_t json_escape_to_sbuff(fr_sbuff_t *out, char const *in, size_t inlen)
+{
+	fr_sbuff_t		our_out = FR_SBUFF(out);
+	uint8_t const		*p = (uint8_t const *)in, *end = p + inlen, *last_app = p;
+	static char const	hex[] = "0123456789abcdef";
+
+	while (p < end) {
+		char const	*esc;
+		char		uesc[6];
+
+		switch (*p) {
+		case '\b': esc = "\\b"; break;
+		case '\n': esc = "\\n"; break;
+		case '\r': esc = "\\r"; break;
+		case '\t': esc = "\\t"; break;
+		case '\f': esc = "\\f"; break;
+		case '"': esc = "\\\""; break;
+		case '\\': esc = "\\\\"; break;
+		case '/': esc = "\\/"; break;
+
+		default:
+			if (*p >= ' ') {
+				p++;
+				continue;
+			}
+
+			uesc[0] = '\\';
+			uesc[1] = 'u';
+			uesc[2] = '0';
+			uesc[3] = '0';
+			uesc[4] = hex[*p >> 4];
+			uesc[5] = hex[*p & 0x0f];
+			if (p > last_app) FR_SBUFF_IN_BSTRNCPY_RETURN(&our_out, (char const *)last_app, p - last_app);
+			FR_SBUFF_IN_BSTRNCPY_RETURN(&our_out, uesc, sizeof(uesc));
+			last_app = ++p;
+			continue;
+		}
+
+		if (p > last_app) FR_SBUFF_IN_BSTRNCPY_RETURN(&our_out, (char const *)last_app, p - last_app);
+		FR_SBUFF_IN_BSTRNCPY_RETURN(&our_out, esc, 2);
+		last_app = ++p;
+	}
+	if (p > last_app) FR_SBUFF_IN_BSTRNCPY_RETURN(&our_out, (char const *)last_app, p - last_app);
+
+	FR_SBUFF_SET_RETURN(out, &our_out);
+}
+
+/** Write a quoted, escaped, JSON string
+ *
+ */
+static inline fr_slen_t json_string_to_sbuff(fr_sbuff_t *out, char const *in, size_t inlen)
+{
+	fr_sbuff_t our_out = FR_SBUFF(out);
+
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, '"');
+	FR_SBUFF_RETURN(json_escape_to_sbuff, &our_out, in, inlen);
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, '"');
+
+	FR_SBUFF_SET_RETURN(out, &our_out);
+}
+
+/** Write the JSON representation of a value box
+ *
+ * Produces exactly what serialising the result of
+ * json_object_from_value_box() would, without allocating
+ * a json_object.
+ *
+ * @param[out] out	Where to write the value.
+ * @param[in] data	to write.
+ * @return
+ *	- >= 0 the number of bytes written.
+ *	- < 0 on error.
+ */
+static fr_slen_t json_value_box_to_sbuff(fr_sbuff_t *out, fr_value_box_t const *data)
+{
+	fr_sbuff_t our_out = FR_SBUFF(out);
+
+	/*
+	 *	We're converting to PRESENTATION format
+	 *	so any attributes with enumeration values
+	 *	should be converted to string types.
+	 */
+	if (data->enumv) {
+		fr_dict_enum_value_t const *enumv;
+
+		enumv = fr_dict_enum_by_value(data->enumv, data);
+		if (enumv) {
+			FR_SBUFF_RETURN(json_string_to_sbuff, &our_out, enumv->name, strlen(enumv->name));
+			FR_SBUFF_SET_RETURN(out, &our_out);
+		}
+	}
+
+	switch (data->type) {
+	default:
+	do_string:
+	{
+		char		buffer[64];
+		fr_sbuff_t	sbuff = FR_SBUFF_IN(buffer, sizeof(buffer));
+
+		if (fr_value_box_print(&sbuff, data, NULL) <= 0) {
+			fr_strerror_printf("Failed printing %s value", fr_type_to_str(data->type));
+			return -1;
+		}
+
+		FR_SBUFF_RETURN(json_string_to_sbuff, &our_out, buffer, fr_sbuff_used(&sbuff));
+	}
+		break;
+
+	case FR_TYPE_STRING:
+	case FR_TYPE_OCTETS:
+		FR_SBUFF_RETURN(json_string_to_sbuff, &our_out, (char const *)data->datum.ptr, data->vb_length);
+		break;
+
+	case FR_TYPE_BOOL:
+		FR_SBUFF_IN_STRCPY_RETURN(&our_out, data->vb_uint8 ? "true" : "false");
+		break;
+
+	case FR_TYPE_UINT8:
+		FR_SBUFF_IN_SPRINTF_RETURN(&our_out, "%u", data->vb_uint8);
+		break;
+
+	case FR_TYPE_UINT16:
+		FR_SBUFF_IN_SPRINTF_RETURN(&our_out, "%u", data->vb_uint16);
+		break;
+
+#ifdef HAVE_JSON_OBJECT_GET_INT64
+	case FR_TYPE_UINT32:
+		FR_SBUFF_IN_SPRINTF_RETURN(&our_out, "%" PRIu32, data->vb_uint32);
+		break;
+
+	case FR_TYPE_UINT64:
+		if (data->vb_uint64 > INT64_MAX) goto do_string;
+		FR_SBUFF_IN_SPRINTF_RETURN(&our_out, "%" PRIu64, data->vb_uint64);
+		break;
+#else
+	case FR_TYPE_UINT32:
+		if (data->vb_uint32 > INT32_MAX) goto do_string;
+		FR_SBUFF_IN_SPRINTF_RETURN(&our_out, "%" PRIu32, data->vb_uint32);
+		break;
+#endif
+
+	case FR_TYPE_INT8:
+		FR_SBUFF_IN_SPRINTF_RETURN(&our_out, "%i", data->vb_int8);
+		break;
+
+	case FR_TYPE_INT16:
+		FR_SBUFF_IN_SPRINTF_RETURN(&our_out, "%i", data->vb_int16);
+		break;
+
+	case FR_TYPE_INT32:
+		FR_SBUFF_IN_SPRINTF_RETURN(&our_out, "%" PRIi32, data->vb_int32);
+		break;
+
+#ifdef HAVE_JSON_OBJECT_GET_INT64
+	case FR_TYPE_INT64:
+		FR_SBUFF_IN_SPRINTF_RETURN(&our_out, "%" PRIi64, data->vb_int64);
+		break;
+
+	case FR_TYPE_SIZE:
+		FR_SBUFF_IN_SPRINTF_RETURN(&our_out, "%" PRIi64, (int64_t)data->vb_size);
+		break;
+#endif
+
+	case FR_TYPE_STRUCTURAL:
+		fr_strerror_const("Structural boxes cannot be converted to JSON values");
+		return -1;
+	}
+
+	FR_SBUFF_SET_RETURN(out, &our_out);
+}
+
+/** Write the value of a leaf pair, applying the value formatting options
+ *
+ * The streaming equivalent of json_afrom_value_box().
+ */
+static fr_slen_t json_pair_value_to_sbuff(fr_sbuff_t *out, fr_pair_t *vp, fr_json_format_t const *format)
+{
+	fr_value_box_t const	*vb = &vp->data;
+	fr_value_box_t		vb_str = FR_VALUE_BOX_INITIALISER_NULL(vb_str);
+	fr_slen_t		slen;
+
+	if (format->value.enum_as_int) {
+		int is_enum;
+
+		is_enum = fr_pair_value_enum_box(&vb, vp);
+		fr_assert(is_enum >= 0);
+	}
+
+	if (!format->value.always_string) return json_value_box_to_sbuff(out, vb);
+
+	if (fr_value_box_cast(NULL, &vb_str, FR_TYPE_STRING, NULL, vb) < 0) return -1;
+	slen = json_value_box_to_sbuff(out, &vb_str);
+	fr_value_box_clear(&vb_str);
+
+	return slen;
+}
+
+/** Write an attribute name, with the optional prefix, as a JSON string
+ *
+ */
+static fr_slen_t json_pair_name_to_sbuff(fr_sbuff_t *out, fr_dict_attr_t const *da, fr_json_format_t const *format)
+{
+	fr_sbuff_t our_out = FR_SBUFF(out);
+
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, '"');
+	if (format->attr.prefix) {
+		FR_SBUFF_RETURN(json_escape_to_sbuff, &our_out, format->attr.prefix, strlen(format->attr.prefix));
+		FR_SBUFF_IN_CHAR_RETURN(&our_out, ':');
+	}
+	FR_SBUFF_RETURN(json_escape_to_sbuff, &our_out, da->name, da->name_len);
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, '"');
+
+	FR_SBUFF_SET_RETURN(out, &our_out);
+}
+
+/** Whether two pairs would produce the same key
+ *
+ */
+static inline bool json_pair_name_eq(fr_pair_t const *a, fr_pair_t const *b)
+{
+	if (a->da == b->da) return true;
+
+	return (a->da->name_len == b->da->name_len) && (memcmp(a->da->name, b->da->name, a->da->name_len) == 0);
+}
+
+#define JSON_PAIR_NAME_BUCKETS	256
+
+/** Hash buckets of the attribute names in a list, which are used by more than one pair
+ *
+ * Pairs in a bucket which is only used once can't share a name with
+ * any other pair, so the searches for repeated names are skipped for
+ * them.  This keeps encoding linear, unless names repeat.
+ */
+typedef struct {
+	uint64_t	dup[JSON_PAIR_NAME_BUCKETS / 64];
+} json_pair_names_t;
+
+static inline unsigned int json_pair_name_bucket(fr_pair_t const *vp)
+{
+	return fr_hash(vp->da->name, vp->da->name_len) % JSON_PAIR_NAME_BUCKETS;
+}
+
+/** Find the names in a list which may be used by more than one pair
+ *
+ */
+static void json_pair_names_init(json_pair_names_t *names, fr_pair_list_t *vps)
+{
+	uint64_t	seen[JSON_PAIR_NAME_BUCKETS / 64] = { 0 };
+	fr_pair_t	*vp;
+
+	memset(names, 0, sizeof(*names));
+
+	for (vp = fr_pair_list_head(vps); vp; vp = fr_pair_list_next(vps, vp)) {
+		unsigned int	bucket;
+		uint64_t	bit;
+
+		if (vp->vp_raw) continue;
+
+		bucket = json_pair_name_bucket(vp);
+		bit = UINT64_C(1) << (bucket % 64);
+
+		if (seen[bucket / 64] & bit) {
+			names->dup[bucket / 64] |= bit;
+		} else {
+			seen[bucket / 64] |= bit;
+		}
+	}
+}
+
+/** Whether another pair in the list may have the same name as vp
+ *
+ */
+static inline bool json_pair_name_maybe_dup(json_pair_names_t const *names, fr_pair_t const *vp)
+{
+	unsigned int bucket = json_pair_name_bucket(vp);
+
+	return (names->dup[bucket / 64] & (UINT64_C(1) << (bucket % 64))) != 0;
+}
+
+/** Find the next pair after vp in the list, which has the same name
+ *
+ * The tree based encoders merge the values of pairs with the same
+ * name into the entry for the first of them.  The streaming encoders
+ * emit all the values when they reach the first pair, and skip the
+ * others.
+ */
+static inline fr_pair_t *json_pair_next_by_name(fr_pair_list_t *vps, fr_pair_t *vp)
+{
+	fr_pair_t *next;
+
+	for (next = fr_pair_list_next(vps, vp); next; next = fr_pair_list_next(vps, next)) {
+		if (next->vp_raw) continue;
+		if (json_pair_name_eq(vp, next)) return next;
+	}
+
+	return NULL;
+}
+
+/** Whether a pair with the same name as vp occurs earlier in the list
+ *
+ */
+static inline bool json_pair_name_seen(fr_pair_list_t *vps, fr_pair_t *vp)
+{
+	fr_pair_t *prev;
+
+	for (prev = fr_pair_list_head(vps); prev != vp; prev = fr_pair_list_next(vps, prev)) {
+		if (prev->vp_raw) continue;
+		if (json_pair_name_eq(vp, prev)) return true;
+	}
+
+	return false;
+}
+
+typedef fr_slen_t (*json_list_to_sbuff_t)(fr_sbuff_t *out, fr_pair_list_t *vps, fr_json_format_t const *format);
+
+/** Write the value of a leaf or structural pair
+ *
+ * Structural pairs are written by recursing into the same output mode.
+ */
+static fr_slen_t json_pair_to_sbuff(fr_sbuff_t *out, fr_pair_t *vp, fr_json_format_t const *format,
+				    json_list_to_sbuff_t list_func)
+{
+	switch (vp->vp_type) {
+	case FR_TYPE_LEAF:
+		return json_pair_value_to_sbuff(out, vp, format);
+
+	case FR_TYPE_STRUCTURAL:
+		return list_func(out, &vp->vp_group, format);
+
+	default:
+		fr_assert(0);
+		fr_strerror_printf("Invalid type %s for attribute %s", fr_type_to_str(vp->vp_type), vp->da->name);
+		return -1;
+	}
+}
+
+/** Write the values of vp, and of all later pairs with the same name
+ *
+ * Values are written as an array if there is more than one, or if
+ * value_is_always_array is set.
+ */
+static fr_slen_t json_pair_values_to_sbuff(fr_sbuff_t *out, fr_pair_list_t *vps, fr_pair_t *vp, bool maybe_dup,
+					   fr_json_format_t const *format, json_list_to_sbuff_t list_func)
+{
+	fr_sbuff_t	our_out = FR_SBUFF(out);
+	fr_pair_t	*next;
+
+	next = maybe_dup ? json_pair_next_by_name(vps, vp) : NULL;
+	if (!next && !format->value.value_is_always_array) {
+		FR_SBUFF_RETURN(json_pair_to_sbuff, &our_out, vp, format, list_func);
+		FR_SBUFF_SET_RETURN(out, &our_out);
+	}
+
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, '[');
+	FR_SBUFF_RETURN(json_pair_to_sbuff, &our_out, vp, format, list_func);
+	while (next) {
+		FR_SBUFF_IN_CHAR_RETURN(&our_out, ',');
+		FR_SBUFF_RETURN(json_pair_to_sbuff, &our_out, next, format, list_func);
+		next = json_pair_next_by_name(vps, next);
+	}
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, ']');
+
+	FR_SBUFF_SET_RETURN(out, &our_out);
+}
+
+/** Write the "object" format, JSON_MODE_OBJECT
+ *
+ * @see json_object_afrom_pair_list
+ */
+static fr_slen_t json_object_to_sbuff(fr_sbuff_t *out, fr_pair_list_t *vps, fr_json_format_t const *format)
+{
+	fr_sbuff_t		our_out = FR_SBUFF(out);
+	fr_pair_t		*vp;
+	json_pair_names_t	names;
+	bool			first = true;
+
+	json_pair_names_init(&names, vps);
+
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, '{');
+	for (vp = fr_pair_list_head(vps);
+	     vp;
+	     vp = fr_pair_list_next(vps, vp)) {
+		bool maybe_dup;
+
+		if (vp->vp_raw) continue;
+
+		maybe_dup = json_pair_name_maybe_dup(&names, vp);
+		if (maybe_dup && json_pair_name_seen(vps, vp)) continue;
+
+		if (!first) FR_SBUFF_IN_CHAR_RETURN(&our_out, ',');
+		first = false;
+
+		FR_SBUFF_RETURN(json_pair_name_to_sbuff, &our_out, vp->da, format);
+		FR_SBUFF_IN_STRCPY_LITERAL_RETURN(&our_out, ":{\"type\":");
+		FR_SBUFF_RETURN(json_string_to_sbuff, &our_out, fr_type_to_str(vp->vp_type), strlen(fr_type_to_str(vp->vp_type)));
+		FR_SBUFF_IN_STRCPY_LITERAL_RETURN(&our_out, ",\"value\":");
+		FR_SBUFF_RETURN(json_pair_values_to_sbuff, &our_out, vps, vp, maybe_dup, format, json_object_to_sbuff);
+		FR_SBUFF_IN_CHAR_RETURN(&our_out, '}');
+	}
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, '}');
+
+	FR_SBUFF_SET_RETURN(out, &our_out);
+}
+
+/** Write the "simple object" format, JSON_MODE_OBJECT_SIMPLE
+ *
+ * @see json_smplobj_afrom_pair_list
+ */
+static fr_slen_t json_smplobj_to_sbuff(fr_sbuff_t *out, fr_pair_list_t *vps, fr_json_format_t const *format)
+{
+	fr_sbuff_t		our_out = FR_SBUFF(out);
+	fr_pair_t		*vp;
+	json_pair_names_t	names;
+	bool			first = true;
+
+	json_pair_names_init(&names, vps);
+
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, '{');
+	for (vp = fr_pair_list_head(vps);
+	     vp;
+	     vp = fr_pair_list_next(vps, vp)) {
+		bool maybe_dup;
+
+		if (vp->vp_raw) continue;
+
+		maybe_dup = json_pair_name_maybe_dup(&names, vp);
+		if (maybe_dup && json_pair_name_seen(vps, vp)) continue;
+
+		if (!first) FR_SBUFF_IN_CHAR_RETURN(&our_out, ',');
+		first = false;
+
+		FR_SBUFF_RETURN(json_pair_name_to_sbuff, &our_out, vp->da, format);
+		FR_SBUFF_IN_CHAR_RETURN(&our_out, ':');
+		FR_SBUFF_RETURN(json_pair_values_to_sbuff, &our_out, vps, vp, maybe_dup, format, json_smplobj_to_sbuff);
+	}
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, '}');
+
+	FR_SBUFF_SET_RETURN(out, &our_out);
+}
+
+/** Write the "array" format, JSON_MODE_ARRAY
+ *
+ * @see json_array_afrom_pair_list
+ */
+static fr_slen_t json_array_to_sbuff(fr_sbuff_t *out, fr_pair_list_t *vps, fr_json_format_t const *format)
+{
+	fr_sbuff_t		our_out = FR_SBUFF(out);
+	fr_pair_t		*vp;
+	json_pair_names_t	names;
+	bool			first = true;
+
+	/*
+	 *	Values of repeated attributes are only merged
+	 *	if they're always written as arrays.
+	 */
+	if (format->value.value_is_always_array) json_pair_names_init(&names, vps);
+
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, '[');
+	for (vp = fr_pair_list_head(vps);
+	     vp;
+	     vp = fr_pair_list_next(vps, vp)) {
+		bool maybe_dup = false;
+
+		if (vp->vp_raw) continue;
+
+		if (format->value.value_is_always_array) {
+			maybe_dup = json_pair_name_maybe_dup(&names, vp);
+			if (maybe_dup && json_pair_name_seen(vps, vp)) continue;
+		}
+
+		if (!first) FR_SBUFF_IN_CHAR_RETURN(&our_out, ',');
+		first = false;
+
+		FR_SBUFF_IN_STRCPY_LITERAL_RETURN(&our_out, "{\"name\":");
+		FR_SBUFF_RETURN(json_pair_name_to_sbuff, &our_out, vp->da, format);
+		FR_SBUFF_IN_STRCPY_LITERAL_RETURN(&our_out, ",\"type\":");
+		FR_SBUFF_RETURN(json_string_to_sbuff, &our_out, fr_type_to_str(vp->vp_type), strlen(fr_type_to_str(vp->vp_type)));
+		FR_SBUFF_IN_STRCPY_LITERAL_RETURN(&our_out, ",\"value\":");
+		if (format->value.value_is_always_array) {
+			FR_SBUFF_RETURN(json_pair_values_to_sbuff, &our_out, vps, vp, maybe_dup, format, json_array_to_sbuff);
+		} else {
+			FR_SBUFF_RETURN(json_pair_to_sbuff, &our_out, vp, format, json_array_to_sbuff);
+		}
+		FR_SBUFF_IN_CHAR_RETURN(&our_out, '}');
+	}
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, ']');
+
+	FR_SBUFF_SET_RETURN(out, &our_out);
+}
+
+/** Write the "array_of_values" format, JSON_MODE_ARRAY_OF_VALUES
+ *
+ * @see json_value_array_afrom_pair_list
+ */
+static fr_slen_t json_value_array_to_sbuff(fr_sbuff_t *out, fr_pair_list_t *vps, fr_json_format_t const *format)
+{
+	fr_sbuff_t	our_out = FR_SBUFF(out);
+	fr_pair_t	*vp;
+	bool		first = true;
+
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, '[');
+	for (vp = fr_pair_list_head(vps);
+	     vp;
+	     vp = fr_pair_list_next(vps, vp)) {
+		if (vp->vp_raw) continue;
+
+		if (!first) FR_SBUFF_IN_CHAR_RETURN(&our_out, ',');
+		first = false;
+
+		FR_SBUFF_RETURN(json_pair_to_sbuff, &our_out, vp, format, json_value_array_to_sbuff);
+	}
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, ']');
+
+	FR_SBUFF_SET_RETURN(out, &our_out);
+}
+
+/** Write the "array_of_names" format, JSON_MODE_ARRAY_OF_NAMES
+ *
+ * @see json_attr_array_afrom_pair_list
+ */
+static fr_slen_t json_attr_array_to_sbuff(fr_sbuff_t *out, fr_pair_list_t *vps, fr_json_format_t const *format)
+{
+	fr_sbuff_t	our_out = FR_SBUFF(out);
+	fr_pair_t	*vp;
+	bool		first = true;
+
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, '[');
+	for (vp = fr_pair_list_head(vps);
+	     vp;
+	     vp = fr_pair_list_next(vps, vp)) {
+		if (vp->vp_raw) continue;
+
+		if (!first) FR_SBUFF_IN_CHAR_RETURN(&our_out, ',');
+		first = false;
+
+		FR_SBUFF_RETURN(json_pair_name_to_sbuff, &our_out, vp->da, format);
+
+		switch (vp->vp_type) {
+		case FR_TYPE_LEAF:
+			break;
+
+		case FR_TYPE_STRUCTURAL:
+			FR_SBUFF_IN_CHAR_RETURN(&our_out, ',');
+			FR_SBUFF_RETURN(json_attr_array_to_sbuff, &our_out, &vp->vp_group, format);
+			break;
+
+		default:
+			fr_assert(0);
+			fr_strerror_printf("Invalid type %s for attribute %s", fr_type_to_str(vp->vp_type), vp->da->name);
+			return -1;
+		}
+	}
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, ']');
+
+	FR_SBUFF_SET_RETURN(out, &our_out);
+}
+
+/** Write a JSON document representing a list of value pairs
+ *
+ * Produces the same output as serialising the result of
+ * #fr_json_object_afrom_pair_list with JSON_C_TO_STRING_PLAIN,
+ * but writes it directly into the sbuff, without building a tree
+ * of json_objects.
+ *
+ * @param[out] out	Where to write the document.
+ * @param[in] vps	a list of value pairs.
+ * @param[in] format	Formatting control, can be NULL to use default format.
+ * @return
+ *	- >= 0 the number of bytes written.
+ *	- < 0 on error, or if out was too small.
+ */
+fr_slen_t fr_json_str_from_pair_list(fr_sbuff_t *out, fr_pair_list_t *vps, fr_json_format_t const *format)
+{
+	if (!format) format = &default_json_format;
+
+	switch (format->output_mode) {
+	case JSON_MODE_OBJECT:
+		return json_object_to_sbuff(out, vps, format);
+
+	case JSON_MODE_OBJECT_SIMPLE:
+		return json_smplobj_to_sbuff(out, vps, format);
+
+	case JSON_MODE_ARRAY:
+		return json_array_to_sbuff(out, vps, format);
+
+	case JSON_MODE_ARRAY_OF_VALUES:
+		return json_value_array_to_sbuff(out, vps, format);
+
+	case JSON_MODE_ARRAY_OF_NAMES:
+		return json_attr_array_to_sbuff(out, vps, format);
+
+	default:
+		fr_assert(0);
+		fr_strerror_const("Invalid JSON output mode");
+		return -1;
+	}
+}
+
 /** Returns a JSON string of a list of value pairs
  *
  * The result is a talloc-ed string, freeing the string is
  * the responsibility of the caller.
  *
+ * The document is written directly into the string by
+ * fr_json_str_from_pair_list(), without building a tree of
+ * json_objects.
+ *
  * The 'format' struct contains settings to configure the output
  * JSON document format.
  * @see fr_json_format_s
@@ -1232,49 +1888,24 @@ static struct json_object *json_attr_array_afrom_pair_list(TALLOC_CTX *ctx, fr_p
  * @param[in] ctx	Talloc context.
  * @param[in] vps	a list of value pairs.
  * @param[in] format	Formatting control, can be NULL to use default format.
- * @return JSON string representation of the value pairs
+ * @return
+ *	- JSON string representation of the value pairs.
+ *	- NULL on error.
  */
 char *fr_json_afrom_pair_list(TALLOC_CTX *ctx, fr_pair_list_t *vps,
 			      fr_json_format_t const *format)
 {
-	struct json_object	*obj = NULL;
-	const char		*p;
-	char			*out;
+	fr_sbuff_t		sbuff;
+	fr_sbuff_uctx_talloc_t	tctx;
 
-	if (!format) format = &default_json_format;
+	if (!fr_sbuff_init_talloc(ctx, &sbuff, &tctx, 1024, SIZE_MAX)) return NULL;
 
-	switch (format->output_mode) {
-	case JSON_MODE_OBJECT:
-		MEM(obj = json_object_afrom_pair_list(ctx, vps, format));
-		break;
-	case JSON_MODE_OBJECT_SIMPLE:
-		MEM(obj = json_smplobj_afrom_pair_list(ctx, vps, format));
-		break;
-	case JSON_MODE_ARRAY:
-		MEM(obj = json_array_afrom_pair_list(ctx, vps, format));
-		break;
-	case JSON_MODE_ARRAY_OF_VALUES:
-		MEM(obj = json_value_array_afrom_pair_list(ctx, vps, format));
-		break;
-	case JSON_MODE_ARRAY_OF_NAMES:
-		MEM(obj = json_attr_array_afrom_pair_list(ctx, vps, format));
-		break;
-	default:
-		/* This should never happen */
-		fr_assert(0);
+	if (fr_json_str_from_pair_list(&sbuff, vps, format) < 0) {
+		TALLOC_FREE(sbuff.buff);
+		return NULL;
 	}
 
-	/*
-	 *	p is a buff inside obj, and will be freed
-	 *	when it is freed.
-	 */
-	MEM(p = json_object_to_json_string_ext(obj, JSON_C_TO_STRING_PLAIN));
-	MEM(out = talloc_typed_strdup(ctx, p));
-
-	/*
-	 * Free the JSON structure, it's not needed any more
-	 */
-	json_object_put_assert(obj);
+	fr_sbuff_trim_talloc(&sbuff, SIZE_MAX);
 
-	return out;
+	return sbuff.buff;
 }
@@ -0,0 +1,315 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Performance tests for encoding lists of pairs as JSON
+ *
+ * Compares the streaming encoder with serialising a tree of
+ * json_objects, and checks that they produce identical output.
+ *
+ * @file src/lib/json/json_perf_test.c
+ *
+ * @copyright 2025 The FreeRADIUS server project
+ */
+
+/*
+ *	Initialise from a constructor, so that the pair list is only
+ *	built once, rather than for every test.
+ */
+static void json_perf_init(void) __attribute__((constructor));
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/dict_test.h>
+#include <freeradius-devel/util/time.h>
+
+#include "base.h"
+
+#define ENCODE_REPS	20000
+
+/*
+ *	Count allocations by interposing the allocator.  The
+ *	sanitizers provide their own, so don't count with them.
+ */
+#if !defined(__has_feature)
+#  define __has_feature(_x) 0
+#endif
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__) && !__has_feature(address_sanitizer) && \
+    !defined(__SANITIZE_THREAD__) && !__has_feature(thread_sanitizer)
+#  define HAVE_ALLOC_COUNT
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static bool	alloc_count_enabled;
+static uint64_t	alloc_count;
+
+void *malloc(size_t size)
+{
+	if (alloc_count_enabled) alloc_count++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	if (alloc_count_enabled) alloc_count++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	if (alloc_count_enabled) alloc_count++;
+	return __libc_realloc(ptr, size);
+}
+
+#  define ALLOC_COUNT_START	do { alloc_count = 0; alloc_count_enabled = true; } while (0)
+#  define ALLOC_COUNT_STOP	do { alloc_count_enabled = false; } while (0)
+#else
+#  define ALLOC_COUNT_START
+#  define ALLOC_COUNT_STOP
+#endif
+
+/*
+ *	Roughly what's sent to a REST API for an Accounting-Request.
+ *	Includes repeated attributes, nested attributes, an enumerated
+ *	value, and a string which needs escaping.
+ */
+static char const	*test_pairs = \
+	"Test-String-0 = \"bob@example.com\","
+	"Test-String-0 += \"Acct-Session-Id=\\\"5f3a2c\\\"/00\\r\\n\\t\","
+	"Test-String-0 += \"Class-0001\","
+	"Test-Octets-0 = 0x00010203ff7f5c2f22,"
+	"Test-IPv4-Addr-0 = 192.0.2.1,"
+	"Test-IPv6-Prefix-0 = 2001:db8::/64,"
+	"Test-Ethernet-0 = 00:11:22:33:44:55,"
+	"Test-Uint8-0 = 5,"
+	"Test-Uint16-0 = 1813,"
+	"Test-Uint32-0 = 4294967295,"
+	"Test-Uint32-0 += 31337,"
+	"Test-Uint64-0 = 18446744073709551615,"
+	"Test-Uint64-0 += 123456789012,"
+	"Test-Int8-0 = -8,"
+	"Test-Int16-0 = -1600,"
+	"Test-Int32-0 = -32000,"
+	"Test-Int64-0 = -64000000000,"
+	"Test-Float64-0 = 1.5,"
+	"Test-Date-0 = \"Jan  1 2020 00:00:00 UTC\","
+	"Test-Enum-0 = test123,"
+	"Test-Enum-0 += 42,"
+	"Test-TLV-0.String = \"nested\","
+	"Test-Struct-0.uint32 = 1234,"
+	"Test-Nested-Top-TLV-0.Child-TLV.Leaf-String = \"leaf\","
+	"Test-Nested-Top-TLV-0.Child-TLV.Leaf-Int32 = 32";
+
+static fr_dict_t	*test_dict;
+static TALLOC_CTX	*autofree;
+static fr_pair_list_t	test_vps;
+
+void json_perf_init(void)
+{
+	fr_pair_parse_t	root, relative;
+
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("json_perf_test");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) goto error;
+
+	if (fr_dict_test_init(autofree, &test_dict, NULL) < 0) goto error;
+
+	fr_pair_list_init(&test_vps);
+
+	root = (fr_pair_parse_t) {
+		.ctx = autofree,
+		.da = fr_dict_root(test_dict),
+		.list = &test_vps,
+	};
+	relative = (fr_pair_parse_t) { };
+
+	if (fr_pair_list_afrom_substr(&root, &relative,
+				      &FR_SBUFF_IN(test_pairs, strlen(test_pairs))) <= 0) goto error;
+
+	fr_time_start();
+}
+
+/** Serialise a tree of json_objects, as fr_json_afrom_pair_list() used to
+ *
+ */
+static char *json_tree_afrom_pair_list(TALLOC_CTX *ctx, fr_pair_list_t *vps, fr_json_format_t const *format)
+{
+	json_object	*obj;
+	char		*out;
+
+	obj = fr_json_object_afrom_pair_list(ctx, vps, format);
+	if (!obj) return NULL;
+
+	out = talloc_typed_strdup(ctx, json_object_to_json_string_ext(obj, JSON_C_TO_STRING_PLAIN));
+	json_object_put(obj);
+
+	return out;
+}
+
+/** Encode the test pairs with both encoders, and compare the output and cost
+ *
+ */
+static void do_test_encode(fr_json_format_t const *format)
+{
+	char		*tree, *stream;
+	fr_time_t	start;
+	fr_time_delta_t	tree_time, stream_time;
+	uint64_t	tree_allocs = 0, stream_allocs = 0;
+	unsigned int	i;
+
+	tree = json_tree_afrom_pair_list(autofree, &test_vps, format);
+	TEST_ASSERT(tree != NULL);
+
+	stream = fr_json_afrom_pair_list(autofree, &test_vps, format);
+	TEST_ASSERT(stream != NULL);
+
+	TEST_CHECK(strcmp(tree, stream) == 0);
+	TEST_MSG("Expected %s", tree);
+	TEST_MSG("Got      %s", stream);
+
+	talloc_free(stream);
+	talloc_free(tree);
+
+	ALLOC_COUNT_START;
+	talloc_free(json_tree_afrom_pair_list(autofree, &test_vps, format));
+	ALLOC_COUNT_STOP;
+#ifdef HAVE_ALLOC_COUNT
+	tree_allocs = alloc_count;
+#endif
+
+	ALLOC_COUNT_START;
+	talloc_free(fr_json_afrom_pair_list(autofree, &test_vps, format));
+	ALLOC_COUNT_STOP;
+#ifdef HAVE_ALLOC_COUNT
+	stream_allocs = alloc_count;
+#endif
+
+	start = fr_time();
+	for (i = 0; i < ENCODE_REPS; i++) talloc_free(json_tree_afrom_pair_list(autofree, &test_vps, format));
+	tree_time = fr_time_sub(fr_time(), start);
+
+	start = fr_time();
+	for (i = 0; i < ENCODE_REPS; i++) talloc_free(fr_json_afrom_pair_list(autofree, &test_vps, format));
+	stream_time = fr_time_sub(fr_time(), start);
+
+	TEST_MSG_ALWAYS("pairs=%zu", fr_pair_list_num_elements(&test_vps));
+#ifdef HAVE_ALLOC_COUNT
+	TEST_MSG_ALWAYS("tree_allocs=%" PRIu64, tree_allocs);
+	TEST_MSG_ALWAYS("stream_allocs=%" PRIu64, stream_allocs);
+#endif
+	TEST_MSG_ALWAYS("tree_per_sec=%0.0lf", ENCODE_REPS / (fr_time_delta_unwrap(tree_time) / (double)NSEC));
+	TEST_MSG_ALWAYS("stream_per_sec=%0.0lf", ENCODE_REPS / (fr_time_delta_unwrap(stream_time) / (double)NSEC));
+}
+
+static void test_encode_object(void)
+{
+	do_test_encode(&(fr_json_format_t){
+		.output_mode = JSON_MODE_OBJECT,
+		.value = { .value_is_always_array = true }
+	});
+	do_test_encode(&(fr_json_format_t){
+		.output_mode = JSON_MODE_OBJECT,
+		.attr = { .prefix = "pre\"fix" },
+		.value = { .enum_as_int = true }
+	});
+}
+
+static void test_encode_object_simple(void)
+{
+	do_test_encode(&(fr_json_format_t){
+		.output_mode = JSON_MODE_OBJECT_SIMPLE
+	});
+	do_test_encode(&(fr_json_format_t){
+		.output_mode = JSON_MODE_OBJECT_SIMPLE,
+		.value = { .value_is_always_array = true, .always_string = true }
+	});
+}
+
+static void test_encode_array(void)
+{
+	do_test_encode(&(fr_json_format_t){
+		.output_mode = JSON_MODE_ARRAY
+	});
+	do_test_encode(&(fr_json_format_t){
+		.output_mode = JSON_MODE_ARRAY,
+		.attr = { .prefix = "acct" },
+		.value = { .value_is_always_array = true, .enum_as_int = true }
+	});
+}
+
+static void test_encode_array_of_values(void)
+{
+	do_test_encode(&(fr_json_format_t){
+		.output_mode = JSON_MODE_ARRAY_OF_VALUES
+	});
+	do_test_encode(&(fr_json_format_t){
+		.output_mode = JSON_MODE_ARRAY_OF_VALUES,
+		.value = { .always_string = true, .enum_as_int = true }
+	});
+}
+
+static void test_encode_array_of_names(void)
+{
+	do_test_encode(&(fr_json_format_t){
+		.output_mode = JSON_MODE_ARRAY_OF_NAMES
+	});
+	do_test_encode(&(fr_json_format_t){
+		.output_mode = JSON_MODE_ARRAY_OF_NAMES,
+		.attr = { .prefix = "acct/" }
+	});
+}
+
+/*
+ *	Empty lists produce empty containers.
+ */
+static void test_encode_empty(void)
+{
+	fr_pair_list_t		empty;
+	fr_json_format_t	format = {};
+	char			*out;
+
+	fr_pair_list_init(&empty);
+
+	format.output_mode = JSON_MODE_OBJECT;
+	out = fr_json_afrom_pair_list(autofree, &empty, &format);
+	TEST_CHECK(out && (strcmp(out, "{}") == 0));
+	talloc_free(out);
+
+	format.output_mode = JSON_MODE_ARRAY;
+	out = fr_json_afrom_pair_list(autofree, &empty, &format);
+	TEST_CHECK(out && (strcmp(out, "[]") == 0));
+	talloc_free(out);
+}
+
+TEST_LIST = {
+	{ "encode_object",		test_encode_object },
+	{ "encode_object_simple",	test_encode_object_simple },
+	{ "encode_array",		test_encode_array },
+	{ "encode_array_of_values",	test_encode_array_of_values },
+	{ "encode_array_of_names",	test_encode_array_of_names },
+	{ "encode_empty",		test_encode_empty },
+
+	{ NULL }
+};
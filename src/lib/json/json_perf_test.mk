@@ -0,0 +1,8 @@
+TARGET		:= json_perf_test$(E)
+SOURCES		:= json_perf_test.c
+
+SRC_CFLAGS	:= $(libfreeradius_json_CFLAGS)
+TGT_LDLIBS	:= $(LIBS) $(libfreeradius_json_LDLIBS)
+TGT_PREREQS	:= libfreeradius-json$(L) libfreeradius-util$(L)
+
+TGT_INSTALLDIR	:=
@@ -63,12 +63,45 @@ static int _kafka_conf_free(fr_kafka_conf_t *kc)
 	return 0;
 }
 
+/** Find the section a kafka configuration handle should be associated with
+ *
+ * Items in the "metadata", "tls", "sasl" etc... subsections all modify the
+ * same rd_kafka_conf_t, so we walk up past them to the section containing
+ * BASE_CONFIG.
+ *
+ * @param[in] cs	containing the item being parsed.
+ * @return the section to store the configuration handle in.
+ */
+static inline CC_HINT(always_inline)
+CONF_SECTION *kafka_conf_root(CONF_SECTION *cs)
+{
+	static char const *base_sections[] = { "connection", "group", "kerberos", "metadata",
+					       "oauth", "sasl", "tls", "version" };
+
+	for (;;) {
+		CONF_SECTION	*parent = cf_item_to_section(cf_parent(cs));
+		char const	*name1 = cf_section_name1(cs);
+		size_t		i;
+
+		if (!parent) return cs;
+
+		for (i = 0; i < NUM_ELEMENTS(base_sections); i++) {
+			if (strcmp(name1, base_sections[i]) == 0) break;
+		}
+		if (i == NUM_ELEMENTS(base_sections)) return cs;
+
+		cs = parent;
+	}
+}
+
 static inline CC_HINT(always_inline)
 fr_kafka_conf_t *kafka_conf_from_cs(CONF_SECTION *cs)
 {
 	CONF_DATA const	*cd;
 	fr_kafka_conf_t	*kc;
 
+	cs = kafka_conf_root(cs);
+
 	cd = cf_data_find(cs, fr_kafka_conf_t, "conf");
 	if (cd) {
 		kc = cf_data_value(cd);
@@ -112,6 +145,43 @@ fr_kafka_topic_conf_t *kafka_topic_conf_from_cs(CONF_SECTION *cs)
 	return ktc;
 }
 
+/** Return a copy of the kafka configuration handle built for a section
+ *
+ * @param[in] cs	the section kafka_base_producer_config or
+ *			kafka_base_consumer_config was parsed from.
+ * @return
+ *	- A new rd_kafka_conf_t, which the caller must free, or pass to rd_kafka_new().
+ *	- NULL on error.
+ */
+rd_kafka_conf_t *kafka_conf_dup(CONF_SECTION *cs)
+{
+	CONF_DATA const	*cd;
+
+	cd = cf_data_find(cs, fr_kafka_conf_t, "conf");
+	if (!cd) return rd_kafka_conf_new();
+
+	return rd_kafka_conf_dup(((fr_kafka_conf_t const *)cf_data_value(cd))->conf);
+}
+
+/** Return a copy of the kafka topic configuration handle built for a topic section
+ *
+ * @param[in] cs	a "topic { <name> { ... } }" section, may be NULL.
+ * @return
+ *	- A new rd_kafka_topic_conf_t, which the caller must free, or pass to rd_kafka_topic_new().
+ *	- NULL on error.
+ */
+rd_kafka_topic_conf_t *kafka_topic_conf_dup(CONF_SECTION *cs)
+{
+	CONF_DATA const	*cd;
+
+	if (!cs) return rd_kafka_topic_conf_new();
+
+	cd = cf_data_find(cs, fr_kafka_topic_conf_t, "conf");
+	if (!cd) return rd_kafka_topic_conf_new();
+
+	return rd_kafka_topic_conf_dup(((fr_kafka_topic_conf_t const *)cf_data_value(cd))->conf);
+}
+
 /** Perform any conversions necessary to map kafka defaults to our values
  *
  * @param[out] out	Where to write the pair.
@@ -1084,7 +1154,7 @@ static conf_parser_t const kafka_base_producer_topic_config[] = {
  *
  */
 static conf_parser_t const kafka_base_producer_topics_config[] = {
-	{ FR_CONF_SUBSECTION_GLOBAL(CF_IDENT_ANY, 0, kafka_base_producer_topic_config) },
+	{ FR_CONF_SUBSECTION_GLOBAL(CF_IDENT_ANY, CONF_FLAG_MULTI, kafka_base_producer_topic_config) },
 
 	CONF_PARSER_TERMINATOR
 };
@@ -1177,7 +1247,14 @@ conf_parser_t const kafka_base_producer_config[] = {
 	{ FR_CONF_FUNC("sticky_partition_delay", FR_TYPE_TIME_DELTA, 0, kafka_config_parse, kafka_config_dflt),
 	  .uctx = &(fr_kafka_conf_ctx_t){ .property = "sticky.partitioning.linger.ms" }},
 
-	{ FR_CONF_SUBSECTION_GLOBAL("topic", CONF_FLAG_MULTI, kafka_base_producer_topics_config) }, \
+	/*
+	 *	Run against librdkafka's built in mock cluster with this
+	 *	many brokers.  Only used by the test suite.
+	 */
+	{ FR_CONF_FUNC("mock_num_brokers", FR_TYPE_UINT32, CONF_FLAG_HIDDEN, kafka_config_parse, NULL),
+	  .uctx = &(fr_kafka_conf_ctx_t){ .property = "test.mock.num.brokers" }},
+
+	{ FR_CONF_SUBSECTION_GLOBAL("topic", 0, kafka_base_producer_topics_config) }, \
 
 	CONF_PARSER_TERMINATOR
 };
@@ -54,15 +54,60 @@ static void _redis_disconnected(redisAsyncContext const *ac, UNUSED int status)
 	connection_signal_reconnect(conn, CONNECTION_FAILED);
 }
 
+/** Check the result of a command sent to prepare a new connection
+ *
+ * Failures are fatal for the connection, as all subsequent commands
+ * would fail too.
+ */
+static void _redis_setup_reply(redisAsyncContext *ac, void *vreply, void *privdata)
+{
+	connection_t		*conn = talloc_get_type_abort(ac->data, connection_t);
+	redisReply		*reply = vreply;
+	char const		*cmd = privdata;
+
+	if (reply && (reply->type != REDIS_REPLY_ERROR)) goto done;
+
+	ERROR("%s failed: %s", cmd, reply ? reply->str : ac->errstr);
+	connection_signal_reconnect(conn, CONNECTION_FAILED);
+
+done:
+#ifdef REDIS_NO_AUTO_FREE_REPLIES
+	fr_redis_reply_free(&reply);
+#endif
+	return;
+}
+
 /** Called by hiredis to indicate the connection is live
  *
+ * If a password or database was configured, the AUTH and SELECT commands
+ * are sent immediately.  Replies arrive in order, so these will have been
+ * processed before the reply to any command from the trunk.
  */
-static void _redis_connected(redisAsyncContext const *ac, UNUSED int status)
+static void _redis_connected(redisAsyncContext const *ac, int status)
 {
 	connection_t		*conn = talloc_get_type_abort(ac->data, connection_t);
+	fr_redis_handle_t	*h = conn->h;
+
+	if (status != REDIS_OK) {
+		DEBUG4("Signalled by hiredis, connection failed: %s", ac->errstr);
+		connection_signal_reconnect(conn, CONNECTION_FAILED);
+		return;
+	}
 
 	DEBUG4("Signalled by hiredis, connection is open");
 
+	if (h->conf->password &&
+	    (redisAsyncCommand(h->ac, _redis_setup_reply, UNCONST(char *, "AUTH"), "AUTH %s", h->conf->password) != REDIS_OK)) {
+	error:
+		ERROR("Failed preparing connection: %s", h->ac->errstr);
+		connection_signal_reconnect(conn, CONNECTION_FAILED);
+		return;
+	}
+
+	if (h->conf->database &&
+	    (redisAsyncCommand(h->ac, _redis_setup_reply, UNCONST(char *, "SELECT"),
+	    		       "SELECT %u", h->conf->database) != REDIS_OK)) goto error;
+
 	connection_signal_connected(conn);
 }
 
@@ -318,12 +363,22 @@ static connection_state_t _redis_io_connection_init(void **h_out, connection_t *
 	MEM(h = talloc_zero(conn, fr_redis_handle_t));
 	talloc_set_destructor(h, _redis_handle_free);
 
+	h->conf = conf;
 	h->ac = redisAsyncConnect(host, port);
 	if (!h->ac) {
 		ERROR("Failed allocating handle for %s:%u", host, port);
 		return CONNECTION_STATE_FAILED;
 	}
 
+#ifdef REDIS_NO_AUTO_FREE_REPLIES
+	/*
+	 *	Replies are stored with the commands in a command
+	 *	set, which may not complete until many callbacks
+	 *	later, so we need them to outlive the callback.
+	 */
+	h->ac->c.flags |= REDIS_NO_AUTO_FREE_REPLIES;
+#endif
+
 	if (h->ac->err) {
 		ERROR("Failed allocating handle for %s:%u: %s", host, port, h->ac->errstr);
 	error:
@@ -72,6 +72,7 @@ struct fr_redis_command_s {
 
 	char const			*str;		//!< The command string.
 	size_t				len;		//!< Length of the command string.
+	bool				formatted;	//!< str is already in the Redis wire format.
 
 	uint64_t			sqn;		//!< The sequence number of the command.  This is only
 							///< valid for a specific handle, and is unique within
@@ -262,39 +263,61 @@ fr_redis_command_set_t *fr_redis_command_set_alloc(TALLOC_CTX *ctx,
  */
 static int _redis_command_free(fr_redis_command_t *cmd)
 {
-	//if (cmd->result) fr_redis_reply_free(&cmd->result);
+	/*
+	 *	hiredis only leaves us the reply if
+	 *	automatic freeing has been disabled,
+	 *	see _redis_io_connection_init.
+	 */
+#ifdef REDIS_NO_AUTO_FREE_REPLIES
+	if (cmd->result) fr_redis_reply_free(&cmd->result);
+#endif
 
 	return 0;
 }
 
+/** Return the result of a command
+ *
+ * The result remains owned by the command, and is freed with it.
+ *
+ * @param[in] cmd	to retrieve the result for.
+ * @return The reply from the Redis server, or NULL if we didn't get one.
+ */
 redisReply *fr_redis_command_get_result(fr_redis_command_t *cmd)
 {
 	return cmd->result;
 }
 
-/** Add a preformatted/expanded command to the command set
+/** Take ownership of the result of a command
  *
- * The command must either be entirely static, or parented by the command set.
+ * The caller must free the result with #fr_redis_reply_free.
  *
- * @note Caller should disallow "SUBSCRIBE" et al, if they're not appropriate.
- * 	 As subscribing to a stream where we're not expecting it would break
- * 	 things, badly.
+ * @param[in] cmd	to steal the result from.
+ * @return The reply from the Redis server, or NULL if we didn't get one.
+ */
+redisReply *fr_redis_command_steal_result(fr_redis_command_t *cmd)
+{
+	redisReply *reply = cmd->result;
+
+	cmd->result = NULL;
+
+	return reply;
+}
+
+/** Check a command keeps the transaction blocks in a command set balanced
  *
- * @param[in] cmds	Command set to add command to.
- * @param[in] cmd_str	A fully expanded/formatted command to send to redis.
- *			Must be static, or have the same lifetime as the
- *			command set (allocated with the command set as the parent).
- * @param[in] cmd_len	Length of the command.
+ * @param[out] type	of the command.
+ * @param[in] cmds	Command set the command is being added to.
+ * @param[in] cmd_str	Command name, or the whole command.
  * @return
- *	- FR_REDIS_PIPELINE_BAD_CMDS if a bad command sequence is enqueued.
- *	- FR_REDIS_PIPELINE_OK if command was enqueued successfully.
+ *	- FR_REDIS_PIPELINE_BAD_CMDS if the command would result in a bad command sequence.
+ *	- FR_REDIS_PIPELINE_OK if the command can be added.
  */
-fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_set_t *cmds,
-							     char const *cmd_str, size_t cmd_len)
+static fr_redis_pipeline_status_t redis_command_type(fr_redis_command_type_t *type,
+						     fr_redis_command_set_t *cmds, char const *cmd_str)
 {
 	request_t			*request = cmds->request;
-	fr_redis_command_t	*cmd;
-	fr_redis_command_type_t	type = FR_REDIS_COMMAND_NORMAL;
+
+	*type = FR_REDIS_COMMAND_NORMAL;
 
 	/*
 	 *	Transaction sanity checks.
@@ -323,7 +346,7 @@ fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_se
 		 *	that's marked as the start of the transaction
 		 *	block.
 		 */
-		type = cmds->txn_watch ? FR_REDIS_COMMAND_TRANSACTION_START : FR_REDIS_COMMAND_NORMAL;
+		*type = cmds->txn_watch ? FR_REDIS_COMMAND_TRANSACTION_START : FR_REDIS_COMMAND_NORMAL;
 		cmds->txn_start++;	/* Yes MULTI increments start, not WATCH */
 		break;
 
@@ -345,7 +368,7 @@ fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_se
 			ROPTIONAL(ERROR, REDEBUG, "Transaction not started, missing \"MULTI\" command");
 			return FR_REDIS_PIPELINE_BAD_CMDS;
 		}
-		type = FR_REDIS_COMMAND_TRANSACTION_END;
+		*type = FR_REDIS_COMMAND_TRANSACTION_END;
 		cmds->txn_end++;
 		break;
 
@@ -366,13 +389,87 @@ fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_se
 		break;
 	}
 
+	return FR_REDIS_PIPELINE_OK;
+}
+
+/** Add a command to the command set
+ *
+ */
+static void redis_command_add(fr_redis_command_set_t *cmds, fr_redis_command_type_t type,
+			      char const *cmd_str, size_t cmd_len, bool formatted)
+{
+	fr_redis_command_t	*cmd;
+
 	MEM(cmd = talloc_zero(cmds, fr_redis_command_t));
 	talloc_set_destructor(cmd, _redis_command_free);
 	cmd->cmds = cmds;
 	cmd->type = type;
 	cmd->str = cmd_str;
 	cmd->len = cmd_len;
+	cmd->formatted = formatted;
 	fr_dlist_insert_tail(&cmds->pending, cmd);
+}
+
+/** Add a preformatted/expanded command to the command set
+ *
+ * The command must either be entirely static, or parented by the command set.
+ *
+ * @note Caller should disallow "SUBSCRIBE" et al, if they're not appropriate.
+ * 	 As subscribing to a stream where we're not expecting it would break
+ * 	 things, badly.
+ *
+ * @param[in] cmds	Command set to add command to.
+ * @param[in] cmd_str	A fully expanded/formatted command to send to redis.
+ *			Must be static, or have the same lifetime as the
+ *			command set (allocated with the command set as the parent).
+ * @param[in] cmd_len	Length of the command.
+ * @return
+ *	- FR_REDIS_PIPELINE_BAD_CMDS if a bad command sequence is enqueued.
+ *	- FR_REDIS_PIPELINE_OK if command was enqueued successfully.
+ */
+fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_set_t *cmds,
+							     char const *cmd_str, size_t cmd_len)
+{
+	fr_redis_command_type_t		type;
+
+	if (redis_command_type(&type, cmds, cmd_str) != FR_REDIS_PIPELINE_OK) return FR_REDIS_PIPELINE_BAD_CMDS;
+
+	redis_command_add(cmds, type, cmd_str, cmd_len, false);
+
+	return FR_REDIS_PIPELINE_OK;
+}
+
+/** Add a command built from an argument vector to the command set
+ *
+ * Arguments may contain any binary data, and are copied, so don't need to
+ * outlive the call.
+ *
+ * @param[in] cmds	Command set to add command to.
+ * @param[in] argc	Number of arguments, including the command name.
+ * @param[in] argv	Command name, followed by its arguments.  The command name
+ *			must be \0 terminated.
+ * @param[in] argvlen	Length of each argument.
+ * @return
+ *	- FR_REDIS_PIPELINE_BAD_CMDS if a bad command sequence is enqueued.
+ *	- FR_REDIS_PIPELINE_FAIL if the command couldn't be formatted.
+ *	- FR_REDIS_PIPELINE_OK if command was enqueued successfully.
+ */
+fr_redis_pipeline_status_t fr_redis_command_argv_add(fr_redis_command_set_t *cmds,
+						     int argc, char const **argv, size_t const *argvlen)
+{
+	fr_redis_command_type_t		type;
+	char				*formatted, *cmd_str;
+	int				len;
+
+	if (redis_command_type(&type, cmds, argv[0]) != FR_REDIS_PIPELINE_OK) return FR_REDIS_PIPELINE_BAD_CMDS;
+
+	len = redisFormatCommandArgv(&formatted, argc, argv, argvlen);
+	if (len < 0) return FR_REDIS_PIPELINE_FAIL;
+
+	MEM(cmd_str = talloc_memdup(cmds, formatted, len));
+	redisFreeCommand(formatted);
+
+	redis_command_add(cmds, type, cmd_str, len, true);
 
 	return FR_REDIS_PIPELINE_OK;
 }
@@ -436,7 +533,9 @@ static void _redis_pipeline_demux(struct redisAsyncContext *ac, void *vreply, vo
 	 */
 	if (!fr_redis_connection_process_response(h)) {
 		DEBUG4("Ignoring response with SQN %"PRIu64, (h->rsp_sqn - 1));	/* Already incremented */
+#ifdef REDIS_NO_AUTO_FREE_REPLIES
 		fr_redis_reply_free((redisReply **)&reply);
+#endif
 		return;
 	}
 
@@ -473,44 +572,58 @@ static connection_t *_redis_pipeline_connection_alloc(trunk_connection_t *tconn,
 /** Enqueue one or more command sets onto a redis handle
  *
  * Because the trunk is in always writable mode, _redis_pipeline_mux
- * will be called any time trunk_request_enqueue is called, so there'll only
- * ever be one command to dequeue.
+ * will be called any time trunk_request_enqueue is called, so there'll
+ * usually only be one command set to dequeue.  Requests in the backlog
+ * are written out together when a connection becomes available.
  *
+ * @param[in] el		Event list the connection is bound to.  Unused.
  * @param[in] tconn		Trunk connection holding the commands to enqueue.
  * @param[in] conn		Connection handle containing the fr_redis_handle_t.
  * @param[in] uctx		fr_redis_cluster_t.  Unused.
  */
-static void _redis_pipeline_mux(trunk_connection_t *tconn, connection_t *conn, UNUSED void *uctx)
+static void _redis_pipeline_mux(UNUSED fr_event_list_t *el,
+				trunk_connection_t *tconn, connection_t *conn, UNUSED void *uctx)
 {
-	trunk_request_t	*treq;
+	trunk_request_t		*treq;
 	fr_redis_command_set_t 	*cmds;
 	fr_redis_command_t	*cmd;
 	fr_redis_handle_t	*h = talloc_get_type_abort(conn->h, fr_redis_handle_t);
-	request_t			*request;
-
-	treq = trunk_connection_pop_request(&request, (void *)&cmds, NULL, tconn);
-	while ((cmd = fr_dlist_head(&cmds->pending))) {
-		/*
-		 *	If this fails it probably means the connection
-		 *	is disconnecting, but if that's happening then
-		 *	we shouldn't be enqueueing new requests?
-		 */
-		if (unlikely(redisAsyncCommand(h->ac, _redis_pipeline_demux, cmd, "%s", cmd->str) != REDIS_OK)) {
-			ROPTIONAL(ERROR, REDEBUG, "Unexpected error queueing REDIS command");
+	request_t		*request;
+	int			ret;
+
+	while ((trunk_connection_pop_request(&treq, tconn) == 0) && treq) {
+		cmds = talloc_get_type_abort(treq->preq, fr_redis_command_set_t);
+		request = cmds->request;
+
+		while ((cmd = fr_dlist_head(&cmds->pending))) {
+			if (cmd->formatted) {
+				ret = redisAsyncFormattedCommand(h->ac, _redis_pipeline_demux, cmd, cmd->str, cmd->len);
+			} else {
+				ret = redisAsyncCommand(h->ac, _redis_pipeline_demux, cmd, "%s", cmd->str);
+			}
 
-			while ((cmd = fr_dlist_head(&cmds->sent))) {
-				fr_redis_connection_ignore_response(h, cmd->sqn);
-				fr_dlist_remove(&cmds->sent, cmd);
-				fr_dlist_insert_tail(&cmds->pending, cmd);
+			/*
+			 *	If this fails it probably means the connection
+			 *	is disconnecting, but if that's happening then
+			 *	we shouldn't be enqueueing new requests?
+			 */
+			if (unlikely(ret != REDIS_OK)) {
+				ROPTIONAL(ERROR, REDEBUG, "Unexpected error queueing REDIS command");
+
+				while ((cmd = fr_dlist_tail(&cmds->sent))) {
+					fr_redis_connection_ignore_response(h, cmd->sqn);
+					fr_dlist_remove(&cmds->sent, cmd);
+					fr_dlist_insert_head(&cmds->pending, cmd);
+				}
+				trunk_request_signal_fail(treq);
+				return;
 			}
-			trunk_request_signal_fail(treq);
-			return;
+			cmd->sqn = fr_redis_connection_sent_request(h);
+			fr_dlist_remove(&cmds->pending, cmd);
+			fr_dlist_insert_tail(&cmds->sent, cmd);
 		}
-		cmd->sqn = fr_redis_connection_sent_request(h);
-		fr_dlist_remove(&cmds->pending, cmd);
-		fr_dlist_insert_tail(&cmds->sent, cmd);
+		trunk_request_signal_sent(treq);
 	}
-	trunk_request_signal_sent(treq);
 }
 
 /** Deal with cancellation of sent requests
@@ -519,7 +632,7 @@ static void _redis_pipeline_mux(trunk_connection_t *tconn, connection_t *conn, U
  * on why the commands were cancelled, we either tell the handle to ignore
  * them, or move them back into the pending list.
  */
-static void _redis_pipeline_command_set_cancel(connection_t *conn, UNUSED trunk_request_t *treq, void *preq,
+static void _redis_pipeline_command_set_cancel(connection_t *conn, void *preq,
 					       trunk_cancel_reason_t reason, UNUSED void *uctx)
 {
 	fr_redis_command_set_t	*cmds = talloc_get_type_abort(preq, fr_redis_command_set_t);
@@ -541,6 +654,7 @@ static void _redis_pipeline_command_set_cancel(connection_t *conn, UNUSED trunk_
 	 *	execution by another handle.
 	 */
 	case TRUNK_CANCEL_REASON_MOVE:
+	case TRUNK_CANCEL_REASON_REQUEUE:
 		fr_dlist_move(&cmds->pending, &cmds->sent);
 		return;
 
@@ -563,6 +677,7 @@ static void _redis_pipeline_command_set_cancel(connection_t *conn, UNUSED trunk_
 		     cmd = fr_dlist_next(&cmds->sent, cmd)) {
 			fr_redis_connection_ignore_response(h, cmd->sqn);
 		}
+		return;
 	}
 
 	case TRUNK_CANCEL_REASON_NONE:
@@ -586,7 +701,7 @@ static void _redis_pipeline_command_set_complete(UNUSED request_t *request, void
  *
  */
 static void _redis_pipeline_command_set_fail(UNUSED request_t *request, void *preq,
-					     UNUSED void *rctx, UNUSED void *uctx)
+					     UNUSED void *rctx, UNUSED trunk_request_state_t state, UNUSED void *uctx)
 {
 	fr_redis_command_set_t	*cmds = talloc_get_type_abort(preq, fr_redis_command_set_t);
 
@@ -643,8 +758,14 @@ fr_redis_trunk_t *fr_redis_trunk_alloc(fr_redis_cluster_thread_t *cluster_thread
  * This structure represents all the connections for a given thread for a given cluster.
  * The structures holds the trunk connections to talk to each cluster member.
  *
+ * @param[in] ctx		to allocate the cluster thread in.
+ * @param[in] el		Event list to run connections in.
+ * @param[in] tconf		Trunk configuration, copied and marked as always writable.
+ * @param[in] log_prefix	to use for all trunk and connection messages.
+ * @return A new cluster thread.
  */
-fr_redis_cluster_thread_t *fr_redis_cluster_thread_alloc(TALLOC_CTX *ctx, fr_event_list_t *el, trunk_conf_t const *tconf)
+fr_redis_cluster_thread_t *fr_redis_cluster_thread_alloc(TALLOC_CTX *ctx, fr_event_list_t *el, trunk_conf_t const *tconf,
+							  char const *log_prefix)
 {
 	fr_redis_cluster_thread_t *cluster_thread;
 	trunk_conf_t *our_tconf;
@@ -655,6 +776,7 @@ fr_redis_cluster_thread_t *fr_redis_cluster_thread_alloc(TALLOC_CTX *ctx, fr_eve
 
 	cluster_thread->el = el;
 	cluster_thread->tconf = our_tconf;
+	MEM(cluster_thread->log_prefix = talloc_strdup(cluster_thread, log_prefix));
 
 	return cluster_thread;
 }
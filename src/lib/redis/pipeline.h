@@ -71,8 +71,13 @@ fr_redis_pipeline_status_t	fr_redis_command_preformatted_add(fr_redis_command_se
  */
 fr_redis_pipeline_status_t redis_command_set_enqueue(fr_redis_trunk_t *rtrunk, fr_redis_command_set_t *cmds);
 
+fr_redis_pipeline_status_t	fr_redis_command_argv_add(fr_redis_command_set_t *cmds,
+							  int argc, char const **argv, size_t const *argvlen);
+
 redisReply *fr_redis_command_get_result(fr_redis_command_t *cmd);
 
+redisReply *fr_redis_command_steal_result(fr_redis_command_t *cmd);
+
 fr_redis_command_set_t		*fr_redis_command_set_alloc(TALLOC_CTX *ctx,
 							    request_t *request,
 							    fr_redis_command_set_complete_t complete,
@@ -83,7 +88,7 @@ fr_redis_trunk_t		*fr_redis_trunk_alloc(fr_redis_cluster_thread_t *rtcluster,
 						      fr_redis_io_conf_t const *conf);
 
 fr_redis_cluster_thread_t	*fr_redis_cluster_thread_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
-							       trunk_conf_t const *tconf);
+							       trunk_conf_t const *tconf, char const *log_prefix);
 
 #ifdef __cplusplus
 }
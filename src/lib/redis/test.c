@@ -1,12 +1,12 @@
 /*
- *  cc  -g3 -Wall -DHAVE_DLFCN_H -I../../../src -include freeradius-devel/build.h -L../../../build/lib/local/.libs -ltalloc -lhiredis -lfreeradius-unlang -lfreeradius-util -lfreeradius-server -o test_redis test.c redis.c io.c crc16.c
+ *  cc  -g3 -Wall -DHAVE_DLFCN_H -I../../../src -include freeradius-devel/build.h -L../../../build/lib/local/.libs -ltalloc -lhiredis -lfreeradius-unlang -lfreeradius-util -lfreeradius-server -o test_redis test.c redis.c io.c pipeline.c crc16.c
  */
 #include <freeradius-devel/util/acutest.h>
 #include "base.h"
 #include "io.h"
 #include "pipeline.h"
 
-#define DEBUG_LVL_SET if (test_verbose_level_ >= 3) fr_debug_lvl = L_DBG_LVL_4 + 1
+#define DEBUG_LVL_SET if (acutest_verbose_level_ >= 3) fr_debug_lvl = L_DBG_LVL_4 + 1
 
 
 typedef struct {
@@ -67,7 +67,7 @@ static void test_basic_connection(void)
 		TEST_CHECK(fr_redis_command_preformatted_add(cmds, "PING", sizeof("PING") - 1) == FR_REDIS_PIPELINE_OK);
 	}
 
-	cluster_thread = fr_redis_cluster_thread_alloc(ctx, el, &trunk_conf);
+	cluster_thread = fr_redis_cluster_thread_alloc(ctx, el, &trunk_conf, "redis");
 	rtrunk = fr_redis_trunk_alloc(cluster_thread,  &(fr_redis_io_conf_t){ .hostname = "127.0.0.1", .port = 30001 });
 
 	stats.enqueued = 1000000;
@@ -81,10 +81,149 @@ static void test_basic_connection(void)
 	} while (events > 0);
 }
 
+/*
+ *	Stand-in for the ippool scripts.  It's the round trip
+ *	we're interested in, not what the script does.
+ */
+#define BENCH_SCRIPT	"return redis.call('INCR', KEYS[1])"
+#define BENCH_CMDS	10000
+
+typedef struct {
+	bool		done;
+	size_t		ok;
+} redis_bench_t;
+
+static void _bench_complete(UNUSED request_t *request, fr_dlist_head_t *completed, void *rctx)
+{
+	redis_bench_t		*bench = rctx;
+	fr_redis_command_t	*cmd;
+
+	for (cmd = fr_dlist_head(completed); cmd; cmd = fr_dlist_next(completed, cmd)) {
+		redisReply *reply = fr_redis_command_get_result(cmd);
+
+		if (reply && (reply->type == REDIS_REPLY_INTEGER)) bench->ok++;
+	}
+	bench->done = true;
+}
+
+static void _bench_failed(UNUSED request_t *request, UNUSED fr_dlist_head_t *completed, void *rctx)
+{
+	redis_bench_t		*bench = rctx;
+
+	bench->done = true;
+}
+
+/** Run a command set to completion
+ *
+ */
+static fr_time_delta_t bench_run(fr_event_list_t *el, fr_redis_trunk_t *rtrunk, fr_redis_command_set_t *cmds,
+				 redis_bench_t *bench)
+{
+	fr_time_t	start = fr_time();
+
+	TEST_CHECK(redis_command_set_enqueue(rtrunk, cmds) == FR_REDIS_PIPELINE_OK);
+	while (!bench->done) {
+		fr_event_corral(el, fr_time(), true);
+		fr_event_service(el);
+	}
+
+	return fr_time_sub(fr_time(), start);
+}
+
+/** Compare one script call per round trip with the same calls pipelined on the trunk
+ *
+ * This is what rlm_redis_ippool's "pipelining" option does for concurrent
+ * allocations.  Run against a local redis-server on port 30001.
+ */
+static void test_evalsha_bench(void)
+{
+	TALLOC_CTX			*ctx;
+	fr_event_list_t			*el;
+	redisContext			*sync;
+	redisReply			*reply;
+	fr_redis_command_set_t		*cmds;
+	fr_redis_cluster_thread_t	*cluster_thread;
+	fr_redis_trunk_t		*rtrunk;
+	connection_conf_t		conn_conf;
+	trunk_conf_t			trunk_conf;
+	redis_bench_t			bench;
+	char				sha[41];
+	char const			*argv[] = { "EVALSHA", sha, "1", "bench" };
+	size_t				argvlen[] = { sizeof("EVALSHA") - 1, sizeof(sha) - 1, 1, sizeof("bench") - 1 };
+	fr_time_t			start;
+	fr_time_delta_t			serial, pipelined;
+	size_t				i;
+
+	DEBUG_LVL_SET;
+
+	memset(&conn_conf, 0, sizeof(conn_conf));
+	memset(&trunk_conf, 0, sizeof(trunk_conf));
+	trunk_conf.conn_conf = &conn_conf;
+	trunk_conf.start = 1;
+	trunk_conf.min = 1;
+	trunk_conf.max = 1;
+
+	ctx = talloc_init("test_ctx");
+	el = fr_event_list_alloc(ctx, NULL, NULL);
+
+	sync = redisConnectWithTimeout("127.0.0.1", 30001, (struct timeval){ .tv_sec = 1 });
+	TEST_ASSERT(sync && !sync->err);
+
+	reply = redisCommand(sync, "SCRIPT LOAD %s", BENCH_SCRIPT);
+	TEST_ASSERT(reply && (reply->type == REDIS_REPLY_STRING) && (reply->len == sizeof(sha) - 1));
+	memcpy(sha, reply->str, sizeof(sha) - 1);
+	sha[sizeof(sha) - 1] = '\0';
+	freeReplyObject(reply);
+
+	/*
+	 *	One round trip per call
+	 */
+	start = fr_time();
+	for (i = 0; i < BENCH_CMDS; i++) {
+		reply = redisCommandArgv(sync, NUM_ELEMENTS(argv), argv, argvlen);
+		TEST_CHECK(reply && (reply->type == REDIS_REPLY_INTEGER));
+		freeReplyObject(reply);
+	}
+	serial = fr_time_sub(fr_time(), start);
+	redisFree(sync);
+
+	cluster_thread = fr_redis_cluster_thread_alloc(ctx, el, &trunk_conf, "redis");
+	rtrunk = fr_redis_trunk_alloc(cluster_thread, &(fr_redis_io_conf_t){ .hostname = "127.0.0.1", .port = 30001 });
+	TEST_ASSERT(rtrunk != NULL);
+
+	/*
+	 *	Wait for the connection to open, so that
+	 *	it's not included in the timing.
+	 */
+	bench = (redis_bench_t){};
+	cmds = fr_redis_command_set_alloc(ctx, NULL, _bench_complete, _bench_failed, &bench);
+	TEST_CHECK(fr_redis_command_argv_add(cmds, NUM_ELEMENTS(argv), argv, argvlen) == FR_REDIS_PIPELINE_OK);
+	bench_run(el, rtrunk, cmds, &bench);
+	TEST_CHECK(bench.ok == 1);
+
+	/*
+	 *	All calls pipelined on one connection
+	 */
+	bench = (redis_bench_t){};
+	cmds = fr_redis_command_set_alloc(ctx, NULL, _bench_complete, _bench_failed, &bench);
+	for (i = 0; i < BENCH_CMDS; i++) {
+		TEST_CHECK(fr_redis_command_argv_add(cmds, NUM_ELEMENTS(argv), argv, argvlen) == FR_REDIS_PIPELINE_OK);
+	}
+	pipelined = bench_run(el, rtrunk, cmds, &bench);
+	TEST_CHECK(bench.ok == BENCH_CMDS);
+
+	TEST_MSG_ALWAYS("\nserial=%u calls/s per connection\npipelined=%u calls/s per connection\n",
+			(unsigned int)(BENCH_CMDS / ((double)fr_time_delta_unwrap(serial) / NSEC)),
+			(unsigned int)(BENCH_CMDS / ((double)fr_time_delta_unwrap(pipelined) / NSEC)));
+
+	talloc_free(ctx);
+}
+
 TEST_LIST = {
 	/*
 	 *	Basic tests
 	 */
 	{ "Basic - Connection", test_basic_connection},
+	{ "Pipeline - EVALSHA throughput", test_evalsha_bench},
 	{ NULL }
 };
@@ -898,6 +898,20 @@ fr_client_t *client_afrom_cs(TALLOC_CTX *ctx, CONF_SECTION *cs, CONF_SECTION *se
 	}
 #endif
 
+	/*
+	 *	Precompute the HMAC-MD5 key pads, so that every
+	 *	packet with a Message-Authenticator doesn't need
+	 *	to hash them again.
+	 */
+	if (c->secret) {
+		c->secret_hmac = fr_hmac_md5_key_alloc(c, (uint8_t const *) c->secret,
+						       talloc_array_length(c->secret) - 1);
+		if (!c->secret_hmac) {
+			cf_log_perr(cs, "Failed precomputing HMAC key for shared secret");
+			goto error;
+		}
+	}
+
 	if ((c->proto == IPPROTO_TCP) || (c->proto == IPPROTO_IP)) {
 		if (fr_time_delta_ispos(c->limit.idle_timeout) && fr_time_delta_lt(c->limit.idle_timeout, fr_time_delta_from_sec(5)))
 			c->limit.idle_timeout = fr_time_delta_from_sec(5);
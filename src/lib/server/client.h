@@ -88,6 +88,8 @@ struct fr_client_s {
 	char const		*shortname;		//!< Client nickname.
 
 	char const		*secret;		//!< Secret PSK.
+	fr_hmac_md5_key_t	*secret_hmac;		//!< Precomputed HMAC-MD5 state for the secret, used
+							///< when signing and verifying Message-Authenticator.
 
 	/** Require RADIUS message authenticator for incoming packets
 	 */
@@ -53,9 +53,16 @@ RCSID("$Id$")
 #include <freeradius-devel/io/listen.h>
 
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/md5.h>
 #include <freeradius-devel/util/rand.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
 /** Holds a state value, and associated fr_pair_ts and data
  *
  */
@@ -140,19 +147,34 @@ typedef struct {
 	request_t		*thawed;			//!< The request that thawed this entry.
 } state_child_entry_t;
 
-struct fr_state_tree_s {
-	uint64_t		id;				//!< Next ID to assign.
+/** One shard of the state tree
+ *
+ * Entries are assigned to a shard by a hash of their state value, so
+ * that lookups, inserts and expiry for unrelated sessions don't
+ * contend for the same mutex.
+ */
+typedef struct {
+	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
+	fr_rb_tree_t		*tree;				//!< rbtree used to lookup state value.
+	fr_dlist_head_t		to_expire;			//!< Linked list of entries to free.
+
 	uint64_t		timed_out;			//!< Number of states that were cleaned up due to
 								//!< timeout.
+	uint64_t		acquired;			//!< Number of times the mutex was acquired.
+	uint64_t		contended;			//!< Number of times we had to wait for the mutex.
+} CC_HINT(aligned(64)) fr_state_shard_t;
+
+struct fr_state_tree_s {
+	atomic_uint_fast64_t	id;				//!< Next ID to assign.
 	uint32_t		max_sessions;			//!< Maximum number of sessions we track.
-	uint32_t		used_sessions;			//!< How many sessions are currently in progress.
-	fr_rb_tree_t		*tree;				//!< rbtree used to lookup state value.
-	fr_dlist_head_t		to_expire;			//!< Linked list of entries to free.
+	atomic_uint_fast32_t	used_sessions;			//!< How many sessions are currently in progress.
+
+	fr_state_shard_t	*shards;			//!< Array of shards.
+	uint32_t		num_shards;			//!< Number of shards, always a power of 2.
 
 	fr_time_delta_t		timeout;			//!< How long to wait before cleaning up state entries.
 
 	bool			thread_safe;			//!< Whether we lock the tree whilst modifying it.
-	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
 
 	uint8_t			server_id;			//!< ID to use for load balancing.
 	uint32_t		context_id;			//!< ID binding state values to a context such
@@ -161,10 +183,13 @@ struct fr_state_tree_s {
 	fr_dict_attr_t const	*da;				//!< State attribute used.
 };
 
-#define PTHREAD_MUTEX_LOCK if (state->thread_safe) pthread_mutex_lock
-#define PTHREAD_MUTEX_UNLOCK if (state->thread_safe) pthread_mutex_unlock
+/** Number of shards for thread safe state trees
+ *
+ * Must be a power of 2.
+ */
+#define STATE_TREE_SHARDS	(64)
 
-static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry);
+static void state_entry_unlink(fr_state_shard_t *shard, fr_state_entry_t *entry);
 
 /** Compare two fr_state_entry_t based on their state value i.e. the value of the attribute
  *
@@ -178,27 +203,68 @@ static int8_t state_entry_cmp(void const *one, void const *two)
 	return CMP(ret, 0);
 }
 
+/** Return the shard an entry belongs in
+ *
+ * State values are usually random, but may be set by modules, so we
+ * hash the whole value rather than just taking a few bytes.
+ */
+static inline CC_HINT(always_inline)
+fr_state_shard_t *state_shard(fr_state_tree_t *state, fr_state_entry_t const *entry)
+{
+	if (state->num_shards == 1) return &state->shards[0];
+
+	return &state->shards[fr_hash(entry->state, sizeof(entry->state)) & (state->num_shards - 1)];
+}
+
+/** Lock a shard, recording whether or not we had to wait
+ *
+ */
+static inline CC_HINT(always_inline)
+void state_shard_lock(fr_state_tree_t *state, fr_state_shard_t *shard)
+{
+	if (!state->thread_safe) return;
+
+	if (pthread_mutex_trylock(&shard->mutex) != 0) {
+		pthread_mutex_lock(&shard->mutex);
+		shard->contended++;
+	}
+	shard->acquired++;
+}
+
+static inline CC_HINT(always_inline)
+void state_shard_unlock(fr_state_tree_t *state, fr_state_shard_t *shard)
+{
+	if (!state->thread_safe) return;
+
+	pthread_mutex_unlock(&shard->mutex);
+}
+
 /** Free the state tree
  *
  */
 static int _state_tree_free(fr_state_tree_t *state)
 {
-	fr_state_entry_t *entry;
-
-	if (state->thread_safe) pthread_mutex_destroy(&state->mutex);
+	fr_state_entry_t	*entry;
+	uint32_t		i;
 
 	DEBUG4("Freeing state tree %p", state);
 
-	while ((entry = fr_dlist_head(&state->to_expire))) {
-		DEBUG4("Freeing state entry %p (%"PRIu64")", entry, entry->id);
-		state_entry_unlink(state, entry);
-		talloc_free(entry);
-	}
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shards[i];
 
-	/*
-	 *	Free the rbtree
-	 */
-	talloc_free(state->tree);
+		if (state->thread_safe) pthread_mutex_destroy(&shard->mutex);
+
+		while ((entry = fr_dlist_head(&shard->to_expire))) {
+			DEBUG4("Freeing state entry %p (%"PRIu64")", entry, entry->id);
+			state_entry_unlink(shard, entry);
+			talloc_free(entry);
+		}
+
+		/*
+		 *	Free the rbtree
+		 */
+		talloc_free(shard->tree);
+	}
 
 	return 0;
 }
@@ -222,12 +288,15 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, b
 				    uint8_t server_id, uint32_t context_id)
 {
 	fr_state_tree_t *state;
+	uint32_t	i;
 
 	state = talloc_zero(NULL, fr_state_tree_t);
 	if (!state) return 0;
 
 	state->max_sessions = max_sessions;
 	state->timeout = timeout;
+	atomic_init(&state->id, 0);
+	atomic_init(&state->used_sessions, 0);
 
 	/*
 	 *	Create a break in the contexts.
@@ -238,23 +307,43 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, b
 	 */
 	talloc_link_ctx(ctx, state);
 
-	if (thread_safe && (pthread_mutex_init(&state->mutex, NULL) != 0)) {
+	/*
+	 *	There's no point in sharding if there's only one
+	 *	thread using the tree.
+	 */
+	state->num_shards = thread_safe ? STATE_TREE_SHARDS : 1;
+	state->shards = talloc_zero_array(state, fr_state_shard_t, state->num_shards);
+	if (!state->shards) {
 		talloc_free(state);
 		return NULL;
 	}
 
-	fr_dlist_talloc_init(&state->to_expire, fr_state_entry_t, free_entry);
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shards[i];
 
-	/*
-	 *	We need to do controlled freeing of the
-	 *	rbtree, so that all the state entries
-	 *	are freed before it's destroyed.  Hence
-	 *	it being parented from the NULL ctx.
-	 */
-	state->tree = fr_rb_inline_talloc_alloc(NULL, fr_state_entry_t, node, state_entry_cmp, NULL);
-	if (!state->tree) {
-		talloc_free(state);
-		return NULL;
+		if (thread_safe && (pthread_mutex_init(&shard->mutex, NULL) != 0)) {
+		error:
+			while (i-- > 0) {
+				if (thread_safe) pthread_mutex_destroy(&state->shards[i].mutex);
+				talloc_free(state->shards[i].tree);
+			}
+			talloc_free(state);
+			return NULL;
+		}
+
+		fr_dlist_talloc_init(&shard->to_expire, fr_state_entry_t, free_entry);
+
+		/*
+		 *	We need to do controlled freeing of the
+		 *	rbtree, so that all the state entries
+		 *	are freed before it's destroyed.  Hence
+		 *	it being parented from the NULL ctx.
+		 */
+		shard->tree = fr_rb_inline_talloc_alloc(NULL, fr_state_entry_t, node, state_entry_cmp, NULL);
+		if (!shard->tree) {
+			if (thread_safe) pthread_mutex_destroy(&shard->mutex);
+			goto error;
+		}
 	}
 	talloc_set_destructor(state, _state_tree_free);
 
@@ -270,23 +359,23 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, b
  *
  */
 static inline CC_HINT(always_inline)
-void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry)
+void state_entry_unlink(fr_state_shard_t *shard, fr_state_entry_t *entry)
 {
 	/*
 	 *	Check the memory is still valid
 	 */
 	(void) talloc_get_type_abort(entry, fr_state_entry_t);
 
-	fr_dlist_remove(&state->to_expire, entry);
-	fr_rb_delete(state->tree, entry);
+	fr_dlist_remove(&shard->to_expire, entry);
+	fr_rb_delete(shard->tree, entry);
 
 	DEBUG4("State ID %" PRIu64 " unlinked", entry->id);
 }
 
-/** Frees any data associated with a state
+/** Release the data associated with a state, without freeing the entry
  *
  */
-static int _state_entry_free(fr_state_entry_t *entry)
+static void state_entry_clear(fr_state_entry_t *entry)
 {
 #ifdef WITH_VERIFY_PTR
 	fr_dcursor_t cursor;
@@ -315,17 +404,118 @@ static int _state_entry_free(fr_state_entry_t *entry)
 	 *	Should also free any state attributes
 	 */
 	if (entry->ctx) TALLOC_FREE(entry->ctx);
+}
+
+/** Frees any data associated with a state
+ *
+ */
+static int _state_entry_free(fr_state_entry_t *entry)
+{
+	state_entry_clear(entry);
 
 	DEBUG4("State ID %" PRIu64 " freed", entry->id);
 
-	entry->state_tree->used_sessions--;
+	atomic_fetch_sub_explicit(&entry->state_tree->used_sessions, 1, memory_order_relaxed);
 
 	return 0;
 }
 
+/** Remove expired entries from a shard
+ *
+ * @note Called with the shard mutex held.
+ *
+ * @param[in] shard	to clean up.
+ * @param[out] to_free	list of entries which the caller should free
+ *			once the mutex has been released.
+ * @param[in] now	the current time.
+ * @return the number of entries which expired.
+ */
+static uint64_t state_shard_expire(fr_state_shard_t *shard, fr_dlist_head_t *to_free, fr_time_t now)
+{
+	fr_state_entry_t	*entry, *next;
+	uint64_t		timed_out = 0;
+
+	for (entry = fr_dlist_head(&shard->to_expire);
+	     entry != NULL;
+	     entry = next) {
+ 		(void)talloc_get_type_abort(entry, fr_state_entry_t);	/* Allow examination */
+		next = fr_dlist_next(&shard->to_expire, entry);		/* Advance *before* potential unlinking */
+
+		/*
+		 *	The list is ordered by cleanup time, so
+		 *	we stop at the first live entry.
+		 */
+		if (!fr_time_lt(entry->cleanup, now)) break;
+
+		state_entry_unlink(shard, entry);
+		fr_dlist_insert_tail(to_free, entry);
+		timed_out++;
+	}
+
+	shard->timed_out += timed_out;
+
+	return timed_out;
+}
+
+/** Free entries which were removed from the state tree
+ *
+ * We do it outside of the mutex as freeing may involve significantly
+ * more work than just freeing the data.
+ *
+ * If there's request data that was persisted it will now be freed also,
+ * and it may have complex destructors associated with it.
+ */
+static void state_entries_free(fr_dlist_head_t *to_free)
+{
+	fr_state_entry_t *entry;
+
+	while ((entry = fr_dlist_head(to_free)) != NULL) {
+		fr_dlist_remove(to_free, entry);
+		talloc_free(entry);
+	}
+}
+
+/** Reserve a session slot
+ *
+ * If we're at the limit, expire old entries from all shards, and try again.
+ */
+static bool state_session_reserve(fr_state_tree_t *state, request_t *request)
+{
+	fr_time_t		now;
+	uint64_t		timed_out = 0;
+	uint32_t		i;
+	fr_dlist_head_t		to_free;
+
+	if (atomic_fetch_add_explicit(&state->used_sessions, 1, memory_order_relaxed) < state->max_sessions) return true;
+	atomic_fetch_sub_explicit(&state->used_sessions, 1, memory_order_relaxed);
+
+	fr_dlist_init(&to_free, fr_state_entry_t, free_entry);
+	now = fr_time();
+
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shards[i];
+
+		state_shard_lock(state, shard);
+		timed_out += state_shard_expire(shard, &to_free, now);
+		state_shard_unlock(state, shard);
+	}
+
+	if (timed_out > 0) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
+
+	state_entries_free(&to_free);
+
+	if (atomic_fetch_add_explicit(&state->used_sessions, 1, memory_order_relaxed) < state->max_sessions) return true;
+	atomic_fetch_sub_explicit(&state->used_sessions, 1, memory_order_relaxed);
+
+	return false;
+}
+
 /** Create a new state entry
  *
- * @note Called with the mutex held.
+ * The entry is not inserted into the tree.  The caller should populate
+ * it, and then call state_entry_insert().
+ *
+ * @note Called with no mutexes held.
  */
 static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *request,
 					    fr_pair_list_t *reply_list, fr_state_entry_t *old)
@@ -334,13 +524,10 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 	uint32_t		x;
 	fr_time_t		now = fr_time();
 	fr_pair_t		*vp;
-	fr_state_entry_t	*entry, *next;
+	fr_state_entry_t	*entry;
 
 	uint8_t			old_state[sizeof(old->state)];
 	int			old_tries = 0;
-	uint64_t		timed_out = 0;
-	bool			too_many = false;
-	fr_dlist_head_t		to_free;
 
 	/*
 	 *	Shouldn't be in any lists if it's being reused
@@ -349,74 +536,18 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 		  (!fr_dlist_entry_in_list(&old->expire_entry) &&
 		   !fr_rb_node_inline_in_tree(&old->node)));
 
-	fr_dlist_init(&to_free, fr_state_entry_t, free_entry);
-
-	/*
-	 *	Clean up expired entries
-	 */
-	for (entry = fr_dlist_head(&state->to_expire);
-	     entry != NULL;
-	     entry = next) {
- 		(void)talloc_get_type_abort(entry, fr_state_entry_t);	/* Allow examination */
-		next = fr_dlist_next(&state->to_expire, entry);		/* Advance *before* potential unlinking */
-
-		if (entry == old) continue;
-
-		/*
-		 *	Too old, we can delete it.
-		 */
-		if (fr_time_lt(entry->cleanup, now)) {
-			state_entry_unlink(state, entry);
-			fr_dlist_insert_tail(&to_free, entry);
-			timed_out++;
-			continue;
-		}
-
-		break;
-	}
-
-	state->timed_out += timed_out;
-
 	if (!old) {
-		too_many = (state->used_sessions == (uint32_t) state->max_sessions);
-		if (!too_many) state->used_sessions++;	/* preemptively increment whilst we hold the mutex */
+		if (!state_session_reserve(state, request)) {
+			RERROR("Failed inserting state entry - At maximum ongoing session limit (%u)",
+			       state->max_sessions);
+			return NULL;
+		}
 		memset(old_state, 0, sizeof(old_state));
 	} else {
 		old_tries = old->tries;
 		memcpy(old_state, old->state, sizeof(old_state));
 	}
 
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
-
-	if (timed_out > 0) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
-
-	/*
-	 *	Now free the unlinked entries.
-	 *
-	 *	We do it here as freeing may involve significantly more
-	 *	work than just freeing the data.
-	 *
-	 *	If there's request data that was persisted it will now
-	 *	be freed also, and it may have complex destructors associated
-	 *	with it.
-	 */
-	while ((entry = fr_dlist_head(&to_free)) != NULL) {
-		fr_dlist_remove(&to_free, entry);
-		talloc_free(entry);
-	}
-
-	/*
-	 *	Have to do this post-cleanup, else we end up returning with
-	 *	a list full of entries to free with none of them being
-	 *	freed which is bad...
-	 */
-	if (too_many) {
-		RERROR("Failed inserting state entry - At maximum ongoing session limit (%u)",
-		       state->max_sessions);
-		PTHREAD_MUTEX_LOCK(&state->mutex);	/* Caller expects this to be locked */
-		return NULL;
-	}
-
 	/*
 	 *	Allocation doesn't need to occur inside the critical region
 	 *	and would add significantly to contention.
@@ -427,10 +558,10 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 		/* tree->used_sessions incremented above */
 	/*
 	 *	Reuse the old state entry cleaning up any memory associated
-	 *	with it.
+	 *	with it.  It still holds its session slot.
 	 */
 	} else {
-		_state_entry_free(old);
+		state_entry_clear(old);
 		talloc_free_children(old);
 		memset(old, 0, sizeof(*old));
 		entry = old;
@@ -440,7 +571,7 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 
 	request_data_list_init(&entry->data);
 
-	entry->id = state->id++;
+	entry->id = atomic_fetch_add_explicit(&state->id, 1, memory_order_relaxed);
 
 	/*
 	 *	Limit the lifetime of this entry based on how long the
@@ -530,8 +661,6 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 	       entry->id, fr_box_octets(entry->state, sizeof(entry->state)),
 	       fr_box_time_delta(fr_time_sub(entry->cleanup, now)));
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-
 	/*
 	 *	XOR the server hash with four bytes of random data.
 	 *	We XOR is again before resolving, to ensure state lookups
@@ -540,20 +669,49 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 	 */
 	*((uint32_t *)(&entry->state_comp.context_id)) ^= state->context_id;
 
-	if (!fr_rb_insert(state->tree, entry)) {
-		RERROR("Failed inserting state entry - Insertion into state tree failed");
-		fr_pair_delete_by_da(reply_list, state->da);
-		talloc_free(entry);
-		return NULL;
+	return entry;
+}
+
+/** Insert a populated state entry into its shard
+ *
+ * Also cleans up any expired entries in the same shard.
+ *
+ * @note Called with no mutexes held.
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 if the entry could not be inserted.  The caller still owns it.
+ */
+static int state_entry_insert(fr_state_tree_t *state, request_t *request, fr_state_entry_t *entry)
+{
+	fr_state_shard_t	*shard = state_shard(state, entry);
+	uint64_t		timed_out;
+	fr_dlist_head_t		to_free;
+	int			ret = 0;
+
+	fr_dlist_init(&to_free, fr_state_entry_t, free_entry);
+
+	state_shard_lock(state, shard);
+
+	timed_out = state_shard_expire(shard, &to_free, fr_time());
+
+	if (!fr_rb_insert(shard->tree, entry)) {
+		ret = -1;
+	} else {
+		/*
+		 *	Link it to the end of the list, which is implicitly
+		 *	ordered by cleanup time.
+		 */
+		fr_dlist_insert_tail(&shard->to_expire, entry);
 	}
 
-	/*
-	 *	Link it to the end of the list, which is implicitly
-	 *	ordered by cleanup time.
-	 */
-	fr_dlist_insert_tail(&state->to_expire, entry);
+	state_shard_unlock(state, shard);
 
-	return entry;
+	if (timed_out > 0) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
+
+	state_entries_free(&to_free);
+
+	return ret;
 }
 
 /** Find the entry based on the State attribute and remove it from the state tree
@@ -561,7 +719,8 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
  */
 static fr_state_entry_t *state_entry_find_and_unlink(fr_state_tree_t *state, fr_value_box_t const *vb)
 {
-	fr_state_entry_t *entry, my_entry;
+	fr_state_entry_t	*entry, my_entry;
+	fr_state_shard_t	*shard;
 
 	/*
 	 *	Assume our own State first.
@@ -590,11 +749,15 @@ static fr_state_entry_t *state_entry_find_and_unlink(fr_state_tree_t *state, fr_
 	 */
 	my_entry.state_comp.context_id ^= state->context_id;
 
-	entry = fr_rb_remove(state->tree, &my_entry);
+	shard = state_shard(state, &my_entry);
+
+	state_shard_lock(state, shard);
+	entry = fr_rb_remove(shard->tree, &my_entry);
 	if (entry) {
 		(void) talloc_get_type_abort(entry, fr_state_entry_t);
-		fr_dlist_remove(&state->to_expire, entry);
+		fr_dlist_remove(&shard->to_expire, entry);
 	}
+	state_shard_unlock(state, shard);
 
 	return entry;
 }
@@ -610,13 +773,8 @@ void fr_state_discard(fr_state_tree_t *state, request_t *request)
 	vp = fr_pair_find_by_da(&request->request_pairs, NULL, state->da);
 	if (!vp) return;
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
 	entry = state_entry_find_and_unlink(state, &vp->data);
-	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
-		return;
-	}
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	if (!entry) return;
 
 	/*
 	 *	If fr_state_to_request was never called, this ensures
@@ -671,14 +829,11 @@ int fr_state_to_request(fr_state_tree_t *state, request_t *request)
 		return 1;
 	}
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
 	entry = state_entry_find_and_unlink(state, &vp->data);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
 		RDEBUG2("No state entry matching request.%pP found", vp);
 		return 2;
 	}
-   	PTHREAD_MUTEX_UNLOCK(&state->mutex);
 
 	/* Probably impossible in the current code */
 	if (unlikely(entry->thawed != NULL)) {
@@ -760,14 +915,13 @@ int fr_request_to_state(fr_state_tree_t *state, request_t *request)
 	}
 
 	MEM(state_ctx = request_state_replace(request, NULL));
-	PTHREAD_MUTEX_LOCK(&state->mutex);
 
 	/*
 	 *	Reuses old if possible
 	 */
 	entry = state_entry_create(state, request, &request->reply_pairs, old);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	error:
 		RERROR("Creating state entry failed");
 
 		talloc_free(request_state_replace(request, state_ctx));
@@ -778,10 +932,27 @@ int fr_request_to_state(fr_state_tree_t *state, request_t *request)
 	fr_assert(entry->ctx == NULL);
 	fr_assert(request->session_state_ctx);
 
+	/*
+	 *	Populate the entry before it's visible to other
+	 *	threads.
+	 */
 	entry->seq_start = request->seq_start;
 	entry->ctx = state_ctx;
 	fr_dlist_move(&entry->data, &data);
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+
+	if (state_entry_insert(state, request, entry) < 0) {
+		RERROR("Failed inserting state entry - Insertion into state tree failed");
+		fr_pair_delete_by_da(&request->reply_pairs, state->da);
+
+		/*
+		 *	Take back the session data, so that it isn't
+		 *	freed along with the entry.
+		 */
+		entry->ctx = NULL;
+		fr_dlist_move(&data, &entry->data);
+		talloc_free(entry);
+		goto error;
+	}
 
 	RDEBUG3("%s - saved", state->da->name);
 	REQUEST_VERIFY(request);
@@ -923,7 +1094,7 @@ void fr_state_discard_child(request_t *parent, void const *unique_ptr, int uniqu
  */
 uint64_t fr_state_entries_created(fr_state_tree_t *state)
 {
-	return state->id;
+	return atomic_load_explicit(&state->id, memory_order_relaxed);
 }
 
 /** Return number of entries that timed out
@@ -931,7 +1102,12 @@ uint64_t fr_state_entries_created(fr_state_tree_t *state)
  */
 uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
 {
-	return state->timed_out;
+	uint64_t	timed_out = 0;
+	uint32_t	i;
+
+	for (i = 0; i < state->num_shards; i++) timed_out += state->shards[i].timed_out;
+
+	return timed_out;
 }
 
 /** Return number of entries we're currently tracking
@@ -939,5 +1115,73 @@ uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
  */
 uint64_t fr_state_entries_tracked(fr_state_tree_t *state)
 {
-	return fr_rb_num_elements(state->tree);
+	uint64_t	tracked = 0;
+	uint32_t	i;
+
+	for (i = 0; i < state->num_shards; i++) tracked += fr_rb_num_elements(state->shards[i].tree);
+
+	return tracked;
+}
+
+/** Return number of times a shard mutex was acquired
+ *
+ */
+uint64_t fr_state_lock_acquired(fr_state_tree_t *state)
+{
+	uint64_t	acquired = 0;
+	uint32_t	i;
+
+	for (i = 0; i < state->num_shards; i++) acquired += state->shards[i].acquired;
+
+	return acquired;
+}
+
+/** Return number of times we had to wait for a shard mutex
+ *
+ */
+uint64_t fr_state_lock_contended(fr_state_tree_t *state)
+{
+	uint64_t	contended = 0;
+	uint32_t	i;
+
+	for (i = 0; i < state->num_shards; i++) contended += state->shards[i].contended;
+
+	return contended;
+}
+
+static int cmd_stats_state(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	fr_state_tree_t *state = talloc_get_type_abort(ctx, fr_state_tree_t);
+
+	/*
+	 *	The counters are read without taking the shard
+	 *	mutexes, so they may be a little stale.
+	 */
+	fprintf(fp, "entries.created\t\t%" PRIu64 "\n", fr_state_entries_created(state));
+	fprintf(fp, "entries.timeout\t\t%" PRIu64 "\n", fr_state_entries_timeout(state));
+	fprintf(fp, "entries.tracked\t\t%" PRIu64 "\n", fr_state_entries_tracked(state));
+	fprintf(fp, "lock.acquired\t\t%" PRIu64 "\n", fr_state_lock_acquired(state));
+	fprintf(fp, "lock.contended\t\t%" PRIu64 "\n", fr_state_lock_contended(state));
+
+	return 0;
 }
+
+fr_cmd_table_t cmd_state_table[] = {
+	{
+		.parent = "stats",
+		.name = "state",
+		.help = "Statistics for session state trees.",
+		.read_only = true
+	},
+
+	{
+		.parent = "stats state",
+		.add_name = true,
+		.name = "self",
+		.func = cmd_stats_state,
+		.help = "Show statistics for the state tree of a specific virtual server.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
@@ -119,6 +119,12 @@ struct trunk_request_s {
 							///< Used so that re-queueing doesn't increase trunk
 							///< `sent` count.
 
+	void			*proxy_ctx;		//!< Context returned by the proxy enqueue function.
+
+	void			*remote_ctx;		//!< Context passed to #trunk_request_enqueue_remote.
+							///< If set, outcomes are reported via the trunk's
+							///< remote functions instead of the API client's.
+
 #ifndef NDEBUG
 	fr_dlist_head_t		log;			//!< State change log.
 #endif
@@ -264,6 +270,16 @@ struct trunk_s {
 	fr_dlist_head_t		watch[TRUNK_STATE_MAX];	//!< To be called when trunk changes state.
 
 	trunk_watch_entry_t	*next_watcher;		//!< Watcher about to be run. Used to prevent nested watchers.
+
+	trunk_proxy_funcs_t const *proxy;		//!< If set, this trunk has no connections and
+							///< forwards its requests to a trunk in another thread.
+
+	void			*proxy_uctx;		//!< uctx to pass to the proxy functions.
+
+	trunk_remote_funcs_t const *remote;		//!< Report the outcome of requests enqueued on behalf
+							///< of a proxy trunk.
+
+	void			*remote_uctx;		//!< uctx to pass to the remote functions.
 	/** @} */
 
 	/** @name Timers
@@ -327,6 +343,9 @@ conf_parser_t const trunk_config[] = {
 
 	{ FR_CONF_OFFSET("max_backlog", trunk_conf_t, max_backlog), .dflt = "1000" },
 
+	{ FR_CONF_OFFSET("shared", trunk_conf_t, shared), .dflt = "no" },
+	{ FR_CONF_OFFSET("shared_threads", trunk_conf_t, shared_threads), .dflt = "2" },
+
 	{ FR_CONF_OFFSET_SUBSECTION("connection", 0, trunk_conf_t, conn_conf, trunk_config_connection), .subcs_size = sizeof(trunk_config_connection) },
 	{ FR_CONF_POINTER("request", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) trunk_config_request },
 
@@ -557,7 +576,10 @@ do { \
  */
 #define DO_REQUEST_COMPLETE(_treq) \
 do { \
-	if ((_treq)->pub.trunk->funcs.request_complete) { \
+	if ((_treq)->remote_ctx) { \
+		(_treq)->pub.trunk->remote->request_done((_treq)->remote_ctx, TRUNK_REQUEST_STATE_COMPLETE, \
+							 (_treq)->pub.trunk->remote_uctx); \
+	} else if ((_treq)->pub.trunk->funcs.request_complete) { \
 		request_t *request = (_treq)->pub.request; \
 		void *_prev = (_treq)->pub.trunk->in_handler; \
 		ROPTIONAL(RDEBUG3, DEBUG3, "Calling request_complete(request=%p, preq=%p, rctx=%p, uctx=%p)", \
@@ -576,7 +598,10 @@ do { \
  */
 #define DO_REQUEST_FAIL(_treq, _prev_state) \
 do { \
-	if ((_treq)->pub.trunk->funcs.request_fail) { \
+	if ((_treq)->remote_ctx) { \
+		(_treq)->pub.trunk->remote->request_done((_treq)->remote_ctx, TRUNK_REQUEST_STATE_FAILED, \
+							 (_treq)->pub.trunk->remote_uctx); \
+	} else if ((_treq)->pub.trunk->funcs.request_fail) { \
 		request_t *request = (_treq)->pub.request; \
 		void *_prev = (_treq)->pub.trunk->in_handler; \
 		ROPTIONAL(RDEBUG3, DEBUG3, "Calling request_fail(request=%p, preq=%p, rctx=%p, state=%s uctx=%p)", \
@@ -596,7 +621,9 @@ do { \
  */
 #define DO_REQUEST_FREE(_treq) \
 do { \
-	if ((_treq)->pub.trunk->funcs.request_free) { \
+	if ((_treq)->remote_ctx) { \
+		(_treq)->pub.trunk->remote->request_release((_treq)->remote_ctx, (_treq)->pub.trunk->remote_uctx); \
+	} else if ((_treq)->pub.trunk->funcs.request_free) { \
 		request_t *request = (_treq)->pub.request; \
 		void *_prev = (_treq)->pub.trunk->in_handler; \
 		ROPTIONAL(RDEBUG3, DEBUG3, "Calling request_free(request=%p, preq=%p, uctx=%p)", \
@@ -2096,6 +2123,17 @@ void trunk_request_signal_complete(trunk_request_t *treq)
 
 	if (!fr_cond_assert_msg(trunk, "treq not associated with trunk")) return;
 
+	/*
+	 *	The request is owned by a trunk in another
+	 *	thread.  It'll report back via
+	 *	trunk_request_proxy_done.
+	 */
+	if (trunk->proxy) {
+		if (treq->pub.state != TRUNK_REQUEST_STATE_SENT) return;
+		trunk->proxy->signal(treq->proxy_ctx, treq, TRUNK_REQUEST_STATE_COMPLETE, trunk->proxy_uctx);
+		return;
+	}
+
 	/*
 	 *	We assume that if the request is being signalled
 	 *	as complete from the demux function, that it was
@@ -2130,7 +2168,15 @@ void trunk_request_signal_complete(trunk_request_t *treq)
  */
 void trunk_request_signal_fail(trunk_request_t *treq)
 {
-	if (!fr_cond_assert_msg(treq->pub.trunk, "treq not associated with trunk")) return;
+	trunk_t *trunk = treq->pub.trunk;
+
+	if (!fr_cond_assert_msg(trunk, "treq not associated with trunk")) return;
+
+	if (trunk->proxy) {
+		if (treq->pub.state != TRUNK_REQUEST_STATE_SENT) return;
+		trunk->proxy->signal(treq->proxy_ctx, treq, TRUNK_REQUEST_STATE_FAILED, trunk->proxy_uctx);
+		return;
+	}
 
 	trunk_request_enter_failed(treq);
 }
@@ -2164,6 +2210,23 @@ void trunk_request_signal_cancel(trunk_request_t *treq)
 
  	trunk = treq->pub.trunk;
 
+	/*
+	 *	The remote trunk decides whether the request
+	 *	can be freed immediately, or whether it needs
+	 *	to wait for the cancel_mux.  Either way the
+	 *	treq is released by trunk_request_proxy_done,
+	 *	possibly before the signal function returns.
+	 */
+	if (trunk->proxy) {
+		if (treq->pub.state != TRUNK_REQUEST_STATE_SENT) return;
+
+		REQUEST_STATE_TRANSITION(TRUNK_REQUEST_STATE_CANCEL);
+		treq->cancel_reason = TRUNK_CANCEL_REASON_SIGNAL;
+		treq->pub.request = NULL;
+		trunk->proxy->signal(treq->proxy_ctx, treq, TRUNK_REQUEST_STATE_CANCEL, trunk->proxy_uctx);
+		return;
+	}
+
 	switch (treq->pub.state) {
 	/*
 	 *	We don't call the complete or failed callbacks
@@ -2534,6 +2597,17 @@ trunk_request_t *trunk_request_alloc(trunk_t *trunk, request_t *request)
 	return treq;
 }
 
+/** Request has been handed to the trunk which owns the connections
+ *
+ * @param[in] treq	belonging to a proxy trunk.
+ */
+static inline void trunk_request_enter_proxy_sent(trunk_request_t *treq)
+{
+	NDEBUG_UNUSED trunk_t *trunk = treq->pub.trunk;
+
+	REQUEST_STATE_TRANSITION(TRUNK_REQUEST_STATE_SENT);
+}
+
 /** Enqueue a request that needs data written to the trunk
  *
  * When a request_t * needs to make an asynchronous request to an external datastore
@@ -2596,6 +2670,51 @@ trunk_enqueue_t trunk_request_enqueue(trunk_request_t **treq_out, trunk_t *trunk
 	if (!fr_cond_assert_msg(!*treq_out || ((*treq_out)->pub.state == TRUNK_REQUEST_STATE_INIT),
 				"%s requests must be in \"init\" state", __FUNCTION__)) return TRUNK_ENQUEUE_FAIL;
 
+	/*
+	 *	Hand the request to the trunk which owns
+	 *	the connections.  From our perspective
+	 *	the request is now "sent".
+	 */
+	if (trunk->proxy) {
+		bool alloced = false;
+
+		if (*treq_out) {
+			treq = *treq_out;
+		} else {
+			*treq_out = treq = trunk_request_alloc(trunk, request);
+			if (!treq) return TRUNK_ENQUEUE_FAIL;
+			alloced = true;
+		}
+		treq->pub.preq = preq;
+		treq->pub.rctx = rctx;
+
+		ret = trunk->proxy->enqueue(&treq->proxy_ctx, treq, trunk->proxy_uctx);
+		switch (ret) {
+		case TRUNK_ENQUEUE_OK:
+		case TRUNK_ENQUEUE_IN_BACKLOG:
+			trunk_request_enter_proxy_sent(treq);
+			break;
+
+		/*
+		 *	Return the treq to the free list without
+		 *	calling request_free, as the API client
+		 *	still owns the preq.
+		 */
+		default:
+			if (alloced) {
+				treq->pub.request = NULL;
+				treq->pub.preq = NULL;
+				treq->pub.rctx = NULL;
+				treq->last_freed = fr_time();
+				trunk->pub.req_alloc--;
+				fr_dlist_insert_head(&trunk->free_requests, treq);
+				*treq_out = NULL;
+			}
+			break;
+		}
+		return ret;
+	}
+
 	/*
 	 *	If delay_start was set, we may need
 	 *	to insert the timer for the connection manager.
@@ -2675,6 +2794,12 @@ trunk_enqueue_t trunk_request_enqueue(trunk_request_t **treq_out, trunk_t *trunk
 trunk_enqueue_t trunk_request_requeue(trunk_request_t *treq)
 {
 	trunk_connection_t	*tconn = treq->pub.tconn;	/* Existing conn */
+	trunk_t			*trunk = treq->pub.trunk;
+
+	if (trunk->proxy) {
+		if (treq->pub.state != TRUNK_REQUEST_STATE_SENT) return TRUNK_ENQUEUE_FAIL;
+		return trunk->proxy->requeue(treq->proxy_ctx, treq, trunk->proxy_uctx);
+	}
 
 	if (!tconn) return TRUNK_ENQUEUE_FAIL;
 
@@ -2782,6 +2907,107 @@ trunk_enqueue_t trunk_request_enqueue_on_conn(trunk_request_t **treq_out, trunk_
 	return TRUNK_ENQUEUE_OK;
 }
 
+/** Enqueue a request on behalf of a proxy trunk in another thread
+ *
+ * Works exactly like #trunk_request_enqueue, except that the outcome of the request is
+ * reported via the trunk's #trunk_remote_funcs_t instead of the API client's
+ * request_complete, request_fail and request_free callbacks.
+ *
+ * If the request can't be enqueued, request_done is called with
+ * #TRUNK_REQUEST_STATE_FAILED and request_release is called before this function returns.
+ *
+ * @param[out] treq_out		Where to write the trunk request.  Will be set to NULL
+ *				when the request is released, so should usually point
+ *				into the remote_ctx.
+ * @param[in] trunk		to enqueue request on.  Must have remote functions set.
+ * @param[in] request		the request belongs to.  Should be NULL if the request
+ *				is owned by another thread, as the trunk and its
+ *				callbacks will log to it.
+ * @param[in] preq		Protocol request to write out.
+ * @param[in] rctx		The resume context to write any result to.
+ * @param[in] remote_ctx	to pass to the remote functions.
+ * @return
+ *	- TRUNK_ENQUEUE_OK.
+ *	- TRUNK_ENQUEUE_IN_BACKLOG.
+ *	- TRUNK_ENQUEUE_NO_CAPACITY.
+ *	- TRUNK_ENQUEUE_DST_UNAVAILABLE
+ *	- TRUNK_ENQUEUE_FAIL
+ */
+trunk_enqueue_t trunk_request_enqueue_remote(trunk_request_t **treq_out, trunk_t *trunk, request_t *request,
+					     void *preq, void *rctx, void *remote_ctx)
+{
+	trunk_request_t	*treq;
+	trunk_enqueue_t	ret;
+
+	if (!fr_cond_assert_msg(trunk->remote, "%s requires remote functions", __FUNCTION__)) return TRUNK_ENQUEUE_FAIL;
+
+	/*
+	 *	Set the remote_ctx before the treq is
+	 *	enqueued, as the mux function may be
+	 *	called immediately.
+	 */
+	treq = trunk_request_alloc(trunk, request);
+	if (!treq) {
+		trunk->remote->request_done(remote_ctx, TRUNK_REQUEST_STATE_FAILED, trunk->remote_uctx);
+		trunk->remote->request_release(remote_ctx, trunk->remote_uctx);
+		return TRUNK_ENQUEUE_NO_CAPACITY;
+	}
+	treq->remote_ctx = remote_ctx;
+	*treq_out = treq;
+
+	ret = trunk_request_enqueue(treq_out, trunk, request, preq, rctx);
+	switch (ret) {
+	case TRUNK_ENQUEUE_OK:
+	case TRUNK_ENQUEUE_IN_BACKLOG:
+		break;
+
+	default:
+		trunk->remote->request_done(remote_ctx, TRUNK_REQUEST_STATE_FAILED, trunk->remote_uctx);
+		trunk_request_free(&treq);	/* Calls request_release */
+		break;
+	}
+
+	return ret;
+}
+
+/** Report the outcome of a request forwarded by a proxy trunk
+ *
+ * Must be called in the thread which owns the proxy trunk, once the remote trunk
+ * has released the request.  Calls the API client's complete or fail callbacks,
+ * then frees the treq.
+ *
+ * @param[in] treq	to finish.
+ * @param[in] state	#TRUNK_REQUEST_STATE_COMPLETE, #TRUNK_REQUEST_STATE_FAILED or
+ *			#TRUNK_REQUEST_STATE_CANCEL_COMPLETE.
+ */
+void trunk_request_proxy_done(trunk_request_t *treq, trunk_request_state_t state)
+{
+	trunk_t			*trunk = treq->pub.trunk;
+	trunk_request_state_t	prev = treq->pub.state;
+
+	if (!fr_cond_assert_msg(trunk->proxy, "%s can only be called for proxy trunks", __FUNCTION__)) return;
+
+	treq->proxy_ctx = NULL;
+
+	switch (state) {
+	case TRUNK_REQUEST_STATE_COMPLETE:
+		REQUEST_STATE_TRANSITION(TRUNK_REQUEST_STATE_COMPLETE);
+		DO_REQUEST_COMPLETE(treq);
+		break;
+
+	case TRUNK_REQUEST_STATE_FAILED:
+		REQUEST_STATE_TRANSITION(TRUNK_REQUEST_STATE_FAILED);
+		DO_REQUEST_FAIL(treq, prev);
+		break;
+
+	default:
+		REQUEST_STATE_TRANSITION(TRUNK_REQUEST_STATE_CANCEL_COMPLETE);
+		break;
+	}
+
+	trunk_request_free(&treq);
+}
+
 #ifndef NDEBUG
 /** Used for sanity checks to ensure all log entries have been freed
  *
@@ -3893,6 +4119,46 @@ int trunk_connection_pop_request(trunk_request_t **treq_out, trunk_connection_t
 	return 0;
 }
 
+/** Peek at the requests waiting to be written to a connection
+ *
+ * Lets the request_mux callback prepare several requests at once, e.g. so
+ * they can be signed together.  The requests must still be written in the
+ * order #trunk_connection_pop_request returns them, and signalled as usual.
+ *
+ * @param[out] out	Where to write the requests.  The first is the one
+ *			#trunk_connection_pop_request would return, the order
+ *			of the rest is unspecified.
+ * @param[in] max	Maximum number of requests to write to out.
+ * @param[in] tconn	to peek at.
+ * @return The number of requests written to out.
+ */
+size_t trunk_connection_peek_requests(trunk_request_t **out, size_t max, trunk_connection_t *tconn)
+{
+	trunk_request_t	*head, *treq;
+	fr_heap_iter_t	iter;
+	size_t		n = 0;
+
+	if (unlikely(tconn->pub.state == TRUNK_CONN_HALTED)) return 0;
+
+	if (!fr_cond_assert_msg(IN_REQUEST_MUX(tconn->pub.trunk),
+				"%s can only be called from within request_mux handler",
+				__FUNCTION__)) return 0;
+
+	if (tconn->partial && (n < max)) out[n++] = tconn->partial;
+
+	head = fr_heap_peek(tconn->pending);
+	if (head && (n < max)) out[n++] = head;
+
+	for (treq = fr_heap_iter_init(tconn->pending, &iter);
+	     treq && (n < max);
+	     treq = fr_heap_iter_next(tconn->pending, &iter)) {
+		if (treq == head) continue;
+		out[n++] = treq;
+	}
+
+	return n;
+}
+
 /** Signal that a trunk connection is writable
  *
  * Should be called from the 'write' I/O handler to signal that requests can be enqueued.
@@ -5014,6 +5280,60 @@ trunk_t *trunk_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
 	return trunk;
 }
 
+/** Allocate a trunk which forwards its requests to a trunk in another thread
+ *
+ * The proxy trunk never opens connections.  Requests enqueued on it are passed to
+ * proxy->enqueue, and signals from the API client are passed to proxy->signal.
+ * The thread owning the connections reports back with #trunk_request_proxy_done.
+ *
+ * @param[in] ctx		To use for any memory allocations.  Must be thread local.
+ * @param[in] el		Event list of the calling thread.
+ * @param[in] funcs		Callback functions.  The request callbacks are called
+ *				in this thread, the connection and I/O callbacks are
+ *				only called by the remote trunk.
+ * @param[in] conf		Common user configurable parameters.
+ * @param[in] log_prefix	To prepend to global messages.
+ * @param[in] uctx		User data to pass to the request callbacks.
+ * @param[in] proxy		Functions used to forward requests.
+ * @param[in] proxy_uctx	User data to pass to the proxy functions.
+ * @return
+ *	- New trunk handle on success.
+ *	- NULL on error.
+ */
+trunk_t *trunk_proxy_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
+			   trunk_io_funcs_t const *funcs, trunk_conf_t const *conf,
+			   char const *log_prefix, void const *uctx,
+			   trunk_proxy_funcs_t const *proxy, void *proxy_uctx)
+{
+	trunk_t *trunk;
+
+	trunk = trunk_alloc(ctx, el, funcs, conf, log_prefix, uctx, true);
+	if (!trunk) return NULL;
+
+	trunk->proxy = proxy;
+	trunk->proxy_uctx = proxy_uctx;
+
+	/*
+	 *	There are no connections to manage
+	 */
+	trunk->started = true;
+	trunk->managing_connections = false;
+
+	return trunk;
+}
+
+/** Set the functions used to report the outcome of requests enqueued on behalf of a proxy
+ *
+ * @param[in] trunk	to set functions for.
+ * @param[in] funcs	to call.  Must remain valid for the lifetime of the trunk.
+ * @param[in] uctx	to pass to the functions.
+ */
+void trunk_remote_funcs_set(trunk_t *trunk, trunk_remote_funcs_t const *funcs, void *uctx)
+{
+	trunk->remote = funcs;
+	trunk->remote_uctx = uctx;
+}
+
 #ifndef TALLOC_GET_TYPE_ABORT_NOOP
 /** Verify a trunk
  *
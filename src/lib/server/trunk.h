@@ -281,6 +281,14 @@ typedef struct {
 	bool			backlog_on_failed_conn;	//!< Assign requests to the backlog when there are no
 							//!< available connections and the last connection event
 							//!< was a failure, instead of failing them immediately.
+
+	bool			shared;			//!< Connections are owned by a small set of I/O threads
+							///< shared by all workers, instead of each worker
+							///< having its own trunk.  Only used by API clients
+							///< which support it.
+
+	uint16_t		shared_threads;		//!< How many I/O threads service a shared trunk.
+							///< Each has its own set of start/min/max connections.
 } trunk_conf_t;
 
 /** Public fields for the trunk
@@ -763,6 +771,65 @@ typedef struct {
 								///< provide a chance to mark the request as runnable.
 } trunk_io_funcs_t;
 
+/** Functions used by a proxy trunk to forward requests to a trunk in another thread
+ *
+ * A proxy trunk has no connections of its own.  The API client uses it exactly as it
+ * would a normal trunk, and the proxy calls these functions to hand its requests to
+ * the thread which owns the connections.
+ *
+ * The owning thread reports back by calling #trunk_request_proxy_done in the proxy's
+ * thread, which runs the API client's complete, fail and free callbacks.
+ */
+typedef struct {
+	/** Hand a new request to the remote trunk
+	 *
+	 * @param[out] proxy_ctx	Where to store context for this request.
+	 * @param[in] treq		Proxy request, with preq and rctx set.
+	 * @param[in] uctx		passed to #trunk_proxy_alloc.
+	 */
+	trunk_enqueue_t		(*enqueue)(void **proxy_ctx, trunk_request_t *treq, void *uctx);
+
+	/** Requeue a request on its existing connection
+	 *
+	 * If the remote trunk can't requeue the request, it should be reported as
+	 * failed with #trunk_request_proxy_done.
+	 */
+	trunk_enqueue_t		(*requeue)(void *proxy_ctx, trunk_request_t *treq, void *uctx);
+
+	/** Signal that the API client is done with a request
+	 *
+	 * state is one of #TRUNK_REQUEST_STATE_COMPLETE, #TRUNK_REQUEST_STATE_FAILED
+	 * or #TRUNK_REQUEST_STATE_CANCEL.  For complete and failed, the function should
+	 * call #trunk_request_proxy_done before returning, as the API client expects its
+	 * callbacks to have run.  Cancelled requests are finished with
+	 * #trunk_request_proxy_done once the remote trunk no longer needs the preq.
+	 */
+	void			(*signal)(void *proxy_ctx, trunk_request_t *treq, trunk_request_state_t state,
+					  void *uctx);
+} trunk_proxy_funcs_t;
+
+/** Functions used by a trunk to report the outcome of requests enqueued on behalf of a proxy
+ *
+ * These are called in place of the request_complete, request_fail and request_free
+ * callbacks for requests enqueued with #trunk_request_enqueue_remote.
+ */
+typedef struct {
+	/** The request completed or failed
+	 *
+	 * @param[in] remote_ctx	passed to #trunk_request_enqueue_remote.
+	 * @param[in] state		#TRUNK_REQUEST_STATE_COMPLETE or #TRUNK_REQUEST_STATE_FAILED.
+	 * @param[in] uctx		passed to #trunk_remote_funcs_set.
+	 */
+	void			(*request_done)(void *remote_ctx, trunk_request_state_t state, void *uctx);
+
+	/** The trunk no longer references the request, or its preq
+	 *
+	 * @param[in] remote_ctx	passed to #trunk_request_enqueue_remote.
+	 * @param[in] uctx		passed to #trunk_remote_funcs_set.
+	 */
+	void			(*request_release)(void *remote_ctx, void *uctx);
+} trunk_remote_funcs_t;
+
 /** @name Statistics
  * @{
  */
@@ -826,6 +893,8 @@ void		trunk_request_state_log(fr_log_t const *log, fr_log_type_t log_type, char
 int trunk_connection_pop_cancellation(trunk_request_t **treq_out, trunk_connection_t *tconn);
 
 int trunk_connection_pop_request(trunk_request_t **treq_out, trunk_connection_t *tconn);
+
+size_t trunk_connection_peek_requests(trunk_request_t **out, size_t max, trunk_connection_t *tconn);
 /** @} */
 
 /** @name Connection state signalling
@@ -912,6 +981,22 @@ trunk_t	*trunk_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
 				char const *log_prefix, void const *uctx, bool delay_start) CC_HINT(nonnull(2, 3, 4));
 /** @} */
 
+/** @name Cross-thread trunks
+ * @{
+ */
+trunk_t		*trunk_proxy_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
+				   trunk_io_funcs_t const *funcs, trunk_conf_t const *conf,
+				   char const *log_prefix, void const *uctx,
+				   trunk_proxy_funcs_t const *proxy, void *proxy_uctx) CC_HINT(nonnull(2, 3, 4, 7));
+
+void		trunk_request_proxy_done(trunk_request_t *treq, trunk_request_state_t state) CC_HINT(nonnull);
+
+void		trunk_remote_funcs_set(trunk_t *trunk, trunk_remote_funcs_t const *funcs, void *uctx) CC_HINT(nonnull(1,2));
+
+trunk_enqueue_t	trunk_request_enqueue_remote(trunk_request_t **treq_out, trunk_t *trunk, request_t *request,
+					     void *preq, void *rctx, void *remote_ctx) CC_HINT(nonnull(1, 2, 6));
+/** @} */
+
 /** @name Watchers
  * @{
  */
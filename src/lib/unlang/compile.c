@@ -2018,6 +2018,18 @@ int unlang_define_local_variable(CONF_ITEM *ci, unlang_variable_t *var, tmpl_rul
 	return 0;
 }
 
+/** Remove an instruction from the instruction tree when it's freed
+ *
+ * Instructions which can never run, such as the contents of "if (false)",
+ * are freed during compilation.
+ */
+static int _unlang_instruction_free(unlang_t *c)
+{
+	if (unlang_instruction_tree) (void) fr_rb_delete(unlang_instruction_tree, c);
+
+	return 0;
+}
+
 /*
  *	Compile one unlang instruction
  */
@@ -2210,21 +2222,28 @@ allocate_number:
 	if (!c) return NULL;
 	if (c == UNLANG_IGNORE) return UNLANG_IGNORE;
 
-	c->number = unlang_number++;
 	compile_set_default_actions(c, unlang_ctx);
 
 	/*
-	 *	Only insert the per-thread allocation && instantiation if it's used.
+	 *	References to "group foo { ... }" are compiled by a
+	 *	recursive call to compile_item(), which has already
+	 *	numbered and inserted the instruction.
 	 */
-	op = &unlang_ops[c->type];
-	if (!op->thread_inst_size) return c;
+	if (c->number) return c;
 
+	c->number = unlang_number++;
+
+	/*
+	 *	Every numbered instruction is inserted, so that it can
+	 *	be found with unlang_instruction_by_number().
+	 */
 	if (!fr_rb_insert(unlang_instruction_tree, c)) {
 		cf_log_err(ci, "Instruction \"%s\" number %u has conflict with previous one.",
 			   c->debug_name, c->number);
 		talloc_free(c);
 		return NULL;
 	}
+	talloc_set_destructor(c, _unlang_instruction_free);
 
 	return c;
 }
@@ -2324,9 +2343,25 @@ static int8_t instruction_cmp(void const *one, void const *two)
 }
 
 
+static int _unlang_instruction_tree_free(UNUSED fr_rb_tree_t **tree_p)
+{
+	unlang_instruction_tree = NULL;
+
+	return 0;
+}
+
 void unlang_compile_init(TALLOC_CTX *ctx)
 {
-	unlang_instruction_tree = fr_rb_alloc(ctx, instruction_cmp, NULL);
+	fr_rb_tree_t	**tree_p;
+
+	/*
+	 *	Instructions may be freed after the tree, so the
+	 *	tree pointer is cleared before the tree is freed.
+	 */
+	MEM(tree_p = talloc(ctx, fr_rb_tree_t *));
+	talloc_set_destructor(tree_p, _unlang_instruction_tree_free);
+
+	unlang_instruction_tree = *tree_p = fr_rb_alloc(tree_p, instruction_cmp, NULL);
 }
 
 
@@ -2356,9 +2391,11 @@ int unlang_thread_instantiate(TALLOC_CTX *ctx)
 
 		unlang_thread_array[instruction->number].instruction = instruction;
 
+		/*
+		 *	Only do the per-thread allocation && instantiation if it's used.
+		 */
 		op = &unlang_ops[instruction->type];
-
-		fr_assert(op->thread_inst_size);
+		if (!op->thread_inst_size) continue;
 
 		/*
 		 *	Allocate any thread-specific instance data.
@@ -2388,6 +2425,24 @@ void *unlang_thread_instance(unlang_t const *instruction)
 	return unlang_thread_array[instruction->number].thread_inst;
 }
 
+/** Find a compiled instruction by its number
+ *
+ * Instructions which are pushed at runtime may share the number of a
+ * compiled instruction, but not its lifetime.  This returns the compiled
+ * instruction, which lives as long as the server config.
+ *
+ * @param[in] number	of the instruction.
+ * @return
+ *	- The compiled instruction.
+ *	- NULL if no instruction with that number exists.
+ */
+unlang_t const *unlang_instruction_by_number(unsigned int number)
+{
+	if (!number || !unlang_instruction_tree) return NULL;
+
+	return fr_rb_find(unlang_instruction_tree, &(unlang_t){ .number = number });
+}
+
 #ifdef WITH_PERF
 void unlang_frame_perf_init(unlang_stack_frame_t *frame)
 {
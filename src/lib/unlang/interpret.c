@@ -42,6 +42,11 @@ RCSID("$Id$")
  */
 static _Thread_local unlang_interpret_t *intp_thread_default;
 
+/** Forwards calls to unlang_interpret_mark_runnable for threads which don't run requests
+ */
+static _Thread_local unlang_interpret_runnable_hook_t intp_thread_runnable_hook;
+static _Thread_local void *intp_thread_runnable_hook_uctx;
+
 static fr_table_num_ordered_t const unlang_action_table[] = {
 	{ L("calculate-result"),	UNLANG_ACTION_CALCULATE_RESULT },
 	{ L("next"),			UNLANG_ACTION_EXECUTE_NEXT },
@@ -613,6 +618,7 @@ unlang_frame_action_t result_calculate(request_t *request, unlang_stack_frame_t
 
 		talloc_free(frame->state);
 		unlang_frame_perf_cleanup(frame);
+		frame_profile_cleanup(frame);
 		frame_state_init(stack, frame);	/* Don't change result_p */
 		return UNLANG_FRAME_ACTION_RETRY;
 	default:
@@ -798,6 +804,7 @@ unlang_frame_action_t frame_eval(request_t *request, unlang_stack_frame_t *frame
 			unlang_ops[instruction->type].name);
 
 		unlang_frame_perf_resume(frame);
+		frame_profile_resume(frame);
 
 		/*
 		 *	catch plays games with the frame so we skip
@@ -846,6 +853,7 @@ unlang_frame_action_t frame_eval(request_t *request, unlang_stack_frame_t *frame
 				      "but stack depth was not increased",
 				      instruction->name);
 			unlang_frame_perf_yield(frame);
+			frame_profile_yield(frame, false);
 			return UNLANG_FRAME_ACTION_NEXT;
 
 		/*
@@ -858,6 +866,7 @@ unlang_frame_action_t frame_eval(request_t *request, unlang_stack_frame_t *frame
 				      "frames for evaluation.  Instruction should return UNLANG_ACTION_PUSHED_CHILD "
 				      "instead", instruction->name);
 			unlang_frame_perf_yield(frame);
+			frame_profile_yield(frame, true);
 			yielded_set(frame);
 			RDEBUG4("** [%i] %s - yielding with current (%s %d)", stack->depth, __FUNCTION__,
 				fr_table_str_by_value(mod_rcode_table, scratch->rcode, "<invalid>"),
@@ -1619,11 +1628,26 @@ bool unlang_interpret_is_resumable(request_t *request)
  */
 void unlang_interpret_mark_runnable(request_t *request)
 {
-	unlang_stack_t			*stack = request->stack;
-	unlang_interpret_t		*intp = stack->intp;
-	unlang_stack_frame_t		*frame = &stack->frame[stack->depth];
+	unlang_stack_t			*stack;
+	unlang_interpret_t		*intp;
+	unlang_stack_frame_t		*frame;
+
+	bool 				scheduled;
+
+	/*
+	 *	The request belongs to another thread, so we
+	 *	can't touch its stack.  Let the hook deliver
+	 *	the notification.
+	 */
+	if (unlikely(intp_thread_runnable_hook != NULL)) {
+		intp_thread_runnable_hook(request, intp_thread_runnable_hook_uctx);
+		return;
+	}
 
-	bool 				scheduled = unlang_request_is_scheduled(request);
+	stack = request->stack;
+	intp = stack->intp;
+	frame = &stack->frame[stack->depth];
+	scheduled = unlang_request_is_scheduled(request);
 
 	/*
 	 *	The request hasn't yielded, OR it's already been
@@ -2033,6 +2057,21 @@ void unlang_interpret_set_thread_default(unlang_interpret_t *intp)
 	intp_thread_default = intp;
 }
 
+/** Set a function to call instead of marking requests runnable in this thread
+ *
+ * Used by threads which perform I/O on behalf of requests owned by other threads.
+ * Any calls to #unlang_interpret_mark_runnable made in this thread are passed to
+ * the hook, which is responsible for notifying the thread which owns the request.
+ *
+ * @param[in] hook	to call.  NULL to remove the hook.
+ * @param[in] uctx	to pass to the hook.
+ */
+void unlang_interpret_set_thread_runnable_hook(unlang_interpret_runnable_hook_t hook, void *uctx)
+{
+	intp_thread_runnable_hook = hook;
+	intp_thread_runnable_hook_uctx = uctx;
+}
+
 /** Get the default interpreter for this thread
  *
  * This allows detached requests to be executed asynchronously
@@ -188,6 +188,15 @@ void			unlang_interpret_set_thread_default(unlang_interpret_t *intp);
 
 unlang_interpret_t	*unlang_interpret_get_thread_default(void);
 
+/** Called instead of marking a request runnable, in threads which don't own the request
+ *
+ * @param[in] request	to mark runnable.
+ * @param[in] uctx	passed to #unlang_interpret_set_thread_runnable_hook.
+ */
+typedef void (*unlang_interpret_runnable_hook_t)(request_t *request, void *uctx);
+
+void			unlang_interpret_set_thread_runnable_hook(unlang_interpret_runnable_hook_t hook, void *uctx);
+
 int			unlang_interpret_set_timeout(request_t *request, fr_time_delta_t timeout) CC_HINT(nonnull);
 
 rlm_rcode_t		unlang_interpret(request_t *request, bool running) CC_HINT(hot);
@@ -0,0 +1,485 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file unlang/profile.c
+ * @brief Per-thread profiling of unlang instructions.
+ *
+ * Time is attributed to the path of instructions on the stack when it
+ * was spent, e.g. "recv Access-Request;if (...);sql".  Each distinct
+ * path is a node in a tree, with the tree stored as an array indexed
+ * by node number, and a hash table mapping (parent node, instruction)
+ * to the child node.
+ *
+ * Only the owning thread ever writes to the profile.  Nodes are never
+ * removed, and the node count is published after the node is fully
+ * initialised, so other threads can read the profile without locking.
+ *
+ * @copyright 2025 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/unlang/profile.h>
+#include <freeradius-devel/util/math.h>
+
+#include "unlang_priv.h"
+#include "module_priv.h"
+
+#ifdef TESTING_UNLANG_PROFILE
+static fr_time_t test_time_base = fr_time_wrap(1);
+
+static fr_time_t test_time(void)
+{
+	return test_time_base;
+}
+
+#define fr_time test_time
+
+static unlang_t const *test_instruction_by_number(unsigned int number);
+
+#define unlang_instruction_by_number test_instruction_by_number
+#endif
+
+#define UNLANG_PROFILE_HIST_BUCKETS	32	//!< log2 microsecond buckets, from <1us to >=2^30us.
+
+/** A single instruction path
+ *
+ */
+typedef struct {
+	unlang_t const		*instruction;		//!< Compiled instruction.  Never one pushed at runtime
+							///< as those may be freed while we still reference them.
+	uint32_t		parent;			//!< Parent node, 0 for the root.
+
+	uint64_t		count;			//!< Number of times the instruction completed.
+	fr_time_delta_t		cpu;			//!< Time spent running the instruction itself.
+	fr_time_delta_t		yielded;		//!< Time spent yielded, waiting for I/O or timers.
+	fr_time_delta_t		latency;		//!< Total time from starting to completing the instruction.
+
+	uint64_t		*hist;			//!< Latency histogram, only allocated for module calls.
+} unlang_profile_node_t;
+
+struct unlang_profile_s {
+	atomic_bool		enabled;		//!< Whether new frames are profiled.
+	atomic_uint_fast32_t	reset;			//!< Incremented by other threads to request a reset.
+	uint32_t		reset_seen;		//!< Last reset request we processed.
+
+	uint32_t		max_nodes;		//!< Maximum number of paths we track.
+	atomic_uint_fast32_t	num_nodes;		//!< Number of nodes published to readers.
+	unlang_profile_node_t	*nodes;			//!< Node 0 is the root, and is never charged.
+	uint64_t		*hist;			//!< Storage for module histograms.
+	uint32_t		num_hist;		//!< Number of histograms in use.
+
+	uint32_t		*slots;			//!< Hash table of node numbers.
+	uint32_t		mask;			//!< Size of the hash table - 1.
+
+	uint64_t		dropped;		//!< Instructions we couldn't profile as the node table was full.
+};
+
+/** Number of threads with the profiler enabled
+ *
+ * Checked before doing any other profiling work.
+ */
+atomic_uint_fast32_t unlang_profile_active;
+
+static _Thread_local unlang_profile_t *unlang_profile;
+
+/** Allocate the node table and hash on first use
+ *
+ * This happens in the thread that owns the profile, so no memory is
+ * used unless that thread is profiled.
+ */
+static int profile_nodes_alloc(unlang_profile_t *profile)
+{
+	uint32_t	num_slots = 1;
+
+	while (num_slots < (profile->max_nodes * 2)) num_slots <<= 1;
+
+	profile->nodes = talloc_zero_array(profile, unlang_profile_node_t, profile->max_nodes);
+	profile->hist = talloc_zero_array(profile, uint64_t, profile->max_nodes * UNLANG_PROFILE_HIST_BUCKETS);
+	profile->slots = talloc_zero_array(profile, uint32_t, num_slots);
+	if (!profile->nodes || !profile->hist || !profile->slots) {
+		TALLOC_FREE(profile->nodes);
+		TALLOC_FREE(profile->hist);
+		TALLOC_FREE(profile->slots);
+		atomic_store_explicit(&profile->enabled, false, memory_order_relaxed);
+		return -1;
+	}
+	profile->mask = num_slots - 1;
+
+	atomic_store_explicit(&profile->num_nodes, 1, memory_order_release);	/* The root */
+
+	return 0;
+}
+
+/** Zero all the counters, if another thread asked us to
+ *
+ * The paths are left alone, as frames which are in progress still
+ * refer to them.
+ */
+static inline void profile_reset_check(unlang_profile_t *profile)
+{
+	uint32_t	reset = atomic_load_explicit(&profile->reset, memory_order_relaxed);
+	uint32_t	num_nodes, i;
+
+	if (likely(reset == profile->reset_seen)) return;
+	profile->reset_seen = reset;
+
+	num_nodes = atomic_load_explicit(&profile->num_nodes, memory_order_relaxed);
+	for (i = 0; i < num_nodes; i++) {
+		unlang_profile_node_t *node = &profile->nodes[i];
+
+		node->count = 0;
+		node->cpu = node->yielded = node->latency = fr_time_delta_wrap(0);
+	}
+	memset(profile->hist, 0, sizeof(uint64_t) * profile->num_hist * UNLANG_PROFILE_HIST_BUCKETS);
+	profile->dropped = 0;
+}
+
+/** Find or create the node for an instruction under a parent node
+ *
+ * @return
+ *	- The node number.
+ *	- 0 if the node table is full.
+ */
+static uint32_t profile_node_find(unlang_profile_t *profile, uint32_t parent, unsigned int number)
+{
+	uint32_t		slot, num_nodes;
+	unlang_profile_node_t	*node;
+	unlang_t const		*instruction;
+
+	slot = ((parent * 0x9e3779b1) ^ (number * 0x85ebca6b)) & profile->mask;
+
+	while (profile->slots[slot]) {
+		node = &profile->nodes[profile->slots[slot]];
+		if ((node->parent == parent) && (node->instruction->number == number)) return profile->slots[slot];
+
+		slot = (slot + 1) & profile->mask;
+	}
+
+	num_nodes = atomic_load_explicit(&profile->num_nodes, memory_order_relaxed);
+	if (num_nodes >= profile->max_nodes) {
+		profile->dropped++;
+		return 0;
+	}
+
+	instruction = unlang_instruction_by_number(number);
+	if (!instruction) return 0;
+
+	node = &profile->nodes[num_nodes];
+	node->instruction = instruction;
+	node->parent = parent;
+	if (instruction->type == UNLANG_TYPE_MODULE) {
+		node->hist = &profile->hist[profile->num_hist++ * UNLANG_PROFILE_HIST_BUCKETS];
+	}
+
+	profile->slots[slot] = num_nodes;
+	atomic_store_explicit(&profile->num_nodes, num_nodes + 1, memory_order_release);
+
+	return num_nodes;
+}
+
+/** Start profiling the instruction in a frame
+ *
+ * Instructions pushed at runtime, such as xlat and tmpl expansions, have
+ * no number of their own.  Their time is charged to the instruction which
+ * pushed them, but they're not counted separately.
+ */
+void unlang_profile_frame_init(unlang_stack_t *stack, unlang_stack_frame_t *frame)
+{
+	unlang_profile_t	*profile = unlang_profile;
+	unlang_t const		*instruction = frame->instruction;
+	uint32_t		parent, node;
+	fr_time_t		now;
+
+	frame->profile.node = 0;
+
+	if (!profile || !atomic_load_explicit(&profile->enabled, memory_order_relaxed)) return;
+
+	if (unlikely(!profile->nodes) && (profile_nodes_alloc(profile) < 0)) return;
+
+	profile_reset_check(profile);
+
+	parent = (frame > stack->frame) ? (frame - 1)->profile.node : 0;
+
+	if (!instruction->number) {
+		if (!parent) return;
+
+		frame->profile = (unlang_frame_profile_t) {
+			.node = parent,
+			.state = UNLANG_PROFILE_STATE_WAITING,
+			.inherited = true
+		};
+		return;
+	}
+
+	node = profile_node_find(profile, parent, instruction->number);
+	if (!node) return;
+
+	now = fr_time();
+	frame->profile = (unlang_frame_profile_t) {
+		.node = node,
+		.state = UNLANG_PROFILE_STATE_WAITING,
+		.start = now,
+		.mark = now
+	};
+}
+
+void unlang_profile_frame_resume(unlang_stack_frame_t *frame)
+{
+	unlang_profile_node_t	*node = &unlang_profile->nodes[frame->profile.node];
+	fr_time_t		now = fr_time();
+
+	if (frame->profile.state == UNLANG_PROFILE_STATE_YIELDED) {
+		node->yielded = fr_time_delta_add(node->yielded, fr_time_sub(now, frame->profile.mark));
+	}
+
+	frame->profile.state = UNLANG_PROFILE_STATE_RUNNING;
+	frame->profile.mark = now;
+}
+
+void unlang_profile_frame_yield(unlang_stack_frame_t *frame, bool async)
+{
+	unlang_profile_node_t	*node = &unlang_profile->nodes[frame->profile.node];
+	fr_time_t		now = fr_time();
+
+	if (frame->profile.state == UNLANG_PROFILE_STATE_RUNNING) {
+		node->cpu = fr_time_delta_add(node->cpu, fr_time_sub(now, frame->profile.mark));
+	}
+
+	frame->profile.state = async ? UNLANG_PROFILE_STATE_YIELDED : UNLANG_PROFILE_STATE_WAITING;
+	frame->profile.mark = now;
+}
+
+void unlang_profile_frame_cleanup(unlang_stack_frame_t *frame)
+{
+	unlang_profile_node_t	*node = &unlang_profile->nodes[frame->profile.node];
+	fr_time_t		now = fr_time();
+	fr_time_delta_t		latency;
+
+	switch (frame->profile.state) {
+	case UNLANG_PROFILE_STATE_RUNNING:
+		node->cpu = fr_time_delta_add(node->cpu, fr_time_sub(now, frame->profile.mark));
+		break;
+
+	case UNLANG_PROFILE_STATE_YIELDED:
+		node->yielded = fr_time_delta_add(node->yielded, fr_time_sub(now, frame->profile.mark));
+		break;
+
+	case UNLANG_PROFILE_STATE_WAITING:
+		break;
+	}
+
+	frame->profile.node = 0;
+
+	if (frame->profile.inherited) return;
+
+	latency = fr_time_sub(now, frame->profile.start);
+
+	node->count++;
+	node->latency = fr_time_delta_add(node->latency, latency);
+
+	if (node->hist) {
+		uint8_t bucket = fr_high_bit_pos((uint64_t)fr_time_delta_to_usec(latency));
+
+		if (bucket >= UNLANG_PROFILE_HIST_BUCKETS) bucket = UNLANG_PROFILE_HIST_BUCKETS - 1;
+		node->hist[bucket]++;
+	}
+}
+
+static int _unlang_profile_free(unlang_profile_t *profile)
+{
+	unlang_profile_enable(profile, false);
+	if (unlang_profile == profile) unlang_profile = NULL;
+
+	return 0;
+}
+
+/** Allocate a profile for the calling thread
+ *
+ * The profile is disabled until #unlang_profile_enable is called.
+ *
+ * @param[in] ctx		to allocate the profile in.  Should be freed
+ *				before the thread exits.
+ * @param[in] max_paths		Maximum number of distinct instruction paths to track.
+ * @return
+ *	- The new profile.
+ *	- NULL on error.
+ */
+unlang_profile_t *unlang_profile_thread_alloc(TALLOC_CTX *ctx, uint32_t max_paths)
+{
+	unlang_profile_t	*profile;
+
+	if (unlang_profile) {
+		fr_strerror_const("Thread already has a profile");
+		return NULL;
+	}
+
+	MEM(profile = talloc_zero(ctx, unlang_profile_t));
+	profile->max_nodes = max_paths + 1;	/* The root */
+	talloc_set_destructor(profile, _unlang_profile_free);
+
+	unlang_profile = profile;
+
+	return profile;
+}
+
+/** Enable or disable profiling for a thread
+ *
+ * May be called from any thread.  Frames which are already being profiled
+ * continue to be charged until they complete.
+ */
+void unlang_profile_enable(unlang_profile_t *profile, bool enable)
+{
+	if (atomic_exchange(&profile->enabled, enable) == enable) return;
+
+	if (enable) {
+		atomic_fetch_add_explicit(&unlang_profile_active, 1, memory_order_relaxed);
+	} else {
+		atomic_fetch_sub_explicit(&unlang_profile_active, 1, memory_order_relaxed);
+	}
+}
+
+bool unlang_profile_is_enabled(unlang_profile_t const *profile)
+{
+	return atomic_load_explicit(&profile->enabled, memory_order_relaxed);
+}
+
+/** Ask the owning thread to zero the profile counters
+ *
+ * May be called from any thread.  The counters are zeroed the next time
+ * the owning thread starts profiling an instruction.
+ */
+void unlang_profile_reset(unlang_profile_t *profile)
+{
+	atomic_fetch_add_explicit(&profile->reset, 1, memory_order_relaxed);
+}
+
+/** Print the name of an instruction as a flamegraph frame
+ *
+ * ';' separates frames, so it can't appear in the name.
+ */
+static void profile_frame_fprint(FILE *fp, unlang_t const *instruction)
+{
+	char const *p;
+
+	for (p = instruction->debug_name; *p; p++) {
+		switch (*p) {
+		case ';':
+			fputc(':', fp);
+			break;
+
+		case '\n':
+		case '\r':
+			fputc(' ', fp);
+			break;
+
+		default:
+			fputc(*p, fp);
+			break;
+		}
+	}
+}
+
+/** Print the profile as folded stacks
+ *
+ * One line per instruction path, with the frames separated by ';', and
+ * the time in nanoseconds.  This is the input format for flamegraph.pl,
+ * and most other flamegraph tools.
+ *
+ * @param[in] fp	to write to.
+ * @param[in] profile	to print.
+ * @param[in] yielded	print time spent yielded instead of CPU time.
+ */
+void unlang_profile_folded_fprint(FILE *fp, unlang_profile_t const *profile, bool yielded)
+{
+	uint32_t	num_nodes = atomic_load_explicit(&profile->num_nodes, memory_order_acquire);
+	uint32_t	i;
+
+	for (i = 1; i < num_nodes; i++) {
+		unlang_profile_node_t const	*node = &profile->nodes[i];
+		uint32_t			path[UNLANG_STACK_MAX];
+		uint32_t			n;
+		int				depth = 0;
+		int64_t				value;
+
+		value = fr_time_delta_unwrap(yielded ? node->yielded : node->cpu);
+		if (value <= 0) continue;
+
+		for (n = i; n && (depth < UNLANG_STACK_MAX); n = profile->nodes[n].parent) path[depth++] = n;
+
+		while (depth--) {
+			profile_frame_fprint(fp, profile->nodes[path[depth]].instruction);
+			fputc(depth ? ';' : ' ', fp);
+		}
+		fprintf(fp, "%" PRId64 "\n", value);
+	}
+}
+
+/** Print latency histograms for module calls
+ *
+ * Histograms for all calls to the same module instance are merged.
+ */
+void unlang_profile_modules_fprint(FILE *fp, unlang_profile_t const *profile)
+{
+	uint32_t			num_nodes = atomic_load_explicit(&profile->num_nodes, memory_order_acquire);
+	uint32_t			i, j, k;
+	bool				*done;
+
+	if (num_nodes <= 1) return;
+
+	MEM(done = talloc_zero_array(NULL, bool, num_nodes));
+
+	for (i = 1; i < num_nodes; i++) {
+		unlang_profile_node_t const	*node = &profile->nodes[i];
+		module_instance_t const		*mi;
+		uint64_t			hist[UNLANG_PROFILE_HIST_BUCKETS] = {};
+		uint64_t			count = 0;
+		fr_time_delta_t			latency = fr_time_delta_wrap(0);
+
+		if (!node->hist || done[i]) continue;
+
+		mi = unlang_generic_to_module(node->instruction)->mmc.mi;
+
+		for (j = i; j < num_nodes; j++) {
+			unlang_profile_node_t const *other = &profile->nodes[j];
+
+			if (!other->hist || (unlang_generic_to_module(other->instruction)->mmc.mi != mi)) continue;
+
+			done[j] = true;
+			count += other->count;
+			latency = fr_time_delta_add(latency, other->latency);
+			for (k = 0; k < UNLANG_PROFILE_HIST_BUCKETS; k++) hist[k] += other->hist[k];
+		}
+
+		if (!count) continue;
+
+		fprintf(fp, "%s.count\t\t%" PRIu64 "\n", mi->name, count);
+		fprintf(fp, "%s.average\t\t%.9f\n", mi->name,
+			fr_time_delta_unwrap(latency) / (double)count / (double)NSEC);
+
+		for (k = 0; k < UNLANG_PROFILE_HIST_BUCKETS; k++) {
+			if (!hist[k]) continue;
+
+			fprintf(fp, "%s.lt_%" PRIu64 "us\t%" PRIu64 "\n", mi->name, ((uint64_t)1) << k, hist[k]);
+		}
+	}
+
+	talloc_free(done);
+
+	if (profile->dropped) fprintf(fp, "dropped\t\t\t%" PRIu64 "\n", profile->dropped);
+}
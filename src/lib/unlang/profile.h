@@ -0,0 +1,50 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/**
+ * $Id$
+ *
+ * @file unlang/profile.h
+ * @brief Per-thread profiling of unlang instructions.
+ *
+ * @copyright 2025 The FreeRADIUS server project
+ */
+#include <freeradius-devel/util/talloc.h>
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct unlang_profile_s unlang_profile_t;
+
+unlang_profile_t	*unlang_profile_thread_alloc(TALLOC_CTX *ctx, uint32_t max_paths);
+
+void			unlang_profile_enable(unlang_profile_t *profile, bool enable) CC_HINT(nonnull);
+
+bool			unlang_profile_is_enabled(unlang_profile_t const *profile) CC_HINT(nonnull);
+
+void			unlang_profile_reset(unlang_profile_t *profile) CC_HINT(nonnull);
+
+void			unlang_profile_folded_fprint(FILE *fp, unlang_profile_t const *profile, bool yielded) CC_HINT(nonnull);
+
+void			unlang_profile_modules_fprint(FILE *fp, unlang_profile_t const *profile) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,405 @@
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include "profile.c"
+
+/*
+ *	The test plays the part of the interpreter, pushing and popping
+ *	frames, and moving the profiler's clock forward by hand.
+ */
+
+typedef struct {
+	TALLOC_CTX		*ctx;
+	unlang_profile_t	*profile;
+	unlang_stack_t		*stack;
+	module_instance_t	*mi;
+} test_profile_t;
+
+static unlang_t const *test_instructions[6];
+
+static unlang_t const *test_instruction_by_number(unsigned int number)
+{
+	if (number >= NUM_ELEMENTS(test_instructions)) return NULL;
+
+	return test_instructions[number];
+}
+
+static unlang_t *test_instruction_alloc(TALLOC_CTX *ctx, unsigned int number, unlang_type_t type, char const *name)
+{
+	unlang_t *instruction;
+
+	if (type == UNLANG_TYPE_MODULE) {
+		unlang_module_t *single;
+
+		MEM(single = talloc_zero(ctx, unlang_module_t));
+		instruction = unlang_module_to_generic(single);
+	} else {
+		MEM(instruction = talloc_zero(ctx, unlang_t));
+	}
+
+	instruction->name = instruction->debug_name = name;
+	instruction->type = type;
+	instruction->number = number;
+
+	if (number) test_instructions[number] = instruction;
+
+	return instruction;
+}
+
+#define TEST_GROUP	test_instructions[1]
+#define TEST_IF		test_instructions[2]
+#define TEST_SQL	test_instructions[3]
+#define TEST_OTHER_SQL	test_instructions[4]
+#define TEST_ODD	test_instructions[5]
+
+static void test_setup(test_profile_t *test, uint32_t max_paths)
+{
+	*test = (test_profile_t){ .ctx = talloc_init_const("test") };
+
+	test_time_base = fr_time_wrap(1);
+	atomic_store(&unlang_profile_active, 0);
+
+	MEM(test->stack = talloc_zero(test->ctx, unlang_stack_t));
+	test->stack->depth = -1;
+
+	MEM(test->mi = talloc_zero(test->ctx, module_instance_t));
+	test->mi->name = "sql";
+
+	test_instruction_alloc(test->ctx, 1, UNLANG_TYPE_GROUP, "recv Access-Request");
+	test_instruction_alloc(test->ctx, 2, UNLANG_TYPE_IF, "if (User-Name == 'bob')");
+	test_instruction_alloc(test->ctx, 3, UNLANG_TYPE_MODULE, "sql");
+	test_instruction_alloc(test->ctx, 4, UNLANG_TYPE_MODULE, "sql");
+	test_instruction_alloc(test->ctx, 5, UNLANG_TYPE_GROUP, "a;b\nc");
+	unlang_generic_to_module(TEST_SQL)->mmc.mi = test->mi;
+	unlang_generic_to_module(TEST_OTHER_SQL)->mmc.mi = test->mi;
+
+	test->profile = unlang_profile_thread_alloc(test->ctx, max_paths);
+	TEST_ASSERT(test->profile != NULL);
+}
+
+static void test_teardown(test_profile_t *test)
+{
+	talloc_free(test->ctx);
+	memset(test_instructions, 0, sizeof(test_instructions));
+	TEST_CHECK(atomic_load(&unlang_profile_active) == 0);
+}
+
+static void test_advance(int64_t nsec)
+{
+	test_time_base = fr_time_add(test_time_base, fr_time_delta_wrap(nsec));
+}
+
+/** Push a frame, and start running it
+ *
+ */
+static unlang_stack_frame_t *test_push(test_profile_t *test, unlang_t const *instruction)
+{
+	unlang_stack_frame_t *frame;
+
+	if (test->stack->depth >= 0) frame_profile_yield(&test->stack->frame[test->stack->depth], false);
+
+	frame = &test->stack->frame[++test->stack->depth];
+	*frame = (unlang_stack_frame_t){ .instruction = instruction };
+
+	frame_profile_init(test->stack, frame);
+	frame_profile_resume(frame);
+
+	return frame;
+}
+
+/** Complete the frame at the top of the stack, and resume its parent
+ *
+ */
+static void test_pop(test_profile_t *test)
+{
+	frame_profile_cleanup(&test->stack->frame[test->stack->depth--]);
+
+	if (test->stack->depth >= 0) frame_profile_resume(&test->stack->frame[test->stack->depth]);
+}
+
+static char *test_print(test_profile_t *test, int what)
+{
+	char	*buff = NULL;
+	size_t	len = 0;
+	FILE	*fp;
+	char	*out;
+
+	fp = open_memstream(&buff, &len);
+	TEST_ASSERT(fp != NULL);
+
+	switch (what) {
+	case 0:
+		unlang_profile_folded_fprint(fp, test->profile, false);
+		break;
+
+	case 1:
+		unlang_profile_folded_fprint(fp, test->profile, true);
+		break;
+
+	default:
+		unlang_profile_modules_fprint(fp, test->profile);
+		break;
+	}
+	fclose(fp);
+
+	MEM(out = talloc_strdup(test->ctx, buff));
+	free(buff);
+
+	return out;
+}
+
+#define TEST_CPU(_test)		test_print(_test, 0)
+#define TEST_YIELDED(_test)	test_print(_test, 1)
+#define TEST_MODULES(_test)	test_print(_test, 2)
+
+/*
+ *	Nothing is recorded until the profile is enabled.
+ */
+static void test_disabled(void)
+{
+	test_profile_t		test;
+	unlang_stack_frame_t	*frame;
+
+	test_setup(&test, 16);
+
+	TEST_CHECK(!unlang_profile_is_enabled(test.profile));
+
+	frame = test_push(&test, TEST_GROUP);
+	TEST_CHECK(frame->profile.node == 0);
+	test_advance(10);
+	test_pop(&test);
+
+	TEST_CHECK(test.profile->nodes == NULL);
+	TEST_CHECK_STRCMP(TEST_CPU(&test), "");
+
+	TEST_CASE("Enabling is counted once per thread");
+	unlang_profile_enable(test.profile, true);
+	unlang_profile_enable(test.profile, true);
+	TEST_CHECK(atomic_load(&unlang_profile_active) == 1);
+
+	unlang_profile_enable(test.profile, false);
+	TEST_CHECK(atomic_load(&unlang_profile_active) == 0);
+
+	TEST_CASE("A thread only has one profile");
+	TEST_CHECK(unlang_profile_thread_alloc(test.ctx, 16) == NULL);
+
+	test_teardown(&test);
+}
+
+/*
+ *	CPU time is charged to the path of instructions on the stack, and
+ *	not to the parent while a child is running.
+ */
+static void test_cpu(void)
+{
+	test_profile_t		test;
+
+	test_setup(&test, 16);
+	unlang_profile_enable(test.profile, true);
+
+	test_push(&test, TEST_GROUP);
+	test_advance(10);
+	test_push(&test, TEST_IF);
+	test_advance(5);
+	test_pop(&test);
+	test_advance(3);
+	test_pop(&test);
+
+	TEST_CHECK_STRCMP(TEST_CPU(&test),
+			  "recv Access-Request 13\n"
+			  "recv Access-Request;if (User-Name == 'bob') 5\n");
+	TEST_CHECK_STRCMP(TEST_YIELDED(&test), "");
+
+	TEST_CASE("Paths are reused");
+	test_push(&test, TEST_GROUP);
+	test_push(&test, TEST_IF);
+	test_advance(7);
+	test_pop(&test);
+	test_pop(&test);
+
+	TEST_CHECK(atomic_load(&test.profile->num_nodes) == 3);
+	TEST_CHECK(test.profile->nodes[1].count == 2);
+	TEST_CHECK(test.profile->nodes[2].count == 2);
+	TEST_CHECK_STRCMP(TEST_CPU(&test),
+			  "recv Access-Request 13\n"
+			  "recv Access-Request;if (User-Name == 'bob') 12\n");
+
+	TEST_CASE("The same instruction under a different parent is a different path");
+	test_push(&test, TEST_IF);
+	test_advance(1);
+	test_pop(&test);
+
+	TEST_CHECK(atomic_load(&test.profile->num_nodes) == 4);
+	TEST_CHECK_STRCMP(TEST_CPU(&test),
+			  "recv Access-Request 13\n"
+			  "recv Access-Request;if (User-Name == 'bob') 12\n"
+			  "if (User-Name == 'bob') 1\n");
+
+	unlang_profile_enable(test.profile, false);
+	test_teardown(&test);
+}
+
+/*
+ *	Time spent yielded is counted separately, and module calls get a
+ *	latency histogram.
+ */
+static void test_yielded(void)
+{
+	test_profile_t		test;
+	unlang_stack_frame_t	*frame;
+
+	test_setup(&test, 16);
+	unlang_profile_enable(test.profile, true);
+
+	test_push(&test, TEST_GROUP);
+	test_advance(1);
+
+	frame = test_push(&test, TEST_SQL);
+	test_advance(2);
+	frame_profile_yield(frame, true);
+	test_advance(3000);
+	frame_profile_resume(frame);
+	test_advance(1);
+	test_pop(&test);
+
+	test_advance(1);
+	test_pop(&test);
+
+	TEST_CHECK_STRCMP(TEST_CPU(&test),
+			  "recv Access-Request 2\n"
+			  "recv Access-Request;sql 3\n");
+	TEST_CHECK_STRCMP(TEST_YIELDED(&test),
+			  "recv Access-Request;sql 3000\n");
+	TEST_CHECK_STRCMP(TEST_MODULES(&test),
+			  "sql.count\t\t1\n"
+			  "sql.average\t\t0.000003003\n"
+			  "sql.lt_4us\t1\n");
+
+	TEST_CASE("Histograms for calls to the same module instance are merged");
+	test_push(&test, TEST_OTHER_SQL);
+	test_advance(1000001);
+	test_pop(&test);
+
+	TEST_CHECK_STRCMP(TEST_MODULES(&test),
+			  "sql.count\t\t2\n"
+			  "sql.average\t\t0.000501502\n"
+			  "sql.lt_4us\t1\n"
+			  "sql.lt_1024us\t1\n");
+
+	unlang_profile_enable(test.profile, false);
+	test_teardown(&test);
+}
+
+/*
+ *	Instructions pushed at runtime have no number, so their time is
+ *	charged to the instruction which pushed them.
+ */
+static void test_inherited(void)
+{
+	test_profile_t		test;
+	unlang_stack_frame_t	*frame;
+	unlang_t		*xlat;
+
+	test_setup(&test, 16);
+	unlang_profile_enable(test.profile, true);
+
+	xlat = test_instruction_alloc(test.ctx, 0, UNLANG_TYPE_XLAT, "xlat");
+
+	TEST_CASE("Without a profiled parent, runtime instructions are ignored");
+	frame = test_push(&test, xlat);
+	TEST_CHECK(frame->profile.node == 0);
+	test_pop(&test);
+
+	TEST_CASE("Otherwise they're charged to their parent");
+	test_push(&test, TEST_GROUP);
+	test_advance(1);
+	frame = test_push(&test, xlat);
+	TEST_CHECK(frame->profile.inherited);
+	test_advance(4);
+	frame_profile_yield(frame, true);
+	test_advance(20);
+	frame_profile_resume(frame);
+	test_pop(&test);
+	test_pop(&test);
+
+	TEST_CHECK(atomic_load(&test.profile->num_nodes) == 2);
+	TEST_CHECK(test.profile->nodes[1].count == 1);
+	TEST_CHECK_STRCMP(TEST_CPU(&test), "recv Access-Request 5\n");
+	TEST_CHECK_STRCMP(TEST_YIELDED(&test), "recv Access-Request 20\n");
+
+	unlang_profile_enable(test.profile, false);
+	test_teardown(&test);
+}
+
+/*
+ *	Paths past max_paths are counted as dropped, and characters which
+ *	have a meaning in the folded format are replaced.
+ */
+static void test_limits(void)
+{
+	test_profile_t		test;
+	unlang_stack_frame_t	*frame;
+
+	test_setup(&test, 2);
+	unlang_profile_enable(test.profile, true);
+
+	test_push(&test, TEST_ODD);
+	test_advance(1);
+	test_push(&test, TEST_SQL);
+	test_advance(1);
+	frame = test_push(&test, TEST_IF);
+	TEST_CHECK(frame->profile.node == 0);
+	test_advance(1);
+	test_pop(&test);
+	test_pop(&test);
+	test_pop(&test);
+
+	TEST_CHECK_STRCMP(TEST_CPU(&test),
+			  "a:b c 1\n"
+			  "a:b c;sql 1\n");
+	TEST_CHECK(strstr(TEST_MODULES(&test), "dropped\t\t\t1\n") != NULL);
+
+	unlang_profile_enable(test.profile, false);
+	test_teardown(&test);
+}
+
+/*
+ *	Counters are zeroed by the owning thread, the next time it starts
+ *	profiling an instruction.
+ */
+static void test_reset(void)
+{
+	test_profile_t		test;
+
+	test_setup(&test, 16);
+	unlang_profile_enable(test.profile, true);
+
+	test_push(&test, TEST_SQL);
+	test_advance(10);
+	test_pop(&test);
+
+	unlang_profile_reset(test.profile);
+	TEST_CHECK_STRCMP(TEST_CPU(&test), "sql 10\n");
+
+	test_push(&test, TEST_GROUP);
+	test_advance(2);
+	test_pop(&test);
+
+	TEST_CHECK(test.profile->nodes[1].count == 0);
+	TEST_CHECK_STRCMP(TEST_CPU(&test), "recv Access-Request 2\n");
+	TEST_CHECK_STRCMP(TEST_MODULES(&test), "");
+
+	unlang_profile_enable(test.profile, false);
+	test_teardown(&test);
+}
+
+TEST_LIST = {
+	{ "Disabled - Nothing recorded",		test_disabled },
+	{ "CPU - Charged per path",			test_cpu },
+	{ "Yielded - Time and histograms",		test_yielded },
+	{ "Inherited - Runtime instructions",		test_inherited },
+	{ "Limits - Dropped paths and escaping",	test_limits },
+	{ "Reset - Counters zeroed",			test_reset },
+
+	{ NULL }
+};
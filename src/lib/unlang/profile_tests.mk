@@ -0,0 +1,10 @@
+TARGET		:= profile_tests$(E)
+SOURCES		:= profile_tests.c
+
+TGT_LDLIBS	:= $(LIBS) $(GPERFTOOLS_LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS) $(GPERFTOOLS_LDFLAGS)
+
+TGT_PREREQS	:= libfreeradius-util$(L) libfreeradius-server$(L) libfreeradius-unlang$(L)
+SRC_CFLAGS	+= -DTESTING_UNLANG_PROFILE
+
+TGT_INSTALLDIR	:=
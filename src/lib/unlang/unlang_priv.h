@@ -353,6 +353,8 @@ typedef struct {
 
 void	*unlang_thread_instance(unlang_t const *instruction);
 
+unlang_t const *unlang_instruction_by_number(unsigned int number);
+
 #ifdef WITH_PERF
 void		unlang_frame_perf_init(unlang_stack_frame_t *frame);
 void		unlang_frame_perf_yield(unlang_stack_frame_t *frame);
@@ -367,6 +369,28 @@ void		unlang_frame_perf_cleanup(unlang_stack_frame_t *frame);
 
 void	unlang_stack_signal(request_t *request, fr_signal_t action, int limit);
 
+/** What the instruction in a frame is currently doing, for the profiler
+ *
+ */
+typedef enum {
+	UNLANG_PROFILE_STATE_WAITING = 0,		//!< Waiting for a child frame to complete.
+	UNLANG_PROFILE_STATE_RUNNING,			//!< Running on the CPU.
+	UNLANG_PROFILE_STATE_YIELDED			//!< Yielded, waiting for I/O or a timer.
+} unlang_profile_state_t;
+
+/** Profiler state for a single stack frame
+ *
+ */
+typedef struct {
+	uint32_t		node;				//!< Path node time is charged to.  0 if not profiling.
+	unlang_profile_state_t	state;				//!< What the instruction is currently doing.
+	bool			inherited;			//!< Ephemeral instruction charged to its parent's node.
+	fr_time_t		start;				//!< When the instruction started.
+	fr_time_t		mark;				//!< When the current state was entered.
+} unlang_frame_profile_t;
+
+extern atomic_uint_fast32_t unlang_profile_active;
+
 typedef struct {
 	request_t		*request;
 	int			depth;				//!< of this retry structure
@@ -441,6 +465,8 @@ struct unlang_stack_frame_s {
 #ifdef WITH_PERF
 	fr_time_tracking_t	tracking;			//!< track this instance of this instruction
 #endif
+
+	unlang_frame_profile_t	profile;			//!< Per-thread profiler state.
 };
 
 /** An unlang stack associated with a request
@@ -611,6 +637,55 @@ static inline int stack_depth_current(request_t *request)
 	return stack->depth;
 }
 
+void	unlang_profile_frame_init(unlang_stack_t *stack, unlang_stack_frame_t *frame);
+void	unlang_profile_frame_resume(unlang_stack_frame_t *frame);
+void	unlang_profile_frame_yield(unlang_stack_frame_t *frame, bool async);
+void	unlang_profile_frame_cleanup(unlang_stack_frame_t *frame);
+
+/** Start profiling the instruction in a frame
+ *
+ * Nothing is done unless a thread has the profiler enabled, so the cost
+ * when profiling is off is a single relaxed load.
+ */
+static inline CC_HINT(always_inline) void frame_profile_init(unlang_stack_t *stack, unlang_stack_frame_t *frame)
+{
+	if (likely(!atomic_load_explicit(&unlang_profile_active, memory_order_relaxed))) return;
+
+	unlang_profile_frame_init(stack, frame);
+}
+
+/** The instruction in a frame is about to be run
+ *
+ */
+static inline CC_HINT(always_inline) void frame_profile_resume(unlang_stack_frame_t *frame)
+{
+	if (likely(!frame->profile.node)) return;
+
+	unlang_profile_frame_resume(frame);
+}
+
+/** The instruction in a frame has stopped running, but hasn't completed
+ *
+ * @param[in] frame	which stopped running.
+ * @param[in] async	true if it yielded waiting for I/O, false if it pushed a child.
+ */
+static inline CC_HINT(always_inline) void frame_profile_yield(unlang_stack_frame_t *frame, bool async)
+{
+	if (likely(!frame->profile.node)) return;
+
+	unlang_profile_frame_yield(frame, async);
+}
+
+/** The instruction in a frame has completed
+ *
+ */
+static inline CC_HINT(always_inline) void frame_profile_cleanup(unlang_stack_frame_t *frame)
+{
+	if (likely(!frame->profile.node)) return;
+
+	unlang_profile_frame_cleanup(frame);
+}
+
 /** Initialise the result fields in a frame
  *
  * @param[in] result_p	Where to write the result of executing the instruction in the frame.
@@ -641,6 +716,7 @@ static inline void frame_state_init(unlang_stack_t *stack, unlang_stack_frame_t
 	char const	*name;
 
 	unlang_frame_perf_init(frame);
+	frame_profile_init(stack, frame);
 
 	op = &unlang_ops[instruction->type];
 	name = op->frame_state_type ? op->frame_state_type : __location__;
@@ -691,6 +767,7 @@ static inline void frame_state_init(unlang_stack_t *stack, unlang_stack_frame_t
 static inline void frame_cleanup(unlang_stack_frame_t *frame)
 {
 	unlang_frame_perf_cleanup(frame);
+	frame_profile_cleanup(frame);
 
 	/*
 	 *	Don't clear top_frame flag, bad things happen...
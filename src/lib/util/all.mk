@@ -3,12 +3,15 @@ SUBMAKEFILES := \
 	dbuff_tests.mk \
 	dcursor_tests.mk \
 	dcursor_typed_tests.mk \
+	dict_image_tests.mk \
+	dict_perf_test.mk \
 	dlist_tests.mk \
 	edit_tests.mk \
 	heap_tests.mk \
 	hmac_tests.mk \
 	libfreeradius-util.mk \
 	lst_tests.mk \
+	md5_tests.mk \
 	minmax_heap_tests.mk \
 	pair_legacy_tests.mk \
 	pair_list_perf_test.mk \
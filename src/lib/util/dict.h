@@ -903,6 +903,8 @@ fr_dict_gctx_t		*fr_dict_global_ctx_init(TALLOC_CTX *ctx, bool free_at_exit, cha
 
 void			fr_dict_global_ctx_perm_check(fr_dict_gctx_t *gctx, bool enable);
 
+void			fr_dict_global_ctx_images(fr_dict_gctx_t *gctx, bool read, bool write);
+
 void			fr_dict_global_ctx_set(fr_dict_gctx_t const *gctx);
 
 int			fr_dict_global_ctx_free(fr_dict_gctx_t const *gctx);
@@ -49,9 +49,14 @@ extern fr_ext_t const fr_dict_enum_ext_def;
  * cannot have VALUEs, as the child defines their
  * VALUE.  See dict_attr_can_have_children() for details.
  */
+typedef struct fr_dict_attr_child_index_s fr_dict_attr_child_index_t;
+
 typedef struct {
 	fr_hash_table_t		*child_by_name;			//!< Namespace at this level in the hierarchy.
 	fr_dict_attr_t const	**children;			//!< Children of this attribute.
+	fr_dict_attr_child_index_t *index;			//!< Children by number, in a layout which is faster
+								///< to search.  Built when the dictionary is made
+								///< read only, and discarded if children are added.
 } fr_dict_attr_ext_children_t;
 
 DIAG_OFF(attributes)
@@ -0,0 +1,504 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Read and write pre-tokenized dictionary images
+ *
+ * @file src/lib/util/dict_image.c
+ *
+ * @copyright 2025 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/dbuff.h>
+#include <freeradius-devel/util/dict_image_priv.h>
+#include <freeradius-devel/util/nbo.h>
+#include <freeradius-devel/util/strerror.h>
+#include <freeradius-devel/util/syserror.h>
+#include <freeradius-devel/util/version.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#define DICT_IMAGE_MAGIC	"FRDICTIM"
+#define DICT_IMAGE_MAGIC_LEN	8
+#define DICT_IMAGE_VERSION	1
+#define DICT_IMAGE_HDR_LEN	32
+
+#define DICT_IMAGE_MAX_LEN	(64 * 1024 * 1024)	//!< Sanity limit for each section of the image.
+
+typedef enum {
+	DICT_IMAGE_RECORD_FILE_BEGIN = 1,		//!< uint32 file index.
+	DICT_IMAGE_RECORD_FILE_MISSING,			//!< uint32 file index, for $INCLUDE- of a missing file.
+	DICT_IMAGE_RECORD_FILE_END,			//!< No payload.
+	DICT_IMAGE_RECORD_LINE				//!< uint32 line, uint8 argc, { uint16 len, string, '\0' } * argc
+} dict_image_record_t;
+
+struct dict_image_s {
+	uint8_t			*base;			//!< Start of the mapping.
+	size_t			len;			//!< Length of the mapping.
+
+	char const		**files;		//!< Names of the files in the image, indexed by file number.
+	uint32_t		num_files;		//!< How many files the image covers.
+
+	uint8_t			*p;			//!< Next record to read.
+	uint8_t			*end;			//!< End of the records.
+};
+
+struct dict_image_writer_s {
+	fr_dbuff_t		files;			//!< File table.
+	fr_dbuff_uctx_talloc_t	files_tctx;
+	fr_dbuff_t		records;		//!< Tokenized lines, in the order they were processed.
+	fr_dbuff_uctx_talloc_t	records_tctx;
+	uint32_t		num_files;
+	bool			failed;			//!< Ran out of space, or something else went wrong.
+};
+
+static int _dict_image_free(dict_image_t *img)
+{
+	if (img->base) munmap(img->base, img->len);
+
+	return 0;
+}
+
+/** Check whether a file still matches the entry recorded for it in the image
+ *
+ */
+static bool dict_image_file_current(uint8_t const *entry, char const *filename, bool perm_check)
+{
+	struct stat	sb;
+
+	if (stat(filename, &sb) < 0) {
+		/*
+		 *	$INCLUDE- of a file which still doesn't exist
+		 */
+		return entry[24] && (errno == ENOENT);
+	}
+
+	if (entry[24]) return false;			/* File has been created since */
+
+	if (!S_ISREG(sb.st_mode)) return false;
+
+#ifdef S_IWOTH
+	/*
+	 *	Fall back to the text files so that the permission
+	 *	error is produced in the normal way.
+	 */
+	if (perm_check && ((sb.st_mode & S_IWOTH) != 0)) return false;
+#endif
+
+	return (fr_nbo_to_uint64(entry) == (uint64_t) sb.st_size) &&
+	       (fr_nbo_to_uint64(entry + 8) == (uint64_t) sb.st_mtime) &&
+	       (fr_nbo_to_uint64(entry + 16) == (uint64_t) sb.st_ino);
+}
+
+/** Map a dictionary image, and check that it's still valid
+ *
+ * The image is only used if it was written by this version of the
+ * library, and if every file it was generated from still has the
+ * same size, modification time and inode.  Any failure means the
+ * caller should read the text files instead, so no error is
+ * produced.
+ *
+ * @param[in] ctx		to allocate the image handle in.
+ * @param[in] image_file	Path to the image.
+ * @param[in] filename		Top level dictionary file the image must have been
+ *				generated from.
+ * @param[in] perm_check	Whether to reject world writable files.
+ * @return
+ *	- An image handle, positioned at the first record.
+ *	- NULL if the image doesn't exist, or is stale.
+ */
+dict_image_t *dict_image_open(TALLOC_CTX *ctx, char const *image_file, char const *filename, bool perm_check)
+{
+	dict_image_t	*img;
+	int		fd;
+	struct stat	sb;
+	void		*base;
+	uint8_t		*p, *files_end;
+	uint32_t	files_len, records_len, i;
+
+	fd = open(image_file, O_RDONLY);
+	if (fd < 0) return NULL;
+
+	if ((fstat(fd, &sb) < 0) || !S_ISREG(sb.st_mode) || (sb.st_size < DICT_IMAGE_HDR_LEN)) {
+	error_close:
+		close(fd);
+		return NULL;
+	}
+
+#ifdef S_IWOTH
+	if (perm_check && ((sb.st_mode & S_IWOTH) != 0)) goto error_close;
+#endif
+
+	/*
+	 *	Private and writable, so that the keyword handlers can
+	 *	modify the argv strings in place, as they do with the
+	 *	line buffer when reading text files.
+	 */
+	base = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) return NULL;
+
+	img = talloc_zero(ctx, dict_image_t);
+	if (!img) {
+		munmap(base, sb.st_size);
+		return NULL;
+	}
+	img->base = base;
+	img->len = sb.st_size;
+	talloc_set_destructor(img, _dict_image_free);
+
+	p = img->base;
+	if ((memcmp(p, DICT_IMAGE_MAGIC, DICT_IMAGE_MAGIC_LEN) != 0) ||
+	    (fr_nbo_to_uint32(p + 8) != DICT_IMAGE_VERSION) ||
+	    (fr_nbo_to_uint64(p + 12) != RADIUSD_MAGIC_NUMBER)) {
+	error:
+		talloc_free(img);
+		return NULL;
+	}
+
+	img->num_files = fr_nbo_to_uint32(p + 20);
+	files_len = fr_nbo_to_uint32(p + 24);
+	records_len = fr_nbo_to_uint32(p + 28);
+	if (((uint64_t) DICT_IMAGE_HDR_LEN + files_len + records_len) != img->len) goto error;
+	if (img->num_files == 0) goto error;
+
+	p += DICT_IMAGE_HDR_LEN;
+	files_end = p + files_len;
+
+	img->files = talloc_array(img, char const *, img->num_files);
+	if (!img->files) goto error;
+	for (i = 0; i < img->num_files; i++) {
+		uint8_t		*entry = p;
+		uint16_t	path_len;
+
+		if ((files_end - p) < 27) goto error;
+		path_len = fr_nbo_to_uint16(p + 25);
+		p += 27;
+
+		if (((files_end - p) <= path_len) || (p[path_len] != '\0')) goto error;
+		img->files[i] = (char const *) p;
+		p += path_len + 1;
+
+		if (!dict_image_file_current(entry, img->files[i], perm_check)) goto error;
+	}
+	if (p != files_end) goto error;
+
+	if (strcmp(img->files[0], filename) != 0) goto error;
+
+	img->p = p;
+	img->end = p + records_len;
+
+	return img;
+}
+
+/** Enter a file in the image
+ *
+ * Must be called in the same order the tokenizer opened the files
+ * when the image was generated.
+ *
+ * @param[in] img		to read from.
+ * @param[in] filename		the tokenizer is about to read.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the image doesn't match what the tokenizer is doing.
+ *	- -2 if the file was missing when the image was generated.
+ */
+int dict_image_file_begin(dict_image_t *img, char const *filename)
+{
+	uint8_t		type;
+	uint32_t	idx;
+
+	if ((img->end - img->p) < 5) goto out_of_sync;
+
+	type = img->p[0];
+	idx = fr_nbo_to_uint32(img->p + 1);
+
+	if ((type != DICT_IMAGE_RECORD_FILE_BEGIN) && (type != DICT_IMAGE_RECORD_FILE_MISSING)) goto out_of_sync;
+	if ((idx >= img->num_files) || (strcmp(img->files[idx], filename) != 0)) goto out_of_sync;
+
+	img->p += 5;
+
+	if (type == DICT_IMAGE_RECORD_FILE_MISSING) {
+		fr_strerror_printf_push("Couldn't open dictionary %s: %s", filename, fr_syserror(ENOENT));
+		return -2;
+	}
+
+	return 0;
+
+out_of_sync:
+	fr_strerror_printf_push("Dictionary image does not match %s, regenerate it with radict -C", filename);
+	return -1;
+}
+
+/** Return the next tokenized line from the current file
+ *
+ * @param[in] img		to read from.
+ * @param[out] line		Line number the entry was found on.
+ * @param[out] argv		Set to point at the strings in the image.
+ * @param[in] max_argc		Number of elements in argv.
+ * @param[out] argc		Number of strings written to argv.
+ * @return
+ *	- 1 if a line was read.
+ *	- 0 at the end of the current file.
+ *	- -1 if the image is malformed.
+ */
+int dict_image_line(dict_image_t *img, int *line, char **argv, int max_argc, int *argc)
+{
+	uint8_t		*p = img->p;
+	int		i, num;
+
+	if (p >= img->end) goto malformed;
+
+	switch (*p) {
+	case DICT_IMAGE_RECORD_FILE_END:
+		img->p = p + 1;
+		return 0;
+
+	case DICT_IMAGE_RECORD_LINE:
+		break;
+
+	default:
+		goto malformed;
+	}
+
+	if ((img->end - p) < 6) goto malformed;
+	*line = fr_nbo_to_uint32(p + 1);
+	num = p[5];
+	if (num > max_argc) goto malformed;
+	p += 6;
+
+	for (i = 0; i < num; i++) {
+		uint16_t len;
+
+		if ((img->end - p) < 2) goto malformed;
+		len = fr_nbo_to_uint16(p);
+		p += 2;
+
+		if (((img->end - p) <= len) || (p[len] != '\0')) goto malformed;
+		argv[i] = (char *) p;
+		p += len + 1;
+	}
+
+	*argc = num;
+	img->p = p;
+
+	return 1;
+
+malformed:
+	fr_strerror_const_push("Dictionary image is malformed, regenerate it with radict -C");
+	return -1;
+}
+
+/** Allocate a new image writer
+ *
+ * @param[in] ctx	to allocate the writer in.
+ * @return
+ *	- A new writer.
+ *	- NULL on failure.
+ */
+dict_image_writer_t *dict_image_writer_alloc(TALLOC_CTX *ctx)
+{
+	dict_image_writer_t *w;
+
+	w = talloc_zero(ctx, dict_image_writer_t);
+	if (!w) {
+	oom:
+		fr_strerror_const("Out of memory");
+		return NULL;
+	}
+
+	if (!fr_dbuff_init_talloc(w, &w->files, &w->files_tctx, 4096, DICT_IMAGE_MAX_LEN) ||
+	    !fr_dbuff_init_talloc(w, &w->records, &w->records_tctx, 64 * 1024, DICT_IMAGE_MAX_LEN)) {
+		talloc_free(w);
+		goto oom;
+	}
+
+	return w;
+}
+
+static ssize_t dict_image_writer_file_add(dict_image_writer_t *w, char const *filename, struct stat const *sb)
+{
+	fr_dbuff_t	work_dbuff = FR_DBUFF(&w->files);
+	size_t		len = strlen(filename);
+
+	if (len > UINT16_MAX) return -1;
+
+	FR_DBUFF_IN_RETURN(&work_dbuff, (uint64_t) (sb ? sb->st_size : 0));
+	FR_DBUFF_IN_RETURN(&work_dbuff, (uint64_t) (sb ? sb->st_mtime : 0));
+	FR_DBUFF_IN_RETURN(&work_dbuff, (uint64_t) (sb ? sb->st_ino : 0));
+	FR_DBUFF_IN_RETURN(&work_dbuff, (uint8_t) (sb == NULL));
+	FR_DBUFF_IN_RETURN(&work_dbuff, (uint16_t) len);
+	FR_DBUFF_IN_MEMCPY_RETURN(&work_dbuff, filename, len + 1);
+
+	return fr_dbuff_set(&w->files, &work_dbuff);
+}
+
+static ssize_t dict_image_writer_file_record(dict_image_writer_t *w, dict_image_record_t type,
+					     char const *filename, struct stat const *sb)
+{
+	fr_dbuff_t	work_dbuff = FR_DBUFF(&w->records);
+	uint32_t	idx = w->num_files;
+
+	if (dict_image_writer_file_add(w, filename, sb) < 0) return -1;
+
+	FR_DBUFF_IN_RETURN(&work_dbuff, (uint8_t) type);
+	FR_DBUFF_IN_RETURN(&work_dbuff, idx);
+
+	w->num_files++;
+
+	return fr_dbuff_set(&w->records, &work_dbuff);
+}
+
+/** Record that the tokenizer has opened a file
+ *
+ * @param[in] w		to record the file in.
+ * @param[in] filename	that was opened.
+ * @param[in] sb	from stating the file, used to detect changes.
+ */
+void dict_image_writer_file_begin(dict_image_writer_t *w, char const *filename, struct stat const *sb)
+{
+	if (dict_image_writer_file_record(w, DICT_IMAGE_RECORD_FILE_BEGIN, filename, sb) < 0) w->failed = true;
+}
+
+/** Record that a file couldn't be opened
+ *
+ * This is only useful for $INCLUDE-, any other missing file is fatal.
+ *
+ * @param[in] w		to record the file in.
+ * @param[in] filename	that was missing.
+ */
+void dict_image_writer_file_missing(dict_image_writer_t *w, char const *filename)
+{
+	if (dict_image_writer_file_record(w, DICT_IMAGE_RECORD_FILE_MISSING, filename, NULL) < 0) w->failed = true;
+}
+
+/** Record that the tokenizer has finished reading a file
+ *
+ * @param[in] w		to record the end of file in.
+ */
+void dict_image_writer_file_end(dict_image_writer_t *w)
+{
+	if (fr_dbuff_in(&w->records, (uint8_t) DICT_IMAGE_RECORD_FILE_END) < 0) w->failed = true;
+}
+
+static ssize_t dict_image_writer_line_record(dict_image_writer_t *w, int line, char **argv, int argc)
+{
+	fr_dbuff_t	work_dbuff = FR_DBUFF(&w->records);
+	int		i;
+
+	if (argc > UINT8_MAX) return -1;
+
+	FR_DBUFF_IN_RETURN(&work_dbuff, (uint8_t) DICT_IMAGE_RECORD_LINE);
+	FR_DBUFF_IN_RETURN(&work_dbuff, (uint32_t) line);
+	FR_DBUFF_IN_RETURN(&work_dbuff, (uint8_t) argc);
+
+	for (i = 0; i < argc; i++) {
+		size_t len = strlen(argv[i]);
+
+		if (len > UINT16_MAX) return -1;
+
+		FR_DBUFF_IN_RETURN(&work_dbuff, (uint16_t) len);
+		FR_DBUFF_IN_MEMCPY_RETURN(&work_dbuff, argv[i], len + 1);
+	}
+
+	return fr_dbuff_set(&w->records, &work_dbuff);
+}
+
+/** Record a tokenized line
+ *
+ * Must be called before the line is processed, as the keyword
+ * handlers may modify the strings.
+ *
+ * @param[in] w		to record the line in.
+ * @param[in] line	number in the current file.
+ * @param[in] argv	as produced by #fr_dict_str_to_argv.
+ * @param[in] argc	Number of elements in argv.
+ */
+void dict_image_writer_line(dict_image_writer_t *w, int line, char **argv, int argc)
+{
+	if (dict_image_writer_line_record(w, line, argv, argc) < 0) w->failed = true;
+}
+
+/** Write an image to disk
+ *
+ * The image is written to a temporary file, which is then renamed
+ * over the old image, so readers never see a partial image.
+ *
+ * @param[in] w			to write out.
+ * @param[in] image_file	Where to write the image.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int dict_image_writer_commit(dict_image_writer_t *w, char const *image_file)
+{
+	uint8_t		hdr[DICT_IMAGE_HDR_LEN];
+	char		*tmp;
+	FILE		*fp;
+	size_t		files_len = fr_dbuff_used(&w->files);
+	size_t		records_len = fr_dbuff_used(&w->records);
+
+	if (w->failed) {
+		fr_strerror_printf("Failed generating dictionary image %s", image_file);
+		return -1;
+	}
+
+	memcpy(hdr, DICT_IMAGE_MAGIC, DICT_IMAGE_MAGIC_LEN);
+	fr_nbo_from_uint32(hdr + 8, DICT_IMAGE_VERSION);
+	fr_nbo_from_uint64(hdr + 12, RADIUSD_MAGIC_NUMBER);
+	fr_nbo_from_uint32(hdr + 20, w->num_files);
+	fr_nbo_from_uint32(hdr + 24, (uint32_t) files_len);
+	fr_nbo_from_uint32(hdr + 28, (uint32_t) records_len);
+
+	tmp = talloc_asprintf(w, "%s.tmp", image_file);
+	if (!tmp) {
+		fr_strerror_const("Out of memory");
+		return -1;
+	}
+
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		fr_strerror_printf("Failed opening %s: %s", tmp, fr_syserror(errno));
+	error:
+		talloc_free(tmp);
+		return -1;
+	}
+
+	if ((fwrite(hdr, sizeof(hdr), 1, fp) != 1) ||
+	    (files_len && (fwrite(fr_dbuff_start(&w->files), files_len, 1, fp) != 1)) ||
+	    (records_len && (fwrite(fr_dbuff_start(&w->records), records_len, 1, fp) != 1))) {
+		fr_strerror_printf("Failed writing %s: %s", tmp, fr_syserror(errno));
+		fclose(fp);
+	error_unlink:
+		unlink(tmp);
+		goto error;
+	}
+
+	if (fclose(fp) != 0) {
+		fr_strerror_printf("Failed writing %s: %s", tmp, fr_syserror(errno));
+		goto error_unlink;
+	}
+
+	if (rename(tmp, image_file) < 0) {
+		fr_strerror_printf("Failed renaming %s to %s: %s", tmp, image_file, fr_syserror(errno));
+		goto error_unlink;
+	}
+
+	talloc_free(tmp);
+
+	return 0;
+}
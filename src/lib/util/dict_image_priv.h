@@ -0,0 +1,82 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Pre-tokenized dictionary images
+ *
+ * An image holds the tokenized contents of a dictionary file, and of
+ * every file it $INCLUDEs, in the order the tokenizer visited them.
+ * Loading from an image skips file I/O and tokenization, the records
+ * are fed through the same keyword handlers as the text files.
+ *
+ * All integers are in network byte order.
+ *
+ *	header	"FRDICTIM", uint32 version, uint64 library magic,
+ *		uint32 num_files, uint32 files_len, uint32 records_len
+ *	files	{ uint64 size, uint64 mtime, uint64 inode, uint8 missing,
+ *		  uint16 path_len, path, '\0' } * num_files
+ *	records	{ uint8 type, ... }
+ *
+ * @file src/lib/util/dict_image_priv.h
+ *
+ * @copyright 2025 The FreeRADIUS server project
+ */
+RCSIDH(dict_image_priv_h, "$Id$")
+
+#include <freeradius-devel/util/talloc.h>
+
+#include <sys/stat.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DICT_IMAGE_SUFFIX	".image"		//!< Appended to the name of the top level dictionary file.
+
+typedef struct dict_image_s dict_image_t;
+typedef struct dict_image_writer_s dict_image_writer_t;
+
+/** @name Reading images
+ *
+ * @{
+ */
+dict_image_t		*dict_image_open(TALLOC_CTX *ctx, char const *image_file, char const *filename, bool perm_check);
+
+int			dict_image_file_begin(dict_image_t *img, char const *filename);
+
+int			dict_image_line(dict_image_t *img, int *line, char **argv, int max_argc, int *argc);
+/** @} */
+
+/** @name Writing images
+ *
+ * @{
+ */
+dict_image_writer_t	*dict_image_writer_alloc(TALLOC_CTX *ctx);
+
+void			dict_image_writer_file_begin(dict_image_writer_t *w, char const *filename, struct stat const *sb);
+
+void			dict_image_writer_file_missing(dict_image_writer_t *w, char const *filename);
+
+void			dict_image_writer_file_end(dict_image_writer_t *w);
+
+void			dict_image_writer_line(dict_image_writer_t *w, int line, char **argv, int argc);
+
+int			dict_image_writer_commit(dict_image_writer_t *w, char const *image_file);
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,321 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for pre-tokenized dictionary images
+ *
+ * @file src/lib/util/dict_image_tests.c
+ *
+ * @copyright 2025 The FreeRADIUS server project
+ */
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include <freeradius-devel/util/dict.h>
+#include <freeradius-devel/util/dict_image_priv.h>
+#include <freeradius-devel/util/file.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+static char const *test_main = \
+	"ATTRIBUTE	Image-Test-String	1	string\n"
+	"$INCLUDE dictionary.include\n"
+	"$INCLUDE- dictionary.missing\n";
+
+static char const *test_include = \
+	"# Comments aren't in the image\n"
+	"ATTRIBUTE	Image-Test-Integer	2	uint32\n"
+	"VALUE	Image-Test-Integer	One	1\n";
+
+typedef struct {
+	TALLOC_CTX		*ctx;
+	fr_dict_gctx_t		*gctx;
+	char			dir[64];
+	char			*image;
+	unsigned int		proto;
+} test_env_t;
+
+static void test_write_file(char const *dir, char const *name, char const *contents)
+{
+	char	path[128];
+	FILE	*fp;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fp = fopen(path, "w");
+	TEST_ASSERT(fp != NULL);
+	TEST_ASSERT(fputs(contents, fp) >= 0);
+	fclose(fp);
+}
+
+/** Replace the first occurrence of a string in a file, without changing its size, inode or mtime
+ *
+ * The image can only tell that the file changed by its contents.
+ */
+static void test_rewrite_in_place(char const *dir, char const *name, char const *from, char const *to)
+{
+	char		path[128], buff[512], *p;
+	struct stat	sb;
+	struct timespec	times[2];
+	ssize_t		len;
+	int		fd;
+
+	TEST_ASSERT(strlen(from) == strlen(to));
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	TEST_ASSERT(stat(path, &sb) == 0);
+
+	fd = open(path, O_RDWR);
+	TEST_ASSERT(fd >= 0);
+	len = read(fd, buff, sizeof(buff) - 1);
+	TEST_ASSERT(len > 0);
+	buff[len] = '\0';
+
+	p = strstr(buff, from);
+	TEST_ASSERT(p != NULL);
+	memcpy(p, to, strlen(to));
+
+	TEST_ASSERT(pwrite(fd, buff, len, 0) == len);
+	close(fd);
+
+	times[0] = (struct timespec){ .tv_sec = sb.st_atime };
+	times[1] = (struct timespec){ .tv_sec = sb.st_mtime };
+	TEST_ASSERT(utimensat(AT_FDCWD, path, times, 0) == 0);
+}
+
+/** Move the mtime of a file, so it no longer matches the image
+ *
+ */
+static void test_touch(char const *dir, char const *name)
+{
+	char		path[128];
+	struct stat	sb;
+	struct timespec	times[2];
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	TEST_ASSERT(stat(path, &sb) == 0);
+
+	times[0] = (struct timespec){ .tv_sec = sb.st_atime };
+	times[1] = (struct timespec){ .tv_sec = sb.st_mtime + 10 };
+	TEST_ASSERT(utimensat(AT_FDCWD, path, times, 0) == 0);
+}
+
+static void test_env_init(test_env_t *env)
+{
+	memset(env, 0, sizeof(*env));
+
+	env->ctx = talloc_init_const("test");
+	TEST_ASSERT(env->ctx != NULL);
+
+	strlcpy(env->dir, "/tmp/dict_image_tests.XXXXXX", sizeof(env->dir));
+	TEST_ASSERT(mkdtemp(env->dir) != NULL);
+
+	test_write_file(env->dir, "dictionary", test_main);
+	test_write_file(env->dir, "dictionary.include", test_include);
+
+	env->image = talloc_asprintf(env->ctx, "%s/dictionary" DICT_IMAGE_SUFFIX, env->dir);
+
+	env->gctx = fr_dict_global_ctx_init(env->ctx, false, "share/dictionary");
+	TEST_ASSERT(env->gctx != NULL);
+	fr_dict_global_ctx_set(env->gctx);
+}
+
+static void test_env_free(test_env_t *env)
+{
+	char const *names[] = { "dictionary", "dictionary.include", "dictionary.missing", "dictionary" DICT_IMAGE_SUFFIX };
+	char path[128];
+	size_t i;
+
+	for (i = 0; i < NUM_ELEMENTS(names); i++) {
+		snprintf(path, sizeof(path), "%s/%s", env->dir, names[i]);
+		unlink(path);
+	}
+	rmdir(env->dir);
+
+	TEST_CHECK(fr_dict_global_ctx_free(env->gctx) == 0);
+	talloc_free(env->ctx);
+}
+
+/** Load the test dictionary, with images enabled or disabled
+ *
+ */
+static fr_dict_t *test_load(test_env_t *env, bool read, bool write)
+{
+	fr_dict_t *dict;
+
+	fr_dict_global_ctx_images(env->gctx, read, write);
+
+	dict = fr_dict_alloc("image", 4000 + env->proto++);
+	TEST_ASSERT(dict != NULL);
+
+	TEST_CHECK(fr_dict_read(dict, env->dir, "dictionary") == 0);
+	TEST_MSG("Failed loading dictionary: %s", fr_strerror());
+
+	return dict;
+}
+
+static bool test_has_attr(fr_dict_t *dict, char const *name)
+{
+	return fr_dict_attr_by_name(NULL, fr_dict_root(dict), name) != NULL;
+}
+
+static bool test_has_enum(fr_dict_t *dict, char const *name)
+{
+	fr_dict_attr_t const *da;
+
+	da = fr_dict_attr_by_name(NULL, fr_dict_root(dict), "Image-Test-Integer");
+	if (!da) return false;
+
+	return fr_dict_enum_by_name(da, name, -1) != NULL;
+}
+
+static void test_generate(void)
+{
+	test_env_t		env;
+	fr_dict_t		*dict;
+	fr_dict_attr_t const	*da;
+
+	test_env_init(&env);
+
+	TEST_CASE("Images aren't written unless asked for");
+	dict = test_load(&env, true, false);
+	TEST_CHECK(access(env.image, F_OK) < 0);
+	talloc_free(dict);
+
+	TEST_CASE("Images are written next to the top level file");
+	dict = test_load(&env, false, true);
+	TEST_CHECK(access(env.image, F_OK) == 0);
+	talloc_free(dict);
+
+	TEST_CASE("Dictionaries loaded from images match the text files");
+	dict = test_load(&env, true, false);
+	TEST_CHECK(test_has_attr(dict, "Image-Test-String"));
+	da = fr_dict_attr_by_name(NULL, fr_dict_root(dict), "Image-Test-Integer");
+	TEST_ASSERT(da != NULL);
+	TEST_CHECK(da->type == FR_TYPE_UINT32);
+	TEST_CHECK(fr_dict_enum_by_name(da, "One", -1) != NULL);
+	TEST_CHECK(da->line == 2);
+	TEST_MSG("Expected line 2, got %i", da->line);
+	talloc_free(dict);
+
+	test_env_free(&env);
+}
+
+static void test_read(void)
+{
+	test_env_t	env;
+	fr_dict_t	*dict;
+
+	test_env_init(&env);
+
+	dict = test_load(&env, false, true);
+	talloc_free(dict);
+
+	/*
+	 *	Same size, inode and mtime, so the image still
+	 *	looks current, and the text file isn't read.
+	 */
+	test_rewrite_in_place(env.dir, "dictionary.include", "One", "Two");
+
+	TEST_CASE("Current images are used instead of the text files");
+	dict = test_load(&env, true, false);
+	TEST_CHECK(test_has_enum(dict, "One"));
+	TEST_CHECK(!test_has_enum(dict, "Two"));
+	talloc_free(dict);
+
+	TEST_CASE("Images are ignored when disabled");
+	dict = test_load(&env, false, false);
+	TEST_CHECK(!test_has_enum(dict, "One"));
+	TEST_CHECK(test_has_enum(dict, "Two"));
+	talloc_free(dict);
+
+	test_env_free(&env);
+}
+
+static void test_stale(void)
+{
+	test_env_t	env;
+	fr_dict_t	*dict;
+
+	test_env_init(&env);
+
+	dict = test_load(&env, false, true);
+	talloc_free(dict);
+
+	TEST_CASE("Images are ignored if an included file changes");
+	test_rewrite_in_place(env.dir, "dictionary.include", "One", "Two");
+	test_touch(env.dir, "dictionary.include");
+
+	dict = test_load(&env, true, false);
+	TEST_CHECK(test_has_enum(dict, "Two"));
+	talloc_free(dict);
+
+	TEST_CASE("Images are ignored if a missing $INCLUDE- file appears");
+	dict = test_load(&env, false, true);
+	talloc_free(dict);
+
+	test_write_file(env.dir, "dictionary.missing", "ATTRIBUTE	Image-Test-Missing	3	string\n");
+
+	dict = test_load(&env, true, false);
+	TEST_CHECK(test_has_attr(dict, "Image-Test-Missing"));
+	talloc_free(dict);
+
+	test_env_free(&env);
+}
+
+static void test_corrupt(void)
+{
+	test_env_t	env;
+	fr_dict_t	*dict;
+	int		fd;
+
+	test_env_init(&env);
+
+	dict = test_load(&env, false, true);
+	talloc_free(dict);
+
+	test_rewrite_in_place(env.dir, "dictionary.include", "One", "Two");
+
+	TEST_CASE("Images with the wrong magic are ignored");
+	fd = open(env.image, O_WRONLY);
+	TEST_ASSERT(fd >= 0);
+	TEST_CHECK(pwrite(fd, "X", 1, 0) == 1);
+	close(fd);
+
+	dict = test_load(&env, true, false);
+	TEST_CHECK(test_has_enum(dict, "Two"));
+	talloc_free(dict);
+
+	TEST_CASE("Truncated images are ignored");
+	dict = test_load(&env, false, true);
+	talloc_free(dict);
+	test_rewrite_in_place(env.dir, "dictionary.include", "Two", "One");
+	TEST_CHECK(truncate(env.image, 40) == 0);
+
+	dict = test_load(&env, true, false);
+	TEST_CHECK(test_has_enum(dict, "One"));
+	talloc_free(dict);
+
+	test_env_free(&env);
+}
+
+TEST_LIST = {
+	{ "Generate - writing images",			test_generate },
+	{ "Read - images used instead of text",		test_read },
+	{ "Stale - changed files fall back to text",	test_stale },
+	{ "Corrupt - bad images fall back to text",	test_corrupt },
+
+	{ NULL }
+};
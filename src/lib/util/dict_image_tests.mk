@@ -0,0 +1,7 @@
+TARGET		:= dict_image_tests$(E)
+SOURCES		:= dict_image_tests.c
+
+TGT_LDLIBS	:= $(LIBS)
+TGT_PREREQS	:= libfreeradius-util$(L)
+
+TGT_INSTALLDIR	:=
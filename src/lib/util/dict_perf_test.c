@@ -0,0 +1,163 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Performance tests for looking up dictionary attributes by number
+ *
+ * @file src/lib/util/dict_perf_test.c
+ *
+ * @copyright 2025 The FreeRADIUS server project
+ */
+
+/*
+ *	Initialise from a constructor, so that the dictionary is only
+ *	built once, rather than for every test.
+ */
+static void dict_perf_init(void) __attribute__((constructor));
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/dict_priv.h>
+#include <freeradius-devel/util/dict_test.h>
+#include <freeradius-devel/util/time.h>
+
+#define NUM_VENDORS	1000				//!< Children of Test-VSA.
+#define NUM_ROOT	600				//!< Numbers to look up in the root.
+#define LOOKUP_REPS	2000
+
+/*
+ *	Spread the vendors out, so they don't form a contiguous range.
+ */
+#define TEST_VENDOR_PEN(_i)	(100000 + ((_i) * 7919))
+
+static fr_dict_t	*test_dict;
+static TALLOC_CTX	*autofree;
+
+static unsigned int	root_nums[NUM_ROOT];
+static unsigned int	vendor_nums[NUM_VENDORS * 2];	//!< Every vendor, and a number which misses.
+
+void dict_perf_init(void)
+{
+	fr_dict_attr_flags_t	flags = {};
+	unsigned int		i;
+
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("dict_perf_test");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) goto error;
+
+	if (fr_dict_test_init(autofree, &test_dict, NULL) < 0) goto error;
+
+	/*
+	 *	Root attributes numbered up to ~550, so some bins
+	 *	have chains.
+	 */
+	for (i = 1; i <= 5; i++) {
+		if (fr_dict_test_attrs_init(test_dict, fr_dict_test_attrs, i * 100, i) < 0) goto error;
+	}
+
+	for (i = 0; i < NUM_VENDORS; i++) {
+		char name[32];
+
+		snprintf(name, sizeof(name), "Test-Vendor-%u", i);
+		if (fr_dict_attr_add(test_dict, fr_dict_attr_test_vsa, name,
+				     TEST_VENDOR_PEN(i), FR_TYPE_VENDOR, &flags) < 0) goto error;
+
+		vendor_nums[i * 2] = TEST_VENDOR_PEN(i);
+		vendor_nums[(i * 2) + 1] = TEST_VENDOR_PEN(i) + 1;
+	}
+
+	for (i = 0; i < NUM_ROOT; i++) root_nums[i] = i;
+
+	fr_time_start();
+}
+
+static fr_time_delta_t do_lookups(fr_dict_attr_t const **out,
+				  fr_dict_attr_t const *parent, unsigned int const *nums, size_t count)
+{
+	fr_time_t	start;
+	unsigned int	i;
+	size_t		j;
+
+	start = fr_time();
+	for (i = 0; i < LOOKUP_REPS; i++) {
+		for (j = 0; j < count; j++) out[j] = fr_dict_attr_child_by_num(parent, nums[j]);
+	}
+
+	return fr_time_sub(fr_time(), start);
+}
+
+/** Look up children by number, first by searching the bins, and then with the index
+ *
+ * Both searches must return the same attributes.
+ */
+static void do_test_child_by_num(fr_dict_attr_t const *parent, unsigned int const *nums, size_t count)
+{
+	fr_dict_attr_t const	**bins_out, **index_out;
+	fr_time_delta_t		bins, indexed;
+	size_t			i;
+
+	bins_out = talloc_array(autofree, fr_dict_attr_t const *, count);
+	index_out = talloc_array(autofree, fr_dict_attr_t const *, count);
+	TEST_ASSERT(bins_out && index_out);
+
+	bins = do_lookups(bins_out, parent, nums, count);
+
+	dict_attr_child_indexes_build(test_dict);
+
+	indexed = do_lookups(index_out, parent, nums, count);
+
+	for (i = 0; i < count; i++) {
+		TEST_CHECK(bins_out[i] == index_out[i]);
+		TEST_MSG("Lookup of %u in %s differs", nums[i], parent->name);
+	}
+
+	TEST_MSG_ALWAYS("parent=%s", parent->name);
+	TEST_MSG_ALWAYS("lookups=%zu", count * LOOKUP_REPS);
+	TEST_MSG_ALWAYS("bins_per_sec=%0.0lf", (count * LOOKUP_REPS) / (fr_time_delta_unwrap(bins) / (double)NSEC));
+	TEST_MSG_ALWAYS("index_per_sec=%0.0lf", (count * LOOKUP_REPS) / (fr_time_delta_unwrap(indexed) / (double)NSEC));
+
+	talloc_free(bins_out);
+	talloc_free(index_out);
+}
+
+/*
+ *	Contiguous number space, uses the dense array.
+ */
+static void test_child_by_num_dense(void)
+{
+	do_test_child_by_num(fr_dict_root(test_dict), root_nums, NUM_ELEMENTS(root_nums));
+}
+
+/*
+ *	Sparse number space, uses the hash table.
+ */
+static void test_child_by_num_sparse(void)
+{
+	do_test_child_by_num(fr_dict_attr_test_vsa, vendor_nums, NUM_ELEMENTS(vendor_nums));
+}
+
+TEST_LIST = {
+	{ "child_by_num_dense",		test_child_by_num_dense },
+	{ "child_by_num_sparse",	test_child_by_num_sparse },
+
+	{ NULL }
+};
@@ -0,0 +1,7 @@
+TARGET		:= dict_perf_test$(E)
+SOURCES		:= dict_perf_test.c
+
+TGT_LDLIBS	:= $(LIBS)
+TGT_PREREQS	:= libfreeradius-util$(L)
+
+TGT_INSTALLDIR	:=
@@ -134,6 +134,11 @@ struct fr_dict_gctx_s {
 
 	bool			read_only;
 
+	bool			image_read;		//!< Load dictionaries from pre-tokenized images
+							///< where they're available and up to date.
+
+	bool			image_write;		//!< Generate images for dictionaries as they're loaded.
+
 	char			*dict_dir_default;	//!< The default location for loading dictionaries if one
 							///< wasn't provided.
 
@@ -267,8 +272,14 @@ bool			dict_attr_valid(fr_dict_attr_t *da);
 
 fr_dict_attr_t		*dict_attr_by_name(fr_dict_attr_err_t *err, fr_dict_attr_t const *parent, char const *name);
 
+fr_dict_attr_t const	*dict_attr_dup_by_name(fr_dict_attr_t const *parent, char const *name) CC_HINT(nonnull);
+
 fr_dict_attr_t		*dict_attr_child_by_num(fr_dict_attr_t const *parent, unsigned int attr);
 
+void			dict_attr_child_indexes_build(fr_dict_t *dict);
+
+void			dict_attr_child_indexes_free(fr_dict_t *dict);
+
 fr_slen_t		dict_by_protocol_substr(fr_dict_attr_err_t *err,
 						fr_dict_t **out, fr_sbuff_t *name, fr_dict_t const *dict_def);
 
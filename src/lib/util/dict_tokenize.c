@@ -26,6 +26,7 @@ RCSID("$Id$")
 #include <freeradius-devel/radius/defs.h>
 #include <freeradius-devel/util/conf.h>
 #include <freeradius-devel/util/dict_fixup_priv.h>
+#include <freeradius-devel/util/dict_image_priv.h>
 #include <freeradius-devel/util/file.h>
 #include <freeradius-devel/util/rand.h>
 #include <freeradius-devel/util/syserror.h>
@@ -91,6 +92,11 @@ struct dict_tokenize_ctx_s {
 	fr_dict_attr_t		*value_attr;		//!< Cache of last attribute to speed up value processing.
 	fr_dict_attr_t const   	*relative_attr;		//!< for ".82" instead of "1.2.3.82". only for parents of type "tlv"
 	dict_fixup_ctx_t	fixup;
+
+	bool			image_check;		//!< Look for, or generate, an image for the next file.
+	char			*image_file;		//!< Image for the top level file.
+	dict_image_t		*image;			//!< Image we're reading from, instead of the text files.
+	dict_image_writer_t	*writer;		//!< Records the tokenized files, if we're generating an image.
 };
 
 static int _dict_from_file(dict_tokenize_ctx_t *dctx,
@@ -916,7 +922,7 @@ static int dict_attr_allow_dup(fr_dict_attr_t const *da)
 	 */
 	if (!da->parent) return 1;	/* no parent no conflicts possible */
 
-	dup_name = fr_dict_attr_by_name(NULL, da->parent, da->name);
+	dup_name = dict_attr_dup_by_name(da->parent, da->name);
 	if (da->flags.name_only) dup_num = fr_dict_attr_child_by_num(da->parent, da->attr);
 
 	/*
@@ -2964,7 +2970,7 @@ static int _dict_from_file(dict_tokenize_ctx_t *dctx,
 		{ L("VENDOR"),			{ .parse = dict_read_process_vendor } },
 	};
 
-	FILE			*fp;
+	FILE			*fp = NULL;
 	char 			dir[256], fn[256];
 	char			buf[256];
 	char			*p;
@@ -3038,7 +3044,36 @@ static int _dict_from_file(dict_tokenize_ctx_t *dctx,
 	}
 #endif
 
+	/*
+	 *	The top level file decides whether we use an image.
+	 *	If the image is missing, or stale, we read the text
+	 *	files as usual.
+	 */
+	if (dctx->image_check) {
+		dctx->image_check = false;
+
+		dctx->image_file = talloc_asprintf(NULL, "%s" DICT_IMAGE_SUFFIX, fn);
+		if (!dctx->image_file) {
+			fr_strerror_const("Out of memory");
+			return -1;
+		}
+
+		if (!dctx->writer) dctx->image = dict_image_open(dctx->image_file, dctx->image_file, fn,
+								  dict_gctx->perm_check);
+	}
+
+	if (dctx->image) {
+		int ret;
+
+		ret = dict_image_file_begin(dctx->image, fn);
+		if (ret < 0) return ret;
+
+		goto add_filename;
+	}
+
 	if ((fp = fopen(fn, "r")) == NULL) {
+		if (dctx->writer) dict_image_writer_file_missing(dctx->writer, fn);
+
 		if (!src_file) {
 			fr_strerror_printf_push("Couldn't open dictionary %s: %s", fr_syserror(errno), fn);
 		} else {
@@ -3056,7 +3091,7 @@ static int _dict_from_file(dict_tokenize_ctx_t *dctx,
 		fr_strerror_printf_push("Failed stating dictionary \"%s\" - %s", fn, fr_syserror(errno));
 
 	perm_error:
-		fclose(fp);
+		if (fp) fclose(fp);
 		return -1;
 	}
 
@@ -3077,46 +3112,71 @@ static int _dict_from_file(dict_tokenize_ctx_t *dctx,
 	}
 #endif
 
+	if (dctx->writer) dict_image_writer_file_begin(dctx->writer, fn, &statbuf);
+
 	/*
 	 *	Now that we've opened the file, copy the filename into the dictionary and add it to the ctx
 	 *	This string is safe to assign to the filename pointer in any attributes added beneath the
 	 *	dictionary.
 	 */
+add_filename:
 	if (unlikely(dict_filename_add(&CURRENT_FILENAME(dctx), dctx->dict, fn, src_file, src_line) < 0)) {
 		goto perm_error;
 	}
 
-	while (fgets(buf, sizeof(buf), fp) != NULL) {
+	while (true) {
 		bool do_begin = false;
 		fr_dict_keyword_parser_t const	*parser;
 		char **argv_p = argv;
 
-		dctx->stack[dctx->stack_depth].line = ++line;
-
-		switch (buf[0]) {
-		case '#':
-		case '\0':
-		case '\n':
-		case '\r':
-			continue;
-		}
-
 		/*
-		 *  Comment characters should NOT be appearing anywhere but
-		 *  as start of a comment;
+		 *	Images contain only the lines which had
+		 *	something on them, already split into words.
 		 */
-		p = strchr(buf, '#');
-		if (p) *p = '\0';
+		if (dctx->image) {
+			int ret;
+
+			ret = dict_image_line(dctx->image, &line, argv, DICT_MAX_ARGV, &argc);
+			if (ret < 0) goto error;
+			if (ret == 0) break;
+
+			dctx->stack[dctx->stack_depth].line = line;
+		} else {
+			if (!fgets(buf, sizeof(buf), fp)) break;
 
-		argc = fr_dict_str_to_argv(buf, argv, DICT_MAX_ARGV);
-		if (argc == 0) continue;
+			dctx->stack[dctx->stack_depth].line = ++line;
+
+			switch (buf[0]) {
+			case '#':
+			case '\0':
+			case '\n':
+			case '\r':
+				continue;
+			}
+
+			/*
+			 *  Comment characters should NOT be appearing anywhere but
+			 *  as start of a comment;
+			 */
+			p = strchr(buf, '#');
+			if (p) *p = '\0';
+
+			argc = fr_dict_str_to_argv(buf, argv, DICT_MAX_ARGV);
+			if (argc == 0) continue;
+
+			/*
+			 *	Record the line before it's processed, as
+			 *	the keyword handlers may modify argv.
+			 */
+			if (dctx->writer) dict_image_writer_line(dctx->writer, line, argv, argc);
+		}
 
 		if (argc == 1) {
 			fr_strerror_const("Invalid entry");
 
 		error:
 			fr_strerror_printf_push("Failed parsing dictionary at %s[%d]", fr_cwd_strip(fn), line);
-			fclose(fp);
+			if (fp) fclose(fp);
 			return -1;
 		}
 
@@ -3206,8 +3266,9 @@ static int _dict_from_file(dict_tokenize_ctx_t *dctx,
 	 *	was copied from the parent, so there are guaranteed to
 	 *	be missing things.
 	 */
-	fclose(fp);
+	if (fp) fclose(fp);
 
+	if (dctx->writer) dict_image_writer_file_end(dctx->writer);
 
 	return 0;
 }
@@ -3226,12 +3287,39 @@ static int dict_from_file(fr_dict_t *dict,
 	dctx.stack[0].da = dict->root;
 	dctx.stack[0].nest = NEST_ROOT;
 
+	if (dict_gctx->image_write) {
+		dctx.writer = dict_image_writer_alloc(NULL);
+		if (!dctx.writer) {
+			talloc_free(dctx.fixup.pool);
+			return -1;
+		}
+		dctx.image_check = true;
+	} else if (dict_gctx->image_read) {
+		dctx.image_check = true;
+	}
+
 	ret = _dict_from_file(&dctx, dir_name, filename, src_file, src_line);
 	if (ret < 0) {
 		talloc_free(dctx.fixup.pool);
+	error:
+		talloc_free(dctx.writer);
+		talloc_free(dctx.image_file);	/* Also frees the image */
 		return ret;
 	}
 
+	/*
+	 *	Only write the image once the whole dictionary has
+	 *	been read successfully.
+	 */
+	if (dctx.writer && (dict_image_writer_commit(dctx.writer, dctx.image_file) < 0)) {
+		talloc_free(dctx.fixup.pool);
+		ret = -1;
+		goto error;
+	}
+
+	talloc_free(dctx.writer);
+	talloc_free(dctx.image_file);
+
 	/*
 	 *	Applies  to any attributes added to the *internal*
 	 *	dictionary.
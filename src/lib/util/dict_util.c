@@ -1480,6 +1480,17 @@ int dict_attr_child_add(fr_dict_attr_t *parent, fr_dict_attr_t *child)
 		if (dict_attr_children_set(parent, children) < 0) return -1;
 	}
 
+	/*
+	 *	Any index is now out of date.  It'll be rebuilt
+	 *	when the dictionary is next made read only.
+	 */
+	{
+		fr_dict_attr_ext_children_t *ext;
+
+		ext = fr_dict_attr_ext(parent, FR_DICT_ATTR_EXT_CHILDREN);
+		if (ext->index) TALLOC_FREE(ext->index);
+	}
+
 	/*
 	 *	Treat the array as a hash of 255 bins, with attributes
 	 *	sorted into bins using num % 255.
@@ -1619,7 +1630,7 @@ int fr_dict_attr_add_initialised(fr_dict_attr_t *da)
 	 *	we'd now need to unpick, it's easier just to error out
 	 *	and have the user fix the duplicate.
 	 */
-	exists = fr_dict_attr_by_name(NULL, da->parent, da->name);
+	exists = dict_attr_dup_by_name(da->parent, da->name);
 	if (exists) {
 		fr_strerror_printf("Duplicate attribute name '%s' in namespace '%s'.  "
 				   "Originally defined %s[%d]", da->name, da->parent->name,
@@ -3278,6 +3289,293 @@ fr_dict_attr_t const *fr_dict_attr_by_name(fr_dict_attr_err_t *err, fr_dict_attr
 	return da;
 }
 
+/** Find an attribute with the same name as one which is about to be added
+ *
+ * Unlike #fr_dict_attr_by_name, no error is set if the name isn't
+ * found.  That's the usual case when adding attributes, and formatting
+ * an error for each of them is a significant part of the time taken to
+ * load the dictionaries.
+ *
+ * @param[in] parent	to search in.
+ * @param[in] name	to search for.
+ * @return
+ *	- The existing attribute, or the target if it's an alias.
+ *	- NULL if no attribute has that name.
+ */
+fr_dict_attr_t const *dict_attr_dup_by_name(fr_dict_attr_t const *parent, char const *name)
+{
+	fr_hash_table_t		*namespace;
+	fr_dict_attr_t		*da;
+
+	DA_VERIFY(parent);
+
+redo:
+	namespace = dict_attr_namespace(parent);
+	if (!namespace) return NULL;
+
+	da = fr_hash_table_find(namespace, &(fr_dict_attr_t) { .name = name });
+	if (!da) {
+		if (parent->flags.is_root) {
+			fr_dict_t const *dict = fr_dict_by_da(parent);
+
+			if (dict->next) {
+				parent = dict->next->root;
+				goto redo;
+			}
+		}
+
+		return NULL;
+	}
+
+	return dict_attr_alias(NULL, da);
+}
+
+/** A slot in the hashed part of a child index
+ *
+ */
+typedef struct {
+	unsigned int		attr;			//!< Number of the child.
+	fr_dict_attr_t const	*da;			//!< The child.  NULL if the slot is free.
+} dict_attr_child_slot_t;
+
+/** Read only index of the children of an attribute, by number
+ *
+ * Children with numbers below dense_len are found by indexing directly
+ * into an array.  The remainder are placed in an open addressed hash
+ * table.  Several multipliers are tried when the table is built, and
+ * the one with the shortest probe sequence is kept, so lookups touch
+ * at most max_probe + 1 slots, and usually only one.
+ */
+struct fr_dict_attr_child_index_s {
+	fr_dict_attr_t const	**dense;		//!< Children indexed by number.
+	unsigned int		dense_len;		//!< Children numbered below this are in dense.
+
+	dict_attr_child_slot_t	*slots;			//!< Children numbered dense_len and above.
+	unsigned int		mask;			//!< Number of slots - 1.
+	uint32_t		mult;			//!< Multiplier used to hash numbers.
+	unsigned int		shift;			//!< How far to shift the product to get a slot.
+	unsigned int		max_probe;		//!< Longest probe sequence in the table.
+};
+
+/** Largest number space we'll give a dense array
+ *
+ */
+#define DICT_CHILD_INDEX_DENSE_MAX	4096
+
+/** Multipliers to try when building the hashed part of a child index
+ *
+ */
+static uint32_t const dict_attr_child_index_mult[] = {
+	0x9e3779b1, 0x85ebca6b, 0xc2b2ae35, 0x27d4eb2f,
+	0x165667b1, 0x61c88647, 0x7feb352d, 0x846ca68b
+};
+
+static inline CC_HINT(always_inline) fr_dict_attr_t const *dict_attr_child_index_find(fr_dict_attr_child_index_t const *idx,
+										   unsigned int attr)
+{
+	unsigned int i, probe;
+
+	if (attr < idx->dense_len) return idx->dense[attr];
+	if (!idx->slots) return NULL;
+
+	i = ((uint32_t) attr * idx->mult) >> idx->shift;
+	for (probe = 0; probe <= idx->max_probe; probe++) {
+		dict_attr_child_slot_t const *slot = &idx->slots[(i + probe) & idx->mask];
+
+		if (slot->da && (slot->attr == attr)) return slot->da;
+	}
+
+	return NULL;
+}
+
+/** Insert the children which aren't in the dense array into the hash table, using a given multiplier
+ *
+ * @return the longest probe sequence.
+ */
+static unsigned int dict_attr_child_index_fill(fr_dict_attr_child_index_t *idx, fr_dict_attr_t const *parent,
+					       uint32_t mult)
+{
+	fr_dict_attr_t const *child = NULL;
+
+	memset(idx->slots, 0, sizeof(idx->slots[0]) * (idx->mask + 1));
+	idx->mult = mult;
+	idx->max_probe = 0;
+
+	for (child = fr_dict_attr_iterate_children(parent, &child);
+	     child != NULL;
+	     child = fr_dict_attr_iterate_children(parent, &child)) {
+		unsigned int i, probe;
+
+		if (child->attr < idx->dense_len) continue;
+
+		i = ((uint32_t) child->attr * mult) >> idx->shift;
+		for (probe = 0; ; probe++) {
+			dict_attr_child_slot_t *slot = &idx->slots[(i + probe) & idx->mask];
+
+			if (!slot->da) {
+				slot->attr = child->attr;
+				slot->da = child;
+				break;
+			}
+
+			/*
+			 *	Children are iterated in the same order
+			 *	as they're searched in the bins, so the
+			 *	first one with this number wins.
+			 */
+			if (slot->attr == child->attr) break;
+		}
+
+		if (probe > idx->max_probe) idx->max_probe = probe;
+	}
+
+	return idx->max_probe;
+}
+
+/** Build the index for the children of a single attribute
+ *
+ * The index is an optimisation, so if anything fails we continue
+ * to search the bins.
+ */
+static void dict_attr_child_index_build(fr_dict_attr_t const *parent, fr_dict_attr_ext_children_t *ext)
+{
+	fr_dict_attr_child_index_t	*idx;
+	fr_dict_attr_t const		*child = NULL;
+	unsigned int			num = 0, max = 0, max_low = 0, hashed = 0;
+	bool				has_low = false;
+
+	if (ext->index) TALLOC_FREE(ext->index);
+
+	for (child = fr_dict_attr_iterate_children(parent, &child);
+	     child != NULL;
+	     child = fr_dict_attr_iterate_children(parent, &child)) {
+		num++;
+		if (child->attr > max) max = child->attr;
+		if (child->attr <= UINT8_MAX) {
+			has_low = true;
+			if (child->attr > max_low) max_low = child->attr;
+		}
+	}
+	/*
+	 *	The bins are indexed by the low byte of the number,
+	 *	so if every child fits in a byte, the bins are
+	 *	already a direct lookup.
+	 */
+	if (!num || (max <= UINT8_MAX)) return;
+
+	idx = talloc_zero(fr_dict_attr_unconst(parent), fr_dict_attr_child_index_t);
+	if (!idx) return;
+
+	/*
+	 *	Use a dense array for the whole number space if it's
+	 *	well populated.  Otherwise only for the
+	 *	first 256 numbers, where most protocols put their
+	 *	commonly used attributes, and hash the rest.
+	 */
+	if ((max < DICT_CHILD_INDEX_DENSE_MAX) && ((num * 4) > max)) {
+		idx->dense_len = max + 1;
+	} else if (has_low) {
+		idx->dense_len = max_low + 1;
+	}
+
+	if (idx->dense_len) {
+		idx->dense = talloc_zero_array(idx, fr_dict_attr_t const *, idx->dense_len);
+		if (!idx->dense) {
+		error:
+			talloc_free(idx);
+			return;
+		}
+	}
+
+	for (child = fr_dict_attr_iterate_children(parent, &child);
+	     child != NULL;
+	     child = fr_dict_attr_iterate_children(parent, &child)) {
+		if (child->attr >= idx->dense_len) {
+			hashed++;
+			continue;
+		}
+
+		if (!idx->dense[child->attr]) idx->dense[child->attr] = child;
+	}
+
+	if (hashed) {
+		unsigned int	bits = 1, best = UINT_MAX, probe = 0;
+		uint32_t	best_mult = 0;
+		size_t		i;
+
+		while ((1U << bits) < (hashed * 2)) bits++;
+
+		idx->mask = (1U << bits) - 1;
+		idx->shift = 32 - bits;
+		idx->slots = talloc_array(idx, dict_attr_child_slot_t, idx->mask + 1);
+		if (!idx->slots) goto error;
+
+		for (i = 0; i < NUM_ELEMENTS(dict_attr_child_index_mult); i++) {
+			probe = dict_attr_child_index_fill(idx, parent, dict_attr_child_index_mult[i]);
+			if (probe < best) {
+				best = probe;
+				best_mult = dict_attr_child_index_mult[i];
+				if (best == 0) break;	/* Perfect */
+			}
+		}
+
+		if (idx->mult != best_mult) dict_attr_child_index_fill(idx, parent, best_mult);
+	}
+
+	ext->index = idx;
+}
+
+static void _dict_attr_child_indexes_build(fr_dict_attr_t const *da, bool build)
+{
+	fr_dict_attr_ext_children_t	*ext;
+	fr_dict_attr_t const		*child = NULL;
+
+	if (fr_dict_attr_ref(da)) return;
+
+	ext = fr_dict_attr_ext(da, FR_DICT_ATTR_EXT_CHILDREN);
+	if (!ext || !ext->children) return;
+
+	if (build) {
+		dict_attr_child_index_build(da, ext);
+	} else if (ext->index) {
+		TALLOC_FREE(ext->index);
+	}
+
+	for (child = fr_dict_attr_iterate_children(da, &child);
+	     child != NULL;
+	     child = fr_dict_attr_iterate_children(da, &child)) {
+		_dict_attr_child_indexes_build(child, build);
+	}
+}
+
+/** Build read only indexes for child lookups by number
+ *
+ * Should be called once the dictionary is complete.  Adding
+ * attributes afterwards discards the index of their parent, so
+ * lookups remain correct, but fall back to searching the bins.
+ *
+ * @param[in] dict	to build indexes for.
+ */
+void dict_attr_child_indexes_build(fr_dict_t *dict)
+{
+	if (!dict->root) return;
+
+	_dict_attr_child_indexes_build(dict->root, true);
+}
+
+/** Discard the indexes for child lookups by number
+ *
+ * Lookups fall back to searching the bins.  Used to compare the two.
+ *
+ * @param[in] dict	to discard indexes for.
+ */
+void dict_attr_child_indexes_free(fr_dict_t *dict)
+{
+	if (!dict->root) return;
+
+	_dict_attr_child_indexes_build(dict->root, false);
+}
+
 /** Internal version of fr_dict_attr_child_by_num
  *
  */
@@ -3286,6 +3584,7 @@ fr_dict_attr_t *dict_attr_child_by_num(fr_dict_attr_t const *parent, unsigned in
 	fr_dict_attr_t const *bin;
 	fr_dict_attr_t const **children;
 	fr_dict_attr_t const *ref;
+	fr_dict_attr_ext_children_t *ext;
 
 	DA_VERIFY(parent);
 
@@ -3295,7 +3594,22 @@ fr_dict_attr_t *dict_attr_child_by_num(fr_dict_attr_t const *parent, unsigned in
 	ref = fr_dict_attr_ref(parent);
 	if (ref) parent = ref;
 
-	children = dict_attr_children(parent);
+	ext = fr_dict_attr_ext(parent, FR_DICT_ATTR_EXT_CHILDREN);
+	if (unlikely(!ext)) {
+		fr_strerror_const("Attribute contains no 'children' extension");
+		return NULL;
+	}
+
+	if (ext->index) {
+		fr_dict_attr_t *out;
+
+		bin = dict_attr_child_index_find(ext->index, attr);
+		memcpy(&out, &bin, sizeof(bin));
+
+		return out;
+	}
+
+	children = ext->children;
 	if (!children) return NULL;
 
 	/*
@@ -4448,6 +4762,7 @@ fr_dict_gctx_t *fr_dict_global_ctx_init(TALLOC_CTX *ctx, bool free_at_exit, char
 		return NULL;
 	}
 	new_ctx->perm_check = true;	/* Check file permissions by default */
+	new_ctx->image_read = true;	/* Use images if they've been generated */
 
 	new_ctx->protocol_by_name = fr_hash_table_alloc(new_ctx, dict_protocol_name_hash, dict_protocol_name_cmp, NULL);
 	if (!new_ctx->protocol_by_name) {
@@ -4490,6 +4805,23 @@ void fr_dict_global_ctx_perm_check(fr_dict_gctx_t *gctx, bool enable)
 	gctx->perm_check = enable;
 }
 
+/** Set whether we use pre-tokenized dictionary images
+ *
+ * Images are generated next to the top level dictionary file of each
+ * protocol, and are ignored if any of the files they were generated
+ * from have changed.
+ *
+ * @param[in] gctx	to alter.
+ * @param[in] read	Whether we load dictionaries from images, where available.
+ * @param[in] write	Whether we (re)generate images as dictionaries are loaded.
+ *			Images are never read when this is true.
+ */
+void fr_dict_global_ctx_images(fr_dict_gctx_t *gctx, bool read, bool write)
+{
+	gctx->image_read = read;
+	gctx->image_write = write;
+}
+
 /** Set a new, active, global dictionary context
  *
  * @param[in] gctx	To set.
@@ -4558,11 +4890,13 @@ void fr_dict_global_ctx_read_only(void)
 	     dict;
 	     dict = fr_hash_table_iter_next(dict_gctx->protocol_by_num, &iter)) {
 	     	dict_hash_tables_finalise(dict);
+		dict_attr_child_indexes_build(dict);
 		dict->read_only = true;
 	}
 
 	dict = dict_gctx->internal;
 	dict_hash_tables_finalise(dict);
+	dict_attr_child_indexes_build(dict);
 	dict->read_only = true;
 	dict_gctx->read_only = true;
 }
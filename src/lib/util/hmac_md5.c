@@ -181,3 +181,158 @@ int fr_hmac_md5(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *in, size_t inl
 	return 0;
 }
 #endif /* HAVE_OPENSSL_EVP_H */
+
+struct fr_hmac_md5_key_s {
+	fr_md5_ctx_t		*inner;		//!< MD5 state after ingesting the key XOR ipad.
+	fr_md5_ctx_t		*outer;		//!< MD5 state after ingesting the key XOR opad.
+
+	fr_md5_mb_state_t	mb_inner;	//!< As inner, for #fr_hmac_md5_mb_calc.
+	fr_md5_mb_state_t	mb_outer;	//!< As outer, for #fr_hmac_md5_mb_calc.
+};
+
+static int _hmac_md5_key_free(fr_hmac_md5_key_t *hkey)
+{
+	if (hkey->inner) fr_md5_ctx_free(&hkey->inner);
+	if (hkey->outer) fr_md5_ctx_free(&hkey->outer);
+
+	return 0;
+}
+
+/** Precompute the HMAC-MD5 state for a key
+ *
+ * The returned state may be shared between threads, it's only ever
+ * copied by #fr_hmac_md5_with_key.
+ *
+ * @param[in] ctx	to allocate the key state in.
+ * @param[in] key	Pointer to authentication key.
+ * @param[in] key_len	Length of authentication key.
+ * @return
+ *	- The key state on success.
+ *	- NULL on error.
+ */
+fr_hmac_md5_key_t *fr_hmac_md5_key_alloc(TALLOC_CTX *ctx, uint8_t const *key, size_t key_len)
+{
+	fr_hmac_md5_key_t	*hkey;
+	uint8_t			k_ipad[64];
+	uint8_t			k_opad[64];
+	uint8_t			tk[MD5_DIGEST_LENGTH];
+	int			i;
+
+	hkey = talloc_zero(ctx, fr_hmac_md5_key_t);
+	if (unlikely(!hkey)) {
+	oom:
+		fr_strerror_const("Out of memory");
+		return NULL;
+	}
+	talloc_set_destructor(hkey, _hmac_md5_key_free);
+
+	hkey->inner = fr_md5_ctx_alloc();
+	hkey->outer = fr_md5_ctx_alloc();
+	if (unlikely(!hkey->inner || !hkey->outer)) {
+		talloc_free(hkey);
+		goto oom;
+	}
+
+	/* if key is longer than 64 bytes reset it to key=MD5(key) */
+	if (key_len > 64) {
+		fr_md5_calc(tk, key, key_len);
+		key = tk;
+		key_len = sizeof(tk);
+	}
+
+	memset(k_ipad, 0, sizeof(k_ipad));
+	memset(k_opad, 0, sizeof(k_opad));
+	memcpy(k_ipad, key, key_len);
+	memcpy(k_opad, key, key_len);
+
+	for (i = 0; i < 64; i++) {
+		k_ipad[i] ^= 0x36;
+		k_opad[i] ^= 0x5c;
+	}
+
+	fr_md5_update(hkey->inner, k_ipad, sizeof(k_ipad));
+	fr_md5_update(hkey->outer, k_opad, sizeof(k_opad));
+
+	fr_md5_mb_state_init(&hkey->mb_inner, k_ipad);
+	fr_md5_mb_state_init(&hkey->mb_outer, k_opad);
+
+	return hkey;
+}
+
+/** Calculate HMAC-MD5 using precomputed key state
+ *
+ * Produces the same digest as #fr_hmac_md5, but saves hashing the
+ * two 64 byte key pads for every message.
+ *
+ * @param digest Caller digest to be filled in.
+ * @param in Pointer to data stream.
+ * @param inlen length of data stream.
+ * @param hkey Key state from #fr_hmac_md5_key_alloc.
+ * @return
+ *	- 0 on success.
+ *      - -1 on error.
+ */
+int fr_hmac_md5_with_key(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *in, size_t inlen,
+			 fr_hmac_md5_key_t const *hkey)
+{
+	fr_md5_ctx_t	*ctx;
+
+	ctx = fr_md5_ctx_alloc_from_list();
+	if (unlikely(!ctx)) return -1;
+
+	fr_md5_ctx_copy(ctx, hkey->inner);
+	fr_md5_update(ctx, in, inlen);
+	fr_md5_final(digest, ctx);
+
+	fr_md5_ctx_copy(ctx, hkey->outer);
+	fr_md5_update(ctx, digest, MD5_DIGEST_LENGTH);
+	fr_md5_final(digest, ctx);
+
+	fr_md5_ctx_free_from_list(&ctx);
+
+	return 0;
+}
+
+#define HMAC_MD5_MB_CHUNK	(FR_MD5_MB_LANES * 4)
+
+/** Calculate HMAC-MD5 for multiple messages using precomputed key state
+ *
+ * Produces the same digests as #fr_hmac_md5_with_key, but the inner
+ * and outer hashes for all the messages are calculated together with
+ * #fr_md5_mb_calc.  Messages may use different keys.
+ *
+ * @param[in] jobs	to calculate digests for.
+ * @param[in] num	Number of jobs.
+ */
+void fr_hmac_md5_mb_calc(fr_hmac_md5_mb_job_t *jobs, size_t num)
+{
+	uint8_t		inner[HMAC_MD5_MB_CHUNK][MD5_DIGEST_LENGTH];
+	fr_md5_mb_job_t	md5[HMAC_MD5_MB_CHUNK];
+	size_t		i, j, n;
+
+	for (i = 0; i < num; i += n) {
+		n = num - i;
+		if (n > HMAC_MD5_MB_CHUNK) n = HMAC_MD5_MB_CHUNK;
+
+		/*
+		 *	All the inner hashes, then all the outer hashes.
+		 */
+		for (j = 0; j < n; j++) {
+			md5[j] = (fr_md5_mb_job_t) {
+				.in = { { .data = jobs[i + j].in, .len = jobs[i + j].inlen } },
+				.state = &jobs[i + j].hkey->mb_inner,
+				.out = inner[j]
+			};
+		}
+		fr_md5_mb_calc(md5, n);
+
+		for (j = 0; j < n; j++) {
+			md5[j] = (fr_md5_mb_job_t) {
+				.in = { { .data = inner[j], .len = sizeof(inner[j]) } },
+				.state = &jobs[i + j].hkey->mb_outer,
+				.out = jobs[i + j].out
+			};
+		}
+		fr_md5_mb_calc(md5, n);
+	}
+}
@@ -25,6 +25,7 @@
 #include <freeradius-devel/util/acutest_helpers.h>
 #include <freeradius-devel/util/md5.h>
 #include <freeradius-devel/util/sha1.h>
+#include <freeradius-devel/util/time.h>
 
 /*
 Test Vectors (Trailing '\0' of a character string not included in test):
@@ -129,6 +130,136 @@ static void test_hmac_md5(void)
 			      sizeof(digest)), 0);
 }
 
+/*
+ *	Precomputed key state must produce the same digests as
+ *	fr_hmac_md5, including for keys longer than the block size.
+ */
+static void test_hmac_md5_with_key(void)
+{
+	uint8_t			digest[16], expected[16];
+	uint8_t			key[80], text[256];
+	size_t			key_len, i;
+	fr_hmac_md5_key_t	*hkey;
+
+	for (i = 0; i < sizeof(key); i++) key[i] = (uint8_t)(i * 7);
+	for (i = 0; i < sizeof(text); i++) text[i] = (uint8_t)(i ^ 0xa5);
+
+	/*
+	 *	OpenSSL won't create HMAC keys with no key data, so
+	 *	check an empty key against a known answer.
+	 */
+	hkey = fr_hmac_md5_key_alloc(NULL, key, 0);
+	TEST_ASSERT(hkey != NULL);
+	TEST_CHECK(fr_hmac_md5_with_key(digest, text, 0, hkey) == 0);
+	TEST_CHECK(memcmp(digest,
+			  (uint8_t[]){
+				0x74, 0xe6, 0xf7, 0x29, 0x8a, 0x9c, 0x2d, 0x16,
+				0x89, 0x35, 0xf5, 0x8c, 0x00, 0x1b, 0xad, 0x88
+			  },
+			  sizeof(digest)) == 0);
+	talloc_free(hkey);
+
+	for (key_len = 8; key_len <= sizeof(key); key_len += 8) {
+		hkey = fr_hmac_md5_key_alloc(NULL, key, key_len);
+		TEST_ASSERT(hkey != NULL);
+
+		/*
+		 *	Reuse the same key state for multiple messages
+		 */
+		for (i = 0; i <= sizeof(text); i += 32) {
+			TEST_CHECK(fr_hmac_md5(expected, text, i, key, key_len) == 0);
+			TEST_CHECK(fr_hmac_md5_with_key(digest, text, i, hkey) == 0);
+			TEST_CHECK(memcmp(digest, expected, sizeof(digest)) == 0);
+			TEST_MSG("key_len %zu, text_len %zu", key_len, i);
+		}
+
+		talloc_free(hkey);
+	}
+}
+
+/*
+ *	Batches must produce the same digests as fr_hmac_md5, with
+ *	a different key and message length for each job.  Empty keys
+ *	are checked against a known answer above.
+ */
+static void test_hmac_md5_mb(void)
+{
+	uint8_t			key[80], text[300];
+	uint8_t			digest[40][16], expected[16];
+	fr_hmac_md5_key_t	*hkey[5];
+	fr_hmac_md5_mb_job_t	jobs[40];
+	size_t			i;
+
+	for (i = 0; i < sizeof(key); i++) key[i] = (uint8_t)(i * 11);
+	for (i = 0; i < sizeof(text); i++) text[i] = (uint8_t)(i ^ 0x5c);
+
+	for (i = 0; i < NUM_ELEMENTS(hkey); i++) {
+		hkey[i] = fr_hmac_md5_key_alloc(NULL, key, (i + 1) * 16);
+		TEST_ASSERT(hkey[i] != NULL);
+	}
+
+	for (i = 0; i < NUM_ELEMENTS(jobs); i++) {
+		jobs[i] = (fr_hmac_md5_mb_job_t) {
+			.in = text,
+			.inlen = (i * 37) % sizeof(text),
+			.hkey = hkey[i % NUM_ELEMENTS(hkey)],
+			.out = digest[i]
+		};
+	}
+
+	fr_hmac_md5_mb_calc(jobs, NUM_ELEMENTS(jobs));
+
+	for (i = 0; i < NUM_ELEMENTS(jobs); i++) {
+		size_t key_len = ((i % NUM_ELEMENTS(hkey)) + 1) * 16;
+
+		TEST_CHECK(fr_hmac_md5(expected, text, jobs[i].inlen, key, key_len) == 0);
+		TEST_CHECK(memcmp(digest[i], expected, sizeof(expected)) == 0);
+		TEST_MSG("job %zu, key_len %zu, text_len %zu", i, key_len, jobs[i].inlen);
+	}
+
+	for (i = 0; i < NUM_ELEMENTS(hkey); i++) talloc_free(hkey[i]);
+}
+
+/*
+ *	Sign and verify a typical Access-Accept sized packet,
+ *	rebuilding the key pads each time vs cloning the midstate.
+ */
+static void test_hmac_md5_bench(void)
+{
+	uint8_t			digest[16];
+	uint8_t			packet[128];
+	uint8_t const		*secret = (uint8_t const *)"testing123-this-is-a-long-shared-secret";
+	size_t			secret_len = strlen((char const *)secret);
+	fr_hmac_md5_key_t	*hkey;
+	fr_time_t		start;
+	fr_time_delta_t		slow, fast;
+	size_t			i, reps = 200000;
+
+	memset(packet, 0x42, sizeof(packet));
+
+	hkey = fr_hmac_md5_key_alloc(NULL, secret, secret_len);
+	TEST_ASSERT(hkey != NULL);
+
+	start = fr_time();
+	for (i = 0; i < reps; i++) {
+		fr_hmac_md5(digest, packet, sizeof(packet), secret, secret_len);
+		packet[0] = digest[0];
+	}
+	slow = fr_time_sub(fr_time(), start);
+
+	start = fr_time();
+	for (i = 0; i < reps; i++) {
+		fr_hmac_md5_with_key(digest, packet, sizeof(packet), hkey);
+		packet[0] = digest[0];
+	}
+	fast = fr_time_sub(fr_time(), start);
+
+	TEST_MSG_ALWAYS("per-call key  %"PRIu64" ns/op", fr_time_delta_unwrap(slow) / reps);
+	TEST_MSG_ALWAYS("precomputed   %"PRIu64" ns/op", fr_time_delta_unwrap(fast) / reps);
+
+	talloc_free(hkey);
+}
+
 /*
 Test Vectors (Trailing '\0' of a character string not included in test):
 
@@ -210,6 +341,9 @@ TEST_LIST = {
 	 *	Allocation and management
 	 */
 	{ "hmac-md5",			test_hmac_md5	},
+	{ "hmac-md5-with-key",		test_hmac_md5_with_key	},
+	{ "hmac-md5-mb",		test_hmac_md5_mb	},
+	{ "hmac-md5-bench",		test_hmac_md5_bench	},
 	{ "hmac-sha1",			test_hmac_sha1	},
 
 	{ NULL }
@@ -51,6 +51,7 @@ uint32_t fr_hw_num_cores_active(void)
 }
 
 #elif defined(__linux__)
+#include <dirent.h>
 #include <stdio.h>
 #include <unistd.h>
 size_t fr_hw_cache_line_size(void)
@@ -112,6 +113,46 @@ uint32_t fr_hw_num_cores_active(void)
 
 	return lcores / (tsibs / lcores);
 }
+
+/** Return the NUMA node a CPU belongs to
+ *
+ * @param[in] cpu	to look up.
+ * @return
+ *	- >= 0 the NUMA node.
+ *	- -1 if the CPU doesn't exist, or the system doesn't expose NUMA topology.
+ */
+int fr_hw_numa_node_of_cpu(unsigned int cpu)
+{
+	DIR		*dir;
+	struct dirent	*dp;
+	char		path[64];
+	int		node = -1;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u", cpu);
+
+	dir = opendir(path);
+	if (!dir) {
+		fr_strerror_printf("Failed opening %s: %s", path, fr_syserror(errno));
+		return -1;
+	}
+
+	/*
+	 *	The CPU directory contains a "nodeN" link to the
+	 *	node it's attached to.
+	 */
+	while ((dp = readdir(dir)) != NULL) {
+		unsigned int	num;
+		char		c;
+
+		if (sscanf(dp->d_name, "node%u%c", &num, &c) != 1) continue;
+
+		node = num;
+		break;
+	}
+	closedir(dir);
+
+	return node;
+}
 #else
 size_t fr_hw_cache_line_size(void)
 {
@@ -123,3 +164,10 @@ uint32_t fr_hw_num_cores_active(void)
 	return CORES_DEFAULT;
 }
 #endif
+
+#ifndef __linux__
+int fr_hw_numa_node_of_cpu(UNUSED unsigned int cpu)
+{
+	return -1;
+}
+#endif
@@ -34,6 +34,8 @@ size_t		fr_hw_cache_line_size(void);
 
 uint32_t	fr_hw_num_cores_active(void);
 
+int		fr_hw_numa_node_of_cpu(unsigned int cpu);
+
 #ifdef __cplusplus
 }
 #endif
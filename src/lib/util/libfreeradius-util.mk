@@ -24,6 +24,7 @@ SOURCES		:= \
 		   decode.c \
 		   dict_ext.c \
 		   dict_fixup.c \
+		   dict_image.c \
 		   dict_print.c \
 		   dict_test.c \
 		   dict_tokenize.c \
@@ -56,6 +57,7 @@ SOURCES		:= \
 		   machine.c \
 		   md4.c \
 		   md5.c \
+		   md5_mb.c \
 		   minmax_heap.c \
 		   misc.c \
 		   missing.c \
@@ -97,6 +99,7 @@ SOURCES		:= \
 		   trie.c \
 		   types.c \
 		   udp.c \
+		   udp_batch.c \
 		   udp_queue.c \
 		   udpfromto.c \
 		   uri.c \
@@ -14,6 +14,7 @@ extern "C" {
 
 #include <freeradius-devel/build.h>
 #include <freeradius-devel/missing.h>
+#include <freeradius-devel/util/talloc.h>
 
 #include <inttypes.h>
 #include <sys/types.h>
@@ -93,9 +94,69 @@ fr_md5_ctx_t	*fr_md5_ctx_alloc_from_list(void);
  */
 void		fr_md5_ctx_free_from_list(fr_md5_ctx_t **ctx);
 
+/* md5_mb.c */
+#define		FR_MD5_MB_LANES		8	//!< Number of messages hashed in parallel.
+#define		FR_MD5_MB_MAX_IN	3	//!< Maximum number of input fragments per message.
+
+/** MD5 state after hashing a whole number of blocks
+ *
+ * Lets a job resume from a common prefix, such as an HMAC key pad,
+ * instead of hashing it again for every message.
+ */
+typedef struct {
+	uint32_t		h[4];		//!< Chaining variables.
+	uint64_t		len;		//!< Number of bytes hashed so far, a multiple of 64.
+} fr_md5_mb_state_t;
+
+/** A single message to be hashed by #fr_md5_mb_calc
+ *
+ * The digest is calculated over the input fragments concatenated in order.
+ * out is only written once all input for the job has been consumed, so it
+ * may point into the job's own input, but not into another job's.
+ */
+typedef struct {
+	struct {
+		uint8_t const	*data;		//!< Fragment data.
+		size_t		len;		//!< Fragment length.  Unused fragments must be zero length.
+	} in[FR_MD5_MB_MAX_IN];
+	fr_md5_mb_state_t const	*state;		//!< State to resume from, or NULL to start a new digest.
+	uint8_t			*out;		//!< Where to write the MD5_DIGEST_LENGTH byte digest.
+} fr_md5_mb_job_t;
+
+void		fr_md5_mb_state_init(fr_md5_mb_state_t *state, uint8_t const block[static 64]) CC_HINT(nonnull);
+
+void		fr_md5_mb_calc(fr_md5_mb_job_t *jobs, size_t num) CC_HINT(nonnull);
+
+char const	*fr_md5_mb_engine(void);
+
 /* hmac.c */
 int		fr_hmac_md5(uint8_t digest[static MD5_DIGEST_LENGTH], uint8_t const *in, size_t inlen,
 			    uint8_t const *key, size_t key_len);
+
+/** Precomputed HMAC-MD5 key state
+ *
+ * Holds the MD5 state after the inner and outer key pads have been
+ * ingested, so they don't need to be recomputed for every message
+ * signed with the same key.
+ */
+typedef struct fr_hmac_md5_key_s fr_hmac_md5_key_t;
+
+fr_hmac_md5_key_t *fr_hmac_md5_key_alloc(TALLOC_CTX *ctx, uint8_t const *key, size_t key_len);
+
+int		fr_hmac_md5_with_key(uint8_t digest[static MD5_DIGEST_LENGTH], uint8_t const *in, size_t inlen,
+				     fr_hmac_md5_key_t const *hkey) CC_HINT(nonnull);
+
+/** A single message to be authenticated by #fr_hmac_md5_mb_calc
+ *
+ */
+typedef struct {
+	uint8_t const		*in;		//!< Message to authenticate.
+	size_t			inlen;		//!< Length of the message.
+	fr_hmac_md5_key_t const	*hkey;		//!< Key state from #fr_hmac_md5_key_alloc.
+	uint8_t			*out;		//!< Where to write the digest.  May point into in.
+} fr_hmac_md5_mb_job_t;
+
+void		fr_hmac_md5_mb_calc(fr_hmac_md5_mb_job_t *jobs, size_t num) CC_HINT(nonnull);
 #ifdef __cplusplus
 }
 #endif
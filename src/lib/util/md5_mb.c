@@ -0,0 +1,442 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Multi-buffer MD5
+ *
+ * MD5 is a serial chain of dependent operations, so a single digest
+ * can't be made meaningfully faster with SIMD.  What we can do is
+ * calculate several independent digests at once, with each message
+ * occupying one 32bit lane of a vector register.
+ *
+ * The transform is written using compiler vector extensions, and
+ * built for a number of instruction sets.  The best one supported by
+ * the CPU is selected the first time a batch is hashed.
+ *
+ * @file src/lib/util/md5_mb.c
+ *
+ * @copyright 2025 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/md5.h>
+
+#define MD5_MB_BLOCK_LENGTH 64
+
+/*
+ *	Where the compiler's baseline target has vector registers the
+ *	generic transform is worth using.  Everywhere else it'd be
+ *	lowered to scalar operations, and we're better off with the
+ *	normal MD5 implementation.
+ */
+#if defined(__SSE2__) || defined(__ARM_NEON) || defined(__ALTIVEC__)
+#  define MD5_MB_HAVE_SIMD 1
+#endif
+
+/*
+ *	Wider variants which are selected at runtime.
+ */
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#  define MD5_MB_HAVE_X86 1
+#endif
+
+typedef uint32_t md5_mb_vec_t __attribute__((vector_size(FR_MD5_MB_LANES * sizeof(uint32_t))));
+
+typedef void (*md5_mb_transform_t)(md5_mb_vec_t state[static 4],
+				   uint8_t const blocks[static FR_MD5_MB_LANES][MD5_MB_BLOCK_LENGTH]);
+
+/** Input state for a single lane
+ *
+ */
+typedef struct {
+	fr_md5_mb_job_t	*job;		//!< Job currently being hashed in this lane, NULL if idle.
+	size_t		frag;		//!< Current input fragment.
+	size_t		offset;		//!< Offset into the current input fragment.
+	uint64_t	total;		//!< Total number of bytes consumed.
+	bool		padded;		//!< Whether the 0x80 terminator has been added.
+} md5_mb_lane_t;
+
+static md5_mb_transform_t	md5_mb_transform_func;
+static char const		*md5_mb_engine_name;
+
+static uint32_t const		md5_mb_iv[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+
+#define MD5_MB_F1(x, y, z) (z ^ (x & (y ^ z)))
+#define MD5_MB_F2(x, y, z) MD5_MB_F1(z, x, y)
+#define MD5_MB_F3(x, y, z) (x ^ y ^ z)
+#define MD5_MB_F4(x, y, z) (y ^ (x | ~z))
+
+#define MD5_MB_STEP(f, w, x, y, z, data, s) (w += f(x, y, z) + data, w = w << s | w >> (32 - s), w += x)
+
+/** Transform one block for every lane
+ *
+ * This is identical to the scalar transform in md5.c, except every
+ * variable holds one word per lane.
+ *
+ * @param[in,out] state		Per lane MD5 state.
+ * @param[in] blocks		One 64 byte block per lane.
+ */
+static inline CC_HINT(always_inline)
+void md5_mb_transform(md5_mb_vec_t state[static 4], uint8_t const blocks[static FR_MD5_MB_LANES][MD5_MB_BLOCK_LENGTH])
+{
+	md5_mb_vec_t	a, b, c, d, in[MD5_MB_BLOCK_LENGTH / 4];
+	size_t		i, l;
+
+	/*
+	 *	Transpose the blocks, so that in[i] contains word
+	 *	i from every lane.
+	 */
+	for (i = 0; i < (MD5_MB_BLOCK_LENGTH / 4); i++) {
+		for (l = 0; l < FR_MD5_MB_LANES; l++) {
+			uint8_t const *p = &blocks[l][i * 4];
+
+			in[i][l] = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+		}
+	}
+
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+
+	MD5_MB_STEP(MD5_MB_F1, a, b, c, d, in[ 0] + 0xd76aa478,  7);
+	MD5_MB_STEP(MD5_MB_F1, d, a, b, c, in[ 1] + 0xe8c7b756, 12);
+	MD5_MB_STEP(MD5_MB_F1, c, d, a, b, in[ 2] + 0x242070db, 17);
+	MD5_MB_STEP(MD5_MB_F1, b, c, d, a, in[ 3] + 0xc1bdceee, 22);
+	MD5_MB_STEP(MD5_MB_F1, a, b, c, d, in[ 4] + 0xf57c0faf,  7);
+	MD5_MB_STEP(MD5_MB_F1, d, a, b, c, in[ 5] + 0x4787c62a, 12);
+	MD5_MB_STEP(MD5_MB_F1, c, d, a, b, in[ 6] + 0xa8304613, 17);
+	MD5_MB_STEP(MD5_MB_F1, b, c, d, a, in[ 7] + 0xfd469501, 22);
+	MD5_MB_STEP(MD5_MB_F1, a, b, c, d, in[ 8] + 0x698098d8,  7);
+	MD5_MB_STEP(MD5_MB_F1, d, a, b, c, in[ 9] + 0x8b44f7af, 12);
+	MD5_MB_STEP(MD5_MB_F1, c, d, a, b, in[10] + 0xffff5bb1, 17);
+	MD5_MB_STEP(MD5_MB_F1, b, c, d, a, in[11] + 0x895cd7be, 22);
+	MD5_MB_STEP(MD5_MB_F1, a, b, c, d, in[12] + 0x6b901122,  7);
+	MD5_MB_STEP(MD5_MB_F1, d, a, b, c, in[13] + 0xfd987193, 12);
+	MD5_MB_STEP(MD5_MB_F1, c, d, a, b, in[14] + 0xa679438e, 17);
+	MD5_MB_STEP(MD5_MB_F1, b, c, d, a, in[15] + 0x49b40821, 22);
+
+	MD5_MB_STEP(MD5_MB_F2, a, b, c, d, in[ 1] + 0xf61e2562,  5);
+	MD5_MB_STEP(MD5_MB_F2, d, a, b, c, in[ 6] + 0xc040b340,  9);
+	MD5_MB_STEP(MD5_MB_F2, c, d, a, b, in[11] + 0x265e5a51, 14);
+	MD5_MB_STEP(MD5_MB_F2, b, c, d, a, in[ 0] + 0xe9b6c7aa, 20);
+	MD5_MB_STEP(MD5_MB_F2, a, b, c, d, in[ 5] + 0xd62f105d,  5);
+	MD5_MB_STEP(MD5_MB_F2, d, a, b, c, in[10] + 0x02441453,  9);
+	MD5_MB_STEP(MD5_MB_F2, c, d, a, b, in[15] + 0xd8a1e681, 14);
+	MD5_MB_STEP(MD5_MB_F2, b, c, d, a, in[ 4] + 0xe7d3fbc8, 20);
+	MD5_MB_STEP(MD5_MB_F2, a, b, c, d, in[ 9] + 0x21e1cde6,  5);
+	MD5_MB_STEP(MD5_MB_F2, d, a, b, c, in[14] + 0xc33707d6,  9);
+	MD5_MB_STEP(MD5_MB_F2, c, d, a, b, in[ 3] + 0xf4d50d87, 14);
+	MD5_MB_STEP(MD5_MB_F2, b, c, d, a, in[ 8] + 0x455a14ed, 20);
+	MD5_MB_STEP(MD5_MB_F2, a, b, c, d, in[13] + 0xa9e3e905,  5);
+	MD5_MB_STEP(MD5_MB_F2, d, a, b, c, in[ 2] + 0xfcefa3f8,  9);
+	MD5_MB_STEP(MD5_MB_F2, c, d, a, b, in[ 7] + 0x676f02d9, 14);
+	MD5_MB_STEP(MD5_MB_F2, b, c, d, a, in[12] + 0x8d2a4c8a, 20);
+
+	MD5_MB_STEP(MD5_MB_F3, a, b, c, d, in[ 5] + 0xfffa3942,  4);
+	MD5_MB_STEP(MD5_MB_F3, d, a, b, c, in[ 8] + 0x8771f681, 11);
+	MD5_MB_STEP(MD5_MB_F3, c, d, a, b, in[11] + 0x6d9d6122, 16);
+	MD5_MB_STEP(MD5_MB_F3, b, c, d, a, in[14] + 0xfde5380c, 23);
+	MD5_MB_STEP(MD5_MB_F3, a, b, c, d, in[ 1] + 0xa4beea44,  4);
+	MD5_MB_STEP(MD5_MB_F3, d, a, b, c, in[ 4] + 0x4bdecfa9, 11);
+	MD5_MB_STEP(MD5_MB_F3, c, d, a, b, in[ 7] + 0xf6bb4b60, 16);
+	MD5_MB_STEP(MD5_MB_F3, b, c, d, a, in[10] + 0xbebfbc70, 23);
+	MD5_MB_STEP(MD5_MB_F3, a, b, c, d, in[13] + 0x289b7ec6,  4);
+	MD5_MB_STEP(MD5_MB_F3, d, a, b, c, in[ 0] + 0xeaa127fa, 11);
+	MD5_MB_STEP(MD5_MB_F3, c, d, a, b, in[ 3] + 0xd4ef3085, 16);
+	MD5_MB_STEP(MD5_MB_F3, b, c, d, a, in[ 6] + 0x04881d05, 23);
+	MD5_MB_STEP(MD5_MB_F3, a, b, c, d, in[ 9] + 0xd9d4d039,  4);
+	MD5_MB_STEP(MD5_MB_F3, d, a, b, c, in[12] + 0xe6db99e5, 11);
+	MD5_MB_STEP(MD5_MB_F3, c, d, a, b, in[15] + 0x1fa27cf8, 16);
+	MD5_MB_STEP(MD5_MB_F3, b, c, d, a, in[ 2] + 0xc4ac5665, 23);
+
+	MD5_MB_STEP(MD5_MB_F4, a, b, c, d, in[ 0] + 0xf4292244,  6);
+	MD5_MB_STEP(MD5_MB_F4, d, a, b, c, in[ 7] + 0x432aff97, 10);
+	MD5_MB_STEP(MD5_MB_F4, c, d, a, b, in[14] + 0xab9423a7, 15);
+	MD5_MB_STEP(MD5_MB_F4, b, c, d, a, in[ 5] + 0xfc93a039, 21);
+	MD5_MB_STEP(MD5_MB_F4, a, b, c, d, in[12] + 0x655b59c3,  6);
+	MD5_MB_STEP(MD5_MB_F4, d, a, b, c, in[ 3] + 0x8f0ccc92, 10);
+	MD5_MB_STEP(MD5_MB_F4, c, d, a, b, in[10] + 0xffeff47d, 15);
+	MD5_MB_STEP(MD5_MB_F4, b, c, d, a, in[ 1] + 0x85845dd1, 21);
+	MD5_MB_STEP(MD5_MB_F4, a, b, c, d, in[ 8] + 0x6fa87e4f,  6);
+	MD5_MB_STEP(MD5_MB_F4, d, a, b, c, in[15] + 0xfe2ce6e0, 10);
+	MD5_MB_STEP(MD5_MB_F4, c, d, a, b, in[ 6] + 0xa3014314, 15);
+	MD5_MB_STEP(MD5_MB_F4, b, c, d, a, in[13] + 0x4e0811a1, 21);
+	MD5_MB_STEP(MD5_MB_F4, a, b, c, d, in[ 4] + 0xf7537e82,  6);
+	MD5_MB_STEP(MD5_MB_F4, d, a, b, c, in[11] + 0xbd3af235, 10);
+	MD5_MB_STEP(MD5_MB_F4, c, d, a, b, in[ 2] + 0x2ad7d2bb, 15);
+	MD5_MB_STEP(MD5_MB_F4, b, c, d, a, in[ 9] + 0xeb86d391, 21);
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+}
+
+/*
+ *	Without a vector unit the compiler lowers this to scalar
+ *	operations.  It's still correct, and is used for jobs which
+ *	resume from a state the normal MD5 functions can't load.
+ */
+static void md5_mb_transform_generic(md5_mb_vec_t state[static 4],
+				     uint8_t const blocks[static FR_MD5_MB_LANES][MD5_MB_BLOCK_LENGTH])
+{
+	md5_mb_transform(state, blocks);
+}
+
+#ifdef MD5_MB_HAVE_X86
+static CC_HINT(target("avx2"))
+void md5_mb_transform_avx2(md5_mb_vec_t state[static 4],
+			   uint8_t const blocks[static FR_MD5_MB_LANES][MD5_MB_BLOCK_LENGTH])
+{
+	md5_mb_transform(state, blocks);
+}
+
+/*
+ *	Same lane count as AVX2, but AVX-512VL gives us a native
+ *	rotate and a three input logic op for the round functions.
+ */
+static CC_HINT(target("avx512f,avx512vl"))
+void md5_mb_transform_avx512(md5_mb_vec_t state[static 4],
+			     uint8_t const blocks[static FR_MD5_MB_LANES][MD5_MB_BLOCK_LENGTH])
+{
+	md5_mb_transform(state, blocks);
+}
+#endif
+
+/** Select the best transform for this CPU
+ *
+ * Racing threads will all pick the same function, so there's no need
+ * for any locking.
+ */
+static void md5_mb_select(void)
+{
+#ifdef MD5_MB_HAVE_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl")) {
+		md5_mb_engine_name = "avx512";
+		md5_mb_transform_func = md5_mb_transform_avx512;
+		return;
+	}
+
+	if (__builtin_cpu_supports("avx2")) {
+		md5_mb_engine_name = "avx2";
+		md5_mb_transform_func = md5_mb_transform_avx2;
+		return;
+	}
+#endif
+
+#ifdef MD5_MB_HAVE_SIMD
+	md5_mb_engine_name = "generic";
+	md5_mb_transform_func = md5_mb_transform_generic;
+#else
+	md5_mb_engine_name = "scalar";
+#endif
+}
+
+/** Produce the next block of input for a lane, including padding
+ *
+ * @param[in] lane	to fill the block for.
+ * @param[out] block	to fill.
+ * @return
+ *	- true if this is the final block for the lane's job.
+ *	- false if more blocks follow.
+ */
+static bool md5_mb_lane_block(md5_mb_lane_t *lane, uint8_t block[static MD5_MB_BLOCK_LENGTH])
+{
+	fr_md5_mb_job_t	*job = lane->job;
+	size_t		have = 0;
+	uint64_t	bits;
+	int		i;
+
+	while (!lane->padded && (have < MD5_MB_BLOCK_LENGTH)) {
+		size_t len;
+
+		if (lane->frag == FR_MD5_MB_MAX_IN) {
+			block[have++] = 0x80;
+			lane->padded = true;
+			break;
+		}
+
+		len = job->in[lane->frag].len - lane->offset;
+		if (len == 0) {
+			lane->frag++;
+			lane->offset = 0;
+			continue;
+		}
+
+		if (len > (MD5_MB_BLOCK_LENGTH - have)) len = MD5_MB_BLOCK_LENGTH - have;
+
+		memcpy(block + have, job->in[lane->frag].data + lane->offset, len);
+		have += len;
+		lane->offset += len;
+		lane->total += len;
+	}
+
+	if (!lane->padded) return false;
+
+	/*
+	 *	No room for the length, it goes in the next block.
+	 */
+	if (have > (MD5_MB_BLOCK_LENGTH - 8)) {
+		memset(block + have, 0, MD5_MB_BLOCK_LENGTH - have);
+		return false;
+	}
+
+	memset(block + have, 0, (MD5_MB_BLOCK_LENGTH - 8) - have);
+
+	bits = lane->total << 3;
+	for (i = 0; i < 8; i++) block[(MD5_MB_BLOCK_LENGTH - 8) + i] = bits >> (i * 8);
+
+	return true;
+}
+
+/** Name of the multi-buffer MD5 implementation in use
+ *
+ * @return "avx512", "avx2", "generic" or "scalar".
+ */
+char const *fr_md5_mb_engine(void)
+{
+	if (unlikely(!md5_mb_engine_name)) md5_mb_select();
+
+	return md5_mb_engine_name;
+}
+
+/** Hash jobs through the lanes of a transform
+ *
+ */
+static void md5_mb_run(fr_md5_mb_job_t *jobs, size_t num, md5_mb_transform_t transform)
+{
+	md5_mb_lane_t	lanes[FR_MD5_MB_LANES] = {};
+	md5_mb_vec_t	state[4] = {};
+	uint8_t		blocks[FR_MD5_MB_LANES][MD5_MB_BLOCK_LENGTH] = {};
+	bool		last[FR_MD5_MB_LANES];
+	size_t		next = 0, active = 0, i, j;
+
+	for (;;) {
+		/*
+		 *	Give idle lanes a new job
+		 */
+		for (i = 0; (i < FR_MD5_MB_LANES) && (next < num); i++) {
+			fr_md5_mb_job_t		*job;
+			uint32_t const		*h;
+
+			if (lanes[i].job) continue;
+
+			job = &jobs[next++];
+			h = job->state ? job->state->h : md5_mb_iv;
+
+			lanes[i] = (md5_mb_lane_t){
+				.job = job,
+				.total = job->state ? job->state->len : 0
+			};
+			for (j = 0; j < 4; j++) state[j][i] = h[j];
+			active++;
+		}
+		if (!active) break;
+
+		/*
+		 *	Idle lanes are transformed along with the
+		 *	others, but their output is ignored.
+		 */
+		for (i = 0; i < FR_MD5_MB_LANES; i++) {
+			last[i] = lanes[i].job ? md5_mb_lane_block(&lanes[i], blocks[i]) : false;
+		}
+
+		transform(state, blocks);
+
+		for (i = 0; i < FR_MD5_MB_LANES; i++) {
+			uint8_t *out;
+
+			if (!last[i]) continue;
+
+			out = lanes[i].job->out;
+			for (j = 0; j < 4; j++) {
+				uint32_t word = state[j][i];
+
+				out[(j * 4) + 0] = word;
+				out[(j * 4) + 1] = word >> 8;
+				out[(j * 4) + 2] = word >> 16;
+				out[(j * 4) + 3] = word >> 24;
+			}
+
+			lanes[i].job = NULL;
+			active--;
+		}
+	}
+}
+
+/** Calculate the MD5 state after hashing a single block
+ *
+ * @param[out] state	to initialise.
+ * @param[in] block	to hash.
+ */
+void fr_md5_mb_state_init(fr_md5_mb_state_t *state, uint8_t const block[static 64])
+{
+	md5_mb_vec_t	vstate[4] = {};
+	uint8_t		blocks[FR_MD5_MB_LANES][MD5_MB_BLOCK_LENGTH] = {};
+	size_t		i;
+
+	memcpy(blocks[0], block, MD5_MB_BLOCK_LENGTH);
+	for (i = 0; i < 4; i++) vstate[i][0] = md5_mb_iv[i];
+
+	md5_mb_transform_generic(vstate, blocks);
+
+	for (i = 0; i < 4; i++) state->h[i] = vstate[i][0];
+	state->len = MD5_MB_BLOCK_LENGTH;
+}
+
+/** Calculate the MD5 digests of multiple independent messages
+ *
+ * Jobs are assigned to lanes as they become free, so messages of
+ * different lengths can be mixed freely in a single call.
+ *
+ * With a single job, or where there's no vector unit, this falls
+ * back to the normal MD5 functions (which may be OpenSSL's), except
+ * for jobs which resume from a #fr_md5_mb_state_t.
+ *
+ * @param[in] jobs	to calculate digests for.
+ * @param[in] num	Number of jobs.
+ */
+void fr_md5_mb_calc(fr_md5_mb_job_t *jobs, size_t num)
+{
+	size_t		i, j;
+
+	if (unlikely(!md5_mb_engine_name)) md5_mb_select();
+
+	if ((num >= 2) && md5_mb_transform_func) {
+		md5_mb_run(jobs, num, md5_mb_transform_func);
+		return;
+	}
+
+	for (i = 0; i < num; i++) {
+		fr_md5_ctx_t *ctx;
+
+		if (jobs[i].state) {
+			md5_mb_run(&jobs[i], 1, md5_mb_transform_func ? md5_mb_transform_func : md5_mb_transform_generic);
+			continue;
+		}
+
+		ctx = fr_md5_ctx_alloc_from_list();
+		for (j = 0; j < FR_MD5_MB_MAX_IN; j++) {
+			if (!jobs[i].in[j].len) continue;
+			fr_md5_update(ctx, jobs[i].in[j].data, jobs[i].in[j].len);
+		}
+		fr_md5_final(jobs[i].out, ctx);
+		fr_md5_ctx_free_from_list(&ctx);
+	}
+}
@@ -0,0 +1,221 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for the single and multi-buffer MD5 functions
+ *
+ * @file src/lib/util/md5_tests.c
+ *
+ * @copyright 2025 The FreeRADIUS server project
+ */
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/md5.h>
+#include <freeradius-devel/util/time.h>
+
+/*
+ *	RFC 1321 Appendix A.5
+ */
+static struct {
+	char const	*in;
+	uint8_t		digest[MD5_DIGEST_LENGTH];
+} rfc1321_vectors[] = {
+	{ "", { 0xd4, 0x1d, 0x8c, 0xd9, 0x8f, 0x00, 0xb2, 0x04, 0xe9, 0x80, 0x09, 0x98, 0xec, 0xf8, 0x42, 0x7e } },
+	{ "a", { 0x0c, 0xc1, 0x75, 0xb9, 0xc0, 0xf1, 0xb6, 0xa8, 0x31, 0xc3, 0x99, 0xe2, 0x69, 0x77, 0x26, 0x61 } },
+	{ "abc", { 0x90, 0x01, 0x50, 0x98, 0x3c, 0xd2, 0x4f, 0xb0, 0xd6, 0x96, 0x3f, 0x7d, 0x28, 0xe1, 0x7f, 0x72 } },
+	{ "message digest", { 0xf9, 0x6b, 0x69, 0x7d, 0x7c, 0xb7, 0x93, 0x8d, 0x52, 0x5a, 0x2f, 0x31, 0xaa, 0xf1, 0x61, 0xd0 } },
+	{ "abcdefghijklmnopqrstuvwxyz", { 0xc3, 0xfc, 0xd3, 0xd7, 0x61, 0x92, 0xe4, 0x00, 0x7d, 0xfb, 0x49, 0x6c, 0xca, 0x67, 0xe1, 0x3b } },
+	{ "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789",
+	  { 0xd1, 0x74, 0xab, 0x98, 0xd2, 0x77, 0xd9, 0xf5, 0xa5, 0x61, 0x1c, 0x2c, 0x9f, 0x41, 0x9d, 0x9f } },
+	{ "12345678901234567890123456789012345678901234567890123456789012345678901234567890",
+	  { 0x57, 0xed, 0xf4, 0xa2, 0x2b, 0xe3, 0xc9, 0x55, 0xac, 0x49, 0xda, 0x2e, 0x21, 0x07, 0xb6, 0x7a } }
+};
+
+static void test_md5_calc(void)
+{
+	uint8_t	digest[MD5_DIGEST_LENGTH];
+	size_t	i;
+
+	for (i = 0; i < NUM_ELEMENTS(rfc1321_vectors); i++) {
+		fr_md5_calc(digest, (uint8_t const *)rfc1321_vectors[i].in, strlen(rfc1321_vectors[i].in));
+		TEST_CHECK(memcmp(digest, rfc1321_vectors[i].digest, sizeof(digest)) == 0);
+		TEST_MSG("\"%s\"", rfc1321_vectors[i].in);
+	}
+}
+
+static void test_md5_mb_vectors(void)
+{
+	fr_md5_mb_job_t	jobs[NUM_ELEMENTS(rfc1321_vectors)];
+	uint8_t		digest[NUM_ELEMENTS(rfc1321_vectors)][MD5_DIGEST_LENGTH];
+	size_t		i;
+
+	TEST_MSG_ALWAYS("engine: %s", fr_md5_mb_engine());
+
+	for (i = 0; i < NUM_ELEMENTS(rfc1321_vectors); i++) {
+		jobs[i] = (fr_md5_mb_job_t) {
+			.in = { { .data = (uint8_t const *)rfc1321_vectors[i].in, .len = strlen(rfc1321_vectors[i].in) } },
+			.out = digest[i]
+		};
+	}
+
+	fr_md5_mb_calc(jobs, NUM_ELEMENTS(jobs));
+
+	for (i = 0; i < NUM_ELEMENTS(rfc1321_vectors); i++) {
+		TEST_CHECK(memcmp(digest[i], rfc1321_vectors[i].digest, MD5_DIGEST_LENGTH) == 0);
+		TEST_MSG("\"%s\"", rfc1321_vectors[i].in);
+	}
+}
+
+/*
+ *	Mixed lengths and fragments, so lanes finish at different
+ *	times, and padding lands on every offset within a block.
+ */
+static void test_md5_mb_mixed(void)
+{
+	static uint8_t	data[1024];
+	fr_md5_mb_job_t	jobs[100];
+	uint8_t		digest[100][MD5_DIGEST_LENGTH];
+	uint8_t		expected[MD5_DIGEST_LENGTH];
+	size_t		i, j;
+
+	for (i = 0; i < sizeof(data); i++) data[i] = (uint8_t)((i * 31) ^ (i >> 3));
+
+	for (i = 0; i < NUM_ELEMENTS(jobs); i++) {
+		jobs[i] = (fr_md5_mb_job_t) {
+			.in = {
+				{ .data = data, .len = (i * 7) % 131 },
+				{ .data = data + 200, .len = (i % 3) ? 0 : i },
+				{ .data = data + 400, .len = (i * 13) % 257 }
+			},
+			.out = digest[i]
+		};
+	}
+
+	fr_md5_mb_calc(jobs, NUM_ELEMENTS(jobs));
+
+	for (i = 0; i < NUM_ELEMENTS(jobs); i++) {
+		fr_md5_ctx_t *ctx = fr_md5_ctx_alloc();
+
+		for (j = 0; j < FR_MD5_MB_MAX_IN; j++) fr_md5_update(ctx, jobs[i].in[j].data, jobs[i].in[j].len);
+		fr_md5_final(expected, ctx);
+		fr_md5_ctx_free(&ctx);
+
+		TEST_CHECK(memcmp(digest[i], expected, sizeof(expected)) == 0);
+		TEST_MSG("job %zu", i);
+	}
+}
+
+/*
+ *	Jobs resuming from a common first block must match hashing
+ *	the whole message, both in batches and on their own.
+ */
+static void test_md5_mb_state(void)
+{
+	static uint8_t		data[512];
+	uint8_t			prefix[64];
+	fr_md5_mb_state_t	state;
+	fr_md5_mb_job_t		jobs[20];
+	uint8_t			digest[20][MD5_DIGEST_LENGTH];
+	uint8_t			expected[MD5_DIGEST_LENGTH];
+	size_t			i;
+
+	for (i = 0; i < sizeof(prefix); i++) prefix[i] = (uint8_t)(i ^ 0x36);
+	for (i = 0; i < sizeof(data); i++) data[i] = (uint8_t)(i * 13);
+
+	fr_md5_mb_state_init(&state, prefix);
+	TEST_CHECK(state.len == sizeof(prefix));
+
+	for (i = 0; i < NUM_ELEMENTS(jobs); i++) {
+		jobs[i] = (fr_md5_mb_job_t) {
+			.in = { { .data = data, .len = (i * 29) % sizeof(data) } },
+			.state = (i % 4) ? &state : NULL,
+			.out = digest[i]
+		};
+	}
+
+	fr_md5_mb_calc(jobs, NUM_ELEMENTS(jobs));
+	fr_md5_mb_calc(&jobs[1], 1);		/* Single job with a state */
+
+	for (i = 0; i < NUM_ELEMENTS(jobs); i++) {
+		fr_md5_ctx_t *ctx = fr_md5_ctx_alloc();
+
+		if (jobs[i].state) fr_md5_update(ctx, prefix, sizeof(prefix));
+		fr_md5_update(ctx, jobs[i].in[0].data, jobs[i].in[0].len);
+		fr_md5_final(expected, ctx);
+		fr_md5_ctx_free(&ctx);
+
+		TEST_CHECK(memcmp(digest[i], expected, sizeof(expected)) == 0);
+		TEST_MSG("job %zu", i);
+	}
+}
+
+/*
+ *	RADIUS Response Authenticator sized inputs, one at a time
+ *	with the normal MD5 functions vs in batches.
+ */
+static void test_md5_mb_bench(void)
+{
+	static uint8_t	packets[64][128];
+	uint8_t const	*secret = (uint8_t const *)"testing123";
+	fr_md5_mb_job_t	jobs[NUM_ELEMENTS(packets)];
+	uint8_t		digest[NUM_ELEMENTS(packets)][MD5_DIGEST_LENGTH];
+	fr_time_t	start;
+	fr_time_delta_t	single, multi;
+	size_t		i, j, reps = 5000;
+
+	for (i = 0; i < NUM_ELEMENTS(packets); i++) memset(packets[i], (int)i, sizeof(packets[i]));
+
+	start = fr_time();
+	for (i = 0; i < reps; i++) {
+		for (j = 0; j < NUM_ELEMENTS(packets); j++) {
+			fr_md5_ctx_t *ctx = fr_md5_ctx_alloc_from_list();
+
+			fr_md5_update(ctx, packets[j], sizeof(packets[j]));
+			fr_md5_update(ctx, secret, 10);
+			fr_md5_final(digest[j], ctx);
+			fr_md5_ctx_free_from_list(&ctx);
+		}
+	}
+	single = fr_time_sub(fr_time(), start);
+
+	for (j = 0; j < NUM_ELEMENTS(packets); j++) {
+		jobs[j] = (fr_md5_mb_job_t) {
+			.in = {
+				{ .data = packets[j], .len = sizeof(packets[j]) },
+				{ .data = secret, .len = 10 }
+			},
+			.out = digest[j]
+		};
+	}
+
+	start = fr_time();
+	for (i = 0; i < reps; i++) fr_md5_mb_calc(jobs, NUM_ELEMENTS(jobs));
+	multi = fr_time_sub(fr_time(), start);
+
+	TEST_MSG_ALWAYS("single  %"PRIu64" ns/digest", fr_time_delta_unwrap(single) / (reps * NUM_ELEMENTS(packets)));
+	TEST_MSG_ALWAYS("%-7s %"PRIu64" ns/digest", fr_md5_mb_engine(),
+			fr_time_delta_unwrap(multi) / (reps * NUM_ELEMENTS(packets)));
+}
+
+TEST_LIST = {
+	{ "md5-calc",			test_md5_calc		},
+	{ "md5-mb-vectors",		test_md5_mb_vectors	},
+	{ "md5-mb-mixed",		test_md5_mb_mixed	},
+	{ "md5-mb-state",		test_md5_mb_state	},
+	{ "md5-mb-bench",		test_md5_mb_bench	},
+
+	{ NULL }
+};
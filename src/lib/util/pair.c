@@ -56,6 +56,7 @@ void fr_pair_list_init(fr_pair_list_t *list)
 #ifdef WITH_VERIFY_PTR
 	list->verified = true;
 #endif
+	list->index = NULL;
 	list->is_child = false;
 }
 
@@ -182,6 +183,17 @@ fr_pair_t *fr_pair_alloc_null(TALLOC_CTX *ctx)
 	return vp;
 }
 
+/** Invalidate the index of the list a pair is in, before changing its da
+ *
+ * @note Internal use by functions which change vp->da in place.
+ */
+static inline CC_HINT(always_inline) void pair_parent_list_index_invalidate(fr_pair_t const *vp)
+{
+	fr_pair_list_t *parent = fr_pair_parent_list(vp);
+
+	if (parent) _fr_pair_list_index_invalidate(parent);
+}
+
 /** Continue initialising an fr_pair_t assigning a da
  *
  * @note Internal use by the pair allocation functions only.
@@ -334,6 +346,17 @@ int fr_pair_reinit_from_da(fr_pair_list_t *list, fr_pair_t *vp, fr_dict_attr_t c
 		fr_value_box_init(&vp->data, da->type, da, false);
 	}
 
+	/*
+	 *	The list index is keyed by da, so the pair has to
+	 *	come out of the list before its da changes, or the
+	 *	slot for the old da would still point at it.
+	 */
+	if (list) {
+		fr_pair_remove(list, vp);
+	} else {
+		pair_parent_list_index_invalidate(vp);
+	}
+
 	to_free = vp->da;
 	vp->da = da;
 
@@ -342,14 +365,7 @@ int fr_pair_reinit_from_da(fr_pair_list_t *list, fr_pair_t *vp, fr_dict_attr_t c
 	 */
 	fr_dict_attr_unknown_free(&to_free);
 
-	/*
-	 *	Ensure we update the attribute index in the parent.
-	 */
-	if (list) {
-		fr_pair_remove(list, vp);
-
-		fr_pair_append(list, vp);
-	}
+	if (list) fr_pair_append(list, vp);
 
 	return 0;
 }
@@ -607,6 +623,7 @@ int fr_pair_raw_afrom_pair(fr_pair_t *vp, uint8_t const *data, size_t data_len)
 	unknown = fr_dict_attr_unknown_afrom_da(vp, vp->da);
 	if (!unknown) return -1;
 
+	pair_parent_list_index_invalidate(vp);
 	vp->da = unknown;
 	fr_assert(vp->da->type == FR_TYPE_OCTETS);
 
@@ -663,6 +680,352 @@ static void *fr_pair_iter_next_by_ancestor(fr_dcursor_t *cursor, void *current,
 	return c;
 }
 
+/** A slot in a pair list index
+ *
+ */
+typedef struct {
+	fr_dict_attr_t const	*da;			//!< Attribute this slot is for.  NULL if the slot is free.
+	fr_pair_t		*vp;			//!< First pair in the list with this attribute.
+} pair_list_index_slot_t;
+
+/** Maps attributes to the first pair with that attribute in a list
+ *
+ * The index is only used if num_elements matches the length of the list,
+ * so if the list is modified without going through the pair API the index
+ * is rebuilt rather than returning stale pairs.
+ */
+struct fr_pair_list_index_s {
+	pair_list_index_slot_t	*slots;			//!< Open addressed, linearly probed, hash table.
+	unsigned int		mask;			//!< Number of slots - 1.
+	unsigned int		used;			//!< Number of slots in use.
+	size_t			num_elements;		//!< Length of the list the index describes.
+	bool			valid;			//!< Whether the index describes the list.
+	unsigned int		misses;			//!< Searches since the index was invalidated.
+};
+
+/** Minimum list length before we build an index.  0 disables indexes
+ *
+ */
+static unsigned int pair_list_index_min = FR_PAIR_LIST_INDEX_THRESHOLD;
+
+/** How many searches of an invalid index we perform linearly before rebuilding it
+ *
+ * Stops lists which are modified as often as they're searched from
+ * constantly rebuilding their index.
+ */
+#define PAIR_LIST_INDEX_REBUILD	4
+
+typedef enum {
+	PAIR_LIST_INDEX_INSERT_HEAD = 0,		//!< Pair was inserted at the head of the list.
+	PAIR_LIST_INDEX_INSERT_TAIL,			//!< Pair was inserted at the tail of the list.
+	PAIR_LIST_INDEX_INSERT_AFTER,			//!< Pair was inserted after another pair.
+	PAIR_LIST_INDEX_INSERT_BEFORE			//!< Pair was inserted before another pair.
+} pair_list_index_insert_t;
+
+/** Set the minimum list length before an index is built
+ *
+ * Should only be called at startup, before any lists are searched.
+ *
+ * @param[in] threshold	Minimum list length.  0 disables indexing.
+ */
+void fr_pair_list_index_threshold_set(unsigned int threshold)
+{
+	pair_list_index_min = threshold;
+}
+
+/** Return the minimum list length before an index is built
+ *
+ */
+unsigned int fr_pair_list_index_threshold(void)
+{
+	return pair_list_index_min;
+}
+
+static inline CC_HINT(always_inline) unsigned int pair_list_index_hash(fr_pair_list_index_t const *idx,
+									fr_dict_attr_t const *da)
+{
+	return (unsigned int)(((uint64_t)(uintptr_t)da * UINT64_C(0x9e3779b97f4a7c15)) >> 32) & idx->mask;
+}
+
+/** Return the slot for a da, or the free slot it would occupy
+ *
+ */
+static inline CC_HINT(always_inline) pair_list_index_slot_t *pair_list_index_slot(fr_pair_list_index_t const *idx,
+										   fr_dict_attr_t const *da)
+{
+	unsigned int i = pair_list_index_hash(idx, da);
+
+	for (;;) {
+		pair_list_index_slot_t *slot = &idx->slots[i];
+
+		if (!slot->da || (slot->da == da)) return slot;
+		i = (i + 1) & idx->mask;
+	}
+}
+
+/** Free a slot, shifting back any entries which were displaced by it
+ *
+ */
+static void pair_list_index_slot_free(fr_pair_list_index_t *idx, pair_list_index_slot_t *slot)
+{
+	unsigned int i = slot - idx->slots, j = i;
+
+	for (;;) {
+		unsigned int k;
+
+		j = (j + 1) & idx->mask;
+		if (!idx->slots[j].da) break;
+
+		/*
+		 *	Entry in j can stay where it is if its
+		 *	home slot is cyclically in (i, j].
+		 */
+		k = pair_list_index_hash(idx, idx->slots[j].da);
+		if ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j))) continue;
+
+		idx->slots[i] = idx->slots[j];
+		i = j;
+	}
+
+	idx->slots[i] = (pair_list_index_slot_t){ .da = NULL };
+	idx->used--;
+}
+
+static int pair_list_index_resize(fr_pair_list_index_t *idx, unsigned int num_slots)
+{
+	pair_list_index_slot_t	*old = idx->slots;
+	unsigned int		old_num = old ? idx->mask + 1 : 0, i;
+
+	idx->slots = talloc_zero_array(idx, pair_list_index_slot_t, num_slots);
+	if (unlikely(!idx->slots)) {
+		idx->slots = old;
+		return -1;
+	}
+	idx->mask = num_slots - 1;
+
+	for (i = 0; i < old_num; i++) {
+		if (!old[i].da) continue;
+		*pair_list_index_slot(idx, old[i].da) = old[i];
+	}
+	talloc_free(old);
+
+	return 0;
+}
+
+/** Add a pair to the index
+ *
+ * @param[in] idx	to add pair to.
+ * @param[in] vp	to add.
+ * @param[in] first	if true, vp replaces any existing entry for its da.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int pair_list_index_add(fr_pair_list_index_t *idx, fr_pair_t *vp, bool first)
+{
+	pair_list_index_slot_t *slot = pair_list_index_slot(idx, vp->da);
+
+	if (slot->da) {
+		if (first) slot->vp = vp;
+		return 0;
+	}
+
+	/*
+	 *	Keep the load factor <= 0.5 so probe
+	 *	sequences stay short.
+	 */
+	if (((idx->used + 1) * 2) > (idx->mask + 1)) {
+		if (pair_list_index_resize(idx, (idx->mask + 1) * 2) < 0) return -1;
+		slot = pair_list_index_slot(idx, vp->da);
+	}
+
+	slot->da = vp->da;
+	slot->vp = vp;
+	idx->used++;
+
+	return 0;
+}
+
+/** Build or rebuild the index for a list
+ *
+ * The index is allocated in the ctx of the pair which owns the list,
+ * so it's freed along with it.
+ */
+static fr_pair_list_index_t *pair_list_index_build(fr_pair_list_t *list, size_t num)
+{
+	fr_pair_list_index_t	*idx = list->index;
+	unsigned int		num_slots = 64;
+
+	if (!idx) {
+		idx = talloc_zero(fr_pair_list_parent(list), fr_pair_list_index_t);
+		if (unlikely(!idx)) return NULL;
+		list->index = idx;
+	}
+
+	while (num_slots < (num * 2)) num_slots <<= 1;
+
+	if (!idx->slots || ((idx->mask + 1) < num_slots)) {
+		talloc_free(idx->slots);
+		idx->slots = NULL;
+		if (pair_list_index_resize(idx, num_slots) < 0) {
+			idx->valid = false;
+			return NULL;
+		}
+	} else {
+		memset(idx->slots, 0, sizeof(idx->slots[0]) * (idx->mask + 1));
+	}
+	idx->used = 0;
+
+	fr_pair_list_foreach(list, vp) {
+		if (unlikely(pair_list_index_add(idx, vp, false) < 0)) {
+			idx->valid = false;
+			return NULL;
+		}
+	}
+
+	idx->num_elements = num;
+	idx->valid = true;
+	idx->misses = 0;
+
+	return idx;
+}
+
+/** Use the list's index to find the first pair with a given da
+ *
+ * @param[out] out	First pair with the da, or NULL if there are none.
+ * @param[in] list	to search.
+ * @param[in] da	to search for.
+ * @return
+ *	- true if the index was used, and out is valid.
+ *	- false if the list should be searched linearly.
+ */
+static inline CC_HINT(always_inline) bool pair_list_index_find(fr_pair_t **out, fr_pair_list_t const *list,
+								fr_dict_attr_t const *da)
+{
+	fr_pair_list_index_t	*idx = list->index;
+	pair_list_index_slot_t	*slot;
+	size_t			num;
+
+	if (!list->is_child || !pair_list_index_min) return false;
+
+	num = fr_pair_order_list_num_elements(&list->order);
+	if (num < pair_list_index_min) return false;
+
+	if (!idx || !idx->valid || (idx->num_elements != num)) {
+		if (idx && (idx->misses++ < PAIR_LIST_INDEX_REBUILD)) return false;
+
+		idx = pair_list_index_build(UNCONST(fr_pair_list_t *, list), num);
+		if (!idx) return false;
+	}
+
+	slot = pair_list_index_slot(idx, da);
+	*out = slot->da ? slot->vp : NULL;
+
+	return true;
+}
+
+/** Update the index after a pair has been inserted into a list
+ *
+ */
+static inline CC_HINT(always_inline) void pair_list_index_insert(fr_pair_list_t *list, fr_pair_t const *pos,
+								  fr_pair_t *vp, pair_list_index_insert_t where)
+{
+	fr_pair_list_index_t	*idx = list->index;
+	pair_list_index_slot_t	*slot;
+
+	if (!idx || !idx->valid) return;
+
+	if ((idx->num_elements + 1) != fr_pair_order_list_num_elements(&list->order)) goto invalidate;
+
+	switch (where) {
+	case PAIR_LIST_INDEX_INSERT_TAIL:
+		if (pair_list_index_add(idx, vp, false) < 0) goto invalidate;
+		break;
+
+	case PAIR_LIST_INDEX_INSERT_HEAD:
+		if (pair_list_index_add(idx, vp, true) < 0) goto invalidate;
+		break;
+
+	/*
+	 *	If there's already a pair with this da, we only know
+	 *	which comes first if we're inserting next to it.
+	 *	This is the common case for fr_pair_replace().
+	 */
+	case PAIR_LIST_INDEX_INSERT_AFTER:
+	case PAIR_LIST_INDEX_INSERT_BEFORE:
+		slot = pair_list_index_slot(idx, vp->da);
+		if (!slot->da) {
+			if (pair_list_index_add(idx, vp, false) < 0) goto invalidate;
+			break;
+		}
+
+		if (slot->vp != pos) goto invalidate;
+		if (where == PAIR_LIST_INDEX_INSERT_BEFORE) slot->vp = vp;
+		break;
+	}
+	idx->num_elements++;
+	return;
+
+invalidate:
+	_fr_pair_list_index_invalidate(list);
+}
+
+/** Update the index before a pair is removed from a list
+ *
+ * @note Private, only for use by fr_pair_remove().
+ *
+ * @param[in] list	the pair is being removed from.
+ * @param[in] vp	being removed.
+ */
+void _fr_pair_list_index_remove(fr_pair_list_t *list, fr_pair_t const *vp)
+{
+	fr_pair_list_index_t	*idx = list->index;
+	pair_list_index_slot_t	*slot;
+	fr_pair_t		*next;
+
+	if (!idx->valid) return;
+
+	if (fr_pair_order_list_parent(vp) != &list->order) {
+		fr_pair_list_t *parent = fr_pair_parent_list(vp);
+
+		_fr_pair_list_index_invalidate(list);
+		if (parent) _fr_pair_list_index_invalidate(parent);
+		return;
+	}
+
+	if (idx->num_elements != fr_pair_order_list_num_elements(&list->order)) {
+		_fr_pair_list_index_invalidate(list);
+		return;
+	}
+
+	slot = pair_list_index_slot(idx, vp->da);
+	if (slot->vp == vp) {
+		next = UNCONST(fr_pair_t *, vp);
+		while ((next = fr_pair_list_next(list, next)) && (next->da != vp->da));
+
+		if (next) {
+			slot->vp = next;
+		} else {
+			pair_list_index_slot_free(idx, slot);
+		}
+	}
+	idx->num_elements--;
+}
+
+/** Mark a list's index as invalid
+ *
+ * @note Private, only for use by pair list manipulation functions.
+ *
+ * @param[in] list	whose index should be invalidated.
+ */
+void _fr_pair_list_index_invalidate(fr_pair_list_t *list)
+{
+	if (!list->index) return;
+
+	list->index->valid = false;
+	list->index->misses = 0;
+}
+
 /** Return the number of instances of a given da in the specified list
  *
  * @param[in] list	to search in.
@@ -678,6 +1041,11 @@ unsigned int fr_pair_count_by_da(fr_pair_list_t const *list, fr_dict_attr_t cons
 
 	if (fr_pair_list_empty(list)) return 0;
 
+	if (pair_list_index_find(&vp, list, da)) {
+		if (!vp) return 0;
+		count++;
+	}
+
 	while ((vp = fr_pair_list_next(list, vp))) if (da == vp->da) count++;
 
 	return count;
@@ -702,6 +1070,8 @@ fr_pair_t *fr_pair_find_by_da(fr_pair_list_t const *list, fr_pair_t const *prev,
 
 	PAIR_LIST_VERIFY(list);
 
+	if (!prev && pair_list_index_find(&vp, list, da)) return vp;
+
 	while ((vp = fr_pair_list_next(list, vp))) if (da == vp->da) return vp;
 
 	return NULL;
@@ -750,6 +1120,14 @@ fr_pair_t *fr_pair_find_by_da_idx(fr_pair_list_t const *list, fr_dict_attr_t con
 
 	PAIR_LIST_VERIFY(list);
 
+	/*
+	 *	Start from the first instance of da
+	 */
+	if (pair_list_index_find(&vp, list, da)) {
+		if (!vp || (idx == 0)) return vp;
+		idx--;
+	}
+
 	while ((vp = fr_pair_list_next(list, vp))) {
 		if (da != vp->da) continue;
 
@@ -986,6 +1364,8 @@ static int _pair_list_dcursor_insert(fr_dcursor_t *cursor, void *to_insert, UNUS
 	 */
 	fr_pair_order_list_set_head(tlist, vp);
 
+	_fr_pair_list_index_invalidate(fr_pair_list_from_dlist(cursor->dlist));
+
 	PAIR_VERIFY(vp);
 
 	return 0;
@@ -1023,6 +1403,9 @@ static int _pair_list_dcursor_remove(NDEBUG_UNUSED fr_dcursor_t *cursor, void *t
 	 */
 	fr_pair_order_list_set_head(NULL, vp);
 
+	_fr_pair_list_index_invalidate(fr_pair_list_from_dlist(cursor->dlist));
+	if (parent) _fr_pair_list_index_invalidate(parent);
+
 	PAIR_VERIFY(vp);
 
 	if (&parent->order.head.dlist_head == cursor->dlist) return 0;
@@ -1323,6 +1706,7 @@ int fr_pair_prepend(fr_pair_list_t *list, fr_pair_t *to_add)
 	}
 
 	fr_pair_order_list_insert_head(&list->order, to_add);
+	pair_list_index_insert(list, NULL, to_add, PAIR_LIST_INDEX_INSERT_HEAD);
 
 	return 0;
 }
@@ -1354,6 +1738,7 @@ int fr_pair_append(fr_pair_list_t *list, fr_pair_t *to_add)
 	}
 
 	fr_pair_order_list_insert_tail(&list->order, to_add);
+	pair_list_index_insert(list, NULL, to_add, PAIR_LIST_INDEX_INSERT_TAIL);
 
 	return 0;
 }
@@ -1387,6 +1772,7 @@ int fr_pair_insert_after(fr_pair_list_t *list, fr_pair_t *pos, fr_pair_t *to_add
 	}
 
 	fr_pair_order_list_insert_after(&list->order, pos, to_add);
+	pair_list_index_insert(list, pos, to_add, PAIR_LIST_INDEX_INSERT_AFTER);
 
 	return 0;
 }
@@ -1421,6 +1807,7 @@ int fr_pair_insert_before(fr_pair_list_t *list, fr_pair_t *pos, fr_pair_t *to_ad
 	}
 
 	fr_pair_order_list_insert_before(&list->order, pos, to_add);
+	pair_list_index_insert(list, pos, to_add, PAIR_LIST_INDEX_INSERT_BEFORE);
 
 	return 0;
 }
@@ -2328,6 +2715,7 @@ int fr_pair_list_copy(TALLOC_CTX *ctx, fr_pair_list_t *to, fr_pair_list_t const
 
 		new_vp = fr_pair_copy(ctx, vp);
 		if (!new_vp) {
+			_fr_pair_list_index_invalidate(to);
 			fr_pair_order_list_talloc_free_to_tail(&to->order, first_added);
 			return -1;
 		}
@@ -2427,6 +2815,7 @@ int fr_pair_list_copy_by_da(TALLOC_CTX *ctx, fr_pair_list_t *to,
 		cnt++;
 		new_vp = fr_pair_copy(ctx, vp);
 		if (!new_vp) {
+			_fr_pair_list_index_invalidate(to);
 			fr_pair_order_list_talloc_free_to_tail(&to->order, first_added);
 			return -1;
 		}
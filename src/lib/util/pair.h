@@ -49,9 +49,14 @@ typedef struct value_pair_s fr_pair_t;
 
 FR_TLIST_TYPES(fr_pair_order_list)
 
+typedef struct fr_pair_list_index_s fr_pair_list_index_t;
+
 typedef struct pair_list_s {
         FR_TLIST_HEAD(fr_pair_order_list)	order;			//!< Maintains the relative order of pairs in a list.
 
+	fr_pair_list_index_t	 _CONST *index;				//!< Lazily built da -> first pair lookup index.
+									///< Only used for lists which are children of a pair.
+
 	bool				 _CONST is_child;		//!< is a child of a VP
 
 #ifdef WITH_VERIFY_PTR
@@ -709,6 +714,29 @@ int		fr_pair_sublist_copy(TALLOC_CTX *ctx, fr_pair_list_t *to,
 				     fr_pair_list_t const *from,
 				     fr_pair_t const *start, unsigned int count) CC_HINT(nonnull(2,3));
 
+/** @name Pair list lookup index
+ *
+ * Lists which are the children of a pair (which includes the request, reply,
+ * control and session-state lists) build a da -> first pair index the first
+ * time they're searched after growing past a threshold length.
+ *
+ * @{
+ */
+
+/** Default minimum list length before an index is built
+ *
+ */
+#define FR_PAIR_LIST_INDEX_THRESHOLD	32
+
+void		fr_pair_list_index_threshold_set(unsigned int threshold);
+
+unsigned int	fr_pair_list_index_threshold(void);
+
+void		_fr_pair_list_index_remove(fr_pair_list_t *list, fr_pair_t const *vp) CC_HINT(nonnull);
+
+void		_fr_pair_list_index_invalidate(fr_pair_list_t *list) CC_HINT(nonnull);
+/** @} */
+
 #ifndef _PAIR_INLINE
 /** @hidecallergraph */
 void		fr_pair_list_free(fr_pair_list_t *list) CC_HINT(nonnull);
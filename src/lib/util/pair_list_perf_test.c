@@ -480,6 +480,108 @@ static void do_test_fr_pair_list_free(unsigned int len, unsigned int perc, unsig
 	TEST_MSG_ALWAYS("per_sec=%0.0lf", (reps * len)/(fr_time_delta_unwrap(used) / (double)NSEC));
 }
 
+/** Search a list hanging off a group attribute, as the request lists are
+ *
+ * @param[in] len		of the list.
+ * @param[in] perc		of attributes which are duplicates.
+ * @param[in] reps		number of times to search for each attribute.
+ * @param[in] source_vps	to build the list from.
+ * @param[in] threshold		passed to fr_pair_list_index_threshold_set().
+ *				0 disables the lookup index.
+ * @param[in] modify_every	if > 0, every modify_every searches an attribute is appended
+ *				to the list, and the head of the list is deleted.
+ */
+static void do_test_lookup(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[],
+			   unsigned int threshold, unsigned int modify_every)
+{
+	fr_pair_t		*group;
+	fr_pair_list_t		*test_vps;
+	unsigned int		i, j, ops = 0;
+	unsigned int		old_threshold = fr_pair_list_index_threshold();
+	fr_pair_t		*new_vp;
+	fr_time_t		start, end;
+	fr_time_delta_t		used = fr_time_delta_wrap(0);
+	size_t			input_count = talloc_array_length(source_vps);
+	fr_fast_rand_t		rand_ctx;
+
+	fr_pair_list_index_threshold_set(threshold);
+
+	group = fr_pair_afrom_da(autofree, fr_dict_attr_test_group);
+	TEST_ASSERT(group != NULL);
+	test_vps = &group->vp_group;
+
+	if (input_count > len) input_count = len;
+	rand_ctx.a = fr_rand();
+	rand_ctx.b = fr_rand();
+
+	/*
+	 *  Initialise the test list
+	 */
+	for (i = 0; i < len; i++) {
+		int idx = fr_fast_rand(&rand_ctx) % input_count;
+		new_vp = fr_pair_copy(group, source_vps[idx]);
+		fr_pair_append(test_vps, new_vp);
+	}
+
+	for (i = 0; i < reps; i++) {
+		for (j = 0; j < len; j++) {
+			fr_dict_attr_t const	*da = source_vps[fr_fast_rand(&rand_ctx) % input_count]->da;
+			fr_pair_t		*vp, *expect;
+
+			if (modify_every && ((++ops % modify_every) == 0)) {
+				new_vp = fr_pair_copy(group, source_vps[fr_fast_rand(&rand_ctx) % input_count]);
+				start = fr_time();
+				fr_pair_append(test_vps, new_vp);
+				fr_pair_delete(test_vps, fr_pair_list_head(test_vps));
+				end = fr_time();
+				used = fr_time_delta_add(used, fr_time_sub(end, start));
+			}
+
+			start = fr_time();
+			vp = fr_pair_find_by_da(test_vps, NULL, da);
+			end = fr_time();
+			used = fr_time_delta_add(used, fr_time_sub(end, start));
+
+			/*
+			 *  Check the result against a linear search
+			 */
+			expect = NULL;
+			while ((expect = fr_pair_list_next(test_vps, expect)) && (expect->da != da));
+			TEST_CHECK(vp == expect);
+		}
+	}
+	TEST_CHECK(fr_pair_list_num_elements(test_vps) == len);
+	talloc_free(group);
+
+	fr_pair_list_index_threshold_set(old_threshold);
+
+	TEST_MSG_ALWAYS("repetitions=%u", reps);
+	TEST_MSG_ALWAYS("perc_rep=%u", perc);
+	TEST_MSG_ALWAYS("list_length=%u", len);
+	TEST_MSG_ALWAYS("used=%"PRId64, fr_time_delta_unwrap(used));
+	TEST_MSG_ALWAYS("per_sec=%0.0lf", (reps * len)/(fr_time_delta_unwrap(used) / (double)NSEC));
+}
+
+static void do_test_lookup_linear(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[])
+{
+	do_test_lookup(len, perc, reps, source_vps, 0, 0);
+}
+
+static void do_test_lookup_indexed(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[])
+{
+	do_test_lookup(len, perc, reps, source_vps, FR_PAIR_LIST_INDEX_THRESHOLD, 0);
+}
+
+static void do_test_lookup_modify_linear(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[])
+{
+	do_test_lookup(len, perc, reps, source_vps, 0, 8);
+}
+
+static void do_test_lookup_modify_indexed(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[])
+{
+	do_test_lookup(len, perc, reps, source_vps, FR_PAIR_LIST_INDEX_THRESHOLD, 8);
+}
+
 #define test_func(_func, _count, _perc, _source_vps) \
 static void test_ ## _func ## _ ## _count ## _ ## _perc(void)\
 {\
@@ -504,6 +606,10 @@ all_test_funcs(fr_pair_append)
 all_test_funcs(fr_pair_find_by_da_idx)
 all_test_funcs(find_nth)
 all_test_funcs(fr_pair_list_free)
+all_test_funcs(lookup_linear)
+all_test_funcs(lookup_indexed)
+all_test_funcs(lookup_modify_linear)
+all_test_funcs(lookup_modify_indexed)
 
 #define repetition_tests(_func, _perc) \
 	{ #_func "_20_" #_perc, test_ ## _func ## _20_ ## _perc},\
@@ -524,6 +630,10 @@ TEST_LIST = {
 	all_repetition_tests(fr_pair_find_by_da_idx)
 	all_repetition_tests(find_nth)
 	all_repetition_tests(fr_pair_list_free)
+	all_repetition_tests(lookup_linear)
+	all_repetition_tests(lookup_indexed)
+	all_repetition_tests(lookup_modify_linear)
+	all_repetition_tests(lookup_modify_indexed)
 
 	{ NULL }
 };
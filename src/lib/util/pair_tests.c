@@ -480,6 +480,68 @@ static void test_fr_pair_find_by_da_nested(void)
 	fr_pair_list_free(&local_pairs);
 }
 
+static void test_fr_pair_reinit_from_da_index(void)
+{
+	fr_pair_t		*group, *vp, *vp_found;
+	fr_dict_attr_t const	*children[] = {
+					fr_dict_attr_test_string, fr_dict_attr_test_octets,
+					fr_dict_attr_test_uint8, fr_dict_attr_test_uint16,
+					fr_dict_attr_test_uint32, fr_dict_attr_test_int8,
+					fr_dict_attr_test_int16, fr_dict_attr_test_int32
+				};
+	unsigned int		old_threshold = fr_pair_list_index_threshold();
+	size_t			i;
+
+	/*
+	 *	Only lists of children are indexed, and only once
+	 *	they have at least pair_list_index_min entries.
+	 */
+	fr_pair_list_index_threshold_set(NUM_ELEMENTS(children) / 2);
+
+	MEM(group = fr_pair_afrom_da(autofree, fr_dict_attr_test_group));
+	for (i = 0; i < NUM_ELEMENTS(children); i++) {
+		MEM(vp = fr_pair_afrom_da(group, children[i]));
+		fr_pair_append(&group->vp_group, vp);
+	}
+
+	vp = fr_pair_find_by_da(&group->vp_group, NULL, fr_dict_attr_test_uint32);
+	TEST_CASE("Find the pair to change, building the index");
+	TEST_CHECK(vp != NULL);
+	if (!vp) goto done;
+	vp->vp_uint32 = 42;
+
+	TEST_CASE("Re-initialise the pair as a uint64");
+	TEST_CHECK(fr_pair_reinit_from_da(&group->vp_group, vp, fr_dict_attr_test_uint64) == 0);
+
+	vp_found = fr_pair_find_by_da(&group->vp_group, NULL, fr_dict_attr_test_uint32);
+	TEST_CASE("Find by the old da after fr_pair_reinit_from_da()");
+	TEST_CHECK_PAIR(vp_found, NULL);
+
+	vp_found = fr_pair_find_by_da(&group->vp_group, NULL, fr_dict_attr_test_uint64);
+	TEST_CASE("Find by the new da after fr_pair_reinit_from_da()");
+	TEST_CHECK_PAIR(vp_found, vp);
+	TEST_CHECK(vp_found && (vp_found->vp_uint64 == 42));
+
+	vp = fr_pair_find_by_da(&group->vp_group, NULL, fr_dict_attr_test_uint16);
+	TEST_CHECK(vp != NULL);
+	if (!vp) goto done;
+
+	TEST_CASE("Convert a pair in the list to raw");
+	TEST_CHECK(fr_pair_raw_afrom_pair(vp, (uint8_t const *) "\x00\x01", 2) == 0);
+
+	vp_found = fr_pair_find_by_da(&group->vp_group, NULL, fr_dict_attr_test_uint16);
+	TEST_CASE("Find by the old da after fr_pair_raw_afrom_pair()");
+	TEST_CHECK_PAIR(vp_found, NULL);
+
+	vp_found = fr_pair_find_by_da(&group->vp_group, NULL, vp->da);
+	TEST_CASE("Find by the raw da after fr_pair_raw_afrom_pair()");
+	TEST_CHECK_PAIR(vp_found, vp);
+
+done:
+	fr_pair_list_index_threshold_set(old_threshold);
+	talloc_free(group);
+}
+
 static void test_fr_pair_append(void)
 {
 	fr_dcursor_t   cursor;
@@ -1315,6 +1377,7 @@ TEST_LIST = {
 	{ "fr_pair_find_by_da_idx",                   test_fr_pair_find_by_da_idx },
 	{ "fr_pair_find_by_child_num_idx",            test_fr_pair_find_by_child_num_idx },
 	{ "fr_pair_find_by_da_nested",            test_fr_pair_find_by_da_nested },
+	{ "fr_pair_reinit_from_da_index",         test_fr_pair_reinit_from_da_index },
 	{ "fr_pair_append",                       test_fr_pair_append },
 	{ "fr_pair_prepend_by_da",                test_fr_pair_prepend_by_da },
 	{ "fr_pair_append_by_da_parent",          test_fr_pair_append_by_da_parent },
@@ -35,6 +35,10 @@
 #include <fcntl.h>
 #include <ifaddrs.h>
 
+#ifdef __linux__
+#  include <linux/filter.h>
+#endif
+
 /** Resolve a named service to a port
  *
  * @param[in] proto	The protocol. Either IPPROTO_TCP or IPPROTO_UDP.
@@ -1033,3 +1037,59 @@ int fr_socket_server_tcp(fr_ipaddr_t const *src_ipaddr, uint16_t *src_port, char
 
 	return sockfd;
 }
+
+/** Steer packets within a group of SO_REUSEPORT sockets by source address
+ *
+ * By default the kernel hashes the full 4-tuple to pick a socket from the
+ * group.  That splits a client which uses many source ports across several
+ * sockets.  This attaches a classic BPF program which picks the socket using
+ * only the source IP address, so that all packets from a particular client
+ * arrive on the same socket.
+ *
+ * Sockets are numbered in the order in which they were bound, so this should
+ * be called after all sockets in the group have been bound.
+ *
+ * @param[in] sockfd	any socket in the group.
+ * @param[in] af	address family of the group.
+ * @param[in] num	number of sockets in the group.
+ * @return
+ *	- 0 on success, or if the platform doesn't support steering.
+ *	- -1 on error.
+ */
+int fr_socket_reuseport_by_src(int sockfd, int af, unsigned int num)
+{
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+	struct sock_filter	code[] = {
+		/*
+		 *	A = source address, or the low 32 bits of it for IPv6.
+		 */
+		{ BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_NET_OFF + ((af == AF_INET6) ? 20 : 12) },
+
+		/*
+		 *	A = (A * golden ratio) >> 16, so that clients in the
+		 *	same subnet are spread across the group.
+		 */
+		{ BPF_ALU | BPF_MUL | BPF_K, 0, 0, 0x9e3779b1 },
+		{ BPF_ALU | BPF_RSH | BPF_K, 0, 0, 16 },
+
+		/*
+		 *	return A % num
+		 */
+		{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, num },
+		{ BPF_RET | BPF_A, 0, 0, 0 },
+	};
+	struct sock_fprog	prog = {
+		.len = NUM_ELEMENTS(code),
+		.filter = code,
+	};
+
+	if (num < 2) return 0;
+
+	if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+		fr_strerror_printf("Failed attaching reuseport filter: %s", fr_syserror(errno));
+		return -1;
+	}
+#endif
+
+	return 0;
+}
@@ -305,6 +305,8 @@ int		fr_socket_server_tcp(fr_ipaddr_t const *ipaddr, uint16_t *port, char const
 
 int		fr_socket_bind(int sockfd, char const *ifname, fr_ipaddr_t *src_ipaddr, uint16_t *src_port);
 
+int		fr_socket_reuseport_by_src(int sockfd, int af, unsigned int num);
+
 #ifdef __cplusplus
 }
 #endif
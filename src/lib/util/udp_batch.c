@@ -0,0 +1,463 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Batched reads and writes of UDP packets
+ *
+ * When a socket is busy, reading one packet per system call means that
+ * the network thread spends most of its time entering and leaving the
+ * kernel.  This API drains up to N packets in one recvmmsg() call, and
+ * hands them back to the caller one at a time, with the same semantics
+ * as udp_recv().  Writes are queued, and sent in one sendmmsg() call
+ * when the caller flushes the batch.
+ *
+ * Where the system doesn't have recvmmsg(), we fall back to multiple
+ * calls to recvmsg().  sendmmsg() is already emulated in missing.c.
+ *
+ * @file src/lib/util/udp_batch.c
+ *
+ * @copyright 2025 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/log.h>
+#include <freeradius-devel/util/syserror.h>
+#include <freeradius-devel/util/udp_batch.h>
+#include <freeradius-devel/util/udpfromto.h>
+
+/** Per-packet buffers for one entry in a batch
+ *
+ */
+typedef struct {
+	struct sockaddr_storage	addr;			//!< source address for reads, destination for writes.
+	struct iovec		iov;			//!< points into the packet buffer.
+	uint8_t			cbuf[256];		//!< for IP_PKTINFO, SO_TIMESTAMP, etc.
+} fr_udp_batch_slot_t;
+
+/** One direction of a batch
+ *
+ */
+typedef struct {
+	struct mmsghdr		*msgs;			//!< array of message headers, one per slot.
+	fr_udp_batch_slot_t	*slots;			//!< array of per-packet buffers.
+	uint8_t			*buffer;		//!< num * max_packet_size bytes of packet data.
+
+	unsigned int		start;			//!< first unprocessed entry.
+	unsigned int		count;			//!< number of entries in the batch.
+} fr_udp_batch_dir_t;
+
+struct fr_udp_batch_s {
+	int			sockfd;			//!< the socket we're reading from / writing to.
+	unsigned int		num;			//!< maximum number of packets per system call.
+	size_t			max_packet_size;	//!< size of each packet buffer.
+
+	struct sockaddr_storage	bound;			//!< address the socket is bound to.
+	socklen_t		bound_len;		//!< length of the bound address.
+	bool			bound_any;		//!< socket is bound to INADDR_ANY or in6addr_any.
+
+	fr_udp_batch_dir_t	recv;			//!< packets we've read, but not yet returned.
+	fr_udp_batch_dir_t	send;			//!< packets we've queued, but not yet written.
+
+	fr_udp_batch_stats_t	stats;			//!< batch depth statistics.
+};
+
+static int udp_batch_dir_alloc(fr_udp_batch_t *ub, fr_udp_batch_dir_t *dir)
+{
+	unsigned int i;
+
+	dir->msgs = talloc_zero_array(ub, struct mmsghdr, ub->num);
+	dir->slots = talloc_zero_array(ub, fr_udp_batch_slot_t, ub->num);
+	dir->buffer = talloc_array(ub, uint8_t, ub->num * ub->max_packet_size);
+	if (!dir->msgs || !dir->slots || !dir->buffer) {
+		fr_strerror_const("Out of memory");
+		return -1;
+	}
+
+	for (i = 0; i < ub->num; i++) {
+		dir->slots[i].iov = (struct iovec) {
+			.iov_base	= dir->buffer + (i * ub->max_packet_size),
+			.iov_len	= ub->max_packet_size,
+		};
+	}
+
+	return 0;
+}
+
+/** Allocate a batch for a UDP socket
+ *
+ * The socket should already be bound, and should have had udpfromto_init()
+ * called on it if the caller wants to know the destination address of
+ * received packets.
+ *
+ * @param[in] ctx		to allocate the batch in.
+ * @param[in] sockfd		the socket to read from and write to.
+ * @param[in] num		maximum number of packets to read or write per system call.
+ * @param[in] max_packet_size	largest packet we expect to read or write.
+ * @return
+ *	- NULL on error.
+ *	- the batch on success.
+ */
+fr_udp_batch_t *fr_udp_batch_alloc(TALLOC_CTX *ctx, int sockfd, unsigned int num, size_t max_packet_size)
+{
+	fr_udp_batch_t *ub;
+
+	if (!num || (num > FR_UDP_BATCH_MAX)) {
+		fr_strerror_printf("Batch size %u must be between 1 and %u", num, FR_UDP_BATCH_MAX);
+		return NULL;
+	}
+
+	if (!max_packet_size) {
+		fr_strerror_const("Maximum packet size cannot be zero");
+		return NULL;
+	}
+
+	ub = talloc_zero(ctx, fr_udp_batch_t);
+	if (!ub) {
+		fr_strerror_const("Out of memory");
+		return NULL;
+	}
+
+	ub->sockfd = sockfd;
+	ub->num = num;
+	ub->max_packet_size = max_packet_size;
+
+	/*
+	 *	recvmsg() doesn't provide the destination port, so we
+	 *	cache the bound address once, instead of calling
+	 *	getsockname() for every packet as recvfromto() does.
+	 */
+	ub->bound_len = sizeof(ub->bound);
+	if (getsockname(sockfd, (struct sockaddr *) &ub->bound, &ub->bound_len) < 0) {
+		fr_strerror_printf("Failed getting socket name: %s", fr_syserror(errno));
+	error:
+		talloc_free(ub);
+		return NULL;
+	}
+
+	switch (ub->bound.ss_family) {
+	case AF_INET:
+		ub->bound_any = (((struct sockaddr_in *) &ub->bound)->sin_addr.s_addr == INADDR_ANY);
+		break;
+
+	case AF_INET6:
+		ub->bound_any = IN6_IS_ADDR_UNSPECIFIED(&((struct sockaddr_in6 *) &ub->bound)->sin6_addr);
+		break;
+
+	default:
+		fr_strerror_const("Socket has unsupported address family");
+		goto error;
+	}
+
+	if (udp_batch_dir_alloc(ub, &ub->recv) < 0) goto error;
+	if (udp_batch_dir_alloc(ub, &ub->send) < 0) goto error;
+
+	return ub;
+}
+
+/** Fill the receive side of the batch
+ *
+ * @return
+ *	- <0 on error.
+ *	- 0 no packets available.
+ *	- >0 the number of packets read.
+ */
+static int udp_batch_fill(fr_udp_batch_t *ub, int flags)
+{
+	unsigned int		i;
+	int			ret;
+	fr_udp_batch_dir_t	*dir = &ub->recv;
+	bool			connected = ((flags & UDP_FLAGS_CONNECTED) != 0);
+
+	for (i = 0; i < ub->num; i++) {
+		fr_udp_batch_slot_t *slot = &dir->slots[i];
+
+		slot->iov.iov_len = ub->max_packet_size;
+
+		dir->msgs[i] = (struct mmsghdr) {
+			.msg_hdr = {
+				.msg_name	= connected ? NULL : &slot->addr,
+				.msg_namelen	= connected ? 0 : sizeof(slot->addr),
+				.msg_iov	= &slot->iov,
+				.msg_iovlen	= 1,
+				.msg_control	= slot->cbuf,
+				.msg_controllen	= sizeof(slot->cbuf),
+			},
+		};
+	}
+
+#ifdef HAVE_RECVMMSG
+	/*
+	 *	Don't wait for a full batch if the socket is blocking,
+	 *	return as soon as there are no more packets.
+	 */
+	ret = recvmmsg(ub->sockfd, dir->msgs, ub->num, MSG_WAITFORONE, NULL);
+#else
+	/*
+	 *	No recvmmsg(), so we read as many packets as are
+	 *	available, but without blocking.
+	 */
+	for (ret = 0; (unsigned int) ret < ub->num; ret++) {
+		ssize_t slen;
+
+		slen = recvmsg(ub->sockfd, &dir->msgs[ret].msg_hdr, (ret == 0) ? 0 : MSG_DONTWAIT);
+		if (slen < 0) {
+			if (ret == 0) ret = -1;
+			break;
+		}
+		dir->msgs[ret].msg_len = (unsigned int) slen;
+	}
+#endif
+	if (ret < 0) {
+		if ((errno == EWOULDBLOCK) || (errno == EAGAIN) || (errno == EINTR)) return 0;
+
+		fr_strerror_printf("Failed reading socket: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	dir->start = 0;
+	dir->count = ret;
+
+	if (ret > 0) {
+		ub->stats.recv_calls++;
+		ub->stats.recv_packets += ret;
+		if ((uint32_t) ret > ub->stats.recv_depth_max) ub->stats.recv_depth_max = ret;
+	}
+
+	return ret;
+}
+
+/** Read one UDP packet, refilling the batch if it is empty
+ *
+ * This function has the same semantics as udp_recv(), except that
+ * UDP_FLAGS_PEEK is not supported.
+ *
+ * @param[in] ub		the batch to read from.
+ * @param[in] flags		UDP_FLAGS_CONNECTED, or UDP_FLAGS_NONE.
+ * @param[out] socket_out	Information about the src/dst address of the packet
+ *				and the interface it was received on.
+ * @param[out] data		pointer where data will be written
+ * @param[in] data_len		length of data to read
+ * @param[out] when		the packet was received.
+ * @return
+ *	- > 0 on success (number of bytes read).
+ *	- 0 no data available.
+ *	- < 0 on failure.
+ */
+ssize_t fr_udp_batch_recv(fr_udp_batch_t *ub, int flags,
+			  fr_socket_t *socket_out, void *data, size_t data_len, fr_time_t *when)
+{
+	fr_udp_batch_dir_t	*dir = &ub->recv;
+	struct mmsghdr		*msg;
+	size_t			len;
+
+	fr_assert((flags & UDP_FLAGS_PEEK) == 0);
+
+	*socket_out = (fr_socket_t){
+		.fd = ub->sockfd,
+		.type = SOCK_DGRAM,
+	};
+
+	if (when) *when = fr_time_wrap(0);
+
+	if (dir->start >= dir->count) {
+		int ret;
+
+		ret = udp_batch_fill(ub, flags);
+		if (ret <= 0) return ret;
+	}
+
+	msg = &dir->msgs[dir->start++];
+
+	len = msg->msg_len;
+	if (len > data_len) len = data_len;
+	memcpy(data, msg->msg_hdr.msg_iov->iov_base, len);
+
+	if ((flags & UDP_FLAGS_CONNECTED) == 0) {
+		struct sockaddr_storage	dst = ub->bound;
+		socklen_t		sizeof_dst = ub->bound_len;
+
+		recvfromto_cmsg(&msg->msg_hdr, &socket_out->inet.ifindex,
+				(struct sockaddr *) &dst, &sizeof_dst, when);
+
+		if (fr_ipaddr_from_sockaddr(&socket_out->inet.src_ipaddr, &socket_out->inet.src_port,
+					    msg->msg_hdr.msg_name, msg->msg_hdr.msg_namelen) < 0) {
+			fr_strerror_const_push("Failed converting src sockaddr to ipaddr");
+			return -1;
+		}
+		if (fr_ipaddr_from_sockaddr(&socket_out->inet.dst_ipaddr, &socket_out->inet.dst_port,
+					    &dst, sizeof_dst) < 0) {
+			fr_strerror_const_push("Failed converting dst sockaddr to ipaddr");
+			return -1;
+		}
+	}
+
+	if (when && fr_time_eq(*when, fr_time_wrap(0))) *when = fr_time();
+
+	return len;
+}
+
+/** Write all queued packets
+ *
+ * Packets which can't be written due to a hard error are discarded,
+ * just as they would be with udp_send().
+ *
+ * @param[in] ub	the batch to flush.
+ * @return
+ *	- 0 on success, all packets have been written.
+ *	- <0 on error.  If errno is EWOULDBLOCK, the remaining packets
+ *	  are still queued, and the caller should try again when the
+ *	  socket becomes writable.
+ */
+int fr_udp_batch_flush(fr_udp_batch_t *ub)
+{
+	fr_udp_batch_dir_t *dir = &ub->send;
+
+	while (dir->start < dir->count) {
+		int ret;
+
+		ret = sendmmsg(ub->sockfd, dir->msgs + dir->start, dir->count - dir->start, 0);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+
+			if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) {
+				errno = EWOULDBLOCK;
+				return -1;
+			}
+
+			/*
+			 *	The first packet failed, discard it
+			 *	and keep going with the rest.
+			 */
+			fr_strerror_printf("Failed writing socket: %s", fr_syserror(errno));
+			ub->stats.send_errors++;
+			dir->start++;
+			continue;
+		}
+
+		ub->stats.send_calls++;
+		ub->stats.send_packets += ret;
+		if ((uint32_t) ret > ub->stats.send_depth_max) ub->stats.send_depth_max = ret;
+
+		dir->start += ret;
+	}
+
+	dir->start = dir->count = 0;
+
+	return 0;
+}
+
+/** Queue a UDP packet for writing
+ *
+ * The packet is copied into the batch, so the caller can reuse the
+ * buffer as soon as this function returns.  If the batch is full, it
+ * is flushed before the new packet is queued.
+ *
+ * @param[in] ub		the batch to queue the packet in.
+ * @param[in] sock		src/dst address of the packet, as with udp_send().
+ * @param[in] flags		UDP_FLAGS_CONNECTED, or UDP_FLAGS_NONE.
+ * @param[in] data		the packet to write.
+ * @param[in] data_len		length of the packet.
+ * @return
+ *	- data_len on success.
+ *	- <0 on error.  If errno is EWOULDBLOCK, the packet was not queued.
+ */
+ssize_t fr_udp_batch_send(fr_udp_batch_t *ub, fr_socket_t const *sock, int flags,
+			  void const *data, size_t data_len)
+{
+	fr_udp_batch_dir_t	*dir = &ub->send;
+	fr_udp_batch_slot_t	*slot;
+	struct mmsghdr		*msg;
+	socklen_t		sizeof_dst = 0;
+
+	fr_assert(sock->type == SOCK_DGRAM);
+
+	if (dir->count == ub->num) {
+		if (fr_udp_batch_flush(ub) < 0) return -1;
+	}
+
+	/*
+	 *	Too large for the batch buffers.  Write everything
+	 *	that's queued first, so that we don't re-order
+	 *	packets, and then write this one directly.
+	 */
+	if (data_len > ub->max_packet_size) {
+		if (fr_udp_batch_flush(ub) < 0) return -1;
+
+		if (udp_send(sock, flags, UNCONST(void *, data), data_len) < 0) return -1;
+
+		return data_len;
+	}
+
+	slot = &dir->slots[dir->count];
+	msg = &dir->msgs[dir->count];
+
+	memcpy(slot->iov.iov_base, data, data_len);
+	slot->iov.iov_len = data_len;
+
+	*msg = (struct mmsghdr) {
+		.msg_hdr = {
+			.msg_iov	= &slot->iov,
+			.msg_iovlen	= 1,
+		},
+	};
+
+	if ((flags & UDP_FLAGS_CONNECTED) == 0) {
+		struct sockaddr_storage	src;
+		socklen_t		sizeof_src;
+
+		if (fr_ipaddr_to_sockaddr(&slot->addr, &sizeof_dst,
+					  &sock->inet.dst_ipaddr, sock->inet.dst_port) < 0) return -1;
+		if (fr_ipaddr_to_sockaddr(&src, &sizeof_src,
+					  &sock->inet.src_ipaddr, sock->inet.src_port) < 0) return -1;
+
+		msg->msg_hdr.msg_name = &slot->addr;
+		msg->msg_hdr.msg_namelen = sizeof_dst;
+
+		/*
+		 *	Only sockets bound to a wildcard address need
+		 *	to be told which source address to use.
+		 */
+		if (ub->bound_any) (void) sendfromto_cmsg(&msg->msg_hdr, slot->cbuf, sizeof(slot->cbuf),
+				       sock->inet.ifindex, (struct sockaddr *) &src, sizeof_src);
+	}
+
+	dir->count++;
+
+	return data_len;
+}
+
+/** Return the number of packets waiting to be written
+ *
+ */
+size_t fr_udp_batch_pending(fr_udp_batch_t const *ub)
+{
+	return ub->send.count - ub->send.start;
+}
+
+/** Return the number of packets which have been read, but not yet returned
+ *
+ */
+size_t fr_udp_batch_buffered(fr_udp_batch_t const *ub)
+{
+	return ub->recv.count - ub->recv.start;
+}
+
+/** Return the statistics for a batch
+ *
+ */
+fr_udp_batch_stats_t const *fr_udp_batch_stats(fr_udp_batch_t const *ub)
+{
+	return &ub->stats;
+}
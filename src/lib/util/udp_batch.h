@@ -0,0 +1,78 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/util/udp_batch.h
+ * @brief Batched reads and writes of UDP packets via recvmmsg() / sendmmsg()
+ *
+ * @copyright 2025 The FreeRADIUS server project
+ */
+RCSIDH(udp_batch_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/util/socket.h>
+#include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/time.h>
+#include <freeradius-devel/util/udp.h>
+
+/** Maximum number of packets we read or write in one system call
+ *
+ */
+#define FR_UDP_BATCH_MAX	(256)
+
+/** Statistics for a batched socket
+ *
+ * The average batch depth is recv_packets / recv_calls, and
+ * send_packets / send_calls.
+ */
+typedef struct {
+	uint64_t		recv_calls;		//!< number of recvmmsg() calls which returned data
+	uint64_t		recv_packets;		//!< number of packets read
+	uint32_t		recv_depth_max;		//!< largest number of packets read in one call
+
+	uint64_t		send_calls;		//!< number of sendmmsg() calls
+	uint64_t		send_packets;		//!< number of packets written
+	uint32_t		send_depth_max;		//!< largest number of packets written in one call
+	uint64_t		send_errors;		//!< packets which were discarded due to write errors
+} fr_udp_batch_stats_t;
+
+typedef struct fr_udp_batch_s fr_udp_batch_t;
+
+fr_udp_batch_t	*fr_udp_batch_alloc(TALLOC_CTX *ctx, int sockfd, unsigned int num, size_t max_packet_size);
+
+ssize_t		fr_udp_batch_recv(fr_udp_batch_t *ub, int flags,
+				  fr_socket_t *socket_out, void *data, size_t data_len, fr_time_t *when) CC_HINT(nonnull(1,3,4));
+
+ssize_t		fr_udp_batch_send(fr_udp_batch_t *ub, fr_socket_t const *sock, int flags,
+				  void const *data, size_t data_len) CC_HINT(nonnull);
+
+int		fr_udp_batch_flush(fr_udp_batch_t *ub) CC_HINT(nonnull);
+
+size_t		fr_udp_batch_pending(fr_udp_batch_t const *ub) CC_HINT(nonnull);
+
+size_t		fr_udp_batch_buffered(fr_udp_batch_t const *ub) CC_HINT(nonnull);
+
+fr_udp_batch_stats_t const *fr_udp_batch_stats(fr_udp_batch_t const *ub) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
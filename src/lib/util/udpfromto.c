@@ -172,6 +172,112 @@ int udpfromto_init(int s, int af)
 	return setsockopt(s, proto, flag, &opt, sizeof(opt));
 }
 
+/** Process the control data returned by recvmsg() or recvmmsg()
+ *
+ * Fills in the destination address, receiving interface and timestamp
+ * from the auxiliary data of a received datagram.
+ *
+ * @param[in] msgh	as filled in by recvmsg().
+ * @param[out] ifindex	The interface which received the datagram (may be NULL).
+ * @param[in,out] to	Destination address.  Must be pre-populated with the
+ *			address and port the socket is bound to.
+ * @param[in,out] to_len Length of the structure pointed to by to.
+ * @param[out] when	the packet was received (may be NULL).
+ */
+void recvfromto_cmsg(struct msghdr *msgh, int *ifindex,
+		     struct sockaddr *to, socklen_t *to_len, fr_time_t *when)
+{
+	struct cmsghdr		*cmsg;
+
+	if (ifindex) *ifindex = 0;
+	if (when) *when = fr_time_wrap(0);
+
+/*
+ *	Needed for emscripten, seems to be an issue in CMSG_NXTHDR
+ */
+DIAG_OFF(sign-compare)
+	/* Process auxiliary received data in msgh */
+	for (cmsg = CMSG_FIRSTHDR(msgh);
+	     cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(msgh, cmsg)) {
+DIAG_ON(sign-compare)
+
+#ifdef IP_PKTINFO
+		if ((cmsg->cmsg_level == SOL_IP) &&
+		    (cmsg->cmsg_type == IP_PKTINFO)) {
+			struct in_pktinfo *i = (struct in_pktinfo *) CMSG_DATA(cmsg);
+
+			((struct sockaddr_in *)to)->sin_addr = i->ipi_addr;
+			*to_len = sizeof(struct sockaddr_in);
+
+			if (ifindex) *ifindex = i->ipi_ifindex;
+
+			break;
+		}
+#endif
+
+#ifdef IP_RECVDSTADDR
+		if ((cmsg->cmsg_level == IPPROTO_IP) &&
+		    (cmsg->cmsg_type == IP_RECVDSTADDR)) {
+			struct in_addr *i = (struct in_addr *) CMSG_DATA(cmsg);
+
+			((struct sockaddr_in *)to)->sin_addr = *i;
+
+			*to_len = sizeof(struct sockaddr_in);
+
+#ifdef   IP_RECVIF
+			continue;
+#else
+			break;
+#endif
+		}
+#endif
+
+#ifdef IP_RECVIF
+		if ((cmsg->cmsg_level == IPPROTO_IP) &&
+		    (cmsg->cmsg_type == IP_RECVIF)) {
+			struct sockaddr_dl *sd = (struct sockaddr_dl *) CMSG_DATA(cmsg);
+
+			if (ifindex) *ifindex = sd->sdl_index;
+
+#ifdef   IP_RECVDSTADDR
+			continue;
+#else
+			break;
+#endif
+		}
+#endif
+
+#ifdef IPV6_PKTINFO
+		if ((cmsg->cmsg_level == IPPROTO_IPV6) &&
+		    (cmsg->cmsg_type == IPV6_PKTINFO)) {
+			struct in6_pktinfo *i = (struct in6_pktinfo *) CMSG_DATA(cmsg);
+
+			((struct sockaddr_in6 *)to)->sin6_addr = i->ipi6_addr;
+			*to_len = sizeof(struct sockaddr_in6);
+
+			if (ifindex) *ifindex = i->ipi6_ifindex;
+
+			break;
+		}
+#endif
+
+#ifdef SO_TIMESTAMP
+		if (when && (cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == SO_TIMESTAMP)) {
+			*when = fr_time_from_timeval((struct timeval *)CMSG_DATA(cmsg));
+		}
+#endif
+
+#ifdef SO_TIMESTAMPNS
+		if (when && (cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == SO_TIMESTAMPNS)) {
+			*when = fr_time_from_timespec((struct timespec *)CMSG_DATA(cmsg));
+		}
+#endif
+	}
+
+	if (when && fr_time_eq(*when, fr_time_wrap(0))) *when = fr_time();
+}
+
 /** Read a packet from a file descriptor, retrieving additional header information
  *
  * Abstracts away the complexity of using the complexity of using recvmsg().
@@ -206,7 +312,6 @@ int recvfromto(int fd, void *buf, size_t len, int flags,
 	       fr_time_t *when)
 {
 	struct msghdr		msgh;
-	struct cmsghdr		*cmsg;
 	struct iovec		iov;
 	char			cbuf[256];
 	int			ret;
@@ -309,95 +414,118 @@ int recvfromto(int fd, void *buf, size_t len, int flags,
 
 	if (from_len) *from_len = msgh.msg_namelen;
 
-	if (ifindex) *ifindex = 0;
-	if (when) *when = fr_time_wrap(0);
+	recvfromto_cmsg(&msgh, ifindex, to, to_len, when);
 
-/*
- *	Needed for emscripten, seems to be an issue in CMSG_NXTHDR
+	return ret;
+}
+
+/** Add the source address and outbound interface to the control data of a msghdr
+ *
+ * @param[in,out] msgh	to populate.  msg_control and msg_controllen are only
+ *			set if control data is required.
+ * @param[in] cbuf	buffer to use for the control data.
+ * @param[in] cbuf_len	length of cbuf.  Must be at least CMSG_SPACE(sizeof(struct in6_pktinfo)).
+ * @param[in] ifindex	The interface on which to send the datagram.
+ * @param[in] from	The source address.
+ * @param[in] from_len	Length of the structure pointed to by from.
+ * @return
+ *	- true if control data was added.
+ *	- false if no control data is needed, and sendto() can be used instead.
  */
-DIAG_OFF(sign-compare)
-	/* Process auxiliary received data in msgh */
-	for (cmsg = CMSG_FIRSTHDR(&msgh);
-	     cmsg != NULL;
-	     cmsg = CMSG_NXTHDR(&msgh, cmsg)) {
-DIAG_ON(sign-compare)
+bool sendfromto_cmsg(struct msghdr *msgh, void *cbuf, size_t cbuf_len,
+		     int ifindex, struct sockaddr *from, socklen_t from_len)
+{
+	/*
+	 *	If the sendmsg() flags aren't defined, fall back to
+	 *	using sendto().  These flags are defined on FreeBSD,
+	 *	but laying it out this way simplifies the look of the
+	 *	code.
+	 */
+#  if !defined(IP_PKTINFO) && !defined(IP_SENDSRCADDR)
+	if (from && from->sa_family == AF_INET) from = NULL;
+#  endif
 
-#ifdef IP_PKTINFO
-		if ((cmsg->cmsg_level == SOL_IP) &&
-		    (cmsg->cmsg_type == IP_PKTINFO)) {
-			struct in_pktinfo *i = (struct in_pktinfo *) CMSG_DATA(cmsg);
+#  if !defined(IPV6_PKTINFO)
+	if (from && from->sa_family == AF_INET6) from = NULL;
+#  endif
 
-			((struct sockaddr_in *)to)->sin_addr = i->ipi_addr;
-			*to_len = sizeof(struct sockaddr_in);
+	/*
+	 *	No "from" or "from" is 0.0.0.0 or ::/0, and there's no
+	 *	interface binding, just use regular sendto.
+	 */
+	if (!from || (from_len == 0) ||
+		((ifindex == 0) &&
+		((from->sa_family == AF_INET &&
+			(((struct sockaddr_in *) from)->sin_addr.s_addr == INADDR_ANY)) ||
+		(from->sa_family == AF_INET6 &&
+			IN6_IS_ADDR_UNSPECIFIED(&((struct sockaddr_in6 *) from)->sin6_addr))))) {
+		return false;
+	}
 
-			if (ifindex) *ifindex = i->ipi_ifindex;
+	memset(cbuf, 0, cbuf_len);
 
-			break;
-		}
-#endif
+# if defined(IP_PKTINFO) || defined(IP_SENDSRCADDR)
+	if (from->sa_family == AF_INET) {
+		struct sockaddr_in *s4 = (struct sockaddr_in *) from;
 
-#ifdef IP_RECVDSTADDR
-		if ((cmsg->cmsg_level == IPPROTO_IP) &&
-		    (cmsg->cmsg_type == IP_RECVDSTADDR)) {
-			struct in_addr *i = (struct in_addr *) CMSG_DATA(cmsg);
+#  ifdef IP_PKTINFO
+		struct cmsghdr *cmsg;
+		struct in_pktinfo *pkt;
 
-			((struct sockaddr_in *)to)->sin_addr = *i;
+		msgh->msg_control = cbuf;
+		msgh->msg_controllen = CMSG_SPACE(sizeof(*pkt));
 
-			*to_len = sizeof(struct sockaddr_in);
+		cmsg = CMSG_FIRSTHDR(msgh);
+		cmsg->cmsg_level = SOL_IP;
+		cmsg->cmsg_type = IP_PKTINFO;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(*pkt));
 
-#ifdef   IP_RECVIF
-			continue;
-#else
-			break;
-#endif
-		}
-#endif
+		pkt = (struct in_pktinfo *) CMSG_DATA(cmsg);
+		memset(pkt, 0, sizeof(*pkt));
+		pkt->ipi_spec_dst = s4->sin_addr;
+		pkt->ipi_ifindex = ifindex;
 
-#ifdef IP_RECVIF
-		if ((cmsg->cmsg_level == IPPROTO_IP) &&
-		    (cmsg->cmsg_type == IP_RECVIF)) {
-			struct sockaddr_dl *sd = (struct sockaddr_dl *) CMSG_DATA(cmsg);
+#  elif defined(IP_SENDSRCADDR)
+		struct cmsghdr *cmsg;
+		struct in_addr *in;
 
-			if (ifindex) *ifindex = sd->sdl_index;
+		msgh->msg_control = cbuf;
+		msgh->msg_controllen = CMSG_SPACE(sizeof(*in));
 
-#ifdef   IP_RECVDSTADDR
-			continue;
-#else
-			break;
-#endif
-		}
-#endif
+		cmsg = CMSG_FIRSTHDR(msgh);
+		cmsg->cmsg_level = IPPROTO_IP;
+		cmsg->cmsg_type = IP_SENDSRCADDR;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(*in));
 
-#ifdef IPV6_PKTINFO
-		if ((cmsg->cmsg_level == IPPROTO_IPV6) &&
-		    (cmsg->cmsg_type == IPV6_PKTINFO)) {
-			struct in6_pktinfo *i = (struct in6_pktinfo *) CMSG_DATA(cmsg);
+		in = (struct in_addr *) CMSG_DATA(cmsg);
+		*in = s4->sin_addr;
+#  endif
+	}
+#endif
 
-			((struct sockaddr_in6 *)to)->sin6_addr = i->ipi6_addr;
-			*to_len = sizeof(struct sockaddr_in6);
+#  if defined(IPV6_PKTINFO)
+	if (from->sa_family == AF_INET6) {
+		struct sockaddr_in6 *s6 = (struct sockaddr_in6 *) from;
 
-			if (ifindex) *ifindex = i->ipi6_ifindex;
+		struct cmsghdr *cmsg;
+		struct in6_pktinfo *pkt;
 
-			break;
-		}
-#endif
+		msgh->msg_control = cbuf;
+		msgh->msg_controllen = CMSG_SPACE(sizeof(*pkt));
 
-#ifdef SO_TIMESTAMP
-		if (when && (cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == SO_TIMESTAMP)) {
-			*when = fr_time_from_timeval((struct timeval *)CMSG_DATA(cmsg));
-		}
-#endif
+		cmsg = CMSG_FIRSTHDR(msgh);
+		cmsg->cmsg_level = IPPROTO_IPV6;
+		cmsg->cmsg_type = IPV6_PKTINFO;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(*pkt));
 
-#ifdef SO_TIMESTAMPNS
-		if (when && (cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == SO_TIMESTAMPNS)) {
-			*when = fr_time_from_timespec((struct timespec *)CMSG_DATA(cmsg));
-		}
-#endif
+		pkt = (struct in6_pktinfo *) CMSG_DATA(cmsg);
+		memset(pkt, 0, sizeof(*pkt));
+		pkt->ipi6_addr = s6->sin6_addr;
+		pkt->ipi6_ifindex = ifindex;
 	}
+#  endif	/* IPV6_PKTINFO */
 
-	if (when && fr_time_eq(*when, fr_time_wrap(0))) *when = fr_time();
-
-	return ret;
+	return (msgh->msg_control != NULL);
 }
 
 /** Send packet via a file descriptor, setting the src address and outbound interface
@@ -466,35 +594,7 @@ int sendfromto(int fd, void *buf, size_t len, int flags,
 	}
 #endif	/* !__FreeBSD__ */
 
-	/*
-	 *	If the sendmsg() flags aren't defined, fall back to
-	 *	using sendto().  These flags are defined on FreeBSD,
-	 *	but laying it out this way simplifies the look of the
-	 *	code.
-	 */
-#  if !defined(IP_PKTINFO) && !defined(IP_SENDSRCADDR)
-	if (from && from->sa_family == AF_INET) from = NULL;
-#  endif
-
-#  if !defined(IPV6_PKTINFO)
-	if (from && from->sa_family == AF_INET6) from = NULL;
-#  endif
-
-	/*
-	 *	No "from" or "from" is 0.0.0.0 or ::/0, and there's no
-	 *	interface binding, just use regular sendto.
-	 */
-	if (!from || (from_len == 0) ||
-		((ifindex == 0) &&
-		((from->sa_family == AF_INET &&
-			(((struct sockaddr_in *) from)->sin_addr.s_addr == INADDR_ANY)) ||
-		(from->sa_family == AF_INET6 &&
-			IN6_IS_ADDR_UNSPECIFIED(&((struct sockaddr_in6 *) from)->sin6_addr))))) {
-		return sendto(fd, buf, len, flags, to, to_len);
-	}
-
 	/* Set up control buffer iov and msgh structures. */
-	memset(&cbuf, 0, sizeof(cbuf));
 	memset(&msgh, 0, sizeof(msgh));
 	memset(&iov, 0, sizeof(iov));
 	iov.iov_base = buf;
@@ -505,66 +605,9 @@ int sendfromto(int fd, void *buf, size_t len, int flags,
 	msgh.msg_name = to;
 	msgh.msg_namelen = to_len;
 
-# if defined(IP_PKTINFO) || defined(IP_SENDSRCADDR)
-	if (from->sa_family == AF_INET) {
-		struct sockaddr_in *s4 = (struct sockaddr_in *) from;
-
-#  ifdef IP_PKTINFO
-		struct cmsghdr *cmsg;
-		struct in_pktinfo *pkt;
-
-		msgh.msg_control = cbuf;
-		msgh.msg_controllen = CMSG_SPACE(sizeof(*pkt));
-
-		cmsg = CMSG_FIRSTHDR(&msgh);
-		cmsg->cmsg_level = SOL_IP;
-		cmsg->cmsg_type = IP_PKTINFO;
-		cmsg->cmsg_len = CMSG_LEN(sizeof(*pkt));
-
-		pkt = (struct in_pktinfo *) CMSG_DATA(cmsg);
-		memset(pkt, 0, sizeof(*pkt));
-		pkt->ipi_spec_dst = s4->sin_addr;
-		pkt->ipi_ifindex = ifindex;
-
-#  elif defined(IP_SENDSRCADDR)
-		struct cmsghdr *cmsg;
-		struct in_addr *in;
-
-		msgh.msg_control = cbuf;
-		msgh.msg_controllen = CMSG_SPACE(sizeof(*in));
-
-		cmsg = CMSG_FIRSTHDR(&msgh);
-		cmsg->cmsg_level = IPPROTO_IP;
-		cmsg->cmsg_type = IP_SENDSRCADDR;
-		cmsg->cmsg_len = CMSG_LEN(sizeof(*in));
-
-		in = (struct in_addr *) CMSG_DATA(cmsg);
-		*in = s4->sin_addr;
-#  endif
-	}
-#endif
-
-#  if defined(IPV6_PKTINFO)
-	if (from->sa_family == AF_INET6) {
-		struct sockaddr_in6 *s6 = (struct sockaddr_in6 *) from;
-
-		struct cmsghdr *cmsg;
-		struct in6_pktinfo *pkt;
-
-		msgh.msg_control = cbuf;
-		msgh.msg_controllen = CMSG_SPACE(sizeof(*pkt));
-
-		cmsg = CMSG_FIRSTHDR(&msgh);
-		cmsg->cmsg_level = IPPROTO_IPV6;
-		cmsg->cmsg_type = IPV6_PKTINFO;
-		cmsg->cmsg_len = CMSG_LEN(sizeof(*pkt));
-
-		pkt = (struct in6_pktinfo *) CMSG_DATA(cmsg);
-		memset(pkt, 0, sizeof(*pkt));
-		pkt->ipi6_addr = s6->sin6_addr;
-		pkt->ipi6_ifindex = ifindex;
+	if (!sendfromto_cmsg(&msgh, cbuf, sizeof(cbuf), ifindex, from, from_len)) {
+		return sendto(fd, buf, len, flags, to, to_len);
 	}
-#  endif	/* IPV6_PKTINFO */
 
 	return sendmsg(fd, &msgh, flags);
 }
@@ -34,6 +34,8 @@ extern "C" {
 #include <freeradius-devel/util/time.h>
 
 #include <netinet/in.h>
+#include <sys/socket.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdlib.h>
 
@@ -45,6 +47,12 @@ int	recvfromto(int s, void *buf, size_t len, int flags,
 		   struct sockaddr *to, socklen_t *tolen,
 		   fr_time_t *when);
 
+void	recvfromto_cmsg(struct msghdr *msgh, int *ifindex,
+			struct sockaddr *to, socklen_t *to_len, fr_time_t *when);
+
+bool	sendfromto_cmsg(struct msghdr *msgh, void *cbuf, size_t cbuf_len,
+			int ifindex, struct sockaddr *from, socklen_t from_len);
+
 int	sendfromto(int s, void *buf, size_t len, int flags,
 		   int ifindex,
 		   struct sockaddr *from, socklen_t fromlen,
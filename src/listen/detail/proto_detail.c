@@ -25,6 +25,7 @@
 #include <freeradius-devel/io/application.h>
 #include <freeradius-devel/io/listen.h>
 #include <freeradius-devel/io/schedule.h>
+#include <freeradius-devel/internal/detail.h>
 #include <freeradius-devel/radius/radius.h>
 #include <freeradius-devel/util/pair_legacy.h>
 
@@ -49,6 +50,12 @@ static int transport_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *
 #define MPRINT(x, ...)
 #endif
 
+static fr_table_num_sorted_t const format_table[] = {
+	{ L("binary"),	PROTO_DETAIL_FORMAT_BINARY	},
+	{ L("text"),	PROTO_DETAIL_FORMAT_TEXT	},
+};
+static size_t format_table_len = NUM_ELEMENTS(format_table);
+
 /** How to parse a Detail listen section
  *
  */
@@ -57,6 +64,8 @@ static conf_parser_t const proto_detail_config[] = {
 			  type), .func = type_parse },
 	{ FR_CONF_OFFSET_TYPE_FLAGS("transport", FR_TYPE_VOID, 0, proto_detail_t, io_submodule),
 	  .func = transport_parse, .dflt = "file" },
+	{ FR_CONF_OFFSET("format", proto_detail_t, format), .dflt = "text",
+	  .func = cf_table_parse_int, .uctx = &(cf_table_parse_ctx_t){ .table = format_table, .len = &format_table_len } },
 
 	/*
 	 *	Add this as a synonym so normal humans can understand it.
@@ -209,6 +218,53 @@ static int transport_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *
 	return 0;
 }
 
+/** Decode a binary detail record
+ *
+ * The record has already been checked by the reader, but it's cheap to
+ * check it again, and the ring buffer is the only thing between them.
+ */
+static int mod_decode_binary(request_t *request, uint8_t *const data, size_t data_len)
+{
+	fr_detail_record_t	record;
+	fr_pair_t		*vp;
+
+	if (fr_detail_record_parse(&record, data, data_len) <= 0) {
+		RPEDEBUG("Malformed detail record");
+		return -1;
+	}
+
+	if (fr_detail_record_decode(request->request_ctx, &request->request_pairs,
+				    fr_dict_root(request->proto_dict), &record, NULL) < 0) {
+		RPEDEBUG("Failed decoding detail record");
+		return -1;
+	}
+
+	/*
+	 *	The original time at which we received the packet.
+	 *	We need this to properly calculate Acct-Delay-Time.
+	 */
+	MEM(vp = fr_pair_afrom_da(request->request_ctx, attr_packet_original_timestamp));
+	vp->vp_date = record.timestamp;
+	fr_pair_append(&request->request_pairs, vp);
+
+	/*
+	 *	Set the original src/dst ip/port
+	 */
+	vp = fr_pair_find_by_da_nested(&request->request_pairs, NULL, attr_packet_src_ip_address);
+	if (vp) request->packet->socket.inet.src_ipaddr = vp->vp_ip;
+
+	vp = fr_pair_find_by_da_nested(&request->request_pairs, NULL, attr_packet_dst_ip_address);
+	if (vp) request->packet->socket.inet.dst_ipaddr = vp->vp_ip;
+
+	vp = fr_pair_find_by_da_nested(&request->request_pairs, NULL, attr_packet_src_port);
+	if (vp) request->packet->socket.inet.src_port = vp->vp_uint16;
+
+	vp = fr_pair_find_by_da_nested(&request->request_pairs, NULL, attr_packet_dst_port);
+	if (vp) request->packet->socket.inet.dst_port = vp->vp_uint16;
+
+	return 0;
+}
+
 /** Decode the packet, and set the request->process function
  *
  */
@@ -238,6 +294,12 @@ static int mod_decode(void const *instance, request_t *request, uint8_t *const d
 	request->reply->socket.inet.src_ipaddr = request->packet->socket.inet.src_ipaddr;
 	request->reply->socket.inet.dst_ipaddr = request->packet->socket.inet.src_ipaddr;
 
+	if (inst->format == PROTO_DETAIL_FORMAT_BINARY) {
+		if (mod_decode_binary(request, data, data_len) < 0) return -1;
+
+		return inst->app_io->decode(inst->app_io_instance, request, data, data_len);
+	}
+
 	end = data + data_len;
 
 	MPRINT("HEADER %s", data);
@@ -34,6 +34,14 @@ RCSIDH(detail_h, "$Id$")
 extern "C" {
 #endif
 
+/** Format of the records in the detail files
+ *
+ */
+typedef enum {
+	PROTO_DETAIL_FORMAT_TEXT = 0,					//!< "attr = value" lines, as written by rlm_detail.
+	PROTO_DETAIL_FORMAT_BINARY					//!< Length prefixed records, see internal/detail.h.
+} proto_detail_format_t;
+
 typedef struct {
 	CONF_SECTION			*server_cs;			//!< server CS for this listener
 	fr_app_t			*self;				//!< child / parent linking issues
@@ -62,6 +70,8 @@ typedef struct {
 	uint32_t			num_messages;			//!< for message ring buffer
 	uint32_t			priority;			//!< for packet processing, larger == higher
 
+	proto_detail_format_t		format;				//!< of the records we're reading.
+
 	/** Hacked in functionality to allow easy testing of the detail reader.
 	 */
 	bool				exit_when_done;			//!< exit when done reading the current file.
@@ -89,6 +99,7 @@ struct proto_detail_work_s {
 
 	fr_retry_config_t		retry_config;		//!< retry config with irt, mrt, etc.
 	uint16_t			max_outstanding;	//!< number of packets to run in parallel
+	bool				max_outstanding_is_set;	//!< whether max_outstanding was configured.
 
 	bool				track_progress;		//!< do we track progress by writing?
 	bool				retransmit;		//!< are we retransmitting on error?
@@ -138,6 +149,9 @@ struct proto_detail_work_thread_s {
 	off_t				header_offset;		//!< offset of the current header we're reading
 	off_t				read_offset;		//!< where we're reading from in filename_work
 
+	uint8_t const			*map;			//!< binary detail file, mapped into memory.
+	size_t				map_len;		//!< length of the mapping.
+
 	fr_timer_t			*ev;			//!< for detail file timers.
 
 	pthread_mutex_t			worker_mutex;		//!< for the workers
@@ -28,10 +28,12 @@
 #include <freeradius-devel/server/main_loop.h>
 #include <freeradius-devel/io/application.h>
 #include <freeradius-devel/io/listen.h>
+#include <freeradius-devel/internal/detail.h>
 #include <freeradius-devel/util/syserror.h>
 #include "proto_detail.h"
 
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #ifndef NDEBUG
@@ -76,7 +78,7 @@ static conf_parser_t limit_config[] = {
 	 *	...again same as v2 and v3.
 	 */
 	{ FR_CONF_OFFSET("max_rtx_duration", proto_detail_work_t, retry_config.mrd), .dflt = STRINGIFY(0) },
-	{ FR_CONF_OFFSET("max_outstanding", proto_detail_work_t, max_outstanding), .dflt = STRINGIFY(1) },
+	{ FR_CONF_OFFSET_IS_SET("max_outstanding", FR_TYPE_UINT16, 0, proto_detail_work_t, max_outstanding), .dflt = STRINGIFY(1) },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -141,6 +143,129 @@ static fr_event_update_t resume_read[] = {
 	{ 0 }
 };
 
+/** Read the next record from a binary detail file
+ *
+ * The file is mapped into memory, so there's no need to track partial
+ * records across reads.  Records which have already been marked as done
+ * are skipped, as are damaged records, so that a restart resumes at the
+ * first record which hasn't been acknowledged.
+ */
+static ssize_t mod_read_binary(proto_detail_work_t const *inst, proto_detail_work_thread_t *thread,
+			       void **packet_ctx, fr_time_t *recv_time_p, uint8_t *buffer, size_t buffer_len)
+{
+	fr_detail_entry_t	*track;
+	fr_detail_record_t	record;
+	uint8_t const		*p;
+	size_t			remaining;
+	ssize_t			slen, skip;
+
+	/*
+	 *	Everything has been read, we're just waiting for the
+	 *	outstanding replies.
+	 */
+	if (thread->closing) return 0;
+
+	if (thread->outstanding >= inst->max_outstanding) {
+		fr_assert(thread->paused);
+		return 0;
+	}
+
+redo:
+	if ((size_t) thread->read_offset >= thread->map_len) goto eof;
+
+	p = thread->map + thread->read_offset;
+	remaining = thread->map_len - thread->read_offset;
+
+	slen = fr_detail_record_parse(&record, p, remaining);
+	if (slen <= 0) {
+		if (slen == 0) {
+			WARN("proto_detail (%s): Skipping truncated record at offset %zu of %s",
+			     thread->name, (size_t) thread->read_offset, thread->filename_work);
+		} else {
+			PERROR("proto_detail (%s): Skipping damaged record at offset %zu of %s",
+			       thread->name, (size_t) thread->read_offset, thread->filename_work);
+		}
+
+		/*
+		 *	A record can be cut short by an interrupted
+		 *	write, with later records appended after it.
+		 *	So a truncated record isn't necessarily the
+		 *	end of the file.
+		 */
+		skip = fr_detail_record_resync(p, remaining);
+		if (skip < 0) {
+			thread->read_offset = thread->map_len;
+			goto eof;
+		}
+
+		thread->read_offset += skip;
+		goto redo;
+	}
+
+	if (record.flags & FR_DETAIL_RECORD_FLAG_DONE) {
+		MPRINT("Skipping done record at offset %ld", (long) thread->read_offset);
+		thread->read_offset += slen;
+		goto redo;
+	}
+
+	if (((size_t) slen > buffer_len) || ((size_t) slen > inst->parent->max_packet_size)) {
+		DEBUG("Ignoring 'too large' entry at offset %zu of %s",
+		      (size_t) thread->read_offset, thread->filename_work);
+		DEBUG("Entry size %zd is greater than allowed maximum %u",
+		      slen, inst->parent->max_packet_size);
+		thread->read_offset += slen;
+		goto redo;
+	}
+
+	memcpy(buffer, p, slen);
+
+	MEM(track = talloc_zero(thread, fr_detail_entry_t));
+	track->parent = thread;
+	track->timestamp = fr_time();
+	track->id = thread->count++;
+
+	/*
+	 *	We mark the flags byte of the record, and nothing else.
+	 */
+	if (inst->track_progress) track->done_offset = thread->read_offset + FR_DETAIL_RECORD_OFFSET_FLAGS;
+
+	if (inst->retransmit) {
+		MEM(track->packet = talloc_memdup(track, buffer, slen));
+		track->packet_len = slen;
+	}
+
+	thread->read_offset += slen;
+	if ((size_t) thread->read_offset >= thread->map_len) {
+		thread->eof = true;
+		thread->closing = true;
+	}
+
+	thread->outstanding++;
+
+	if (!thread->paused && (thread->outstanding >= inst->max_outstanding)) {
+		(void) fr_event_filter_update(thread->el, thread->fd, FR_EVENT_FILTER_IO, pause_read);
+		thread->paused = true;
+	}
+
+	*packet_ctx = track;
+	*recv_time_p = track->timestamp;
+
+	MPRINT("Returning NUM %u - %zd bytes", thread->outstanding, slen);
+	return slen;
+
+eof:
+	thread->eof = true;
+	thread->closing = true;
+
+	/*
+	 *	Nothing left to replay, and nothing to wait for.  Tell
+	 *	the network side to close the file, which also deletes it.
+	 */
+	if (!thread->outstanding) return -1;
+
+	return 0;
+}
+
 static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time_p, uint8_t *buffer, size_t buffer_len, size_t *leftover)
 {
 	proto_detail_work_t const	*inst = talloc_get_type_abort_const(li->app_io_instance, proto_detail_work_t);
@@ -188,6 +313,10 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 		return track->packet_len;
 	}
 
+	if (inst->parent->format == PROTO_DETAIL_FORMAT_BINARY) {
+		return mod_read_binary(inst, thread, packet_ctx, recv_time_p, buffer, buffer_len);
+	}
+
 	/*
 	 *	If we decide that we're closing, ignore everything
 	 *	else in the file.  Someone extended the file on us
@@ -625,6 +754,19 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 
 	} else if (inst->track_progress && (track->done_offset > 0)) {
 	mark_done:
+		if (inst->parent->format == PROTO_DETAIL_FORMAT_BINARY) {
+			static uint8_t const done = FR_DETAIL_RECORD_FLAG_DONE;
+
+			/*
+			 *	Binary records are acknowledged individually,
+			 *	and we don't touch the file offset.
+			 */
+			if (pwrite(thread->fd, &done, sizeof(done), track->done_offset) < 0) {
+				ERROR("%s - Failed marking entry as done: %s", thread->name, fr_syserror(errno));
+			}
+			goto free_track;
+		}
+
 		/*
 		 *	Seek to the entry, mark it as done, and then seek to
 		 *	the point in the file where we were reading from.
@@ -714,6 +856,34 @@ static int mod_open(fr_listen_t *li)
 		thread->file_size = 1;
 	}
 
+	/*
+	 *	Binary files are mapped, and read directly from memory.
+	 *	The file has already been renamed and locked, so nothing
+	 *	else should be appending to it.
+	 */
+	if (inst->parent->format == PROTO_DETAIL_FORMAT_BINARY) {
+		struct stat buf;
+
+		if (fstat(thread->fd, &buf) < 0) {
+			cf_log_err(inst->cs, "Failed examining %s: %s", thread->filename_work, fr_syserror(errno));
+			return -1;
+		}
+
+		if (buf.st_size > 0) {
+			void *map;
+
+			map = mmap(NULL, buf.st_size, PROT_READ, MAP_SHARED, thread->fd, 0);
+			if (map == MAP_FAILED) {
+				cf_log_err(inst->cs, "Failed mapping %s: %s", thread->filename_work, fr_syserror(errno));
+				return -1;
+			}
+			(void) madvise(map, buf.st_size, MADV_SEQUENTIAL);
+
+			thread->map = map;
+			thread->map_len = buf.st_size;
+		}
+	}
+
 	fr_assert(thread->name == NULL);
 	fr_assert(thread->filename_work != NULL);
 	thread->name = talloc_typed_asprintf(thread, "detail_work reading file %s", thread->filename_work);
@@ -758,6 +928,12 @@ static int mod_close_internal(proto_detail_work_thread_t *thread)
 
 	if (thread->outstanding == 0) unlink(thread->filename_work);
 
+	if (thread->map) {
+		(void) munmap(UNCONST(uint8_t *, thread->map), thread->map_len);
+		thread->map = NULL;
+		thread->map_len = 0;
+	}
+
 	close(thread->fd);
 	thread->fd = -1;
 
@@ -867,6 +1043,15 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		FR_TIME_DELTA_BOUND_CHECK("limit.max_rtx_timer", inst->retry_config.mrt, <=, fr_time_delta_from_sec(30));
 	}
 
+	/*
+	 *	Binary records can be replayed out of order, as each one
+	 *	is acknowledged individually.  So unless told otherwise,
+	 *	keep enough of them in flight to spread over the workers.
+	 */
+	if ((inst->parent->format == PROTO_DETAIL_FORMAT_BINARY) && !inst->max_outstanding_is_set) {
+		inst->max_outstanding = 64;
+	}
+
 	FR_INTEGER_BOUND_CHECK("limit.max_outstanding", inst->max_outstanding, >=, 1);
 
 	client = inst->client = talloc_zero(inst, fr_client_t);
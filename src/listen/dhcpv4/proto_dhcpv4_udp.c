@@ -28,6 +28,7 @@
 #include <freeradius-devel/arp/arp.h>
 #include <freeradius-devel/server/protocol.h>
 #include <freeradius-devel/util/udp.h>
+#include <freeradius-devel/util/udp_batch.h>
 #include <freeradius-devel/util/trie.h>
 #include <freeradius-devel/io/application.h>
 #include <freeradius-devel/io/listen.h>
@@ -43,6 +44,8 @@ typedef struct {
 
 	fr_io_address_t			*connection;		//!< for connected sockets.
 
+	fr_udp_batch_t			*batch;			//!< for recvmmsg() / sendmmsg()
+
 	fr_stats_t			stats;			//!< statistics for this socket
 }  proto_dhcpv4_udp_thread_t;
 
@@ -61,6 +64,8 @@ typedef struct {
 	uint32_t			max_packet_size;	//!< for message ring buffer.
 	uint32_t			max_attributes;		//!< Limit maximum decodable attributes.
 
+	uint32_t			batch_size;		//!< Maximum packets to read or write per system call.
+
 	uint16_t			port;			//!< Port to listen on.
 	uint16_t			client_port;		//!< Client port to reply to.
 
@@ -108,6 +113,8 @@ static const conf_parser_t udp_listen_config[] = {
 	{ FR_CONF_OFFSET("max_packet_size", proto_dhcpv4_udp_t, max_packet_size), .dflt = "4096" } ,
        	{ FR_CONF_OFFSET("max_attributes", proto_dhcpv4_udp_t, max_attributes), .dflt = STRINGIFY(DHCPV4_MAX_ATTRIBUTES) } ,
 
+	{ FR_CONF_OFFSET("batch_size", proto_dhcpv4_udp_t, batch_size), .dflt = "1" } ,
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -156,7 +163,12 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	 */
 	flags = UDP_FLAGS_CONNECTED * (thread->connection != NULL);
 
-	data_size = udp_recv(thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
+	if (thread->batch) {
+		data_size = fr_udp_batch_recv(thread->batch, flags, &address->socket, buffer, buffer_len, recv_time_p);
+		li->read_pending = (fr_udp_batch_buffered(thread->batch) > 0);
+	} else {
+		data_size = udp_recv(thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
+	}
 	if (data_size < 0) {
 		RATE_LIMIT_GLOBAL(PERROR, "Read error (%zd)", data_size);
 		return data_size;
@@ -486,7 +498,11 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 	/*
 	 *	proto_dhcpv4 takes care of suppressing do-not-respond, etc.
 	 */
-	data_size = udp_send(&socket, flags, buffer, buffer_len);
+	if (thread->batch) {
+		data_size = fr_udp_batch_send(thread->batch, &socket, flags, buffer, buffer_len);
+	} else {
+		data_size = udp_send(&socket, flags, buffer, buffer_len);
+	}
 
 	/*
 	 *	This socket is dead.  That's an error...
@@ -497,6 +513,18 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 }
 
 
+/** Write any replies which have been batched up
+ *
+ */
+static int mod_flush(fr_listen_t *li)
+{
+	proto_dhcpv4_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_dhcpv4_udp_thread_t);
+
+	if (!thread->batch) return 0;
+
+	return fr_udp_batch_flush(thread->batch);
+}
+
 static int mod_connection_set(fr_listen_t *li, fr_io_address_t *connection)
 {
 	proto_dhcpv4_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_dhcpv4_udp_thread_t);
@@ -581,6 +609,21 @@ static int mod_open(fr_listen_t *li)
 
 	thread->sockfd = sockfd;
 
+	/*
+	 *	Read and write multiple packets per system call.
+	 */
+	if (inst->batch_size > 1) {
+		thread->batch = fr_udp_batch_alloc(thread, sockfd, inst->batch_size, inst->max_packet_size);
+		if (!thread->batch) {
+			close(sockfd);
+			PERROR("Failed allocating packet batch");
+			goto error;
+		}
+
+		li->read_batch = inst->batch_size;
+		li->batch_stats = fr_udp_batch_stats(thread->batch);
+	}
+
 	fr_assert((cf_parent(inst->cs) != NULL) && (cf_parent(cf_parent(inst->cs)) != NULL));	/* listen { ... } */
 
 	thread->name = fr_app_io_socket_name(thread, &proto_dhcpv4_udp,
@@ -737,6 +780,9 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, MIN_PACKET_SIZE);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65536);
 
+	FR_INTEGER_BOUND_CHECK("batch_size", inst->batch_size, >=, 1);
+	FR_INTEGER_BOUND_CHECK("batch_size", inst->batch_size, <=, FR_UDP_BATCH_MAX);
+
 	if (!inst->port) {
 		struct servent *s;
 
@@ -851,6 +897,7 @@ fr_app_io_t proto_dhcpv4_udp = {
 	.open			= mod_open,
 	.read			= mod_read,
 	.write			= mod_write,
+	.flush			= mod_flush,
 	.fd_set			= mod_fd_set,
 	.track_create  		= mod_track_create,
 	.track_compare		= mod_track_compare,
@@ -24,6 +24,10 @@
  */
 #include <freeradius-devel/radius/radius.h>
 #include <freeradius-devel/io/listen.h>
+#include <freeradius-devel/io/network.h>
+#include <freeradius-devel/protocol/radius/rfc2865.h>
+#include <freeradius-devel/protocol/radius/rfc3162.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/unlang/xlat_func.h>
 #include <freeradius-devel/server/module_rlm.h>
 #include <stdbool.h>
@@ -44,6 +48,20 @@ static conf_parser_t const limit_config[] = {
 	{ FR_CONF_OFFSET("max_clients", proto_radius_t, io.max_clients), .dflt = "256" } ,
 	{ FR_CONF_OFFSET("max_pending_packets", proto_radius_t, io.max_pending_packets), .dflt = "256" } ,
 
+	/*
+	 *	Open one socket per network thread.
+	 */
+	{ FR_CONF_OFFSET("shards", proto_radius_t, io.shards), .dflt = "1" } ,
+
+	/*
+	 *	How packets are assigned to workers.
+	 */
+	{ FR_CONF_OFFSET("dispatch", proto_radius_t, io.dispatch),
+	  .func = cf_table_parse_int,
+	  .uctx = &(cf_table_parse_ctx_t){ .table = fr_network_dispatch_table, .len = &fr_network_dispatch_table_len },
+	  .dflt = "load" },
+	{ FR_CONF_OFFSET("dispatch_spill", proto_radius_t, io.dispatch_spill), .dflt = "64" } ,
+
 	/*
 	 *	For performance tweaking.  NOT for normal humans.
 	 */
@@ -209,6 +227,7 @@ static int mod_decode(void const *instance, request_t *request, uint8_t *const d
 	common_ctx = (fr_radius_ctx_t) {
 		.secret = client->secret,
 		.secret_length = talloc_array_length(client->secret) - 1,
+		.hmac_key = client->secret_hmac,
 	};
 
 	request->packet->code = data[0];
@@ -490,6 +509,7 @@ static ssize_t mod_encode(UNUSED void const *instance, request_t *request, uint8
 	common_ctx = (fr_radius_ctx_t) {
 		.secret = client->secret,
 		.secret_length = talloc_array_length(client->secret) - 1,
+		.hmac_key = client->secret_hmac,
 	};
 	encode_ctx = (fr_radius_encode_ctx_t) {
 		.common = &common_ctx,
@@ -509,8 +529,9 @@ static ssize_t mod_encode(UNUSED void const *instance, request_t *request, uint8
 		return -1;
 	}
 
-	if (fr_radius_sign(buffer, request->packet->data + 4,
-			   (uint8_t const *) client->secret, talloc_array_length(client->secret) - 1) < 0) {
+	if (fr_radius_sign_with_key(buffer, request->packet->data + 4,
+				    (uint8_t const *) client->secret, talloc_array_length(client->secret) - 1,
+				    client->secret_hmac) < 0) {
 		RPEDEBUG("Failed signing RADIUS reply");
 		return -1;
 	}
@@ -561,6 +582,42 @@ static int mod_priority_set(void const *instance, uint8_t const *buffer, UNUSED
 	return inst->priorities[buffer[0]];
 }
 
+/** Identify the session a packet belongs to
+ *
+ *  All rounds of an EAP conversation come from the same NAS, for the
+ *  same user and station.  The State attribute can't be used, as it
+ *  isn't in the first round, and changes on each round.
+ */
+static uint32_t mod_affinity_get(UNUSED void const *instance, uint8_t const *buffer, size_t buflen)
+{
+	uint8_t const	*attr, *end;
+	uint32_t	hash = 0;
+
+	attr = buffer + RADIUS_HEADER_LENGTH;
+	end = buffer + buflen;
+
+	while ((attr + 2) <= end) {
+		if ((attr[1] < 2) || ((attr + attr[1]) > end)) break;
+
+		switch (attr[0]) {
+		case FR_USER_NAME:
+		case FR_NAS_IP_ADDRESS:
+		case FR_CALLING_STATION_ID:
+		case FR_NAS_IDENTIFIER:
+		case FR_NAS_IPV6_ADDRESS:
+			hash = fr_hash_update(attr, attr[1], hash);
+			break;
+
+		default:
+			break;
+		}
+
+		attr += attr[1];
+	}
+
+	return hash;
+}
+
 /** Open listen sockets/connect to external event source
  *
  * @param[in] instance	Ctx data for this application.
@@ -721,5 +778,6 @@ fr_app_t proto_radius = {
 	.open			= mod_open,
 	.decode			= mod_decode,
 	.encode			= mod_encode,
-	.priority		= mod_priority_set
+	.priority		= mod_priority_set,
+	.affinity		= mod_affinity_get
 };
@@ -0,0 +1,520 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_cache_shard.c
+ * @brief Sharded in-memory cache.
+ *
+ * The key space is split across a number of shards, each with its own
+ * rbtree, expiry heap, LRU list and mutex.  Operations on different
+ * keys only contend if the keys hash to the same shard.
+ *
+ * @copyright 2025 The FreeRADIUS server project
+ */
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/heap.h>
+#include <freeradius-devel/util/math.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/value.h>
+#include "../../rlm_cache.h"
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+/** One partition of the cache
+ *
+ */
+typedef struct {
+	pthread_mutex_t			mutex;		//!< Protect the shard from multiple readers/writers.
+
+	fr_rb_tree_t			*cache;		//!< Tree for looking up cache keys.
+	fr_heap_t			*heap;		//!< For managing entry expiry.
+	fr_dlist_head_t			lru;		//!< Least recently used entries at the head.
+
+	uint64_t			evicted;	//!< Number of entries evicted to make room.
+} CC_HINT(aligned(64)) rlm_cache_shard_part_t;
+
+typedef struct {
+	rlm_cache_shard_part_t		*parts;		//!< Array of shards.
+	atomic_uint_fast64_t		count;		//!< Total number of entries in all shards.
+} rlm_cache_shard_mutable_t;
+
+typedef struct {
+	uint32_t			num_shards;	//!< Number of shards, rounded up to a power of 2.
+	bool				lru;		//!< Evict the least recently used entries when full.
+
+	rlm_cache_shard_mutable_t	*mutable;	//!< Mutable instance data.
+} rlm_cache_shard_t;
+
+typedef struct {
+	rlm_cache_entry_t		fields;		//!< Entry data.
+
+	fr_rb_node_t			node;		//!< Entry used for lookups.
+	fr_heap_index_t			heap_id;	//!< Offset used for expiry heap.
+	fr_dlist_t			lru_entry;	//!< Entry in the shard's LRU list.
+} rlm_cache_shard_entry_t;
+
+/** Per-request handle
+ *
+ * Records which shard (if any) the request currently holds locked.
+ * The lock is held until the handle is released, as rlm_cache
+ * continues to use the entry returned by find.
+ */
+typedef struct {
+	request_t			*request;	//!< For sanity checks.
+	rlm_cache_shard_part_t		*locked;	//!< Shard we currently hold the mutex for.
+} rlm_cache_shard_handle_t;
+
+static conf_parser_t driver_config[] = {
+	{ FR_CONF_OFFSET("shards", rlm_cache_shard_t, num_shards), .dflt = "32" },
+	{ FR_CONF_OFFSET("lru", rlm_cache_shard_t, lru), .dflt = "no" },
+	CONF_PARSER_TERMINATOR
+};
+
+/** Compare two entries by key
+ *
+ * There may only be one entry with the same key.
+ */
+static int8_t cache_entry_cmp(void const *one, void const *two)
+{
+	rlm_cache_entry_t const *a = one, *b = two;
+
+	MEMCMP_RETURN(a, b, key.vb_strvalue, key.vb_length);
+	return 0;
+}
+
+/** Compare two entries by expiry time
+ *
+ * There may be multiple entries with the same expiry time.
+ */
+static int8_t cache_heap_cmp(void const *one, void const *two)
+{
+	rlm_cache_entry_t const *a = one, *b = two;
+
+	return fr_unix_time_cmp(a->expires, b->expires);
+}
+
+/** Lock the shard which holds a key
+ *
+ * If the handle already holds a different shard, that one is released
+ * first, so a handle never holds more than one mutex.
+ */
+static rlm_cache_shard_part_t *cache_shard_lock(rlm_cache_shard_t const *driver, rlm_cache_shard_handle_t *handle,
+						fr_value_box_t const *key)
+{
+	rlm_cache_shard_part_t *part;
+
+	part = &driver->mutable->parts[fr_hash(key->vb_strvalue, key->vb_length) & (driver->num_shards - 1)];
+	if (handle->locked == part) return part;
+
+	if (handle->locked) pthread_mutex_unlock(&handle->locked->mutex);
+
+	pthread_mutex_lock(&part->mutex);
+	handle->locked = part;
+
+	return part;
+}
+
+/** Remove an entry from its shard, and free it
+ *
+ * @note Called with the shard mutex held.
+ */
+static void cache_shard_entry_free(rlm_cache_shard_t const *driver, rlm_cache_shard_part_t *part,
+				   rlm_cache_shard_entry_t *c)
+{
+	fr_heap_extract(&part->heap, c);
+	fr_rb_delete(part->cache, c);
+	fr_dlist_remove(&part->lru, c);
+	atomic_fetch_sub_explicit(&driver->mutable->count, 1, memory_order_relaxed);
+	talloc_free(c);
+}
+
+/** Custom allocation function for the driver
+ *
+ * Allows allocation of cache entry structures with additional fields.
+ *
+ * @copydetails cache_entry_alloc_t
+ */
+static rlm_cache_entry_t *cache_entry_alloc(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+					    request_t *request)
+{
+	rlm_cache_shard_entry_t *c;
+
+	c = talloc_zero(NULL, rlm_cache_shard_entry_t);
+	if (!c) {
+		RERROR("Failed allocating cache entry");
+		return NULL;
+	}
+
+	return (rlm_cache_entry_t *)c;
+}
+
+/** Locate a cache entry
+ *
+ * @copydetails cache_entry_find_t
+ */
+static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
+				       UNUSED rlm_cache_config_t const *config, void *instance,
+				       request_t *request, void *handle, fr_value_box_t const *key)
+{
+	rlm_cache_shard_t		*driver = talloc_get_type_abort(instance, rlm_cache_shard_t);
+	rlm_cache_shard_part_t		*part;
+	rlm_cache_shard_entry_t		*c;
+	rlm_cache_entry_t		find = {};
+
+	fr_assert(((rlm_cache_shard_handle_t *)handle)->request == request);
+
+	part = cache_shard_lock(driver, handle, key);
+
+	/*
+	 *	Clear out old entries
+	 */
+	c = fr_heap_peek(part->heap);
+	if (c && (fr_unix_time_lt(c->fields.expires, fr_time_to_unix_time(request->packet->timestamp)))) {
+		cache_shard_entry_free(driver, part, c);
+	}
+
+	fr_value_box_copy_shallow(NULL, &find.key, key);
+
+	/*
+	 *	Is there an entry for this key?
+	 */
+	c = fr_rb_find(part->cache, &find);
+	if (!c) {
+		*out = NULL;
+		return CACHE_MISS;
+	}
+
+	/*
+	 *	Mark it as recently used.
+	 */
+	if (driver->lru) {
+		fr_dlist_remove(&part->lru, c);
+		fr_dlist_insert_tail(&part->lru, c);
+	}
+
+	*out = &c->fields;
+
+	return CACHE_OK;
+}
+
+/** Free an entry and remove it from the data store
+ *
+ * @copydetails cache_entry_expire_t
+ */
+static cache_status_t cache_entry_expire(UNUSED rlm_cache_config_t const *config, void *instance,
+					 request_t *request, void *handle,
+					 fr_value_box_t const *key)
+{
+	rlm_cache_shard_t		*driver = talloc_get_type_abort(instance, rlm_cache_shard_t);
+	rlm_cache_shard_part_t		*part;
+	rlm_cache_entry_t		find = {};
+	rlm_cache_shard_entry_t		*c;
+
+	if (!request) return CACHE_ERROR;
+
+	part = cache_shard_lock(driver, handle, key);
+
+	fr_value_box_copy_shallow(NULL, &find.key, key);
+
+	c = fr_rb_find(part->cache, &find);
+	if (!c) return CACHE_MISS;
+
+	cache_shard_entry_free(driver, part, c);
+
+	return CACHE_OK;
+}
+
+/** Insert a new entry into the data store
+ *
+ * If LRU eviction is enabled, and the shard is at its share of
+ * max_entries, the least recently used entry is evicted first.
+ *
+ * @copydetails cache_entry_insert_t
+ */
+static cache_status_t cache_entry_insert(rlm_cache_config_t const *config, void *instance,
+					 request_t *request, void *handle,
+					 rlm_cache_entry_t const *c)
+{
+	rlm_cache_shard_t		*driver = talloc_get_type_abort(instance, rlm_cache_shard_t);
+	rlm_cache_shard_part_t		*part;
+	rlm_cache_shard_entry_t		*entry = UNCONST(rlm_cache_shard_entry_t *, (rlm_cache_shard_entry_t const *) c);
+	cache_status_t			status;
+
+	if (!request) return CACHE_ERROR;
+
+	part = cache_shard_lock(driver, handle, &c->key);
+
+	/*
+	 *	Allow overwriting
+	 */
+	if (!fr_rb_insert(part->cache, entry)) {
+		status = cache_entry_expire(config, instance, request, handle, &c->key);
+		if ((status != CACHE_OK) && !fr_cond_assert(0)) return CACHE_ERROR;
+
+		if (!fr_rb_insert(part->cache, entry)) {
+			RERROR("Failed adding entry");
+
+			return CACHE_ERROR;
+		}
+	}
+
+	if (fr_heap_insert(&part->heap, entry) < 0) {
+		fr_rb_delete(part->cache, entry);
+		RERROR("Failed adding entry to expiry heap");
+
+		return CACHE_ERROR;
+	}
+
+	fr_dlist_insert_tail(&part->lru, entry);
+	atomic_fetch_add_explicit(&driver->mutable->count, 1, memory_order_relaxed);
+
+	/*
+	 *	Make room by evicting the least recently used
+	 *	entries.  The limit is split evenly across the
+	 *	shards, so we only need to look at this one.  We
+	 *	round down, so that the total never exceeds
+	 *	max_entries, and rlm_cache never sees a full cache.
+	 */
+	if (driver->lru && (config->max_entries > 0)) {
+		uint32_t max = config->max_entries / driver->num_shards;
+
+		if (!max) max = 1;
+
+		while (fr_rb_num_elements(part->cache) > max) {
+			rlm_cache_shard_entry_t *old = fr_dlist_head(&part->lru);
+
+			if (old == entry) break;
+
+			RDEBUG3("Evicting least recently used entry");
+			cache_shard_entry_free(driver, part, old);
+			part->evicted++;
+		}
+	}
+
+	return CACHE_OK;
+}
+
+/** Update the TTL of an entry
+ *
+ * @copydetails cache_entry_set_ttl_t
+ */
+static cache_status_t cache_entry_set_ttl(UNUSED rlm_cache_config_t const *config, void *instance,
+					  request_t *request, void *handle,
+					  rlm_cache_entry_t *c)
+{
+	rlm_cache_shard_t		*driver = talloc_get_type_abort(instance, rlm_cache_shard_t);
+	rlm_cache_shard_part_t		*part;
+
+#ifdef NDEBUG
+	if (!request) return CACHE_ERROR;
+#endif
+
+	part = cache_shard_lock(driver, handle, &c->key);
+
+	if (!fr_cond_assert(fr_heap_extract(&part->heap, c) == 0)) {
+		RERROR("Entry not in heap");
+		return CACHE_ERROR;
+	}
+
+	if (fr_heap_insert(&part->heap, c) < 0) {
+		fr_rb_delete(part->cache, c);	/* make sure we don't leak entries... */
+		fr_dlist_remove(&part->lru, (rlm_cache_shard_entry_t *)c);
+		atomic_fetch_sub_explicit(&driver->mutable->count, 1, memory_order_relaxed);
+		RERROR("Failed updating entry TTL.  Entry was forcefully expired");
+		return CACHE_ERROR;
+	}
+	return CACHE_OK;
+}
+
+/** Return the number of entries in the cache
+ *
+ * @copydetails cache_entry_count_t
+ */
+static uint64_t cache_entry_count(UNUSED rlm_cache_config_t const *config, void *instance,
+				  request_t *request, UNUSED void *handle)
+{
+	rlm_cache_shard_t *driver = talloc_get_type_abort(instance, rlm_cache_shard_t);
+
+	if (!request) return CACHE_ERROR;
+
+	return atomic_load_explicit(&driver->mutable->count, memory_order_relaxed);
+}
+
+/** Allocate a handle
+ *
+ * No mutexes are taken here.  The shard for a key is locked by the
+ * first operation which uses that key.
+ *
+ * @copydetails cache_acquire_t
+ */
+static int cache_acquire(void **handle, UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+			 request_t *request)
+{
+	rlm_cache_shard_handle_t *h;
+
+	MEM(h = talloc(request, rlm_cache_shard_handle_t));
+	*h = (rlm_cache_shard_handle_t) {
+		.request = request,
+	};
+
+	*handle = h;
+
+	return 0;
+}
+
+/** Release a handle, unlocking any shard it holds
+ *
+ * @copydetails cache_release_t
+ */
+static void cache_release(UNUSED rlm_cache_config_t const *config, UNUSED void *instance, request_t *request,
+			  rlm_cache_handle_t *handle)
+{
+	rlm_cache_shard_handle_t *h = handle;
+
+	fr_assert(h->request == request);
+
+	if (h->locked) {
+		pthread_mutex_unlock(&h->locked->mutex);
+		RDEBUG3("Mutex released");
+	}
+
+	talloc_free(h);
+}
+
+/** Cleanup a cache_shard instance
+ *
+ */
+static int mod_detach(module_detach_ctx_t const *mctx)
+{
+	rlm_cache_shard_t		*driver = talloc_get_type_abort(mctx->mi->data, rlm_cache_shard_t);
+	rlm_cache_shard_mutable_t	*mutable = driver->mutable;
+	uint32_t			i;
+
+	if (!mutable) return 0;
+
+	for (i = 0; i < driver->num_shards; i++) {
+		rlm_cache_shard_part_t	*part = &mutable->parts[i];
+		fr_rb_iter_inorder_t	iter;
+		void			*data;
+
+		if (!part->cache) continue;
+
+		for (data = fr_rb_iter_init_inorder(&iter, part->cache);
+		     data;
+		     data = fr_rb_iter_next_inorder(&iter)) {
+			fr_rb_iter_delete_inorder(&iter);
+			talloc_free(data);
+		}
+
+		pthread_mutex_destroy(&part->mutex);
+	}
+
+	TALLOC_FREE(driver->mutable);
+
+	return 0;
+}
+
+/** Create a new cache_shard instance
+ *
+ * @param[in] mctx		Data required for instantiation.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_instantiate(module_inst_ctx_t const *mctx)
+{
+	rlm_cache_shard_t		*driver = talloc_get_type_abort(mctx->mi->data, rlm_cache_shard_t);
+	rlm_cache_shard_mutable_t	*mutable;
+	uint32_t			i;
+	int				ret;
+
+	FR_INTEGER_BOUND_CHECK("shards", driver->num_shards, >=, 1);
+	FR_INTEGER_BOUND_CHECK("shards", driver->num_shards, <=, 1024);
+
+	/*
+	 *	Round up to a power of 2, so we can mask the hash.
+	 */
+	if (driver->num_shards & (driver->num_shards - 1)) driver->num_shards = 1 << fr_high_bit_pos(driver->num_shards);
+
+	MEM(mutable = talloc_zero(NULL, rlm_cache_shard_mutable_t));
+	MEM(mutable->parts = talloc_zero_array(mutable, rlm_cache_shard_part_t, driver->num_shards));
+	atomic_init(&mutable->count, 0);
+
+	for (i = 0; i < driver->num_shards; i++) {
+		rlm_cache_shard_part_t *part = &mutable->parts[i];
+
+		/*
+		 *	The cache.
+		 */
+		part->cache = fr_rb_inline_talloc_alloc(mutable, rlm_cache_shard_entry_t, node, cache_entry_cmp, NULL);
+		if (!part->cache) {
+			ERROR("Failed to create cache");
+		error:
+			while (i-- > 0) pthread_mutex_destroy(&mutable->parts[i].mutex);
+			talloc_free(mutable);
+			return -1;
+		}
+
+		/*
+		 *	The heap of entries to expire.
+		 */
+		part->heap = fr_heap_talloc_alloc(mutable, cache_heap_cmp, rlm_cache_shard_entry_t, heap_id, 0);
+		if (!part->heap) {
+			ERROR("Failed to create heap for the cache");
+			goto error;
+		}
+
+		fr_dlist_talloc_init(&part->lru, rlm_cache_shard_entry_t, lru_entry);
+
+		if ((ret = pthread_mutex_init(&part->mutex, NULL)) != 0) {
+			ERROR("Failed initializing mutex: %s", fr_syserror(ret));
+			goto error;
+		}
+	}
+
+	driver->mutable = mutable;
+
+	return 0;
+}
+
+extern rlm_cache_driver_t rlm_cache_shard;
+rlm_cache_driver_t rlm_cache_shard = {
+	.common = {
+		.magic		= MODULE_MAGIC_INIT,
+		.name		= "cache_shard",
+		.config		= driver_config,
+		.instantiate	= mod_instantiate,
+		.detach		= mod_detach,
+		.inst_size	= sizeof(rlm_cache_shard_t),
+		.inst_type	= "rlm_cache_shard_t",
+	},
+	.alloc		= cache_entry_alloc,
+
+	.find		= cache_entry_find,
+	.insert		= cache_entry_insert,
+	.expire		= cache_entry_expire,
+	.set_ttl	= cache_entry_set_ttl,
+	.count		= cache_entry_count,
+
+	.acquire	= cache_acquire,
+	.release	= cache_release,
+};
@@ -47,6 +47,12 @@ int submodule_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, con
 static int cache_key_parse(TALLOC_CTX *ctx, void *out, tmpl_rules_t const *t_rules, CONF_ITEM *ci, call_env_ctx_t const *cec, call_env_parser_t const *rule);
 static int cache_update_section_parse(TALLOC_CTX *ctx, call_env_parsed_head_t *out, tmpl_rules_t const *t_rules, CONF_ITEM *ci, call_env_ctx_t const *cec, call_env_parser_t const *rule);
 
+static const conf_parser_t l1_config[] = {
+	{ FR_CONF_OFFSET("max_entries", rlm_cache_t, l1_max_entries), .dflt = "0" },
+	{ FR_CONF_OFFSET("ttl", rlm_cache_t, l1_ttl), .dflt = "1s" },
+	CONF_PARSER_TERMINATOR
+};
+
 static const conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET_TYPE_FLAGS("driver", FR_TYPE_VOID, 0, rlm_cache_t, driver_submodule), .dflt = "rbtree",
 			 .func = submodule_parse },
@@ -56,6 +62,7 @@ static const conf_parser_t module_config[] = {
 	/* Should be a type which matches time_t, @fixme before 2038 */
 	{ FR_CONF_OFFSET("epoch", rlm_cache_config_t, epoch), .dflt = "0" },
 	{ FR_CONF_OFFSET("add_stats", rlm_cache_config_t, stats), .dflt = "no" },
+	{ FR_CONF_POINTER("l1", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) l1_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -234,6 +241,188 @@ static void cache_free(rlm_cache_t const *inst, rlm_cache_entry_t **c)
 	*c = NULL;
 }
 
+/** An entry in a worker's L1 tier
+ *
+ * Holds a private copy of an entry retrieved from the driver, so that
+ * hot keys can be served without acquiring a driver handle.
+ */
+typedef struct {
+	rlm_cache_entry_t	c;			//!< Copy of the driver's entry.  Must come first.
+	fr_unix_time_t		l1_expires;		//!< When the copy must no longer be served.
+
+	fr_rb_node_t		node;			//!< Entry in the L1 tree.
+	fr_dlist_t		entry;			//!< Entry in the LRU list.
+} rlm_cache_l1_entry_t;
+
+/** Lookup counters for each tier
+ *
+ */
+typedef struct {
+	uint64_t		l1_hits;		//!< Lookups served from the L1 tier.
+	uint64_t		l1_misses;		//!< Lookups passed to the driver.
+	uint64_t		l2_hits;		//!< Lookups served by the driver.
+	uint64_t		l2_misses;		//!< Lookups which found nothing in the driver.
+} rlm_cache_stats_t;
+
+typedef struct {
+	fr_rb_tree_t		*l1;			//!< Entries in this worker's L1 tier.
+	fr_dlist_head_t		lru;			//!< Most recently used entries at the head.
+
+	rlm_cache_stats_t	stats;			//!< Only written by this worker.
+	fr_dlist_t		entry;			//!< Entry in the list of workers using this instance.
+} rlm_cache_thread_t;
+
+/** State shared between workers, and with radmin
+ *
+ */
+struct rlm_cache_mutable_s {
+	pthread_mutex_t		mutex;			//!< Protects the fields below.
+	fr_dlist_head_t		threads;		//!< Workers using this instance.
+	rlm_cache_stats_t	stats;			//!< Totals from workers which have exited.
+};
+
+/** Compare two L1 entries by key
+ *
+ */
+static int8_t cache_l1_cmp(void const *one, void const *two)
+{
+	rlm_cache_entry_t const *a = one, *b = two;
+
+	MEMCMP_RETURN(a, b, key.vb_strvalue, key.vb_length);
+	return 0;
+}
+
+/** Unlink an L1 entry from the tree and the LRU list
+ *
+ */
+static int _cache_l1_entry_free(rlm_cache_l1_entry_t *l1)
+{
+	rlm_cache_thread_t *t = talloc_parent(l1);
+
+	fr_rb_remove_by_inline_node(t->l1, &l1->node);
+	fr_dlist_remove(&t->lru, l1);
+
+	return 0;
+}
+
+/** Remove any copy of an entry from this worker's L1 tier
+ *
+ * Called whenever this worker modifies or removes an entry.  Copies held
+ * by other workers age out after at most #rlm_cache_t.l1_ttl.
+ */
+static void cache_l1_remove(rlm_cache_t const *inst, rlm_cache_thread_t *t, fr_value_box_t const *key)
+{
+	rlm_cache_entry_t find = {};
+
+	if (!inst->l1_max_entries) return;
+
+	fr_value_box_copy_shallow(NULL, &find.key, key);
+	talloc_free(fr_rb_find(t->l1, &find));
+}
+
+/** Find an entry in this worker's L1 tier
+ *
+ * @return
+ *	- The L1 copy of the entry.  Must not be passed to #cache_free.
+ *	- NULL if the L1 tier is disabled, or holds no valid copy of the entry.
+ */
+static rlm_cache_entry_t *cache_l1_find(rlm_cache_t const *inst, rlm_cache_thread_t *t, request_t *request,
+					fr_value_box_t const *key)
+{
+	rlm_cache_entry_t	find = {};
+	rlm_cache_l1_entry_t	*l1;
+	fr_unix_time_t		now;
+
+	if (!inst->l1_max_entries) return NULL;
+
+	fr_value_box_copy_shallow(NULL, &find.key, key);
+	l1 = fr_rb_find(t->l1, &find);
+	if (!l1) {
+	miss:
+		t->stats.l1_misses++;
+		return NULL;
+	}
+
+	now = fr_time_to_unix_time(request->packet->timestamp);
+	if (fr_unix_time_lt(l1->l1_expires, now) ||
+	    fr_unix_time_lt(l1->c.created, fr_unix_time_from_sec(inst->config.epoch))) {
+		talloc_free(l1);
+		goto miss;
+	}
+
+	fr_dlist_remove(&t->lru, l1);
+	fr_dlist_insert_head(&t->lru, l1);
+
+	t->stats.l1_hits++;
+	l1->c.hits++;
+
+	RDEBUG2("Found entry for \"%pV\" in L1 tier", key);
+
+	return &l1->c;
+}
+
+/** Record the result of a driver lookup, copying found entries into the L1 tier
+ *
+ */
+static void cache_l1_fill(rlm_cache_t const *inst, rlm_cache_thread_t *t, request_t *request,
+			  rlm_cache_entry_t const *c)
+{
+	rlm_cache_l1_entry_t	*l1;
+	map_t const		*map = NULL;
+	map_t			*c_map;
+	fr_unix_time_t		l1_expires;
+
+	if (!c) {
+		t->stats.l2_misses++;
+		return;
+	}
+	t->stats.l2_hits++;
+
+	if (!inst->l1_max_entries) return;
+
+	cache_l1_remove(inst, t, &c->key);
+
+	/*
+	 *	Make room by evicting the least recently used entry.
+	 */
+	if (fr_rb_num_elements(t->l1) >= inst->l1_max_entries) talloc_free(fr_dlist_tail(&t->lru));
+
+	MEM(l1 = talloc_zero(t, rlm_cache_l1_entry_t));
+	map_list_init(&l1->c.maps);
+	if (unlikely(fr_value_box_copy(l1, &l1->c.key, &c->key) < 0)) {
+	error:
+		RWDEBUG("Failed copying entry into L1 tier");
+		talloc_free(l1);
+		return;
+	}
+	l1->c.hits = c->hits;
+	l1->c.created = c->created;
+	l1->c.expires = c->expires;
+
+	while ((map = map_list_next(&c->maps, map))) {
+		MEM(c_map = talloc_zero(l1, map_t));
+		c_map->op = map->op;
+		map_list_init(&c_map->child);
+
+		c_map->lhs = tmpl_copy(c_map, map->lhs);
+		c_map->rhs = tmpl_copy(c_map, map->rhs);
+		if (!c_map->lhs || !c_map->rhs) goto error;
+
+		map_list_insert_tail(&l1->c.maps, c_map);
+	}
+
+	/*
+	 *	Never serve the copy for longer than the driver would
+	 *	have served the original.
+	 */
+	l1_expires = fr_unix_time_add(fr_time_to_unix_time(request->packet->timestamp), inst->l1_ttl);
+	l1->l1_expires = fr_unix_time_lt(c->expires, l1_expires) ? c->expires : l1_expires;
+
+	fr_rb_insert(t->l1, l1);
+	fr_dlist_insert_head(&t->lru, l1);
+	talloc_set_destructor(l1, _cache_l1_entry_free);
+}
+
 /** Merge a cached entry into a #request_t
  *
  * @return
@@ -288,7 +477,7 @@ static rlm_rcode_t cache_merge(rlm_cache_t const *inst, request_t *request, rlm_
  *	- #RLM_MODULE_NOTFOUND on cache miss.
  */
 static unlang_action_t cache_find(unlang_result_t *p_result, rlm_cache_entry_t **out,
-				  rlm_cache_t const *inst, request_t *request,
+				  rlm_cache_t const *inst, rlm_cache_thread_t *t, request_t *request,
 				  rlm_cache_handle_t **handle, fr_value_box_t const *key)
 {
 	cache_status_t ret;
@@ -332,7 +521,8 @@ static unlang_action_t cache_find(unlang_result_t *p_result, rlm_cache_entry_t *
 			fr_box_time(request->packet->timestamp));
 
 	expired:
-		inst->driver->expire(&inst->config, inst->driver_submodule->data, request, handle, key);
+		inst->driver->expire(&inst->config, inst->driver_submodule->data, request, *handle, key);
+		cache_l1_remove(inst, t, key);
 		cache_free(inst, &c);
 		RETURN_UNLANG_NOTFOUND;	/* Couldn't find a non-expired entry */
 	}
@@ -358,10 +548,11 @@ static unlang_action_t cache_find(unlang_result_t *p_result, rlm_cache_entry_t *
  *	- #RLM_MODULE_FAIL on failure.
  */
 static unlang_action_t cache_expire(unlang_result_t *p_result,
-				    rlm_cache_t const *inst, request_t *request,
+				    rlm_cache_t const *inst, rlm_cache_thread_t *t, request_t *request,
 				    rlm_cache_handle_t **handle, fr_value_box_t const *key)
 {
 	RDEBUG2("Expiring cache entry");
+	cache_l1_remove(inst, t, key);
 	for (;;) switch (inst->driver->expire(&inst->config, inst->driver_submodule->data, request, *handle, key)) {
 	case CACHE_RECONNECT:
 		if (cache_reconnect(handle, inst, request) == 0) continue;
@@ -386,7 +577,8 @@ static unlang_action_t cache_expire(unlang_result_t *p_result,
  *	- #RLM_MODULE_FAIL on failure.
  */
 static unlang_action_t cache_insert(unlang_result_t *p_result,
-				    rlm_cache_t const *inst, request_t *request, rlm_cache_handle_t **handle,
+				    rlm_cache_t const *inst, rlm_cache_thread_t *t, request_t *request,
+				    rlm_cache_handle_t **handle,
 				    fr_value_box_t const *key, map_list_t const *maps, fr_time_delta_t ttl)
 {
 	map_t			const *map = NULL;
@@ -422,6 +614,7 @@ static unlang_action_t cache_insert(unlang_result_t *p_result,
 	c->expires = fr_unix_time_add(c->expires, ttl);
 
 	RDEBUG2("Creating new cache entry");
+	cache_l1_remove(inst, t, key);
 
 	/*
 	 *	We don't have any maps to apply to the cache entry
@@ -563,9 +756,11 @@ skip_maps:
  *	- #RLM_MODULE_FAIL on failure.
  */
 static unlang_action_t cache_set_ttl(unlang_result_t *p_result,
-				     rlm_cache_t const *inst, request_t *request,
+				     rlm_cache_t const *inst, rlm_cache_thread_t *t, request_t *request,
 				     rlm_cache_handle_t **handle, rlm_cache_entry_t *c)
 {
+	cache_l1_remove(inst, t, &c->key);
+
 	/*
 	 *	Call the driver's insert method to overwrite the old entry
 	 */
@@ -622,9 +817,10 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(unlang_result_t *p_result,
 {
 	rlm_cache_entry_t	*c = NULL;
 	rlm_cache_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_cache_t);
+	rlm_cache_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_cache_thread_t);
 	cache_call_env_t	*env = talloc_get_type_abort(mctx->env_data, cache_call_env_t);
 
-	rlm_cache_handle_t	*handle;
+	rlm_cache_handle_t	*handle = NULL;
 
 	fr_dcursor_t		cursor;
 	fr_pair_t		*vp;
@@ -651,13 +847,19 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(unlang_result_t *p_result,
 		RDEBUG3("status-only: yes");
 		REXDENT();
 
+		if (cache_l1_find(inst, t, request, env->key)) {
+			p_result->rcode = RLM_MODULE_OK;
+			goto finish;
+		}
+
 		if (cache_acquire(&handle, inst, request) < 0) {
 			RETURN_UNLANG_FAIL;
 		}
 
-		cache_find(p_result, &c, inst, request, &handle, env->key);
+		cache_find(p_result, &c, inst, t, request, &handle, env->key);
 		if (p_result->rcode == RLM_MODULE_FAIL) goto finish;
 		fr_assert(!inst->driver->acquire || handle);
+		cache_l1_fill(inst, t, request, c);
 
 		p_result->rcode = c ? RLM_MODULE_OK:
 				      RLM_MODULE_NOTFOUND;
@@ -693,6 +895,20 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(unlang_result_t *p_result,
 	RDEBUG3("expire : %s", expire ? "yes" : "no");
 	RDEBUG3("ttl    : %pV", fr_box_time_delta(ttl));
 	REXDENT();
+
+	/*
+	 *	A copy from the L1 tier can only satisfy a plain merge,
+	 *	anything which alters the entry needs the driver.
+	 */
+	if (merge && !expire && !set_ttl) {
+		rlm_cache_entry_t *l1 = cache_l1_find(inst, t, request, env->key);
+
+		if (l1) {
+			p_result->rcode = cache_merge(inst, request, l1);
+			goto finish;
+		}
+	}
+
 	if (cache_acquire(&handle, inst, request) < 0) {
 		RETURN_UNLANG_FAIL;
 	}
@@ -702,7 +918,7 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(unlang_result_t *p_result,
 	 *	recording whether the entry existed.
 	 */
 	if (merge) {
-		cache_find(p_result, &c, inst, request, &handle, env->key);
+		cache_find(p_result, &c, inst, t, request, &handle, env->key);
 		switch (p_result->rcode) {
 		case RLM_MODULE_FAIL:
 			goto finish;
@@ -721,6 +937,7 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(unlang_result_t *p_result,
 			fr_assert(0);
 		}
 		fr_assert(!inst->driver->acquire || handle);
+		cache_l1_fill(inst, t, request, c);
 	}
 
 	/*
@@ -735,7 +952,7 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(unlang_result_t *p_result,
 			unlang_result_t tmp;
 
 			fr_assert(!set_ttl);
-			cache_expire(&tmp, inst, request, &handle, env->key);
+			cache_expire(&tmp, inst, t, request, &handle, env->key);
 			switch (tmp.rcode) {
 			case RLM_MODULE_FAIL:
 				p_result->rcode = RLM_MODULE_FAIL;
@@ -767,7 +984,7 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(unlang_result_t *p_result,
 	if ((exists < 0) && (insert || set_ttl)) {
 		unlang_result_t tmp;
 
-		cache_find(&tmp, &c, inst, request, &handle, env->key);
+		cache_find(&tmp, &c, inst, t, request, &handle, env->key);
 		switch (tmp.rcode) {
 		case RLM_MODULE_FAIL:
 			p_result->rcode = RLM_MODULE_FAIL;
@@ -798,7 +1015,7 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(unlang_result_t *p_result,
 
 		c->expires = fr_unix_time_add(fr_time_to_unix_time(request->packet->timestamp), ttl);
 
-		cache_set_ttl(&tmp, inst, request, &handle, c);
+		cache_set_ttl(&tmp, inst, t, request, &handle, c);
 		switch (tmp.rcode) {
 		case RLM_MODULE_FAIL:
 			p_result->rcode = RLM_MODULE_FAIL;
@@ -823,7 +1040,7 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(unlang_result_t *p_result,
 	if (insert && (exists == 0)) {
 		unlang_result_t tmp;
 
-		cache_insert(&tmp, inst, request, &handle, env->key, env->maps, ttl);
+		cache_insert(&tmp, inst, t, request, &handle, env->key, env->maps, ttl);
 		switch (tmp.rcode) {
 		case RLM_MODULE_FAIL:
 			p_result->rcode = RLM_MODULE_FAIL;
@@ -890,8 +1107,9 @@ xlat_action_t cache_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 			 xlat_ctx_t const *xctx,
 			 request_t *request, fr_value_box_list_t *in)
 {
-	rlm_cache_entry_t 		*c = NULL;
+	rlm_cache_entry_t 		*c = NULL, *found;
 	rlm_cache_t			*inst = talloc_get_type_abort(xctx->mctx->mi->data, rlm_cache_t);
+	rlm_cache_thread_t		*t = talloc_get_type_abort(xctx->mctx->thread, rlm_cache_thread_t);
 	cache_call_env_t		*env = talloc_get_type_abort(xctx->env_data, cache_call_env_t);
 	rlm_cache_handle_t		*handle = NULL;
 
@@ -918,23 +1136,29 @@ xlat_action_t cache_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 		return XLAT_ACTION_FAIL;
 	}
 
-	if (cache_acquire(&handle, inst, request) < 0) {
-		talloc_free(target);
-		return XLAT_ACTION_FAIL;
-	}
+	found = cache_l1_find(inst, t, request, env->key);
+	if (!found) {
+		if (cache_acquire(&handle, inst, request) < 0) {
+			talloc_free(target);
+			return XLAT_ACTION_FAIL;
+		}
 
-	cache_find(&result, &c, inst, request, &handle, env->key);
-	switch (result.rcode) {
-	case RLM_MODULE_OK:		/* found */
-		break;
+		cache_find(&result, &c, inst, t, request, &handle, env->key);
+		switch (result.rcode) {
+		case RLM_MODULE_OK:		/* found */
+			break;
 
-	default:
-		talloc_free(target);
-		cache_release(inst, request, &handle);
-		return XLAT_ACTION_FAIL;
+		default:
+			if (result.rcode == RLM_MODULE_NOTFOUND) cache_l1_fill(inst, t, request, NULL);
+			talloc_free(target);
+			cache_release(inst, request, &handle);
+			return XLAT_ACTION_FAIL;
+		}
+		cache_l1_fill(inst, t, request, c);
+		found = c;
 	}
 
-	while ((map = map_list_next(&c->maps, map))) {
+	while ((map = map_list_next(&found->maps, map))) {
 		if ((tmpl_attr_tail_da(map->lhs) != tmpl_attr_tail_da(target)) ||
 		    (tmpl_list(map->lhs) != tmpl_list(target))) continue;
 
@@ -964,6 +1188,7 @@ static xlat_action_t cache_ttl_get_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 
 	rlm_cache_entry_t	*c = NULL;
 	rlm_cache_t		*inst = talloc_get_type_abort(xctx->mctx->mi->data, rlm_cache_t);
+	rlm_cache_thread_t	*t = talloc_get_type_abort(xctx->mctx->thread, rlm_cache_thread_t);
 	cache_call_env_t	*env = talloc_get_type_abort(xctx->env_data, cache_call_env_t);
 	rlm_cache_handle_t	*handle = NULL;
 
@@ -975,7 +1200,7 @@ static xlat_action_t cache_ttl_get_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 		return XLAT_ACTION_FAIL;
 	}
 
-	cache_find(&result, &c, inst, request, &handle, env->key);
+	cache_find(&result, &c, inst, t, request, &handle, env->key);
 	switch (result.rcode) {
 	case RLM_MODULE_OK:		/* found */
 		break;
@@ -1044,6 +1269,7 @@ static void cache_unref(request_t *request, rlm_cache_t const *inst, rlm_cache_e
 static unlang_action_t CC_HINT(nonnull) mod_method_status(unlang_result_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_cache_t const	*inst = talloc_get_type_abort(mctx->mi->data, rlm_cache_t);
+	rlm_cache_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_cache_thread_t);
 	cache_call_env_t	*env = talloc_get_type_abort(mctx->env_data, cache_call_env_t);
 	rlm_cache_entry_t 	*entry = NULL;
 	rlm_cache_handle_t 	*handle = NULL;
@@ -1055,6 +1281,11 @@ static unlang_action_t CC_HINT(nonnull) mod_method_status(unlang_result_t *p_res
 		RETURN_UNLANG_FAIL;
 	}
 
+	if (cache_l1_find(inst, t, request, env->key)) {
+		p_result->rcode = RLM_MODULE_OK;
+		goto finish;
+	}
+
 	/* Good to go? */
 	if (cache_acquire(&handle, inst, request) < 0) {
 		RETURN_UNLANG_FAIL;
@@ -1062,8 +1293,9 @@ static unlang_action_t CC_HINT(nonnull) mod_method_status(unlang_result_t *p_res
 
 	fr_assert(!inst->driver->acquire || handle);
 
-	cache_find(p_result, &entry, inst, request, &handle, env->key);
+	cache_find(p_result, &entry, inst, t, request, &handle, env->key);
 	if (p_result->rcode == RLM_MODULE_FAIL) goto finish;
+	cache_l1_fill(inst, t, request, entry);
 
 	p_result->rcode = (entry) ? RLM_MODULE_OK : RLM_MODULE_NOTFOUND;
 
@@ -1083,8 +1315,9 @@ finish:
 static unlang_action_t CC_HINT(nonnull) mod_method_load(unlang_result_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_cache_t const	*inst = talloc_get_type_abort(mctx->mi->data, rlm_cache_t);
+	rlm_cache_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_cache_thread_t);
 	cache_call_env_t	*env = talloc_get_type_abort(mctx->env_data, cache_call_env_t);
-	rlm_cache_entry_t 	*entry = NULL;
+	rlm_cache_entry_t 	*entry = NULL, *l1;
 	rlm_cache_handle_t 	*handle = NULL;
 
 	p_result->rcode = RLM_MODULE_NOOP;
@@ -1094,13 +1327,20 @@ static unlang_action_t CC_HINT(nonnull) mod_method_load(unlang_result_t *p_resul
 		RETURN_UNLANG_FAIL;
 	}
 
+	l1 = cache_l1_find(inst, t, request, env->key);
+	if (l1) {
+		p_result->rcode = cache_merge(inst, request, l1);
+		goto finish;
+	}
+
 	/* Good to go? */
 	if (cache_acquire(&handle, inst, request) < 0) {
 		RETURN_UNLANG_FAIL;
 	}
 
-	cache_find(p_result, &entry, inst, request, &handle, env->key);
+	cache_find(p_result, &entry, inst, t, request, &handle, env->key);
 	if (p_result->rcode == RLM_MODULE_FAIL) goto finish;
+	cache_l1_fill(inst, t, request, entry);
 
 	if (!entry) {
 		RDEBUG2("Entry not found to load");
@@ -1126,6 +1366,7 @@ finish:
 static unlang_action_t CC_HINT(nonnull) mod_method_update(unlang_result_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_cache_t const	*inst = talloc_get_type_abort(mctx->mi->data, rlm_cache_t);
+	rlm_cache_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_cache_thread_t);
 	cache_call_env_t	*env = talloc_get_type_abort(mctx->env_data, cache_call_env_t);
 	fr_time_delta_t		ttl;
 	bool 			expire = false;
@@ -1164,7 +1405,7 @@ static unlang_action_t CC_HINT(nonnull) mod_method_update(unlang_result_t *p_res
 	/*
 	 *	We can only alter the TTL on an entry if it exists.
 	 */
-	cache_find(p_result, &entry, inst, request, &handle, env->key);
+	cache_find(p_result, &entry, inst, t, request, &handle, env->key);
 	if (p_result->rcode == RLM_MODULE_FAIL) goto finish;
 
 	if (p_result->rcode == RLM_MODULE_OK) {
@@ -1174,7 +1415,7 @@ static unlang_action_t CC_HINT(nonnull) mod_method_update(unlang_result_t *p_res
 
 		entry->expires = fr_unix_time_add(fr_time_to_unix_time(request->packet->timestamp), ttl);
 
-		cache_set_ttl(p_result, inst, request, &handle, entry);
+		cache_set_ttl(p_result, inst, t, request, &handle, entry);
 		if (p_result->rcode == RLM_MODULE_FAIL) goto finish;
 	}
 
@@ -1188,7 +1429,7 @@ static unlang_action_t CC_HINT(nonnull) mod_method_update(unlang_result_t *p_res
 	if (expire) {
 		DEBUG3("Expiring cache entry");
 
-		cache_expire(p_result, inst, request, &handle, env->key);
+		cache_expire(p_result, inst, t, request, &handle, env->key);
 		if (p_result->rcode == RLM_MODULE_FAIL) goto finish;
 	}
 
@@ -1196,7 +1437,7 @@ static unlang_action_t CC_HINT(nonnull) mod_method_update(unlang_result_t *p_res
 	 *	Inserts are upserts, so we don't care about the
 	 *	entry state.
 	 */
-	cache_insert(p_result, inst, request, &handle, env->key, env->maps, ttl);
+	cache_insert(p_result, inst, t, request, &handle, env->key, env->maps, ttl);
 	if (p_result->rcode == RLM_MODULE_OK) p_result->rcode = RLM_MODULE_UPDATED;
 
 finish:
@@ -1215,6 +1456,7 @@ finish:
 static unlang_action_t CC_HINT(nonnull) mod_method_store(unlang_result_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_cache_t const	*inst = talloc_get_type_abort(mctx->mi->data, rlm_cache_t);
+	rlm_cache_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_cache_thread_t);
 	cache_call_env_t	*env = talloc_get_type_abort(mctx->env_data, cache_call_env_t);
 	fr_time_delta_t		ttl;
 	rlm_cache_entry_t 	*entry = NULL;
@@ -1244,7 +1486,7 @@ static unlang_action_t CC_HINT(nonnull) mod_method_store(unlang_result_t *p_resu
 	/*
 	 *	We can only alter the TTL on an entry if it exists.
 	 */
-	cache_find(p_result, &entry, inst, request, &handle, env->key);
+	cache_find(p_result, &entry, inst, t, request, &handle, env->key);
 	switch (p_result->rcode) {
 	default:
 	case RLM_MODULE_OK:
@@ -1264,7 +1506,7 @@ static unlang_action_t CC_HINT(nonnull) mod_method_store(unlang_result_t *p_resu
 	 *	setting the TTL, which precludes performing an
 	 *	insert.
 	 */
-	cache_insert(p_result, inst, request, &handle, env->key, env->maps, ttl);
+	cache_insert(p_result, inst, t, request, &handle, env->key, env->maps, ttl);
 
 finish:
 	cache_unref(request, inst, entry, handle);
@@ -1283,6 +1525,7 @@ finish:
 static unlang_action_t CC_HINT(nonnull) mod_method_clear(unlang_result_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_cache_t const	*inst = talloc_get_type_abort(mctx->mi->data, rlm_cache_t);
+	rlm_cache_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_cache_thread_t);
 	cache_call_env_t	*env = talloc_get_type_abort(mctx->env_data, cache_call_env_t);
 	rlm_cache_entry_t 	*entry = NULL;
 	rlm_cache_handle_t 	*handle = NULL;
@@ -1296,12 +1539,18 @@ static unlang_action_t CC_HINT(nonnull) mod_method_clear(unlang_result_t *p_resu
 		RETURN_UNLANG_FAIL;
 	}
 
+	/*
+	 *	Our L1 copy may outlive an entry another worker
+	 *	already removed from the driver.
+	 */
+	cache_l1_remove(inst, t, env->key);
+
 	/* Good to go? */
 	if (cache_acquire(&handle, inst, request) < 0) {
 		RETURN_UNLANG_FAIL;
 	}
 
-	cache_find(p_result, &entry, inst, request, &handle, env->key);
+	cache_find(p_result, &entry, inst, t, request, &handle, env->key);
 	if (p_result->rcode == RLM_MODULE_FAIL) goto finish;
 
 	if (!entry) {
@@ -1310,7 +1559,7 @@ static unlang_action_t CC_HINT(nonnull) mod_method_clear(unlang_result_t *p_resu
 		goto finish;
 	}
 
-	cache_expire(p_result, inst, request, &handle, env->key);
+	cache_expire(p_result, inst, t, request, &handle, env->key);
 
 finish:
 	cache_unref(request, inst, entry, handle);
@@ -1328,6 +1577,7 @@ finish:
 static unlang_action_t CC_HINT(nonnull) mod_method_ttl(unlang_result_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_cache_t const	*inst = talloc_get_type_abort(mctx->mi->data, rlm_cache_t);
+	rlm_cache_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_cache_thread_t);
 	cache_call_env_t	*env = talloc_get_type_abort(mctx->env_data, cache_call_env_t);
 	fr_time_delta_t		ttl;
 	rlm_cache_entry_t 	*entry = NULL;
@@ -1365,7 +1615,7 @@ static unlang_action_t CC_HINT(nonnull) mod_method_ttl(unlang_result_t *p_result
 	/*
 	 *	We can only alter the TTL on an entry if it exists.
 	 */
-	cache_find(p_result, &entry, inst, request, &handle, env->key);
+	cache_find(p_result, &entry, inst, t, request, &handle, env->key);
 	if (p_result->rcode == RLM_MODULE_FAIL) goto finish;
 
 	if (p_result->rcode == RLM_MODULE_OK) {
@@ -1375,7 +1625,7 @@ static unlang_action_t CC_HINT(nonnull) mod_method_ttl(unlang_result_t *p_result
 
 		entry->expires = fr_unix_time_add(fr_time_to_unix_time(request->packet->timestamp), ttl);
 
-		cache_set_ttl(p_result, inst, request, &handle, entry);
+		cache_set_ttl(p_result, inst, t, request, &handle, entry);
 		if (p_result->rcode == RLM_MODULE_FAIL) goto finish;
 
 		p_result->rcode = RLM_MODULE_UPDATED;
@@ -1387,6 +1637,95 @@ finish:
 	return UNLANG_ACTION_CALCULATE_RESULT;
 }
 
+static void cache_stats_add(rlm_cache_stats_t *out, rlm_cache_stats_t const *in)
+{
+	out->l1_hits += in->l1_hits;
+	out->l1_misses += in->l1_misses;
+	out->l2_hits += in->l2_hits;
+	out->l2_misses += in->l2_misses;
+}
+
+static int cmd_stats_cache(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	rlm_cache_t const	*inst = talloc_get_type_abort_const(ctx, rlm_cache_t);
+	rlm_cache_mutable_t	*mutable = inst->mutable;
+	rlm_cache_stats_t	stats;
+
+	/*
+	 *	The counters of running workers may be a little
+	 *	stale, the same as with "stats worker".
+	 */
+	pthread_mutex_lock(&mutable->mutex);
+	stats = mutable->stats;
+	fr_dlist_foreach(&mutable->threads, rlm_cache_thread_t, t) cache_stats_add(&stats, &t->stats);
+	pthread_mutex_unlock(&mutable->mutex);
+
+	fprintf(fp, "l1.hits\t\t\t%" PRIu64 "\n", stats.l1_hits);
+	fprintf(fp, "l1.misses\t\t%" PRIu64 "\n", stats.l1_misses);
+	fprintf(fp, "l2.hits\t\t\t%" PRIu64 "\n", stats.l2_hits);
+	fprintf(fp, "l2.misses\t\t%" PRIu64 "\n", stats.l2_misses);
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_cache_table[] = {
+	{
+		.parent = "stats",
+		.name = "cache",
+		.help = "Statistics for cache modules.",
+		.read_only = true
+	},
+
+	{
+		.parent = "stats cache",
+		.add_name = true,
+		.name = "tiers",
+		.func = cmd_stats_cache,
+		.help = "Show the lookups served by each tier of a specific module.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_cache_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_cache_t);
+	rlm_cache_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_cache_thread_t);
+
+	pthread_mutex_lock(&inst->mutable->mutex);
+	fr_dlist_insert_tail(&inst->mutable->threads, t);
+	pthread_mutex_unlock(&inst->mutable->mutex);
+
+	if (!inst->l1_max_entries) return 0;
+
+	MEM(t->l1 = fr_rb_inline_talloc_alloc(t, rlm_cache_l1_entry_t, node, cache_l1_cmp, NULL));
+	fr_dlist_talloc_init(&t->lru, rlm_cache_l1_entry_t, entry);
+
+	return 0;
+}
+
+static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_cache_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_cache_t);
+	rlm_cache_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_cache_thread_t);
+	rlm_cache_l1_entry_t	*l1;
+
+	DEBUG2("L1 hits %" PRIu64 ", misses %" PRIu64 ". L2 hits %" PRIu64 ", misses %" PRIu64,
+	       t->stats.l1_hits, t->stats.l1_misses, t->stats.l2_hits, t->stats.l2_misses);
+
+	pthread_mutex_lock(&inst->mutable->mutex);
+	cache_stats_add(&inst->mutable->stats, &t->stats);
+	fr_dlist_remove(&inst->mutable->threads, t);
+	pthread_mutex_unlock(&inst->mutable->mutex);
+
+	if (!inst->l1_max_entries) return 0;
+
+	while ((l1 = fr_dlist_head(&t->lru))) talloc_free(l1);
+
+	return 0;
+}
+
 /** Free any memory allocated under the instance
  *
  */
@@ -1394,6 +1733,8 @@ static int mod_detach(module_detach_ctx_t const *mctx)
 {
 	rlm_cache_t *inst = talloc_get_type_abort(mctx->mi->data, rlm_cache_t);
 
+	talloc_free(inst->mutable);
+
 	/*
 	 *	We need to explicitly free all children, so if the driver
 	 *	parented any memory off the instance, their destructors
@@ -1458,6 +1799,12 @@ static int cache_update_section_parse(TALLOC_CTX *ctx, call_env_parsed_head_t *o
 	return 0;
 }
 
+static int _cache_mutable_free(rlm_cache_mutable_t *mutable)
+{
+	pthread_mutex_destroy(&mutable->mutex);
+	return 0;
+}
+
 /** Create a new rlm_cache_instance
  *
  */
@@ -1484,6 +1831,25 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		return -1;
 	}
 
+	if (inst->l1_max_entries && !fr_time_delta_ispos(inst->l1_ttl)) {
+		cf_log_err(conf, "Must set 'l1.ttl' to non-zero");
+		return -1;
+	}
+
+	/*
+	 *	Not parented by the instance, as instance data is
+	 *	read-only once the server is running.
+	 */
+	MEM(inst->mutable = talloc_zero(NULL, rlm_cache_mutable_t));
+	pthread_mutex_init(&inst->mutable->mutex, NULL);
+	fr_dlist_talloc_init(&inst->mutable->threads, rlm_cache_thread_t, entry);
+	talloc_set_destructor(inst->mutable, _cache_mutable_free);
+
+	if (fr_command_register_hook(NULL, mctx->mi->name, inst, cmd_cache_table) < 0) {
+		cf_log_perr(conf, "Failed registering radmin commands");
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -1524,7 +1890,11 @@ module_rlm_t rlm_cache = {
 		.config		= module_config,
 		.bootstrap	= mod_bootstrap,
 		.instantiate	= mod_instantiate,
-		.detach		= mod_detach
+		.detach		= mod_detach,
+
+		.thread_inst_size	= sizeof(rlm_cache_thread_t),
+		.thread_instantiate	= mod_thread_instantiate,
+		.thread_detach		= mod_thread_detach
 	},
 	.method_group = {
 		.bindings = (module_method_binding_t[]){
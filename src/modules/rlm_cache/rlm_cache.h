@@ -34,6 +34,8 @@ typedef struct rlm_cache_driver_s rlm_cache_driver_t;
 
 typedef void rlm_cache_handle_t;
 
+typedef struct rlm_cache_mutable_s rlm_cache_mutable_t;
+
 #define MAX_ATTRMAP	128
 
 typedef enum {
@@ -67,6 +69,12 @@ typedef struct {
 
 	module_instance_t	*driver_submodule;	//!< Driver's instance data.
 	rlm_cache_driver_t const *driver;		//!< Driver's exported interface.
+
+	uint32_t		l1_max_entries;		//!< Maximum entries in each worker's L1 tier.
+							///< 0 disables the L1 tier.
+	fr_time_delta_t		l1_ttl;			//!< Maximum time an entry is served from the L1 tier.
+
+	rlm_cache_mutable_t	*mutable;		//!< Statistics shared with radmin.
 } rlm_cache_t;
 
 typedef struct {
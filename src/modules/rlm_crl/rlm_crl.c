@@ -25,8 +25,17 @@
 RCSID("$Id$")
 
 #include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/command.h>
 #include <freeradius-devel/server/module_rlm.h>
 #include <freeradius-devel/unlang/call_env.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/math.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
 
 #include <freeradius-devel/tls/strerror.h>
 #include <freeradius-devel/tls/utils.h>
@@ -37,15 +46,79 @@ RCSID("$Id$")
 #include <openssl/asn1.h>
 #include <openssl/bn.h>
 
-/** Global tree of CRLs
+typedef enum {
+	CRL_ERROR = -1,							//!< Unspecified error ocurred.
+	CRL_ENTRY_NOT_FOUND = 0,					//!< Serial not found in this CRL.
+	CRL_ENTRY_FOUND = 1,						//!< Serial was found in this CRL.
+	CRL_ENTRY_REMOVED = 2,						//!< Serial was "un-revoked" in this delta CRL.
+	CRL_NOT_FOUND = 3,						//!< No CRL found, need to load it from the CDP URL
+	CRL_MISSING_DELTA = 4,						//!< Need to load a delta CRL to supplement this CRL.
+} crl_ret_t;
+
+/** A certificate serial number, in the form used for index lookups
+ *
+ */
+typedef struct {
+	uint8_t const			*serial;			//!< Big endian magnitude, without leading zeros.
+	uint32_t			len;				//!< Length of the serial.
+	bool				negative;			//!< Serial is negative (not valid, but possible).
+	uint32_t			hash;				//!< Of the above.
+} crl_serial_t;
+
+/** A slot in the open addressed serial number index
+ *
+ */
+typedef struct {
+	crl_serial_t			key;				//!< Revoked serial.  key.serial is NULL if the slot is empty.
+	crl_ret_t			status;				//!< CRL_ENTRY_FOUND or CRL_ENTRY_REMOVED.
+} crl_slot_t;
+
+/** A single CRL, compiled into an index of revoked serials
+ *
+ * Once published, only the reference count and the refreshing flag change.
+ */
+typedef struct {
+	char const 			*cdp_url;			//!< The URL of the CRL.
+	ASN1_INTEGER			*crl_num;			//!< The CRL number.
+	char const			**delta_urls;			//!< URLs from which a delta CRL can be retrieved.
+	bool				delta;				//!< This is a delta CRL.
+
+	crl_slot_t			*slots;				//!< Hashed serial number index.
+	uint32_t			mask;				//!< Number of slots - 1.
+	uint32_t			num_serials;			//!< Number of serials in the index.
+
+	fr_time_t			loaded;				//!< When this CRL was loaded.
+	fr_time_t			refresh;			//!< When a request should refresh this CRL.
+	fr_time_t			expires;			//!< nextUpdate, after which the CRL must not be used.
+	fr_time_delta_t			load_time;			//!< How long fetching and compiling took.
+
+	atomic_uint_fast32_t		refs;				//!< Snapshots and requests using this CRL.
+	atomic_bool			refreshing;			//!< A request is refreshing this CRL.
+} crl_entry_t;
+
+/** An immutable set of CRLs
+ *
+ * Readers use whichever snapshot was current when they started.  Loading
+ * a CRL creates a new snapshot which replaces the current one.
+ */
+typedef struct {
+	crl_entry_t			**crls;				//!< CRLs sorted by CDP URL.
+	atomic_uint_fast32_t		refs;				//!< Threads using this snapshot.
+} crl_snapshot_t;
+
+/** Global set of CRLs
  *
  * Separate from the instance data because that's protected.
  */
 typedef struct {
-	fr_rb_tree_t			*crls;				//!< A tree of CRLs organised by CDP URL.
-	fr_timer_list_t			*timer_list;			//!< The timer list to use for CRL expiry.
-									///< This gets serviced by the main loop.
-	pthread_mutex_t			mutex;
+	atomic_uintptr_t		current;			//!< The current #crl_snapshot_t.
+	pthread_mutex_t			mutex;				//!< Serialises publishing, and taking
+									///< references to the current snapshot.
+
+	atomic_uint_fast64_t		loads;				//!< CRLs loaded.
+	atomic_uint_fast64_t		load_failures;			//!< CRLs which could not be loaded.
+	atomic_uint_fast64_t		load_time_ns;			//!< Total time spent fetching and compiling CRLs.
+	atomic_uint_fast64_t		load_time_max_ns;		//!< Longest time spent on a single CRL.
 } rlm_crl_mutable_t;
 
 typedef struct {
@@ -61,16 +134,10 @@ typedef struct {
 	rlm_crl_mutable_t		*mutable;			//!< Mutable data that's shared between all threads.
 } rlm_crl_t;
 
-/** A single CRL in the global list of CRLs */
 typedef struct {
-	X509_CRL			*crl;				//!< The CRL.
-	char const 			*cdp_url;			//!< The URL of the CRL.
-	ASN1_INTEGER			*crl_num;			//!< The CRL number.
-	fr_timer_t 			*ev;				//!< When to expire the CRL
-	fr_rb_node_t			node;				//!< The node in the tree
-	fr_value_box_list_t		delta_urls;			//!< URLs from which a delta CRL can be retrieved.
-	rlm_crl_t const			*inst;				//!< The instance of the CRL module.
-} crl_entry_t;
+	rlm_crl_t const			*inst;				//!< Instance of the CRL module.
+	crl_snapshot_t			*snapshot;			//!< The snapshot this thread is using.
+} rlm_crl_thread_t;
 
 /** A status used to track which CRL is being checked */
 typedef enum {
@@ -82,6 +149,10 @@ typedef enum {
 typedef struct {
 	fr_value_box_t			*cdp_url;			//!< The URL we're currently attempting to load.
 	crl_entry_t			*base_crl;			//!< The base CRL relating to the delta currently being fetched.
+	crl_entry_t			*loaded;			//!< The CRL we loaded most recently.
+	crl_entry_t			*refreshing;			//!< The CRL this request is refreshing.
+	crl_serial_t			serial;				//!< The serial being checked.
+	fr_time_t			fetch_start;			//!< When we started fetching the current CRL.
 	fr_value_box_list_t		crl_data;			//!< Data from CRL expansion.
 	fr_value_box_list_t		missing_crls;			//!< CRLs missing from the tree
 	crl_check_status_t		status;				//!< Status of the current CRL check.
@@ -122,15 +193,6 @@ typedef struct {
 	fr_value_box_list_head_t	*cdp; 				//!< The CRL distribution points
 } rlm_crl_env_t;
 
-typedef enum {
-	CRL_ERROR = -1,							//!< Unspecified error ocurred.
-	CRL_ENTRY_NOT_FOUND = 0,					//!< Serial not found in this CRL.
-	CRL_ENTRY_FOUND = 1,						//!< Serial was found in this CRL.
-	CRL_ENTRY_REMOVED = 2,						//!< Serial was "un-revoked" in this delta CRL.
-	CRL_NOT_FOUND = 3,						//!< No CRL found, need to load it from the CDP URL
-	CRL_MISSING_DELTA = 4,						//!< Need to load a delta CRL to supplement this CRL.
-} crl_ret_t;
-
 #ifdef WITH_TLS
 static const call_env_method_t crl_env = {
 	FR_CALL_ENV_METHOD_OUT(rlm_crl_env_t),
@@ -154,93 +216,311 @@ static const call_env_method_t crl_env = {
 	},
 };
 
-static int8_t crl_cmp(void const *a, void const *b)
+/** Take a reference to a CRL
+ *
+ */
+static inline crl_entry_t *crl_entry_ref(crl_entry_t *crl)
+{
+	atomic_fetch_add_explicit(&crl->refs, 1, memory_order_relaxed);
+	return crl;
+}
+
+/** Release a reference to a CRL, freeing it if this was the last one
+ *
+ */
+static inline void crl_entry_release(crl_entry_t *crl)
 {
-	crl_entry_t	const	*crl_a = (crl_entry_t const *)a;
-	crl_entry_t	const	*crl_b = (crl_entry_t const *)b;
+	if (!crl) return;
 
-	return CMP(strcmp(crl_a->cdp_url,  crl_b->cdp_url), 0);
+	if (atomic_fetch_sub_explicit(&crl->refs, 1, memory_order_acq_rel) == 1) talloc_free(crl);
 }
 
-static void crl_free(void *data)
+/** Release a reference to a snapshot, freeing it if this was the last one
+ *
+ */
+static void crl_snapshot_release(crl_snapshot_t *snapshot)
 {
-	talloc_free(data);
+	size_t i;
+
+	if (!snapshot) return;
+
+	if (atomic_fetch_sub_explicit(&snapshot->refs, 1, memory_order_acq_rel) != 1) return;
+
+	for (i = 0; i < talloc_array_length(snapshot->crls); i++) crl_entry_release(snapshot->crls[i]);
+	talloc_free(snapshot);
 }
 
-static void crl_expire(UNUSED fr_timer_list_t *tl, UNUSED fr_time_t now, UNUSED void *uctx)
+/** Take a reference to the current snapshot
+ *
+ * This is only needed when the snapshot has changed, or for callers
+ * which aren't worker threads.
+ */
+static crl_snapshot_t *crl_snapshot_acquire(rlm_crl_mutable_t *mutable)
 {
-	crl_entry_t	*crl = talloc_get_type_abort(uctx, crl_entry_t);
+	crl_snapshot_t *snapshot;
+
+	pthread_mutex_lock(&mutable->mutex);
+	snapshot = (crl_snapshot_t *)atomic_load_explicit(&mutable->current, memory_order_relaxed);
+	atomic_fetch_add_explicit(&snapshot->refs, 1, memory_order_relaxed);
+	pthread_mutex_unlock(&mutable->mutex);
 
-	DEBUG2("CRL associated with CDP %s expired", crl->cdp_url);
-	pthread_mutex_lock(&crl->inst->mutable->mutex);
-	fr_rb_remove(crl->inst->mutable->crls, crl);
-	pthread_mutex_unlock(&crl->inst->mutable->mutex);
-	talloc_free(crl);
+	return snapshot;
 }
 
-/** Make sure we don't lock up the server if a request is cancelled
+/** Return the current snapshot for this thread
+ *
+ * Unless a CRL has been loaded since this thread last looked, this
+ * is a single atomic load, and no locks are taken.
  */
-static void crl_signal(module_ctx_t const *mctx, UNUSED request_t *request, fr_signal_t action)
+static crl_snapshot_t *crl_snapshot_get(rlm_crl_thread_t *t)
 {
-	rlm_crl_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_crl_t);
+	rlm_crl_mutable_t	*mutable = t->inst->mutable;
+	crl_snapshot_t		*old = t->snapshot;
 
-	if (action == FR_SIGNAL_CANCEL) {
-		pthread_mutex_unlock(&inst->mutable->mutex);
-		pair_delete_request(attr_crl_cdp_url);
+	if ((crl_snapshot_t *)atomic_load_explicit(&mutable->current, memory_order_acquire) == old) return old;
+
+	t->snapshot = crl_snapshot_acquire(mutable);
+	crl_snapshot_release(old);
+
+	return t->snapshot;
+}
+
+/** Find the CRL for a CDP URL in a snapshot
+ *
+ */
+static crl_entry_t *crl_snapshot_find(crl_snapshot_t const *snapshot, char const *cdp_url)
+{
+	size_t	low = 0, high = talloc_array_length(snapshot->crls);
+
+	while (low < high) {
+		size_t	mid = low + ((high - low) / 2);
+		int	cmp = strcmp(cdp_url, snapshot->crls[mid]->cdp_url);
+
+		if (cmp == 0) return snapshot->crls[mid];
+		if (cmp < 0) {
+			high = mid;
+		} else {
+			low = mid + 1;
+		}
+	}
+
+	return NULL;
+}
+
+/** Make a CRL visible to all threads
+ *
+ * Builds a new snapshot containing the CRL, replacing any previous
+ * version, and swaps it in as the current snapshot.  Threads pick up
+ * the new snapshot the next time they check a serial.
+ *
+ * @param[in] mutable	Shared CRL state.
+ * @param[in] crl	to publish.  A new reference is taken for the snapshot.
+ */
+static void crl_publish(rlm_crl_mutable_t *mutable, crl_entry_t *crl)
+{
+	crl_snapshot_t	*old, *new;
+	crl_entry_t	*existing;
+	size_t		i, j = 0, num;
+	bool		inserted = false;
+
+	pthread_mutex_lock(&mutable->mutex);
+	old = (crl_snapshot_t *)atomic_load_explicit(&mutable->current, memory_order_relaxed);
+
+	/*
+	 *	Another request may have loaded a newer version of
+	 *	this CRL whilst we were fetching ours.
+	 */
+	existing = crl_snapshot_find(old, crl->cdp_url);
+	if (existing && existing->crl_num && crl->crl_num &&
+	    (ASN1_INTEGER_cmp(existing->crl_num, crl->crl_num) > 0)) {
+		pthread_mutex_unlock(&mutable->mutex);
+		return;
+	}
+
+	num = talloc_array_length(old->crls);
+	MEM(new = talloc_zero(NULL, crl_snapshot_t));
+	MEM(new->crls = talloc_array(new, crl_entry_t *, existing ? num : num + 1));
+	atomic_init(&new->refs, 1);
+
+	for (i = 0; i < num; i++) {
+		if (!inserted && (strcmp(crl->cdp_url, old->crls[i]->cdp_url) <= 0)) {
+			new->crls[j++] = crl_entry_ref(crl);
+			inserted = true;
+			if (old->crls[i] == existing) continue;
+		}
+		new->crls[j++] = crl_entry_ref(old->crls[i]);
 	}
+	if (!inserted) new->crls[j++] = crl_entry_ref(crl);
+	fr_assert(j == talloc_array_length(new->crls));
+
+	atomic_store_explicit(&mutable->current, (uintptr_t)new, memory_order_release);
+	pthread_mutex_unlock(&mutable->mutex);
+
+	crl_snapshot_release(old);
 }
 
-/** See if a particular serial is present in a CRL list
+/** Convert a DER encoded serial number to a lookup key
  *
  */
-static crl_ret_t crl_check_entry(crl_entry_t *crl_entry, request_t *request, uint8_t const *serial)
+static int crl_serial_init(TALLOC_CTX *ctx, crl_serial_t *out, uint8_t const *der, size_t der_len)
 {
-	X509_REVOKED	*revoked;
-	ASN1_INTEGER	*asn1_serial = NULL;
-	int ret;
+	ASN1_INTEGER	*asn1_serial;
+	uint8_t const	*p = der;
+	uint8_t		*serial;
 
-	asn1_serial = d2i_ASN1_INTEGER(NULL, (unsigned char const **)&serial, talloc_array_length(serial));
-	ret = X509_CRL_get0_by_serial(crl_entry->crl, &revoked, asn1_serial);
+	asn1_serial = d2i_ASN1_INTEGER(NULL, &p, der_len);
+	if (!asn1_serial) {
+		fr_tls_strerror_printf("Failed parsing certificate serial");
+		return -1;
+	}
+
+	out->len = ASN1_STRING_length(asn1_serial);
+	out->negative = (ASN1_STRING_type(asn1_serial) == V_ASN1_NEG_INTEGER);
+	MEM(serial = talloc_zero_array(ctx, uint8_t, out->len + 1));
+	memcpy(serial, ASN1_STRING_get0_data(asn1_serial), out->len);
+	out->serial = serial;
+	out->hash = fr_hash(out->serial, out->len) ^ out->negative;
 	ASN1_INTEGER_free(asn1_serial);
-	switch (ret) {
-	/* The docs describe 0 as "failure" - but that means "failed to find"*/
-	case 0:
-		RDEBUG3("Certificate not in CRL");
-		return CRL_ENTRY_NOT_FOUND;
 
-	case 1:
+	return 0;
+}
+
+static inline bool crl_serial_cmp(crl_serial_t const *a, crl_serial_t const *b)
+{
+	return (a->hash == b->hash) && (a->len == b->len) && (a->negative == b->negative) &&
+	       (memcmp(a->serial, b->serial, a->len) == 0);
+}
+
+/** Compile the revoked serials in a CRL into an open addressed hash table
+ *
+ * The table is at most half full, so lookups rarely probe more than
+ * a couple of slots.
+ */
+static void crl_entry_compile(crl_entry_t *crl, X509_CRL *x509_crl)
+{
+	STACK_OF(X509_REVOKED)	*revoked = X509_CRL_get_REVOKED(x509_crl);
+	int			i, num = revoked ? sk_X509_REVOKED_num(revoked) : 0;
+	size_t			total = 0;
+	uint8_t			*serials, *p;
+
+	for (i = 0; i < num; i++) total += ASN1_STRING_length(X509_REVOKED_get0_serialNumber(sk_X509_REVOKED_value(revoked, i)));
+
+	crl->mask = (UINT32_C(1) << fr_high_bit_pos(((uint64_t) num * 2) | 0x0f)) - 1;
+	MEM(crl->slots = talloc_zero_array(crl, crl_slot_t, crl->mask + 1));
+	MEM(p = serials = talloc_array(crl, uint8_t, total + 1));
+
+	for (i = 0; i < num; i++) {
+		X509_REVOKED		*rev = sk_X509_REVOKED_value(revoked, i);
+		ASN1_INTEGER const	*sn = X509_REVOKED_get0_serialNumber(rev);
+		ASN1_ENUMERATED		*reason;
+		crl_serial_t		key;
+		crl_slot_t		*slot;
+		uint32_t		j;
+
+		key.len = ASN1_STRING_length(sn);
+		key.negative = (ASN1_STRING_type(sn) == V_ASN1_NEG_INTEGER);
+		memcpy(p, ASN1_STRING_get0_data(sn), key.len);
+		key.serial = p;
+		key.hash = fr_hash(key.serial, key.len) ^ key.negative;
+
+		for (j = key.hash & crl->mask; crl->slots[j].key.serial; j = (j + 1) & crl->mask) {
+			if (crl_serial_cmp(&crl->slots[j].key, &key)) break;
+		}
+		slot = &crl->slots[j];
+		if (slot->key.serial) continue;	/* Duplicate, first one wins */
+
+		slot->key = key;
+		slot->status = CRL_ENTRY_FOUND;
+		p += key.len;
+		crl->num_serials++;
+
+		/*
+		 *	Delta CRLs use removeFromCRL to "un-revoke" serials
+		 *	listed in the base CRL.
+		 */
+		reason = X509_REVOKED_get_ext_d2i(rev, NID_crl_reason, NULL, NULL);
+		if (reason) {
+			if (ASN1_ENUMERATED_get(reason) == CRL_REASON_REMOVE_FROM_CRL) slot->status = CRL_ENTRY_REMOVED;
+			ASN1_ENUMERATED_free(reason);
+		}
+	}
+}
+
+static void crl_signal(UNUSED module_ctx_t const *mctx, request_t *request, fr_signal_t action)
+{
+	if (action == FR_SIGNAL_CANCEL) pair_delete_request(attr_crl_cdp_url);
+}
+
+/** See if a particular serial is present in a CRL
+ *
+ */
+static crl_ret_t crl_check_entry(crl_entry_t const *crl_entry, request_t *request, crl_serial_t const *serial)
+{
+	uint32_t i;
+
+	for (i = serial->hash & crl_entry->mask; crl_entry->slots[i].key.serial; i = (i + 1) & crl_entry->mask) {
+		if (!crl_serial_cmp(&crl_entry->slots[i].key, serial)) continue;
+
+		if (crl_entry->slots[i].status == CRL_ENTRY_REMOVED) {
+			RDEBUG3("Certificate un-revoked by %s", crl_entry->cdp_url);
+			return CRL_ENTRY_REMOVED;
+		}
+
 		REDEBUG2("Certificate revoked by %s", crl_entry->cdp_url);
 		return CRL_ENTRY_FOUND;
+	}
+
+	RDEBUG3("Certificate not in CRL");
+	return CRL_ENTRY_NOT_FOUND;
+}
+
+/** Check whether a CRL needs to be (re)loaded before it's used
+ *
+ * Once a CRL is due for refresh, the first request to see it fetches
+ * a new copy.  All other requests carry on using the current copy
+ * until the new one is published, or until nextUpdate has passed.
+ */
+static bool crl_entry_stale(crl_entry_t *crl, request_t *request, rlm_crl_rctx_t *rctx, fr_time_t now)
+{
+	bool	expected = false;
 
-	case 2:
-		RDEBUG3("Certificate un-revoked by %s", crl_entry->cdp_url);
-		return CRL_ENTRY_REMOVED;
+	if (fr_time_gteq(now, crl->expires)) {
+		RDEBUG2("CRL from %s has expired", crl->cdp_url);
+		return true;
 	}
 
-	return CRL_ERROR;
+	if (fr_time_lt(now, crl->refresh) || rctx->refreshing) return false;
+
+	if (!atomic_compare_exchange_strong_explicit(&crl->refreshing, &expected, true,
+						     memory_order_acq_rel, memory_order_relaxed)) return false;
+
+	RDEBUG2("Refreshing CRL from %s", crl->cdp_url);
+	rctx->refreshing = crl_entry_ref(crl);
+
+	return true;
 }
 
 /** Resolve a cdp_url to a CRL entry, and check serial against it, if it exists
  *
  */
-static crl_ret_t crl_check_serial(fr_rb_tree_t *crls, request_t *request, char const *cdp_url, uint8_t const *serial,
-				  crl_entry_t **found)
+static crl_ret_t crl_check_serial(crl_snapshot_t const *snapshot, request_t *request, rlm_crl_rctx_t *rctx,
+				  char const *cdp_url, crl_entry_t **found)
 {
-	crl_entry_t	*delta, find = { .cdp_url = cdp_url};
-	fr_value_box_t	*vb = NULL;
+	crl_entry_t	*delta;
 	crl_ret_t	ret = CRL_NOT_FOUND;
+	fr_time_t	now = fr_event_list_time(unlang_interpret_event_list(request));
+	size_t		i;
 
-	*found = fr_rb_find(crls, &find);
-	if (*found == NULL) return CRL_NOT_FOUND;
+	*found = crl_snapshot_find(snapshot, cdp_url);
+	if (!*found || crl_entry_stale(*found, request, rctx, now)) return CRL_NOT_FOUND;
 
 	/*
 	 *	First check the delta if it should exist
 	 */
-	while ((vb = fr_value_box_list_next(&(*found)->delta_urls, vb))) {
-		find.cdp_url = vb->vb_strvalue;
-		delta = fr_rb_find(crls, &find);
-		if (delta) {
-			ret = crl_check_entry(delta, request, serial);
+	for (i = 0; i < talloc_array_length((*found)->delta_urls); i++) {
+		delta = crl_snapshot_find(snapshot, (*found)->delta_urls[i]);
+		if (delta && !crl_entry_stale(delta, request, rctx, now)) {
+			ret = crl_check_entry(delta, request, &rctx->serial);
 
 			/*
 			 *	An entry found in a delta overrides the base CRL
@@ -254,27 +534,27 @@ static crl_ret_t crl_check_serial(fr_rb_tree_t *crls, request_t *request, char c
 
 	if (ret == CRL_MISSING_DELTA) return ret;
 
-	return crl_check_entry(*found, request, serial);
+	return crl_check_entry(*found, request, &rctx->serial);
 }
 
 static int _crl_entry_free(crl_entry_t *crl_entry)
 {
-	X509_CRL_free(crl_entry->crl);
 	if (crl_entry->crl_num) ASN1_INTEGER_free(crl_entry->crl_num);
 	return 0;
 }
 
-/** Add an entry to the cdp_url -> crl tree
+/** Parse, verify and compile a CRL
  *
- * @note Must be called with the mutex held.
+ * This is done without holding any locks.  The result is not visible
+ * to other requests until it's passed to #crl_publish.
  */
-static crl_entry_t *crl_entry_create(rlm_crl_t const *inst, fr_timer_list_t *tl, char const *url, uint8_t const *data,
-				     crl_entry_t *base_crl)
+static crl_entry_t *crl_entry_create(rlm_crl_t const *inst, char const *url, uint8_t const *data, size_t data_len,
+				     crl_entry_t *base_crl, fr_time_t now, fr_time_t fetch_start)
 {
 	uint8_t const	*our_data = data;
 	crl_entry_t	*crl;
+	X509_CRL	*x509_crl;
 	time_t		next_update;
-	fr_time_t	now = fr_time();
 	fr_time_delta_t	expiry_time;
 	int		i;
 	STACK_OF(DIST_POINT)	*dps;
@@ -282,13 +562,16 @@ static crl_entry_t *crl_entry_create(rlm_crl_t const *inst, fr_timer_list_t *tl,
 	X509_OBJECT	*xobj;
 	EVP_PKEY	*pkey;
 
-	MEM(crl = talloc_zero(inst->mutable->crls, crl_entry_t));
+	MEM(crl = talloc_zero(NULL, crl_entry_t));
+	atomic_init(&crl->refs, 1);
+	atomic_init(&crl->refreshing, false);
 	crl->cdp_url = talloc_bstrdup(crl, url);
-	crl->crl = d2i_X509_CRL(NULL, (const unsigned char **)&our_data, talloc_array_length(our_data));
-	if (crl->crl == NULL) {
+	x509_crl = d2i_X509_CRL(NULL, (const unsigned char **)&our_data, data_len);
+	if (x509_crl == NULL) {
 		fr_tls_strerror_printf("Failed to parse CRL from %s", url);
 	error:
 		talloc_free(crl);
+		if (x509_crl) X509_CRL_free(x509_crl);
 		if (verify_ctx) X509_STORE_CTX_free(verify_ctx);
 		return NULL;
 	}
@@ -301,7 +584,7 @@ static crl_entry_t *crl_entry_create(rlm_crl_t const *inst, fr_timer_list_t *tl,
         }
 
         xobj = X509_STORE_CTX_get_obj_by_subject(verify_ctx, X509_LU_X509,
-                                                 X509_CRL_get_issuer(crl->crl));
+                                                 X509_CRL_get_issuer(x509_crl));
         if (!xobj) {
 		fr_tls_strerror_printf("CRL issuer certificate not in trusted store");
 		goto error;
@@ -312,7 +595,7 @@ static crl_entry_t *crl_entry_create(rlm_crl_t const *inst, fr_timer_list_t *tl,
 		fr_tls_strerror_printf("Error getting CRL issuer public key");
 		goto error;
         }
-        i = X509_CRL_verify(crl->crl, pkey);
+        i = X509_CRL_verify(x509_crl, pkey);
         EVP_PKEY_free(pkey);
 
 	if (i < 0) {
@@ -324,14 +607,14 @@ static crl_entry_t *crl_entry_create(rlm_crl_t const *inst, fr_timer_list_t *tl,
 		goto error;
 	}
 
-	crl->crl_num = X509_CRL_get_ext_d2i(crl->crl, NID_crl_number, &i, NULL);
+	crl->crl_num = X509_CRL_get_ext_d2i(x509_crl, NID_crl_number, &i, NULL);
 
 	/*
 	 *	If we're passed a base_crl, then this is a delta - check the delta
 	 *	relates to the correct base.
 	 */
 	if (base_crl) {
-		ASN1_INTEGER *base_num = X509_CRL_get_ext_d2i(crl->crl, NID_delta_crl, &i, NULL);
+		ASN1_INTEGER *base_num = X509_CRL_get_ext_d2i(x509_crl, NID_delta_crl, &i, NULL);
 		if (!base_num) {
 			fr_tls_strerror_printf("Delta CRL missing Delta CRL Indicator extension");
 			goto error;
@@ -354,29 +637,24 @@ static crl_entry_t *crl_entry_create(rlm_crl_t const *inst, fr_timer_list_t *tl,
 						delta_num, crl_num);
 			goto error;
 		}
+		crl->delta = true;
 	}
 
-	if (fr_tls_utils_asn1time_to_epoch(&next_update, X509_CRL_get0_nextUpdate(crl->crl)) < 0) {
+	if (fr_tls_utils_asn1time_to_epoch(&next_update, X509_CRL_get0_nextUpdate(x509_crl)) < 0) {
 		fr_tls_strerror_printf("Failed to parse nextUpdate from CRL");
 		goto error;
 	}
 
-	if (!fr_rb_insert(inst->mutable->crls, crl)) {
-		ERROR("Failed to insert CRL into tree of CRLs");
-		goto error;
-	}
-	crl->inst = inst;
-
 	/*
 	 *	Check if this CRL has a Freshest CRL extension - the list of URIs to get deltas from
 	 */
-	fr_value_box_list_init(&crl->delta_urls);
-	if (!base_crl && (dps = X509_CRL_get_ext_d2i(crl->crl, NID_freshest_crl, NULL, NULL))) {
+	MEM(crl->delta_urls = talloc_array(crl, char const *, 0));
+	if (!base_crl && (dps = X509_CRL_get_ext_d2i(x509_crl, NID_freshest_crl, NULL, NULL))) {
 		DIST_POINT		*dp;
 		STACK_OF(GENERAL_NAME)	*names;
 		GENERAL_NAME		*name;
 		int			j;
-		fr_value_box_t		*vb;
+		size_t			num;
 
 		for (i = 0; i < sk_DIST_POINT_num(dps); i++) {
 			dp = sk_DIST_POINT_value(dps, i);
@@ -384,34 +662,72 @@ static crl_entry_t *crl_entry_create(rlm_crl_t const *inst, fr_timer_list_t *tl,
 			for (j = 0; j < sk_GENERAL_NAME_num(names); j++) {
 				name = sk_GENERAL_NAME_value(names, j);
 				if (name->type != GEN_URI) continue;
-				MEM(vb = fr_value_box_alloc_null(crl));
-				fr_value_box_bstrndup(vb, vb, NULL,
-						      (char const *)ASN1_STRING_get0_data(name->d.uniformResourceIdentifier),
-						      ASN1_STRING_length(name->d.uniformResourceIdentifier), true);
-				DEBUG3("CRL references delta URI %pV", vb);
-				fr_value_box_list_insert_tail(&crl->delta_urls, vb);
+
+				num = talloc_array_length(crl->delta_urls);
+				MEM(crl->delta_urls = talloc_realloc(crl, crl->delta_urls, char const *, num + 1));
+				MEM(crl->delta_urls[num] = talloc_bstrndup(crl->delta_urls,
+						(char const *)ASN1_STRING_get0_data(name->d.uniformResourceIdentifier),
+						ASN1_STRING_length(name->d.uniformResourceIdentifier)));
+				DEBUG3("CRL references delta URI %s", crl->delta_urls[num]);
 			}
 		}
 		CRL_DIST_POINTS_free(dps);
 	}
 
-	expiry_time = fr_time_delta_sub(fr_time_sub(fr_time_from_sec(next_update), now), inst->early_refresh);
+	crl_entry_compile(crl, x509_crl);
+	X509_CRL_free(x509_crl);
+	X509_STORE_CTX_free(verify_ctx);
+
+	crl->expires = fr_time_from_sec(next_update);
+	expiry_time = fr_time_delta_sub(fr_time_sub(crl->expires, now), inst->early_refresh);
 	if (base_crl && inst->force_delta_expiry_is_set) {
 		if (fr_time_delta_cmp(expiry_time, inst->force_delta_expiry)) expiry_time = inst->force_delta_expiry;
 	} else {
 		if (inst->force_expiry_is_set &&
 		    (fr_time_delta_cmp(expiry_time, inst->force_expiry) > 0)) expiry_time = inst->force_expiry;
 	}
+	crl->refresh = fr_time_add(now, expiry_time);
+	crl->loaded = now;
+	crl->load_time = fr_time_sub(fr_time(), fetch_start);
 
-	DEBUG3("CRL from %s will expire in %pVs", url, fr_box_time_delta(expiry_time));
-	if (fr_timer_in(crl, tl, &crl->ev, expiry_time, false, crl_expire, crl) <0) {
-		ERROR("Failed to set timer to expire CRL");
-	}
+	DEBUG3("CRL from %s has %u revoked serials, and will be refreshed in %pVs", url, crl->num_serials,
+	       fr_box_time_delta(expiry_time));
 
-	X509_STORE_CTX_free(verify_ctx);
 	return crl;
 }
 
+/** Record how long it took to load a CRL
+ *
+ */
+static void crl_load_stats(rlm_crl_mutable_t *mutable, crl_entry_t const *crl)
+{
+	uint64_t	ns = fr_time_delta_unwrap(crl->load_time);
+	uint64_t	max = atomic_load_explicit(&mutable->load_time_max_ns, memory_order_relaxed);
+
+	atomic_fetch_add_explicit(&mutable->loads, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&mutable->load_time_ns, ns, memory_order_relaxed);
+	while ((ns > max) &&
+	       !atomic_compare_exchange_weak_explicit(&mutable->load_time_max_ns, &max, ns,
+						      memory_order_relaxed, memory_order_relaxed));
+}
+
+static int _crl_rctx_free(rlm_crl_rctx_t *rctx)
+{
+	crl_entry_release(rctx->base_crl);
+	crl_entry_release(rctx->loaded);
+
+	/*
+	 *	Let another request try, if we didn't manage
+	 *	to replace the CRL.
+	 */
+	if (rctx->refreshing) {
+		atomic_store_explicit(&rctx->refreshing->refreshing, false, memory_order_release);
+		crl_entry_release(rctx->refreshing);
+	}
+
+	return 0;
+}
+
 static unlang_action_t CC_HINT(nonnull) crl_process_cdp_data(unlang_result_t *p_result, module_ctx_t const *mctx,
 							     request_t *request);
 
@@ -453,13 +769,12 @@ static int crl_tmpl_yield(request_t *request, rlm_crl_env_t *env, rlm_crl_rctx_t
 		return -1;
 	}
 
+	rctx->fetch_start = fr_time();
 	if (unlang_module_yield_to_tmpl(rctx, &rctx->crl_data, request, vpt,
 					NULL, crl_process_cdp_data, crl_signal, 0, rctx) < 0) return -1;
 	return 1;
 }
 
-static unlang_action_t crl_by_url(unlang_result_t *p_result, module_ctx_t const *mctx, request_t *request);
-
 /** Process the response from evaluating the cdp_url -> crl_data expansion
  *
  * This is the resumption function when we yield to get CRL data associated with a URL
@@ -467,10 +782,11 @@ static unlang_action_t crl_by_url(unlang_result_t *p_result, module_ctx_t const
 static unlang_action_t CC_HINT(nonnull) crl_process_cdp_data(unlang_result_t *p_result, module_ctx_t const *mctx,
 							     request_t *request)
 {
-	rlm_crl_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_crl_t);
-	rlm_crl_env_t *env = talloc_get_type_abort(mctx->env_data, rlm_crl_env_t);
-	rlm_crl_rctx_t *rctx = talloc_get_type_abort(mctx->rctx, rlm_crl_rctx_t);
-	crl_ret_t	ret = CRL_NOT_FOUND;
+	rlm_crl_t const		*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_crl_t);
+	rlm_crl_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_crl_thread_t);
+	rlm_crl_env_t		*env = talloc_get_type_abort(mctx->env_data, rlm_crl_env_t);
+	rlm_crl_rctx_t		*rctx = talloc_get_type_abort(mctx->rctx, rlm_crl_rctx_t);
+	crl_ret_t		ret = CRL_NOT_FOUND;
 
 	switch (fr_value_box_list_num_elements(&rctx->crl_data)) {
 	case 0:
@@ -493,24 +809,32 @@ static unlang_action_t CC_HINT(nonnull) crl_process_cdp_data(unlang_result_t *p_
 			}
 		}
 	fail:
-		pthread_mutex_unlock(&inst->mutable->mutex);
 		fr_value_box_list_talloc_free(&rctx->crl_data);
 		pair_delete_request(attr_crl_cdp_url);
 		RETURN_UNLANG_FAIL;
 
 	case 1:
 	{
-		crl_entry_t *crl_entry;
+		crl_entry_t	*crl_entry;
 		fr_value_box_t	*crl_data = fr_value_box_list_pop_head(&rctx->crl_data);
 
-		crl_entry = crl_entry_create(inst, unlang_interpret_event_list(request)->tl,
-					     rctx->cdp_url->vb_strvalue,
-					     crl_data->vb_octets, rctx->base_crl);
+		crl_entry = crl_entry_create(inst, rctx->cdp_url->vb_strvalue,
+					     crl_data->vb_octets, crl_data->vb_length, rctx->base_crl,
+					     fr_event_list_time(unlang_interpret_event_list(request)), rctx->fetch_start);
 		talloc_free(crl_data);
 		if (!crl_entry) {
+			atomic_fetch_add_explicit(&inst->mutable->load_failures, 1, memory_order_relaxed);
 			RPERROR("Failed to process returned CRL data");
 			goto again;
 		}
+		crl_publish(inst->mutable, crl_entry);
+		crl_load_stats(inst->mutable, crl_entry);
+
+		/*
+		 *	Keep our reference until the request is done with the CRL.
+		 */
+		crl_entry_release(rctx->loaded);
+		rctx->loaded = crl_entry;
 
 		/*
 		 *	We've successfully loaded a URI - so we can clear the list of missing crls
@@ -518,23 +842,26 @@ static unlang_action_t CC_HINT(nonnull) crl_process_cdp_data(unlang_result_t *p_
 		 */
 		fr_value_box_list_talloc_free(&rctx->missing_crls);
 
-		if (fr_value_box_list_num_elements(&crl_entry->delta_urls) > 0) {
-			crl_entry_t	*delta, find;
-			fr_value_box_t	*vb = NULL, *delta_uri;
+		if (talloc_array_length(crl_entry->delta_urls) > 0) {
+			crl_snapshot_t	*snapshot = crl_snapshot_get(t);
+			crl_entry_t	*delta;
+			fr_value_box_t	*delta_uri;
+			fr_time_t	now = fr_event_list_time(unlang_interpret_event_list(request));
+			size_t		i;
 
 			rctx->status = CRL_CHECK_DELTA;
-			while ((vb = fr_value_box_list_next(&crl_entry->delta_urls, vb))) {
-				find.cdp_url = vb->vb_strvalue;
-				delta = fr_rb_find(inst->mutable->crls, &find);
-				if (delta) {
-					ret = crl_check_entry(delta, request, env->serial.vb_octets);
+			for (i = 0; i < talloc_array_length(crl_entry->delta_urls); i++) {
+				delta = crl_snapshot_find(snapshot, crl_entry->delta_urls[i]);
+				if (delta && fr_time_lt(now, delta->expires)) {
+					ret = crl_check_entry(delta, request, &rctx->serial);
 					/*
 					 *	The delta contained an entry for this serial - so this
 					 *	is the return status.
 					 */
 					if (ret != CRL_ENTRY_NOT_FOUND) break;
 				} else {
-					delta_uri = fr_value_box_acopy(rctx, vb);
+					MEM(delta_uri = fr_value_box_alloc_null(rctx));
+					MEM(fr_value_box_strdup(delta_uri, delta_uri, NULL, crl_entry->delta_urls[i], false) == 0);
 					fr_value_box_list_insert_tail(&rctx->missing_crls, delta_uri);
 				}
 			}
@@ -545,16 +872,21 @@ static unlang_action_t CC_HINT(nonnull) crl_process_cdp_data(unlang_result_t *p_
 			 */
 			if (ret == CRL_NOT_FOUND) {
 				rctx->status = CRL_CHECK_FETCH_DELTA;
-				rctx->base_crl = crl_entry;
+				crl_entry_release(rctx->base_crl);
+				rctx->base_crl = crl_entry_ref(crl_entry);
 				goto again;
 			}
 		}
 
-		if (rctx->status != CRL_CHECK_DELTA) ret = crl_check_entry(crl_entry, request, env->serial.vb_octets);
+		/*
+		 *	If the delta didn't mention the serial, the base CRL decides.
+		 */
+		if ((rctx->status != CRL_CHECK_DELTA) || (ret == CRL_ENTRY_NOT_FOUND)) {
+			ret = crl_check_entry(crl_entry, request, &rctx->serial);
+		}
 	check_return:
 		switch (ret) {
 		case CRL_ENTRY_FOUND:
-			pthread_mutex_unlock(&inst->mutable->mutex);
 			RETURN_UNLANG_REJECT;
 
 		case CRL_ENTRY_NOT_FOUND:
@@ -566,13 +898,12 @@ static unlang_action_t CC_HINT(nonnull) crl_process_cdp_data(unlang_result_t *p_
 			if (rctx->status == CRL_CHECK_FETCH_DELTA) {
 				RDEBUG3("Certificate not in delta CRL, checking base CRL");
 				rctx->status = CRL_CHECK_BASE;
-				ret = crl_check_entry(rctx->base_crl, request, env->serial.vb_octets);
+				ret = crl_check_entry(rctx->base_crl, request, &rctx->serial);
 				goto check_return;
 			}
 			FALL_THROUGH;
 
 		case CRL_ENTRY_REMOVED:
-			pthread_mutex_unlock(&inst->mutable->mutex);
 			pair_delete_request(attr_crl_cdp_url);
 			RETURN_UNLANG_OK;
 
@@ -601,18 +932,31 @@ static unlang_action_t CC_HINT(nonnull) crl_process_cdp_data(unlang_result_t *p_
 
 static unlang_action_t CC_HINT(nonnull) crl_by_url(unlang_result_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
-	rlm_crl_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_crl_t);
-	rlm_crl_env_t *env = talloc_get_type_abort(mctx->env_data, rlm_crl_env_t);
-	rlm_crl_rctx_t *rctx = mctx->rctx;
-	rlm_rcode_t	rcode = RLM_MODULE_NOOP;
-	crl_entry_t	*found;
+	rlm_crl_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_crl_thread_t);
+	rlm_crl_env_t		*env = talloc_get_type_abort(mctx->env_data, rlm_crl_env_t);
+	rlm_crl_rctx_t		*rctx = mctx->rctx;
+	rlm_rcode_t		rcode = RLM_MODULE_NOOP;
+	crl_snapshot_t		*snapshot;
+	crl_entry_t		*found;
 
 	if (fr_value_box_list_num_elements(env->cdp) == 0) RETURN_UNLANG_NOOP;
 
-	if (!rctx) rctx = talloc_zero(unlang_interpret_frame_talloc_ctx(request), rlm_crl_rctx_t);
+	if (!rctx) {
+		rctx = talloc_zero(unlang_interpret_frame_talloc_ctx(request), rlm_crl_rctx_t);
+		talloc_set_destructor(rctx, _crl_rctx_free);
+	}
 	fr_value_box_list_init(&rctx->missing_crls);
 
-	pthread_mutex_lock(&inst->mutable->mutex);
+	if (crl_serial_init(rctx, &rctx->serial, env->serial.vb_octets, env->serial.vb_length) < 0) {
+		RPERROR("Invalid certificate serial");
+		RETURN_UNLANG_FAIL;
+	}
+
+	/*
+	 *	Lookups don't take any locks.  The snapshot only
+	 *	changes when a CRL has been loaded.
+	 */
+	snapshot = crl_snapshot_get(t);
 
 	/*
 	 *	Fast path when we have a CRL.
@@ -620,8 +964,7 @@ static unlang_action_t CC_HINT(nonnull) crl_by_url(unlang_result_t *p_result, mo
 	 *	if we have any of them before attempting to fetch missing ones.
 	 */
 	while ((rctx->cdp_url = fr_value_box_list_pop_head(env->cdp))) {
-		switch (crl_check_serial(inst->mutable->crls, request, rctx->cdp_url->vb_strvalue,
-					 env->serial.vb_octets, &found)) {
+		switch (crl_check_serial(snapshot, request, rctx, rctx->cdp_url->vb_strvalue, &found)) {
 		case CRL_ENTRY_FOUND:
 			rcode = RLM_MODULE_REJECT;
 			break;
@@ -646,12 +989,15 @@ static unlang_action_t CC_HINT(nonnull) crl_by_url(unlang_result_t *p_result, mo
 			 *	was not found.  Populate the "missing" list with
 			 *	the CDP for the delta and go get it.
 			 */
-			fr_value_box_t	*vb = NULL, *delta_uri;
-			rctx->base_crl = found;
+			fr_value_box_t	*delta_uri;
+			size_t		i;
+
+			rctx->base_crl = crl_entry_ref(found);
 			rctx->status = CRL_CHECK_FETCH_DELTA;
 			fr_value_box_list_talloc_free(&rctx->missing_crls);
-			while ((vb = fr_value_box_list_next(&found->delta_urls, vb))) {
-				delta_uri = fr_value_box_acopy(rctx, vb);
+			for (i = 0; i < talloc_array_length(found->delta_urls); i++) {
+				MEM(delta_uri = fr_value_box_alloc_null(rctx));
+				MEM(fr_value_box_strdup(delta_uri, delta_uri, NULL, found->delta_urls[i], false) == 0);
 				fr_value_box_list_insert_tail(&rctx->missing_crls, delta_uri);
 			}
 			goto fetch_missing;
@@ -659,43 +1005,113 @@ static unlang_action_t CC_HINT(nonnull) crl_by_url(unlang_result_t *p_result, mo
 		}
 	}
 
-	if (rcode != RLM_MODULE_NOTFOUND) {
-		pthread_mutex_unlock(&inst->mutable->mutex);
-		RETURN_UNLANG_RCODE(rcode);
-	}
+	if (rcode != RLM_MODULE_NOTFOUND) RETURN_UNLANG_RCODE(rcode);
 
 	/*
 	 *	Need to convert a missing cdp_url to a CRL entry
 	 *
 	 *	We yield to an expansion to allow this to happen, then parse the CRL data
-	 *	and check if the serial has an entry in the CRL.
+	 *	and check if the serial has an entry in the CRL.  Other requests
+	 *	aren't blocked whilst this happens.
 	 */
 fetch_missing:
 	fr_value_box_list_init(&rctx->crl_data);
 
 again:
 	rctx->cdp_url = fr_value_box_list_pop_head(&rctx->missing_crls);
+	if (!rctx->cdp_url) RETURN_UNLANG_FAIL;
 
 	switch (crl_tmpl_yield(request, env, rctx)) {
 	case 0:
 		goto again;
 	case 1:
-		/*
-		 *	The lock is released after the pushed tmpl result is handled
-		 */
-		/* coverity[missing_unlock] */
 		return UNLANG_ACTION_PUSHED_CHILD;
 	default:
-		pthread_mutex_unlock(&inst->mutable->mutex);
 		RETURN_UNLANG_FAIL;
 	}
 }
 
+static int cmd_stats_crl(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	rlm_crl_t const		*inst = talloc_get_type_abort_const(ctx, rlm_crl_t);
+	rlm_crl_mutable_t	*mutable = inst->mutable;
+	crl_snapshot_t		*snapshot;
+	uint64_t		loads = atomic_load_explicit(&mutable->loads, memory_order_relaxed);
+	fr_time_t		now = fr_time();
+	size_t			i;
+
+	fprintf(fp, "loads\t\t\t%" PRIu64 "\n", loads);
+	fprintf(fp, "load_failures\t\t%" PRIu64 "\n",
+		(uint64_t) atomic_load_explicit(&mutable->load_failures, memory_order_relaxed));
+	fprintf(fp, "load.average_usec\t%.1f\n",
+		loads ? (double) atomic_load_explicit(&mutable->load_time_ns, memory_order_relaxed) / loads / 1000 : 0.0);
+	fprintf(fp, "load.max_usec\t\t%.1f\n",
+		(double) atomic_load_explicit(&mutable->load_time_max_ns, memory_order_relaxed) / 1000);
+
+	snapshot = crl_snapshot_acquire(mutable);
+	for (i = 0; i < talloc_array_length(snapshot->crls); i++) {
+		crl_entry_t const *crl = snapshot->crls[i];
+
+		fprintf(fp, "%s\n", crl->cdp_url);
+		fprintf(fp, "\tdelta\t\t\t%s\n", crl->delta ? "yes" : "no");
+		fprintf(fp, "\tserials\t\t\t%u\n", crl->num_serials);
+		fprintf(fp, "\tslots\t\t\t%u\n", crl->mask + 1);
+		fprintf(fp, "\tload_usec\t\t%.1f\n", (double) fr_time_delta_unwrap(crl->load_time) / 1000);
+		fprintf(fp, "\tage\t\t\t%" PRId64 "\n", fr_time_delta_to_sec(fr_time_sub(now, crl->loaded)));
+		fprintf(fp, "\trefresh_in\t\t%" PRId64 "\n", fr_time_delta_to_sec(fr_time_sub(crl->refresh, now)));
+		fprintf(fp, "\texpires_in\t\t%" PRId64 "\n", fr_time_delta_to_sec(fr_time_sub(crl->expires, now)));
+	}
+	crl_snapshot_release(snapshot);
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_crl_table[] = {
+	{
+		.parent = "stats",
+		.name = "crl",
+		.help = "Statistics for CRL modules.",
+		.read_only = true
+	},
+
+	{
+		.parent = "stats crl",
+		.add_name = true,
+		.name = "index",
+		.func = cmd_stats_crl,
+		.help = "Show the CRLs loaded by a specific module.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
 static int mod_mutable_free(rlm_crl_mutable_t *mutable)
 {
+	crl_snapshot_release((crl_snapshot_t *)atomic_load_explicit(&mutable->current, memory_order_relaxed));
 	pthread_mutex_destroy(&mutable->mutex);
 	return 0;
 }
+
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_crl_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_crl_thread_t);
+
+	t->inst = talloc_get_type_abort_const(mctx->mi->data, rlm_crl_t);
+	t->snapshot = crl_snapshot_acquire(t->inst->mutable);
+
+	return 0;
+}
+
+static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_crl_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_crl_thread_t);
+
+	crl_snapshot_release(t->snapshot);
+	t->snapshot = NULL;
+
+	return 0;
+}
 #endif
 
 /**	Instantiate the module
@@ -706,8 +1122,13 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 #ifdef WITH_TLS
 	rlm_crl_t	*inst = talloc_get_type_abort(mctx->mi->data, rlm_crl_t);
 
+	crl_snapshot_t	*snapshot;
+
 	MEM(inst->mutable = talloc_zero(NULL, rlm_crl_mutable_t));
-	MEM(inst->mutable->crls = fr_rb_inline_talloc_alloc(inst->mutable, crl_entry_t, node, crl_cmp, crl_free));
+	MEM(snapshot = talloc_zero(NULL, crl_snapshot_t));
+	MEM(snapshot->crls = talloc_array(snapshot, crl_entry_t *, 0));
+	atomic_init(&snapshot->refs, 1);
+	atomic_init(&inst->mutable->current, (uintptr_t)snapshot);
 	pthread_mutex_init(&inst->mutable->mutex, NULL);
 	talloc_set_destructor(inst->mutable, mod_mutable_free);
 
@@ -725,6 +1146,11 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 
 	X509_STORE_set_purpose(inst->verify_store, X509_PURPOSE_SSL_CLIENT);
 
+	if (fr_command_register_hook(NULL, mctx->mi->name, inst, cmd_crl_table) < 0) {
+		cf_log_perr(mctx->mi->conf, "Failed registering radmin commands");
+		return -1;
+	}
+
 	return 0;
 #else
 	cf_log_err(mctx->mi->conf, "rlm_crl requires OpenSSL");
@@ -756,6 +1182,11 @@ module_rlm_t rlm_crl = {
 		.detach		= mod_detach,
 		.name		= "crl",
 		.config		= module_config,
+#ifdef WITH_TLS
+		.thread_inst_size	= sizeof(rlm_crl_thread_t),
+		.thread_instantiate	= mod_thread_instantiate,
+		.thread_detach		= mod_thread_detach,
+#endif
 	},
 #ifdef WITH_TLS
 	.method_group = {
@@ -3,4 +3,6 @@ TARGETNAME	:= rlm_detail
 TARGET		:= $(TARGETNAME)$(L)
 SOURCES		:= $(TARGETNAME).c
 
+TGT_PREREQS	:= libfreeradius-internal$(L) libfreeradius-io$(L)
+
 LOG_ID_LIB	= 11
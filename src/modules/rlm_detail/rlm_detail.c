@@ -23,6 +23,8 @@
  */
 RCSID("$Id$")
 
+#include <freeradius-devel/internal/detail.h>
+#include <freeradius-devel/io/exfile_writer.h>
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/cf_util.h>
 #include <freeradius-devel/server/exfile.h>
@@ -42,6 +44,20 @@ RCSID("$Id$")
 #  include <grp.h>
 #endif
 
+/** Output formats
+ *
+ */
+typedef enum {
+	RLM_DETAIL_FORMAT_TEXT = 0,			//!< One "attr = value" line per pair.
+	RLM_DETAIL_FORMAT_BINARY			//!< Length prefixed, checksummed internal encoding.
+} rlm_detail_format_t;
+
+static fr_table_num_sorted_t const detail_format_table[] = {
+	{ L("binary"),	RLM_DETAIL_FORMAT_BINARY	},
+	{ L("text"),	RLM_DETAIL_FORMAT_TEXT		},
+};
+static size_t detail_format_table_len = NUM_ELEMENTS(detail_format_table);
+
 /** Instance configuration for rlm_detail
  *
  * Holds the configuration and preparsed data for a instance of rlm_detail.
@@ -57,9 +73,22 @@ typedef struct {
 
 	bool		escape;		//!< do filename escaping, yes / no
 
+	rlm_detail_format_t	format;	//!< Text or binary records.
+
 	exfile_t    	*ef;		//!< Log file handler
+
+	bool		buffered;	//!< Write through per-thread buffers.
+	exfile_writer_config_t	buffer;	//!< Buffer sizes, flush interval etc.
+	exfile_writer_t	*writer;	//!< Flushes the per-thread buffers.
 } rlm_detail_t;
 
+typedef struct {
+	exfile_writer_thread_t	*wt;		//!< This thread's write buffer.
+	FILE			*fp;		//!< Renders text entries into dbuff.
+	fr_dbuff_t		dbuff;		//!< Holds the current text entry.
+	fr_dbuff_uctx_talloc_t	tctx;
+} rlm_detail_thread_t;
+
 typedef struct {
 	fr_value_box_t	filename;	//!< File / path to write to.
 	tmpl_t		*filename_tmpl;	//!< tmpl used to expand filename (for debug output)
@@ -77,6 +106,10 @@ static const conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET("locking", rlm_detail_t, locking), .dflt = "no" },
 	{ FR_CONF_OFFSET("escape_filenames", rlm_detail_t, escape), .dflt = "no" },
 	{ FR_CONF_OFFSET("log_packet_header", rlm_detail_t, log_srcdst), .dflt = "no" },
+	{ FR_CONF_OFFSET("format", rlm_detail_t, format), .dflt = "text",
+	  .func = cf_table_parse_int, .uctx = &(cf_table_parse_ctx_t){ .table = detail_format_table, .len = &detail_format_table_len } },
+	{ FR_CONF_OFFSET("buffered", rlm_detail_t, buffered), .dflt = "no" },
+	{ FR_CONF_OFFSET_SUBSECTION("buffer", 0, rlm_detail_t, buffer, exfile_writer_config) },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -163,6 +196,70 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		return -1;
 	}
 
+	/*
+	 *	The workers update the writer, so it can't be in the
+	 *	instance data, which is read only once we're running.
+	 */
+	if (inst->buffered) {
+		inst->writer = exfile_writer_alloc(NULL, inst->ef, mctx->mi->name, &inst->buffer);
+		if (!inst->writer) {
+			cf_log_perr(conf, "Failed creating buffered writer");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int mod_detach(module_detach_ctx_t const *mctx)
+{
+	rlm_detail_t *inst = talloc_get_type_abort(mctx->mi->data, rlm_detail_t);
+
+	/*
+	 *	Flushes anything still buffered, and must happen
+	 *	before inst->ef is freed.
+	 */
+	TALLOC_FREE(inst->writer);
+
+	return 0;
+}
+
+static ssize_t _detail_buffer_write(void *cookie, char const *buf, size_t size)
+{
+	rlm_detail_thread_t *t = cookie;
+
+	return fr_dbuff_in_memcpy(&t->dbuff, (uint8_t const *) buf, size);
+}
+
+static int _detail_thread_free(rlm_detail_thread_t *t)
+{
+	if (t->fp) fclose(t->fp);
+
+	return 0;
+}
+
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_detail_t		*inst = talloc_get_type_abort(mctx->mi->data, rlm_detail_t);
+	rlm_detail_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_detail_thread_t);
+
+	if (!inst->writer) return 0;
+
+	t->wt = exfile_writer_thread_alloc(t, inst->writer);
+	if (!t->wt) {
+		PERROR("Failed allocating write buffer");
+		return -1;
+	}
+
+	fr_dbuff_init_talloc(t, &t->dbuff, &t->tctx, 1024, SIZE_MAX);
+
+	t->fp = fopencookie(t, "w", (cookie_io_functions_t){ .write = _detail_buffer_write });
+	if (!t->fp) {
+		ERROR("Failed creating detail buffer stream: %s", fr_syserror(errno));
+		return -1;
+	}
+	talloc_set_destructor(t, _detail_thread_free);
+
 	return 0;
 }
 
@@ -301,6 +398,171 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, request_t *request,
 	return 0;
 }
 
+/** Remove suppressed attributes from a list, at any depth
+ *
+ */
+static void detail_binary_suppress(fr_pair_list_t *list, fr_hash_table_t *ht)
+{
+	fr_pair_list_foreach(list, vp) {
+		if (fr_hash_table_find(ht, vp->da)) {
+			fr_pair_delete(list, vp);
+			continue;
+		}
+
+		if (fr_type_is_structural(vp->vp_type)) detail_binary_suppress(&vp->vp_group, ht);
+	}
+}
+
+/** Encode a single binary detail record
+ *
+ * The whole record is built in memory, so that it can be written with one
+ * write() call, and the file only ever contains complete records, or a
+ * truncated last record which the reader will skip.
+ *
+ * @param[out] out Where to write a pointer to the encoded record.
+ *	NULL if there was nothing to encode.
+ * @param[in] inst Instance of rlm_detail.
+ * @param[in] request The current request.
+ * @param[in] packet associated with the request (request, reply...).
+ * @param[in] list of pairs to write.
+ * @param[in] ht Hash table containing attributes to be suppressed in the output.
+ */
+static int detail_encode_binary(fr_dbuff_t **out, rlm_detail_t const *inst, request_t *request,
+				fr_packet_t *packet, fr_pair_list_t *list, fr_hash_table_t *ht)
+{
+	fr_dbuff_t	*dbuff;
+	fr_pair_list_t	copy, *to_encode = list;
+	TALLOC_CTX	*local = NULL;
+	int		ret = -1;
+
+	*out = NULL;
+
+	if (fr_pair_list_empty(list)) {
+		RWDEBUG("Skipping empty packet");
+		return 0;
+	}
+
+	/*
+	 *	Only copy the list if we need to change it.
+	 */
+	if (ht || inst->log_srcdst) {
+		MEM(local = talloc_new(NULL));
+		fr_pair_list_init(&copy);
+
+		if (fr_pair_list_copy(local, &copy, list) < 0) {
+			RPERROR("Failed copying pairs for detail record");
+			goto done;
+		}
+
+		if (ht) detail_binary_suppress(&copy, ht);
+
+		if (inst->log_srcdst) {
+			fr_pair_t *vp;
+
+			vp = fr_pair_find_by_da(&request->control_pairs, NULL, attr_net);
+			if (vp) {
+				MEM(vp = fr_pair_copy(local, vp));
+				fr_pair_append(&copy, vp);
+			}
+		}
+
+		to_encode = &copy;
+	}
+
+	FR_DBUFF_TALLOC_THREAD_LOCAL(&dbuff, 1024, SIZE_MAX);
+
+	if (fr_detail_record_encode(dbuff, packet->code, fr_time_to_unix_time(request->packet->timestamp),
+				    to_encode, NULL) < 0) {
+		RPERROR("Failed encoding detail record");
+		goto done;
+	}
+
+	*out = dbuff;
+	ret = 0;
+
+done:
+	talloc_free(local);
+	return ret;
+}
+
+/** Write a single binary detail record to a file descriptor
+ *
+ * @param[in] out Where to write entry.
+ * @param[in] inst Instance of rlm_detail.
+ * @param[in] request The current request.
+ * @param[in] packet associated with the request (request, reply...).
+ * @param[in] list of pairs to write.
+ * @param[in] ht Hash table containing attributes to be suppressed in the output.
+ */
+static int detail_write_binary(int out, rlm_detail_t const *inst, request_t *request,
+			       fr_packet_t *packet, fr_pair_list_t *list, fr_hash_table_t *ht)
+{
+	fr_dbuff_t	*dbuff;
+	uint8_t const	*p, *end;
+
+	if (detail_encode_binary(&dbuff, inst, request, packet, list, ht) < 0) return -1;
+	if (!dbuff) return 0;
+
+	p = fr_dbuff_start(dbuff);
+	end = p + fr_dbuff_used(dbuff);
+	while (p < end) {
+		ssize_t slen;
+
+		slen = write(out, p, end - p);
+		if (slen < 0) {
+			if (errno == EINTR) continue;
+
+			RERROR("Failed writing to detail file: %s", fr_syserror(errno));
+			return -1;
+		}
+		p += slen;
+	}
+
+	return 0;
+}
+
+/** Append a single detail entry to this thread's write buffer
+ *
+ * Text entries are rendered through the same code as unbuffered ones,
+ * using a FILE stream which writes to memory.
+ */
+static int detail_append(rlm_detail_thread_t *t, rlm_detail_t const *inst, request_t *request,
+			 rlm_detail_env_t *env, fr_packet_t *packet, fr_pair_list_t *list)
+{
+	struct iovec	vector;
+
+	if (inst->format == RLM_DETAIL_FORMAT_BINARY) {
+		fr_dbuff_t *dbuff;
+
+		if (detail_encode_binary(&dbuff, inst, request, packet, list, env->ht) < 0) return -1;
+		if (!dbuff) return 0;
+
+		vector.iov_base = fr_dbuff_start(dbuff);
+		vector.iov_len = fr_dbuff_used(dbuff);
+	} else {
+		fr_dbuff_set_to_start(&t->dbuff);
+
+		if (detail_write(t->fp, inst, request, &env->header, packet, list, env->ht) < 0) return -1;
+		if (fflush(t->fp) == EOF) {
+			RERROR("Failed rendering detail entry");
+			return -1;
+		}
+
+		vector.iov_base = fr_dbuff_start(&t->dbuff);
+		vector.iov_len = fr_dbuff_used(&t->dbuff);
+		if (!vector.iov_len) return 0;
+	}
+
+	if (exfile_writer_append(t->wt, env->filename.vb_strvalue, inst->perm,
+				 inst->group_is_set ? inst->group : (gid_t) -1,
+				 NULL, 0, &vector, 1) < 0) {
+		RPERROR("Failed buffering detail entry");
+		return -1;
+	}
+
+	return 0;
+}
+
 /*
  *	Do detail, compatible with old accounting
  */
@@ -315,6 +577,14 @@ static unlang_action_t CC_HINT(nonnull) detail_do(unlang_result_t *p_result, mod
 
 	RDEBUG2("%s expands to %pV", env->filename_tmpl->name, &env->filename);
 
+	if (inst->writer) {
+		rlm_detail_thread_t *t = talloc_get_type_abort(mctx->thread, rlm_detail_thread_t);
+
+		if (detail_append(t, inst, request, env, packet, list) < 0) RETURN_UNLANG_FAIL;
+
+		RETURN_UNLANG_OK;
+	}
+
 	outfd = exfile_open(inst->ef, env->filename.vb_strvalue, inst->perm, NULL);
 	if (outfd < 0) {
 		RPERROR("Couldn't open file %pV", &env->filename);
@@ -330,6 +600,13 @@ static unlang_action_t CC_HINT(nonnull) detail_do(unlang_result_t *p_result, mod
 		}
 	}
 
+	if (inst->format == RLM_DETAIL_FORMAT_BINARY) {
+		if (detail_write_binary(outfd, inst, request, packet, list, env->ht) < 0) goto fail;
+
+		exfile_close(inst->ef, outfd);
+		RETURN_UNLANG_OK;
+	}
+
 	dupfd = dup(outfd);
 	if (dupfd < 0) {
 		RERROR("Failed to dup() file descriptor for detail file");
@@ -493,7 +770,10 @@ module_rlm_t rlm_detail = {
 		.name		= "detail",
 		.inst_size	= sizeof(rlm_detail_t),
 		.config		= module_config,
-		.instantiate	= mod_instantiate
+		.instantiate	= mod_instantiate,
+		.detach		= mod_detach,
+		.thread_inst_size	= sizeof(rlm_detail_thread_t),
+		.thread_instantiate	= mod_thread_instantiate
 	},
 	.method_group = {
 		.bindings = (module_method_binding_t[]){
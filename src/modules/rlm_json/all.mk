@@ -3,6 +3,7 @@
 #  target may stick around.
 TARGETNAME	:=
 -include $(top_builddir)/src/lib/json/all.mk
+SUBMAKEFILES	:=
 
 ifneq "${TARGETNAME}" ""
   TARGETNAME	:= rlm_json
@@ -19,18 +19,327 @@
  * @file rlm_kafka.c
  * @brief Kafka producer module
  *
+ * Each worker thread gets its own producer.  Messages are handed to librdkafka
+ * without blocking, and the request yields until the delivery report for its
+ * message arrives.  librdkafka signals the arrival of delivery reports by
+ * writing to a pipe which is serviced by the worker's event loop, so no
+ * additional threads ever touch the request.
+ *
+ * Batching, linger and compression are all handled by librdkafka, and are
+ * controlled by the normal producer and per-topic configuration items.
+ *
  * @copyright 2022 Arran Cudbard-Bell (a.cudbardb@freeradius.org)
  */
 RCSID("$Id$")
 USES_APPLE_DEPRECATED_API
 
 #include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/module_rlm.h>
 #include <freeradius-devel/kafka/base.h>
+#include <freeradius-devel/unlang/call_env.h>
+#include <freeradius-devel/unlang/module.h>
+#include <freeradius-devel/util/misc.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+/** How long we wait for outstanding messages to be delivered when a thread exits
+ *
+ */
+#define KAFKA_FLUSH_TIMEOUT_MS	(5000)
 
 typedef struct {
-	char const *foo;
+	CONF_SECTION		*topics;		//!< "topic" section containing per-topic configuration.
 } rlm_kafka_t;
 
+/** Per-thread producer
+ *
+ */
+typedef struct {
+	rlm_kafka_t const	*inst;			//!< Instance data.
+	fr_event_list_t		*el;			//!< Worker's event list.
+	rd_kafka_t		*rk;			//!< Producer handle.
+	rd_kafka_queue_t	*queue;			//!< Main queue, which delivery reports are enqueued to.
+	int			pipe[2];		//!< librdkafka writes to pipe[1] when the
+							///< queue becomes non-empty.
+	fr_rb_tree_t		*topics;		//!< Topic handles we've created, by name.
+} rlm_kafka_thread_t;
+
+/** A topic handle, cached per thread
+ *
+ */
+typedef struct {
+	fr_rb_node_t		node;			//!< Entry in the thread's topic tree.
+	char const		*name;			//!< Topic name.
+	rd_kafka_topic_t	*rkt;			//!< Topic handle.
+} rlm_kafka_topic_t;
+
+/** Tracks a single message until its delivery report arrives
+ *
+ * Allocated in the thread context so that it outlives requests which are
+ * cancelled while their message is still in flight.
+ */
+typedef struct {
+	request_t		*request;		//!< The request which produced the message.
+							///< NULL if the request has been cancelled.
+	rd_kafka_resp_err_t	err;			//!< Result of the delivery.
+} rlm_kafka_rctx_t;
+
+typedef struct {
+	fr_value_box_t		*topic;			//!< Topic to produce to.
+	fr_value_box_t		*key;			//!< Optional message key.
+	fr_value_box_t		*partition;		//!< Optional partition.  If not set the
+							///< topic's partitioner picks one.
+	fr_value_box_t		*value;			//!< Message payload.
+} rlm_kafka_env_t;
+
+static const call_env_method_t rlm_kafka_env = {
+	FR_CALL_ENV_METHOD_OUT(rlm_kafka_env_t),
+	.env = (call_env_parser_t[]) {
+		{ FR_CALL_ENV_SUBSECTION("message", NULL, CALL_ENV_FLAG_REQUIRED,
+					 ((call_env_parser_t[]) {
+						{ FR_CALL_ENV_OFFSET("topic", FR_TYPE_STRING, CALL_ENV_FLAG_REQUIRED | CALL_ENV_FLAG_CONCAT, rlm_kafka_env_t, topic) },
+						{ FR_CALL_ENV_OFFSET("key", FR_TYPE_STRING, CALL_ENV_FLAG_CONCAT | CALL_ENV_FLAG_NULLABLE, rlm_kafka_env_t, key) },
+						{ FR_CALL_ENV_OFFSET("partition", FR_TYPE_INT32, CALL_ENV_FLAG_SINGLE | CALL_ENV_FLAG_NULLABLE, rlm_kafka_env_t, partition) },
+						{ FR_CALL_ENV_OFFSET("value", FR_TYPE_STRING, CALL_ENV_FLAG_REQUIRED | CALL_ENV_FLAG_CONCAT, rlm_kafka_env_t, value) },
+						CALL_ENV_TERMINATOR
+					 })) },
+		CALL_ENV_TERMINATOR
+	}
+};
+
+static int8_t kafka_topic_cmp(void const *one, void const *two)
+{
+	rlm_kafka_topic_t const *a = one, *b = two;
+
+	return CMP(strcmp(a->name, b->name), 0);
+}
+
+static int _kafka_topic_free(rlm_kafka_topic_t *topic)
+{
+	rd_kafka_topic_destroy(topic->rkt);
+	return 0;
+}
+
+/** Find or create a topic handle
+ *
+ * Per-topic configuration comes from the matching "topic { <name> { ... } }"
+ * section, if there is one.
+ */
+static rlm_kafka_topic_t *kafka_topic_get(rlm_kafka_thread_t *t, request_t *request, char const *name)
+{
+	rlm_kafka_topic_t	*topic, find = { .name = name };
+	rd_kafka_topic_conf_t	*conf;
+	CONF_SECTION		*cs = NULL;
+
+	topic = fr_rb_find(t->topics, &find);
+	if (topic) return topic;
+
+	if (t->inst->topics) cs = cf_section_find(t->inst->topics, name, NULL);
+
+	conf = kafka_topic_conf_dup(cs);
+	if (!conf) {
+		REDEBUG("Failed allocating configuration for topic \"%s\"", name);
+		return NULL;
+	}
+
+	MEM(topic = talloc_zero(t->topics, rlm_kafka_topic_t));
+	topic->name = talloc_strdup(topic, name);
+	topic->rkt = rd_kafka_topic_new(t->rk, name, conf);	/* Always takes ownership of conf */
+	if (!topic->rkt) {
+		REDEBUG("Failed creating topic \"%s\": %s", name, rd_kafka_err2str(rd_kafka_last_error()));
+		talloc_free(topic);
+		return NULL;
+	}
+	talloc_set_destructor(topic, _kafka_topic_free);
+	fr_rb_insert(t->topics, topic);
+
+	return topic;
+}
+
+/** Called by rd_kafka_poll() for each message which has been delivered or has failed
+ *
+ */
+static void _kafka_delivery_report(UNUSED rd_kafka_t *rk, rd_kafka_message_t const *msg, UNUSED void *uctx)
+{
+	rlm_kafka_rctx_t *rctx = talloc_get_type_abort(msg->_private, rlm_kafka_rctx_t);
+
+	if (!rctx->request) {
+		talloc_free(rctx);
+		return;
+	}
+
+	rctx->err = msg->err;
+	unlang_interpret_mark_runnable(rctx->request);
+}
+
+/** librdkafka has queued delivery reports, service them
+ *
+ */
+static void _kafka_queue_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	rlm_kafka_thread_t	*t = talloc_get_type_abort(uctx, rlm_kafka_thread_t);
+	uint8_t			buff[64];
+
+	while (read(fd, buff, sizeof(buff)) > 0);
+
+	while (rd_kafka_poll(t->rk, 0) > 0);
+}
+
+static unlang_action_t mod_produce_resume(unlang_result_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_kafka_rctx_t	*rctx = talloc_get_type_abort(mctx->rctx, rlm_kafka_rctx_t);
+	rd_kafka_resp_err_t	err = rctx->err;
+
+	talloc_free(rctx);
+
+	if (err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+		REDEBUG("Message delivery failed: %s", rd_kafka_err2str(err));
+		RETURN_UNLANG_FAIL;
+	}
+
+	RETURN_UNLANG_OK;
+}
+
+static void mod_produce_signal(module_ctx_t const *mctx, UNUSED request_t *request, UNUSED fr_signal_t action)
+{
+	rlm_kafka_rctx_t	*rctx = talloc_get_type_abort(mctx->rctx, rlm_kafka_rctx_t);
+
+	/*
+	 *	The message can't be recalled, so leave the
+	 *	rctx for the delivery report to free.
+	 */
+	rctx->request = NULL;
+}
+
+/** Enqueue a message and yield until it's delivered
+ *
+ */
+static unlang_action_t CC_HINT(nonnull) mod_produce(unlang_result_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_kafka_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_kafka_thread_t);
+	rlm_kafka_env_t		*env = talloc_get_type_abort(mctx->env_data, rlm_kafka_env_t);
+	rlm_kafka_topic_t	*topic;
+	rlm_kafka_rctx_t	*rctx;
+	int32_t			partition = RD_KAFKA_PARTITION_UA;
+	void const		*key = NULL;
+	size_t			key_len = 0;
+
+	topic = kafka_topic_get(t, request, env->topic->vb_strvalue);
+	if (!topic) RETURN_UNLANG_FAIL;
+
+	if (env->key) {
+		key = env->key->vb_strvalue;
+		key_len = env->key->vb_length;
+	}
+	if (env->partition) partition = env->partition->vb_int32;
+
+	MEM(rctx = talloc_zero(t, rlm_kafka_rctx_t));
+	rctx->request = request;
+
+	if (rd_kafka_produce(topic->rkt, partition, RD_KAFKA_MSG_F_COPY,
+			     UNCONST(char *, env->value->vb_strvalue), env->value->vb_length,
+			     key, key_len, rctx) < 0) {
+		REDEBUG("Failed enqueueing message for topic \"%s\": %s",
+			topic->name, rd_kafka_err2str(rd_kafka_last_error()));
+		talloc_free(rctx);
+		RETURN_UNLANG_FAIL;
+	}
+
+	RDEBUG2("Enqueued %zu byte message for topic \"%s\"", env->value->vb_length, topic->name);
+
+	return unlang_module_yield(request, mod_produce_resume, mod_produce_signal, ~FR_SIGNAL_CANCEL, rctx);
+}
+
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_kafka_t		*inst = talloc_get_type_abort(mctx->mi->data, rlm_kafka_t);
+	rlm_kafka_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_kafka_thread_t);
+	rd_kafka_conf_t		*conf;
+	char			errstr[512];
+
+	t->inst = inst;
+	t->el = mctx->el;
+	t->pipe[0] = t->pipe[1] = -1;
+
+	conf = kafka_conf_dup(mctx->mi->conf);
+	if (!conf) {
+		PERROR("Failed allocating producer configuration");
+		return -1;
+	}
+	rd_kafka_conf_set_dr_msg_cb(conf, _kafka_delivery_report);
+	rd_kafka_conf_set_opaque(conf, t);
+
+	t->rk = rd_kafka_new(RD_KAFKA_PRODUCER, conf, errstr, sizeof(errstr));	/* Takes ownership of conf */
+	if (!t->rk) {
+		ERROR("Failed creating producer: %s", errstr);
+		rd_kafka_conf_destroy(conf);
+		return -1;
+	}
+
+	MEM(t->topics = fr_rb_inline_talloc_alloc(t, rlm_kafka_topic_t, node, kafka_topic_cmp, NULL));
+
+	if (pipe(t->pipe) < 0) {
+		ERROR("Failed creating pipe: %s", fr_syserror(errno));
+		return -1;
+	}
+	if ((fr_nonblock(t->pipe[0]) < 0) || (fr_nonblock(t->pipe[1]) < 0)) {
+		PERROR("Failed setting pipe to non-blocking");
+		return -1;
+	}
+
+	/*
+	 *	Have librdkafka poke the event loop whenever
+	 *	delivery reports are waiting to be serviced.
+	 */
+	t->queue = rd_kafka_queue_get_main(t->rk);
+	rd_kafka_queue_io_event_enable(t->queue, t->pipe[1], "1", 1);
+
+	if (fr_event_fd_insert(t, NULL, t->el, t->pipe[0], _kafka_queue_read, NULL, NULL, t) < 0) {
+		PERROR("Failed inserting producer queue into event loop");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_kafka_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_kafka_thread_t);
+
+	if (t->pipe[0] >= 0) (void) fr_event_fd_delete(t->el, t->pipe[0], FR_EVENT_FILTER_IO);
+
+	if (t->rk) {
+		if (rd_kafka_flush(t->rk, KAFKA_FLUSH_TIMEOUT_MS) != RD_KAFKA_RESP_ERR_NO_ERROR) {
+			WARN("Timed out waiting for %i message(s) to be delivered", rd_kafka_outq_len(t->rk));
+			rd_kafka_purge(t->rk, RD_KAFKA_PURGE_F_QUEUE | RD_KAFKA_PURGE_F_INFLIGHT);
+			while (rd_kafka_poll(t->rk, 0) > 0);
+		}
+
+		if (t->queue) {
+			rd_kafka_queue_io_event_enable(t->queue, -1, NULL, 0);
+			rd_kafka_queue_destroy(t->queue);
+		}
+
+		TALLOC_FREE(t->topics);		/* Topics must be destroyed before the producer */
+		rd_kafka_destroy(t->rk);
+	}
+
+	if (t->pipe[0] >= 0) close(t->pipe[0]);
+	if (t->pipe[1] >= 0) close(t->pipe[1]);
+
+	return 0;
+}
+
+static int mod_instantiate(module_inst_ctx_t const *mctx)
+{
+	rlm_kafka_t	*inst = talloc_get_type_abort(mctx->mi->data, rlm_kafka_t);
+
+	inst->topics = cf_section_find(mctx->mi->conf, "topic", NULL);
+
+	return 0;
+}
+
 /*
  *	The module name should be the only globally exported symbol.
  *	That is, everything else should be 'static'.
@@ -43,9 +352,19 @@ typedef struct {
 extern module_rlm_t rlm_kafka;
 module_rlm_t rlm_kafka = {
 	.common = {
-		.magic		= MODULE_MAGIC_INIT,
-		.name		= "kafka",
-		.inst_size	= sizeof(rlm_kafka_t),
-		.config		= kafka_base_producer_config,
+		.magic			= MODULE_MAGIC_INIT,
+		.name			= "kafka",
+		.inst_size		= sizeof(rlm_kafka_t),
+		.thread_inst_size	= sizeof(rlm_kafka_thread_t),
+		.config			= kafka_base_producer_config,
+		.instantiate		= mod_instantiate,
+		.thread_instantiate	= mod_thread_instantiate,
+		.thread_detach		= mod_thread_detach
+	},
+	.method_group = {
+		.bindings = (module_method_binding_t[]){
+			{ .section = SECTION_NAME(CF_IDENT_ANY, CF_IDENT_ANY), .method = mod_produce, .method_env = &rlm_kafka_env },
+			MODULE_BINDING_TERMINATOR
+		}
 	}
 };
@@ -3,4 +3,6 @@ TARGETNAME	:= rlm_linelog
 TARGET		:= $(TARGETNAME)$(L)
 SOURCES		:= $(TARGETNAME).c
 
+TGT_PREREQS	:= libfreeradius-io$(L)
+
 LOG_ID_LIB	= 27
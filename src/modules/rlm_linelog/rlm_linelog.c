@@ -23,6 +23,7 @@
 
 RCSID("$Id$")
 
+#include <freeradius-devel/io/exfile_writer.h>
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/exfile.h>
 #include <freeradius-devel/server/module_rlm.h>
@@ -122,6 +123,9 @@ typedef struct {
 		exfile_t		*ef;			//!< Exclusive file access handle.
 		bool			escape;			//!< Do filename escaping, yes / no.
 		bool			fsync;			//!< fsync after each write.
+		bool			buffered;		//!< Write through per-thread buffers.
+		exfile_writer_config_t	buffer;			//!< Buffer sizes, flush interval etc.
+		exfile_writer_t		*writer;		//!< Flushes the per-thread buffers.
 	} file;
 
 	struct {
@@ -135,6 +139,10 @@ typedef struct {
 	CONF_SECTION		*cs;			//!< #CONF_SECTION to use as the root for #log_ref lookups.
 } rlm_linelog_t;
 
+typedef struct {
+	exfile_writer_thread_t	*wt;			//!< This thread's file write buffer.
+} rlm_linelog_thread_t;
+
 typedef struct {
 	int			sockfd;			//!< File descriptor associated with socket
 } linelog_conn_t;
@@ -145,6 +153,8 @@ static const conf_parser_t file_config[] = {
 	{ FR_CONF_OFFSET("group", rlm_linelog_t, file.group_str) },
 	{ FR_CONF_OFFSET("escape_filenames", rlm_linelog_t, file.escape), .dflt = "no" },
 	{ FR_CONF_OFFSET("fsync", rlm_linelog_t, file.fsync), .dflt = "no" },
+	{ FR_CONF_OFFSET("buffered", rlm_linelog_t, file.buffered), .dflt = "no" },
+	{ FR_CONF_OFFSET_SUBSECTION("buffer", 0, rlm_linelog_t, file.buffer, exfile_writer_config) },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -366,7 +376,7 @@ static void linelog_hexdump(request_t *request, struct iovec *vector_p, size_t v
 	RHEXDUMP3(fr_dbuff_start(agg), fr_dbuff_used(agg), "%s", msg);
 }
 
-static int linelog_write(rlm_linelog_t const *inst, linelog_call_env_t const *call_env, request_t *request, struct iovec *vector_p, size_t vector_len, bool with_delim)
+static int linelog_write(rlm_linelog_t const *inst, rlm_linelog_thread_t *t, linelog_call_env_t const *call_env, request_t *request, struct iovec *vector_p, size_t vector_len, bool with_delim)
 {
 	int 			ret = 0;
 	linelog_conn_t		*conn;
@@ -390,6 +400,40 @@ static int linelog_write(rlm_linelog_t const *inst, linelog_call_env_t const *ca
 
 		path = call_env->filename->vb_strvalue;
 
+		/*
+		 *	Hand the entry to the writer thread, which
+		 *	creates directories, writes the header, and
+		 *	syncs the file as needed.
+		 */
+		if (inst->file.writer) {
+			struct iovec	head_vector_s[2];
+			size_t		head_vector_len = 0;
+
+			if (call_env->log_head) {
+				memcpy(&head_vector_s[0].iov_base, &call_env->log_head->vb_strvalue, sizeof(head_vector_s[0].iov_base));
+				head_vector_s[0].iov_len = call_env->log_head->vb_length;
+				head_vector_len = 1;
+
+				if (with_delim) {
+					memcpy(&head_vector_s[1].iov_base, &(inst->delimiter),
+					       sizeof(head_vector_s[1].iov_base));
+					head_vector_s[1].iov_len = inst->delimiter_len;
+					head_vector_len = 2;
+				}
+			}
+
+			if (RDEBUG_ENABLED3) linelog_hexdump(request, vector_p, vector_len, "linelog data");
+
+			if (exfile_writer_append(t->wt, path, inst->file.permissions,
+						 inst->file.group_str ? inst->file.group : (gid_t) -1,
+						 head_vector_len ? head_vector_s : NULL, head_vector_len,
+						 vector_p, vector_len) < 0) {
+				RPERROR("Failed buffering entry for \"%pV\"", call_env->filename);
+				return -1;
+			}
+			break;
+		}
+
 		/* check path and eventually create subdirs */
 		p = strrchr(path, '/');
 		if (p) {
@@ -604,7 +648,7 @@ static xlat_action_t linelog_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 		vector[i].iov_len = inst->delimiter_len;
 		i++;
 	}
-	slen = linelog_write(inst, call_env, request, vector, i, with_delim);
+	slen = linelog_write(inst, xctx->mctx->thread, call_env, request, vector, i, with_delim);
 	if (slen < 0) return XLAT_ACTION_FAIL;
 
 	MEM(wrote = fr_value_box_alloc(ctx, FR_TYPE_SIZE, NULL));
@@ -673,7 +717,7 @@ static unlang_action_t CC_HINT(nonnull) mod_do_linelog_resume(unlang_result_t *p
 		}
 	}
 
-	RETURN_UNLANG_RCODE(linelog_write(inst, call_env, request, vector, vector_len, rctx->with_delim) < 0 ? RLM_MODULE_FAIL : RLM_MODULE_OK);
+	RETURN_UNLANG_RCODE(linelog_write(inst, mctx->thread, call_env, request, vector, vector_len, rctx->with_delim) < 0 ? RLM_MODULE_FAIL : RLM_MODULE_OK);
 }
 
 /** Write a linelog message
@@ -860,7 +904,7 @@ build_vector:
 			RDEBUG2("No data to write");
 			rcode = RLM_MODULE_NOOP;
 		} else {
-			rcode = linelog_write(inst, call_env, request, vector_p, vector_len, with_delim) < 0 ? RLM_MODULE_FAIL : RLM_MODULE_OK;
+			rcode = linelog_write(inst, mctx->thread, call_env, request, vector_p, vector_len, with_delim) < 0 ? RLM_MODULE_FAIL : RLM_MODULE_OK;
 		}
 
 		talloc_free(vpt);
@@ -926,6 +970,28 @@ static int mod_detach(module_detach_ctx_t const *mctx)
 
 	fr_pool_free(inst->pool);
 
+	/*
+	 *	Flushes anything still buffered, and must happen
+	 *	before inst->file.ef is freed.
+	 */
+	TALLOC_FREE(inst->file.writer);
+
+	return 0;
+}
+
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_linelog_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_linelog_t);
+	rlm_linelog_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_linelog_thread_t);
+
+	if (!inst->file.writer) return 0;
+
+	t->wt = exfile_writer_thread_alloc(t, inst->file.writer);
+	if (!t->wt) {
+		PERROR("Failed allocating write buffer");
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -978,6 +1044,21 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 				}
 			}
 		}
+
+		if (inst->file.buffered) {
+			inst->file.buffer.fsync |= inst->file.fsync;
+
+			/*
+			 *	The workers update the writer, so it can't be in
+			 *	the instance data, which is read only once we're
+			 *	running.
+			 */
+			inst->file.writer = exfile_writer_alloc(NULL, inst->file.ef, mctx->mi->name, &inst->file.buffer);
+			if (!inst->file.writer) {
+				cf_log_perr(conf, "Failed creating buffered writer");
+				return -1;
+			}
+		}
 	}
 		break;
 
@@ -1075,7 +1156,9 @@ module_rlm_t rlm_linelog = {
 		.config		= module_config,
 		.bootstrap	= mod_bootstrap,
 		.instantiate	= mod_instantiate,
-		.detach		= mod_detach
+		.detach		= mod_detach,
+		.thread_inst_size	= sizeof(rlm_linelog_thread_t),
+		.thread_instantiate	= mod_thread_instantiate
 	},
 	.method_group = {
 		.bindings = (module_method_binding_t[]){
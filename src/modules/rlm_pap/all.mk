@@ -4,4 +4,5 @@ TARGET		:= $(TARGETNAME)$(L)
 SOURCES		:= $(TARGETNAME).c
 
 TGT_LDFLAGS	:= $(LCRYPT)
+TGT_PREREQS	:= libfreeradius-io$(L)
 LOG_ID_LIB	= 35
@@ -28,6 +28,7 @@ RCSID("$Id$")
 USES_APPLE_DEPRECATED_API
 
 #include <freeradius-devel/server/base.h>
+#include <freeradius-devel/io/crypto_pool.h>
 #include <freeradius-devel/server/module_rlm.h>
 #include <freeradius-devel/server/password.h>
 #include <freeradius-devel/tls/base.h>
@@ -76,7 +77,11 @@ typedef struct {
 	bool				normify;
 } rlm_pap_t;
 
-typedef unlang_action_t (*pap_auth_func_t)(unlang_result_t *p_result, rlm_pap_t const *inst, request_t *request, fr_pair_t const *, fr_value_box_t const *);
+typedef struct {
+	crypto_pool_thread_t		*cpt;		//!< For offloading expensive hashes.
+} rlm_pap_thread_t;
+
+typedef unlang_action_t (*pap_auth_func_t)(unlang_result_t *p_result, module_ctx_t const *mctx, request_t *request, fr_pair_t const *, fr_value_box_t const *);
 
 static const conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET("normalise", rlm_pap_t, normify), .dflt = "yes" },
@@ -172,12 +177,33 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(unlang_result_t *p_result,
 	RETURN_UNLANG_UPDATED;
 }
 
+/** Log the result of comparing the password
+ *
+ */
+static unlang_action_t pap_auth_result(unlang_result_t *p_result, request_t *request)
+{
+	switch (p_result->rcode) {
+	case RLM_MODULE_REJECT:
+		REDEBUG("Password incorrect");
+		break;
+
+	case RLM_MODULE_OK:
+		RDEBUG2("User authenticated successfully");
+		break;
+
+	default:
+		break;
+	}
+
+	return UNLANG_ACTION_CALCULATE_RESULT;
+}
+
 /*
  *	PAP authentication functions
  */
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_clear(unlang_result_t *p_result,
-						       UNUSED rlm_pap_t const *inst, request_t *request,
+						       UNUSED module_ctx_t const *mctx, request_t *request,
 						       fr_pair_t const *known_good, fr_value_box_t const *password)
 {
 	if ((known_good->vp_length != password->vb_length) ||
@@ -192,48 +218,102 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_clear(unlang_result_t *p_result
 }
 
 #ifdef HAVE_CRYPT
-static unlang_action_t CC_HINT(nonnull) pap_auth_crypt(unlang_result_t *p_result,
-						       UNUSED rlm_pap_t const *inst, request_t *request,
-						       fr_pair_t const *known_good, fr_value_box_t const *password)
+/** Data for calculating a crypt() hash in the crypto pool
+ *
+ */
+typedef struct {
+	crypto_job_t	*job;
+	char		*password;
+	char		*known_good;
+	bool		match;
+} pap_crypt_job_t;
+
+static void pap_crypt_job(void *uctx)
 {
-	char	*crypt_out;
-	int	cmp = 0;
+	pap_crypt_job_t	*cj = uctx;
+	char		*crypt_out;
+	int		cmp = 0;
 
 #ifdef HAVE_CRYPT_R
 	struct crypt_data crypt_data = { .initialized = 0 };
 
-	crypt_out = crypt_r(password->vb_strvalue, known_good->vp_strvalue, &crypt_data);
-	if (crypt_out) cmp = strcmp(known_good->vp_strvalue, crypt_out);
+	crypt_out = crypt_r(cj->password, cj->known_good, &crypt_data);
+	if (crypt_out) cmp = strcmp(cj->known_good, crypt_out);
 #else
 	/*
 	 *	Ensure we're thread-safe, as crypt() isn't.
 	 */
 	pthread_mutex_lock(&fr_crypt_mutex);
-	crypt_out = crypt(password->vb_strvalue, known_good->vp_strvalue);
+	crypt_out = crypt(cj->password, cj->known_good);
 
 	/*
 	 *	Got something, check it within the lock.  This is
 	 *	faster than copying it to a local buffer, and the
 	 *	time spent within the lock is critical.
 	 */
-	if (crypt_out) cmp = strcmp(known_good->vp_strvalue, crypt_out);
+	if (crypt_out) cmp = strcmp(cj->known_good, crypt_out);
 	pthread_mutex_unlock(&fr_crypt_mutex);
 #endif
 
-	/*
-	 *	Error.
-	 */
-	if (!crypt_out || (cmp != 0)) {
+	cj->match = (crypt_out && (cmp == 0));
+}
+
+static unlang_action_t pap_crypt_job_result(unlang_result_t *p_result, request_t *request, pap_crypt_job_t *cj)
+{
+	bool match = cj->match;
+
+	crypto_job_free(cj->job);
+
+	if (!match) {
 		REDEBUG("Crypt digest does not match \"known good\" digest");
 		RETURN_UNLANG_REJECT;
 	}
 
 	RETURN_UNLANG_OK;
 }
+
+static unlang_action_t pap_crypt_job_resume(unlang_result_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	pap_crypt_job_result(p_result, request, talloc_get_type_abort(mctx->rctx, pap_crypt_job_t));
+
+	return pap_auth_result(p_result, request);
+}
+
+static void pap_crypt_job_signal(module_ctx_t const *mctx, UNUSED request_t *request, UNUSED fr_signal_t action)
+{
+	pap_crypt_job_t *cj = talloc_get_type_abort(mctx->rctx, pap_crypt_job_t);
+
+	crypto_job_cancel(cj->job);
+}
+
+static unlang_action_t CC_HINT(nonnull) pap_auth_crypt(unlang_result_t *p_result,
+						       module_ctx_t const *mctx, request_t *request,
+						       fr_pair_t const *known_good, fr_value_box_t const *password)
+{
+	rlm_pap_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_pap_thread_t);
+	crypto_job_t		*job;
+	pap_crypt_job_t		*cj;
+
+	/*
+	 *	Modern crypt() schemes are deliberately slow, so the
+	 *	hash is calculated outside of the worker.
+	 */
+	job = crypto_job_alloc(t->cpt);
+	MEM(cj = talloc_zero(job, pap_crypt_job_t));
+	cj->job = job;
+	MEM(cj->password = talloc_bstrndup(cj, password->vb_strvalue, password->vb_length));
+	MEM(cj->known_good = talloc_bstrndup(cj, known_good->vp_strvalue, known_good->vp_length));
+
+	if (crypto_job_submit(job, request, pap_crypt_job, cj) == 0) {
+		return unlang_module_yield(request, pap_crypt_job_resume, pap_crypt_job_signal, ~FR_SIGNAL_CANCEL, cj);
+	}
+
+	return pap_crypt_job_result(p_result, request, cj);
+}
 #endif
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_md5(unlang_result_t *p_result,
-						     UNUSED rlm_pap_t const *inst, request_t *request,
+						     UNUSED module_ctx_t const *mctx, request_t *request,
 						     fr_pair_t const *known_good, fr_value_box_t const *password)
 {
 	uint8_t digest[MD5_DIGEST_LENGTH];
@@ -259,7 +339,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_md5(unlang_result_t *p_result,
 
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_smd5(unlang_result_t *p_result,
-						      UNUSED rlm_pap_t const *inst, request_t *request,
+						      UNUSED module_ctx_t const *mctx, request_t *request,
 						      fr_pair_t const *known_good, fr_value_box_t const *password)
 {
 	fr_md5_ctx_t	*md5_ctx;
@@ -292,7 +372,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_smd5(unlang_result_t *p_result,
 }
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_sha1(unlang_result_t *p_result,
-						      UNUSED rlm_pap_t const *inst, request_t *request,
+						      UNUSED module_ctx_t const *mctx, request_t *request,
 						      fr_pair_t const *known_good, fr_value_box_t const *password)
 {
 	fr_sha1_ctx	sha1_context;
@@ -320,7 +400,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_sha1(unlang_result_t *p_result,
 }
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_ssha1(unlang_result_t *p_result,
-						       UNUSED rlm_pap_t const *inst, request_t *request,
+						       UNUSED module_ctx_t const *mctx, request_t *request,
 						       fr_pair_t const *known_good, fr_value_box_t const *password)
 {
 	fr_sha1_ctx	sha1_context;
@@ -353,7 +433,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_ssha1(unlang_result_t *p_result
 
 #ifdef HAVE_OPENSSL_EVP_H
 static unlang_action_t CC_HINT(nonnull) pap_auth_evp_md(unlang_result_t *p_result,
-						    	UNUSED rlm_pap_t const *inst, request_t *request,
+						    	UNUSED module_ctx_t const *mctx, request_t *request,
 						    	fr_pair_t const *known_good, fr_value_box_t const *password,
 						    	char const *name, EVP_MD const *md)
 {
@@ -382,7 +462,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_evp_md(unlang_result_t *p_resul
 }
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_evp_md_salted(unlang_result_t *p_result,
-							       UNUSED rlm_pap_t const *inst, request_t *request,
+							       UNUSED module_ctx_t const *mctx, request_t *request,
 							       fr_pair_t const *known_good, fr_value_box_t const *password,
 							       char const *name, EVP_MD const *md)
 {
@@ -422,10 +502,10 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_evp_md_salted(unlang_result_t *
  */
 #define PAP_AUTH_EVP_MD(_func, _new_func, _name, _md) \
 static unlang_action_t CC_HINT(nonnull) _new_func(unlang_result_t *p_result, \
-					          rlm_pap_t const *inst, request_t *request, \
+					          module_ctx_t const *mctx, request_t *request, \
 						  fr_pair_t const *known_good, fr_value_box_t const *password) \
 { \
-	return _func(p_result, inst, request, known_good, password, _name, _md); \
+	return _func(p_result, mctx, request, known_good, password, _name, _md); \
 }
 
 PAP_AUTH_EVP_MD(pap_auth_evp_md, pap_auth_sha2_224, "SHA2-224", EVP_sha224())
@@ -446,9 +526,138 @@ PAP_AUTH_EVP_MD(pap_auth_evp_md_salted, pap_auth_ssha3_256, "SSHA3-256", EVP_sha
 PAP_AUTH_EVP_MD(pap_auth_evp_md_salted, pap_auth_ssha3_384, "SSHA3-384", EVP_sha3_384())
 PAP_AUTH_EVP_MD(pap_auth_evp_md_salted, pap_auth_ssha3_512, "SSHA3-512", EVP_sha3_512())
 
+/** Data for calculating a PBKDF2 hash in the crypto pool
+ *
+ */
+typedef struct {
+	crypto_job_t	*job;
+	char const	*name;				//!< Of the scheme, for logging.
+
+	EVP_MD const	*evp_md;
+	uint32_t	iterations;
+	uint8_t		*password;
+	size_t		password_len;
+	uint8_t		*salt;
+	size_t		salt_len;
+	uint8_t		*hash;				//!< "known good" hash.
+	size_t		hash_len;
+
+	uint8_t		digest[EVP_MAX_MD_SIZE];	//!< Calculated hash.
+	size_t		digest_len;
+	bool		failed;
+} pap_pbkdf2_job_t;
+
+static void pap_pbkdf2_job(void *uctx)
+{
+	pap_pbkdf2_job_t *pj = uctx;
+
+	if (PKCS5_PBKDF2_HMAC((char const *)pj->password, (int)pj->password_len,
+			      (unsigned char const *)pj->salt, (int)pj->salt_len,
+			      (int)pj->iterations,
+			      pj->evp_md,
+			      (int)pj->digest_len, (unsigned char *)pj->digest) == 0) {
+		/*
+		 *	The error stack belongs to whichever thread ran
+		 *	the job, so it can't be logged to the request.
+		 */
+		ERR_clear_error();
+		pj->failed = true;
+	}
+}
+
+static unlang_action_t pap_pbkdf2_job_result(unlang_result_t *p_result, request_t *request, pap_pbkdf2_job_t *pj)
+{
+	rlm_rcode_t rcode;
+
+	if (pj->failed) {
+		REDEBUG("%s digest failure", pj->name);
+		rcode = RLM_MODULE_INVALID;
+
+	} else if (fr_digest_cmp(pj->digest, pj->hash, pj->digest_len) != 0) {
+		REDEBUG("%s digest does not match \"known good\" digest", pj->name);
+		if (DEBUG_ENABLED3) {
+			REDEBUG3("Salt       : %pH", fr_box_octets(pj->salt, pj->salt_len));
+			REDEBUG3("Calculated : %pH", fr_box_octets(pj->digest, pj->digest_len));
+			REDEBUG3("Expected   : %pH", fr_box_octets(pj->hash, pj->hash_len));
+		}
+		rcode = RLM_MODULE_REJECT;
+
+	} else {
+		rcode = RLM_MODULE_OK;
+	}
+
+	crypto_job_free(pj->job);
+
+	RETURN_UNLANG_RCODE(rcode);
+}
+
+static unlang_action_t pap_pbkdf2_job_resume(unlang_result_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	pap_pbkdf2_job_result(p_result, request, talloc_get_type_abort(mctx->rctx, pap_pbkdf2_job_t));
+
+	return pap_auth_result(p_result, request);
+}
+
+static void pap_pbkdf2_job_signal(module_ctx_t const *mctx, UNUSED request_t *request, UNUSED fr_signal_t action)
+{
+	pap_pbkdf2_job_t *pj = talloc_get_type_abort(mctx->rctx, pap_pbkdf2_job_t);
+
+	crypto_job_cancel(pj->job);
+}
+
+/** Calculate a PBKDF2 hash, and compare it with the "known good" hash
+ *
+ * With high iteration counts this takes a significant amount of CPU
+ * time, so the hash is calculated in the crypto pool, and the request
+ * yields until it's done.
+ *
+ * @param[out] p_result		The result of comparing the pbkdf2 hash with the password.
+ * @param[in] mctx		Module calling context.
+ * @param[in] request		The current request.
+ * @param[in] name		Of the scheme, for logging.
+ * @param[in] evp_md		Digest to use.
+ * @param[in] digest_len	Length of the digest, and the number of bytes of hash to compare.
+ * @param[in] iterations	Number of PBKDF2 iterations.
+ * @param[in] salt		to hash the password with.
+ * @param[in] salt_len		Length of the salt.
+ * @param[in] hash		"known good" hash.
+ * @param[in] hash_len		Length of the "known good" hash.
+ * @param[in] password		to validate.
+ */
+static unlang_action_t pap_auth_pbkdf2_hash(unlang_result_t *p_result, module_ctx_t const *mctx, request_t *request,
+					    char const *name, EVP_MD const *evp_md, size_t digest_len, uint32_t iterations,
+					    uint8_t const *salt, size_t salt_len, uint8_t const *hash, size_t hash_len,
+					    fr_value_box_t const *password)
+{
+	rlm_pap_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_pap_thread_t);
+	crypto_job_t		*job;
+	pap_pbkdf2_job_t	*pj;
+
+	job = crypto_job_alloc(t->cpt);
+	MEM(pj = talloc_zero(job, pap_pbkdf2_job_t));
+	pj->job = job;
+	pj->name = name;
+	pj->evp_md = evp_md;
+	pj->iterations = iterations;
+	pj->digest_len = digest_len;
+	MEM(pj->password = talloc_memdup(pj, password->vb_octets, password->vb_length));
+	pj->password_len = password->vb_length;
+	MEM(pj->salt = talloc_memdup(pj, salt, salt_len));
+	pj->salt_len = salt_len;
+	MEM(pj->hash = talloc_memdup(pj, hash, hash_len));
+	pj->hash_len = hash_len;
+
+	if (crypto_job_submit(job, request, pap_pbkdf2_job, pj) == 0) {
+		return unlang_module_yield(request, pap_pbkdf2_job_resume, pap_pbkdf2_job_signal, ~FR_SIGNAL_CANCEL, pj);
+	}
+
+	return pap_pbkdf2_job_result(p_result, request, pj);
+}
+
 /** Validates Crypt::PBKDF2 LDAP format strings
  *
  * @param[out] p_result		The result of comparing the pbkdf2 hash with the password.
+ * @param[in] mctx		Module calling context.
  * @param[in] request		The current request.
  * @param[in] str		Raw PBKDF2 string.
  * @param[in] len		Length of string.
@@ -461,12 +670,12 @@ PAP_AUTH_EVP_MD(pap_auth_evp_md_salted, pap_auth_ssha3_512, "SSHA3-512", EVP_sha
  *	- RLM_MODULE_REJECT
  *	- RLM_MODULE_OK
  */
-static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse_digest(unlang_result_t *p_result,
+static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse_digest(unlang_result_t *p_result, module_ctx_t const *mctx,
 									    request_t *request, const uint8_t *str, size_t len,
 									    int digest_type, char iter_sep, char salt_sep,
 									    bool iter_is_base64, fr_value_box_t const *password)
 {
-	rlm_rcode_t		rcode = RLM_MODULE_INVALID;
+	unlang_action_t		action;
 
 	uint8_t const		*p, *q, *end;
 	ssize_t			slen;
@@ -479,7 +688,6 @@ static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse_digest(unla
 	uint8_t			*salt = NULL;
 	size_t			salt_len;
 	uint8_t			hash[EVP_MAX_MD_SIZE];
-	uint8_t			digest[EVP_MAX_MD_SIZE];
 
 	/*
 	 *	Parse PBKDF string for given digest = <iterations><iter_sep>b64(<salt>)<salt_sep>b64(<hash>)
@@ -649,35 +857,22 @@ static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse_digest(unla
 	/*
 	 *	Hash and compare
 	 */
-	if (PKCS5_PBKDF2_HMAC((char const *)password->vb_octets, (int)password->vb_length,
-			      (unsigned char const *)salt, (int)salt_len,
-			      (int)iterations,
-			      evp_md,
-			      (int)digest_len, (unsigned char *)digest) == 0) {
-		fr_tls_log(request, "PBKDF2 digest failure");
-		goto finish;
-	}
+	action = pap_auth_pbkdf2_hash(p_result, mctx, request, "PBKDF2", evp_md, digest_len, iterations,
+				      salt, salt_len, hash, digest_len, password);
+	talloc_free(salt);
 
-	if (fr_digest_cmp(digest, hash, (size_t)digest_len) != 0) {
-		REDEBUG("PBKDF2 digest does not match \"known good\" digest");
-		if (!DEBUG_ENABLED3) RETURN_UNLANG_REJECT;
-		REDEBUG3("Salt       : %pH", fr_box_octets(salt, salt_len));
-		REDEBUG3("Calculated : %pH", fr_box_octets(digest, digest_len));
-		REDEBUG3("Expected   : %pH", fr_box_octets(hash, slen));
-		rcode = RLM_MODULE_REJECT;
-	} else {
-		rcode = RLM_MODULE_OK;
-	}
+	return action;
 
 finish:
 	talloc_free(salt);
 
-	RETURN_UNLANG_RCODE(rcode);
+	RETURN_UNLANG_INVALID;
 }
 
 /** Validates Crypt::PBKDF2 LDAP format strings
  *
  * @param[out] p_result		The result of comparing the pbkdf2 hash with the password.
+ * @param[in] mctx		Module calling context.
  * @param[in] request		The current request.
  * @param[in] str		Raw PBKDF2 string.
  * @param[in] len		Length of string.
@@ -692,7 +887,7 @@ finish:
  *	- RLM_MODULE_REJECT
  *	- RLM_MODULE_OK
  */
-static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse(unlang_result_t *p_result,
+static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse(unlang_result_t *p_result, module_ctx_t const *mctx,
 								     request_t *request, const uint8_t *str, size_t len,
 								     fr_table_num_sorted_t const hash_names[], size_t hash_names_len,
 								     char scheme_sep, char iter_sep, char salt_sep,
@@ -726,14 +921,14 @@ static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse(unlang_resu
 
 	p = q + 1;
 
-	return pap_auth_pbkdf2_parse_digest(p_result, request, p, end - p, digest_type, iter_sep, salt_sep, iter_is_base64, password);
+	return pap_auth_pbkdf2_parse_digest(p_result, mctx, request, p, end - p, digest_type, iter_sep, salt_sep, iter_is_base64, password);
 
 finish:
 	RETURN_UNLANG_RCODE(rcode);
 }
 
 static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(unlang_result_t *p_result,
-							       UNUSED rlm_pap_t const *inst,
+							       module_ctx_t const *mctx,
 							       request_t *request,
 							       fr_pair_t const *known_good, fr_value_box_t const *password)
 {
@@ -757,7 +952,7 @@ static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(unlang_result_t *
 	if (*p != '$') {
 		if ((size_t)(end - p) >= sizeof("{PBKDF2-") && (memcmp(p, "{PBKDF2-", sizeof("{PBKDF2-") - 1) == 0)) {
 			p += sizeof("{PBKDF2-") - 1;
-			return pap_auth_pbkdf2_parse(p_result, request, p, end - p,
+			return pap_auth_pbkdf2_parse(p_result, mctx, request, p, end - p,
 						     pbkdf2_passlib_names, pbkdf2_passlib_names_len,
 						     '}', '$', '$', false, password);
 		} else {
@@ -768,7 +963,7 @@ static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(unlang_result_t *
 				q = memchr(p, '}', end - p);
 				p = q + 1;
 			}
-			return pap_auth_pbkdf2_parse(p_result, request, p, end - p,
+			return pap_auth_pbkdf2_parse(p_result, mctx, request, p, end - p,
 						     pbkdf2_crypt_names, pbkdf2_crypt_names_len,
 						     ':', ':', ':', true, password);
 		}
@@ -781,7 +976,7 @@ static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(unlang_result_t *
 	 */
 	if ((size_t)(end - p) >= sizeof("$PBKDF2$") && (memcmp(p, "$PBKDF2$", sizeof("$PBKDF2$") - 1) == 0)) {
 		p += sizeof("$PBKDF2$") - 1;
-		return pap_auth_pbkdf2_parse(p_result, request, p, end - p,
+		return pap_auth_pbkdf2_parse(p_result, mctx, request, p, end - p,
 					     pbkdf2_crypt_names, pbkdf2_crypt_names_len,
 					     ':', ':', '$', false, password);
 	}
@@ -795,7 +990,7 @@ static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(unlang_result_t *
 	 */
 	if ((size_t)(end - p) >= sizeof("$pbkdf2-") && (memcmp(p, "$pbkdf2-", sizeof("$pbkdf2-") - 1) == 0)) {
 		p += sizeof("$pbkdf2-") - 1;
-		return pap_auth_pbkdf2_parse(p_result, request, p, end - p,
+		return pap_auth_pbkdf2_parse(p_result, mctx, request, p, end - p,
 					     pbkdf2_passlib_names, pbkdf2_passlib_names_len,
 					     '$', '$', '$', false, password);
 	}
@@ -811,7 +1006,7 @@ static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(unlang_result_t *
  * 	{PBKDF2-<digest>}<rounds>$<b64_salt>$<b64_hash>
  */
 static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2_sha1(unlang_result_t *p_result,
-								    UNUSED rlm_pap_t const *inst,
+								    module_ctx_t const *mctx,
 								    request_t *request,
 								    fr_pair_t const *known_good, fr_value_box_t const *password)
 {
@@ -822,11 +1017,11 @@ static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2_sha1(unlang_resul
 		RETURN_UNLANG_INVALID;
 	}
 
-	return pap_auth_pbkdf2_parse_digest(p_result, request, p, end - p, FR_SSHA1, '$', '$', false, password);
+	return pap_auth_pbkdf2_parse_digest(p_result, mctx, request, p, end - p, FR_SSHA1, '$', '$', false, password);
 }
 
 static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2_sha256(unlang_result_t *p_result,
-								      UNUSED rlm_pap_t const *inst,
+								      module_ctx_t const *mctx,
 								      request_t *request,
 								      fr_pair_t const *known_good, fr_value_box_t const *password)
 {
@@ -837,11 +1032,11 @@ static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2_sha256(unlang_res
 		RETURN_UNLANG_INVALID;
 	}
 
-	return pap_auth_pbkdf2_parse_digest(p_result, request, p, end - p, FR_SSHA2_256, '$', '$', false, password);
+	return pap_auth_pbkdf2_parse_digest(p_result, mctx, request, p, end - p, FR_SSHA2_256, '$', '$', false, password);
 }
 
 static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2_sha512(unlang_result_t *p_result,
-								      UNUSED rlm_pap_t const *inst,
+								      module_ctx_t const *mctx,
 								      request_t *request,
 								      fr_pair_t const *known_good, fr_value_box_t const *password)
 {
@@ -852,7 +1047,7 @@ static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2_sha512(unlang_res
 		RETURN_UNLANG_INVALID;
 	}
 
-	return pap_auth_pbkdf2_parse_digest(p_result, request, p, end - p, FR_SSHA2_512, '$', '$', false, password);
+	return pap_auth_pbkdf2_parse_digest(p_result, mctx, request, p, end - p, FR_SSHA2_512, '$', '$', false, password);
 }
 
 /*
@@ -867,7 +1062,7 @@ static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2_sha512(unlang_res
  *	256 bytes hash
  */
 static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2_sha256_legacy(unlang_result_t *p_result,
-									     UNUSED rlm_pap_t const *inst,
+									     module_ctx_t const *mctx,
 									     request_t *request,
 									     fr_pair_t const *known_good, fr_value_box_t const *password)
 {
@@ -890,7 +1085,6 @@ static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2_sha256_legacy(unl
 
 	EVP_MD const		*evp_md = EVP_sha256();
 	size_t			digest_len = SHA256_DIGEST_LENGTH;
-	uint8_t			digest[SHA256_DIGEST_LENGTH];
 
 	if ((end - p) != PBKDF2_SHA256_LEGACY_B64_LENGTH) {
 		REDEBUG("Password.With-Header {PBKDF2_SHA256} has incorrect size %zd instead of %d.", known_good->vp_length, PBKDF2_SHA256_LEGACY_B64_LENGTH);
@@ -917,30 +1111,14 @@ static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2_sha256_legacy(unl
 		RETURN_UNLANG_INVALID;
 	}
 
-	if (PKCS5_PBKDF2_HMAC((char const *)password->vb_octets, (int)password->vb_length,
-			      (unsigned char const *)pbkdf2_buf.salt, (int)PBKDF2_SHA256_LEGACY_SALT_LENGTH,
-			      (int)pbkdf2_buf.iterations,
-			      evp_md,
-			      (int)digest_len, (unsigned char *)digest) == 0) {
-		fr_tls_log(request, "PBKDF2_SHA256 digest failure");
-		RETURN_UNLANG_INVALID;
-	}
-
-	if (fr_digest_cmp(digest, pbkdf2_buf.hash, (size_t)digest_len) != 0) {
-		REDEBUG("PBKDF2_SHA256 digest does not match \"known good\" digest");
-		if (!DEBUG_ENABLED3) RETURN_UNLANG_REJECT;
-		REDEBUG3("Salt       : %pH", fr_box_octets(pbkdf2_buf.salt, PBKDF2_SHA256_LEGACY_SALT_LENGTH));
-		REDEBUG3("Calculated : %pH", fr_box_octets(digest, digest_len));
-		REDEBUG3("Expected   : %pH", fr_box_octets(pbkdf2_buf.hash, PBKDF2_SHA256_LEGACY_HASH_LENGTH));
-		RETURN_UNLANG_RCODE(RLM_MODULE_REJECT);
-	} else {
-		RETURN_UNLANG_RCODE(RLM_MODULE_OK);
-	}
+	return pap_auth_pbkdf2_hash(p_result, mctx, request, "PBKDF2_SHA256", evp_md, digest_len, pbkdf2_buf.iterations,
+				    pbkdf2_buf.salt, PBKDF2_SHA256_LEGACY_SALT_LENGTH,
+				    pbkdf2_buf.hash, PBKDF2_SHA256_LEGACY_HASH_LENGTH, password);
 }
 #endif
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_nt(unlang_result_t *p_result,
-						    UNUSED rlm_pap_t const *inst, request_t *request,
+						    UNUSED module_ctx_t const *mctx, request_t *request,
 						    fr_pair_t const *known_good, fr_value_box_t const *password)
 {
 	ssize_t len;
@@ -975,7 +1153,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_nt(unlang_result_t *p_result,
 }
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_ns_mta_md5(unlang_result_t *p_result,
-							    UNUSED rlm_pap_t const *inst, request_t *request,
+							    UNUSED module_ctx_t const *mctx, request_t *request,
 							    fr_pair_t const *known_good, fr_value_box_t const *password)
 {
 	uint8_t digest[128];
@@ -1040,7 +1218,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_ns_mta_md5(unlang_result_t *p_r
  *
  */
 static unlang_action_t CC_HINT(nonnull) pap_auth_dummy(unlang_result_t *p_result,
-						       UNUSED rlm_pap_t const *inst, UNUSED request_t *request,
+						       UNUSED module_ctx_t const *mctx, UNUSED request_t *request,
 						       UNUSED fr_pair_t const *known_good, UNUSED fr_value_box_t const *password)
 {
 	RETURN_UNLANG_FAIL;
@@ -1098,6 +1276,7 @@ static unlang_action_t CC_HINT(nonnull) mod_authenticate(unlang_result_t *p_resu
 	rlm_pap_t const 	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_pap_t);
 	fr_pair_t		*known_good;
 	pap_auth_func_t		auth_func;
+	unlang_action_t		action;
 	bool			ephemeral;
 	pap_call_env_t		*env_data = talloc_get_type_abort(mctx->env_data, pap_call_env_t);
 
@@ -1150,24 +1329,14 @@ static unlang_action_t CC_HINT(nonnull) mod_authenticate(unlang_result_t *p_resu
 	}
 
 	/*
-	 *	Authenticate, and return.
+	 *	Authenticate, and return.  Functions which yield
+	 *	have copied anything they need from known_good.
 	 */
-	auth_func(p_result, inst, request, known_good, &env_data->password);
+	action = auth_func(p_result, mctx, request, known_good, &env_data->password);
 	if (ephemeral) TALLOC_FREE(known_good);
-	switch (p_result->rcode) {
-	case RLM_MODULE_REJECT:
-		REDEBUG("Password incorrect");
-		break;
-
-	case RLM_MODULE_OK:
-		RDEBUG2("User authenticated successfully");
-		break;
-
-	default:
-		break;
-	}
+	if (action == UNLANG_ACTION_YIELD) return action;
 
-	return UNLANG_ACTION_CALCULATE_RESULT;
+	return pap_auth_result(p_result, request);
 }
 
 static int mod_instantiate(module_inst_ctx_t const *mctx)
@@ -1183,6 +1352,19 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	return 0;
 }
 
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_pap_thread_t *t = talloc_get_type_abort(mctx->thread, rlm_pap_thread_t);
+
+	t->cpt = crypto_pool_thread_alloc(t, mctx->el);
+	if (!t->cpt) {
+		PERROR("Failed allocating crypto pool state");
+		return -1;
+	}
+
+	return 0;
+}
+
 static int mod_load(void)
 {
 	size_t	i, j = 0;
@@ -1249,6 +1431,12 @@ static void mod_unload(void)
  *	The server will then take care of ensuring that the module
  *	is single-threaded.
  */
+extern global_lib_autoinst_t const * const rlm_pap_lib[];
+global_lib_autoinst_t const * const rlm_pap_lib[] = {
+	&crypto_pool_autoinst,
+	GLOBAL_LIB_TERMINATOR
+};
+
 extern module_rlm_t rlm_pap;
 module_rlm_t rlm_pap = {
 	.common = {
@@ -1258,7 +1446,11 @@ module_rlm_t rlm_pap = {
 		.onload		= mod_load,
 		.unload		= mod_unload,
 		.config		= module_config,
-		.instantiate	= mod_instantiate
+		.instantiate	= mod_instantiate,
+
+		.thread_inst_size	= sizeof(rlm_pap_thread_t),
+		.thread_inst_type	= "rlm_pap_thread_t",
+		.thread_instantiate	= mod_thread_instantiate
 	},
 	.method_group = {
 		.bindings = (module_method_binding_t[]){
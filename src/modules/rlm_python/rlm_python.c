@@ -51,6 +51,7 @@ typedef struct {
 	char const	*function_name;		//!< String name of function in module.
 	char		*name1;			//!< Section name1 where this is called.
 	char		*name2;			//!< Section name2 where this is called.
+	unsigned int	idx;			//!< Index of the copy loaded into per-thread interpreters.
 	fr_rb_node_t	node;			//!< Entry in tree of Python functions.
 } python_func_def_t;
 
@@ -64,13 +65,13 @@ typedef struct {
 	char const	*def_module_name;	//!< Default module for Python functions
 	fr_rb_tree_t	funcs;			//!< Tree of function calls found by call_env parser
 	bool		funcs_init;		//!< Has the tree been initialised.
+	unsigned int	num_funcs;		//!< Number of functions in the tree.
+
+	bool		per_thread_interpreter;	//!< Create a separate interpreter for each thread.
 
 	python_func_def_t
 	instantiate,
 	detach;
-
-	PyObject	*pythonconf_dict;	//!< Configuration parameters defined in the module
-						//!< made available to the python script.
 } rlm_python_t;
 
 /** Global config for python library
@@ -94,6 +95,18 @@ typedef struct {
 typedef struct {
 	rlm_python_t const	*inst;		//!< Current module instance data.
 	PyThreadState		*state;		//!< Module instance/thread specific state.
+
+	/*
+	 *	Only used when per_thread_interpreter is set, in which
+	 *	case state is the only thread state of an interpreter
+	 *	owned by this thread.
+	 */
+	PyObject		*module;	//!< Thread specific freeradius module.
+	python_func_def_t	*funcs;		//!< Functions loaded into the thread specific interpreter,
+						///< indexed by python_func_def_t.idx.
+	python_func_def_t
+	instantiate,
+	detach;
 } rlm_python_thread_t;
 
 /** Additional fields for pairs
@@ -115,6 +128,20 @@ typedef struct {
 	PyObject		*state;		//!< Session state list.
 } py_freeradius_request_t;
 
+/** Per-interpreter state of the freeradius module
+ *
+ * The types are created separately for each interpreter, so that
+ * interpreters with their own GIL never share Python objects.
+ */
+typedef struct {
+	PyTypeObject		*pair_type;		//!< freeradius.Pair
+	PyTypeObject		*value_pair_type;	//!< freeradius.ValuePair
+	PyTypeObject		*grouping_pair_type;	//!< freeradius.GroupingPair
+	PyTypeObject		*pair_list_type;	//!< freeradius.PairList
+	PyTypeObject		*request_type;		//!< freeradius.Request
+	PyTypeObject		*state_type;		//!< freeradius.State
+} py_freeradius_mod_state_t;
+
 /** Wrapper around a python instance
  *
  * This is added to the FreeRADIUS module to allow us to
@@ -130,14 +157,23 @@ typedef struct {
 static void			*python_dlhandle;
 static PyThreadState		*global_interpreter;	//!< Our first interpreter.
 
-static rlm_python_t const	*current_inst = NULL;	//!< Used for communication with inittab functions.
-static CONF_SECTION		*current_conf;		//!< Used for communication with inittab functions.
-static rlm_python_thread_t	*current_t;		//!< Used for communicating with object init function.
+/*
+ *	These are thread local, as per-thread interpreters are created by
+ *	the worker threads concurrently.
+ */
+static _Thread_local rlm_python_t const	*current_inst;	//!< Used for communication with inittab functions.
+static _Thread_local CONF_SECTION	*current_conf;	//!< Used for communication with inittab functions.
+static _Thread_local rlm_python_thread_t *current_t;	//!< Used for communicating with object init function.
 
 static PyObject *py_freeradius_log(UNUSED PyObject *self, PyObject *args, PyObject *kwds);
 
 static int	py_freeradius_state_init(PyObject *self, UNUSED PyObject *args, UNUSED PyObject *kwds);
 
+static int	python_module_exec(PyObject *module);
+static int	python_module_traverse(PyObject *module, visitproc visit, void *arg);
+static int	python_module_clear(PyObject *module);
+static void	python_module_free(void *module);
+
 static PyObject	*py_freeradius_pair_map_subscript(PyObject *self, PyObject *attr);
 static PyObject *py_freeradius_attribute_instance(PyObject *self, PyObject *attr);
 static int	py_freeradius_pair_map_set(PyObject* self, PyObject* attr, PyObject* value);
@@ -175,14 +211,17 @@ global_lib_autoinst_t const * const rlm_python_lib[] = {
 };
 
 /*
- *	As of Python 3.8 the GIL will be per-interpreter
- *	If there are still issues with CEXTs,
- *	multiple interpreters and the GIL at that point
- *	users can build rlm_python against Python 3.8
- *	and the horrible hack of using a single interpreter
- *	for all instances of rlm_python will no longer be
- *	required.
+ *	Each instance of rlm_python has its own interpreter, which
+ *	all worker threads share.  If per_thread_interpreter is set,
+ *	each worker thread instead creates its own interpreter.
+ *
+ *	As of Python 3.12 those interpreters are created with their
+ *	own GIL, so worker threads execute Python code in parallel.
+ *	Against older versions they still share the main GIL.
  */
+#if PY_VERSION_HEX >= 0x030C0000
+#  define PYTHON_OWN_GIL 1
+#endif
 
 /*
  *	A mapping of configuration file names to internal variables.
@@ -199,6 +238,8 @@ static conf_parser_t module_config[] = {
 
 	{ FR_CONF_OFFSET("module", rlm_python_t, def_module_name) },
 
+	{ FR_CONF_OFFSET("per_thread_interpreter", rlm_python_t, per_thread_interpreter), .dflt = "no" },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -239,17 +280,32 @@ static struct {
 	{ NULL, 0 },
 };
 
+/** Free an instance of one of the freeradius types
+ *
+ * Instances of heap types hold a reference to their type.
+ */
+static void py_freeradius_object_dealloc(PyObject *self)
+{
+	PyTypeObject *type = Py_TYPE(self);
+
+	type->tp_free(self);
+	Py_DECREF(type);
+}
+
 /** The class which all pair types inherit from
  *
  */
-static PyTypeObject py_freeradius_pair_def = {
-	PyVarObject_HEAD_INIT(NULL, 0)
-	.tp_name = "freeradius.Pair",
-	.tp_doc = "An attribute value pair",
-	.tp_basicsize = sizeof(py_freeradius_pair_t),
-	.tp_itemsize = 0,
-	.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
-	.tp_new = PyType_GenericNew,
+static PyType_Spec py_freeradius_pair_spec = {
+	.name = "freeradius.Pair",
+	.basicsize = sizeof(py_freeradius_pair_t),
+	.itemsize = 0,
+	.flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+	.slots = (PyType_Slot[]){
+		{ Py_tp_doc, UNCONST(char *, "An attribute value pair") },
+		{ Py_tp_new, PyType_GenericNew },
+		{ Py_tp_dealloc, py_freeradius_object_dealloc },
+		{ 0, NULL }
+	}
 };
 
 /** How to access "value" attribute of a pair
@@ -269,17 +325,17 @@ static PyGetSetDef py_freeradius_pair_getset[] = {
 /** Contains a value pair of a specific type
  *
  */
-static PyTypeObject py_freeradius_value_pair_def = {
-	PyVarObject_HEAD_INIT(NULL, 0)
-	.tp_name = "freeradius.ValuePair",
-	.tp_doc = "A value pair, i.e. one of the type string, integer, ipaddr etc...)",
-	.tp_flags = Py_TPFLAGS_DEFAULT,
-	.tp_base = &py_freeradius_pair_def,
-	.tp_getset = py_freeradius_pair_getset,
-	.tp_str = py_freeradius_pair_str,
-	.tp_as_mapping = &(PyMappingMethods) {
-		.mp_subscript = py_freeradius_attribute_instance,
-		.mp_ass_subscript = py_freeradius_pair_map_set,
+static PyType_Spec py_freeradius_value_pair_spec = {
+	.name = "freeradius.ValuePair",
+	.basicsize = sizeof(py_freeradius_pair_t),
+	.flags = Py_TPFLAGS_DEFAULT,
+	.slots = (PyType_Slot[]){
+		{ Py_tp_doc, UNCONST(char *, "A value pair, i.e. one of the type string, integer, ipaddr etc...)") },
+		{ Py_tp_getset, py_freeradius_pair_getset },
+		{ Py_tp_str, py_freeradius_pair_str },
+		{ Py_mp_subscript, py_freeradius_attribute_instance },
+		{ Py_mp_ass_subscript, py_freeradius_pair_map_set },
+		{ 0, NULL }
 	}
 };
 
@@ -289,30 +345,30 @@ static PyTypeObject py_freeradius_value_pair_def = {
  * i.e. foo['child-of-foo'].
  *
  */
-static PyTypeObject py_freeradius_grouping_pair_def = {
-	PyVarObject_HEAD_INIT(NULL, 0)
-	.tp_name = "freeradius.GroupingPair",
-	.tp_doc = "A grouping pair, i.e. one of the type group, tlv, vsa or vendor.  "
-	          "Children are accessible via the mapping protocol i.e. foo['child-of-foo]",
-	.tp_flags = Py_TPFLAGS_DEFAULT,
-	.tp_base = &py_freeradius_pair_def,
-	.tp_as_mapping = &(PyMappingMethods){
-		.mp_subscript = py_freeradius_pair_map_subscript,
-		.mp_ass_subscript = py_freeradius_pair_map_set,
+static PyType_Spec py_freeradius_grouping_pair_spec = {
+	.name = "freeradius.GroupingPair",
+	.basicsize = sizeof(py_freeradius_pair_t),
+	.flags = Py_TPFLAGS_DEFAULT,
+	.slots = (PyType_Slot[]){
+		{ Py_tp_doc, UNCONST(char *, "A grouping pair, i.e. one of the type group, tlv, vsa or vendor.  "
+					     "Children are accessible via the mapping protocol i.e. foo['child-of-foo]") },
+		{ Py_mp_subscript, py_freeradius_pair_map_subscript },
+		{ Py_mp_ass_subscript, py_freeradius_pair_map_set },
+		{ 0, NULL }
 	}
 };
 
 /** Each instance contains a top level list (i.e. request, reply, control, session-state)
  */
-static PyTypeObject py_freeradius_pair_list_def = {
-	PyVarObject_HEAD_INIT(NULL, 0)
-	.tp_name = "freeradius.PairList",
-	.tp_doc = "A list of objects of freeradius.GroupingPairList and freeradius.ValuePair",
-	.tp_flags = Py_TPFLAGS_DEFAULT,
-	.tp_base = &py_freeradius_pair_def,
-	.tp_as_mapping = &(PyMappingMethods){
-		.mp_subscript = py_freeradius_pair_map_subscript,
-		.mp_ass_subscript = py_freeradius_pair_map_set,
+static PyType_Spec py_freeradius_pair_list_spec = {
+	.name = "freeradius.PairList",
+	.basicsize = sizeof(py_freeradius_pair_t),
+	.flags = Py_TPFLAGS_DEFAULT,
+	.slots = (PyType_Slot[]){
+		{ Py_tp_doc, UNCONST(char *, "A list of objects of freeradius.GroupingPairList and freeradius.ValuePair") },
+		{ Py_mp_subscript, py_freeradius_pair_map_subscript },
+		{ Py_mp_ass_subscript, py_freeradius_pair_map_set },
+		{ 0, NULL }
 	}
 };
 
@@ -348,26 +404,32 @@ static PyMemberDef py_freeradius_request_attrs[] = {
 	{ NULL }	/* Terminator */
 };
 
-static PyTypeObject py_freeradius_request_def = {
-	PyVarObject_HEAD_INIT(NULL, 0)
-	.tp_name = "freeradius.Request",
-	.tp_doc = "freeradius request handle",
-	.tp_basicsize = sizeof(py_freeradius_request_t),
-	.tp_itemsize = 0,
-	.tp_flags = Py_TPFLAGS_DEFAULT,
-	.tp_new = PyType_GenericNew,
-	.tp_members = py_freeradius_request_attrs
+static PyType_Spec py_freeradius_request_spec = {
+	.name = "freeradius.Request",
+	.basicsize = sizeof(py_freeradius_request_t),
+	.itemsize = 0,
+	.flags = Py_TPFLAGS_DEFAULT,
+	.slots = (PyType_Slot[]){
+		{ Py_tp_doc, UNCONST(char *, "freeradius request handle") },
+		{ Py_tp_new, PyType_GenericNew },
+		{ Py_tp_dealloc, py_freeradius_object_dealloc },
+		{ Py_tp_members, py_freeradius_request_attrs },
+		{ 0, NULL }
+	}
 };
 
-static PyTypeObject py_freeradius_state_def = {
-	PyVarObject_HEAD_INIT(NULL, 0)
-	.tp_name = "freeradius.State",
-	.tp_doc = "Private state data",
-	.tp_basicsize = sizeof(py_freeradius_state_t),
-	.tp_itemsize = 0,
-	.tp_flags = Py_TPFLAGS_DEFAULT,
-	.tp_new = PyType_GenericNew,
-	.tp_init = py_freeradius_state_init
+static PyType_Spec py_freeradius_state_spec = {
+	.name = "freeradius.State",
+	.basicsize = sizeof(py_freeradius_state_t),
+	.itemsize = 0,
+	.flags = Py_TPFLAGS_DEFAULT,
+	.slots = (PyType_Slot[]){
+		{ Py_tp_doc, UNCONST(char *, "Private state data") },
+		{ Py_tp_new, PyType_GenericNew },
+		{ Py_tp_dealloc, py_freeradius_object_dealloc },
+		{ Py_tp_init, py_freeradius_state_init },
+		{ 0, NULL }
+	}
 };
 
 #ifndef _PyCFunction_CAST
@@ -397,14 +459,55 @@ static PyMethodDef py_freeradius_methods[] = {
 	{ NULL, NULL, 0, NULL },
 };
 
+/*
+ *	The module is initialised in multiple phases, so each
+ *	interpreter gets its own copy of the module and its types.
+ *	This is required to import it into interpreters which
+ *	have their own GIL.
+ *
+ *	This is done whether or not per_thread_interpreter is set.
+ *	With a single interpreter there is one copy of the module,
+ *	and the only difference visible to Python code is that the
+ *	types are heap types rather than static ones.
+ */
+static PyModuleDef_Slot py_freeradius_slots[] = {
+	{ Py_mod_exec, python_module_exec },
+#ifdef PYTHON_OWN_GIL
+	{ Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED },
+#endif
+	{ 0, NULL }
+};
+
 static PyModuleDef py_freeradius_def = {
 	PyModuleDef_HEAD_INIT,
 	.m_name = "freeradius",
 	.m_doc = "FreeRADIUS python module",
-	.m_size = 0,
-	.m_methods = py_freeradius_methods
+	.m_size = sizeof(py_freeradius_mod_state_t),
+	.m_methods = py_freeradius_methods,
+	.m_slots = py_freeradius_slots,
+	.m_traverse = python_module_traverse,
+	.m_clear = python_module_clear,
+	.m_free = python_module_free
 };
 
+/** Return the module state of the interpreter which created an object
+ *
+ * @param[in] self	an instance of one of the freeradius types.
+ */
+static inline CC_HINT(always_inline) py_freeradius_mod_state_t *py_freeradius_mod_state(PyObject *self)
+{
+#if PY_VERSION_HEX >= 0x03090000
+	return PyType_GetModuleState(Py_TYPE(self));
+#else
+	PyObject *module;
+
+	module = PyImport_AddModule("freeradius");	/* Borrowed reference to this interpreter's copy */
+	if (unlikely(!module)) return NULL;
+
+	return PyModule_GetState(module);
+#endif
+}
+
 /** How to compare two Python calls
  *
  */
@@ -432,7 +535,7 @@ static inline CC_HINT(always_inline) py_freeradius_state_t *rlm_python_state_obj
 	if (!dict) {
 		PyObject *module;
 
-		module = PyState_FindModule(&py_freeradius_def);
+		module = PyImport_AddModule("freeradius");
 		if (unlikely(!module)) return NULL;
 
 		dict = PyModule_GetDict(module);
@@ -522,6 +625,7 @@ static PyObject *py_freeradius_attribute_instance(PyObject *self, PyObject *attr
 {
 	long			index;
 	py_freeradius_pair_t	*pair, *init_pair = (py_freeradius_pair_t *)self;
+	py_freeradius_mod_state_t *mod_state = py_freeradius_mod_state(self);
 
 	if (!PyLong_CheckExact(attr)) Py_RETURN_NONE;
 	index = PyLong_AsLong(attr);
@@ -533,10 +637,10 @@ static PyObject *py_freeradius_attribute_instance(PyObject *self, PyObject *attr
 	if (index == 0) return self;
 
 	if (fr_type_is_leaf(init_pair->da->type)) {
-		pair = PyObject_New(py_freeradius_pair_t, (PyTypeObject *)&py_freeradius_value_pair_def);
+		pair = PyObject_New(py_freeradius_pair_t, mod_state->value_pair_type);
 
 	} else if (fr_type_is_struct(init_pair->da->type)) {
-		pair = PyObject_New(py_freeradius_pair_t, (PyTypeObject *)&py_freeradius_grouping_pair_def);
+		pair = PyObject_New(py_freeradius_pair_t, mod_state->grouping_pair_type);
 	} else {
 		PyErr_SetString(PyExc_AttributeError, "Unsupported data type");
 		return NULL;
@@ -564,6 +668,7 @@ static PyObject *py_freeradius_attribute_instance(PyObject *self, PyObject *attr
 static PyObject *py_freeradius_pair_map_subscript(PyObject *self, PyObject *attr)
 {
 	py_freeradius_pair_t	*our_self = (py_freeradius_pair_t *)self;
+	py_freeradius_mod_state_t *mod_state = py_freeradius_mod_state(self);
 	char const		*attr_name;
 	ssize_t			len;
 	request_t		*request = rlm_python_get_request();
@@ -583,7 +688,7 @@ static PyObject *py_freeradius_pair_map_subscript(PyObject *self, PyObject *attr
 	}
 	attr_name = PyUnicode_AsUTF8AndSize(attr, &len);
 
-	if (PyObject_IsInstance(self, (PyObject *)&py_freeradius_pair_list_def)) {
+	if (PyObject_IsInstance(self, (PyObject *)mod_state->pair_list_type)) {
 		fr_dict_attr_search_by_name_substr(NULL, &da, request->proto_dict, &FR_SBUFF_IN(attr_name, len),
 						   NULL, true, false);
 	} else {
@@ -597,9 +702,9 @@ static PyObject *py_freeradius_pair_map_subscript(PyObject *self, PyObject *attr
 	}
 
 	if (fr_type_is_leaf(da->type)) {
-		pair = PyObject_New(py_freeradius_pair_t, (PyTypeObject *)&py_freeradius_value_pair_def);
+		pair = PyObject_New(py_freeradius_pair_t, mod_state->value_pair_type);
 	} else if (fr_type_is_structural(da->type)) {
-		pair = PyObject_New(py_freeradius_pair_t, (PyTypeObject *)&py_freeradius_grouping_pair_def);
+		pair = PyObject_New(py_freeradius_pair_t, mod_state->grouping_pair_type);
 	} else {
 		PyErr_SetString(PyExc_AttributeError, "Unsupported data type");
 		return NULL;
@@ -691,7 +796,7 @@ static int py_freeradius_pair_map_set(PyObject* self, PyObject* attr, PyObject*
 
 		attr_name = PyUnicode_AsUTF8AndSize(attr, &len);
 
-		if (PyObject_IsInstance(self, (PyObject *)&py_freeradius_pair_list_def)) {
+		if (PyObject_IsInstance(self, (PyObject *)py_freeradius_mod_state(self)->pair_list_type)) {
 			fr_dict_attr_search_by_name_substr(NULL, &da, request->proto_dict, &FR_SBUFF_IN(attr_name, len),
 							   NULL, true, false);
 		} else {
@@ -1161,7 +1266,8 @@ failed:
 /** Create the Python object representing a pair list
  *
  */
-static inline CC_HINT(always_inline) PyObject *pair_list_alloc(request_t *request, fr_dict_attr_t const *list)
+static inline CC_HINT(always_inline) PyObject *pair_list_alloc(py_freeradius_mod_state_t *mod_state,
+								 request_t *request, fr_dict_attr_t const *list)
 {
 	PyObject		*py_list;
 	py_freeradius_pair_t	*our_list;
@@ -1174,7 +1280,7 @@ static inline CC_HINT(always_inline) PyObject *pair_list_alloc(request_t *reques
 		return Py_None;
 	}
 
-	py_list = PyObject_CallObject((PyObject *)&py_freeradius_pair_list_def, NULL);
+	py_list = PyObject_CallObject((PyObject *)mod_state->pair_list_type, NULL);
 	if (unlikely(!py_list)) return NULL;
 
 	our_list = (py_freeradius_pair_t *)py_list;
@@ -1185,11 +1291,21 @@ static inline CC_HINT(always_inline) PyObject *pair_list_alloc(request_t *reques
 	return py_list;
 }
 
+/** Call a Python function
+ *
+ * @param[out] p_result	of calling the function.
+ * @param[in] mctx	calling context.
+ * @param[in] request	being processed, NULL when calling instantiate or detach.
+ * @param[in] p_module	copy of the freeradius module in the interpreter being used.
+ * @param[in] p_func	to call.
+ * @param[in] funcname	name of the function, for logging.
+ */
 static unlang_action_t do_python_single(unlang_result_t *p_result, module_ctx_t const *mctx,
-					request_t *request, PyObject *p_func, char const *funcname)
+					request_t *request, PyObject *p_module, PyObject *p_func, char const *funcname)
 {
 	rlm_rcode_t		rcode = RLM_MODULE_OK;
 	rlm_python_t const	*inst = talloc_get_type_abort(mctx->mi->data, rlm_python_t);
+	py_freeradius_mod_state_t *mod_state = PyModule_GetState(p_module);
 
 	PyObject		*p_ret = NULL;
 	PyObject		*py_request;
@@ -1198,7 +1314,7 @@ static unlang_action_t do_python_single(unlang_result_t *p_result, module_ctx_t
 	/*
 	 *	Instantiate the request
 	 */
-	py_request = PyObject_CallObject((PyObject *)&py_freeradius_request_def, NULL);
+	py_request = PyObject_CallObject((PyObject *)mod_state->request_type, NULL);
 	if (unlikely(!py_request)) {
 		python_error_log(inst, request);
 		RETURN_UNLANG_FAIL;
@@ -1210,7 +1326,7 @@ static unlang_action_t do_python_single(unlang_result_t *p_result, module_ctx_t
 	/*
 	 *	Create the list roots
 	 */
-	our_request->request = pair_list_alloc(request, request_attr_request);
+	our_request->request = pair_list_alloc(mod_state, request, request_attr_request);
 	if (unlikely(!our_request->request)) {
 	req_error:
 		Py_DECREF(py_request);
@@ -1218,13 +1334,13 @@ static unlang_action_t do_python_single(unlang_result_t *p_result, module_ctx_t
 		RETURN_UNLANG_FAIL;
 	}
 
-	our_request->reply = pair_list_alloc(request, request_attr_reply);
+	our_request->reply = pair_list_alloc(mod_state, request, request_attr_reply);
 	if (unlikely(!our_request->reply)) goto req_error;
 
-	our_request->control = pair_list_alloc(request, request_attr_control);
+	our_request->control = pair_list_alloc(mod_state, request, request_attr_control);
 	if (unlikely(!our_request->control)) goto req_error;
 
-	our_request->state = pair_list_alloc(request, request_attr_state);
+	our_request->state = pair_list_alloc(mod_state, request, request_attr_state);
 	if (unlikely(!our_request->state)) goto req_error;
 
 	/* Call Python function. */
@@ -1275,18 +1391,30 @@ finish:
  */
 static unlang_action_t mod_python(unlang_result_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
+	rlm_python_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_python_t);
 	rlm_python_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_python_thread_t);
 	python_call_env_t	*func = talloc_get_type_abort(mctx->env_data, python_call_env_t);
+	python_func_def_t const	*def = func->func;
+	PyObject		*p_module = inst->module;
 
 	/*
 	 *	It's a NOOP if the function wasn't defined
 	 */
-	if (!func->func->function) RETURN_UNLANG_NOOP;
+	if (!def->function) RETURN_UNLANG_NOOP;
+
+	/*
+	 *	Use the copy of the function loaded into
+	 *	this thread's interpreter.
+	 */
+	if (inst->per_thread_interpreter) {
+		def = &t->funcs[def->idx];
+		p_module = t->module;
+	}
 
 	RDEBUG3("Using thread state %p/%p", mctx->mi->data, t->state);
 
 	PyEval_RestoreThread(t->state);	/* Swap in our local thread state */
-	do_python_single(p_result, mctx, request, func->func->function, func->func->function_name);
+	do_python_single(p_result, mctx, request, p_module, def->function, def->function_name);
 	(void)fr_cond_assert(PyEval_SaveThread() == t->state);
 
 	return UNLANG_ACTION_CALCULATE_RESULT;
@@ -1309,9 +1437,8 @@ static void python_function_destroy(python_func_def_t *def)
 /** Import a user module and load a function from it
  *
  */
-static int python_function_load(module_inst_ctx_t const *mctx, python_func_def_t *def)
+static int python_function_load(rlm_python_t const *inst, python_func_def_t *def)
 {
-	rlm_python_t const	*inst = talloc_get_type_abort(mctx->mi->data, rlm_python_t);
 	char const *funcname = "python_function_load";
 
 	if (def->module_name == NULL || (def->function_name == NULL && def->name1 == NULL)) return 0;
@@ -1443,20 +1570,20 @@ static int python_parse_config(rlm_python_t const *inst, CONF_SECTION *cs, int l
 /** Make the current instance's config available within the module we're initialising
  *
  */
-static int python_module_import_config(rlm_python_t *inst, CONF_SECTION *conf, PyObject *module)
+static int python_module_import_config(rlm_python_t const *inst, CONF_SECTION *conf, PyObject *module)
 {
-	CONF_SECTION *cs;
+	CONF_SECTION	*cs;
+	PyObject	*pythonconf_dict;
 
 	/*
 	 *	Convert a FreeRADIUS config structure into a python
 	 *	dictionary.
 	 */
-	inst->pythonconf_dict = PyDict_New();
-	if (!inst->pythonconf_dict) {
+	pythonconf_dict = PyDict_New();
+	if (!pythonconf_dict) {
 		ERROR("Unable to create python dict for config");
 	error:
-		Py_XDECREF(inst->pythonconf_dict);
-		inst->pythonconf_dict = NULL;
+		Py_XDECREF(pythonconf_dict);
 		python_error_log(inst, NULL);
 		return -1;
 	}
@@ -1464,13 +1591,13 @@ static int python_module_import_config(rlm_python_t *inst, CONF_SECTION *conf, P
 	cs = cf_section_find(conf, "config", NULL);
 	if (cs) {
 		DEBUG("Inserting \"config\" section into python environment as radiusd.config");
-		if (python_parse_config(inst, cs, 0, inst->pythonconf_dict) < 0) goto error;
+		if (python_parse_config(inst, cs, 0, pythonconf_dict) < 0) goto error;
 	}
 
 	/*
 	 *	Add module configuration as a dict
 	 */
-	if (PyModule_AddObject(module, "config", inst->pythonconf_dict) < 0) goto error;
+	if (PyModule_AddObject(module, "config", pythonconf_dict) < 0) goto error;
 
 	return 0;
 }
@@ -1493,70 +1620,67 @@ static int python_module_import_constants(rlm_python_t const *inst, PyObject *mo
 	return 0;
 }
 
+/** Create one of the freeradius types for a copy of the module
+ *
+ */
+static inline CC_HINT(always_inline) PyTypeObject *python_type_alloc(UNUSED PyObject *module,
+								     PyType_Spec *spec, PyTypeObject *base)
+{
+#if PY_VERSION_HEX >= 0x03090000
+	return (PyTypeObject *)PyType_FromModuleAndSpec(module, spec, (PyObject *)base);
+#else
+	return (PyTypeObject *)PyType_FromSpecWithBases(spec, (PyObject *)base);
+#endif
+}
+
 /*
  *	Python 3 interpreter initialisation and destruction
  */
 static PyObject *python_module_init(void)
 {
-	PyObject		*module;
-	PyObject		*p_state;
-	static pthread_mutex_t	init_lock = PTHREAD_MUTEX_INITIALIZER;
-	static bool		type_ready = false;
-
-	fr_assert(current_inst);
-
 	/*
-	 *	Only allow one thread at a time to do the module init.  This is
-	 *	out of an abundance of caution as it's unclear whether the
-	 *	reference counts on the various objects are thread safe.
+	 *	The module and its types are created by
+	 *	python_module_exec, once for each interpreter.
 	 */
-	pthread_mutex_lock(&init_lock);
-
-	/*
-	 *	The type definitions are global, so we only need to call the
-	 *	init functions the first pass through.
-	*/
+	return PyModuleDef_Init(&py_freeradius_def);
+}
 
-	if (!type_ready) {
-		/*
-		 *	We need to initialise the definitions first
-		 *	this fills in any fields we didn't explicitly
-		 *	specify, and gets the structures ready for
-		 *	use by the python interpreter.
-		 */
-		if (PyType_Ready(&py_freeradius_pair_def) < 0) {
-		error:
-			pthread_mutex_unlock(&init_lock);
-			python_error_log(current_inst, NULL);
-			Py_RETURN_NONE;
-		}
+/** Populate a new copy of the freeradius module
+ *
+ * Any exception raised here is reported by the code importing the module.
+ */
+static int python_module_exec(PyObject *module)
+{
+	py_freeradius_mod_state_t	*mod_state = PyModule_GetState(module);
+	PyObject			*p_state;
 
-		if (PyType_Ready(&py_freeradius_value_pair_def) < 0) goto error;
+	fr_assert(current_inst);
 
-		if (PyType_Ready(&py_freeradius_grouping_pair_def) < 0) goto error;
+	/*
+	 *	Each copy of the module has its own types, so
+	 *	no objects are shared between interpreters.
+	 */
+	mod_state->pair_type = python_type_alloc(module, &py_freeradius_pair_spec, NULL);
+	if (!mod_state->pair_type) return -1;
 
-		if (PyType_Ready(&py_freeradius_pair_list_def) < 0) goto error;
+	mod_state->value_pair_type = python_type_alloc(module, &py_freeradius_value_pair_spec, mod_state->pair_type);
+	if (!mod_state->value_pair_type) return -1;
 
-		if (PyType_Ready(&py_freeradius_request_def) < 0) goto error;
+	mod_state->grouping_pair_type = python_type_alloc(module, &py_freeradius_grouping_pair_spec, mod_state->pair_type);
+	if (!mod_state->grouping_pair_type) return -1;
 
-		if (PyType_Ready(&py_freeradius_state_def) < 0) goto error;
+	mod_state->pair_list_type = python_type_alloc(module, &py_freeradius_pair_list_spec, mod_state->pair_type);
+	if (!mod_state->pair_list_type) return -1;
 
-		type_ready = true;
-	}
+	mod_state->request_type = python_type_alloc(module, &py_freeradius_request_spec, NULL);
+	if (!mod_state->request_type) return -1;
 
-	/*
-	 *	The module is per-interpreter
-	 */
-	module = PyModule_Create(&py_freeradius_def);
-	if (!module) {
-		python_error_log(current_inst, NULL);
-		goto error;
-	}
+	mod_state->state_type = python_type_alloc(module, &py_freeradius_state_spec, NULL);
+	if (!mod_state->state_type) return -1;
 
 	/*
-	 *	PyModule_AddObject steals ref on success, we we
-	 *	INCREF here to give it something to steal, else
-	 *	on free the refcount would go negative.
+	 *	PyModule_AddObject steals ref on success, so
+	 *	we only DECREF on failure.
 	 *
 	 *	Note here we're creating a new instance of an
 	 *	object, not adding the object definition itself
@@ -1568,13 +1692,12 @@ static PyObject *python_module_init(void)
 	 *	instance data from globals and thread-specific
 	 *	variables.
 	 */
-	p_state = PyObject_CallObject((PyObject *)&py_freeradius_state_def, NULL);
-	Py_INCREF(&py_freeradius_state_def);
+	p_state = PyObject_CallObject((PyObject *)mod_state->state_type, NULL);
+	if (!p_state) return -1;
 
 	if (PyModule_AddObject(module, "__State", p_state) < 0) {
-		Py_DECREF(&py_freeradius_state_def);
-		Py_DECREF(module);
-		goto error;
+		Py_DECREF(p_state);
+		return -1;
 	}
 
 	/*
@@ -1582,13 +1705,75 @@ static PyObject *python_module_init(void)
 	 *	as opposed to the object instance we inserted
 	 *	for inst.
 	 */
-	Py_INCREF(&py_freeradius_pair_def);
-	if (PyModule_AddObject(module, "Pair", (PyObject *)&py_freeradius_pair_def) < 0) {
-		Py_DECREF(&py_freeradius_pair_def);
+	Py_INCREF(mod_state->pair_type);
+	if (PyModule_AddObject(module, "Pair", (PyObject *)mod_state->pair_type) < 0) {
+		Py_DECREF(mod_state->pair_type);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int python_module_traverse(PyObject *module, visitproc visit, void *arg)
+{
+	py_freeradius_mod_state_t *mod_state = PyModule_GetState(module);
+
+	if (!mod_state) return 0;
+
+	Py_VISIT(mod_state->pair_type);
+	Py_VISIT(mod_state->value_pair_type);
+	Py_VISIT(mod_state->grouping_pair_type);
+	Py_VISIT(mod_state->pair_list_type);
+	Py_VISIT(mod_state->request_type);
+	Py_VISIT(mod_state->state_type);
+
+	return 0;
+}
+
+static int python_module_clear(PyObject *module)
+{
+	py_freeradius_mod_state_t *mod_state = PyModule_GetState(module);
+
+	if (!mod_state) return 0;
+
+	Py_CLEAR(mod_state->pair_type);
+	Py_CLEAR(mod_state->value_pair_type);
+	Py_CLEAR(mod_state->grouping_pair_type);
+	Py_CLEAR(mod_state->pair_list_type);
+	Py_CLEAR(mod_state->request_type);
+	Py_CLEAR(mod_state->state_type);
+
+	return 0;
+}
+
+static void python_module_free(void *module)
+{
+	(void)python_module_clear((PyObject *)module);
+}
+
+/** Import the freeradius module into the current interpreter
+ *
+ * Each interpreter gets its own copy of the module, which it can
+ * mutate as much as it wants.
+ *
+ * @return the module, or NULL on error.
+ */
+static PyObject *python_module_import(rlm_python_t const *inst, CONF_SECTION *conf)
+{
+	PyObject	*module;
+
+	module = PyImport_ImportModule("freeradius");
+	if (!module) {
+		ERROR("Failed importing \"freeradius\" module into interpreter %p", PyThreadState_Get());
+		python_error_log(inst, NULL);
+		return NULL;
+	}
+
+	if ((python_module_import_config(inst, conf, module) < 0) ||
+	    (python_module_import_constants(inst, module) < 0)) {
 		Py_DECREF(module);
-		goto error;
+		return NULL;
 	}
-	pthread_mutex_unlock(&init_lock);
 
 	return module;
 }
@@ -1619,22 +1804,9 @@ static int python_interpreter_init(module_inst_ctx_t const *mctx)
 
 	PyEval_RestoreThread(inst->interpreter);
 
-	/*
-	 *	Import the radiusd module into this python
-	 *	environment.  Each interpreter gets its
-	 *	own copy which it can mutate as much as
-	 *      it wants.
-	 */
- 	module = PyImport_ImportModule("freeradius");
- 	if (!module) {
- 		ERROR("Failed importing \"freeradius\" module into interpreter %p", inst->interpreter);
- 		return -1;
- 	}
-	if ((python_module_import_config(inst, conf, module) < 0) ||
-	    (python_module_import_constants(inst, module) < 0)) {
-		Py_DECREF(module);
-		return -1;
-	}
+	module = python_module_import(inst, conf);
+	if (!module) return -1;
+
 	inst->module = module;
 	PyEval_SaveThread();
 
@@ -1687,7 +1859,7 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	/*
 	 *	Process the various sections
 	 */
-#define PYTHON_FUNC_LOAD(_x) if (python_function_load(mctx, &inst->_x) < 0) goto error
+#define PYTHON_FUNC_LOAD(_x) if (python_function_load(inst, &inst->_x) < 0) goto error
 	PYTHON_FUNC_LOAD(instantiate);
 	PYTHON_FUNC_LOAD(detach);
 
@@ -1729,7 +1901,8 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	found_func:
 		if (cp) func->function_name = cf_pair_value(cp);
 
-		if (python_function_load(mctx, func) < 0) goto error;
+		if (python_function_load(inst, func) < 0) goto error;
+		func->idx = inst->num_funcs++;
 		func = fr_rb_iter_next_inorder(&iter);
 	}
 
@@ -1739,7 +1912,8 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	if (inst->instantiate.function) {
 		unlang_result_t result;
 
-		do_python_single(&result, MODULE_CTX_FROM_INST(mctx), NULL, inst->instantiate.function, "instantiate");
+		do_python_single(&result, MODULE_CTX_FROM_INST(mctx), NULL, inst->module,
+				 inst->instantiate.function, "instantiate");
 		switch (result.rcode) {
 		case RLM_MODULE_FAIL:
 		case RLM_MODULE_REJECT:
@@ -1786,7 +1960,8 @@ static int mod_detach(module_detach_ctx_t const *mctx)
 	if (inst->detach.function) {
 		unlang_result_t result;
 
-		(void)do_python_single(&result, MODULE_CTX_FROM_INST(mctx), NULL, inst->detach.function, "detach");
+		(void)do_python_single(&result, MODULE_CTX_FROM_INST(mctx), NULL, inst->module,
+				       inst->detach.function, "detach");
 	}
 
 #define PYTHON_FUNC_DESTROY(_x) python_function_destroy(&inst->_x)
@@ -1809,6 +1984,132 @@ static int mod_detach(module_detach_ctx_t const *mctx)
 	return 0;
 }
 
+/** Create an interpreter for the current worker thread
+ *
+ * Against Python 3.12 or later the interpreter has its own GIL,
+ * otherwise it shares the main GIL with all other interpreters.
+ *
+ * @return
+ *	- The thread state of the new interpreter, which is current
+ *	  and holds the interpreter's GIL.
+ *	- NULL on error.
+ */
+static PyThreadState *python_thread_interpreter_alloc(rlm_python_t const *inst)
+{
+	PyThreadState		*state;
+#ifdef PYTHON_OWN_GIL
+	PyStatus		status;
+	PyInterpreterConfig	config = {
+		.use_main_obmalloc = 0,
+		.allow_fork = 0,
+		.allow_exec = 0,
+		.allow_threads = 1,
+		.allow_daemon_threads = 0,
+		.check_multi_interp_extensions = 1,
+		.gil = PyInterpreterConfig_OWN_GIL
+	};
+#endif
+
+	PyEval_RestoreThread(global_interpreter);	/* Creating an interpreter requires a current thread state */
+
+#ifdef PYTHON_OWN_GIL
+	/*
+	 *	On success the main GIL is released, and we hold
+	 *	the GIL of the new interpreter instead.
+	 */
+	LSAN_DISABLE(status = Py_NewInterpreterFromConfig(&state, &config));
+	if (PyStatus_Exception(status)) {
+		ERROR("Failed creating thread interpreter: %s", status.err_msg ? status.err_msg : "unknown error");
+		PyEval_SaveThread();
+		return NULL;
+	}
+#else
+	LSAN_DISABLE(state = Py_NewInterpreter());
+	if (!state) {
+		ERROR("Failed creating thread interpreter");
+		PyEval_SaveThread();
+		return NULL;
+	}
+#endif
+	DEBUG3("Created thread interpreter %p", state);
+
+	return state;
+}
+
+/** Free the interpreter belonging to the current worker thread
+ *
+ * Must be called with the interpreter's thread state current.
+ */
+static void python_thread_interpreter_free(rlm_python_thread_t *t)
+{
+	size_t i;
+
+	python_function_destroy(&t->instantiate);
+	python_function_destroy(&t->detach);
+	for (i = 0; i < talloc_array_length(t->funcs); i++) python_function_destroy(&t->funcs[i]);
+	TALLOC_FREE(t->funcs);
+
+	python_obj_destroy(&t->module);
+
+	Py_EndInterpreter(t->state);	/* Sets thread state to NULL */
+	t->state = NULL;
+
+#ifndef PYTHON_OWN_GIL
+	/*
+	 *	The interpreter shared the main GIL, which we still hold.
+	 */
+	PyThreadState_Swap(global_interpreter);
+	PyEval_SaveThread();
+#endif
+}
+
+/** Load a copy of a function the instance loaded, into the current interpreter
+ *
+ * The function name was resolved when the instance was instantiated.
+ */
+static int python_function_copy(rlm_python_t const *inst, python_func_def_t *out, python_func_def_t const *in)
+{
+	*out = (python_func_def_t){
+		.module_name = in->module_name,
+		.function_name = in->function_name,
+		.idx = in->idx
+	};
+	if (!in->function) return 0;
+
+	return python_function_load(inst, out);
+}
+
+/** Import the freeradius module and the instance's functions into a worker thread's interpreter
+ *
+ */
+static int python_thread_interpreter_load(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_python_t		*inst = talloc_get_type_abort(mctx->mi->data, rlm_python_t);
+	rlm_python_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_python_thread_t);
+	python_func_def_t	*func;
+	fr_rb_iter_inorder_t	iter;
+
+	t->module = python_module_import(inst, mctx->mi->conf);
+	if (!t->module) return -1;
+
+	if ((python_function_copy(inst, &t->instantiate, &inst->instantiate) < 0) ||
+	    (python_function_copy(inst, &t->detach, &inst->detach) < 0)) return -1;
+
+	t->funcs = talloc_zero_array(t, python_func_def_t, inst->num_funcs);
+	if (!t->funcs) {
+		ERROR("Failed allocating thread function table");
+		return -1;
+	}
+
+	for (func = fr_rb_iter_init_inorder(&iter, &inst->funcs);
+	     func;
+	     func = fr_rb_iter_next_inorder(&iter)) {
+		if (python_function_copy(inst, &t->funcs[func->idx], func) < 0) return -1;
+	}
+
+	return 0;
+}
+
 static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
 {
 	rlm_python_t		*inst = talloc_get_type_abort(mctx->mi->data, rlm_python_t);
@@ -1816,26 +2117,37 @@ static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
 
 	PyThreadState		*t_state;
 	PyObject		*t_dict;
+	PyObject		*p_module;
 	PyObject		*p_state;
+	py_freeradius_mod_state_t *mod_state;
 
+	current_inst = inst;
+	current_conf = mctx->mi->conf;
 	current_t = t;
 
 	t->inst = inst;
-	t_state = PyThreadState_New(inst->interpreter->interp);
-	if (!t_state) {
-		ERROR("Failed initialising local PyThreadState");
-		return -1;
+	if (inst->per_thread_interpreter) {
+		t_state = python_thread_interpreter_alloc(inst);	/* Switches thread state and locks GIL */
+		if (!t_state) return -1;
+		t->state = t_state;
+
+		if (python_thread_interpreter_load(mctx) < 0) goto error;
+		p_module = t->module;
+	} else {
+		t_state = PyThreadState_New(inst->interpreter->interp);
+		if (!t_state) {
+			ERROR("Failed initialising local PyThreadState");
+			return -1;
+		}
+
+		PyEval_RestoreThread(t_state);	/* Switches thread state and locks GIL */
+		p_module = inst->module;
 	}
 
-	PyEval_RestoreThread(t_state);	/* Switches thread state and locks GIL */
 	t_dict = PyThreadState_GetDict();
 	if (unlikely(!t_dict)) {
 		ERROR("Failed getting PyThreadState dictionary");
-	error:
-		PyEval_SaveThread();			/* Unlock GIL */
-		PyThreadState_Delete(t_state);
-
-		return -1;
+		goto error;
 	}
 
 	/*
@@ -1843,7 +2155,8 @@ static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
 	 *	the global and thread instances, and associates
 	 *	them with the thread.
 	 */
-	p_state = PyObject_CallObject((PyObject *)&py_freeradius_state_def, NULL);
+	mod_state = PyModule_GetState(p_module);
+	p_state = PyObject_CallObject((PyObject *)mod_state->state_type, NULL);
 	if (unlikely(!p_state)) {
 		ERROR("Failed instantiating module instance information object");
 		goto error;
@@ -1854,11 +2167,42 @@ static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
 		goto error;
 	}
 
+	/*
+	 *	The instantiate function is called once for
+	 *	every interpreter, so that any state the
+	 *	Python module creates exists in each of them.
+	 */
+	if (inst->per_thread_interpreter && t->instantiate.function) {
+		unlang_result_t result;
+
+		do_python_single(&result, MODULE_CTX(mctx->mi, t, NULL, NULL), NULL, t->module,
+				 t->instantiate.function, "instantiate");
+		switch (result.rcode) {
+		case RLM_MODULE_FAIL:
+		case RLM_MODULE_REJECT:
+			goto error;
+
+		default:
+			break;
+		}
+	}
+
 	DEBUG3("Initialised PyThreadState %p", t_state);
 	t->state = t_state;
 	PyEval_SaveThread();				/* Unlock GIL */
 
 	return 0;
+
+error:
+	if (inst->per_thread_interpreter) {
+		python_thread_interpreter_free(t);	/* Ends the interpreter and unlocks the GIL */
+		return -1;
+	}
+
+	PyEval_SaveThread();				/* Unlock GIL */
+	PyThreadState_Delete(t_state);
+
+	return -1;
 }
 
 static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
@@ -1866,6 +2210,22 @@ static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
 	rlm_python_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_python_thread_t);
 
 	PyEval_RestoreThread(t->state);	/* Swap in our local thread state */
+
+	if (t->inst->per_thread_interpreter) {
+		/*
+		 *	We don't care if this fails.
+		 */
+		if (t->detach.function) {
+			unlang_result_t result;
+
+			(void)do_python_single(&result, MODULE_CTX(mctx->mi, t, NULL, NULL), NULL, t->module,
+					       t->detach.function, "detach");
+		}
+
+		python_thread_interpreter_free(t);	/* Ends the interpreter and unlocks the GIL */
+		return 0;
+	}
+
 	PyThreadState_Clear(t->state);
 	PyEval_SaveThread();
 
@@ -37,6 +37,11 @@
 //#include "rlm_radius.h"
 #include "track.h"
 
+/*
+ *	How many new packets to encode and sign together.
+ */
+#define RLM_RADIUS_SIGN_BATCH	FR_MD5_MB_LANES
+
 typedef struct {
 	char const		*module_name;	//!< the module that opened the connection
 	rlm_radius_t const	*inst;		//!< our instance
@@ -157,7 +162,9 @@ static rlm_rcode_t radius_code_to_rcode[FR_RADIUS_CODE_MAX] = {
 static void		conn_init_writable(UNUSED fr_event_list_t *el, UNUSED int fd,
 					   UNUSED int flags, void *uctx);
 
-static int 		encode(bio_handle_t *h, request_t *request, bio_request_t *u, uint8_t id);
+static int 		encode(bio_handle_t *h, request_t *request, bio_request_t *u, uint8_t id, uint8_t *buffer);
+
+static int		sign(bio_handle_t *h, request_t *request, bio_request_t *u);
 
 static fr_radius_decode_fail_t	decode(TALLOC_CTX *ctx, fr_pair_list_t *reply, uint8_t *response_code,
 			       bio_handle_t *h, request_t *request, bio_request_t *u,
@@ -537,7 +544,8 @@ static void conn_init_writable(fr_event_list_t *el, UNUSED int fd, UNUSED int fl
 	DEBUG("%s - Sending %s ID %d over connection %s",
 	      h->ctx.module_name, fr_radius_packet_name[u->code], u->id, h->ctx.fd_info->name);
 
-	if (encode(h, h->status_request, u, u->id) < 0) {
+	if ((encode(h, h->status_request, u, u->id, h->buffer) < 0) ||
+	    (sign(h, h->status_request, u) < 0)) {
 	fail:
 		connection_signal_reconnect(conn, CONNECTION_FAILED);
 		return;
@@ -1136,7 +1144,19 @@ static fr_radius_decode_fail_t decode(TALLOC_CTX *ctx, fr_pair_list_t *reply, ui
 	return DECODE_FAIL_NONE;
 }
 
-static int encode(bio_handle_t *h, request_t *request, bio_request_t *u, uint8_t id)
+/** Encode a packet, without signing it
+ *
+ * @param[in] h		the connection.
+ * @param[in] request	the packet is for.
+ * @param[in] u		to encode.
+ * @param[in] id	to use.
+ * @param[in] buffer	to encode into, at least max_packet_size bytes.
+ *			Owned by the caller, even on error.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+static int encode(bio_handle_t *h, request_t *request, bio_request_t *u, uint8_t id, uint8_t *buffer)
 {
 	ssize_t			packet_len;
 	fr_radius_encode_ctx_t	encode_ctx;
@@ -1146,7 +1166,7 @@ static int encode(bio_handle_t *h, request_t *request, bio_request_t *u, uint8_t
 	fr_assert(!u->packet);
 
 	u->packet_len = inst->max_packet_size;
-	u->packet = h->buffer;
+	u->packet = buffer;
 
 	/*
 	 *	We should have at minimum 64-byte packets, so don't
@@ -1188,7 +1208,7 @@ static int encode(bio_handle_t *h, request_t *request, bio_request_t *u, uint8_t
 		RPERROR("Failed encoding packet");
 
 	error:
-		TALLOC_FREE(u->packet);
+		u->packet = NULL;
 		return -1;
 	}
 
@@ -1235,13 +1255,19 @@ static int encode(bio_handle_t *h, request_t *request, bio_request_t *u, uint8_t
 	 */
 	u->packet_len = packet_len;
 
-	/*
-	 *	Now that we're done mangling the packet, sign it.
-	 */
-	if (fr_radius_sign(u->packet, NULL, (uint8_t const *) h->ctx.radius_ctx.secret,
-			   h->ctx.radius_ctx.secret_length) < 0) {
+	return 0;
+}
+
+/** Sign a packet, once we're done mangling it
+ *
+ */
+static int sign(bio_handle_t *h, request_t *request, bio_request_t *u)
+{
+	if (fr_radius_sign_with_key(u->packet, NULL, (uint8_t const *) h->ctx.radius_ctx.secret,
+				    h->ctx.radius_ctx.secret_length, h->ctx.radius_ctx.hmac_key) < 0) {
 		RPERROR("Failed signing packet");
-		goto error;
+		u->packet = NULL;
+		return -1;
 	}
 
 	return 0;
@@ -1496,6 +1522,110 @@ static void do_retry(rlm_radius_t const *inst, bio_request_t *u, request_t *requ
 	check_for_zombie(unlang_interpret_event_list(request), tconn, now, retry->start);
 }
 
+/** Reserve an ID for a new packet, and encode it
+ *
+ * On error the request is reset, but not failed.
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+static int mod_encode(request_t *request, trunk_request_t *treq, bio_handle_t *h, uint8_t *buffer)
+{
+	bio_request_t		*u = treq->preq;
+
+	fr_assert(!u->rr);
+
+	if (unlikely(radius_track_entry_reserve(&u->rr, treq, h->tt, request, u->code, treq) < 0)) {
+#ifndef NDEBUG
+		radius_track_state_log(&default_log, L_ERR, __FILE__, __LINE__,
+				       h->tt, bio_tracking_entry_log);
+#endif
+		fr_assert_fail("Tracking entry allocation failed: %s", fr_strerror());
+		return -1;
+	}
+	fr_assert(u->rr);
+	u->id = u->rr->id;
+
+	if (encode(h, request, u, u->id, buffer) < 0) {
+		/*
+		 *	Need to do this because request_conn_release
+		 *	may not be called.
+		 */
+		bio_request_reset(u);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Encode and sign the new packets waiting on a connection together
+ *
+ * The HMAC-MD5 and MD5 digests for the packets are calculated in one
+ * batch, which is cheaper than signing each packet as it's written.
+ * Each packet gets its own buffer, as they're written out one at a
+ * time by later calls to request_mux().
+ *
+ * Errors are left for mod_write() to find, and report, when it
+ * tries to encode the packet again.
+ */
+static void mod_encode_batch(bio_handle_t *h, trunk_connection_t *tconn)
+{
+	rlm_radius_t const	*inst = h->ctx.inst;
+	trunk_request_t		*treq[RLM_RADIUS_SIGN_BATCH];
+	bio_request_t		*u[RLM_RADIUS_SIGN_BATCH];
+	fr_radius_sign_batch_t	batch[RLM_RADIUS_SIGN_BATCH];
+	size_t			i, num, n = 0;
+
+	if (!h->ctx.radius_ctx.hmac_key) return;
+
+	num = trunk_connection_peek_requests(treq, NUM_ELEMENTS(treq), tconn);
+	if (num < 2) return;
+
+	for (i = 0; i < num; i++) {
+		bio_request_t	*our_u = treq[i]->preq;
+		uint8_t		*buffer;
+
+		if (our_u->packet) continue;
+
+		MEM(buffer = talloc_array(our_u, uint8_t, inst->max_packet_size));
+		if (mod_encode(treq[i]->request, treq[i], h, buffer) < 0) {
+			talloc_free(buffer);
+			continue;
+		}
+
+		/*
+		 *	Don't hold on to max_packet_size bytes for every
+		 *	request.
+		 */
+		MEM(our_u->packet = talloc_realloc(our_u, buffer, uint8_t, our_u->packet_len));
+
+		u[n] = our_u;
+		batch[n++] = (fr_radius_sign_batch_t) {
+			.packet = our_u->packet,
+			.secret = (uint8_t const *) h->ctx.radius_ctx.secret,
+			.secret_len = h->ctx.radius_ctx.secret_length,
+			.hmac_key = h->ctx.radius_ctx.hmac_key
+		};
+	}
+	if (!n) return;
+
+	(void) fr_radius_sign_batch(batch, n);
+
+	for (i = 0; i < n; i++) {
+		if (batch[i].rcode < 0) {
+			bio_request_reset(u[i]);
+			continue;
+		}
+
+		/*
+		 *	Remember the authentication vector, which now has the
+		 *	packet signature.
+		 */
+		(void) radius_track_entry_update(u[i]->rr, u[i]->packet + RADIUS_AUTH_VECTOR_OFFSET);
+	}
+}
+
 CC_NO_UBSAN(function) /* UBSAN: false positive - public vs private connection_t trips --fsanitize=function*/
 static void request_mux(UNUSED fr_event_list_t *el,
 			trunk_connection_t *tconn, connection_t *conn, UNUSED void *uctx)
@@ -1511,6 +1641,12 @@ static void request_mux(UNUSED fr_event_list_t *el,
 	 */
 	if (!treq) return;
 
+	/*
+	 *	If the next packet needs encoding, then the ones
+	 *	waiting behind it probably do too.
+	 */
+	if (!((bio_request_t *) treq->preq)->packet) mod_encode_batch(h, tconn);
+
 	request = treq->request;
 
 	mod_write(request, treq, h);
@@ -1553,32 +1689,15 @@ static void mod_write(request_t *request, trunk_request_t *treq, bio_handle_t *h
 	 *	the REQUEUE signal was received.
 	 */
 	if (!u->packet) {
-		fr_assert(!u->rr);
-
-		if (unlikely(radius_track_entry_reserve(&u->rr, treq, h->tt, request, u->code, treq) < 0)) {
-#ifndef NDEBUG
-			radius_track_state_log(&default_log, L_ERR, __FILE__, __LINE__,
-					       h->tt, bio_tracking_entry_log);
-#endif
-			fr_assert_fail("Tracking entry allocation failed: %s", fr_strerror());
+		if ((mod_encode(request, treq, h, h->buffer) < 0) ||
+		    (sign(h, request, u) < 0)) {
+			bio_request_reset(u);
 			trunk_request_signal_fail(treq);
 			return;
 		}
-		fr_assert(u->rr);
-		u->id = u->rr->id;
 
 		RDEBUG("Sending %s ID %d length %zu over connection %s",
 		       fr_radius_packet_name[u->code], u->id, u->packet_len, h->ctx.fd_info->name);
-
-		if (encode(h, request, u, u->id) < 0) {
-			/*
-			 *	Need to do this because request_conn_release
-			 *	may not be called.
-			 */
-			bio_request_reset(u);
-			trunk_request_signal_fail(treq);
-			return;
-		}
 		RHEXDUMP3(u->packet, u->packet_len, "Encoded packet");
 
 		/*
@@ -1586,6 +1705,15 @@ static void mod_write(request_t *request, trunk_request_t *treq, bio_handle_t *h
 		 *	packet signature.
 		 */
 		(void) radius_track_entry_update(u->rr, u->packet + RADIUS_AUTH_VECTOR_OFFSET);
+
+	/*
+	 *	Encoded and signed by mod_encode_batch()
+	 */
+	} else if (treq->state == TRUNK_REQUEST_STATE_PENDING) {
+		RDEBUG("Sending %s ID %d length %zu over connection %s",
+		       fr_radius_packet_name[u->code], u->id, u->packet_len, h->ctx.fd_info->name);
+		RHEXDUMP3(u->packet, u->packet_len, "Encoded packet");
+
 	} else {
 		RDEBUG("Retransmitting %s ID %d length %zu over connection %s",
 		       fr_radius_packet_name[u->code], u->id, u->packet_len, h->ctx.fd_info->name);
@@ -1654,7 +1782,7 @@ do_write:
 		/*
 		 *	The first time around, save a copy of the packet for later writing.
 		 */
-		if (!u->partial) MEM(u->packet = talloc_memdup(u, u->packet, u->packet_len));
+		if (!u->partial && (u->packet == h->buffer)) MEM(u->packet = talloc_memdup(u, u->packet, u->packet_len));
 
 		u->partial = packet_len;
 		trunk_request_signal_partial(treq);
@@ -1719,11 +1847,16 @@ do_write:
 	 *	If we only send one datagram packet, then don't bother saving it.
 	 */
 	if (u->retry.config && u->retry.config->mrc == 1) {
+		if (u->packet != h->buffer) TALLOC_FREE(u->packet);
 		u->packet = NULL;
 		return;
 	}
 
-	MEM(u->packet = talloc_memdup(u, u->packet, u->packet_len));
+	/*
+	 *	Packets encoded by mod_encode_batch() already have
+	 *	their own buffer.
+	 */
+	if (u->packet == h->buffer) MEM(u->packet = talloc_memdup(u, u->packet, u->packet_len));
 }
 
 /** Deal with Protocol-Error replies, and possible negotiation
@@ -2831,6 +2964,13 @@ static xlat_action_t xlat_radius_client(UNUSED TALLOC_CTX *ctx, UNUSED fr_dcurso
 			.secret_length = secret->vb_length,
 			.proxy_state = inst->common_ctx.proxy_state,
 		};
+		home->ctx.radius_ctx.hmac_key = fr_hmac_md5_key_alloc(home, (uint8_t const *) secret->vb_strvalue,
+								      secret->vb_length);
+		if (!home->ctx.radius_ctx.hmac_key) {
+			RPERROR("Failed precomputing HMAC key for shared secret");
+			talloc_free(home);
+			return XLAT_ACTION_FAIL;
+		}
 
 		/*
 		 *	Allocate the trunk and start it up.
@@ -852,6 +852,19 @@ check_others:
 		.proxy_state = ((uint64_t) fr_rand()) << 32 | fr_rand(),
 	};
 
+	/*
+	 *	Precompute the HMAC-MD5 key pads, for signing and
+	 *	verifying packets with a Message-Authenticator.
+	 */
+	if (inst->secret) {
+		inst->common_ctx.hmac_key = fr_hmac_md5_key_alloc(inst, (uint8_t const *) inst->secret,
+								  inst->common_ctx.secret_length);
+		if (!inst->common_ctx.hmac_key) {
+			cf_log_perr(conf, "Failed precomputing HMAC key for shared secret");
+			return -1;
+		}
+	}
+
 	/*
 	 *	Allow for O(1) lookup later...
 	 */
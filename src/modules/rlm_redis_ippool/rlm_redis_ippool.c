@@ -50,6 +50,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/redis/base.h>
 #include <freeradius-devel/redis/cluster.h>
+#include <freeradius-devel/redis/pipeline.h>
 
 #include <freeradius-devel/unlang/call_env.h>
 
@@ -75,9 +76,98 @@ typedef struct {
 	bool			copy_on_update; //!< Copy the address provided by ip_address to the
 						//!< allocated_address_attr if updates are successful.
 
+	bool			pipelining;	//!< Coalesce commands from concurrent requests on
+						//!< the same thread into pipelines.
+
+	trunk_conf_t		trunk_conf;	//!< Trunk configuration for pipelined commands.
+
+	fr_redis_io_conf_t	io_conf;	//!< Server pipelined commands are sent to.
+
 	fr_redis_cluster_t	*cluster;	//!< Redis cluster.
 } rlm_redis_ippool_t;
 
+/** rlm_redis_ippool thread instance
+ *
+ */
+typedef struct {
+	rlm_redis_ippool_t const *inst;		//!< Instance data.
+
+	fr_event_list_t		*el;		//!< This thread's event list.
+
+	fr_timer_t		*ev;		//!< Sends the pending commands.
+
+	fr_dlist_head_t		pending;	//!< Commands waiting to be sent, in the order they were queued.
+
+	fr_redis_cluster_thread_t *cluster_thread;	//!< Async connections for this thread.
+
+	fr_redis_trunk_t	*rtrunk;	//!< Trunk pipelined commands are enqueued on.
+} rlm_redis_ippool_thread_t;
+
+typedef struct ippool_batch_s ippool_batch_t;
+
+/** A script and its digest
+ *
+ */
+typedef struct {
+	char const		*digest;	//!< SHA1 of the script, used for EVALSHA.
+	char const		*script;	//!< Lua source, used for SCRIPT LOAD.
+} ippool_script_t;
+
+#define IPPOOL_UPDATE_FIXED_ARGS	5	//!< EVALSHA, digest, key count, pool name and wall time.
+#define IPPOOL_UPDATE_LEASE_ARGS	4	//!< expires, ip, owner and gateway.
+
+/** An EVALSHA command for a single request
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;		//!< Entry in the thread's pending list.
+	rlm_redis_ippool_thread_t *t;		//!< Thread whose pending list we're in, NULL if not queued.
+	ippool_batch_t		*batch;		//!< Batch we're being sent in, NULL if not sent.
+	unsigned int		slot;		//!< Our slot in the batch.
+
+	request_t		*request;	//!< Request waiting for the result.
+	ippool_action_t		action;		//!< What the command does.
+	fr_value_box_t const	*pool_name;	//!< Pool name, used to find the cluster node.
+	ippool_script_t const	*script;	//!< Script the command calls.
+
+	char const		*argv[IPPOOL_UPDATE_FIXED_ARGS + IPPOOL_UPDATE_LEASE_ARGS];	//!< Command and arguments.
+	size_t			argvlen[IPPOOL_UPDATE_FIXED_ARGS + IPPOOL_UPDATE_LEASE_ARGS];	//!< Argument lengths.
+	int			argc;		//!< Number of arguments.
+
+	char			now_buff[sizeof("4294967295")];		//!< Wall time.
+	char			expires_buff[sizeof("4294967295")];	//!< Lease time.
+	char			ip_buff[FR_IPADDR_PREFIX_STRLEN];	//!< Address being updated or released.
+
+	bool			done;		//!< We have a final result.
+	bool			redirected;	//!< Must be sent via the cluster code.
+	fr_redis_rcode_t	status;		//!< Result of the command.
+	redisReply		*reply;		//!< Script result, if status is REDIS_RCODE_SUCCESS.
+} ippool_cmd_t;
+
+/** A command in a batch
+ *
+ */
+typedef struct {
+	ippool_cmd_t		*cmd;		//!< NULL if the request was cancelled.
+	bool			update;		//!< Merged into the multi-lease update command.
+	bool			sent;		//!< Included in the command set that's in flight.
+} ippool_batch_slot_t;
+
+/** Commands for the same pool, sent as a single pipeline
+ *
+ */
+struct ippool_batch_s {
+	rlm_redis_ippool_thread_t *t;		//!< Thread the batch was sent from.
+	fr_timer_t		*ev;		//!< Resends commands which didn't complete.
+	bool			loaded;		//!< Scripts are loaded before the commands are sent.
+
+	char			wait_num_buff[sizeof("4294967295")];		//!< WAIT replica count.
+	char			wait_timeout_buff[sizeof("18446744073709551615")];	//!< WAIT timeout.
+
+	unsigned int		num;		//!< Number of slots.
+	ippool_batch_slot_t	*slot;		//!< Commands, in the order their replies arrive.
+};
+
 static conf_parser_t redis_config[] = {
 	REDIS_COMMON_CONFIG,
 	CONF_PARSER_TERMINATOR
@@ -93,6 +183,8 @@ static conf_parser_t module_config[] = {
 
 	{ FR_CONF_OFFSET("ipv4_integer", rlm_redis_ippool_t, ipv4_integer) },
 	{ FR_CONF_OFFSET("copy_on_update", rlm_redis_ippool_t, copy_on_update), .dflt = "yes", .quote = T_BARE_WORD },
+	{ FR_CONF_OFFSET("pipelining", rlm_redis_ippool_t, pipelining), .dflt = "no", .quote = T_BARE_WORD },
+	{ FR_CONF_OFFSET_SUBSECTION("pipeline", 0, rlm_redis_ippool_t, trunk_conf, trunk_config) },
 
 	/*
 	 *	Split out to allow conversion to universal ippool module with
@@ -331,51 +423,62 @@ static char lua_alloc_cmd[] =
 static char lua_alloc_digest[(SHA1_DIGEST_LENGTH * 2) + 1];
 
 /** Lua script for updating leases
+ *
+ * Updates one or more leases in a single call, so that interim updates
+ * from concurrent requests can be batched.
  *
  * - KEYS[1] The pool name.
  * - ARGV[1] Wall time (seconds since epoch).
- * - ARGV[2] Expires in (seconds).
- * - ARGV[3] IP address to update.
- * - ARGV[4] Lease owner identifier.
- * - ARGV[5] (optional) Gateway identifier.
  *
- * Returns @verbatim array { <rcode>[, <range>] } @endverbatim
+ * Followed by groups of four arguments, one group per lease:
+ * - ARGV[n] Expires in (seconds).
+ * - ARGV[n + 1] IP address to update.
+ * - ARGV[n + 2] Lease owner identifier.
+ * - ARGV[n + 3] Gateway identifier.
+ *
+ * Returns @verbatim array { { <rcode>[, <range>][, <counter>] }, ... } @endverbatim
+ * with one element per lease, in the order the leases were passed in.
  * - IPPOOL_RCODE_SUCCESS lease updated..
  * - IPPOOL_RCODE_NOT_FOUND lease not found in pool.
  * - IPPOOL_RCODE_EXPIRED lease has already expired.
  * - IPPOOL_RCODE_DEVICE_MISMATCH lease was allocated to a different client.
  */
 static char lua_update_cmd[] =
-	"local ret" EOL									/* 1 */
-	"local found" EOL								/* 2 */
+	"local results = {}" EOL							/* 1 */
 
-	"local pool_key" EOL								/* 3 */
-	"local address_key" EOL								/* 4 */
-	"local owner_key" EOL								/* 5 */
+	"local pool_key = '{' .. KEYS[1] .. '}:"IPPOOL_POOL_KEY"'" EOL			/* 2 */
+
+	"for i = 2, #ARGV, 4 do" EOL							/* 3 */
+	"  local expires_in = ARGV[i]" EOL						/* 4 */
+	"  local ip = ARGV[i + 1]" EOL							/* 5 */
+	"  local owner = ARGV[i + 2]" EOL						/* 6 */
+	"  local gateway = ARGV[i + 3]" EOL						/* 7 */
 
 	/*
 	 *	We either need to know that the IP was last allocated to the
 	 *	same device, or that the lease on the IP has NOT expired.
 	 */
-	"address_key = '{' .. KEYS[1] .. '}:"IPPOOL_ADDRESS_KEY":' .. ARGV[3]" EOL	/* 6 */
-	"found = redis.call('HMGET', address_key, 'range', 'device', 'gateway', 'counter' )" EOL	/* 7 */
+	"  local address_key = '{' .. KEYS[1] .. '}:"IPPOOL_ADDRESS_KEY":' .. ip" EOL	/* 8 */
+	"  local found = redis.call('HMGET', address_key, 'range', 'device', 'gateway', 'counter' )" EOL	/* 9 */
+	"  local expires = tonumber(redis.call('ZSCORE', pool_key, ip))" EOL		/* 10 */
+
 	/*
-	 *	Range may be nil (if not used), so we use the device key
+	 *	Range may be nil (if not used), so we use the device key.
+	 *
+	 *	A missing pool entry is also treated as not found, so one bad
+	 *	lease can't cause the script to error out and fail the others.
 	 */
-	"if not found[2] then" EOL							/* 8 */
-	"  return {" STRINGIFY(_IPPOOL_RCODE_NOT_FOUND) "}" EOL				/* 9 */
-	"end" EOL									/* 10 */
-	"if found[2] ~= ARGV[4] then" EOL						/* 11 */
-	"  return {" STRINGIFY(_IPPOOL_RCODE_DEVICE_MISMATCH) ", found[2]}" EOL		/* 12 */
-	"end" EOL									/* 13 */
+	"  if not found[2] or not expires then" EOL					/* 11 */
+	"    results[#results + 1] = {" STRINGIFY(_IPPOOL_RCODE_NOT_FOUND) "}" EOL	/* 12 */
+	"  elseif found[2] ~= owner then" EOL						/* 13 */
+	"    results[#results + 1] = {" STRINGIFY(_IPPOOL_RCODE_DEVICE_MISMATCH) ", found[2]}" EOL	/* 14 */
+	"  else" EOL									/* 15 */
 
 	/*
 	 *	Update the expiry time
 	 */
-	"pool_key = '{' .. KEYS[1] .. '}:"IPPOOL_POOL_KEY"'" EOL			/* 14 */
-	"local expires = tonumber(redis.call('ZSCORE', pool_key, ARGV[3]))" EOL		/* 15 */
-	"local static = expires > " STRINGIFY(IPPOOL_STATIC_BIT) EOL			/* 16 */
-	"redis.call('ZADD', pool_key, 'XX', ARGV[1] + ARGV[2] + (static and " STRINGIFY(IPPOOL_STATIC_BIT) " or 0), ARGV[3])" EOL	/* 17 */
+	"    local static = expires > " STRINGIFY(IPPOOL_STATIC_BIT) EOL			/* 16 */
+	"    redis.call('ZADD', pool_key, 'XX', ARGV[1] + expires_in + (static and " STRINGIFY(IPPOOL_STATIC_BIT) " or 0), ip)" EOL	/* 17 */
 
 	/*
 	 *	The device key should usually exist, but
@@ -383,19 +486,22 @@ static char lua_update_cmd[] =
 	 *	of a lease being expired, it may have been
 	 *	removed.
 	 */
-	"owner_key = '{' .. KEYS[1] .. '}:"IPPOOL_OWNER_KEY":' .. ARGV[4]" EOL		/* 18 */
-	"if not static and (redis.call('EXPIRE', owner_key, ARGV[2]) == 0) then" EOL	/* 19 */
-	"  redis.call('SET', owner_key, ARGV[3])" EOL					/* 20 */
-	"  redis.call('EXPIRE', owner_key, ARGV[2])" EOL				/* 21 */
-	"end" EOL									/* 22 */
+	"    local owner_key = '{' .. KEYS[1] .. '}:"IPPOOL_OWNER_KEY":' .. owner" EOL	/* 18 */
+	"    if not static and (redis.call('EXPIRE', owner_key, expires_in) == 0) then" EOL	/* 19 */
+	"      redis.call('SET', owner_key, ip)" EOL					/* 20 */
+	"      redis.call('EXPIRE', owner_key, expires_in)" EOL				/* 21 */
+	"    end" EOL									/* 22 */
 
 	/*
 	 *	Update the gateway address
 	 */
-	"if ARGV[5] ~= found[3] then" EOL						/* 23 */
-	"  redis.call('HSET', address_key, 'gateway', ARGV[5])" EOL			/* 24 */
-	"end" EOL									/* 25 */
-	"return { " STRINGIFY(_IPPOOL_RCODE_SUCCESS) ", found[1], found[4] }"EOL;	/* 26 */
+	"    if gateway ~= found[3] then" EOL						/* 23 */
+	"      redis.call('HSET', address_key, 'gateway', gateway)" EOL			/* 24 */
+	"    end" EOL									/* 25 */
+	"    results[#results + 1] = { " STRINGIFY(_IPPOOL_RCODE_SUCCESS) ", found[1], found[4] }" EOL	/* 26 */
+	"  end" EOL									/* 27 */
+	"end" EOL									/* 28 */
+	"return results" EOL;								/* 29 */
 static char lua_update_digest[(SHA1_DIGEST_LENGTH * 2) + 1];
 
 /** Lua script for releasing leases
@@ -536,6 +642,15 @@ static void ippool_action_print(request_t *request, ippool_action_t action,
 	talloc_free(gateway_str);
 }
 
+/** Scripts indexed by the action they implement
+ *
+ */
+static ippool_script_t const ippool_scripts[] = {
+	[POOL_ACTION_ALLOCATE]	= { .digest = lua_alloc_digest, .script = lua_alloc_cmd },
+	[POOL_ACTION_UPDATE]	= { .digest = lua_update_digest, .script = lua_update_cmd },
+	[POOL_ACTION_RELEASE]	= { .digest = lua_release_digest, .script = lua_release_cmd }
+};
+
 /** Execute a script against Redis cluster
  *
  * Handles uploading the script to the server if required.
@@ -552,15 +667,16 @@ static void ippool_action_print(request_t *request, ippool_action_t action,
  * @param[in] wait_timeout	How long to wait for slaves to replicate the data.
  * @param[in] digest		of script.
  * @param[in] script		to upload.
- * @param[in] cmd		EVALSHA command to execute.
- * @param[in] ...		Arguments for the eval command.
+ * @param[in] argc		Number of arguments in the EVALSHA command.
+ * @param[in] argv		EVALSHA command and its arguments.
+ * @param[in] argvlen		Lengths of the arguments.
  * @return status of the command.
  */
 static fr_redis_rcode_t ippool_script(redisReply **out, request_t *request, fr_redis_cluster_t *cluster,
 				      uint8_t const *key, size_t key_len,
 				      uint32_t wait_num, fr_time_delta_t wait_timeout,
 				      char const digest[], char const *script,
-				      char const *cmd, ...)
+				      int argc, char const **argv, size_t const *argvlen)
 {
 	fr_redis_conn_t			*conn;
 	redisReply			*replies[5];	/* Must be equal to the maximum number of pipelined commands */
@@ -570,25 +686,17 @@ static fr_redis_rcode_t ippool_script(redisReply **out, request_t *request, fr_r
 	fr_redis_rcode_t		s_ret, status;
 	unsigned int			pipelined = 0;
 
-	va_list				ap;
-
 	*out = NULL;
 
 #ifndef NDEBUG
 	memset(replies, 0, sizeof(replies));
 #endif
 
-	va_start(ap, cmd);
-
 	for (s_ret = fr_redis_cluster_state_init(&state, &conn, cluster, request, key, key_len, false);
 	     s_ret == REDIS_RCODE_TRY_AGAIN;	/* Continue */
 	     s_ret = fr_redis_cluster_state_next(&state, &conn, cluster, request, status, &replies[0])) {
-	     	va_list	copy;
-
 	     	RDEBUG3("Calling script 0x%s", digest);
-	     	va_copy(copy, ap);	/* copy or segv */
-		redisvAppendCommand(conn->handle, cmd, copy);
-		va_end(copy);
+		redisAppendCommandArgv(conn->handle, argc, argv, argvlen);
 		pipelined = 1;
 		if (wait_num) {
 			redisAppendCommand(conn->handle, "WAIT %i %i", wait_num, fr_time_delta_to_msec(wait_timeout));
@@ -612,9 +720,7 @@ static fr_redis_rcode_t ippool_script(redisReply **out, request_t *request, fr_r
 	     	RDEBUG3("Loading script 0x%s", digest);
 		redisAppendCommand(conn->handle, "MULTI");
 		redisAppendCommand(conn->handle, "SCRIPT LOAD %s", script);
-	     	va_copy(copy, ap);	/* copy or segv */
-		redisvAppendCommand(conn->handle, cmd, copy);
-		va_end(copy);
+		redisAppendCommandArgv(conn->handle, argc, argv, argvlen);
 		redisAppendCommand(conn->handle, "EXEC");
 		pipelined = 4;
 		if (wait_num) {
@@ -686,38 +792,605 @@ static fr_redis_rcode_t ippool_script(redisReply **out, request_t *request, fr_r
 	}
 
 finish:
-	va_end(ap);
 	return s_ret;
 }
 
-/** Allocate a new IP address from a pool
+/** Detach a command from the pending list or batch it's in
+ *
+ */
+static void ippool_cmd_detach(ippool_cmd_t *cmd)
+{
+	if (cmd->t) {
+		fr_dlist_remove(&cmd->t->pending, cmd);
+		cmd->t = NULL;
+	}
+
+	/*
+	 *	The slot stays in the batch so that replies
+	 *	can still be matched with the other commands.
+	 */
+	if (cmd->batch) {
+		cmd->batch->slot[cmd->slot].cmd = NULL;
+		cmd->batch = NULL;
+	}
+}
+
+/** Free any reply we're still holding, and remove the command from the pending list or batch
+ *
+ */
+static int _ippool_cmd_free(ippool_cmd_t *cmd)
+{
+	ippool_cmd_detach(cmd);
+	fr_redis_reply_free(&cmd->reply);
+
+	return 0;
+}
+
+/** Build the EVALSHA command for an action
+ *
+ * Arguments are stored in the command itself, so that they can be
+ * written out when the command is sent, which may be after this
+ * function has returned.
+ *
+ * @param[out] cmd		to initialise.
+ * @param[in] inst		of rlm_redis_ippool.
+ * @param[in] request		The current request.
+ * @param[in] action		to perform.
+ * @param[in] pool_name		Pool to perform the action on.
+ * @param[in] ip		Address to update or release, NULL for allocations.
+ * @param[in] owner		Unique lease owner identifier.
+ * @param[in] gateway_id	Gateway identifier, NULL for releases.
+ * @param[in] expires		Lease time, ignored for releases.
+ */
+static void ippool_cmd_init(ippool_cmd_t *cmd, rlm_redis_ippool_t const *inst, request_t *request,
+			    ippool_action_t action, fr_value_box_t const *pool_name, fr_ipaddr_t *ip,
+			    fr_value_box_t const *owner, fr_value_box_t const *gateway_id, uint32_t expires)
+{
+	*cmd = (ippool_cmd_t) {
+		.request = request,
+		.action = action,
+		.pool_name = pool_name,
+		.script = &ippool_scripts[action],
+		.status = REDIS_RCODE_ERROR
+	};
+
+#define CMD_ARG(_p, _len) \
+do { \
+	fr_assert(cmd->argc < (int)NUM_ELEMENTS(cmd->argv)); \
+	cmd->argv[cmd->argc] = (_p); \
+	cmd->argvlen[cmd->argc] = (_len); \
+	cmd->argc++; \
+} while (0)
+
+	CMD_ARG("EVALSHA", sizeof("EVALSHA") - 1);
+	CMD_ARG(cmd->script->digest, SHA1_DIGEST_LENGTH * 2);
+	CMD_ARG("1", 1);
+	CMD_ARG(pool_name->vb_strvalue, pool_name->vb_length);
+	CMD_ARG(cmd->now_buff, snprintf(cmd->now_buff, sizeof(cmd->now_buff), "%u",
+					(unsigned int)fr_time_to_timeval(fr_time()).tv_sec));
+
+	if (action != POOL_ACTION_RELEASE) {
+		CMD_ARG(cmd->expires_buff, snprintf(cmd->expires_buff, sizeof(cmd->expires_buff), "%u", expires));
+	}
+
+	if (ip) {
+		if ((ip->af == AF_INET) && inst->ipv4_integer) {
+			snprintf(cmd->ip_buff, sizeof(cmd->ip_buff), "%u", htonl(ip->addr.v4.s_addr));
+		} else {
+			IPPOOL_SPRINT_IP(cmd->ip_buff, ip, ip->prefix);
+		}
+		CMD_ARG(cmd->ip_buff, strlen(cmd->ip_buff));
+	}
+
+	CMD_ARG(owner->vb_strvalue, owner->vb_length);
+	if (gateway_id) CMD_ARG(gateway_id->vb_strvalue, gateway_id->vb_length);
+
+#undef CMD_ARG
+}
+
+/** Execute a single command synchronously
+ *
+ */
+static void ippool_cmd_run(rlm_redis_ippool_t const *inst, ippool_cmd_t *cmd)
+{
+	request_t	*request = cmd->request;
+	redisReply	*reply = NULL;
+
+	cmd->status = ippool_script(&reply, request, inst->cluster,
+				    (uint8_t const *)cmd->pool_name->vb_strvalue, cmd->pool_name->vb_length,
+				    inst->wait_num, inst->wait_timeout,
+				    cmd->script->digest, cmd->script->script,
+				    cmd->argc, cmd->argv, cmd->argvlen);
+	if (cmd->status != REDIS_RCODE_SUCCESS) return;
+
+	/*
+	 *	The update script can process multiple leases
+	 *	so wraps each result in an outer array.
+	 */
+	if (cmd->action == POOL_ACTION_UPDATE) {
+		if ((reply->type != REDIS_REPLY_ARRAY) || (reply->elements != 1)) {
+			REDEBUG("Expected result to be array with one element, got \"%s\"",
+				fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
+			fr_redis_reply_free(&reply);
+			cmd->status = REDIS_RCODE_ERROR;
+			return;
+		}
+		cmd->reply = reply->element[0];
+		reply->element[0] = NULL;		/* Prevent double free */
+		fr_redis_reply_free(&reply);		/* This works because hiredis checks for NULL elements */
+		return;
+	}
+
+	cmd->reply = reply;
+}
+
+static void ippool_batch_enqueue(ippool_batch_t *batch);
+
+/** Get the status of a reply from the async pipeline
+ *
+ */
+static inline fr_redis_rcode_t ippool_reply_status(redisReply *reply)
+{
+	if (!reply) {
+		fr_strerror_const("No reply from server");
+		return REDIS_RCODE_RECONNECT;
+	}
+
+	/*
+	 *	conn is only used to retrieve the error
+	 *	when we didn't get a reply.
+	 */
+	return fr_redis_command_status(NULL, reply);
+}
+
+/** Record the result of a command in a batch
+ *
+ * Commands which need their script loading, or need to follow a cluster
+ * redirect, are left outstanding for #ippool_batch_retry.
+ *
+ * @param[in] batch	the command is in.
+ * @param[in] i		Slot of the command.
+ * @param[in] status	of the reply.
+ * @param[in] reply	to record.  Ownership is always taken.
+ */
+static void ippool_batch_result(ippool_batch_t *batch, unsigned int i, fr_redis_rcode_t status, redisReply *reply)
+{
+	ippool_cmd_t	*cmd = batch->slot[i].cmd;
+	request_t	*request;
+
+	batch->slot[i].sent = false;
+
+	/*
+	 *	Request was cancelled after the command was sent.
+	 */
+	if (!cmd) {
+		fr_redis_reply_free(&reply);
+		return;
+	}
+	request = cmd->request;
+
+	switch (status) {
+	case REDIS_RCODE_SUCCESS:
+		cmd->reply = reply;
+		cmd->status = status;
+		cmd->done = true;
+		return;
+
+	/*
+	 *	Load the scripts and try again, once.
+	 */
+	case REDIS_RCODE_NO_SCRIPT:
+		fr_redis_reply_free(&reply);
+		if (batch->loaded) break;
+		return;
+
+	/*
+	 *	The pipeline only talks to one server, so
+	 *	the cluster code has to deal with these.
+	 */
+	case REDIS_RCODE_MOVE:
+	case REDIS_RCODE_ASK:
+	case REDIS_RCODE_TRY_AGAIN:
+		fr_redis_reply_free(&reply);
+		cmd->redirected = true;
+		return;
+
+	default:
+		fr_redis_reply_free(&reply);
+		break;
+	}
+
+	RPERROR("Calling script 0x%s failed", cmd->script->digest);
+	cmd->status = REDIS_RCODE_ERROR;
+	cmd->done = true;
+}
+
+/** Resume all the requests in a batch and free it
  *
  */
-static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, request_t *request,
-					    redis_ippool_alloc_call_env_t *env, uint32_t lease_time)
+static void ippool_batch_done(ippool_batch_t *batch)
 {
-	struct			timeval now;
-	redisReply		*reply = NULL;
+	unsigned int	i;
+
+	for (i = 0; i < batch->num; i++) {
+		ippool_cmd_t	*cmd = batch->slot[i].cmd;
+
+		if (!cmd) continue;
+
+		cmd->batch = NULL;
+		unlang_interpret_mark_runnable(cmd->request);
+	}
+
+	talloc_free(batch);
+}
+
+/** Send the commands from a batch which didn't complete
+ *
+ * Runs outside of the trunk callbacks, as new command sets can't be
+ * enqueued from within them.
+ */
+static void ippool_batch_retry(UNUSED fr_timer_list_t *tl, UNUSED fr_time_t now, void *uctx)
+{
+	ippool_batch_t	*batch = talloc_get_type_abort(uctx, ippool_batch_t);
+	unsigned int	i;
+	bool		resend = false;
+
+	for (i = 0; i < batch->num; i++) {
+		ippool_cmd_t	*cmd = batch->slot[i].cmd;
 
+		if (!cmd || cmd->done) continue;
+
+		/*
+		 *	Redirects are rare, and only happen when
+		 *	the cluster is being resharded, so use
+		 *	the synchronous code which knows how to
+		 *	follow them.
+		 */
+		if (cmd->redirected) {
+			ippool_cmd_run(batch->t->inst, cmd);
+			cmd->done = true;
+			continue;
+		}
+
+		resend = true;
+	}
+
+	if (!resend) {
+		ippool_batch_done(batch);
+		return;
+	}
+
+	batch->loaded = true;
+	ippool_batch_enqueue(batch);
+}
+
+/** Process the replies to a batch
+ *
+ * Replies are in the order #ippool_batch_enqueue added the commands.
+ */
+static void _ippool_batch_complete(UNUSED request_t *request, fr_dlist_head_t *completed, void *rctx)
+{
+	ippool_batch_t		*batch = talloc_get_type_abort(rctx, ippool_batch_t);
+	rlm_redis_ippool_t const *inst = batch->t->inst;
+	fr_redis_command_t	*rcmd = fr_dlist_head(completed);
 	fr_redis_rcode_t	status;
-	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
+	redisReply		*reply;
+	unsigned int		i, j, updates = 0;
+	bool			retry = false;
+
+#define NEXT_REPLY(_reply) \
+do { \
+	if (!rcmd) { \
+		_reply = NULL; \
+		break; \
+	} \
+	_reply = fr_redis_command_steal_result(rcmd); \
+	rcmd = fr_dlist_next(completed, rcmd); \
+} while (0)
 
-	fr_assert(env->pool_name.vb_length > 0);
-	fr_assert(env->owner.vb_length > 0);
+	/*
+	 *	SCRIPT LOAD replies.  If loading failed
+	 *	every EVALSHA will fail with NOSCRIPT,
+	 *	and be marked as failed below.
+	 */
+	if (batch->loaded) for (i = POOL_ACTION_ALLOCATE; i <= POOL_ACTION_RELEASE; i++) {
+		NEXT_REPLY(reply);
+		status = ippool_reply_status(reply);
+		if (status != REDIS_RCODE_SUCCESS) PERROR("Loading script 0x%s failed", ippool_scripts[i].digest);
+		fr_redis_reply_free(&reply);
+	}
+
+	for (i = 0; i < batch->num; i++) {
+		if (!batch->slot[i].sent) continue;
+
+		if (batch->slot[i].update) {
+			updates++;
+			continue;
+		}
+
+		NEXT_REPLY(reply);
+		ippool_batch_result(batch, i, ippool_reply_status(reply), reply);
+	}
+
+	/*
+	 *	All the updates were merged into a single call
+	 *	of the update script, which returns an array
+	 *	with one element per lease.
+	 */
+	if (updates) {
+		NEXT_REPLY(reply);
+		status = ippool_reply_status(reply);
+		if ((status == REDIS_RCODE_SUCCESS) &&
+		    ((reply->type != REDIS_REPLY_ARRAY) || (reply->elements != updates))) {
+			fr_strerror_printf("Expected update result to be array with %u elements", updates);
+			status = REDIS_RCODE_ERROR;
+		}
+
+		for (i = 0, j = 0; i < batch->num; i++) {
+			if (!batch->slot[i].sent || !batch->slot[i].update) continue;
+
+			if (status == REDIS_RCODE_SUCCESS) {
+				ippool_batch_result(batch, i, status, reply->element[j]);
+				reply->element[j++] = NULL;	/* Prevent double free */
+				continue;
+			}
+			ippool_batch_result(batch, i, status, NULL);
+		}
+		fr_redis_reply_free(&reply);
+	}
+
+	/*
+	 *	If too few slaves acknowledged the writes, every
+	 *	command that succeeded has failed.
+	 */
+	if (inst->wait_num) {
+		ippool_cmd_t	*cmd = NULL;
+
+		NEXT_REPLY(reply);
+
+		for (i = 0; i < batch->num; i++) {
+			cmd = batch->slot[i].cmd;
+			if (cmd && cmd->done && (cmd->status == REDIS_RCODE_SUCCESS)) break;
+		}
+
+		/*
+		 *	Only log against one request, all the others
+		 *	will fail with the same error.
+		 */
+		if ((i < batch->num) &&
+		    ((ippool_reply_status(reply) != REDIS_RCODE_SUCCESS) ||
+		     (ippool_wait_check(cmd->request, inst->wait_num, reply) < 0))) {
+			for (; i < batch->num; i++) {
+				cmd = batch->slot[i].cmd;
+				if (!cmd || !cmd->done || (cmd->status != REDIS_RCODE_SUCCESS)) continue;
+
+				fr_redis_reply_free(&cmd->reply);
+				cmd->status = REDIS_RCODE_ERROR;
+			}
+		}
+		fr_redis_reply_free(&reply);
+	}
+#undef NEXT_REPLY
 
-	now = fr_time_to_timeval(fr_time());
-
-	status = ippool_script(&reply, request, inst->cluster,
-			       (uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
-			       inst->wait_num, inst->wait_timeout,
-			       lua_alloc_digest, lua_alloc_cmd,
-	 		       "EVALSHA %s 1 %b %u %u %b %b",
-	 		       lua_alloc_digest,
-			       (uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
-			       (unsigned int)now.tv_sec, lease_time,
-			       (uint8_t const *)env->owner.vb_strvalue, env->owner.vb_length,
-			       (uint8_t const *)env->gateway_id.vb_strvalue, env->gateway_id.vb_length);
-	if (status != REDIS_RCODE_SUCCESS) {
+	for (i = 0; i < batch->num; i++) {
+		ippool_cmd_t	*cmd = batch->slot[i].cmd;
+
+		if (cmd && !cmd->done) retry = true;
+	}
+
+	if (!retry) {
+		ippool_batch_done(batch);
+		return;
+	}
+
+	if (fr_timer_in(batch, batch->t->el->tl, &batch->ev, fr_time_delta_wrap(0),
+			true, ippool_batch_retry, batch) < 0) {
+		PERROR("Failed inserting retry timer");
+		ippool_batch_done(batch);
+	}
+}
+
+/** Fail all the outstanding commands in a batch
+ *
+ */
+static void _ippool_batch_fail(UNUSED request_t *request, UNUSED fr_dlist_head_t *completed, void *rctx)
+{
+	ippool_batch_t	*batch = talloc_get_type_abort(rctx, ippool_batch_t);
+
+	ERROR("Failed sending %u commands", batch->num);
+	ippool_batch_done(batch);
+}
+
+/** Write the outstanding commands in a batch to the trunk
+ *
+ * Allocations and releases are sent as individual EVALSHA commands.
+ * Updates are merged into a single EVALSHA of the update script,
+ * which takes multiple leases.
+ *
+ * This only queues the commands, control returns to the event loop,
+ * and _ippool_batch_complete is called once all the replies have
+ * been received.
+ */
+static void ippool_batch_enqueue(ippool_batch_t *batch)
+{
+	rlm_redis_ippool_t const	*inst = batch->t->inst;
+	fr_redis_command_set_t		*cmds;
+	ippool_cmd_t			*first = NULL;
+	unsigned int			i, updates = 0;
+
+	cmds = fr_redis_command_set_alloc(NULL, NULL, _ippool_batch_complete, _ippool_batch_fail, batch);
+
+	if (batch->loaded) for (i = POOL_ACTION_ALLOCATE; i <= POOL_ACTION_RELEASE; i++) {
+		char const	*argv[] = { "SCRIPT", "LOAD", ippool_scripts[i].script };
+		size_t		argvlen[] = { sizeof("SCRIPT") - 1, sizeof("LOAD") - 1, strlen(ippool_scripts[i].script) };
+
+		DEBUG3("Loading script 0x%s", ippool_scripts[i].digest);
+		if (fr_redis_command_argv_add(cmds, NUM_ELEMENTS(argv), argv, argvlen) != FR_REDIS_PIPELINE_OK) goto error;
+	}
+
+	for (i = 0; i < batch->num; i++) {
+		ippool_cmd_t	*cmd = batch->slot[i].cmd;
+
+		if (!cmd || cmd->done) continue;
+
+		batch->slot[i].sent = true;
+		if (cmd->action == POOL_ACTION_UPDATE) {
+			if (!first) first = cmd;
+			updates++;
+			continue;
+		}
+
+		if (fr_redis_command_argv_add(cmds, cmd->argc, cmd->argv, cmd->argvlen) != FR_REDIS_PIPELINE_OK) goto error;
+	}
+
+	if (updates) {
+		char const	**argv;
+		size_t		*argvlen;
+		int		argc = IPPOOL_UPDATE_FIXED_ARGS + (updates * IPPOOL_UPDATE_LEASE_ARGS);
+		int		ret;
+
+		MEM(argv = talloc_array(NULL, char const *, argc));
+		MEM(argvlen = talloc_array(argv, size_t, argc));
+
+		/*
+		 *	EVALSHA, digest, key count, pool name and
+		 *	wall time are the same for every lease.
+		 */
+		memcpy(argv, first->argv, sizeof(*argv) * IPPOOL_UPDATE_FIXED_ARGS);
+		memcpy(argvlen, first->argvlen, sizeof(*argvlen) * IPPOOL_UPDATE_FIXED_ARGS);
+		argc = IPPOOL_UPDATE_FIXED_ARGS;
+
+		for (i = 0; i < batch->num; i++) {
+			ippool_cmd_t	*cmd = batch->slot[i].cmd;
+
+			if (!batch->slot[i].sent || !batch->slot[i].update) continue;
+
+			memcpy(&argv[argc], &cmd->argv[IPPOOL_UPDATE_FIXED_ARGS], sizeof(*argv) * IPPOOL_UPDATE_LEASE_ARGS);
+			memcpy(&argvlen[argc], &cmd->argvlen[IPPOOL_UPDATE_FIXED_ARGS],
+			       sizeof(*argvlen) * IPPOOL_UPDATE_LEASE_ARGS);
+			argc += IPPOOL_UPDATE_LEASE_ARGS;
+		}
+		ret = fr_redis_command_argv_add(cmds, argc, argv, argvlen);
+		talloc_free(argv);
+		if (ret != FR_REDIS_PIPELINE_OK) goto error;
+	}
+
+	if (inst->wait_num) {
+		char const	*argv[] = { "WAIT", batch->wait_num_buff, batch->wait_timeout_buff };
+		size_t		argvlen[NUM_ELEMENTS(argv)];
+
+		snprintf(batch->wait_num_buff, sizeof(batch->wait_num_buff), "%u", inst->wait_num);
+		snprintf(batch->wait_timeout_buff, sizeof(batch->wait_timeout_buff), "%" PRIu64,
+			 (uint64_t)fr_time_delta_to_msec(inst->wait_timeout));
+		argvlen[0] = sizeof("WAIT") - 1;
+		argvlen[1] = strlen(argv[1]);
+		argvlen[2] = strlen(argv[2]);
+
+		if (fr_redis_command_argv_add(cmds, NUM_ELEMENTS(argv), argv, argvlen) != FR_REDIS_PIPELINE_OK) goto error;
+	}
+
+	if (redis_command_set_enqueue(batch->t->rtrunk, cmds) != FR_REDIS_PIPELINE_OK) {
+	error:
+		ERROR("Failed enqueueing %u commands", batch->num);
+		talloc_free(cmds);
+		ippool_batch_done(batch);
+	}
+}
+
+/** Send all the commands queued by requests on this thread
+ *
+ * Runs once all the requests which were runnable when the first command
+ * was queued have had a chance to queue theirs.  Commands are grouped by
+ * pool, and each group is enqueued on the trunk as a single pipeline.
+ */
+static void ippool_batch_flush(UNUSED fr_timer_list_t *tl, UNUSED fr_time_t now, void *uctx)
+{
+	rlm_redis_ippool_thread_t	*t = talloc_get_type_abort(uctx, rlm_redis_ippool_thread_t);
+	ippool_cmd_t			*cmd;
+
+	while ((cmd = fr_dlist_head(&t->pending))) {
+		fr_value_box_t const	*pool_name = cmd->pool_name;
+		ippool_cmd_t		*next;
+		ippool_batch_t		*batch;
+		unsigned int		num = 0, pass;
+
+		for (; cmd; cmd = fr_dlist_next(&t->pending, cmd)) {
+			if (fr_value_box_cmp(cmd->pool_name, pool_name) == 0) num++;
+		}
+
+		MEM(batch = talloc_zero_pooled_object(t, ippool_batch_t, 1, sizeof(ippool_batch_slot_t) * num));
+		MEM(batch->slot = talloc_zero_array(batch, ippool_batch_slot_t, num));
+		batch->t = t;
+
+		/*
+		 *	Updates go last, as they're merged into a
+		 *	single command.  Otherwise commands are sent
+		 *	in the order they were queued.
+		 */
+		for (pass = 0; pass < 2; pass++) {
+			for (cmd = fr_dlist_head(&t->pending); cmd; cmd = next) {
+				next = fr_dlist_next(&t->pending, cmd);
+
+				if ((cmd->action == POOL_ACTION_UPDATE) != (pass == 1)) continue;
+				if (fr_value_box_cmp(cmd->pool_name, pool_name) != 0) continue;
+
+				fr_dlist_remove(&t->pending, cmd);
+				cmd->t = NULL;
+				cmd->batch = batch;
+				cmd->slot = batch->num;
+				batch->slot[batch->num++] = (ippool_batch_slot_t){
+					.cmd = cmd,
+					.update = (cmd->action == POOL_ACTION_UPDATE)
+				};
+			}
+		}
+		fr_assert(batch->num == num);
+
+		DEBUG3("Sending %u commands for pool \"%pV\"", batch->num, pool_name);
+		ippool_batch_enqueue(batch);
+	}
+}
+
+/** Stop a cancelled request's command from being sent
+ *
+ */
+static void ippool_cmd_signal(module_ctx_t const *mctx, UNUSED request_t *request, UNUSED fr_signal_t action)
+{
+	ippool_cmd_detach(talloc_get_type_abort(mctx->rctx, ippool_cmd_t));
+}
+
+/** Queue a command to be sent with those from other requests on this thread
+ *
+ */
+static unlang_action_t ippool_cmd_queue(unlang_result_t *p_result, module_ctx_t const *mctx, request_t *request,
+					ippool_cmd_t *cmd, module_method_t resume)
+{
+	rlm_redis_ippool_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_redis_ippool_thread_t);
+
+	if (!t->ev && (fr_timer_in(t, unlang_interpret_event_list(request)->tl, &t->ev, fr_time_delta_wrap(0),
+				   true, ippool_batch_flush, t) < 0)) {
+		RPERROR("Failed inserting pipeline flush timer");
+		talloc_free(cmd);
+		RETURN_UNLANG_FAIL;
+	}
+
+	cmd->t = t;
+	fr_dlist_insert_tail(&t->pending, cmd);
+	talloc_set_destructor(cmd, _ippool_cmd_free);
+
+	return unlang_module_yield(request, resume, ippool_cmd_signal, ~FR_SIGNAL_CANCEL, cmd);
+}
+
+/** Process the result of allocating a new IP address from a pool
+ *
+ */
+static ippool_rcode_t redis_ippool_allocate(request_t *request, redis_ippool_alloc_call_env_t *env, ippool_cmd_t *cmd)
+{
+	redisReply		*reply = cmd->reply;
+	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
+
+	cmd->reply = NULL;
+	if (cmd->status != REDIS_RCODE_SUCCESS) {
 		ret = IPPOOL_RCODE_FAIL;
 		goto finish;
 	}
@@ -872,53 +1545,17 @@ finish:
 	return ret;
 }
 
-/** Update an existing IP address in a pool
+/** Process the result of updating an existing IP address in a pool
  *
  */
-static ippool_rcode_t redis_ippool_update(rlm_redis_ippool_t const *inst, request_t *request,
-					  redis_ippool_update_call_env_t *env,
-					  fr_ipaddr_t *ip,
-					  fr_value_box_t const *owner,
-					  fr_value_box_t const *gateway_id,
-					  uint32_t expires)
+static ippool_rcode_t redis_ippool_update(request_t *request, redis_ippool_update_call_env_t *env,
+					  uint32_t expires, ippool_cmd_t *cmd)
 {
-	struct			timeval now;
-	redisReply		*reply = NULL;
-
-	fr_redis_rcode_t	status;
+	redisReply		*reply = cmd->reply;
 	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
 
-	now = fr_time_to_timeval(fr_time());
-
-	if ((ip->af == AF_INET) && inst->ipv4_integer) {
-		status = ippool_script(&reply, request, inst->cluster,
-				       (uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
-				       inst->wait_num, inst->wait_timeout,
-				       lua_update_digest, lua_update_cmd,
-				       "EVALSHA %s 1 %b %u %u %u %b %b",
-				       lua_update_digest,
-				       (uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
-				       (unsigned int)now.tv_sec, expires,
-				       htonl(ip->addr.v4.s_addr),
-				       (uint8_t const *)owner->vb_strvalue, owner->vb_length,
-				       (uint8_t const *)gateway_id->vb_strvalue, gateway_id->vb_length);
-	} else {
-		char ip_buff[FR_IPADDR_PREFIX_STRLEN];
-
-		IPPOOL_SPRINT_IP(ip_buff, ip, ip->prefix);
-		status = ippool_script(&reply, request, inst->cluster,
-				       (uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
-				       inst->wait_num, inst->wait_timeout,
-				       lua_update_digest, lua_update_cmd,
-				       "EVALSHA %s 1 %b %u %u %s %b %b",
-				       lua_update_digest,
-				       (uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
-				       (unsigned int)now.tv_sec, expires,
-				       ip_buff,
-				       (uint8_t const *)owner->vb_strvalue, owner->vb_length,
-				       (uint8_t const *)gateway_id->vb_strvalue, gateway_id->vb_length);
-	}
-	if (status != REDIS_RCODE_SUCCESS) {
+	cmd->reply = NULL;
+	if (cmd->status != REDIS_RCODE_SUCCESS) {
 		ret = IPPOOL_RCODE_FAIL;
 		goto finish;
 	}
@@ -1009,49 +1646,16 @@ finish:
 	return ret;
 }
 
-/** Release an existing IP address in a pool
+/** Process the result of releasing an existing IP address in a pool
  *
  */
-static ippool_rcode_t redis_ippool_release(rlm_redis_ippool_t const *inst, request_t *request,
-					   fr_value_box_t const *key_prefix,
-					   fr_ipaddr_t *ip,
-					   fr_value_box_t const *owner)
+static ippool_rcode_t redis_ippool_release(request_t *request, ippool_cmd_t *cmd)
 {
-	struct			timeval now;
-	redisReply		*reply = NULL;
-
-	fr_redis_rcode_t	status;
+	redisReply		*reply = cmd->reply;
 	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
 
-	now = fr_time_to_timeval(fr_time());
-
-	if ((ip->af == AF_INET) && inst->ipv4_integer) {
-		status = ippool_script(&reply, request, inst->cluster,
-				       (uint8_t const *)key_prefix->vb_strvalue, key_prefix->vb_length,
-				       inst->wait_num, inst->wait_timeout,
-				       lua_release_digest, lua_release_cmd,
-				       "EVALSHA %s 1 %b %u %u %b",
-				       lua_release_digest,
-				       (uint8_t const *)key_prefix->vb_strvalue, key_prefix->vb_length,
-				       (unsigned int)now.tv_sec,
-				       htonl(ip->addr.v4.s_addr),
-				       (uint8_t const *)owner->vb_strvalue, owner->vb_length);
-	} else {
-		char ip_buff[FR_IPADDR_PREFIX_STRLEN];
-
-		IPPOOL_SPRINT_IP(ip_buff, ip, ip->prefix);
-		status = ippool_script(&reply, request, inst->cluster,
-				       (uint8_t const *)key_prefix->vb_strvalue, key_prefix->vb_length,
-				       inst->wait_num, inst->wait_timeout,
-				       lua_release_digest, lua_release_cmd,
-				       "EVALSHA %s 1 %b %u %s %b",
-				       lua_release_digest,
-				       (uint8_t const *)key_prefix->vb_strvalue, key_prefix->vb_length,
-				       (unsigned int)now.tv_sec,
-				       ip_buff,
-				       (uint8_t const *)owner->vb_strvalue, owner->vb_length);
-	}
-	if (status != REDIS_RCODE_SUCCESS) {
+	cmd->reply = NULL;
+	if (cmd->status != REDIS_RCODE_SUCCESS) {
 		ret = IPPOOL_RCODE_FAIL;
 		goto finish;
 	}
@@ -1098,11 +1702,32 @@ finish:
 		RETURN_UNLANG_NOOP; \
 	}
 
+static unlang_action_t CC_HINT(nonnull) mod_alloc_resume(unlang_result_t *p_result, module_ctx_t const *mctx,
+							 request_t *request)
+{
+	redis_ippool_alloc_call_env_t	*env = talloc_get_type_abort(mctx->env_data, redis_ippool_alloc_call_env_t);
+	ippool_cmd_t			*cmd = mctx->rctx;
+
+	switch (redis_ippool_allocate(request, env, cmd)) {
+	case IPPOOL_RCODE_SUCCESS:
+		RDEBUG2("IP address lease allocated");
+		RETURN_UNLANG_UPDATED;
+
+	case IPPOOL_RCODE_POOL_EMPTY:
+		RWDEBUG("Pool contains no free addresses");
+		RETURN_UNLANG_NOTFOUND;
+
+	default:
+		RETURN_UNLANG_FAIL;
+	}
+}
+
 static unlang_action_t CC_HINT(nonnull) mod_alloc(unlang_result_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_redis_ippool_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_redis_ippool_t);
 	redis_ippool_alloc_call_env_t	*env = talloc_get_type_abort(mctx->env_data, redis_ippool_alloc_call_env_t);
 	uint32_t			lease_time;
+	ippool_cmd_t			cmd_buff, *cmd = &cmd_buff;
 
 	CHECK_POOL_NAME
 
@@ -1114,33 +1739,27 @@ static unlang_action_t CC_HINT(nonnull) mod_alloc(unlang_result_t *p_result, mod
 			env->offer_time.vb_uint32 : env->lease_time.vb_uint32;
 	ippool_action_print(request, POOL_ACTION_ALLOCATE, L_DBG_LVL_2, &env->pool_name, NULL,
 			    &env->owner, &env->gateway_id, lease_time);
-	switch (redis_ippool_allocate(inst, request, env, lease_time)) {
-	case IPPOOL_RCODE_SUCCESS:
-		RDEBUG2("IP address lease allocated");
-		RETURN_UNLANG_UPDATED;
 
-	case IPPOOL_RCODE_POOL_EMPTY:
-		RWDEBUG("Pool contains no free addresses");
-		RETURN_UNLANG_NOTFOUND;
+	fr_assert(env->owner.vb_length > 0);
 
-	default:
-		RETURN_UNLANG_FAIL;
-	}
+	if (inst->pipelining) MEM(cmd = talloc(unlang_interpret_frame_talloc_ctx(request), ippool_cmd_t));
+	ippool_cmd_init(cmd, inst, request, POOL_ACTION_ALLOCATE, &env->pool_name, NULL,
+			&env->owner, &env->gateway_id, lease_time);
+	if (inst->pipelining) return ippool_cmd_queue(p_result, mctx, request, cmd, mod_alloc_resume);
+
+	ippool_cmd_run(inst, cmd);
+
+	return mod_alloc_resume(p_result, MODULE_CTX(mctx->mi, mctx->thread, mctx->env_data, cmd), request);
 }
 
-static unlang_action_t CC_HINT(nonnull) mod_update(unlang_result_t *p_result, module_ctx_t const *mctx, request_t *request)
+static unlang_action_t CC_HINT(nonnull) mod_update_resume(unlang_result_t *p_result, module_ctx_t const *mctx,
+							  request_t *request)
 {
 	rlm_redis_ippool_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_redis_ippool_t);
 	redis_ippool_update_call_env_t	*env = talloc_get_type_abort(mctx->env_data, redis_ippool_update_call_env_t);
+	ippool_cmd_t			*cmd = mctx->rctx;
 
-	CHECK_POOL_NAME
-
-	ippool_action_print(request, POOL_ACTION_UPDATE, L_DBG_LVL_2, &env->pool_name,
-			    &env->requested_address, &env->owner, &env->gateway_id, env->lease_time.vb_uint32);
-	switch (redis_ippool_update(inst, request, env,
-				    &env->requested_address.datum.ip, &env->owner,
-				    &env->gateway_id,
-				    env->lease_time.vb_uint32)) {
+	switch (redis_ippool_update(request, env, env->lease_time.vb_uint32, cmd)) {
 	case IPPOOL_RCODE_SUCCESS:
 		RDEBUG2("Requested IP address' \"%pV\" lease updated", &env->requested_address);
 
@@ -1190,16 +1809,34 @@ static unlang_action_t CC_HINT(nonnull) mod_update(unlang_result_t *p_result, mo
 	}
 }
 
-static unlang_action_t CC_HINT(nonnull) mod_release(unlang_result_t *p_result, module_ctx_t const *mctx, request_t *request)
+static unlang_action_t CC_HINT(nonnull) mod_update(unlang_result_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_redis_ippool_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_redis_ippool_t);
-	redis_ippool_release_call_env_t	*env = talloc_get_type_abort(mctx->env_data, redis_ippool_release_call_env_t);
+	redis_ippool_update_call_env_t	*env = talloc_get_type_abort(mctx->env_data, redis_ippool_update_call_env_t);
+	ippool_cmd_t			cmd_buff, *cmd = &cmd_buff;
 
 	CHECK_POOL_NAME
 
-	ippool_action_print(request, POOL_ACTION_RELEASE, L_DBG_LVL_2, &env->pool_name,
-			    &env->requested_address, &env->owner, &env->gateway_id, 0);
-	switch (redis_ippool_release(inst, request, &env->pool_name, &env->requested_address.datum.ip, &env->owner)) {
+	ippool_action_print(request, POOL_ACTION_UPDATE, L_DBG_LVL_2, &env->pool_name,
+			    &env->requested_address, &env->owner, &env->gateway_id, env->lease_time.vb_uint32);
+
+	if (inst->pipelining) MEM(cmd = talloc(unlang_interpret_frame_talloc_ctx(request), ippool_cmd_t));
+	ippool_cmd_init(cmd, inst, request, POOL_ACTION_UPDATE, &env->pool_name, &env->requested_address.datum.ip,
+			&env->owner, &env->gateway_id, env->lease_time.vb_uint32);
+	if (inst->pipelining) return ippool_cmd_queue(p_result, mctx, request, cmd, mod_update_resume);
+
+	ippool_cmd_run(inst, cmd);
+
+	return mod_update_resume(p_result, MODULE_CTX(mctx->mi, mctx->thread, mctx->env_data, cmd), request);
+}
+
+static unlang_action_t CC_HINT(nonnull) mod_release_resume(unlang_result_t *p_result, module_ctx_t const *mctx,
+							   request_t *request)
+{
+	redis_ippool_release_call_env_t	*env = talloc_get_type_abort(mctx->env_data, redis_ippool_release_call_env_t);
+	ippool_cmd_t			*cmd = mctx->rctx;
+
+	switch (redis_ippool_release(request, cmd)) {
 	case IPPOOL_RCODE_SUCCESS:
 		RDEBUG2("IP address \"%pV\" released", &env->requested_address);
 		RETURN_UNLANG_UPDATED;
@@ -1224,6 +1861,27 @@ static unlang_action_t CC_HINT(nonnull) mod_release(unlang_result_t *p_result, m
 	}
 }
 
+static unlang_action_t CC_HINT(nonnull) mod_release(unlang_result_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_redis_ippool_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_redis_ippool_t);
+	redis_ippool_release_call_env_t	*env = talloc_get_type_abort(mctx->env_data, redis_ippool_release_call_env_t);
+	ippool_cmd_t			cmd_buff, *cmd = &cmd_buff;
+
+	CHECK_POOL_NAME
+
+	ippool_action_print(request, POOL_ACTION_RELEASE, L_DBG_LVL_2, &env->pool_name,
+			    &env->requested_address, &env->owner, &env->gateway_id, 0);
+
+	if (inst->pipelining) MEM(cmd = talloc(unlang_interpret_frame_talloc_ctx(request), ippool_cmd_t));
+	ippool_cmd_init(cmd, inst, request, POOL_ACTION_RELEASE, &env->pool_name, &env->requested_address.datum.ip,
+			&env->owner, NULL, 0);
+	if (inst->pipelining) return ippool_cmd_queue(p_result, mctx, request, cmd, mod_release_resume);
+
+	ippool_cmd_run(inst, cmd);
+
+	return mod_release_resume(p_result, MODULE_CTX(mctx->mi, mctx->thread, mctx->env_data, cmd), request);
+}
+
 static unlang_action_t CC_HINT(nonnull) mod_bulk_release(unlang_result_t *p_result, UNUSED module_ctx_t const *mctx,
 							 request_t *request)
 {
@@ -1248,6 +1906,41 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		return -1;
 	}
 
+	/*
+	 *	Pipelined commands are sent asynchronously to the
+	 *	first server.  Pools on other cluster nodes are
+	 *	reached by following redirects synchronously.
+	 */
+	if (inst->pipelining) {
+		fr_ipaddr_t	ipaddr;
+		uint16_t	port = 0;
+		char		buff[FR_IPADDR_STRLEN];
+
+#ifndef REDIS_NO_AUTO_FREE_REPLIES
+		cf_log_err(mctx->mi->conf, "pipelining requires hiredis >= 1.0.0");
+		return -1;
+#endif
+		if (inst->conf.use_tls || inst->conf.username) {
+			cf_log_err(mctx->mi->conf, "pipelining does not support 'use_tls' or 'username'");
+			return -1;
+		}
+
+		if (fr_inet_pton_port(&ipaddr, &port, inst->conf.hostname[0], -1, AF_UNSPEC, true, true) < 0) {
+			cf_log_perr(mctx->mi->conf, "Failed parsing server \"%s\"", inst->conf.hostname[0]);
+			return -1;
+		}
+
+		inst->io_conf = (fr_redis_io_conf_t){
+			.hostname = talloc_typed_strdup(inst, fr_inet_ntop(buff, sizeof(buff), &ipaddr)),
+			.port = port ? port : inst->conf.port,
+			.database = inst->conf.database,
+			.password = inst->conf.password,
+			.connection_timeout = inst->conf.connection_timeout,
+			.reconnection_delay = inst->conf.reconnection_delay,
+			.log_prefix = mctx->mi->name
+		};
+	}
+
 	/*
 	 *	Pre-Compute the SHA1 hashes of the Lua scripts
 	 */
@@ -1274,6 +1967,39 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	return 0;
 }
 
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_redis_ippool_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_redis_ippool_thread_t);
+
+	t->inst = talloc_get_type_abort_const(mctx->mi->data, rlm_redis_ippool_t);
+	t->el = mctx->el;
+	fr_dlist_talloc_init(&t->pending, ippool_cmd_t, entry);
+
+	if (!t->inst->pipelining) return 0;
+
+	t->cluster_thread = fr_redis_cluster_thread_alloc(t, mctx->el, &t->inst->trunk_conf, mctx->mi->name);
+	t->rtrunk = fr_redis_trunk_alloc(t->cluster_thread, &t->inst->io_conf);
+	if (!t->rtrunk) {
+		ERROR("Failed creating trunk to %s:%u", t->inst->io_conf.hostname, t->inst->io_conf.port);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_redis_ippool_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_redis_ippool_thread_t);
+
+	/*
+	 *	Free the trunk first, as failing the command
+	 *	sets still in flight touches their batches.
+	 */
+	TALLOC_FREE(t->cluster_thread);
+
+	return 0;
+}
+
 static int mod_load(void)
 {
 	fr_redis_version_print();
@@ -1289,7 +2015,12 @@ module_rlm_t rlm_redis_ippool = {
 		.inst_size	= sizeof(rlm_redis_ippool_t),
 		.config		= module_config,
 		.onload		= mod_load,
-		.instantiate	= mod_instantiate
+		.instantiate	= mod_instantiate,
+
+		.thread_inst_size	= sizeof(rlm_redis_ippool_thread_t),
+		.thread_inst_type	= "rlm_redis_ippool_thread_t",
+		.thread_instantiate	= mod_thread_instantiate,
+		.thread_detach		= mod_thread_detach
 	},
 	.method_group = {
 		.bindings = (module_method_binding_t[]){
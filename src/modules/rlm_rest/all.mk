@@ -3,6 +3,7 @@
 TARGETNAME	:=
 -include $(top_builddir)/src/lib/json/all.mk
 TARGET		:=
+SUBMAKEFILES	:=
 
 #  Add libfreeradius-json to the prereqs (so rlm_rest links to it)
 ifneq "$(TARGETNAME)" ""
@@ -42,8 +42,14 @@ RCSID("$Id$")
 #define LOG_PREFIX "sql - postgresql"
 
 #include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/command.h>
 #include <freeradius-devel/util/debug.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
 #include <sys/stat.h>
 
 #include <libpq-fe.h>
@@ -57,29 +63,98 @@ RCSID("$Id$")
 #  define NAMEDATALEN 64
 #endif
 
+/** Group commit statistics, shared by all connections of a driver instance
+ *
+ */
+typedef struct {
+	atomic_uint_fast64_t	batches;		//!< Batches committed.
+	atomic_uint_fast64_t	queries;		//!< Queries committed in those batches.
+	atomic_uint_fast64_t	failed;			//!< Batches rolled back because one of their queries failed.
+	atomic_uint_fast64_t	resent;			//!< Queries resent on their own after their batch failed.
+	atomic_uint_fast64_t	latency_ns;		//!< Total time from the first query of each batch being
+							///< sent to the batch committing.
+} rlm_sql_postgres_batch_stats_t;
+
 /** PostgreSQL configuration
  *
  */
 typedef struct {
 	char const	*db_string;		//!< Text based configuration string.
 	bool		send_application_name;	//!< Whether we send the application name to PostgreSQL.
+	uint32_t	pipeline_depth;		//!< Maximum number of queries in flight on a connection.
+	bool		prepare;		//!< Send queries as server side prepared statements.
+	uint32_t	max_prepared;		//!< Maximum number of prepared statements per connection.
+	uint32_t	batch_size;		//!< Maximum number of queries committed together.
+	fr_time_delta_t	batch_delay;		//!< Maximum time a query waits for its batch to fill.
 	fr_trie_t	*states;		//!< sql state trie.
+
+	rlm_sql_postgres_batch_stats_t	*stats;	//!< Group commit statistics.
 } rlm_sql_postgresql_t;
 
+typedef struct rlm_sql_postgres_conn_s rlm_sql_postgres_conn_t;
+
+/** A prepared statement, created on a connection the first time a query with its shape is sent
+ *
+ */
 typedef struct {
+	char const		*shape;			//!< Query text with literals replaced by parameters.
+	char			name[16];		//!< Name of the statement on the server.
+	bool			broken;			//!< Server rejected the statement, send the original text.
+} rlm_sql_postgres_stmt_t;
+
+/** Result state for a single query
+ *
+ * Kept separately from the connection, as in pipeline mode several queries can be
+ * in flight on the same connection.
+ */
+typedef struct {
+	fr_dlist_t		entry;			//!< Entry in the connection's list of queries awaiting results.
+	rlm_sql_postgres_conn_t	*conn;			//!< Connection the query was sent on.  NULL once its results
+							///< have been read, or the connection closed.
+	fr_sql_query_t		*query_ctx;		//!< Query this state belongs to.  NULL if the query was
+							///< abandoned and its results are to be discarded.
+	request_t		*request;		//!< To log against.  NULL if the request is owned by
+							///< another thread, i.e. the trunk is shared.
+	PGresult		*result;
+	int			cur_row;
+	int			num_fields;
+	int			affected_rows;
+	char			**row;
+
+	int			skip;			//!< Number of commands whose results precede the query's own.
+	fr_time_t		sent;			//!< When the query was sent.
+	bool			read;			//!< All results have been read, waiting for the sync which
+							///< commits them.
+	bool			rewritten;		//!< Query was sent with its literals as parameters.
+	rlm_sql_postgres_stmt_t	*stmt;			//!< Prepared statement used, if any.
+} rlm_sql_postgres_query_t;
+
+struct rlm_sql_postgres_conn_s {
 	PGconn		*db;
-	PGresult	*result;
-	int		cur_row;
-	int		num_fields;
-	int		affected_rows;
-	char		**row;
 	connection_t	*conn;			//!< Generic connection structure for this connection.
 	int		fd;			//!< fd for this connection's I/O events.
-	fr_sql_query_t	*query_ctx;		//!< Current query running on this connection.
-} rlm_sql_postgres_conn_t;
+	rlm_sql_postgresql_t const *inst;	//!< Driver instance data.
+
+	fr_dlist_head_t	queries;		//!< Queries sent on this connection, in the order they were sent.
+	fr_dlist_head_t	read;			//!< Queries whose results have been read, awaiting the sync
+						///< which commits them.
+	bool		pipeline;		//!< Connection is in pipeline mode.
+	int		syncs;			//!< Pipeline syncs sent, but not yet received.
+
+	uint32_t	batch_count;		//!< Batchable queries sent since the last sync.
+	fr_timer_t	*batch_ev;		//!< Sends the sync for a batch which hasn't filled.
+	bool		std_strings;		//!< standard_conforming_strings is on, so quotes are the only escapes.
+	fr_hash_table_t	*stmts;			//!< Prepared statements, keyed by query shape.
+	uint32_t	stmt_id;		//!< Used to name prepared statements.
+};
 
 static conf_parser_t driver_config[] = {
 	{ FR_CONF_OFFSET("send_application_name", rlm_sql_postgresql_t, send_application_name), .dflt = "yes" },
+	{ FR_CONF_OFFSET("pipeline_depth", rlm_sql_postgresql_t, pipeline_depth), .dflt = "0" },
+	{ FR_CONF_OFFSET("prepare", rlm_sql_postgresql_t, prepare), .dflt = "no" },
+	{ FR_CONF_OFFSET("max_prepared", rlm_sql_postgresql_t, max_prepared), .dflt = "256" },
+	{ FR_CONF_OFFSET("batch_size", rlm_sql_postgresql_t, batch_size), .dflt = "0" },
+	{ FR_CONF_OFFSET("batch_delay", rlm_sql_postgresql_t, batch_delay), .dflt = "0.005" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -143,17 +218,17 @@ static int affected_rows(PGresult * result)
 	return atoi(PQcmdTuples(result));
 }
 
-/** Free the row of the current result that's stored in the conn struct
+/** Free the row of the current result that's stored in the query struct
  *
  */
-static void free_result_row(rlm_sql_postgres_conn_t *conn)
+static void free_result_row(rlm_sql_postgres_query_t *query)
 {
-	TALLOC_FREE(conn->row);
-	conn->num_fields = 0;
+	TALLOC_FREE(query->row);
+	query->num_fields = 0;
 }
 
 #if defined(PG_DIAG_SQLSTATE) && defined(PG_DIAG_MESSAGE_PRIMARY)
-static sql_rcode_t sql_classify_error(rlm_sql_postgresql_t *inst, ExecStatusType status, PGresult const *result)
+static sql_rcode_t sql_classify_error(rlm_sql_postgresql_t const *inst, ExecStatusType status, PGresult const *result)
 {
 	char const		*error_code;
 	char const		*error_msg;
@@ -227,6 +302,642 @@ static sql_rcode_t sql_classify_error(UNUSED PGresult const *result)
 }
 #endif
 
+/** Free the result state of a query
+ *
+ * If the query's results are still to arrive, a placeholder takes its place in the
+ * connection's list of queries, so the results can be read and discarded.
+ */
+static int _sql_postgres_query_free(rlm_sql_postgres_query_t *query)
+{
+	rlm_sql_postgres_conn_t		*c = query->conn;
+	rlm_sql_postgres_query_t	*discard;
+
+	if (query->result) PQclear(query->result);
+
+	if (!c) return 0;
+
+	/*
+	 *	Only waiting for the sync, there's nothing left to read.
+	 */
+	if (query->read) {
+		fr_dlist_remove(&c->read, query);
+		return 0;
+	}
+
+	if (query->query_ctx) {
+		MEM(discard = talloc_zero(c, rlm_sql_postgres_query_t));
+		discard->conn = c;
+		discard->skip = query->skip;
+		talloc_set_destructor(discard, _sql_postgres_query_free);
+		fr_dlist_insert_after(&c->queries, query, discard);
+	}
+	fr_dlist_remove(&c->queries, query);
+
+	return 0;
+}
+
+static uint32_t sql_stmt_hash(void const *data)
+{
+	rlm_sql_postgres_stmt_t const *stmt = data;
+
+	return fr_hash_string(stmt->shape);
+}
+
+static int8_t sql_stmt_cmp(void const *one, void const *two)
+{
+	rlm_sql_postgres_stmt_t const *a = one, *b = two;
+
+	return CMP(strcmp(a->shape, b->shape), 0);
+}
+
+typedef enum {
+	SQL_TOKEN_OPEN = 0,				//!< Start of query, '(', '[' or ','.
+	SQL_TOKEN_OP,					//!< Operator.
+	SQL_TOKEN_WORD,					//!< Keyword or identifier.
+	SQL_TOKEN_VALUE					//!< Literal, or ')' or ']'.
+} sql_token_t;
+
+/** Keywords which may be followed by a value
+ *
+ */
+static char const * const sql_value_keywords[] = {
+	"AND", "BETWEEN", "CASE", "ELSE", "ESCAPE", "FROM", "HAVING", "ILIKE", "IN", "LIKE", "LIMIT",
+	"NOT", "OFFSET", "OR", "RETURNING", "SELECT", "SIMILAR", "THEN", "TO", "VALUES", "WHEN", "WHERE",
+	NULL
+};
+
+/** Keywords which end an ORDER BY or GROUP BY list
+ *
+ */
+static char const * const sql_clause_keywords[] = {
+	"EXCEPT", "FETCH", "FOR", "HAVING", "INTERSECT", "LIMIT", "OFFSET", "RETURNING", "UNION", "WINDOW",
+	NULL
+};
+
+static bool sql_word_in(char const *word, size_t len, char const * const list[])
+{
+	char const * const *p;
+
+	for (p = list; *p; p++) {
+		if ((strlen(*p) == len) && (strncasecmp(*p, word, len) == 0)) return true;
+	}
+
+	return false;
+}
+
+static inline CC_HINT(always_inline) bool sql_word_is(char const *word, size_t len, char const *keyword)
+{
+	return (strlen(keyword) == len) && (strncasecmp(keyword, word, len) == 0);
+}
+
+/** Skip over a bound value
+ *
+ * @param[in] p		pointing at the #SQL_BIND_START of the value.
+ * @return
+ *	- Pointer to the character after the #SQL_BIND_END.
+ *	- NULL if the value isn't terminated.
+ */
+static char const *sql_bind_skip(char const *p)
+{
+	for (p++; *p; p++) {
+		if (*p == SQL_BIND_END) return p + 1;
+		if ((*p == SQL_BIND_ESC) && p[1]) p++;
+	}
+
+	return NULL;
+}
+
+/** Skip over a quoted string or identifier
+ *
+ * @param[in] p		pointing at the opening quote.
+ * @param[in] backslash	Whether backslash escapes the next character (E'' strings).
+ * @param[out] bound	Set to true if the string contains bound values.  NULL if
+ *			bound values aren't allowed.
+ * @return
+ *	- Pointer to the character after the closing quote.
+ *	- NULL if the string isn't terminated, or contains bound values which
+ *	  aren't allowed.
+ */
+static char const *sql_skip_quoted(char const *p, bool backslash, bool *bound)
+{
+	char	quote = *p++;
+
+	for (;;) {
+		if (!*p) return NULL;
+		if (sql_bind_is_marker(*p)) {
+			if (!bound) return NULL;
+			*bound = true;
+
+			if (*p == SQL_BIND_START) {
+				p = sql_bind_skip(p);
+				if (!p) return NULL;
+				continue;
+			}
+			if (*p == SQL_BIND_END) return NULL;
+			if (!p[1]) return NULL;
+			p += 2;
+			continue;
+		}
+		if (backslash && (*p == '\\') && p[1]) {
+			p += 2;
+			continue;
+		}
+		if (*p == quote) {
+			if (p[1] != quote) return p + 1;
+			p++;
+		}
+		p++;
+	}
+}
+
+/** Replace the literals in a query with parameters
+ *
+ * Quoted strings and integers are replaced with `$n` placeholders, so that queries which
+ * differ only in the values expanded into them have the same shape, and can share a
+ * prepared statement.
+ *
+ * Literals whose meaning depends on their position are left alone, e.g. `INTERVAL '1 day'`,
+ * type modifiers like `varchar(64)` and ordinals in `ORDER BY 1`.  Anything else we don't
+ * understand (dollar quoting, block comments, multiple statements) means the query is
+ * sent as is.
+ *
+ * Bound values (see #SQL_BIND_START) are only allowed inside quoted strings which are
+ * replaced, where they become part of the parameter.  Anywhere else they'd have to be
+ * escaped, so the query is sent as text.
+ *
+ * @param[in] ctx		to allocate the shape and values in.
+ * @param[out] shape_out	Query with its literals replaced.
+ * @param[out] values_out	Unescaped values of the literals.
+ * @param[out] count_out	Number of values.
+ * @param[in] query		to rewrite.  Must have been escaped with standard_conforming_strings on.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the query can't be rewritten.
+ */
+static int sql_query_parameterise(TALLOC_CTX *ctx, char **shape_out, char const ***values_out, int *count_out,
+				  char const *query)
+{
+	char const	*p = query, *span = query, *start, *in, *word = NULL;
+	size_t		word_len = 0;
+	char		*shape, *value, *q;
+	char const	**values = NULL;
+	int		count = 0, depth = 0, by_depth = -1;
+	uint64_t	typmod = 0;
+	bool		cast = false, is_type = false;
+	sql_token_t	prev = SQL_TOKEN_OPEN;
+
+#define VALUE_ALLOWED \
+	((prev == SQL_TOKEN_OPEN) || (prev == SQL_TOKEN_OP) || \
+	 ((prev == SQL_TOKEN_WORD) && word && sql_word_in(word, word_len, sql_value_keywords)))
+
+	MEM(shape = talloc_strdup(ctx, ""));
+
+	while (*p) {
+		if (isspace((uint8_t)*p)) {
+			p++;
+			continue;
+		}
+
+		/*
+		 *	'string'
+		 */
+		if (*p == '\'') {
+			bool allowed = VALUE_ALLOWED, bound = false;
+
+			start = p;
+			p = sql_skip_quoted(p, false, &bound);
+			if (!p) goto error;
+			prev = SQL_TOKEN_VALUE;
+			cast = false;
+			if (!allowed) {
+				if (bound) goto error;
+				continue;
+			}
+
+			if (count == UINT16_MAX) goto error;
+
+			MEM(value = talloc_array(ctx, char, (p - start) - 1));
+			for (in = start + 1, q = value; in < (p - 1); in++) {
+				if (*in == SQL_BIND_START) {
+					in = sql_bind_decode(&q, in) - 1;
+					continue;
+				}
+				if (*in == SQL_BIND_ESC) in++;
+				*q++ = *in;
+				if (*in == '\'') in++;
+			}
+			*q = '\0';
+
+			MEM(values = talloc_realloc(ctx, values, char const *, count + 1));
+			values[count++] = value;
+			MEM(shape = talloc_asprintf_append_buffer(shape, "%.*s$%i", (int)(start - span), span, count));
+			span = p;
+			continue;
+		}
+
+		/*
+		 *	Integers.  Other numeric literals are left as they are.
+		 */
+		if (isdigit((uint8_t)*p)) {
+			bool allowed = VALUE_ALLOWED && !(typmod & ((uint64_t)1 << depth)) && (by_depth != depth);
+
+			start = p;
+			while (isdigit((uint8_t)*p)) p++;
+			prev = SQL_TOKEN_VALUE;
+			cast = false;
+			if ((*p == '.') || (*p == '_') || isalpha((uint8_t)*p)) {
+				while (isalnum((uint8_t)*p) || (*p == '.') || (*p == '_') ||
+				       (((*p == '+') || (*p == '-')) && ((p[-1] == 'e') || (p[-1] == 'E')))) p++;
+				continue;
+			}
+			if (!allowed || ((p - start) > 18)) continue;
+
+			if (count == UINT16_MAX) goto error;
+
+			MEM(values = talloc_realloc(ctx, values, char const *, count + 1));
+			MEM(values[count++] = talloc_strndup(ctx, start, p - start));
+			MEM(shape = talloc_asprintf_append_buffer(shape, "%.*s$%i::int8", (int)(start - span), span, count));
+			span = p;
+			continue;
+		}
+
+		/*
+		 *	Keywords and identifiers
+		 */
+		if (isalpha((uint8_t)*p) || (*p == '_') || (*p & 0x80)) {
+			word = p;
+			while (isalnum((uint8_t)*p) || (*p == '_') || (*p == '$') || (*p & 0x80)) p++;
+			word_len = p - word;
+
+			/*
+			 *	E'', B'', X'' and N'' strings
+			 */
+			if (*p == '\'') {
+				p = sql_skip_quoted(p, (word_len == 1) && ((*word == 'E') || (*word == 'e')), NULL);
+				if (!p) goto error;
+				prev = SQL_TOKEN_VALUE;
+				cast = false;
+				continue;
+			}
+
+			is_type = cast;
+			cast = sql_word_is(word, word_len, "AS");
+
+			if (sql_word_is(word, word_len, "BY")) {
+				by_depth = depth;
+			} else if ((by_depth == depth) && sql_word_in(word, word_len, sql_clause_keywords)) {
+				by_depth = -1;
+			}
+			prev = SQL_TOKEN_WORD;
+			continue;
+		}
+
+		switch (*p) {
+		case '"':
+			p = sql_skip_quoted(p, false, NULL);
+			if (!p) goto error;
+			word = NULL;
+			is_type = cast;
+			cast = false;
+			prev = SQL_TOKEN_WORD;
+			continue;
+
+		case '(':
+			if (++depth >= 64) goto error;
+			if ((prev == SQL_TOKEN_WORD) && is_type) typmod |= ((uint64_t)1 << depth);
+			prev = SQL_TOKEN_OPEN;
+			break;
+
+		case ')':
+			typmod &= ~((uint64_t)1 << depth);
+			if (by_depth == depth) by_depth = -1;
+			if (depth > 0) depth--;
+			prev = SQL_TOKEN_VALUE;
+			break;
+
+		case '[':
+		case ',':
+			prev = SQL_TOKEN_OPEN;
+			break;
+
+		case ']':
+			prev = SQL_TOKEN_VALUE;
+			break;
+
+		/*
+		 *	Only a trailing semicolon is allowed.  Multiple statements
+		 *	can't be sent as a prepared statement.
+		 */
+		case ';':
+			for (p++; isspace((uint8_t)*p); p++);
+			if (*p) goto error;
+			continue;
+
+		/*
+		 *	Dollar quoting, or existing parameters
+		 */
+		case '$':
+			goto error;
+
+		case '/':
+			if (p[1] == '*') goto error;
+			prev = SQL_TOKEN_OP;
+			break;
+
+		/*
+		 *	Comments are stripped, as they may contain expanded values
+		 */
+		case '-':
+			if (p[1] == '-') {
+				MEM(shape = talloc_strndup_append_buffer(shape, span, p - span));
+				while (*p && (*p != '\n')) {
+					if (sql_bind_is_marker(*p)) goto error;
+					p++;
+				}
+				span = p;
+				continue;
+			}
+			prev = SQL_TOKEN_OP;
+			break;
+
+		/*
+		 *	Bound values which aren't part of a string
+		 */
+		case SQL_BIND_ESC:
+		case SQL_BIND_START:
+		case SQL_BIND_END:
+			goto error;
+
+		case ':':
+			if (p[1] == ':') {
+				p += 2;
+				cast = true;
+				prev = SQL_TOKEN_OP;
+				continue;
+			}
+			prev = SQL_TOKEN_OP;
+			break;
+
+		default:
+			prev = SQL_TOKEN_OP;
+			break;
+		}
+		cast = false;
+		p++;
+	}
+#undef VALUE_ALLOWED
+
+	MEM(shape = talloc_strndup_append_buffer(shape, span, p - span));
+
+	*shape_out = shape;
+	*values_out = values;
+	*count_out = count;
+
+	return 0;
+
+error:
+	talloc_free(shape);
+	talloc_free(values);
+	return -1;
+}
+
+/** Escape a value using the character set of a connection
+ *
+ */
+static ssize_t sql_escape_conn(request_t *request, char *out, size_t outlen, char const *in, void *arg)
+{
+	size_t			inlen, ret;
+	rlm_sql_postgres_conn_t	*conn = talloc_get_type_abort(arg, rlm_sql_postgres_conn_t);
+	int			err;
+
+	/* Check for potential buffer overflow */
+	inlen = strlen(in);
+	if ((inlen * 2 + 1) > outlen) return 0;
+	/* Prevent integer overflow */
+	if ((inlen * 2 + 1) <= inlen) return 0;
+
+	ret = PQescapeStringConn(conn->db, out, in, inlen, &err);
+	if (err) {
+		ROPTIONAL(REDEBUG, ERROR, "Error escaping string \"%s\": %s", in, PQerrorMessage(conn->db));
+		return 0;
+	}
+
+	return ret;
+}
+
+#ifdef LIBPQ_HAS_PIPELINING
+/** Send a query with its literals as parameters, using a prepared statement if possible
+ *
+ * @return
+ *	- 1 if the query can't be rewritten, and should be sent as is.
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int sql_query_send_prepared(rlm_sql_postgres_conn_t *c, rlm_sql_postgres_query_t *query, char const *query_str)
+{
+	TALLOC_CTX		*tmp_ctx;
+	char			*shape;
+	char const		**values;
+	int			count, ret;
+	rlm_sql_postgres_stmt_t	*stmt;
+
+	MEM(tmp_ctx = talloc_new(NULL));
+	if (sql_query_parameterise(tmp_ctx, &shape, &values, &count, query_str) < 0) {
+	literal:
+		talloc_free(tmp_ctx);
+		return 1;
+	}
+
+	stmt = fr_hash_table_find(c->stmts, &(rlm_sql_postgres_stmt_t){ .shape = shape });
+	if (stmt && stmt->broken) goto literal;
+
+	/*
+	 *	First time we've seen this shape on this connection.
+	 *	Prepare it in the same pipeline as the query.
+	 */
+	if (!stmt && (fr_hash_table_num_elements(c->stmts) < c->inst->max_prepared)) {
+		MEM(stmt = talloc_zero(c->stmts, rlm_sql_postgres_stmt_t));
+		stmt->shape = talloc_steal(stmt, shape);
+		snprintf(stmt->name, sizeof(stmt->name), "fr_%u", c->stmt_id++);
+		if (!fr_hash_table_insert(c->stmts, stmt)) {
+			talloc_free(stmt);
+			goto literal;
+		}
+
+		if (!PQsendPrepare(c->db, stmt->name, stmt->shape, count, NULL)) {
+			talloc_free(tmp_ctx);
+			return -1;
+		}
+		query->skip = 1;
+	}
+
+	if (stmt) {
+		ret = PQsendQueryPrepared(c->db, stmt->name, count, values, NULL, NULL, 0);
+	} else {
+		ret = PQsendQueryParams(c->db, shape, count, NULL, values, NULL, NULL, 0);
+	}
+	talloc_free(tmp_ctx);
+	if (!ret) return -1;
+
+	query->rewritten = true;
+	query->stmt = stmt;
+
+	return 0;
+}
+#endif
+
+/** Send a query on a connection
+ *
+ * @param[in] c		to send the query on.
+ * @param[in] query	state to record how the query was sent in.
+ * @param[in] query_str	to send.
+ * @param[in] literal	Send the query as is, even if prepared statements are enabled.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int sql_query_send(rlm_sql_postgres_conn_t *c, rlm_sql_postgres_query_t *query, char const *query_str,
+			  bool literal)
+{
+	char	*rendered = NULL;
+	int	ret = 1;
+
+	query->skip = 0;
+	query->rewritten = false;
+	query->stmt = NULL;
+
+#ifdef LIBPQ_HAS_PIPELINING
+	if (c->pipeline && c->inst->prepare && c->std_strings && !literal) {
+		ret = sql_query_send_prepared(c, query, query_str);
+		if (ret < 0) return -1;
+		if (ret == 0) return 0;
+	}
+#endif
+
+	/*
+	 *	Bound values have to be escaped if the query is sent as text.
+	 */
+	if (c->inst->prepare && sql_bind_present(query_str)) {
+		rendered = sql_bind_render(NULL, query_str, sql_escape_conn, c);
+		if (!rendered) return -1;
+		query_str = rendered;
+	}
+
+#ifdef LIBPQ_HAS_PIPELINING
+	if (c->pipeline) {
+		ret = PQsendQueryParams(c->db, query_str, 0, NULL, NULL, NULL, NULL, 0);
+	} else
+#endif
+	ret = PQsendQuery(c->db, query_str);
+	talloc_free(rendered);
+
+	return ret ? 0 : -1;
+}
+
+/** Commit the queries sent since the last sync
+ *
+ * All queries between two syncs run in a single implicit transaction.  If any
+ * of them fails, the others are rolled back.
+ */
+static int sql_pipeline_sync(rlm_sql_postgres_conn_t *c)
+{
+#ifdef LIBPQ_HAS_PIPELINING
+	FR_TIMER_DISARM(c->batch_ev);
+	c->batch_count = 0;
+
+	if (!PQpipelineSync(c->db)) return -1;
+	c->syncs++;
+#endif
+
+	return 0;
+}
+
+/** Send the sync for a batch which didn't fill in time
+ *
+ */
+static void _sql_batch_timeout(UNUSED fr_timer_list_t *tl, UNUSED fr_time_t now, void *uctx)
+{
+	rlm_sql_postgres_conn_t *c = talloc_get_type_abort(uctx, rlm_sql_postgres_conn_t);
+
+	if ((sql_pipeline_sync(c) < 0) || (PQflush(c->db) < 0)) {
+		ERROR("Failed sending batch: %s", PQerrorMessage(c->db));
+		connection_signal_reconnect(c->conn, CONNECTION_FAILED);
+	}
+}
+
+/** Decide whether to commit after sending a query
+ *
+ * Batchable queries (accounting and other writes) are committed together once
+ * batch_size of them have been sent, or batch_delay after the first.  Anything
+ * else is committed on its own, along with any batch in progress.
+ */
+static int sql_query_commit(rlm_sql_postgres_conn_t *c, rlm_sql_postgres_query_t *query, bool batch)
+{
+	rlm_sql_postgresql_t const *inst = c->inst;
+
+	if (!c->pipeline) return 0;
+
+	query->sent = fr_time();
+
+	if (!batch || (inst->batch_size <= 1)) return sql_pipeline_sync(c);
+
+	if (++c->batch_count >= inst->batch_size) return sql_pipeline_sync(c);
+
+	if ((c->batch_count == 1) &&
+	    (fr_timer_in(c, c->conn->el->tl, &c->batch_ev, inst->batch_delay, false, _sql_batch_timeout, c) < 0)) {
+		return sql_pipeline_sync(c);
+	}
+
+	return 0;
+}
+
+/** Send a query again, on its own, after the server rejected it, or its batch failed
+ *
+ */
+static int sql_query_resend(rlm_sql_postgres_conn_t *c, rlm_sql_postgres_query_t *query, bool literal)
+{
+	PQclear(query->result);
+	query->result = NULL;
+	query->read = false;
+
+	if ((sql_query_send(c, query, query->query_ctx->query_str, literal) < 0) ||
+	    (sql_pipeline_sync(c) < 0)) return -1;
+
+	query->conn = c;
+	fr_dlist_insert_tail(&c->queries, query);
+
+	return 0;
+}
+
+/** Finish setting up a connection once it's established
+ *
+ */
+static void sql_connection_ready(rlm_sql_postgres_conn_t *c)
+{
+	char const	*std_strings;
+
+	DEBUG2("Connected to database '%s' on '%s' server version %i, protocol version %i, backend PID %i ",
+	       PQdb(c->db), PQhost(c->db), PQserverVersion(c->db), PQprotocolVersion(c->db),
+	       PQbackendPID(c->db));
+	PQsetnonblocking(c->db, 1);
+
+	std_strings = PQparameterStatus(c->db, "standard_conforming_strings");
+	c->std_strings = std_strings && (strcmp(std_strings, "on") == 0);
+
+#ifdef LIBPQ_HAS_PIPELINING
+	if ((c->inst->pipeline_depth > 1) || c->inst->prepare) {
+		if (!PQenterPipelineMode(c->db)) {
+			ERROR("Failed entering pipeline mode: %s", PQerrorMessage(c->db));
+			connection_signal_reconnect(c->conn, CONNECTION_FAILED);
+			return;
+		}
+		c->pipeline = true;
+	}
+#endif
+
+	connection_signal_connected(c->conn);
+}
+
 static void _sql_connect_io_notify(fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
 {
 	rlm_sql_postgres_conn_t		*c = talloc_get_type_abort(uctx, rlm_sql_postgres_conn_t);
@@ -244,11 +955,7 @@ static void _sql_connect_io_notify(fr_event_list_t *el, int fd, UNUSED int flags
 	c->fd = PQsocket(c->db);
 	switch (status) {
 	case PGRES_POLLING_OK:
-		DEBUG2("Connected to database '%s' on '%s' server version %i, protocol version %i, backend PID %i ",
-		       PQdb(c->db), PQhost(c->db), PQserverVersion(c->db), PQprotocolVersion(c->db),
-		       PQbackendPID(c->db));
-		PQsetnonblocking(c->db, 1);
-		connection_signal_connected(c->conn);
+		sql_connection_ready(c);
 		return;
 
 	case PGRES_POLLING_FAILED:
@@ -282,6 +989,10 @@ static connection_state_t _sql_connection_init(void **h, connection_t *conn, voi
 	MEM(c = talloc_zero(conn, rlm_sql_postgres_conn_t));
 	c->conn = conn;
 	c->fd = -1;
+	c->inst = inst;
+	fr_dlist_talloc_init(&c->queries, rlm_sql_postgres_query_t, entry);
+	fr_dlist_talloc_init(&c->read, rlm_sql_postgres_query_t, entry);
+	if (inst->prepare) MEM(c->stmts = fr_hash_table_alloc(c, sql_stmt_hash, sql_stmt_cmp, NULL));
 
 	DEBUG2("Starting connection to PostgreSQL server using parameters: %s", inst->db_string);
 
@@ -295,11 +1006,8 @@ static connection_state_t _sql_connection_init(void **h, connection_t *conn, voi
 	switch (PQstatus(c->db)) {
 	case CONNECTION_OK:
 		c->fd = PQsocket(c->db);
-		DEBUG2("Connected to database '%s' on '%s' server version %i, protocol version %i, backend PID %i ",
-		       PQdb(c->db), PQhost(c->db), PQserverVersion(c->db), PQprotocolVersion(c->db),
-		       PQbackendPID(c->db));
-		PQsetnonblocking(c->db, 1);
-		connection_signal_connected(c->conn);
+		*h = c;
+		sql_connection_ready(c);
 		return CONNECTION_STATE_CONNECTING;
 
 	case CONNECTION_BAD:
@@ -329,21 +1037,30 @@ static connection_state_t _sql_connection_init(void **h, connection_t *conn, voi
 
 static void _sql_connection_close(fr_event_list_t *el, void *h, UNUSED void *uctx)
 {
-	rlm_sql_postgres_conn_t	*c = talloc_get_type_abort(h, rlm_sql_postgres_conn_t);
+	rlm_sql_postgres_conn_t		*c = talloc_get_type_abort(h, rlm_sql_postgres_conn_t);
+	rlm_sql_postgres_query_t	*query;
 
 	if (c->fd >= 0) {
 		fr_event_fd_delete(el, c->fd, FR_EVENT_FILTER_IO);
 		c->fd = -1;
 	}
 
-	if (c->result) {
-		PQclear(c->result);
-		c->result = NULL;
+	/*
+	 *	Detach any queries still awaiting results.
+	 */
+	while ((query = fr_dlist_pop_head(&c->queries))) {
+		query->conn = NULL;
+		if (!query->query_ctx) talloc_free(query);
 	}
+	while ((query = fr_dlist_pop_head(&c->read))) {
+		query->conn = NULL;
+		query->read = false;
+		if (!query->query_ctx) talloc_free(query);
+	}
+	FR_TIMER_DELETE(&c->batch_ev);
 
 	/* PQfinish also frees the memory used by the PGconn structure */
 	PQfinish(c->db);
-	c->query_ctx = NULL;
 	talloc_free(h);
 }
 
@@ -355,167 +1072,403 @@ CC_NO_UBSAN(function) /* UBSAN: false positive - public vs private connection_t
 static void sql_trunk_request_mux(UNUSED fr_event_list_t *el, trunk_connection_t *tconn,
 				  connection_t *conn, UNUSED void *uctx)
 {
-	rlm_sql_postgres_conn_t	*sql_conn = talloc_get_type_abort(conn->h, rlm_sql_postgres_conn_t);
-	request_t		*request;
-	trunk_request_t		*treq;
-	fr_sql_query_t		*query_ctx;
-	int			err;
+	rlm_sql_postgres_conn_t		*sql_conn = talloc_get_type_abort(conn->h, rlm_sql_postgres_conn_t);
+	rlm_sql_postgres_query_t	*query;
+	request_t			*request;
+	trunk_request_t			*treq;
+	fr_sql_query_t			*query_ctx;
 
-	if (trunk_connection_pop_request(&treq, tconn) != 0) return;
-	if (!treq) return;
+	/*
+	 *	In pipeline mode, send as many queries as the
+	 *	trunk will give us.
+	 */
+	while ((trunk_connection_pop_request(&treq, tconn) == 0) && treq) {
+		query_ctx = talloc_get_type_abort(treq->preq, fr_sql_query_t);
+		request = treq->request;
 
-	query_ctx = talloc_get_type_abort(treq->preq, fr_sql_query_t);
-	request = query_ctx->request;
+		if (query_ctx->status != SQL_QUERY_PREPARED) return;
 
-	switch (query_ctx->status) {
-	case SQL_QUERY_PREPARED:
 		ROPTIONAL(RDEBUG2, DEBUG2, "Executing query: %s", query_ctx->query_str);
-		err = PQsendQuery(sql_conn->db, query_ctx->query_str);
+
+		/*
+		 *	Results of the previous query in a transaction
+		 */
+		TALLOC_FREE(query_ctx->uctx);
+
+		MEM(query = talloc_zero(query_ctx, rlm_sql_postgres_query_t));
+		talloc_set_destructor(query, _sql_postgres_query_free);
+		query->query_ctx = query_ctx;
+		query->request = request;
+		query_ctx->uctx = query;
 		query_ctx->tconn = tconn;
-		if (!err) {
+
+		if ((sql_query_send(sql_conn, query, query_ctx->query_str, false) < 0) ||
+		    (sql_query_commit(sql_conn, query, query_ctx->batch) < 0)) {
 			ROPTIONAL(RERROR, ERROR, "Failed to send query: %s", PQerrorMessage(sql_conn->db));
 			trunk_request_signal_fail(treq);
+
+			/*
+			 *	Part of the pipeline may have been sent, so
+			 *	we can no longer match results to queries.
+			 */
+			if (sql_conn->pipeline) connection_signal_reconnect(conn, CONNECTION_FAILED);
 			return;
 		}
 
+		query->conn = sql_conn;
+		fr_dlist_insert_tail(&sql_conn->queries, query);
+
 		query_ctx->status = SQL_QUERY_SUBMITTED;
-		sql_conn->query_ctx = query_ctx;
 		trunk_request_signal_sent(treq);
-		return;
+
+		if (!sql_conn->pipeline) break;
+	}
+
+	/*
+	 *	Anything left in the send buffer is flushed
+	 *	when we next read from the connection.
+	 */
+	if (sql_conn->pipeline && (PQflush(sql_conn->db) < 0)) {
+		ERROR("Failed sending queries: %s", PQerrorMessage(sql_conn->db));
+		connection_signal_reconnect(conn, CONNECTION_FAILED);
+	}
+}
+
+/** Whether the server rejected a query because of the way we rewrote it
+ *
+ */
+static bool sql_result_rejected(PGresult const *result)
+{
+	char const *error_code;
+
+	switch (PQresultStatus(result)) {
+	case PGRES_FATAL_ERROR:
+		break;
 
 	default:
-		return;
+		return false;
 	}
+
+	error_code = PQresultErrorField(result, PG_DIAG_SQLSTATE);
+	if (!error_code) return false;
+
+	/*
+	 *	42 - Syntax error or access rule violation
+	 *	26 - Invalid SQL statement name (the statement failed to prepare)
+	 */
+	return ((error_code[0] == '4') && (error_code[1] == '2')) ||
+	       ((error_code[0] == '2') && (error_code[1] == '6'));
 }
 
-CC_NO_UBSAN(function) /* UBSAN: false positive - public vs private connection_t trips --fsanitize=function*/
-static void sql_trunk_request_demux(UNUSED fr_event_list_t *el, UNUSED trunk_connection_t *tconn,
-				    connection_t *conn, UNUSED void *uctx)
+/** Process the results of a query, once they've all been read
+ *
+ */
+static void sql_query_returned(rlm_sql_postgres_conn_t *sql_conn, rlm_sql_postgres_query_t *query)
 {
-	rlm_sql_postgres_conn_t	*sql_conn = talloc_get_type_abort(conn->h, rlm_sql_postgres_conn_t);
-	rlm_sql_postgresql_t	*inst;
-	fr_sql_query_t		*query_ctx;
+	fr_sql_query_t		*query_ctx = query->query_ctx;
 	request_t		*request;
-	PGresult		*tmp_result;
 	ExecStatusType		status;
 	int			numfields;
 
-	query_ctx = sql_conn->query_ctx;
-	request = query_ctx->request;
-	inst = talloc_get_type_abort(query_ctx->inst->driver_submodule->data, rlm_sql_postgresql_t);
+	/*
+	 *	Abandoned query
+	 */
+	if (!query_ctx) {
+		talloc_free(query);
+		return;
+	}
+	request = query->request;
+
+	/*
+	 *	The server didn't like the query with its literals as
+	 *	parameters.  Send it again as it was written, and don't
+	 *	rewrite it in future.
+	 */
+	if (query->rewritten && query->result && sql_result_rejected(query->result)) {
+		ROPTIONAL(RDEBUG2, DEBUG2, "Parameterised query rejected (%s), sending original query",
+			  PQresultErrorField(query->result, PG_DIAG_SQLSTATE));
+		if (query->stmt) query->stmt->broken = true;
 
-	switch (query_ctx->status) {
-	case SQL_QUERY_SUBMITTED:
-		if (PQconsumeInput(sql_conn->db) == 0) {
-			ROPTIONAL(RERROR, ERROR, "SQL query failed: %s", PQerrorMessage(sql_conn->db));
-			query_ctx->rcode = RLM_SQL_ERROR;
-			break;
-		}
-		if (PQisBusy(sql_conn->db)) return;
+		if (sql_query_resend(sql_conn, query, true) == 0) return;
 
+		ROPTIONAL(RERROR, ERROR, "Failed to send query: %s", PQerrorMessage(sql_conn->db));
 		query_ctx->status = SQL_QUERY_RETURNED;
+		query_ctx->rcode = RLM_SQL_ERROR;
+		goto done;
+	}
 
-		sql_conn->result = PQgetResult(sql_conn->db);
-
-		/* Discard results for appended queries */
-		while ((tmp_result = PQgetResult(sql_conn->db)) != NULL)
-			PQclear(tmp_result);
+	query_ctx->status = SQL_QUERY_RETURNED;
 
-		/*
-		 *  As this error COULD be a connection error OR an out-of-memory
-		 *  condition return value WILL be wrong SOME of the time
-		 *  regardless! Pick your poison...
-		 */
-		if (!sql_conn->result) {
-			ROPTIONAL(RERROR, ERROR, "Failed getting query result: %s", PQerrorMessage(sql_conn->db));
-			query_ctx->rcode = RLM_SQL_RECONNECT;
-			break;
-		}
+	/*
+	 *  As this error COULD be a connection error OR an out-of-memory
+	 *  condition return value WILL be wrong SOME of the time
+	 *  regardless! Pick your poison...
+	 */
+	if (!query->result) {
+		ROPTIONAL(RERROR, ERROR, "Failed getting query result: %s", PQerrorMessage(sql_conn->db));
+		query_ctx->rcode = RLM_SQL_RECONNECT;
+		goto done;
+	}
 
-		status = PQresultStatus(sql_conn->result);
-		switch (status){
-		/*
-		 *  Successful completion of a command returning no data.
-		 */
-		case PGRES_COMMAND_OK:
-			/*
-			 *  Affected_rows function only returns the number of affected rows of a command
-			 *  returning no data...
-			 */
-			sql_conn->affected_rows = affected_rows(sql_conn->result);
-			ROPTIONAL(RDEBUG2, DEBUG2, "query affected rows = %i", sql_conn->affected_rows);
-			break;
+	status = PQresultStatus(query->result);
+	switch (status){
+	/*
+	 *  Successful completion of a command returning no data.
+	 */
+	case PGRES_COMMAND_OK:
 		/*
-		 *  Successful completion of a command returning data (such as a SELECT or SHOW).
+		 *  Affected_rows function only returns the number of affected rows of a command
+		 *  returning no data...
 		 */
+		query->affected_rows = affected_rows(query->result);
+		ROPTIONAL(RDEBUG2, DEBUG2, "query affected rows = %i", query->affected_rows);
+		break;
+	/*
+	 *  Successful completion of a command returning data (such as a SELECT or SHOW).
+	 */
 #ifdef HAVE_PGRES_SINGLE_TUPLE
-		case PGRES_SINGLE_TUPLE:
+	case PGRES_SINGLE_TUPLE:
 #endif
 #ifdef HAVE_PGRES_TUPLES_CHUNK
-		case PGRES_TUPLES_CHUNK:
+	case PGRES_TUPLES_CHUNK:
 #endif
-		case PGRES_TUPLES_OK:
-			sql_conn->cur_row = 0;
-			sql_conn->affected_rows = PQntuples(sql_conn->result);
-			numfields = PQnfields(sql_conn->result); /*Check row storing functions..*/
-			ROPTIONAL(RDEBUG2, DEBUG2, "query returned rows = %i, fields = %i", sql_conn->affected_rows, numfields);
-			break;
+	case PGRES_TUPLES_OK:
+		query->cur_row = 0;
+		query->affected_rows = PQntuples(query->result);
+		numfields = PQnfields(query->result); /*Check row storing functions..*/
+		ROPTIONAL(RDEBUG2, DEBUG2, "query returned rows = %i, fields = %i", query->affected_rows, numfields);
+		break;
 
 #ifdef HAVE_PGRES_COPY_BOTH
-		case PGRES_COPY_BOTH:
+	case PGRES_COPY_BOTH:
 #endif
-		case PGRES_COPY_OUT:
-		case PGRES_COPY_IN:
-			DEBUG2("Data transfer started");
-			break;
+	case PGRES_COPY_OUT:
+	case PGRES_COPY_IN:
+		DEBUG2("Data transfer started");
+		break;
 
-		/*
-		 *  Weird.. this shouldn't happen.
-		 */
-		case PGRES_EMPTY_QUERY:
-		case PGRES_BAD_RESPONSE:	/* The server's response was not understood */
-		case PGRES_NONFATAL_ERROR:
-		case PGRES_FATAL_ERROR:
+	/*
+	 *  Weird.. this shouldn't happen.
+	 */
+	case PGRES_EMPTY_QUERY:
+	case PGRES_BAD_RESPONSE:	/* The server's response was not understood */
+	case PGRES_NONFATAL_ERROR:
+	case PGRES_FATAL_ERROR:
 #ifdef HAVE_PGRES_PIPELINE_SYNC
-		case PGRES_PIPELINE_SYNC:
-		case PGRES_PIPELINE_ABORTED:
+	case PGRES_PIPELINE_SYNC:
+	case PGRES_PIPELINE_ABORTED:
 #endif
-			break;
+		break;
+	}
+
+	query_ctx->rcode = sql_classify_error(sql_conn->inst, status, query->result);
+
+done:
+	if (query_ctx->request) unlang_interpret_mark_runnable(query_ctx->request);
+}
+
+/** Process the queries committed by a sync
+ *
+ * If any query in a batch failed, the implicit transaction was rolled back, so
+ * the other queries are sent again on their own.
+ */
+static void sql_batch_committed(rlm_sql_postgres_conn_t *sql_conn)
+{
+	rlm_sql_postgresql_t const	*inst = sql_conn->inst;
+	rlm_sql_postgres_query_t	*query;
+	request_t			*request;
+	uint32_t			count = fr_dlist_num_elements(&sql_conn->read);
+	bool				failed = false;
+
+	if (count == 0) return;
+
+	if (inst->batch_size > 1) {
+		query = fr_dlist_head(&sql_conn->read);
+		atomic_fetch_add_explicit(&inst->stats->batches, 1, memory_order_relaxed);
+		atomic_fetch_add_explicit(&inst->stats->queries, count, memory_order_relaxed);
+		atomic_fetch_add_explicit(&inst->stats->latency_ns,
+					  fr_time_delta_unwrap(fr_time_sub(fr_time(), query->sent)), memory_order_relaxed);
+		DEBUG3("Committed batch of %u queries", count);
+	}
+
+	if (count > 1) {
+		for (query = fr_dlist_head(&sql_conn->read);
+		     query;
+		     query = fr_dlist_next(&sql_conn->read, query)) {
+			if (query->result && (PQresultStatus(query->result) == PGRES_FATAL_ERROR)) {
+				failed = true;
+				atomic_fetch_add_explicit(&inst->stats->failed, 1, memory_order_relaxed);
+				break;
+			}
 		}
+	}
 
-		query_ctx->rcode = sql_classify_error(inst, status, sql_conn->result);
-		break;
+	while ((query = fr_dlist_pop_head(&sql_conn->read))) {
+		query->read = false;
+		query->conn = NULL;
 
-	default:
-		fr_assert(0);
+		/*
+		 *	The query which failed gets its error.  The
+		 *	others were rolled back, or never ran.
+		 */
+		if (failed && query->query_ctx &&
+		    (!query->result || (PQresultStatus(query->result) != PGRES_FATAL_ERROR))) {
+			request = query->request;
+			ROPTIONAL(RDEBUG2, DEBUG2, "Batch was rolled back, sending query again");
+			atomic_fetch_add_explicit(&inst->stats->resent, 1, memory_order_relaxed);
+
+			if (sql_query_resend(sql_conn, query, false) == 0) continue;
+
+			ROPTIONAL(RERROR, ERROR, "Failed to send query: %s", PQerrorMessage(sql_conn->db));
+			query->query_ctx->status = SQL_QUERY_RETURNED;
+			query->query_ctx->rcode = RLM_SQL_ERROR;
+			if (query->query_ctx->request) unlang_interpret_mark_runnable(query->query_ctx->request);
+			continue;
+		}
+
+		sql_query_returned(sql_conn, query);
 	}
+}
+
+/** Fail all queries on a connection
+ *
+ */
+static void sql_query_fail_all(rlm_sql_postgres_conn_t *sql_conn, fr_dlist_head_t *list)
+{
+	rlm_sql_postgres_query_t	*query;
+	request_t			*request;
+
+	while ((query = fr_dlist_pop_head(list))) {
+		query->conn = NULL;
+		query->read = false;
+		if (!query->query_ctx) {
+			talloc_free(query);
+			continue;
+		}
+
+		request = query->request;
+		ROPTIONAL(RERROR, ERROR, "SQL query failed: %s", PQerrorMessage(sql_conn->db));
+		query->query_ctx->status = SQL_QUERY_RETURNED;
+		query->query_ctx->rcode = RLM_SQL_ERROR;
+		if (query->query_ctx->request) unlang_interpret_mark_runnable(query->query_ctx->request);
+	}
+}
+
+CC_NO_UBSAN(function) /* UBSAN: false positive - public vs private connection_t trips --fsanitize=function*/
+static void sql_trunk_request_demux(UNUSED fr_event_list_t *el, UNUSED trunk_connection_t *tconn,
+				    connection_t *conn, UNUSED void *uctx)
+{
+	rlm_sql_postgres_conn_t		*sql_conn = talloc_get_type_abort(conn->h, rlm_sql_postgres_conn_t);
+	rlm_sql_postgres_query_t	*query;
+	PGresult			*result;
+
+	if (PQconsumeInput(sql_conn->db) == 0) {
+		sql_query_fail_all(sql_conn, &sql_conn->read);
+		sql_query_fail_all(sql_conn, &sql_conn->queries);
+		sql_conn->syncs = 0;
+		return;
+	}
+
+	/*
+	 *	Results arrive in the order the queries were sent.  Each
+	 *	command's results are terminated by a NULL result.  In
+	 *	pipeline mode, the results of a query are only final once
+	 *	the sync which follows it (or its batch) has been received.
+	 */
+	while ((fr_dlist_num_elements(&sql_conn->queries) > 0) || (sql_conn->syncs > 0)) {
+		if (PQisBusy(sql_conn->db)) return;
+
+		result = PQgetResult(sql_conn->db);
+
+#ifdef LIBPQ_HAS_PIPELINING
+		if (result && (PQresultStatus(result) == PGRES_PIPELINE_SYNC)) {
+			PQclear(result);
+			sql_conn->syncs--;
+			sql_batch_committed(sql_conn);
+			continue;
+		}
+#endif
+
+		query = fr_dlist_head(&sql_conn->queries);
+		if (!query) {
+			if (!result) break;
+			PQclear(result);
+			continue;
+		}
+
+		if (result) {
+			/*
+			 *	Result of preparing the statement.  Only
+			 *	interesting if it failed.
+			 */
+			if (query->skip && (PQresultStatus(result) == PGRES_COMMAND_OK)) {
+				PQclear(result);
+				continue;
+			}
 
-	if (request) unlang_interpret_mark_runnable(request);
+			/*
+			 *	Keep the first result, discarding those of
+			 *	appended queries, or those aborted because
+			 *	the statement failed to prepare.
+			 */
+			if (query->result) {
+				PQclear(result);
+				continue;
+			}
+			query->result = result;
+			continue;
+		}
+
+		if (query->skip) {
+			query->skip--;
+			continue;
+		}
+
+		fr_dlist_remove(&sql_conn->queries, query);
+		if (sql_conn->pipeline) {
+			query->read = true;
+			fr_dlist_insert_tail(&sql_conn->read, query);
+			continue;
+		}
+		query->conn = NULL;
+		sql_query_returned(sql_conn, query);
+	}
 }
 
 CC_NO_UBSAN(function) /* UBSAN: false positive - public vs private connection_t trips --fsanitize=function*/
-static void sql_request_cancel(connection_t *conn, void *preq, trunk_cancel_reason_t reason,
+static void sql_request_cancel(UNUSED connection_t *conn, void *preq, trunk_cancel_reason_t reason,
 			       UNUSED void *uctx)
 {
 	fr_sql_query_t		*query_ctx = talloc_get_type_abort(preq, fr_sql_query_t);
-	rlm_sql_postgres_conn_t	*sql_conn = talloc_get_type_abort(conn->h, rlm_sql_postgres_conn_t);
 
 	if (!query_ctx->treq) return;
 	if (reason != TRUNK_CANCEL_REASON_SIGNAL) return;
-	if (sql_conn->query_ctx == query_ctx) sql_conn->query_ctx = NULL;
+
+	/*
+	 *	Any results still to arrive will be discarded
+	 */
+	TALLOC_FREE(query_ctx->uctx);
 }
 
 CC_NO_UBSAN(function) /* UBSAN: false positive - public vs private connection_t trips --fsanitize=function*/
 static void sql_request_cancel_mux(UNUSED fr_event_list_t *el, trunk_connection_t *tconn,
 				   connection_t *conn, UNUSED void *uctx)
 {
-	trunk_request_t		*treq;
-	PGcancel		*cancel;
-	rlm_sql_postgres_conn_t	*sql_conn = talloc_get_type_abort(conn->h, rlm_sql_postgres_conn_t);
-	char			errbuf[256];
-	PGresult		*tmp_result;
+	trunk_request_t			*treq;
+	PGcancel			*cancel;
+	rlm_sql_postgres_conn_t		*sql_conn = talloc_get_type_abort(conn->h, rlm_sql_postgres_conn_t);
+	rlm_sql_postgres_query_t	*query;
+	char				errbuf[256];
+	PGresult			*tmp_result;
 
 	if ((trunk_connection_pop_cancellation(&treq, tconn)) == 0) {
+		/*
+		 *	Cancelling would affect whichever query the server
+		 *	happens to be running, which may not be ours.  The
+		 *	results are discarded when they arrive instead.
+		 */
+		if (sql_conn->pipeline) goto complete;
+
 		cancel = PQgetCancel(sql_conn->db);
 		if (!cancel) goto complete;
 		if (PQcancel(cancel, errbuf, sizeof(errbuf)) == 0) {
@@ -530,6 +1483,11 @@ static void sql_request_cancel_mux(UNUSED fr_event_list_t *el, trunk_connection_
 		while ((tmp_result = PQgetResult(sql_conn->db)) != NULL)
 			PQclear(tmp_result);
 
+		while ((query = fr_dlist_pop_head(&sql_conn->queries))) {
+			query->conn = NULL;
+			if (!query->query_ctx) talloc_free(query);
+		}
+
 	complete:
 		trunk_request_signal_cancel_complete(treq);
 	}
@@ -540,17 +1498,17 @@ SQL_QUERY_RESUME
 
 static sql_rcode_t sql_fields(char const **out[], fr_sql_query_t *query_ctx, UNUSED rlm_sql_config_t const *config)
 {
-	rlm_sql_postgres_conn_t *conn = talloc_get_type_abort(query_ctx->tconn->conn->h, rlm_sql_postgres_conn_t);
+	rlm_sql_postgres_query_t *query = talloc_get_type_abort(query_ctx->uctx, rlm_sql_postgres_query_t);
 
 	int		fields, i;
 	char const	**names;
 
-	fields = PQnfields(conn->result);
+	fields = PQnfields(query->result);
 	if (fields <= 0) return RLM_SQL_ERROR;
 
 	MEM(names = talloc_array(query_ctx, char const *, fields));
 
-	for (i = 0; i < fields; i++) names[i] = PQfname(conn->result, i);
+	for (i = 0; i < fields; i++) names[i] = PQfname(query->result, i);
 	*out = names;
 
 	return RLM_SQL_OK;
@@ -560,28 +1518,28 @@ static unlang_action_t sql_fetch_row(unlang_result_t *p_result, UNUSED request_t
 {
 	fr_sql_query_t		*query_ctx = talloc_get_type_abort(uctx, fr_sql_query_t);
 	int			records, i, len;
-	rlm_sql_postgres_conn_t *conn = talloc_get_type_abort(query_ctx->tconn->conn->h, rlm_sql_postgres_conn_t);
+	rlm_sql_postgres_query_t *query = talloc_get_type_abort(query_ctx->uctx, rlm_sql_postgres_query_t);
 
 	query_ctx->row = NULL;
 
 	query_ctx->rcode = RLM_SQL_NO_MORE_ROWS;
-	if (conn->cur_row >= PQntuples(conn->result)) RETURN_UNLANG_OK;
+	if (query->cur_row >= PQntuples(query->result)) RETURN_UNLANG_OK;
 
-	free_result_row(conn);
+	free_result_row(query);
 
-	records = PQnfields(conn->result);
-	conn->num_fields = records;
+	records = PQnfields(query->result);
+	query->num_fields = records;
 
-	if ((PQntuples(conn->result) > 0) && (records > 0)) {
-		conn->row = talloc_zero_array(conn, char *, records + 1);
+	if ((PQntuples(query->result) > 0) && (records > 0)) {
+		query->row = talloc_zero_array(query, char *, records + 1);
 		for (i = 0; i < records; i++) {
-			if (PQgetisnull(conn->result, conn->cur_row, i)) continue;
-			len = PQgetlength(conn->result, conn->cur_row, i);
-			conn->row[i] = talloc_array(conn->row, char, len + 1);
-			strlcpy(conn->row[i], PQgetvalue(conn->result, conn->cur_row, i), len + 1);
+			if (PQgetisnull(query->result, query->cur_row, i)) continue;
+			len = PQgetlength(query->result, query->cur_row, i);
+			query->row[i] = talloc_array(query->row, char, len + 1);
+			strlcpy(query->row[i], PQgetvalue(query->result, query->cur_row, i), len + 1);
 		}
-		conn->cur_row++;
-		query_ctx->row = conn->row;
+		query->cur_row++;
+		query_ctx->row = query->row;
 
 		query_ctx->rcode = RLM_SQL_OK;
 	}
@@ -591,23 +1549,8 @@ static unlang_action_t sql_fetch_row(unlang_result_t *p_result, UNUSED request_t
 
 static sql_rcode_t sql_free_result(fr_sql_query_t *query_ctx, UNUSED rlm_sql_config_t const *config)
 {
-	rlm_sql_postgres_conn_t *conn;
-
-	if (query_ctx->treq && !(query_ctx->treq->state &
-	    (TRUNK_REQUEST_STATE_SENT | TRUNK_REQUEST_STATE_REAPABLE | TRUNK_REQUEST_STATE_COMPLETE))) return RLM_SQL_OK;
-
-	if (!query_ctx->tconn || !query_ctx->tconn->conn || !query_ctx->tconn->conn->h) return RLM_SQL_ERROR;
-
-	if (!(query_ctx->tconn->state & TRUNK_CONN_PROCESSING)) return RLM_SQL_ERROR;
-
-	conn = talloc_get_type_abort(query_ctx->tconn->conn->h, rlm_sql_postgres_conn_t);
-
-	if (conn->result != NULL) {
-		PQclear(conn->result);
-		conn->result = NULL;
-	}
-
-	free_result_row(conn);
+	TALLOC_FREE(query_ctx->uctx);
+	query_ctx->row = NULL;
 
 	return 0;
 }
@@ -626,12 +1569,20 @@ static size_t sql_error(TALLOC_CTX *ctx, sql_log_entry_t out[], size_t outlen,
 			fr_sql_query_t *query_ctx)
 {
 	rlm_sql_postgres_conn_t *conn = talloc_get_type_abort(query_ctx->tconn->conn->h, rlm_sql_postgres_conn_t);
+	rlm_sql_postgres_query_t *query = query_ctx->uctx;
 	char const		*p, *q;
 	size_t			i = 0;
 
 	fr_assert(outlen > 0);
 
-	p = PQerrorMessage(conn->db);
+	/*
+	 *	With several queries in flight, the connection's
+	 *	error may belong to another query.
+	 */
+	p = NULL;
+	if (query && query->result) p = PQresultErrorMessage(query->result);
+	if (!p || (*p == '\0')) p = PQerrorMessage(conn->db);
+
 	while ((q = strchr(p, '\n'))) {
 		out[i].type = L_ERR;
 		out[i].msg = talloc_typed_asprintf(ctx, "%.*s", (int) (q - p), p);
@@ -649,40 +1600,84 @@ static size_t sql_error(TALLOC_CTX *ctx, sql_log_entry_t out[], size_t outlen,
 
 static int sql_affected_rows(fr_sql_query_t *query_ctx, UNUSED rlm_sql_config_t const *config)
 {
-	rlm_sql_postgres_conn_t *conn = talloc_get_type_abort(query_ctx->tconn->conn->h, rlm_sql_postgres_conn_t);
+	rlm_sql_postgres_query_t *query = talloc_get_type_abort(query_ctx->uctx, rlm_sql_postgres_query_t);
 
-	return conn->affected_rows;
+	return query->affected_rows;
+}
+
+/** Maximum number of queries which may be in flight on a connection
+ *
+ */
+static uint32_t sql_pipeline_depth(void const *driver_inst)
+{
+	rlm_sql_postgresql_t const *inst = talloc_get_type_abort_const(driver_inst, rlm_sql_postgresql_t);
+
+	return inst->pipeline_depth;
+}
+
+/** Whether values are bound instead of escaped
+ *
+ * Only queries sent as prepared statements bind values.  Values in any others are
+ * escaped when the query is sent.
+ */
+static bool sql_bind_values(void const *driver_inst)
+{
+	rlm_sql_postgresql_t const *inst = talloc_get_type_abort_const(driver_inst, rlm_sql_postgresql_t);
+
+	return inst->prepare;
 }
 
 static ssize_t sql_escape_func(request_t *request, char *out, size_t outlen, char const *in, void *arg)
 {
-	size_t			inlen, ret;
 	connection_t		*c = talloc_get_type_abort(arg, connection_t);
-	rlm_sql_postgres_conn_t	*conn;
-	int			err;
 
 	if ((c->state == CONNECTION_STATE_HALTED) || (c->state == CONNECTION_STATE_CLOSED)) {
 		ROPTIONAL(RERROR, ERROR, "Connection not available for escaping");
 		return -1;
 	}
 
-	conn = talloc_get_type_abort(c->h, rlm_sql_postgres_conn_t);
+	return sql_escape_conn(request, out, outlen, in, c->h);
+}
 
-	/* Check for potential buffer overflow */
-	inlen = strlen(in);
-	if ((inlen * 2 + 1) > outlen) return 0;
-	/* Prevent integer overflow */
-	if ((inlen * 2 + 1) <= inlen) return 0;
+static int cmd_stats_batch(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	rlm_sql_postgres_batch_stats_t	*stats = ctx;
+	uint64_t			batches, queries, latency_ns;
 
-	ret = PQescapeStringConn(conn->db, out, in, inlen, &err);
-	if (err) {
-		ROPTIONAL(REDEBUG, ERROR, "Error escaping string \"%s\": %s", in, PQerrorMessage(conn->db));
-		return 0;
-	}
+	batches = atomic_load_explicit(&stats->batches, memory_order_relaxed);
+	queries = atomic_load_explicit(&stats->queries, memory_order_relaxed);
+	latency_ns = atomic_load_explicit(&stats->latency_ns, memory_order_relaxed);
 
-	return ret;
+	fprintf(fp, "batches\t\t\t%" PRIu64 "\n", batches);
+	fprintf(fp, "queries\t\t\t%" PRIu64 "\n", queries);
+	fprintf(fp, "failed\t\t\t%" PRIu64 "\n", atomic_load_explicit(&stats->failed, memory_order_relaxed));
+	fprintf(fp, "resent\t\t\t%" PRIu64 "\n", atomic_load_explicit(&stats->resent, memory_order_relaxed));
+	fprintf(fp, "size.average\t\t%.2f\n", batches ? (double)queries / batches : 0.0);
+	fprintf(fp, "latency.average_usec\t%.1f\n", batches ? (double)latency_ns / batches / 1000 : 0.0);
+
+	return 0;
 }
 
+static fr_cmd_table_t cmd_batch_table[] = {
+	{
+		.parent = "stats",
+		.name = "sql",
+		.help = "Statistics for SQL modules.",
+		.read_only = true
+	},
+
+	{
+		.parent = "stats sql",
+		.add_name = true,
+		.name = "batch",
+		.func = cmd_stats_batch,
+		.help = "Show group commit statistics for a specific SQL module.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
 static int mod_instantiate(module_inst_ctx_t const *mctx)
 {
 	rlm_sql_t const		*parent = talloc_get_type_abort(mctx->mi->parent->data, rlm_sql_t);
@@ -773,6 +1768,36 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	}
 	inst->db_string = db_string;
 
+#ifndef LIBPQ_HAS_PIPELINING
+	if ((inst->pipeline_depth > 1) || inst->prepare) {
+		cf_log_err(mctx->mi->conf, "'pipeline_depth' and 'prepare' require libpq >= 14");
+		return -1;
+	}
+#endif
+
+	/*
+	 *	Queries can only be committed together if several
+	 *	can be in flight on a connection.
+	 */
+	if (inst->batch_size > 1) {
+		if (inst->pipeline_depth < inst->batch_size) {
+			cf_log_err(mctx->mi->conf, "'batch_size' (%u) must not be greater than 'pipeline_depth' (%u)",
+				   inst->batch_size, inst->pipeline_depth);
+			return -1;
+		}
+
+		if (!fr_time_delta_ispos(inst->batch_delay)) {
+			cf_log_err(mctx->mi->conf, "'batch_delay' must be greater than zero");
+			return -1;
+		}
+
+		MEM(inst->stats = talloc_zero(inst, rlm_sql_postgres_batch_stats_t));
+		if (fr_command_register_hook(NULL, mctx->mi->parent->name, inst->stats, cmd_batch_table) < 0) {
+			PERROR("Failed registering radmin commands");
+			return -1;
+		}
+	}
+
 	inst->states = sql_state_trie_alloc(inst);
 
 	/*
@@ -844,7 +1869,9 @@ rlm_sql_driver_t rlm_sql_postgresql = {
 		.config				= driver_config,
 		.instantiate			= mod_instantiate
 	},
-	.flags				= RLM_SQL_RCODE_FLAGS_ALT_QUERY,
+	.flags				= RLM_SQL_RCODE_FLAGS_ALT_QUERY | RLM_SQL_MULTI_QUERY_CONN | RLM_SQL_SHARED_TRUNK,
+	.sql_pipeline_depth		= sql_pipeline_depth,
+	.sql_bind_values		= sql_bind_values,
 	.sql_query_resume		= sql_query_resume,
 	.sql_select_query_resume	= sql_query_resume,
 	.sql_fields			= sql_fields,
@@ -0,0 +1,9 @@
+TARGET		:= rlm_sql_postgresql$(L)
+SOURCES		:= rlm_sql_postgresql.c
+
+SRC_CFLAGS	:= $(rlm_sql_postgresql_CFLAGS)
+SRC_CFLAGS	+= -I${top_srcdir}/src/modules/rlm_sql
+TGT_LDLIBS	:= $(rlm_sql_postgresql_LDLIBS)
+TGT_PREREQS	:= rlm_sql.a
+
+$(call DEFINE_LOG_ID_SECTION,postgresql,1,$(SOURCES))
@@ -0,0 +1,256 @@
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include "rlm_sql_postgresql.c"
+
+typedef struct {
+	char const	*shape;			//!< Expected shape, or NULL if the query can't be rewritten.
+	char const	*values[4];		//!< Expected values.
+} test_parameterise_t;
+
+/** Wrap a value as rlm_sql does for drivers which bind values
+ *
+ */
+static char *test_bind(TALLOC_CTX *ctx, char const *value)
+{
+	size_t	len = strlen(value);
+	char	*out;
+
+	MEM(out = talloc_array(ctx, char, (len * 2) + 3));
+	TEST_ASSERT(sql_bind_mark(out, (len * 2) + 3, value, len) >= 0);
+
+	return out;
+}
+
+static void test_check(char const *query, test_parameterise_t const *expected)
+{
+	TALLOC_CTX	*ctx = talloc_init_const("test");
+	char		*shape;
+	char const	**values;
+	int		count, i, ret;
+
+	ret = sql_query_parameterise(ctx, &shape, &values, &count, query);
+	if (!expected->shape) {
+		TEST_CHECK(ret < 0);
+		TEST_MSG("Expected query to be sent as is, got \"%s\"", (ret == 0) ? shape : "");
+		talloc_free(ctx);
+		return;
+	}
+
+	TEST_ASSERT(ret == 0);
+	TEST_CHECK_STRCMP(shape, expected->shape);
+
+	for (i = 0; (i < (int)NUM_ELEMENTS(expected->values)) && expected->values[i]; i++);
+	TEST_CHECK(count == i);
+	TEST_MSG("Expected %i values, got %i", i, count);
+
+	for (i = 0; (i < count) && (i < (int)NUM_ELEMENTS(expected->values)); i++) {
+		TEST_CHECK_STRCMP(values[i], expected->values[i]);
+	}
+
+	talloc_free(ctx);
+}
+
+#define TEST_QUERY(_query, _shape, ...) \
+	test_check(_query, &(test_parameterise_t){ .shape = _shape, .values = { __VA_ARGS__ } })
+
+#define TEST_QUERY_LITERAL(_query) \
+	test_check(_query, &(test_parameterise_t){ .shape = NULL })
+
+static void test_quotes(void)
+{
+	TEST_CASE("Strings and integers are replaced");
+	TEST_QUERY("SELECT id FROM radcheck WHERE username = 'bob' AND id > 10",
+		   "SELECT id FROM radcheck WHERE username = $1 AND id > $2::int8", "bob", "10");
+
+	TEST_CASE("Doubled quotes are unescaped");
+	TEST_QUERY("SELECT 1 FROM t WHERE a = 'O''Brien' OR a = ''''",
+		   "SELECT $1::int8 FROM t WHERE a = $2 OR a = $3", "1", "O'Brien", "'");
+
+	TEST_CASE("Empty strings");
+	TEST_QUERY("INSERT INTO t VALUES ('', 'x')", "INSERT INTO t VALUES ($1, $2)", "", "x");
+
+	TEST_CASE("E'' strings are left alone, including escaped quotes");
+	TEST_QUERY("SELECT * FROM t WHERE a = E'it\\'s' AND b = 'x'",
+		   "SELECT * FROM t WHERE a = E'it\\'s' AND b = $1", "x");
+
+	TEST_CASE("Quoted identifiers are left alone");
+	TEST_QUERY("SELECT \"we'ird\"\"name\" FROM t WHERE a = 'x'",
+		   "SELECT \"we'ird\"\"name\" FROM t WHERE a = $1", "x");
+
+	TEST_CASE("Unterminated strings");
+	TEST_QUERY_LITERAL("SELECT * FROM t WHERE a = 'x");
+	TEST_QUERY_LITERAL("SELECT * FROM t WHERE a = 'x''");
+	TEST_QUERY_LITERAL("SELECT \"x FROM t");
+}
+
+static void test_position(void)
+{
+	TEST_CASE("Typed literals are left alone");
+	TEST_QUERY("SELECT now() - INTERVAL '1 day' FROM t WHERE a = 'x'",
+		   "SELECT now() - INTERVAL '1 day' FROM t WHERE a = $1", "x");
+
+	TEST_CASE("Type modifiers are left alone");
+	TEST_QUERY("SELECT CAST('x' AS varchar(64)), 'y'::numeric(10, 2)",
+		   "SELECT CAST($1 AS varchar(64)), $2::numeric(10, 2)", "x", "y");
+
+	TEST_CASE("ORDER BY ordinals are left alone");
+	TEST_QUERY("SELECT a, b FROM t WHERE c = 5 ORDER BY 1, 2 LIMIT 3",
+		   "SELECT a, b FROM t WHERE c = $1::int8 ORDER BY 1, 2 LIMIT $2::int8", "5", "3");
+
+	TEST_CASE("Other numeric literals are left alone");
+	TEST_QUERY("SELECT 1.5, 1e10, 0x10 FROM t", "SELECT 1.5, 1e10, 0x10 FROM t");
+
+	TEST_CASE("A trailing semicolon is allowed, multiple statements aren't");
+	TEST_QUERY("DELETE FROM t WHERE a = 'x';  ", "DELETE FROM t WHERE a = $1;  ", "x");
+	TEST_QUERY_LITERAL("DELETE FROM t WHERE a = 'x'; DELETE FROM u");
+}
+
+static void test_comments(void)
+{
+	TEST_CASE("Line comments are stripped, quotes in them don't start strings");
+	TEST_QUERY("SELECT a -- it's 'x'\nFROM t WHERE b = 'y' -- trailing",
+		   "SELECT a \nFROM t WHERE b = $1 ", "y");
+
+	TEST_CASE("A single dash is an operator");
+	TEST_QUERY("SELECT a - 1 FROM t", "SELECT a - $1::int8 FROM t", "1");
+
+	TEST_CASE("Dashes in strings don't start comments");
+	TEST_QUERY("SELECT * FROM t WHERE a = '--x'", "SELECT * FROM t WHERE a = $1", "--x");
+
+	TEST_CASE("Block comments mean the query is sent as is");
+	TEST_QUERY_LITERAL("SELECT a /* it's */ FROM t WHERE b = 'x'");
+	TEST_QUERY_LITERAL("SELECT a FROM t WHERE b = 'x' /* unterminated");
+
+	TEST_CASE("Slashes in strings don't start comments");
+	TEST_QUERY("SELECT * FROM t WHERE a = '/*x*/'", "SELECT * FROM t WHERE a = $1", "/*x*/");
+
+	TEST_CASE("Division is an operator");
+	TEST_QUERY("SELECT a / 2 FROM t", "SELECT a / $1::int8 FROM t", "2");
+}
+
+static void test_dollar(void)
+{
+	TEST_CASE("Dollar quoting means the query is sent as is");
+	TEST_QUERY_LITERAL("SELECT $$it's$$ FROM t WHERE a = 'x'");
+	TEST_QUERY_LITERAL("SELECT $tag$it's$tag$ FROM t");
+
+	TEST_CASE("Existing parameters mean the query is sent as is");
+	TEST_QUERY_LITERAL("SELECT * FROM t WHERE a = $1");
+
+	TEST_CASE("Dollars in identifiers and strings are allowed");
+	TEST_QUERY("SELECT a$b FROM t WHERE c = '$$'", "SELECT a$b FROM t WHERE c = $1", "$$");
+}
+
+static void test_bound(void)
+{
+	TALLOC_CTX	*ctx = talloc_init_const("test");
+	char		*query, *name;
+
+	name = test_bind(ctx, "O'Brien");
+
+	TEST_CASE("Bound values in strings are sent as they are");
+	query = talloc_asprintf(ctx, "SELECT * FROM t WHERE a = '%s'", name);
+	TEST_QUERY(query, "SELECT * FROM t WHERE a = $1", "O'Brien");
+
+	TEST_CASE("Bound values can be mixed with text");
+	query = talloc_asprintf(ctx, "SELECT * FROM t WHERE a = 'x''%sy'", name);
+	TEST_QUERY(query, "SELECT * FROM t WHERE a = $1", "x'O'Brieny");
+
+	TEST_CASE("Markers in bound values are escaped");
+	query = talloc_asprintf(ctx, "SELECT * FROM t WHERE a = '%s'", test_bind(ctx, "\x1e' OR ''='\x1f"));
+	TEST_QUERY(query, "SELECT * FROM t WHERE a = $1", "\x1e' OR ''='\x1f");
+
+	TEST_CASE("Quotes and comments in bound values don't end strings");
+	query = talloc_asprintf(ctx, "SELECT * FROM t WHERE a = '%s' AND b = 1",
+				test_bind(ctx, "x' -- \n/* $$"));
+	TEST_QUERY(query, "SELECT * FROM t WHERE a = $1 AND b = $2::int8", "x' -- \n/* $$", "1");
+
+	TEST_CASE("Bound values outside strings mean the query is sent as text");
+	query = talloc_asprintf(ctx, "SELECT * FROM t WHERE a = %s", name);
+	TEST_QUERY_LITERAL(query);
+
+	query = talloc_asprintf(ctx, "SELECT * FROM t WHERE a = E'%s'", name);
+	TEST_QUERY_LITERAL(query);
+
+	query = talloc_asprintf(ctx, "SELECT \"%s\" FROM t", name);
+	TEST_QUERY_LITERAL(query);
+
+	query = talloc_asprintf(ctx, "SELECT now() - INTERVAL '%s'", name);
+	TEST_QUERY_LITERAL(query);
+
+	query = talloc_asprintf(ctx, "SELECT a FROM t -- %s", name);
+	TEST_QUERY_LITERAL(query);
+
+	TEST_CASE("Unterminated bound values");
+	query = talloc_asprintf(ctx, "SELECT * FROM t WHERE a = '%cx'", SQL_BIND_START);
+	TEST_QUERY_LITERAL(query);
+
+	query = talloc_asprintf(ctx, "SELECT * FROM t WHERE a = 'x%c'", SQL_BIND_END);
+	TEST_QUERY_LITERAL(query);
+
+	talloc_free(ctx);
+}
+
+/** Quote doubling, as PQescapeStringConn does with standard_conforming_strings on
+ *
+ */
+static ssize_t test_escape(UNUSED request_t *request, char *out, size_t outlen, char const *in, UNUSED void *arg)
+{
+	char *q = out;
+
+	for (; *in; in++) {
+		if ((size_t)(q - out) >= (outlen - 2)) return -1;
+		if (*in == '\'') *q++ = '\'';
+		*q++ = *in;
+	}
+	*q = '\0';
+
+	return q - out;
+}
+
+static void test_render(void)
+{
+	TALLOC_CTX	*ctx = talloc_init_const("test");
+	char		*query, *rendered, safe[16];
+
+	TEST_CASE("Bound values are escaped when the query is sent as text");
+	query = talloc_asprintf(ctx, "SELECT * FROM t WHERE a = E'%s' AND b = '%s'",
+				test_bind(ctx, "it's"), test_bind(ctx, ""));
+	TEST_CHECK(sql_bind_present(query));
+	rendered = sql_bind_render(ctx, query, test_escape, NULL);
+	TEST_ASSERT(rendered != NULL);
+	TEST_CHECK_STRCMP(rendered, "SELECT * FROM t WHERE a = E'it''s' AND b = ''");
+
+	TEST_CASE("Escaped markers outside bound values are decoded");
+	TEST_CHECK(sql_bind_encode(safe, sizeof(safe), "a\x1d\x1e\x1f", 4) == 7);
+	query = talloc_asprintf(ctx, "SELECT '%s'", safe);
+	rendered = sql_bind_render(ctx, query, test_escape, NULL);
+	TEST_ASSERT(rendered != NULL);
+	TEST_CHECK_STRCMP(rendered, "SELECT 'a\x1d\x1e\x1f'");
+
+	TEST_CASE("Unterminated bound values are an error");
+	query = talloc_asprintf(ctx, "SELECT '%cx'", SQL_BIND_START);
+	TEST_CHECK(sql_bind_render(ctx, query, test_escape, NULL) == NULL);
+
+	TEST_CASE("Queries without bound values");
+	TEST_CHECK(!sql_bind_present("SELECT 'x'"));
+
+	TEST_CASE("Buffers which are too small");
+	TEST_CHECK(sql_bind_mark(safe, 3, "a", 1) < 0);
+	TEST_CHECK(sql_bind_mark(safe, 4, "a", 1) == 3);
+	TEST_CHECK(sql_bind_mark(safe, 4, "\x1e", 1) < 0);
+
+	talloc_free(ctx);
+}
+
+TEST_LIST = {
+	{ "Quotes - strings and identifiers",		test_quotes },
+	{ "Position - literals left alone",		test_position },
+	{ "Comments - line and block",			test_comments },
+	{ "Dollar - dollar quoting",			test_dollar },
+	{ "Bound - values sent as parameters",		test_bound },
+	{ "Render - values escaped",			test_render },
+
+	{ NULL }
+};
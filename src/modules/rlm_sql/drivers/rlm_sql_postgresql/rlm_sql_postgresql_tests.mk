@@ -0,0 +1,10 @@
+TARGET		:= rlm_sql_postgresql_tests$(E)
+SOURCES		:= rlm_sql_postgresql_tests.c
+
+SRC_CFLAGS	:= $(rlm_sql_postgresql_CFLAGS)
+SRC_CFLAGS	+= -I${top_srcdir}/src/modules/rlm_sql
+TGT_LDLIBS	:= $(LIBS) $(rlm_sql_postgresql_LDLIBS)
+TGT_LDFLAGS	:= $(LDFLAGS)
+TGT_PREREQS	:= rlm_sql.a libfreeradius-util$(L) libfreeradius-server$(L) libfreeradius-unlang$(L) libfreeradius-io$(L)
+
+TGT_INSTALLDIR	:=
@@ -269,6 +269,7 @@ int submodule_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, con
 
 	mi = talloc_get_type_abort(*((void **)out), module_instance_t);
 	inst->driver = (rlm_sql_driver_t const *)mi->exported; /* Public symbol exported by the submodule */
+	inst->bind_values = inst->driver->sql_bind_values && inst->driver->sql_bind_values(mi->data);
 
 	return 0;
 }
@@ -349,11 +350,28 @@ static int CC_HINT(nonnull(2,3)) sql_xlat_escape(request_t *request, fr_value_bo
 	rlm_sql_escape_uctx_t		*ctx = uctx;
 	rlm_sql_t const			*inst = talloc_get_type_abort_const(ctx->sql, rlm_sql_t);
 	rlm_sql_thread_t		*thread = talloc_get_type_abort(module_thread(inst->mi)->data, rlm_sql_thread_t);
+	bool				bind = inst->bind_values && !ctx->no_bind;
 
 	/*
 	 *	If it's already safe, don't do anything.
+	 *
+	 *	Unless the driver binds values, in which case any
+	 *	markers in the value have to be escaped, so that
+	 *	they can't be mistaken for bound values.
 	 */
-	if (fr_value_box_is_safe_for(vb, inst->driver)) return 0;
+	if (fr_value_box_is_safe_for(vb, inst->driver)) {
+		if (!bind || (vb->type != FR_TYPE_STRING) || !sql_bind_present(vb->vb_strvalue)) return 0;
+
+		if (!fr_sbuff_init_talloc(vb, &sbuff, &sbuff_ctx, vb->vb_length * 2, vb->vb_length * 2)) {
+		alloc_error:
+			fr_strerror_printf_push("Failed to allocate buffer for escaped sql argument");
+			return -1;
+		}
+
+		len = sql_bind_encode(fr_sbuff_buff(&sbuff), vb->vb_length * 2 + 1, vb->vb_strvalue, vb->vb_length);
+		if (len < 0) goto error;
+		goto done;
+	}
 
 	/*
 	 *	No need to escape types with inherently safe data
@@ -369,33 +387,45 @@ static int CC_HINT(nonnull(2,3)) sql_xlat_escape(request_t *request, fr_value_bo
 		break;
 	}
 
-	if (inst->sql_escape_arg) {
-		arg = inst->sql_escape_arg;
-	} else if (thread->sql_escape_arg) {
-		arg = thread->sql_escape_arg;
-	}
-	if (!arg) {
+	/*
+	 *	Escaping functions work on strings - ensure the box is a string
+	 */
+	if ((vb->type != FR_TYPE_STRING) && (fr_value_box_cast_in_place(vb, vb, FR_TYPE_STRING, NULL) < 0)) {
 	error:
 		fr_value_box_clear_value(vb);
 		return -1;
 	}
 
 	/*
-	 *	Escaping functions work on strings - ensure the box is a string
+	 *	The driver sends the value separately from the query,
+	 *	so it only needs marking.
 	 */
-	if ((vb->type != FR_TYPE_STRING) && (fr_value_box_cast_in_place(vb, vb, FR_TYPE_STRING, NULL) < 0)) goto error;
+	if (bind) {
+		if (!fr_sbuff_init_talloc(vb, &sbuff, &sbuff_ctx, vb->vb_length * 2 + 2, vb->vb_length * 2 + 2)) {
+			goto alloc_error;
+		}
+
+		len = sql_bind_mark(fr_sbuff_buff(&sbuff), vb->vb_length * 2 + 3, vb->vb_strvalue, vb->vb_length);
+		if (len < 0) goto error;
+		goto done;
+	}
+
+	if (inst->sql_escape_arg) {
+		arg = inst->sql_escape_arg;
+	} else if (thread->sql_escape_arg) {
+		arg = thread->sql_escape_arg;
+	}
+	if (!arg) goto error;
 
 	/*
 	 *	Maximum escaped length is 3 * original - if every character needs escaping
 	 */
-	if (!fr_sbuff_init_talloc(vb, &sbuff, &sbuff_ctx, vb->vb_length * 3, vb->vb_length * 3)) {
-		fr_strerror_printf_push("Failed to allocate buffer for escaped sql argument");
-		return -1;
-	}
+	if (!fr_sbuff_init_talloc(vb, &sbuff, &sbuff_ctx, vb->vb_length * 3, vb->vb_length * 3)) goto alloc_error;
 
 	len = inst->sql_escape_func(request, fr_sbuff_buff(&sbuff), vb->vb_length * 3 + 1, vb->vb_strvalue, arg);
 	if (len < 0) goto error;
 
+done:
 	fr_sbuff_trim_talloc(&sbuff, len);
 	fr_value_box_strdup_shallow_replace(vb, fr_sbuff_buff(&sbuff), len);
 
@@ -428,12 +458,15 @@ static xlat_action_t sql_escape_xlat(UNUSED TALLOC_CTX *ctx, fr_dcursor_t *out,
 {
 	rlm_sql_t const		*inst = talloc_get_type_abort(xctx->mctx->mi->data, rlm_sql_t);
 	fr_value_box_t		*vb;
-	rlm_sql_escape_uctx_t	*escape_uctx = NULL;
+
+	/*
+	 *	The output may be used anywhere, so it's always escaped.
+	 */
+	rlm_sql_escape_uctx_t	escape_uctx = { .sql = inst, .no_bind = true };
 
 	while ((vb = fr_value_box_list_pop_head(in))) {
 		if (fr_value_box_is_safe_for(vb, inst->driver)) goto append;
-		if (!escape_uctx) escape_uctx = sql_escape_uctx_alloc(request, inst);
-		sql_box_escape(vb, escape_uctx);
+		sql_xlat_escape(request, vb, &escape_uctx);
 	append:
 		fr_dcursor_append(out, vb);
 	}
@@ -887,7 +920,7 @@ static unlang_action_t mod_map_proc(unlang_result_t *p_result, map_ctx_t const *
 	}
 
 	while ((vb = fr_value_box_list_next(query, vb))) {
-		if (fr_value_box_is_safe_for(vb, inst->driver)) continue;
+		if (!inst->bind_values && fr_value_box_is_safe_for(vb, inst->driver)) continue;
 		if (!escape_uctx) escape_uctx = sql_escape_uctx_alloc(request, inst);
 		sql_box_escape(vb, escape_uctx);
 	}
@@ -1876,6 +1909,12 @@ static unlang_action_t mod_sql_redundant_resume(unlang_result_t *p_result, modul
 	MEM(redundant_ctx->query_ctx = fr_sql_query_alloc(redundant_ctx, inst, request, redundant_ctx->trunk,
 							  redundant_ctx->query_vb->vb_strvalue, SQL_QUERY_OTHER));
 
+	/*
+	 *	Accounting and post-auth writes may be committed along
+	 *	with those of other requests, if the driver supports it.
+	 */
+	redundant_ctx->query_ctx->batch = true;
+
 	unlang_module_yield(request, mod_sql_redundant_query_resume, NULL, 0, redundant_ctx);
 	return unlang_function_push_with_result(/* discard, mod_sql_redundant_query_resume uses query_ctx->rcode*/ NULL,
 						request,
@@ -2046,14 +2085,16 @@ static int query_call_env_parse(TALLOC_CTX *ctx, call_env_parsed_head_t *out, tm
 	talloc_free(section2);
 
 	/*
-	 *	Use module specific escape functions
+	 *	Use module specific escape functions.  If the driver binds
+	 *	values, safe values are passed to the escape function too,
+	 *	so that they can't contain forged bound values.
 	 */
 	our_rules = *t_rules;
 	our_rules.escape = (tmpl_escape_t) {
 		.box_escape = (fr_value_box_escape_t) {
 			.func = sql_box_escape,
 			.safe_for = SQL_SAFE_FOR,
-			.always_escape = false,
+			.always_escape = inst->bind_values,
 		},
 		.uctx = { .func = { .uctx = inst, .alloc = sql_escape_uctx_alloc }, .type = TMPL_ESCAPE_UCTX_ALLOC_FUNC },
 		.mode = TMPL_ESCAPE_PRE_CONCAT,
@@ -2094,6 +2135,12 @@ static int mod_detach(module_detach_ctx_t const *mctx)
 {
 	rlm_sql_t	*inst = talloc_get_type_abort(mctx->mi->data, rlm_sql_t);
 
+	/*
+	 *	Stops any shared I/O threads, which may still be
+	 *	calling into the driver.
+	 */
+	TALLOC_FREE(inst->trunk_shared);
+
 	/*
 	 *	We need to explicitly free all children, so if the driver
 	 *	parented any memory off the instance, their destructors
@@ -2107,6 +2154,19 @@ static int mod_detach(module_detach_ctx_t const *mctx)
 	return 0;
 }
 
+/** Allocate the trunk uctx for a shared I/O thread
+ *
+ */
+static void *sql_shared_uctx_alloc(TALLOC_CTX *ctx, UNUSED fr_event_list_t *el, void *uctx)
+{
+	rlm_sql_thread_t	*t;
+
+	MEM(t = talloc_zero(ctx, rlm_sql_thread_t));
+	t->inst = talloc_get_type_abort(uctx, rlm_sql_t);
+
+	return t;
+}
+
 static int mod_instantiate(module_inst_ctx_t const *mctx)
 {
 	rlm_sql_boot_t const	*boot = talloc_get_type_abort(mctx->mi->boot, rlm_sql_boot_t);
@@ -2172,7 +2232,7 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	inst->box_escape = (fr_value_box_escape_t) {
 		.func = sql_box_escape,
 		.safe_for = SQL_SAFE_FOR,
-		.always_escape = false,
+		.always_escape = inst->bind_values,
 	};
 
 	inst->ef = module_rlm_exfile_init(inst, conf, 256, fr_time_delta_from_sec(30), true, NULL, NULL);
@@ -2181,22 +2241,50 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		return -1;
 	}
 
+	/*
+	 *	Instantiate the driver module.  Whether a connection can
+	 *	have multiple queries in flight may depend on its configuration.
+	 */
+	if (unlikely(module_instantiate(inst->driver_submodule) < 0)) {
+		cf_log_err(conf, "Failed instantiating driver module");
+		return -1;
+	}
+
 	/*
 	 *	Most SQL trunks can only have one running request per connection.
 	 */
 	if (!(inst->driver->flags & RLM_SQL_MULTI_QUERY_CONN)) {
 		inst->config.trunk_conf.target_req_per_conn = 1;
 		inst->config.trunk_conf.max_req_per_conn = 1;
+	} else if (inst->driver->sql_pipeline_depth) {
+		uint32_t depth = inst->driver->sql_pipeline_depth(inst->driver_submodule->data);
+
+		if (depth <= 1) {
+			inst->config.trunk_conf.target_req_per_conn = 1;
+			inst->config.trunk_conf.max_req_per_conn = 1;
+		} else {
+			inst->config.trunk_conf.max_req_per_conn = depth;
+			inst->config.trunk_conf.target_req_per_conn = (depth + 1) / 2;
+		}
 	}
 	if (!inst->driver->trunk_io_funcs.connection_notify) {
 		inst->config.trunk_conf.always_writable = true;
 	}
+	if (inst->config.trunk_conf.shared && !(inst->driver->flags & RLM_SQL_SHARED_TRUNK)) {
+		cf_log_warn(conf, "Driver %s does not support shared connections, using per-thread connections",
+			    inst->driver->common.name);
+		inst->config.trunk_conf.shared = false;
+	}
 
 	/*
-	 *	Instantiate the driver module
+	 *	Not parented by the instance, as instance data is
+	 *	read-only once the server is running, and workers
+	 *	update the shared trunk's state.
 	 */
-	if (unlikely(module_instantiate(inst->driver_submodule) < 0)) {
-		cf_log_err(conf, "Failed instantiating driver module");
+	inst->trunk_shared = trunk_shared_alloc(NULL, &inst->driver->trunk_io_funcs, &inst->config.trunk_conf,
+						inst->name, sql_shared_uctx_alloc, inst);
+	if (!inst->trunk_shared) {
+		cf_log_err(conf, "Failed creating connection trunk");
 		return -1;
 	}
 
@@ -2324,6 +2412,7 @@ static int mod_bootstrap(module_inst_ctx_t const *mctx)
 		.concat = true,
 		.func = sql_xlat_escape,
 		.safe_for = SQL_SAFE_FOR,
+		.always_escape = inst->bind_values,
 		.uctx = uctx
 	};
 	sql_xlat_arg[1] = (xlat_arg_parser_t)XLAT_ARG_PARSER_TERMINATOR;
@@ -2388,8 +2477,7 @@ static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
 
 	t->inst = inst;
 
-	t->trunk = trunk_alloc(t, mctx->el, &inst->driver->trunk_io_funcs,
-				  &inst->config.trunk_conf, inst->name, t, false);
+	t->trunk = trunk_shared_attach(t, mctx->el, inst->trunk_shared, t);
 	if (!t->trunk) return -1;
 
 	return 0;
@@ -2424,7 +2512,7 @@ static int call_env_parse(TALLOC_CTX *ctx, void *out, tmpl_rules_t const *t_rule
 	our_rules.escape.box_escape = (fr_value_box_escape_t) {
 		.func = sql_box_escape,
 		.safe_for = SQL_SAFE_FOR,
-		.always_escape = false,
+		.always_escape = inst->bind_values,
 	};
 	our_rules.escape.uctx.func.uctx = inst;
 	our_rules.literals_safe_for = SQL_SAFE_FOR;
@@ -32,6 +32,7 @@ RCSIDH(rlm_sql_h, "$Id$")
 #include <freeradius-devel/server/modpriv.h>
 #include <freeradius-devel/server/exfile.h>
 #include <freeradius-devel/server/trunk.h>
+#include <freeradius-devel/io/trunk_shared.h>
 #include <freeradius-devel/unlang/function.h>
 
 #define FR_ITEM_CHECK 0
@@ -144,6 +145,9 @@ typedef struct {
 	fr_sql_query_status_t	status;				//!< Status of the query.
 	sql_rcode_t		rcode;				//!< Result code.
 	rlm_sql_row_t		row;				//!< Row data from the last query.
+	bool			batch;				//!< Query may be committed in the same transaction as
+								///< those of other requests.  The result is only
+								///< returned once the transaction commits.
 	void			*uctx;				//!< Driver specific data.
 } fr_sql_query_t;
 
@@ -171,6 +175,26 @@ extern size_t sql_rcode_table_len;
 #define RLM_SQL_RCODE_FLAGS_ALT_QUERY	1			//!< Can distinguish between other errors and those
 								//!< resulting from a unique key violation.
 #define RLM_SQL_MULTI_QUERY_CONN	2			//!< Can support multiple queries on a single connection.
+#define RLM_SQL_SHARED_TRUNK		4			//!< Connections can be owned by a shared I/O thread,
+								//!< with results read by the worker which sent the query.
+
+/*
+ *	Values bound as query parameters
+ *
+ *	For drivers which bind values, tainted values aren't escaped.  They're
+ *	wrapped in SQL_BIND_START and SQL_BIND_END, and the driver sends them
+ *	separately from the query text.  Any marker bytes in the data, whether
+ *	in a bound value or in one which was already safe, are prefixed with
+ *	SQL_BIND_ESC so that bound values can't be forged.
+ */
+#define SQL_BIND_ESC			'\x1d'			//!< Next byte is data.
+#define SQL_BIND_START			'\x1e'			//!< Start of a bound value.
+#define SQL_BIND_END			'\x1f'			//!< End of a bound value.
+
+static inline CC_HINT(always_inline) bool sql_bind_is_marker(char c)
+{
+	return (c >= SQL_BIND_ESC) && (c <= SQL_BIND_END);
+}
 
 /** Retrieve errors from the last query operation
  *
@@ -195,6 +219,7 @@ typedef size_t (*sql_error_t)(TALLOC_CTX *ctx, sql_log_entry_t out[], size_t out
 
 typedef struct {
 	rlm_sql_t const		*sql;
+	bool			no_bind;		//!< Escape values, even if the driver binds them.
 } rlm_sql_escape_uctx_t;
 
 typedef struct {
@@ -202,6 +227,14 @@ typedef struct {
 
 	int		flags;
 
+	uint32_t	(*sql_pipeline_depth)(void const *driver_inst);	//!< Maximum number of queries in flight on
+									///< a connection, for drivers which set
+									///< #RLM_SQL_MULTI_QUERY_CONN.
+									///< Values <= 1 mean one query at a time.
+
+	bool		(*sql_bind_values)(void const *driver_inst);	//!< Whether tainted values should be
+									///< marked for binding instead of escaped.
+
 	unlang_function_with_result_t	sql_query_resume;		//!< Callback run after an SQL trunk query is run.
 	unlang_function_with_result_t	sql_select_query_resume;	//!< Callback run after an SQL select trunk query is run.
 
@@ -231,12 +264,15 @@ struct sql_inst {
 							//!< dictionary attribute.
 	exfile_t			*ef;
 
+	trunk_shared_t			*trunk_shared;		//!< Trunk configuration used by all workers.
+
 	module_instance_t		*driver_submodule;	//!< Driver's submodule.
 	rlm_sql_driver_t const		*driver;		//!< Driver's exported interface.
 
 	xlat_escape_legacy_t		sql_escape_func;
 	fr_value_box_escape_t		box_escape;
 	void				*sql_escape_arg;	//!< Instance specific argument to be passed to escape function.
+	bool				bind_values;		//!< Driver binds tainted values, see #SQL_BIND_START.
 
 	unlang_function_with_result_t	query;
 	unlang_function_with_result_t	select;
@@ -255,6 +291,11 @@ void 		rlm_sql_query_log(rlm_sql_t const *inst, char const *filename, char const
 unlang_action_t rlm_sql_trunk_query(unlang_result_t *p_result, request_t *request, void *uctx);
 unlang_action_t rlm_sql_fetch_row(unlang_result_t *p_result, request_t *request, void *uctx);
 void		rlm_sql_print_error(rlm_sql_t const *inst, request_t *request, fr_sql_query_t *query_ctx, bool force_debug);
+ssize_t		sql_bind_mark(char *out, size_t outlen, char const *in, size_t inlen);
+ssize_t		sql_bind_encode(char *out, size_t outlen, char const *in, size_t inlen);
+char const	*sql_bind_decode(char **out, char const *p);
+bool		sql_bind_present(char const *query);
+char		*sql_bind_render(TALLOC_CTX *ctx, char const *query, xlat_escape_legacy_t escape, void *arg);
 fr_sql_query_t *fr_sql_query_alloc(TALLOC_CTX *ctx, rlm_sql_t const *inst, request_t *request, trunk_t *trunk, char const *query_str, fr_sql_query_type_t type);
 
 /*
@@ -3,4 +3,5 @@ SOURCES		:= rlm_sql.c sql.c sql_state.c
 
 SRC_CFLAGS	:= $(rlm_sql_CFLAGS)
 TGT_LDLIBS	:= $(rlm_sql_LDLIBS)
+TGT_PREREQS	:= libfreeradius-io$(L)
 LOG_ID_LIB	= 50
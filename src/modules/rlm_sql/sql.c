@@ -367,6 +367,186 @@ unlang_action_t sql_get_map_list(unlang_result_t *p_result, request_t *request,
 						map_ctx->query_ctx);
 }
 
+/** Prefix any marker bytes in a value with #SQL_BIND_ESC
+ *
+ * @param[out] out	Where to write the encoded value.
+ * @param[in] outlen	Size of out, including space for the terminating \0.
+ * @param[in] in	Value to encode.
+ * @param[in] inlen	Length of in.
+ * @return
+ *	- Length of the encoded value.
+ *	- -1 if out is too small.
+ */
+ssize_t sql_bind_encode(char *out, size_t outlen, char const *in, size_t inlen)
+{
+	char const	*p, *end = in + inlen;
+	char		*q = out, *q_end = out + outlen;
+
+	for (p = in; p < end; p++) {
+		if (sql_bind_is_marker(*p)) {
+			if (q >= q_end) return -1;
+			*q++ = SQL_BIND_ESC;
+		}
+		if (q >= q_end) return -1;
+		*q++ = *p;
+	}
+	if (q >= q_end) return -1;
+	*q = '\0';
+
+	return q - out;
+}
+
+/** Mark a value to be bound by the driver, instead of escaping it
+ *
+ * @param[out] out	Where to write the marked value.
+ * @param[in] outlen	Size of out, including space for the terminating \0.
+ *			At most (inlen * 2) + 3 bytes are needed.
+ * @param[in] in	Value to mark.
+ * @param[in] inlen	Length of in.
+ * @return
+ *	- Length of the marked value.
+ *	- -1 if out is too small.
+ */
+ssize_t sql_bind_mark(char *out, size_t outlen, char const *in, size_t inlen)
+{
+	ssize_t	slen;
+
+	if (outlen < 3) return -1;
+
+	out[0] = SQL_BIND_START;
+	slen = sql_bind_encode(out + 1, outlen - 2, in, inlen);
+	if (slen < 0) return -1;
+	out[slen + 1] = SQL_BIND_END;
+	out[slen + 2] = '\0';
+
+	return slen + 2;
+}
+
+/** Decode a bound value
+ *
+ * @param[in,out] out	Where to write the value.  Advanced past the data written.
+ *			The value is never longer than its marked form.
+ * @param[in] p		Pointing at the #SQL_BIND_START of the value.
+ * @return
+ *	- Pointer to the character after the #SQL_BIND_END.
+ *	- NULL if the value isn't terminated.
+ */
+char const *sql_bind_decode(char **out, char const *p)
+{
+	char	*q = *out;
+
+	fr_assert(*p == SQL_BIND_START);
+
+	for (p++; *p; p++) {
+		if (*p == SQL_BIND_END) {
+			*out = q;
+			return p + 1;
+		}
+		if ((*p == SQL_BIND_ESC) && p[1]) p++;
+		*q++ = *p;
+	}
+
+	return NULL;
+}
+
+/** Whether a query contains any bound values
+ *
+ */
+bool sql_bind_present(char const *query)
+{
+	char const *p;
+
+	for (p = query; *p; p++) if (sql_bind_is_marker(*p)) return true;
+
+	return false;
+}
+
+/** Replace the bound values in a query with escaped ones
+ *
+ * Used when the driver can't bind the values in a query, and to write
+ * queries to log files.
+ *
+ * @param[in] ctx	to allocate the query in.
+ * @param[in] query	containing bound values.
+ * @param[in] escape	function to escape values with.
+ * @param[in] arg	to pass to the escape function.
+ * @return
+ *	- The query, with escaped values.
+ *	- NULL on error.
+ */
+char *sql_bind_render(TALLOC_CTX *ctx, char const *query, xlat_escape_legacy_t escape, void *arg)
+{
+	char const	*p = query, *span = query;
+	char		*out, *value, *q, *escaped;
+	size_t		len;
+	ssize_t		slen;
+
+	MEM(out = talloc_strdup(ctx, ""));
+
+	while (*p) {
+		if (!sql_bind_is_marker(*p)) {
+			p++;
+			continue;
+		}
+		MEM(out = talloc_strndup_append_buffer(out, span, p - span));
+
+		/*
+		 *	Data outside a bound value
+		 */
+		if (*p != SQL_BIND_START) {
+			if ((*p == SQL_BIND_ESC) && p[1]) p++;
+			MEM(out = talloc_strndup_append_buffer(out, p, 1));
+			span = ++p;
+			continue;
+		}
+
+		len = strlen(p);
+		MEM(value = talloc_array(out, char, len + 1));
+		q = value;
+		p = sql_bind_decode(&q, p);
+		if (!p) {
+		error:
+			talloc_free(out);
+			return NULL;
+		}
+		*q = '\0';
+
+		len = q - value;
+		MEM(escaped = talloc_array(out, char, (len * 3) + 1));
+		slen = escape(NULL, escaped, (len * 3) + 1, value, arg);
+		if (slen < 0) goto error;
+
+		MEM(out = talloc_strndup_append_buffer(out, escaped, slen));
+		talloc_free(escaped);
+		talloc_free(value);
+		span = p;
+	}
+	MEM(out = talloc_strndup_append_buffer(out, span, p - span));
+
+	return out;
+}
+
+/** Double quotes, to write bound values to the query log
+ *
+ */
+static ssize_t sql_bind_log_escape(UNUSED request_t *request, char *out, size_t outlen, char const *in,
+				   UNUSED void *arg)
+{
+	char *q = out, *end = out + outlen - 1;
+
+	for (; *in; in++) {
+		if (q >= end) return -1;
+		if (*in == '\'') {
+			*q++ = '\'';
+			if (q >= end) return -1;
+		}
+		*q++ = *in;
+	}
+	*q = '\0';
+
+	return q - out;
+}
+
 /*
  *	Log the query to a file.
  */
@@ -375,6 +555,7 @@ void rlm_sql_query_log(rlm_sql_t const *inst, char const *filename, char const *
 	int fd;
 	size_t len;
 	bool failed = false;	/* Write the log message outside of the critical region */
+	char *rendered = NULL;
 
 	fd = exfile_open(inst->ef, filename, 0640, NULL);
 	if (fd < 0) {
@@ -384,10 +565,16 @@ void rlm_sql_query_log(rlm_sql_t const *inst, char const *filename, char const *
 		return;
 	}
 
+	if (inst->bind_values && sql_bind_present(query)) {
+		rendered = sql_bind_render(NULL, query, sql_bind_log_escape, NULL);
+		if (rendered) query = rendered;
+	}
+
 	len = strlen(query);
 	if ((write(fd, query, len) < 0) || (write(fd, ";\n", 2) < 0)) failed = true;
 
 	if (failed) ERROR("Failed writing to logfile '%s': %s", filename, fr_syserror(errno));
 
 	exfile_close(inst->ef, fd);
+	talloc_free(rendered);
 }
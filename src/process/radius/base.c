@@ -877,6 +877,11 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 						   inst->auth.session_timeout, inst->auth.state_server_id,
 						   fr_hash_string(cf_section_name2(inst->server_cs)));
 
+	if (fr_command_register_hook(NULL, mctx->mi->name, inst->auth.state_tree, cmd_state_table) < 0) {
+		cf_log_perr(mctx->mi->conf, "Failed registering radmin commands");
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -1,11 +1 @@
-#
-# Makefile
-#
-# Version:      $Id$
-#
-TARGET		:= libfreeradius-internal$(L)
-
-SOURCES		:= decode.c \
-		   encode.c
-
-TGT_PREREQS	:= libfreeradius-util$(L)
+SUBMAKEFILES := libfreeradius-internal.mk detail_tests.mk
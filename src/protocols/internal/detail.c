@@ -0,0 +1,198 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file protocols/internal/detail.c
+ * @brief Functions to encode and decode binary detail file records.
+ *
+ * @copyright 2025 The FreeRADIUS server project
+ */
+#include <freeradius-devel/internal/internal.h>
+#include <freeradius-devel/internal/detail.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/nbo.h>
+#include <freeradius-devel/util/strerror.h>
+
+/** Calculate the checksum of a record
+ *
+ * Skips the flags and checksum fields.
+ */
+static uint32_t detail_record_checksum(uint8_t const *hdr, uint8_t const *payload, size_t payload_len)
+{
+	uint32_t hash;
+
+	hash = fr_hash(hdr, FR_DETAIL_RECORD_OFFSET_FLAGS);
+	hash = fr_hash_update(hdr + 5, 7, hash);
+	hash = fr_hash_update(hdr + 16, FR_DETAIL_RECORD_HDR_LEN - 16, hash);
+
+	return fr_hash_update(payload, payload_len, hash);
+}
+
+/** Encode a list of pairs as a binary detail record
+ *
+ * @param[in] dbuff		to write the record to.
+ * @param[in] code		Packet code of the request.
+ * @param[in] timestamp		When the request was received.
+ * @param[in] list		of pairs to encode.
+ * @param[in] encode_ctx	passed to the internal encoder.
+ * @return
+ *	- >0 length of the record.
+ *	- <0 on error.
+ */
+ssize_t fr_detail_record_encode(fr_dbuff_t *dbuff, uint32_t code, fr_unix_time_t timestamp,
+				fr_pair_list_t const *list, void *encode_ctx)
+{
+	fr_dbuff_t		work_dbuff = FR_DBUFF(dbuff);
+	fr_dbuff_marker_t	hdr_m;
+	uint8_t			*hdr;
+	ssize_t			slen;
+	size_t			payload_len;
+
+	fr_dbuff_marker(&hdr_m, &work_dbuff);
+
+	/*
+	 *	Reserve the header, and fill it in once we know the
+	 *	payload length.  The buffer may be reallocated while
+	 *	encoding, so we go through the marker afterwards.
+	 */
+	FR_DBUFF_MEMSET_RETURN(&work_dbuff, 0, FR_DETAIL_RECORD_HDR_LEN);
+
+	slen = fr_internal_encode_list(&work_dbuff, list, encode_ctx);
+	if (slen < 0) {
+		fr_dbuff_marker_release(&hdr_m);
+		return slen;
+	}
+	payload_len = (size_t) slen;
+
+	if (payload_len > UINT32_MAX) {
+		fr_strerror_printf("Record payload too large (%zu bytes)", payload_len);
+		fr_dbuff_marker_release(&hdr_m);
+		return -1;
+	}
+
+	hdr = fr_dbuff_current(&hdr_m);
+	memcpy(hdr, FR_DETAIL_RECORD_MAGIC, FR_DETAIL_RECORD_MAGIC_LEN);
+	hdr[FR_DETAIL_RECORD_OFFSET_FLAGS] = 0;
+	hdr[5] = FR_DETAIL_RECORD_VERSION;
+	fr_nbo_from_uint32(hdr + 8, (uint32_t) payload_len);
+	fr_nbo_from_uint32(hdr + 16, code);
+	fr_nbo_from_uint64(hdr + 24, fr_unix_time_unwrap(timestamp));
+	fr_nbo_from_uint32(hdr + 12, detail_record_checksum(hdr, hdr + FR_DETAIL_RECORD_HDR_LEN, payload_len));
+
+	fr_dbuff_marker_release(&hdr_m);
+
+	return fr_dbuff_set(dbuff, &work_dbuff);
+}
+
+/** Parse and verify a binary detail record
+ *
+ * @param[out] out		Decoded header.  payload points into data.
+ * @param[in] data		Start of the record.
+ * @param[in] data_len		Bytes available from data.
+ * @return
+ *	- >0 total length of the record.
+ *	- 0 if the record is incomplete.
+ *	- <0 if the record is malformed.
+ */
+ssize_t fr_detail_record_parse(fr_detail_record_t *out, uint8_t const *data, size_t data_len)
+{
+	size_t		payload_len;
+
+	if (data_len < FR_DETAIL_RECORD_HDR_LEN) return 0;
+
+	if (memcmp(data, FR_DETAIL_RECORD_MAGIC, FR_DETAIL_RECORD_MAGIC_LEN) != 0) {
+		fr_strerror_const("Invalid record magic");
+		return -1;
+	}
+
+	if (data[5] != FR_DETAIL_RECORD_VERSION) {
+		fr_strerror_printf("Unsupported record version %u", data[5]);
+		return -1;
+	}
+
+	payload_len = fr_nbo_to_uint32(data + 8);
+	if (payload_len > (data_len - FR_DETAIL_RECORD_HDR_LEN)) return 0;
+
+	if (fr_nbo_to_uint32(data + 12) != detail_record_checksum(data, data + FR_DETAIL_RECORD_HDR_LEN, payload_len)) {
+		fr_strerror_const("Record checksum mismatch");
+		return -1;
+	}
+
+	*out = (fr_detail_record_t) {
+		.flags = data[FR_DETAIL_RECORD_OFFSET_FLAGS],
+		.code = fr_nbo_to_uint32(data + 16),
+		.timestamp = fr_unix_time_wrap(fr_nbo_to_uint64(data + 24)),
+		.payload_len = payload_len,
+		.payload = data + FR_DETAIL_RECORD_HDR_LEN
+	};
+
+	return FR_DETAIL_RECORD_HDR_LEN + payload_len;
+}
+
+/** Find the next thing which looks like the start of a record
+ *
+ * Used to skip over damaged records, e.g. after a partial write.
+ *
+ * @param[in] data		to search, starting at the damaged record.
+ * @param[in] data_len		Bytes available from data.
+ * @return
+ *	- Offset of the next record magic.
+ *	- -1 if no more records were found.
+ */
+ssize_t fr_detail_record_resync(uint8_t const *data, size_t data_len)
+{
+	uint8_t const *p;
+
+	if (data_len <= FR_DETAIL_RECORD_MAGIC_LEN) return -1;
+
+	p = memmem(data + 1, data_len - 1, FR_DETAIL_RECORD_MAGIC, FR_DETAIL_RECORD_MAGIC_LEN);
+	if (!p) return -1;
+
+	return p - data;
+}
+
+/** Decode the pairs in a binary detail record
+ *
+ * @param[in] ctx		to allocate pairs in.
+ * @param[out] out		list to append pairs to.
+ * @param[in] parent		attribute to decode pairs under, usually the protocol root.
+ * @param[in] record		as returned by #fr_detail_record_parse.
+ * @param[in] decode_ctx	passed to the internal decoder.
+ * @return
+ *	- bytes of payload consumed.
+ *	- <0 on error.
+ */
+ssize_t fr_detail_record_decode(TALLOC_CTX *ctx, fr_pair_list_t *out, fr_dict_attr_t const *parent,
+				fr_detail_record_t const *record, void *decode_ctx)
+{
+	fr_pair_list_t	tmp;
+	ssize_t		slen;
+
+	fr_pair_list_init(&tmp);
+
+	slen = fr_internal_decode_list_dbuff(ctx, &tmp, parent,
+					     &FR_DBUFF_TMP(record->payload, record->payload_len), decode_ctx);
+	if (slen < 0) {
+		fr_pair_list_free(&tmp);
+		return slen;
+	}
+
+	fr_pair_list_append(out, &tmp);
+
+	return slen;
+}
@@ -0,0 +1,95 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/*
+ * $Id$
+ *
+ * @file protocols/internal/detail.h
+ * @brief Binary detail file records.
+ *
+ * Each record is a fixed size header, followed by the request pairs
+ * in the internal encoding.  All integers are in network byte order.
+ *
+ *	0                   1                   2                   3
+ *	0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	|                             Magic                             |
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	|     Flags     |    Version    |           Reserved            |
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	|                         Payload Length                        |
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	|                            Checksum                           |
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	|                          Packet Code                          |
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	|                            Reserved                           |
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	|                      Timestamp (Unix, ns)                     |
+ *	|                                                               |
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	|                      Payload (internal) ...
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *
+ * The checksum covers everything except the flags and the checksum
+ * itself, so that readers can mark records as done in place.
+ *
+ * @copyright 2025 The FreeRADIUS server project
+ */
+RCSIDH(internal_detail_h, "$Id$")
+
+#include <freeradius-devel/util/dbuff.h>
+#include <freeradius-devel/util/pair.h>
+#include <freeradius-devel/util/time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FR_DETAIL_RECORD_MAGIC		"\xfd" "FRD"	//!< Can never start a text detail entry.
+#define FR_DETAIL_RECORD_MAGIC_LEN	4
+#define FR_DETAIL_RECORD_VERSION	1
+#define FR_DETAIL_RECORD_HDR_LEN	32
+
+#define FR_DETAIL_RECORD_OFFSET_FLAGS	4		//!< Offset of the flags byte, for in place updates.
+
+#define FR_DETAIL_RECORD_FLAG_DONE	0x01		//!< Record has been replayed successfully.
+
+/** Decoded binary detail record header
+ *
+ */
+typedef struct {
+	uint8_t		flags;			//!< FR_DETAIL_RECORD_FLAG_*
+	uint32_t	code;			//!< Packet code of the original request.
+	fr_unix_time_t	timestamp;		//!< When the original request was received.
+	size_t		payload_len;		//!< Length of the encoded pairs.
+	uint8_t const	*payload;		//!< Encoded pairs.
+} fr_detail_record_t;
+
+ssize_t	fr_detail_record_encode(fr_dbuff_t *dbuff, uint32_t code, fr_unix_time_t timestamp,
+				fr_pair_list_t const *list, void *encode_ctx);
+
+ssize_t	fr_detail_record_parse(fr_detail_record_t *out, uint8_t const *data, size_t data_len);
+
+ssize_t	fr_detail_record_resync(uint8_t const *data, size_t data_len);
+
+ssize_t	fr_detail_record_decode(TALLOC_CTX *ctx, fr_pair_list_t *out, fr_dict_attr_t const *parent,
+				fr_detail_record_t const *record, void *decode_ctx);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,258 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for binary detail file records
+ *
+ * @file src/protocols/internal/detail_tests.c
+ *
+ * @copyright 2025 The FreeRADIUS server project
+ */
+static void test_init(void);
+static void test_fini(void);
+#define TEST_INIT  test_init()
+#define TEST_FINI  test_fini()
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/conf.h>
+#include <freeradius-devel/util/dict_test.h>
+
+#include "internal.h"
+#include "detail.h"
+
+#define TEST_CODE	4
+#define TEST_TIMESTAMP	fr_unix_time_wrap((int64_t) 1700000000 * NSEC)
+
+static TALLOC_CTX	*autofree;
+static fr_dict_t	*test_dict;
+static fr_dict_t	*test_dict_internal;
+
+/** Global initialisation
+ */
+static void test_init(void)
+{
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("detail_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) goto error;
+
+	if (fr_dict_test_init(autofree, &test_dict, NULL) < 0) goto error;
+
+	/*
+	 *	The internal encoder needs to know which attributes
+	 *	are internal.
+	 */
+	if (fr_dict_internal_afrom_file(&test_dict_internal, FR_DICTIONARY_INTERNAL_DIR, __FILE__) < 0) goto error;
+}
+
+static void test_fini(void)
+{
+	fr_dict_free(&test_dict_internal, __FILE__);
+}
+
+static void test_pair_add(TALLOC_CTX *ctx, fr_pair_list_t *list, fr_dict_attr_t const *da, char const *value)
+{
+	fr_pair_t	*vp;
+
+	MEM(vp = fr_pair_afrom_da(ctx, da));
+	TEST_CHECK(fr_pair_value_from_str(vp, value, strlen(value), NULL, false) == 0);
+	fr_pair_append(list, vp);
+}
+
+static void test_list_init(TALLOC_CTX *ctx, fr_pair_list_t *list)
+{
+	fr_pair_list_init(list);
+
+	test_pair_add(ctx, list, fr_dict_attr_test_string, "bob");
+	test_pair_add(ctx, list, fr_dict_attr_test_uint32, "1234");
+	test_pair_add(ctx, list, fr_dict_attr_test_ipv4_addr, "192.0.2.1");
+	test_pair_add(ctx, list, fr_dict_attr_test_octets, "0x0102030405");
+}
+
+/** Encode a record into buff, returning its length
+ *
+ */
+static size_t test_record_encode(uint8_t *buff, size_t buff_len, fr_pair_list_t *list)
+{
+	ssize_t		slen;
+
+	slen = fr_detail_record_encode(&FR_DBUFF_TMP(buff, buff_len), TEST_CODE, TEST_TIMESTAMP, list, NULL);
+	TEST_CHECK(slen > FR_DETAIL_RECORD_HDR_LEN);
+	TEST_MSG("Expected record, got %zd (%s)", slen, fr_strerror());
+
+	return slen < 0 ? 0 : (size_t) slen;
+}
+
+static void test_record_round_trip(void)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("test");
+	uint8_t			buff[1024];
+	fr_pair_list_t		in, out;
+	fr_detail_record_t	record;
+	size_t			len;
+	ssize_t			slen;
+
+	test_list_init(ctx, &in);
+	fr_pair_list_init(&out);
+
+	TEST_CASE("Encoding");
+	len = test_record_encode(buff, sizeof(buff), &in);
+	TEST_CHECK(memcmp(buff, FR_DETAIL_RECORD_MAGIC, FR_DETAIL_RECORD_MAGIC_LEN) == 0);
+
+	TEST_CASE("Parsing");
+	slen = fr_detail_record_parse(&record, buff, len);
+	TEST_CHECK_SLEN(slen, (ssize_t) len);
+	TEST_CHECK(record.code == TEST_CODE);
+	TEST_CHECK(fr_unix_time_eq(record.timestamp, TEST_TIMESTAMP));
+	TEST_CHECK(record.flags == 0);
+	TEST_CHECK(record.payload == buff + FR_DETAIL_RECORD_HDR_LEN);
+	TEST_CHECK(record.payload_len == len - FR_DETAIL_RECORD_HDR_LEN);
+
+	TEST_CASE("Decoding");
+	slen = fr_detail_record_decode(ctx, &out, fr_dict_root(test_dict), &record, NULL);
+	TEST_CHECK_SLEN(slen, (ssize_t) record.payload_len);
+	TEST_CHECK(fr_pair_list_cmp(&in, &out) == 0);
+
+	talloc_free(ctx);
+}
+
+static void test_record_done_flag(void)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("test");
+	uint8_t			buff[1024];
+	fr_pair_list_t		in;
+	fr_detail_record_t	record;
+	size_t			len;
+
+	test_list_init(ctx, &in);
+	len = test_record_encode(buff, sizeof(buff), &in);
+
+	TEST_CASE("Marking a record as done doesn't invalidate the checksum");
+	buff[FR_DETAIL_RECORD_OFFSET_FLAGS] |= FR_DETAIL_RECORD_FLAG_DONE;
+	TEST_CHECK_SLEN(fr_detail_record_parse(&record, buff, len), (ssize_t) len);
+	TEST_CHECK(record.flags & FR_DETAIL_RECORD_FLAG_DONE);
+
+	talloc_free(ctx);
+}
+
+static void test_record_truncated(void)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("test");
+	uint8_t			buff[1024];
+	fr_pair_list_t		in;
+	fr_detail_record_t	record;
+	size_t			len;
+
+	test_list_init(ctx, &in);
+	len = test_record_encode(buff, sizeof(buff), &in);
+
+	TEST_CASE("Partial header");
+	TEST_CHECK_SLEN(fr_detail_record_parse(&record, buff, FR_DETAIL_RECORD_HDR_LEN - 1), 0);
+
+	TEST_CASE("Partial payload");
+	TEST_CHECK_SLEN(fr_detail_record_parse(&record, buff, len - 1), 0);
+
+	talloc_free(ctx);
+}
+
+static void test_record_damaged(void)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("test");
+	uint8_t			buff[1024];
+	fr_pair_list_t		in;
+	fr_detail_record_t	record;
+	size_t			len;
+
+	test_list_init(ctx, &in);
+	len = test_record_encode(buff, sizeof(buff), &in);
+
+	TEST_CASE("Bad magic");
+	buff[0] ^= 0xff;
+	TEST_CHECK(fr_detail_record_parse(&record, buff, len) < 0);
+	buff[0] ^= 0xff;
+
+	TEST_CASE("Bad version");
+	buff[5] = FR_DETAIL_RECORD_VERSION + 1;
+	TEST_CHECK(fr_detail_record_parse(&record, buff, len) < 0);
+	buff[5] = FR_DETAIL_RECORD_VERSION;
+
+	TEST_CASE("Corrupted payload");
+	buff[len - 1] ^= 0xff;
+	TEST_CHECK(fr_detail_record_parse(&record, buff, len) < 0);
+	buff[len - 1] ^= 0xff;
+
+	TEST_CASE("Corrupted code");
+	buff[16] ^= 0xff;
+	TEST_CHECK(fr_detail_record_parse(&record, buff, len) < 0);
+	buff[16] ^= 0xff;
+
+	TEST_CHECK_SLEN(fr_detail_record_parse(&record, buff, len), (ssize_t) len);
+
+	talloc_free(ctx);
+}
+
+static void test_record_resync(void)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("test");
+	uint8_t			buff[2048];
+	fr_pair_list_t		in;
+	fr_detail_record_t	record;
+	size_t			len, second;
+	ssize_t			skip;
+
+	test_list_init(ctx, &in);
+
+	/*
+	 *	Two records, the first of which is cut short, as
+	 *	happens when a write is interrupted and later
+	 *	writes are appended after it.
+	 */
+	len = test_record_encode(buff, sizeof(buff), &in);
+	second = len / 2;
+	len = test_record_encode(buff + second, sizeof(buff) - second, &in);
+
+	TEST_CASE("Truncated record followed by a complete one");
+	TEST_CHECK(fr_detail_record_parse(&record, buff, second + len) < 0);
+
+	skip = fr_detail_record_resync(buff, second + len);
+	TEST_CHECK_SLEN(skip, (ssize_t) second);
+	TEST_CHECK_SLEN(fr_detail_record_parse(&record, buff + skip, second + len - skip), (ssize_t) len);
+
+	TEST_CASE("No further records");
+	TEST_CHECK_SLEN(fr_detail_record_resync(buff + second, len), -1);
+
+	TEST_CASE("Too little data to hold a record magic");
+	TEST_CHECK_SLEN(fr_detail_record_resync(buff, FR_DETAIL_RECORD_MAGIC_LEN), -1);
+
+	talloc_free(ctx);
+}
+
+TEST_LIST = {
+	{ "fr_detail_record_round_trip",	test_record_round_trip },
+	{ "fr_detail_record_done_flag",		test_record_done_flag },
+	{ "fr_detail_record_truncated",		test_record_truncated },
+	{ "fr_detail_record_damaged",		test_record_damaged },
+	{ "fr_detail_record_resync",		test_record_resync },
+
+	{ NULL }
+};
@@ -1 +1 @@
-SUBMAKEFILES := libfreeradius-radius.mk libfreeradius-radius-bio.mk
+SUBMAKEFILES := libfreeradius-radius.mk libfreeradius-radius-bio.mk radius_sign_tests.mk radius_decode_perf_test.mk
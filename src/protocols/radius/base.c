@@ -358,10 +358,36 @@ invalid:
  */
 int fr_radius_sign(uint8_t *packet, uint8_t const *vector,
 		   uint8_t const *secret, size_t secret_len)
+{
+	return fr_radius_sign_with_key(packet, vector, secret, secret_len, NULL);
+}
+
+/** Validate a packet for signing, and set up the authenticator fields
+ *
+ * The Request / Response Authenticator and Message-Authenticator fields
+ * are set to the values they need to have when the digests are
+ * calculated.  The digests themselves are left to the caller.
+ *
+ * @param[in,out] packet	(request or response).
+ * @param[in] vector		original packet vector to use
+ * @param[in] secret_len	The length of the secret.
+ * @param[out] ma_p		Where to write the HMAC-MD5 for Message-Authenticator,
+ *				or NULL if the packet doesn't contain one.
+ * @param[out] auth_p		Whether the Request / Response Authenticator needs
+ *				to be calculated.
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+static int radius_sign_prepare(uint8_t *packet, uint8_t const *vector, size_t secret_len,
+			       uint8_t **ma_p, bool *auth_p)
 {
 	uint8_t		*msg, *end;
 	size_t		packet_len = fr_nbo_to_uint16(packet + 2);
 
+	*ma_p = NULL;
+	*auth_p = false;
+
 	/*
 	 *	No real limit on secret length, this is just
 	 *	to catch uninitialised fields.
@@ -434,12 +460,12 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *vector,
 		}
 
 		/*
-		 *	Force Message-Authenticator to be zero,
-		 *	calculate the HMAC, and put it into the
-		 *	Message-Authenticator attribute.
+		 *	Force Message-Authenticator to be zero, the
+		 *	caller calculates the HMAC and puts it into
+		 *	the Message-Authenticator attribute.
 		 */
 		memset(msg + 2, 0, RADIUS_AUTH_VECTOR_LENGTH);
-		fr_hmac_md5(msg + 2, packet, packet_len, secret, secret_len);
+		*ma_p = msg + 2;
 		break;
 	}
 
@@ -485,10 +511,53 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *vector,
 		return -1;
 	}
 
+	*auth_p = true;
+
+	return 0;
+}
+
+/** Sign a previously encoded packet, using precomputed HMAC-MD5 key state
+ *
+ * As #fr_radius_sign, but if hmac_key is provided, Message-Authenticator
+ * is calculated from the precomputed key state instead of rebuilding
+ * the HMAC key pads from the secret.
+ *
+ * @param[in,out] packet	(request or response).
+ * @param[in] vector		original packet vector to use
+ * @param[in] secret		to sign the packet with.
+ * @param[in] secret_len	The length of the secret.
+ * @param[in] hmac_key		precomputed from the secret.  May be NULL.
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+int fr_radius_sign_with_key(uint8_t *packet, uint8_t const *vector,
+			    uint8_t const *secret, size_t secret_len,
+			    fr_hmac_md5_key_t const *hmac_key)
+{
+	uint8_t		*ma;
+	bool		auth;
+	size_t		packet_len;
+
+	if (radius_sign_prepare(packet, vector, secret_len, &ma, &auth) < 0) return -1;
+
+	packet_len = fr_nbo_to_uint16(packet + 2);
+
+	if (ma) {
+		if (hmac_key) {
+			if (fr_hmac_md5_with_key(ma, packet, packet_len, hmac_key) < 0) {
+				fr_strerror_const("Failed calculating Message-Authenticator");
+				return -1;
+			}
+		} else {
+			fr_hmac_md5(ma, packet, packet_len, secret, secret_len);
+		}
+	}
+
 	/*
 	 *	Request / Response Authenticator = MD5(packet + secret)
 	 */
-	{
+	if (auth) {
 		fr_md5_ctx_t	*md5_ctx;
 
 		md5_ctx = fr_md5_ctx_alloc_from_list();
@@ -501,6 +570,104 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *vector,
 	return 0;
 }
 
+#define RADIUS_SIGN_BATCH_CHUNK (FR_MD5_MB_LANES * 4)
+
+/** Sign a chunk of packets, see #fr_radius_sign_batch
+ *
+ */
+static size_t radius_sign_batch_chunk(fr_radius_sign_batch_t *batch, size_t num)
+{
+	fr_hmac_md5_mb_job_t	hmac[RADIUS_SIGN_BATCH_CHUNK];
+	fr_md5_mb_job_t		md5[RADIUS_SIGN_BATCH_CHUNK];
+	uint8_t			*ma;
+	bool			auth[RADIUS_SIGN_BATCH_CHUNK];
+	size_t			i, n = 0, failed = 0;
+
+	fr_assert(num <= RADIUS_SIGN_BATCH_CHUNK);
+
+	/*
+	 *	Validate all the packets, and set up their headers.
+	 *
+	 *	Message-Authenticator = HMAC-MD5(secret, packet)
+	 */
+	for (i = 0; i < num; i++) {
+		batch[i].rcode = radius_sign_prepare(batch[i].packet, batch[i].vector, batch[i].secret_len,
+						     &ma, &auth[i]);
+		if (batch[i].rcode < 0) {
+		fail:
+			auth[i] = false;
+			failed++;
+			continue;
+		}
+
+		if (!ma) continue;
+
+		if (!fr_cond_assert_msg(batch[i].hmac_key, "Batch signing requires precomputed HMAC-MD5 state")) {
+			batch[i].rcode = -1;
+			goto fail;
+		}
+
+		hmac[n++] = (fr_hmac_md5_mb_job_t) {
+			.in = batch[i].packet,
+			.inlen = fr_nbo_to_uint16(batch[i].packet + 2),
+			.hkey = batch[i].hmac_key,
+			.out = ma
+		};
+	}
+	if (n) fr_hmac_md5_mb_calc(hmac, n);
+
+	/*
+	 *	Request / Response Authenticator = MD5(packet + secret)
+	 *
+	 *	This has to be done after Message-Authenticator, as
+	 *	it covers the calculated value.
+	 */
+	for (i = 0, n = 0; i < num; i++) {
+		if (!auth[i]) continue;
+
+		md5[n++] = (fr_md5_mb_job_t) {
+			.in = {
+				{ .data = batch[i].packet, .len = fr_nbo_to_uint16(batch[i].packet + 2) },
+				{ .data = batch[i].secret, .len = batch[i].secret_len }
+			},
+			.out = batch[i].packet + 4
+		};
+	}
+	if (n) fr_md5_mb_calc(md5, n);
+
+	return failed;
+}
+
+/** Sign multiple previously encoded packets
+ *
+ * Produces the same result as calling #fr_radius_sign on each packet,
+ * but the digests for all the packets are calculated together using
+ * the multi-buffer MD5 functions.
+ *
+ * Only the authenticators are calculated here.  User-Password and
+ * Tunnel-Password are hidden by the encoder, one packet at a time.
+ * Their MD5 chain is serial within an attribute, but independent
+ * between packets, so hiding could also be batched if the encoder
+ * were given more than one packet at once.
+ *
+ * @param[in,out] batch	of packets to sign.  The rcode field of each
+ *			entry is set to the result of signing that packet.
+ * @param[in] num	Number of entries in the batch.
+ * @return
+ *	- 0 if all packets were signed.
+ *	- <0 the negative number of packets which failed.
+ */
+int fr_radius_sign_batch(fr_radius_sign_batch_t *batch, size_t num)
+{
+	size_t	i, failed = 0;
+
+	for (i = 0; i < num; i += RADIUS_SIGN_BATCH_CHUNK) {
+		failed += radius_sign_batch_chunk(batch + i, ((num - i) < RADIUS_SIGN_BATCH_CHUNK) ?
+						  (num - i) : RADIUS_SIGN_BATCH_CHUNK);
+	}
+
+	return -((int) failed);
+}
 
 /** See if the data pointed to by PTR is a valid RADIUS packet.
  *
@@ -799,14 +966,34 @@ int fr_radius_verify(uint8_t *packet, uint8_t const *vector,
 		     uint8_t const *secret, size_t secret_len,
 		     bool require_message_authenticator, bool limit_proxy_state)
 {
-	bool		found_message_authenticator = false;
+	return fr_radius_verify_with_key(packet, vector, secret, secret_len, NULL,
+					 require_message_authenticator, limit_proxy_state);
+}
+
+/** Authenticators saved by #radius_verify_prepare, to check after the packet is re-signed
+ *
+ */
+typedef struct {
+	uint8_t		*msg;						//!< Message-Authenticator attribute, or NULL.
+	uint8_t		request_authenticator[RADIUS_AUTH_VECTOR_LENGTH];
+	uint8_t		message_authenticator[RADIUS_AUTH_VECTOR_LENGTH];
+} radius_verify_t;
+
+/** Check the structure of a packet, and save the authenticators it was received with
+ *
+ * @return
+ *	< <0 on error (negative fr_radius_decode_fail_t)
+ *	- 0 on success.
+ */
+static int radius_verify_prepare(radius_verify_t *rv, uint8_t *packet,
+				 bool require_message_authenticator, bool limit_proxy_state)
+{
 	bool		found_proxy_state = false;
-	int		rcode;
 	int		code;
 	uint8_t		*msg, *end;
 	size_t		packet_len = fr_nbo_to_uint16(packet + 2);
-	uint8_t		request_authenticator[RADIUS_AUTH_VECTOR_LENGTH];
-	uint8_t		message_authenticator[RADIUS_AUTH_VECTOR_LENGTH];
+
+	rv->msg = NULL;
 
 	if (packet_len < RADIUS_HEADER_LENGTH) {
 		fr_strerror_printf("invalid packet length %zu", packet_len);
@@ -819,7 +1006,7 @@ int fr_radius_verify(uint8_t *packet, uint8_t const *vector,
 		return -DECODE_FAIL_UNKNOWN_PACKET_CODE;
 	}
 
-	memcpy(request_authenticator, packet + 4, sizeof(request_authenticator));
+	memcpy(rv->request_authenticator, packet + 4, sizeof(rv->request_authenticator));
 
 	/*
 	 *	Find Message-Authenticator.  Its value has to be
@@ -859,33 +1046,34 @@ int fr_radius_verify(uint8_t *packet, uint8_t const *vector,
 		/*
 		 *	Found it, save a copy.
 		 */
-		memcpy(message_authenticator, msg + 2, sizeof(message_authenticator));
-		found_message_authenticator = true;
+		memcpy(rv->message_authenticator, msg + 2, sizeof(rv->message_authenticator));
+		rv->msg = msg;
 		break;
 	}
 
 	if (packet[0] == FR_RADIUS_CODE_ACCESS_REQUEST) {
-		if (limit_proxy_state && found_proxy_state && !found_message_authenticator) {
+		if (limit_proxy_state && found_proxy_state && !rv->msg) {
 			fr_strerror_const("Proxy-State is not allowed without Message-Authenticator");
 			return -DECODE_FAIL_MA_MISSING;
 		}
 
-	    	if (require_message_authenticator && !found_message_authenticator) {
+	    	if (require_message_authenticator && !rv->msg) {
 			fr_strerror_const("Access-Request is missing the required Message-Authenticator attribute");
 			return -DECODE_FAIL_MA_MISSING;
 		}
 	}
 
-	/*
-	 *	Overwrite the contents of Message-Authenticator
-	 *	with the one we calculate.
-	 */
-	rcode = fr_radius_sign(packet, vector, secret, secret_len);
-	if (rcode < 0) {
-		fr_strerror_const_push("Failed calculating correct authenticator");
-		return -DECODE_FAIL_VERIFY;
-	}
+	return 0;
+}
 
+/** Compare the saved authenticators with the ones calculated when the packet was re-signed
+ *
+ * @return
+ *	< <0 on error (negative fr_radius_decode_fail_t)
+ *	- 0 on success.
+ */
+static int radius_verify_check(radius_verify_t const *rv, uint8_t *packet, uint8_t const *vector)
+{
 	/*
 	 *	Check the Message-Authenticator first.
 	 *
@@ -897,10 +1085,10 @@ int fr_radius_verify(uint8_t *packet, uint8_t const *vector,
 	 *	message authenticators are the same, so we don't
 	 *	need to do anything.
 	 */
-	if ((msg < end) &&
-	    (fr_digest_cmp(message_authenticator, msg + 2, sizeof(message_authenticator)) != 0)) {
-		memcpy(msg + 2, message_authenticator, sizeof(message_authenticator));
-		memcpy(packet + 4, request_authenticator, sizeof(request_authenticator));
+	if (rv->msg &&
+	    (fr_digest_cmp(rv->message_authenticator, rv->msg + 2, sizeof(rv->message_authenticator)) != 0)) {
+		memcpy(rv->msg + 2, rv->message_authenticator, sizeof(rv->message_authenticator));
+		memcpy(packet + 4, rv->request_authenticator, sizeof(rv->request_authenticator));
 
 		fr_strerror_const("invalid Message-Authenticator (shared secret is incorrect)");
 		return -DECODE_FAIL_MA_INVALID;
@@ -917,8 +1105,8 @@ int fr_radius_verify(uint8_t *packet, uint8_t const *vector,
 	/*
 	 *	Check the Request Authenticator.
 	 */
-	if (fr_digest_cmp(request_authenticator, packet + 4, sizeof(request_authenticator)) != 0) {
-		memcpy(packet + 4, request_authenticator, sizeof(request_authenticator));
+	if (fr_digest_cmp(rv->request_authenticator, packet + 4, sizeof(rv->request_authenticator)) != 0) {
+		memcpy(packet + 4, rv->request_authenticator, sizeof(rv->request_authenticator));
 		if (vector) {
 			fr_strerror_const("invalid Response Authenticator (shared secret is incorrect)");
 		} else {
@@ -930,6 +1118,128 @@ int fr_radius_verify(uint8_t *packet, uint8_t const *vector,
 	return 0;
 }
 
+/** Verify a request / response packet, using precomputed HMAC-MD5 key state
+ *
+ * As #fr_radius_verify, but passes hmac_key through to #fr_radius_sign_with_key.
+ *
+ * @param[in] packet				the raw RADIUS packet (request or response)
+ * @param[in] vector				the original packet vector
+ * @param[in] secret				the shared secret
+ * @param[in] secret_len			the length of the secret
+ * @param[in] hmac_key				precomputed from the secret.  May be NULL.
+ * @param[in] require_message_authenticator	whether we require Message-Authenticator.
+ * @param[in] limit_proxy_state			whether we allow Proxy-State without Message-Authenticator.
+ * @return
+ *	< <0 on error (negative fr_radius_decode_fail_t)
+ *	- 0 on success.
+ */
+int fr_radius_verify_with_key(uint8_t *packet, uint8_t const *vector,
+			      uint8_t const *secret, size_t secret_len,
+			      fr_hmac_md5_key_t const *hmac_key,
+			      bool require_message_authenticator, bool limit_proxy_state)
+{
+	radius_verify_t	rv;
+	int		rcode;
+
+	rcode = radius_verify_prepare(&rv, packet, require_message_authenticator, limit_proxy_state);
+	if (rcode < 0) return rcode;
+
+	/*
+	 *	Overwrite the contents of Message-Authenticator
+	 *	with the one we calculate.
+	 */
+	rcode = fr_radius_sign_with_key(packet, vector, secret, secret_len, hmac_key);
+	if (rcode < 0) {
+		fr_strerror_const_push("Failed calculating correct authenticator");
+		return -DECODE_FAIL_VERIFY;
+	}
+
+	return radius_verify_check(&rv, packet, vector);
+}
+
+/** Verify a chunk of packets, see #fr_radius_verify_batch
+ *
+ */
+static size_t radius_verify_batch_chunk(fr_radius_verify_batch_t *batch, size_t num)
+{
+	radius_verify_t		rv[RADIUS_SIGN_BATCH_CHUNK];
+	fr_radius_sign_batch_t	sign[RADIUS_SIGN_BATCH_CHUNK];
+	size_t			idx[RADIUS_SIGN_BATCH_CHUNK];
+	size_t			i, n = 0, failed = 0;
+
+	fr_assert(num <= RADIUS_SIGN_BATCH_CHUNK);
+
+	for (i = 0; i < num; i++) {
+		batch[i].rcode = radius_verify_prepare(&rv[i], batch[i].packet,
+						       batch[i].require_message_authenticator,
+						       batch[i].limit_proxy_state);
+		if (batch[i].rcode < 0) {
+			failed++;
+			continue;
+		}
+
+		idx[n] = i;
+		sign[n++] = (fr_radius_sign_batch_t) {
+			.packet = batch[i].packet,
+			.vector = batch[i].vector,
+			.secret = batch[i].secret,
+			.secret_len = batch[i].secret_len,
+			.hmac_key = batch[i].hmac_key
+		};
+	}
+	if (!n) return failed;
+
+	/*
+	 *	Overwrite the contents of Message-Authenticator
+	 *	with the ones we calculate.
+	 */
+	(void) radius_sign_batch_chunk(sign, n);
+
+	for (i = 0; i < n; i++) {
+		fr_radius_verify_batch_t *entry = &batch[idx[i]];
+
+		if (sign[i].rcode < 0) {
+			fr_strerror_const_push("Failed calculating correct authenticator");
+			entry->rcode = -DECODE_FAIL_VERIFY;
+			failed++;
+			continue;
+		}
+
+		entry->rcode = radius_verify_check(&rv[idx[i]], entry->packet, entry->vector);
+		if (entry->rcode < 0) failed++;
+	}
+
+	return failed;
+}
+
+/** Verify multiple request / response packets
+ *
+ * Produces the same result as calling #fr_radius_verify_with_key on
+ * each packet, but the digests are calculated together, as with
+ * #fr_radius_sign_batch.
+ *
+ * @note The error buffer only holds the message for the last packet
+ *	which failed.  Check the rcode of each entry.
+ *
+ * @param[in,out] batch	of packets to verify.  The rcode field of each
+ *			entry is set to the result of verifying that packet.
+ * @param[in] num	Number of entries in the batch.
+ * @return
+ *	- 0 if all packets were verified.
+ *	- <0 the negative number of packets which failed.
+ */
+int fr_radius_verify_batch(fr_radius_verify_batch_t *batch, size_t num)
+{
+	size_t	i, failed = 0;
+
+	for (i = 0; i < num; i += RADIUS_SIGN_BATCH_CHUNK) {
+		failed += radius_verify_batch_chunk(batch + i, ((num - i) < RADIUS_SIGN_BATCH_CHUNK) ?
+						    (num - i) : RADIUS_SIGN_BATCH_CHUNK);
+	}
+
+	return -((int) failed);
+}
+
 void *fr_radius_next_encodable(fr_dcursor_t *cursor, void *current, void *uctx);
 
 void *fr_radius_next_encodable(fr_dcursor_t *cursor, void *current, void *uctx)
@@ -1170,9 +1480,10 @@ ssize_t	fr_radius_decode(TALLOC_CTX *ctx, fr_pair_list_t *out,
 	if (decode_ctx->verify) {
 		if (!decode_ctx->request_authenticator) decode_ctx->request_authenticator = zeros;
 
-		if (fr_radius_verify(packet, decode_ctx->request_authenticator,
-				     (uint8_t const *) decode_ctx->common->secret, decode_ctx->common->secret_length,
-				     decode_ctx->require_message_authenticator, decode_ctx->limit_proxy_state) < 0) {
+		if (fr_radius_verify_with_key(packet, decode_ctx->request_authenticator,
+					      (uint8_t const *) decode_ctx->common->secret, decode_ctx->common->secret_length,
+					      decode_ctx->common->hmac_key,
+					      decode_ctx->require_message_authenticator, decode_ctx->limit_proxy_state) < 0) {
 			return -1;
 		}
 	}
@@ -27,6 +27,7 @@
 #include <freeradius-devel/util/packet.h>
 #include <freeradius-devel/util/rand.h>
 #include <freeradius-devel/util/log.h>
+#include <freeradius-devel/util/md5.h>
 #include <freeradius-devel/util/dbuff.h>
 #include <freeradius-devel/io/test_point.h>
 
@@ -94,6 +95,8 @@ typedef struct {
 typedef struct {
 	char const		*secret;
 	size_t			secret_length;
+	fr_hmac_md5_key_t const	*hmac_key;		//!< Precomputed HMAC-MD5 state for the secret.
+							///< Optional, and must match the secret if set.
 
 	bool			secure_transport;	//!< for TLS
 
@@ -223,10 +226,51 @@ int		fr_radius_allow_reply(int code, bool allowed[static FR_RADIUS_CODE_MAX]);
 int		fr_radius_sign(uint8_t *packet, uint8_t const *vector,
 			       uint8_t const *secret, size_t secret_len) CC_HINT(nonnull (1,3));
 
+int		fr_radius_sign_with_key(uint8_t *packet, uint8_t const *vector,
+					uint8_t const *secret, size_t secret_len,
+					fr_hmac_md5_key_t const *hmac_key) CC_HINT(nonnull (1,3));
+
+/** A packet to be signed by #fr_radius_sign_batch
+ *
+ */
+typedef struct {
+	uint8_t			*packet;		//!< Encoded packet to sign.
+	uint8_t const		*vector;		//!< Original packet vector, or NULL for requests.
+	uint8_t const		*secret;		//!< Shared secret.
+	size_t			secret_len;		//!< Length of the shared secret.
+	fr_hmac_md5_key_t const	*hmac_key;		//!< Precomputed from the secret.  Required if the
+							///< packet contains a Message-Authenticator.
+	int			rcode;			//!< Result of signing this packet.
+} fr_radius_sign_batch_t;
+
+int		fr_radius_sign_batch(fr_radius_sign_batch_t *batch, size_t num) CC_HINT(nonnull);
+
 int		fr_radius_verify(uint8_t *packet, uint8_t const *vector,
 				 uint8_t const *secret, size_t secret_len,
 				 bool require_message_authenticator, bool limit_proxy_state) CC_HINT(nonnull (1,3));
 
+int		fr_radius_verify_with_key(uint8_t *packet, uint8_t const *vector,
+					  uint8_t const *secret, size_t secret_len,
+					  fr_hmac_md5_key_t const *hmac_key,
+					  bool require_message_authenticator, bool limit_proxy_state) CC_HINT(nonnull (1,3));
+
+/** A packet to be verified by #fr_radius_verify_batch
+ *
+ */
+typedef struct {
+	uint8_t			*packet;		//!< Received packet to verify.
+	uint8_t const		*vector;		//!< Original packet vector, or NULL for requests.
+	uint8_t const		*secret;		//!< Shared secret.
+	size_t			secret_len;		//!< Length of the shared secret.
+	fr_hmac_md5_key_t const	*hmac_key;		//!< Precomputed from the secret.  Required if the
+							///< packet contains a Message-Authenticator.
+	bool			require_message_authenticator;	//!< As for #fr_radius_verify.
+	bool			limit_proxy_state;		//!< As for #fr_radius_verify.
+	int			rcode;			//!< Result of verifying this packet.
+} fr_radius_verify_batch_t;
+
+int		fr_radius_verify_batch(fr_radius_verify_batch_t *batch, size_t num) CC_HINT(nonnull);
+
 bool		fr_radius_ok(uint8_t const *packet, size_t *packet_len_p,
 			     uint32_t max_attributes, bool require_message_authenticator, fr_radius_decode_fail_t *reason) CC_HINT(nonnull (1,2));
 
@@ -0,0 +1,326 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Performance tests for decoding RADIUS packets
+ *
+ * The packets are taken from the RADIUS protocol tests, which include
+ * packets captured from real traffic, and many vendor attributes.
+ * Each packet is decoded by searching the dictionary bins for
+ * attributes, and then again using the indexes which are normally
+ * built when the dictionaries are made read only.
+ *
+ * The two are alternated, and the fastest round of each is reported,
+ * so that neither benefits from running second.
+ *
+ * The indexes are built directly, rather than by making the
+ * dictionaries read only, as read only dictionaries can't have unknown
+ * attributes added, which changes how some malformed packets decode.
+ *
+ * Must be run from the top of the source tree.
+ *
+ * @file src/protocols/radius/radius_decode_perf_test.c
+ *
+ * @copyright 2025 The FreeRADIUS server project
+ */
+
+/*
+ *	Initialise from a constructor, so that the dictionaries and
+ *	packets are only loaded once, rather than for every test.
+ */
+static void radius_decode_perf_init(void) __attribute__((constructor));
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/dict_priv.h>
+#include <freeradius-devel/util/syserror.h>
+#include <freeradius-devel/util/time.h>
+
+#include <dirent.h>
+
+#include "radius.h"
+
+#define TEST_CORPUS_DIR		"src/tests/unit/protocols/radius"
+#define TEST_SECRET		"testing123"
+#define DECODE_REPS		500
+#define DECODE_ROUNDS		5			//!< Alternate between the bins and the index.
+
+typedef struct {
+	uint8_t		*data;
+	size_t		len;
+} test_packet_t;
+
+static TALLOC_CTX	*autofree;
+static test_packet_t	*packets;			//!< Packets which decode successfully.
+static size_t		num_packets;
+
+static uint8_t const	test_vector[RADIUS_AUTH_VECTOR_LENGTH] = { 0 };
+
+/** Parse the hex bytes following a test command
+ *
+ * @return
+ *	- The number of bytes written to out.
+ *	- 0 if the line isn't all hex.
+ */
+static size_t hex_parse(uint8_t *out, size_t outlen, char const *p)
+{
+	size_t		len = 0;
+	char		*end;
+	unsigned long	byte;
+
+	while (*p) {
+		while (isspace((uint8_t) *p)) p++;
+		if (!*p) break;
+
+		if (len >= outlen) return 0;
+
+		byte = strtoul(p, &end, 16);
+		if ((end != p + 2) || (byte > 0xff)) return 0;
+
+		out[len++] = byte;
+		p = end;
+	}
+
+	return len;
+}
+
+static bool packet_decodes(uint8_t *data, size_t len)
+{
+	TALLOC_CTX	*ctx = talloc_init_const("decode");
+	fr_pair_list_t	list;
+	ssize_t		slen;
+
+	fr_pair_list_init(&list);
+	slen = fr_radius_decode_simple(ctx, &list, data, len, test_vector, TEST_SECRET);
+	talloc_free(ctx);
+
+	return (slen > 0);
+}
+
+/** Add a packet to the corpus, if we can decode it
+ *
+ */
+static void packet_add(uint8_t const *data, size_t len)
+{
+	uint8_t	*copy;
+
+	copy = talloc_memdup(autofree, data, len);
+	if (!packet_decodes(copy, len)) {
+		talloc_free(copy);
+		return;
+	}
+
+	packets = talloc_realloc(autofree, packets, test_packet_t, num_packets + 1);
+	packets[num_packets++] = (test_packet_t) { .data = copy, .len = len };
+}
+
+/** Load the packets from one test file
+ *
+ * "decode-proto" lines are whole packets.  "decode-pair" lines are
+ * attributes, which we put into an Accounting-Request.
+ */
+static void packets_load(char const *filename)
+{
+	FILE	*fp;
+	char	line[8192];
+	uint8_t	buff[RADIUS_MAX_PACKET_SIZE];
+	size_t	len;
+
+	fp = fopen(filename, "r");
+	if (!fp) return;
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (strncmp(line, "decode-proto ", 13) == 0) {
+			len = hex_parse(buff, sizeof(buff), line + 13);
+			if ((len < RADIUS_HEADER_LENGTH) || (fr_nbo_to_uint16(buff + 2) != len)) continue;
+
+			packet_add(buff, len);
+			continue;
+		}
+
+		if (strncmp(line, "decode-pair ", 12) == 0) {
+			len = hex_parse(buff + RADIUS_HEADER_LENGTH, sizeof(buff) - RADIUS_HEADER_LENGTH, line + 12);
+			if (!len) continue;
+
+			len += RADIUS_HEADER_LENGTH;
+			memset(buff, 0, RADIUS_HEADER_LENGTH);
+			buff[0] = FR_RADIUS_CODE_ACCOUNTING_REQUEST;
+			fr_nbo_from_uint16(buff + 2, len);
+
+			packet_add(buff, len);
+		}
+	}
+
+	fclose(fp);
+}
+
+void radius_decode_perf_init(void)
+{
+	DIR		*dir;
+	struct dirent	*dp;
+	char		path[PATH_MAX];
+
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("radius_decode_perf_test");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) goto error;
+
+	if (!fr_dict_global_ctx_init(autofree, true, "share/dictionary")) goto error;
+
+	if (fr_radius_global_init() < 0) goto error;
+
+	/*
+	 *	Registered after the autofree context, so it runs
+	 *	first, and the dictionaries are no longer referenced
+	 *	when they're freed.
+	 */
+	atexit(fr_radius_global_free);
+
+	dir = opendir(TEST_CORPUS_DIR);
+	if (!dir) {
+		fr_strerror_printf("Failed opening %s: %s", TEST_CORPUS_DIR, fr_syserror(errno));
+		goto error;
+	}
+
+	while ((dp = readdir(dir)) != NULL) {
+		size_t len = strlen(dp->d_name);
+
+		if ((len < 4) || (strcmp(dp->d_name + len - 4, ".txt") != 0)) continue;
+
+		snprintf(path, sizeof(path), "%s/%s", TEST_CORPUS_DIR, dp->d_name);
+		packets_load(path);
+	}
+	closedir(dir);
+
+	fr_time_start();
+}
+
+/** Decode every packet in the corpus DECODE_REPS times
+ *
+ */
+static fr_time_delta_t do_decodes(size_t *pairs)
+{
+	TALLOC_CTX	*ctx = talloc_init_const("decode");
+	fr_pair_list_t	list;
+	fr_time_t	start;
+	unsigned int	i;
+	size_t		j;
+
+	fr_pair_list_init(&list);
+	*pairs = 0;
+
+	start = fr_time();
+	for (i = 0; i < DECODE_REPS; i++) {
+		for (j = 0; j < num_packets; j++) {
+			(void) fr_radius_decode_simple(ctx, &list, packets[j].data, packets[j].len,
+						       test_vector, TEST_SECRET);
+			*pairs += fr_pair_list_num_elements(&list);
+			fr_pair_list_free(&list);
+		}
+	}
+	talloc_free(ctx);
+
+	return fr_time_sub(fr_time(), start);
+}
+
+/** Decode a packet, and print the pairs
+ *
+ * Unknown attributes are allocated for every decode, so the pairs
+ * are compared as text.
+ */
+static char *packet_print(TALLOC_CTX *ctx, test_packet_t const *packet)
+{
+	fr_pair_list_t		list;
+	fr_sbuff_t		sbuff;
+	fr_sbuff_uctx_talloc_t	tctx;
+
+	fr_pair_list_init(&list);
+	if (fr_radius_decode_simple(ctx, &list, packet->data, packet->len, test_vector, TEST_SECRET) <= 0) return NULL;
+
+	if (!fr_sbuff_init_talloc(ctx, &sbuff, &tctx, 1024, SIZE_MAX)) return NULL;
+	(void) fr_pair_list_print(&sbuff, NULL, &list);
+	fr_pair_list_free(&list);
+
+	return sbuff.buff;
+}
+
+/** Decode the same packets before and after the dictionary indexes are built
+ *
+ * Both must produce the same pairs.
+ */
+static void test_decode(void)
+{
+	TALLOC_CTX	*ctx = talloc_init_const("test");
+	char		**expected, *got;
+	fr_dict_t	*dict = fr_dict_unconst(fr_dict_by_protocol_name("radius"));
+	fr_time_delta_t	bins = fr_time_delta_wrap(0), indexed = fr_time_delta_wrap(0);
+	size_t		bins_pairs, index_pairs, i;
+	unsigned int	round;
+
+	TEST_ASSERT(num_packets > 0);
+
+	expected = talloc_array(ctx, char *, num_packets);
+	for (i = 0; i < num_packets; i++) {
+		expected[i] = packet_print(ctx, &packets[i]);
+		TEST_CHECK(expected[i] != NULL);
+	}
+
+	for (round = 0; round < DECODE_ROUNDS; round++) {
+		fr_time_delta_t	elapsed;
+
+		elapsed = do_decodes(&bins_pairs);
+		if (!round || fr_time_delta_lt(elapsed, bins)) bins = elapsed;
+
+		dict_attr_child_indexes_build(dict);
+
+		elapsed = do_decodes(&index_pairs);
+		if (!round || fr_time_delta_lt(elapsed, indexed)) indexed = elapsed;
+
+		TEST_CHECK(bins_pairs == index_pairs);
+		TEST_MSG("Decoded %zu pairs without the index, %zu with", bins_pairs, index_pairs);
+
+		if (round < (DECODE_ROUNDS - 1)) dict_attr_child_indexes_free(dict);
+	}
+
+	for (i = 0; i < num_packets; i++) {
+		got = packet_print(ctx, &packets[i]);
+		TEST_CHECK(got && expected[i] && (strcmp(got, expected[i]) == 0));
+		TEST_MSG("Packet %zu decodes differently with the index", i);
+		TEST_MSG("expected %s", expected[i]);
+		TEST_MSG("got      %s", got);
+	}
+
+	TEST_MSG_ALWAYS("packets=%zu", num_packets);
+	TEST_MSG_ALWAYS("decodes=%zu", num_packets * DECODE_REPS);
+	TEST_MSG_ALWAYS("pairs=%zu", bins_pairs);
+	TEST_MSG_ALWAYS("bins_packets_per_sec=%0.0lf",
+			(num_packets * DECODE_REPS) / (fr_time_delta_unwrap(bins) / (double)NSEC));
+	TEST_MSG_ALWAYS("index_packets_per_sec=%0.0lf",
+			(num_packets * DECODE_REPS) / (fr_time_delta_unwrap(indexed) / (double)NSEC));
+
+	talloc_free(ctx);
+}
+
+TEST_LIST = {
+	{ "decode",	test_decode },
+
+	{ NULL }
+};
@@ -0,0 +1,8 @@
+TARGET		:= radius_decode_perf_test$(E)
+SOURCES		:= radius_decode_perf_test.c
+
+TGT_LDLIBS	:= $(LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS)
+TGT_PREREQS	:= libfreeradius-util$(L) libfreeradius-radius$(L)
+
+TGT_INSTALLDIR	:=
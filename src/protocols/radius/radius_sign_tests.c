@@ -0,0 +1,340 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for batched signing and verification of RADIUS packets
+ *
+ * Batches must produce exactly the same packets and results as
+ * fr_radius_sign() and fr_radius_verify() do one at a time.
+ *
+ * @file src/protocols/radius/radius_sign_tests.c
+ *
+ * @copyright 2025 The FreeRADIUS server project
+ */
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/time.h>
+
+#include "radius.h"
+
+#define TEST_PACKETS	64
+#define TEST_MAX_LEN	256
+
+typedef struct {
+	uint8_t		code;		//!< Packet code.
+	bool		ma;		//!< Whether to add a Message-Authenticator.
+	size_t		data_len;	//!< Length of the User-Name / Reply-Message data.
+} test_packet_t;
+
+/*
+ *	A mix of requests and responses, with and without
+ *	Message-Authenticator, crossing the MD5 block boundaries.
+ */
+static test_packet_t const test_packets[] = {
+	{ FR_RADIUS_CODE_ACCESS_REQUEST,	true,	3 },
+	{ FR_RADIUS_CODE_ACCESS_REQUEST,	false,	17 },
+	{ FR_RADIUS_CODE_ACCESS_ACCEPT,		true,	0 },
+	{ FR_RADIUS_CODE_ACCESS_REJECT,		false,	40 },
+	{ FR_RADIUS_CODE_ACCESS_CHALLENGE,	true,	100 },
+	{ FR_RADIUS_CODE_ACCOUNTING_REQUEST,	false,	25 },
+	{ FR_RADIUS_CODE_ACCOUNTING_REQUEST,	true,	8 },
+	{ FR_RADIUS_CODE_ACCOUNTING_RESPONSE,	false,	0 },
+	{ FR_RADIUS_CODE_COA_REQUEST,		true,	33 },
+	{ FR_RADIUS_CODE_COA_ACK,		false,	2 },
+	{ FR_RADIUS_CODE_DISCONNECT_REQUEST,	false,	120 },
+	{ FR_RADIUS_CODE_DISCONNECT_NAK,	true,	70 },
+	{ FR_RADIUS_CODE_STATUS_SERVER,		true,	0 },
+};
+
+static uint8_t const	test_vector[RADIUS_AUTH_VECTOR_LENGTH] = {
+	0x0f, 0x1e, 0x2d, 0x3c, 0x4b, 0x5a, 0x69, 0x78, 0x87, 0x96, 0xa5, 0xb4, 0xc3, 0xd2, 0xe1, 0xf0
+};
+
+static bool test_is_response(uint8_t code)
+{
+	switch (code) {
+	case FR_RADIUS_CODE_ACCESS_ACCEPT:
+	case FR_RADIUS_CODE_ACCESS_REJECT:
+	case FR_RADIUS_CODE_ACCESS_CHALLENGE:
+	case FR_RADIUS_CODE_ACCOUNTING_RESPONSE:
+	case FR_RADIUS_CODE_COA_ACK:
+	case FR_RADIUS_CODE_COA_NAK:
+	case FR_RADIUS_CODE_DISCONNECT_ACK:
+	case FR_RADIUS_CODE_DISCONNECT_NAK:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/** Build an unsigned packet
+ *
+ * @return the length of the packet.
+ */
+static size_t test_packet_build(uint8_t out[static TEST_MAX_LEN], test_packet_t const *tp, uint8_t id)
+{
+	uint8_t	*p = out + RADIUS_HEADER_LENGTH;
+	size_t	i, len;
+
+	out[0] = tp->code;
+	out[1] = id;
+	for (i = 0; i < RADIUS_AUTH_VECTOR_LENGTH; i++) out[4 + i] = (uint8_t)(id * 31 + i);
+
+	if (tp->data_len) {
+		p[0] = test_is_response(tp->code) ? 18 : 1;	/* Reply-Message or User-Name */
+		p[1] = 2 + tp->data_len;
+		for (i = 0; i < tp->data_len; i++) p[2 + i] = 'a' + ((id + i) % 26);
+		p += p[1];
+	}
+
+	if (tp->ma) {
+		p[0] = FR_MESSAGE_AUTHENTICATOR;
+		p[1] = 18;
+		memset(p + 2, 0xff, RADIUS_AUTH_VECTOR_LENGTH);
+		p += 18;
+	}
+
+	len = p - out;
+	fr_nbo_from_uint16(out + 2, len);
+
+	return len;
+}
+
+/*
+ *	Every packet signed in a batch must be identical to the same
+ *	packet signed with fr_radius_sign().
+ */
+static void test_sign_batch(void)
+{
+	uint8_t			expected[TEST_PACKETS][TEST_MAX_LEN];
+	uint8_t			packets[TEST_PACKETS][TEST_MAX_LEN];
+	fr_radius_sign_batch_t	batch[TEST_PACKETS];
+	char const		*secrets[] = { "testing123", "a-much-longer-shared-secret-for-the-second-client",
+					       "x", "a-secret-which-is-longer-than-the-sixty-four-byte-hmac-block-size!!" };
+	fr_hmac_md5_key_t	*keys[NUM_ELEMENTS(secrets)];
+	size_t			i, len;
+	int			ret;
+
+	for (i = 0; i < NUM_ELEMENTS(secrets); i++) {
+		keys[i] = fr_hmac_md5_key_alloc(NULL, (uint8_t const *) secrets[i], strlen(secrets[i]));
+		TEST_ASSERT(keys[i] != NULL);
+	}
+
+	for (i = 0; i < TEST_PACKETS; i++) {
+		test_packet_t const	*tp = &test_packets[i % NUM_ELEMENTS(test_packets)];
+		char const		*secret = secrets[i % NUM_ELEMENTS(secrets)];
+		uint8_t const		*vector = test_is_response(tp->code) ? test_vector : NULL;
+
+		len = test_packet_build(expected[i], tp, i);
+		memcpy(packets[i], expected[i], len);
+
+		TEST_CHECK(fr_radius_sign(expected[i], vector, (uint8_t const *) secret, strlen(secret)) == 0);
+
+		batch[i] = (fr_radius_sign_batch_t) {
+			.packet = packets[i],
+			.vector = vector,
+			.secret = (uint8_t const *) secret,
+			.secret_len = strlen(secret),
+			.hmac_key = keys[i % NUM_ELEMENTS(secrets)]
+		};
+	}
+
+	/*
+	 *	Sign them in uneven chunks, to exercise partly
+	 *	filled lanes, and single packets.
+	 */
+	for (i = 0, len = 1; i < TEST_PACKETS; i += len, len += 2) {
+		if ((i + len) > TEST_PACKETS) len = TEST_PACKETS - i;
+
+		ret = fr_radius_sign_batch(batch + i, len);
+		TEST_CHECK_RET(ret, 0);
+	}
+
+	for (i = 0; i < TEST_PACKETS; i++) {
+		TEST_CHECK(batch[i].rcode == 0);
+		TEST_CHECK(memcmp(packets[i], expected[i], fr_nbo_to_uint16(expected[i] + 2)) == 0);
+		TEST_MSG("Packet %zu (code %u) differs", i, expected[i][0]);
+	}
+
+	for (i = 0; i < NUM_ELEMENTS(keys); i++) talloc_free(keys[i]);
+}
+
+/*
+ *	Bad packets fail individually, and don't affect the rest of
+ *	the batch.
+ */
+static void test_sign_batch_errors(void)
+{
+	uint8_t			packets[4][TEST_MAX_LEN];
+	uint8_t			expected[TEST_MAX_LEN];
+	fr_radius_sign_batch_t	batch[4];
+	fr_hmac_md5_key_t	*key;
+	char const		*secret = "testing123";
+	size_t			i;
+
+	key = fr_hmac_md5_key_alloc(NULL, (uint8_t const *) secret, strlen(secret));
+	TEST_ASSERT(key != NULL);
+
+	for (i = 0; i < NUM_ELEMENTS(packets); i++) {
+		(void) test_packet_build(packets[i], &(test_packet_t){ FR_RADIUS_CODE_ACCESS_ACCEPT, true, 10 }, i);
+
+		batch[i] = (fr_radius_sign_batch_t) {
+			.packet = packets[i],
+			.vector = test_vector,
+			.secret = (uint8_t const *) secret,
+			.secret_len = strlen(secret),
+			.hmac_key = key
+		};
+	}
+	memcpy(expected, packets[3], sizeof(expected));
+	TEST_CHECK(fr_radius_sign(expected, test_vector, (uint8_t const *) secret, strlen(secret)) == 0);
+
+	batch[0].vector = NULL;				/* Response without a request */
+	packets[1][RADIUS_HEADER_LENGTH + 1] = 0;	/* Invalid attribute length */
+	packets[2][0] = 0;				/* Unknown code */
+
+	TEST_CHECK(fr_radius_sign_batch(batch, NUM_ELEMENTS(batch)) == -3);
+	TEST_CHECK(batch[0].rcode < 0);
+	TEST_CHECK(batch[1].rcode < 0);
+	TEST_CHECK(batch[2].rcode < 0);
+	TEST_CHECK(batch[3].rcode == 0);
+	TEST_CHECK(memcmp(packets[3], expected, fr_nbo_to_uint16(expected + 2)) == 0);
+
+	talloc_free(key);
+}
+
+/*
+ *	Batch verification must give the same result as
+ *	fr_radius_verify() for good and bad packets.
+ */
+static void test_verify_batch(void)
+{
+	uint8_t				packets[TEST_PACKETS][TEST_MAX_LEN];
+	uint8_t				copy[TEST_MAX_LEN];
+	fr_radius_verify_batch_t	batch[TEST_PACKETS];
+	char const			*secret = "testing123";
+	fr_hmac_md5_key_t		*key;
+	size_t				i, len;
+	int				expected_rcode[TEST_PACKETS];
+	int				failed = 0;
+
+	key = fr_hmac_md5_key_alloc(NULL, (uint8_t const *) secret, strlen(secret));
+	TEST_ASSERT(key != NULL);
+
+	for (i = 0; i < TEST_PACKETS; i++) {
+		test_packet_t const	*tp = &test_packets[i % NUM_ELEMENTS(test_packets)];
+		uint8_t const		*vector = test_is_response(tp->code) ? test_vector : NULL;
+
+		len = test_packet_build(packets[i], tp, i);
+		TEST_CHECK(fr_radius_sign(packets[i], vector, (uint8_t const *) secret, strlen(secret)) == 0);
+
+		/*
+		 *	Corrupt some of them, in different places.
+		 */
+		switch (i % 5) {
+		case 1:
+			packets[i][len - 1] ^= 0x01;	/* Message-Authenticator or data */
+			break;
+
+		case 3:
+			packets[i][4] ^= 0x80;		/* Authenticator */
+			break;
+
+		default:
+			break;
+		}
+
+		batch[i] = (fr_radius_verify_batch_t) {
+			.packet = packets[i],
+			.vector = vector,
+			.secret = (uint8_t const *) secret,
+			.secret_len = strlen(secret),
+			.hmac_key = key,
+			.require_message_authenticator = (i % 7) == 0,
+		};
+
+		memcpy(copy, packets[i], len);
+		expected_rcode[i] = fr_radius_verify(copy, vector, (uint8_t const *) secret, strlen(secret),
+						     batch[i].require_message_authenticator, false);
+		if (expected_rcode[i] < 0) failed++;
+	}
+	TEST_CHECK(failed > 0);
+
+	TEST_CHECK(fr_radius_verify_batch(batch, TEST_PACKETS) == -failed);
+
+	for (i = 0; i < TEST_PACKETS; i++) {
+		TEST_CHECK(batch[i].rcode == expected_rcode[i]);
+		TEST_MSG("Packet %zu (code %u) expected %d got %d", i, packets[i][0], expected_rcode[i], batch[i].rcode);
+	}
+
+	talloc_free(key);
+}
+
+/*
+ *	Sign the same packets one at a time, and in batches.
+ */
+static void test_sign_batch_bench(void)
+{
+	uint8_t			packets[TEST_PACKETS][TEST_MAX_LEN];
+	fr_radius_sign_batch_t	batch[TEST_PACKETS];
+	char const		*secret = "testing123-this-is-a-long-shared-secret";
+	fr_hmac_md5_key_t	*key;
+	fr_time_t		start;
+	fr_time_delta_t		single, batched;
+	size_t			i, j, reps = 5000;
+
+	key = fr_hmac_md5_key_alloc(NULL, (uint8_t const *) secret, strlen(secret));
+	TEST_ASSERT(key != NULL);
+
+	for (i = 0; i < TEST_PACKETS; i++) {
+		(void) test_packet_build(packets[i], &(test_packet_t){ FR_RADIUS_CODE_ACCESS_ACCEPT, true, 60 }, i);
+		batch[i] = (fr_radius_sign_batch_t) {
+			.packet = packets[i],
+			.vector = test_vector,
+			.secret = (uint8_t const *) secret,
+			.secret_len = strlen(secret),
+			.hmac_key = key
+		};
+	}
+
+	start = fr_time();
+	for (j = 0; j < reps; j++) {
+		for (i = 0; i < TEST_PACKETS; i++) {
+			(void) fr_radius_sign_with_key(packets[i], test_vector, (uint8_t const *) secret,
+						       strlen(secret), key);
+		}
+	}
+	single = fr_time_sub(fr_time(), start);
+
+	start = fr_time();
+	for (j = 0; j < reps; j++) (void) fr_radius_sign_batch(batch, TEST_PACKETS);
+	batched = fr_time_sub(fr_time(), start);
+
+	TEST_MSG_ALWAYS("engine        %s", fr_md5_mb_engine());
+	TEST_MSG_ALWAYS("single        %"PRIu64" ns/packet", fr_time_delta_unwrap(single) / (reps * TEST_PACKETS));
+	TEST_MSG_ALWAYS("batch         %"PRIu64" ns/packet", fr_time_delta_unwrap(batched) / (reps * TEST_PACKETS));
+
+	talloc_free(key);
+}
+
+TEST_LIST = {
+	{ "sign_batch",			test_sign_batch },
+	{ "sign_batch_errors",		test_sign_batch_errors },
+	{ "verify_batch",		test_verify_batch },
+	{ "sign_batch_bench",		test_sign_batch_bench },
+
+	{ NULL }
+};
@@ -0,0 +1,8 @@
+TARGET		:= radius_sign_tests$(E)
+SOURCES		:= radius_sign_tests.c
+
+TGT_LDLIBS	:= $(LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS)
+TGT_PREREQS	:= libfreeradius-util$(L) libfreeradius-radius$(L)
+
+TGT_INSTALLDIR	:=
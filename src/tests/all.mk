@@ -56,6 +56,7 @@ test: \
 		test.radiusd-c	\
 		test.radclient	\
 		test.detail	\
+		test.detail_binary	\
 		test.radsniff	\
 		test.auth	\
 		test.digest	\
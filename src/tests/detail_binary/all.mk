@@ -0,0 +1,46 @@
+#
+#	Tests for replaying binary detail files.
+#
+#	Each input is a text detail file.  The "write" configuration
+#	replays it, writing every entry to a binary detail file.  A
+#	truncated copy of the first record is then put in front of the
+#	binary file, as happens after an interrupted write, and the
+#	"replay" configuration reads it back, writing every entry it
+#	sees to a text detail file.
+#
+
+#
+#	Test name
+#
+TEST  := test.detail_binary
+FILES := $(subst $(DIR)/,,$(wildcard $(DIR)/*.txt))
+
+$(eval $(call TEST_BOOTSTRAP))
+
+$(OUTPUT)/%: $(DIR)/% $(addprefix ${BUILD_DIR}/lib/,proto_detail.la proto_detail_file.la proto_detail_work.la rlm_detail.la)
+	$(eval DIR := $(dir $<))
+	${Q}echo "DETAIL-BINARY $(notdir $<)"
+	${Q}rm -f $(dir $@)/detail* $(dir $@)/binary* $(dir $@)/processed
+	${Q}cp $< $(dir $@)/detail.txt
+	${Q}if ! $(TEST_BIN)/radiusd -d $(DIR)/config -n write -D ${top_srcdir}/share/dictionary -X > $@.write.log; then \
+		tail $@.write.log; \
+		echo "cp $< $(dir $@)/detail.txt; $(TEST_BIN)/radiusd -d $(DIR)/config -n write -D ${top_srcdir}/share/dictionary -X"; \
+		exit 1; \
+	fi
+	${Q}head -c 40 $(dir $@)/binary > $(dir $@)/binary-detail
+	${Q}cat $(dir $@)/binary >> $(dir $@)/binary-detail
+	${Q}if ! $(TEST_BIN)/radiusd -d $(DIR)/config -n replay -D ${top_srcdir}/share/dictionary -X > $@.log; then \
+		tail $@.log; \
+		echo "$(TEST_BIN)/radiusd -d $(DIR)/config -n replay -D ${top_srcdir}/share/dictionary -X"; \
+		exit 1; \
+	fi
+	${Q}if [ "$$(grep -c '^	User-Name = ' $(dir $@)/processed)" != "$$(grep -c '^	User-Name = ' $<)" ]; then \
+		tail $@.log; \
+		echo "Replaying binary entries from $< did not produce the expected output in $(dir $@)/processed"; \
+		exit 1; \
+	fi
+	${Q}touch $@
+
+.NO_PARALLEL: $(TEST)
+$(TEST):
+	@touch $(BUILD_DIR)/tests/$@
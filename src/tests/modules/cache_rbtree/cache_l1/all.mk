@@ -0,0 +1,3 @@
+#
+# Test the L1 tier of the "cache" module
+#
@@ -1,6 +1,6 @@
 #
 #  Test the "kafka" module
 #
-
-# Don't test kafka if KAFKA_TEST_SERVER ENV is not set
-kafka_require_test_server := 1
+#  Messages are produced to librdkafka's mock cluster, so
+#  no test server is required.
+#
@@ -0,0 +1,16 @@
+import freeradius
+
+
+def recv(p):
+    #
+    #  Enough work that the time is spent in Python, and not in
+    #  the server.
+    #
+    total = 0
+    for i in range(2000):
+        total += i * i
+
+    if total < 0:
+        return freeradius.RLM_MODULE_FAIL
+
+    return freeradius.RLM_MODULE_OK
@@ -32,6 +32,11 @@ CLIENT := radmin
 include src/tests/radiusd.mk
 $(eval $(call RADIUSD_SERVICE,control-socket,$(OUTPUT)))
 
+#
+#  Modules loaded by the server's configuration.
+#
+$(OUTPUT)/radiusd.pid: $(addprefix $(BUILD_DIR)/lib/local/,rlm_cache.la rlm_cache_rbtree.la process_radius.la)
+
 #
 #  For each file, look for precursor test.
 #  Ensure that each test depends on its precursors.